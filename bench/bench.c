@@ -0,0 +1,433 @@
+/*
+ * Microsemi Switchtec(tm) PCIe Management Library
+ * Copyright (c) 2017, Microsemi Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * Microbenchmarks for the library's hot paths, run by "make bench".
+ *
+ * The host-only benchmarks (CRCs and log parsing) always run. Device
+ * benchmarks run once for every -d option, so the same device can be
+ * measured over several transports in one run. Each result is printed
+ * as one JSON object per line:
+ *
+ *   {"bench":"echo","device":"/dev/switchtec0","iters":N,
+ *    "ns_per_op":X,"ops_per_sec":Y,"bytes_per_sec":Z}
+ *
+ * bytes_per_sec is only present for benchmarks that move data.
+ */
+
+#include "lib/crc.h"
+#include <switchtec/switchtec.h>
+#include <switchtec/gas.h>
+#include <switchtec/log.h>
+#include <switchtec/registers.h>
+#include <switchtec/utils.h>
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_MAX_DEVICES 16
+
+#define CRC32_BUF_LEN (64 * 1024)
+#define CRC8_BUF_LEN (4 * 1024)
+#define GAS_COPY_LEN 4096
+#define LOG_ENTRIES 100000
+#define LOG_MODULES 8
+#define LOG_MODULE_ENTRIES 32
+
+struct bench {
+	const char *name;
+	const char *device;
+	size_t bytes_per_op;
+	int (*run)(void *ctx);
+	void *ctx;
+};
+
+static double min_time = 0.5;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void json_str(const char *s)
+{
+	putchar('"');
+	for (; *s; s++) {
+		if (*s == '"' || *s == '\\')
+			putchar('\\');
+		putchar(*s);
+	}
+	putchar('"');
+}
+
+/*
+ * Run a benchmark until min_time has passed, doubling the batch of
+ * iterations between clock reads so cheap operations are not swamped
+ * by the timer.
+ */
+static int bench_run(struct bench *b)
+{
+	unsigned long long iters = 0, batch = 1, i;
+	double start, elapsed;
+	int ret;
+
+	ret = b->run(b->ctx);
+	if (ret) {
+		fprintf(stderr, "%s: %s: %s\n", b->device ? b->device : "host",
+			b->name, strerror(errno));
+		return ret;
+	}
+
+	start = now();
+	do {
+		for (i = 0; i < batch; i++) {
+			ret = b->run(b->ctx);
+			if (ret) {
+				fprintf(stderr, "%s: %s: %s\n",
+					b->device ? b->device : "host",
+					b->name, strerror(errno));
+				return ret;
+			}
+		}
+
+		iters += batch;
+		elapsed = now() - start;
+		if (batch < (1 << 20))
+			batch *= 2;
+	} while (elapsed < min_time);
+
+	printf("{\"bench\":");
+	json_str(b->name);
+	if (b->device) {
+		printf(",\"device\":");
+		json_str(b->device);
+	}
+	printf(",\"iters\":%llu,\"ns_per_op\":%.1f,\"ops_per_sec\":%.1f",
+	       iters, elapsed * 1e9 / iters, iters / elapsed);
+	if (b->bytes_per_op)
+		printf(",\"bytes_per_sec\":%.0f",
+		       b->bytes_per_op * iters / elapsed);
+	printf("}\n");
+	fflush(stdout);
+
+	return 0;
+}
+
+static uint8_t crc_buf[CRC32_BUF_LEN];
+
+static int run_crc32(void *ctx)
+{
+	volatile uint32_t crc;
+
+	crc = crc32(crc_buf, sizeof(crc_buf), 0, 1, 1);
+	(void)crc;
+	return 0;
+}
+
+static int run_crc8(void *ctx)
+{
+	volatile uint8_t crc;
+
+	crc = crc8(crc_buf, CRC8_BUF_LEN, 0, true);
+	(void)crc;
+	return 0;
+}
+
+struct log_ctx {
+	FILE *bin;
+	FILE *defs;
+	FILE *out;
+};
+
+/*
+ * Build an app log of LOG_ENTRIES entries spread over LOG_MODULES
+ * modules, with a definition file whose format strings use every
+ * argument, so the parse exercises decoding and formatting alike.
+ */
+static int log_setup(struct log_ctx *ctx)
+{
+	struct log_a_data e;
+	int i, j;
+
+	ctx->bin = tmpfile();
+	ctx->defs = tmpfile();
+	ctx->out = tmpfile();
+	if (!ctx->bin || !ctx->defs || !ctx->out)
+		return -1;
+
+	fprintf(ctx->defs, "# SDK Version: 0x0\n# FW Version: 0x0\n");
+	for (i = 0; i < LOG_MODULES; i++) {
+		fprintf(ctx->defs, "MOD_%d %d %d\n", i, i + 1,
+			LOG_MODULE_ENTRIES);
+		for (j = 0; j < LOG_MODULE_ENTRIES; j++)
+			fprintf(ctx->defs,
+				"entry %d: a=%%d b=0x%%x c=%%d d=%%x e=%%d\n",
+				j);
+	}
+
+	for (i = 0; i < LOG_ENTRIES; i++) {
+		e.data[0] = 0;
+		e.data[1] = i * 1000;
+		e.data[2] = (3u << 28) | ((i % LOG_MODULES + 1) << 16) |
+			    (i % LOG_MODULE_ENTRIES);
+		for (j = 3; j < 8; j++)
+			e.data[j] = i * j;
+		fwrite(&e, sizeof(e), 1, ctx->bin);
+	}
+
+	if (fflush(ctx->bin) || fflush(ctx->defs))
+		return -1;
+
+	return 0;
+}
+
+static int run_parse_log(void *arg)
+{
+	struct log_ctx *ctx = arg;
+	int ret;
+
+	rewind(ctx->bin);
+	rewind(ctx->defs);
+	rewind(ctx->out);
+
+	ret = switchtec_parse_log(ctx->bin, ctx->defs, ctx->out,
+				  SWITCHTEC_LOG_PARSE_TYPE_APP,
+				  SWITCHTEC_GEN4, NULL);
+	return ret < 0 ? ret : 0;
+}
+
+struct dev_ctx {
+	struct switchtec_dev *dev;
+	gasptr_t gas;
+	struct switchtec_status *status;
+	int nr_ports;
+	int *port_ids;
+	struct switchtec_bwcntr_res *bw;
+	uint8_t buf[GAS_COPY_LEN];
+};
+
+static int run_echo(void *arg)
+{
+	struct dev_ctx *ctx = arg;
+	uint32_t out;
+
+	return switchtec_echo(ctx->dev, 0x5a5a5a5a, &out);
+}
+
+static int run_gas_read32(void *arg)
+{
+	struct dev_ctx *ctx = arg;
+	uint32_t val;
+
+	return gas_read32(ctx->dev, &ctx->gas->sys_info.device_id, &val);
+}
+
+static int run_memcpy_from_gas(void *arg)
+{
+	struct dev_ctx *ctx = arg;
+
+	return memcpy_from_gas(ctx->dev, ctx->buf, &ctx->gas->sys_info,
+			       sizeof(ctx->buf));
+}
+
+static int run_status(void *arg)
+{
+	struct dev_ctx *ctx = arg;
+	struct switchtec_status *status;
+	int ret;
+
+	ret = switchtec_status(ctx->dev, &status);
+	if (ret < 0)
+		return ret;
+
+	switchtec_status_free(status, ret);
+	return 0;
+}
+
+static int run_bwcntr_many(void *arg)
+{
+	struct dev_ctx *ctx = arg;
+	int ret;
+
+	ret = switchtec_bwcntr_many(ctx->dev, ctx->nr_ports, ctx->port_ids,
+				    0, ctx->bw);
+	return ret < 0 ? ret : 0;
+}
+
+static int bench_device(const char *name)
+{
+	struct dev_ctx *ctx;
+	int i, errs = 0;
+	struct bench benches[] = {
+		{ "echo", name, 0, run_echo },
+		{ "gas_read32", name, sizeof(uint32_t), run_gas_read32 },
+		{ "memcpy_from_gas", name, GAS_COPY_LEN,
+			run_memcpy_from_gas },
+		{ "status", name, 0, run_status },
+		{ "bwcntr_many", name, 0, run_bwcntr_many },
+	};
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return -1;
+
+	ctx->dev = switchtec_open(name);
+	if (!ctx->dev) {
+		switchtec_perror(name);
+		free(ctx);
+		return -1;
+	}
+
+	ctx->gas = switchtec_gas_map(ctx->dev, 0, NULL);
+	if (ctx->gas == SWITCHTEC_MAP_FAILED) {
+		switchtec_perror("gas_map");
+		ctx->gas = NULL;
+	}
+
+	ctx->nr_ports = switchtec_status(ctx->dev, &ctx->status);
+	if (ctx->nr_ports > 0) {
+		ctx->port_ids = calloc(ctx->nr_ports, sizeof(*ctx->port_ids));
+		ctx->bw = calloc(ctx->nr_ports, sizeof(*ctx->bw));
+		for (i = 0; ctx->port_ids && i < ctx->nr_ports; i++)
+			ctx->port_ids[i] = ctx->status[i].port.phys_id;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(benches); i++) {
+		benches[i].ctx = ctx;
+
+		if (!ctx->gas && (benches[i].run == run_gas_read32 ||
+				  benches[i].run == run_memcpy_from_gas))
+			continue;
+		if ((!ctx->port_ids || !ctx->bw) &&
+		    benches[i].run == run_bwcntr_many)
+			continue;
+
+		if (bench_run(&benches[i]))
+			errs++;
+	}
+
+	free(ctx->port_ids);
+	free(ctx->bw);
+	if (ctx->nr_ports > 0)
+		switchtec_status_free(ctx->status, ctx->nr_ports);
+	if (ctx->gas)
+		switchtec_gas_unmap(ctx->dev, ctx->gas);
+	switchtec_close(ctx->dev);
+	free(ctx);
+
+	return errs ? -1 : 0;
+}
+
+static int bench_host(void)
+{
+	struct log_ctx log = {};
+	int i, errs = 0;
+	struct bench benches[] = {
+		{ "crc32", NULL, sizeof(crc_buf), run_crc32 },
+		{ "crc8", NULL, CRC8_BUF_LEN, run_crc8 },
+		{ "parse_log", NULL, LOG_ENTRIES * sizeof(struct log_a_data),
+			run_parse_log, &log },
+	};
+
+	for (i = 0; i < sizeof(crc_buf); i++)
+		crc_buf[i] = i * 31 + 7;
+
+	if (log_setup(&log)) {
+		perror("log setup");
+		errs++;
+	}
+
+	for (i = 0; i < ARRAY_SIZE(benches); i++) {
+		if (benches[i].run == run_parse_log && errs)
+			continue;
+		if (bench_run(&benches[i]))
+			errs++;
+	}
+
+	if (log.bin)
+		fclose(log.bin);
+	if (log.defs)
+		fclose(log.defs);
+	if (log.out)
+		fclose(log.out);
+
+	return errs ? -1 : 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-H] [-t SECONDS] [-d DEVICE]...\n"
+		"\n"
+		"  -d DEVICE   benchmark a device; may be given once per\n"
+		"              transport to compare them\n"
+		"  -H          skip the host-only benchmarks\n"
+		"  -t SECONDS  minimum time per benchmark (default 0.5)\n",
+		prog);
+}
+
+int main(int argc, char **argv)
+{
+	const char *devices[BENCH_MAX_DEVICES];
+	int nr_devices = 0, host = 1, errs = 0;
+	int i, opt;
+
+	while ((opt = getopt(argc, argv, "d:Ht:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			if (nr_devices == BENCH_MAX_DEVICES) {
+				fprintf(stderr, "too many devices\n");
+				return 1;
+			}
+			devices[nr_devices++] = optarg;
+			break;
+		case 'H':
+			host = 0;
+			break;
+		case 't':
+			min_time = atof(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return opt != 'h';
+		}
+	}
+
+	if (host && bench_host())
+		errs++;
+
+	for (i = 0; i < nr_devices; i++)
+		if (bench_device(devices[i]))
+			errs++;
+
+	return errs ? 1 : 0;
+}
@@ -55,6 +55,52 @@ static argconfig_help_func *help_funcs[MAX_HELP_FUNC] = { NULL };
 
 static char append_usage_str[100] = "";
 
+/*
+ * In batch mode several commands are parsed by one process, so the
+ * static config structures they parse into have to be reset to their
+ * initial values every time and a bad command line must not exit.
+ */
+static jmp_buf *batch_env;
+
+struct cfg_default {
+	const char *desc;
+	void *config;
+	size_t size;
+	struct cfg_default *next;
+	char data[];
+};
+
+static struct cfg_default *cfg_defaults;
+
+void argconfig_set_batch(jmp_buf *env)
+{
+	batch_env = env;
+}
+
+static void restore_config(const char *desc, void *config, size_t size)
+{
+	struct cfg_default *d;
+
+	for (d = cfg_defaults; d; d = d->next) {
+		if (d->config == config && d->desc == desc &&
+		    d->size == size) {
+			memcpy(config, d->data, size);
+			return;
+		}
+	}
+
+	d = malloc(sizeof(*d) + size);
+	if (!d)
+		return;
+
+	d->desc = desc;
+	d->config = config;
+	d->size = size;
+	memcpy(d->data, config, size);
+	d->next = cfg_defaults;
+	cfg_defaults = d;
+}
+
 void argconfig_append_usage(const char *str)
 {
 	strncat(append_usage_str, str, sizeof(append_usage_str) -
@@ -972,6 +1018,9 @@ int argconfig_parse(int argc, char *argv[], const char *program_desc,
 	void *value_addr;
 
 	errno = 0;
+	if (batch_env && config_out && config_size)
+		restore_config(program_desc, config_out, config_size);
+
 	options_count = num_options(options);
 	long_opts = malloc(sizeof(struct option) * (options_count + 2));
 	short_opts = malloc(sizeof(*short_opts) * (options_count * 3 + 4));
@@ -1085,6 +1134,8 @@ int argconfig_parse(int argc, char *argv[], const char *program_desc,
  exit:
 	free(short_opts);
 	free(long_opts);
+	if (batch_env)
+		longjmp(*batch_env, 1);
 	exit(1);
 }
 
@@ -40,6 +40,7 @@
 #include <string.h>
 #include <getopt.h>
 #include <stdarg.h>
+#include <setjmp.h>
 
 enum {
 	optional_positional = 20,
@@ -123,6 +124,7 @@ void argconfig_print_usage(const struct argconfig_options *options);
 void argconfig_print_help(const char *program_desc,
 			  const struct argconfig_options *options);
 void argconfig_register_help_func(argconfig_help_func * f);
+void argconfig_set_batch(jmp_buf *env);
 
 void print_word_wrapped(const char *s, int indent, int start);
 
@@ -33,6 +33,7 @@
 
 static struct subcommand *subcmd_default;
 static struct subcommand *subcmd_list;
+static const struct prog_info *cur_prog_info;
 
 void commands_register(struct subcommand *s)
 {
@@ -252,6 +253,19 @@ static int do_command(int argc, char **argv, struct subcommand *subcmd,
 int commands_handle(int argc, char **argv, struct prog_info *prog_info)
 {
 	prog_info->exe = argv[0];
+	cur_prog_info = prog_info;
 
 	return do_command(argc - 1, &argv[1], subcmd_default, prog_info);
 }
+
+/*
+ * Run another command from within the one started by commands_handle().
+ * argv[0] is the command name, as it would follow the program name on
+ * the command line.
+ */
+int commands_run(int argc, char **argv)
+{
+	argconfig_reset_usage();
+
+	return do_command(argc, argv, subcmd_default, cur_prog_info);
+}
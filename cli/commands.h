@@ -56,5 +56,6 @@ struct prog_info {
 
 void commands_register(struct subcommand *subcmd);
 int commands_handle(int argc, char **argv, struct prog_info *prog_info);
+int commands_run(int argc, char **argv);
 
 #endif
@@ -31,10 +31,13 @@
 
 #include <switchtec/switchtec.h>
 #include <switchtec/utils.h>
+#include <switchtec/endian.h>
+#include <switchtec/serdes.h>
 
 #include <limits.h>
 #include <locale.h>
 #include <math.h>
+#include <signal.h>
 #include <stdio.h>
 #include <unistd.h>
 
@@ -144,7 +147,7 @@ static int ltssm_log(int argc, char **argv) {
 		return 0;
 	}
 	port = cfg.port_id;
-	log_count = sizeof(output);
+	log_count = ARRAY_SIZE(output);
 	ret = switchtec_diag_ltssm_log(cfg.dev, port, &log_count, output);
 	if (ret) {
 		switchtec_perror("ltssm_log");
@@ -163,6 +166,150 @@ static int ltssm_log(int argc, char **argv) {
 	return ret;
 }
 
+static volatile sig_atomic_t ltssm_watch_stop;
+
+static void ltssm_watch_sig(int sig)
+{
+	ltssm_watch_stop = 1;
+}
+
+static void ltssm_watch_print(void *arg,
+			      const struct switchtec_diag_ltssm_capture_entry *ent,
+			      int count)
+{
+	FILE *out = arg;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (ent[i].gap)
+			fprintf(out, "# Port %d: log wrapped, some entries were lost\n",
+				ent[i].port);
+
+		fprintf(out, "%llu.%06llu\t%d\t%02x%08x\t%.1fG\t\t%s\n",
+			(unsigned long long)ent[i].host_time_us / 1000000,
+			(unsigned long long)ent[i].host_time_us % 1000000,
+			ent[i].port, ent[i].log.timestamp_high,
+			ent[i].log.timestamp, ent[i].log.link_rate,
+			switchtec_ltssm_str(ent[i].log.link_state, 1));
+	}
+}
+
+static int ltssm_watch_ports(struct switchtec_dev *dev, const char *list,
+			     int *ports, int max_ports)
+{
+	struct switchtec_status *status;
+	char *buf, *tok;
+	int i, n = 0;
+
+	if (list) {
+		buf = strdup(list);
+		if (!buf)
+			return -1;
+
+		for (tok = strtok(buf, ","); tok && n < max_ports;
+		     tok = strtok(NULL, ","))
+			ports[n++] = atoi(tok);
+
+		free(buf);
+		return n;
+	}
+
+	n = switchtec_status(dev, &status);
+	if (n < 0)
+		return n;
+
+	if (n > max_ports)
+		n = max_ports;
+
+	for (i = 0; i < n; i++)
+		ports[i] = status[i].port.phys_id;
+
+	switchtec_status_free(status, n);
+	return n;
+}
+
+#define CMD_DESC_LTSSM_WATCH "Stream the LTSSM logs of several ports"
+static int ltssm_watch(int argc, char **argv)
+{
+	struct switchtec_diag_ltssm_capture *cap;
+	int ports[SWITCHTEC_MAX_PORTS];
+	int num_ports, ret = 0;
+
+	static struct {
+		struct switchtec_dev *dev;
+		const char *ports;
+		unsigned interval;
+		FILE *out;
+		const char *out_filename;
+	} cfg = {
+		.interval = 100,
+	};
+	const struct argconfig_options opts[] = {
+		DEVICE_OPTION,
+		{"ports", 'p', "LIST", CFG_STRING, &cfg.ports,
+		 required_argument,
+		 "comma separated list of physical port IDs to watch (default: all ports)"},
+		{"interval", 'i', "MS", CFG_POSITIVE, &cfg.interval,
+		 required_argument,
+		 "interval between dumps of each log in ms (default: 100)"},
+		{"output", 'o', "FILE", CFG_FILE_W, &cfg.out,
+		 required_argument,
+		 "file to write the log to (default: stdout)"},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_LTSSM_WATCH, opts, &cfg,
+			sizeof(cfg));
+
+	if (!cfg.out)
+		cfg.out = stdout;
+
+	num_ports = ltssm_watch_ports(cfg.dev, cfg.ports, ports,
+				      ARRAY_SIZE(ports));
+	if (num_ports < 0) {
+		switchtec_perror("ltssm_watch");
+		return -1;
+	} else if (!num_ports) {
+		fprintf(stderr, "No ports to watch\n");
+		return -1;
+	}
+
+	cap = switchtec_diag_ltssm_capture_start(cfg.dev, ports, num_ports);
+	if (!cap) {
+		switchtec_perror("ltssm_watch");
+		return -1;
+	}
+
+	ltssm_watch_stop = 0;
+	signal(SIGINT, ltssm_watch_sig);
+	signal(SIGTERM, ltssm_watch_sig);
+
+	fprintf(cfg.out, "Host Time\t\tPort\tDelta Time\tPCIe Rate\tState\n");
+
+	while (!ltssm_watch_stop) {
+		ret = switchtec_diag_ltssm_capture_poll(cap, ltssm_watch_print,
+							cfg.out);
+		if (ret) {
+			switchtec_perror("ltssm_watch");
+			break;
+		}
+
+		fflush(cfg.out);
+
+		if (cfg.interval >= 1000)
+			sleep(cfg.interval / 1000);
+		usleep((cfg.interval % 1000) * 1000);
+	}
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	switchtec_diag_ltssm_capture_free(cap);
+	if (cfg.out != stdout)
+		fclose(cfg.out);
+
+	return ret;
+}
+
 static const struct argconfig_choice eye_modes[] = {
 	{"RAW", SWITCHTEC_DIAG_EYE_RAW,
 	 "raw data mode (slow, more accurate)"},
@@ -175,6 +322,7 @@ enum output_format {
 	FMT_CSV,
 	FMT_TEXT,
 	FMT_CURSES,
+	FMT_BIN,
 };
 
 static const struct argconfig_choice output_fmt_choices[] = {
@@ -188,6 +336,8 @@ static const struct argconfig_choice output_fmt_choices[] = {
 #endif
 	{"text", FMT_TEXT, "Display data in a simplified text format"},
 	{"csv", FMT_CSV, "Raw Data in CSV format"},
+	{"bin", FMT_BIN, "Raw Data in compact binary format (eye only)"},
+	{}
 };
 
 static double *load_eye_csv(FILE *f, struct range *X, struct range *Y,
@@ -375,6 +525,192 @@ static void write_eye_csv_files(int port_id, int lane_id, int num_lanes,
 	}
 }
 
+#define EYE_BIN_MAGIC "SWTCEYE1"
+
+/*
+ * Compact eye capture file: this header followed by the pixels as
+ * little endian float32, row by row. All header fields are little
+ * endian.
+ */
+struct eye_bin_hdr {
+	char magic[8];
+	uint32_t pixel_size;
+	int32_t port;
+	int32_t lane;
+	int32_t gen;
+	int32_t interval;
+	int32_t x_start, x_end, x_step;
+	int32_t y_start, y_end, y_step;
+	uint32_t rsvd;
+};
+
+static int write_eye_bin(FILE *f, int port, int lane, int gen,
+			 int interval, struct range *X, struct range *Y,
+			 double *pixels)
+{
+	size_t i, cnt = RANGE_CNT(X) * RANGE_CNT(Y);
+	struct eye_bin_hdr hdr = {
+		.magic = EYE_BIN_MAGIC,
+		.pixel_size = htole32(sizeof(float)),
+		.port = htole32(port),
+		.lane = htole32(lane),
+		.gen = htole32(gen),
+		.interval = htole32(interval),
+		.x_start = htole32(X->start),
+		.x_end = htole32(X->end),
+		.x_step = htole32(X->step),
+		.y_start = htole32(Y->start),
+		.y_end = htole32(Y->end),
+		.y_step = htole32(Y->step),
+	};
+	uint32_t buf[512];
+	size_t n = 0;
+	float v;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+		return -1;
+
+	for (i = 0; i < cnt; i++) {
+		v = pixels[i];
+		memcpy(&buf[n], &v, sizeof(v));
+		buf[n] = htole32(buf[n]);
+
+		if (++n == ARRAY_SIZE(buf) || i == cnt - 1) {
+			if (fwrite(buf, sizeof(*buf), n, f) != n)
+				return -1;
+			n = 0;
+		}
+	}
+
+	return 0;
+}
+
+static void write_eye_bin_files(int port_id, int lane_id, int num_lanes,
+				int interval_ms, int gen, struct range *X,
+				struct range *Y, double *pixels)
+{
+	int stride = RANGE_CNT(X) * RANGE_CNT(Y);
+	char fname[128];
+	FILE *f;
+	int l;
+
+	for (l = 0; l < num_lanes; l++) {
+		snprintf(fname, sizeof(fname), "eye_port%d_lane%d.eye",
+			 port_id, lane_id + l);
+		f = fopen(fname, "wb");
+		if (!f) {
+			fprintf(stderr, "Unable to write eye file '%s': %m\n",
+				fname);
+			continue;
+		}
+
+		if (write_eye_bin(f, port_id, lane_id + l, gen, interval_ms,
+				  X, Y, &pixels[l * stride])) {
+			fprintf(stderr, "Unable to write eye file '%s': %m\n",
+				fname);
+			fclose(f);
+			continue;
+		}
+
+		fclose(f);
+
+		fprintf(stderr, "Wrote %s\n", fname);
+	}
+}
+
+static int eye_bin_range(struct range *r, int32_t start, int32_t end,
+			 int32_t step, int min, int max)
+{
+	r->start = le32toh(start);
+	r->end = le32toh(end);
+	r->step = le32toh(step);
+
+	if (r->start < min || r->end > max || r->end < r->start ||
+	    r->step <= 0)
+		return -1;
+
+	return 0;
+}
+
+static double *load_eye_bin(FILE *f, struct range *X, struct range *Y,
+			    char *title, size_t title_sz, int *interval)
+{
+	struct eye_bin_hdr hdr;
+	double *pixels, d;
+	uint32_t raw, psize;
+	uint64_t raw64;
+	size_t i, cnt;
+	float v;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1)
+		return NULL;
+
+	if (memcmp(hdr.magic, EYE_BIN_MAGIC, sizeof(hdr.magic)))
+		return NULL;
+
+	psize = le32toh(hdr.pixel_size);
+	if (psize != sizeof(float) && psize != sizeof(double))
+		return NULL;
+
+	if (eye_bin_range(X, hdr.x_start, hdr.x_end, hdr.x_step, 0, 63) ||
+	    eye_bin_range(Y, hdr.y_start, hdr.y_end, hdr.y_step, -255, 255))
+		return NULL;
+
+	*interval = le32toh(hdr.interval);
+	snprintf(title, title_sz, "Eye Observation, Port %d, Lane %d, Gen %d",
+		 (int)le32toh(hdr.port), (int)le32toh(hdr.lane),
+		 (int)le32toh(hdr.gen));
+
+	cnt = RANGE_CNT(X) * RANGE_CNT(Y);
+	pixels = calloc(cnt, sizeof(*pixels));
+	if (!pixels) {
+		perror("allocating pixels");
+		return NULL;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		if (psize == sizeof(double)) {
+			if (fread(&raw64, sizeof(raw64), 1, f) != 1)
+				goto out_err;
+			raw64 = le64toh(raw64);
+			memcpy(&d, &raw64, sizeof(d));
+			pixels[i] = d;
+			continue;
+		}
+
+		if (fread(&raw, sizeof(raw), 1, f) != 1)
+			goto out_err;
+		raw = le32toh(raw);
+		memcpy(&v, &raw, sizeof(v));
+		pixels[i] = v;
+	}
+
+	return pixels;
+
+out_err:
+	free(pixels);
+	return NULL;
+}
+
+/*
+ * Load an earlier capture, in either the binary format (detected by its
+ * magic) or CSV.
+ */
+static double *load_eye_file(FILE *f, struct range *X, struct range *Y,
+			     char *title, size_t title_sz, int *interval)
+{
+	char magic[sizeof(EYE_BIN_MAGIC) - 1];
+
+	if (fread(magic, sizeof(magic), 1, f) == 1 &&
+	    !memcmp(magic, EYE_BIN_MAGIC, sizeof(magic))) {
+		rewind(f);
+		return load_eye_bin(f, X, Y, title, title_sz, interval);
+	}
+
+	rewind(f);
+	return load_eye_csv(f, X, Y, title, title_sz, interval);
+}
+
 static void eye_graph_data(struct range *X, struct range *Y, double *pixels,
 			   int *data, int *shades)
 {
@@ -728,65 +1064,40 @@ static int crosshair_graph(struct switchtec_dev *dev,
 static int crosshair_capture(struct switchtec_dev *dev, int lane,
 		struct switchtec_diag_cross_hair *ch, const char *title)
 {
-	int ret, i, num_lanes, l, n;
+	int lanes[SWITCHTEC_MAX_LANES];
+	int ret, i, num_lanes;
 	char status[100];
 
 	fprintf(stderr, "Capturing %s\n", title);
 
 	if (lane == SWITCHTEC_DIAG_CROSS_HAIR_ALL_LANES) {
-		lane = 0;
 		num_lanes = SWITCHTEC_MAX_LANES;
+		for (i = 0; i < num_lanes; i++)
+			lanes[i] = i;
 	} else {
 		num_lanes = 1;
+		lanes[0] = lane;
 	}
 
-	while (true) {
-		usleep(100000);
-
-		for (l = 0; l < num_lanes;
-		     l += SWITCHTEC_DIAG_CROSS_HAIR_MAX_LANES) {
-			n = num_lanes - l;
-			if (n > SWITCHTEC_DIAG_CROSS_HAIR_MAX_LANES)
-				n = SWITCHTEC_DIAG_CROSS_HAIR_MAX_LANES;
-
-			ret = switchtec_diag_cross_hair_get(dev, lane + l, n,
-							    ch + l);
-			if (ret) {
-				switchtec_perror("Unable to get cross hair");
-				return -1;
-			}
-		}
+	progress_start();
+	ret = switchtec_diag_cross_hair_run(dev, lanes, num_lanes, ch,
+					    progress_update_norate);
+	progress_finish(ret != 0);
+	if (ret) {
+		switchtec_perror("Unable to get cross hair");
+		return -1;
+	}
 
-		for (i = 0; i < num_lanes; i++) {
-			if (ch[i].state == SWITCHTEC_DIAG_CROSS_HAIR_DISABLED ||
-			    ch[i].state == SWITCHTEC_DIAG_CROSS_HAIR_DONE)
-				continue;
+	for (i = 0; i < num_lanes; i++) {
+		if (ch[i].state == SWITCHTEC_DIAG_CROSS_HAIR_ERROR) {
 			crosshair_set_status(NULL, &ch[i], status);
-			fprintf(stderr, "\rLane %-2d  %-60s\r",
-				ch[i].lane_id, status);
-		}
-
-		for (i = 0; i < num_lanes; i++) {
-			if (ch[i].state == SWITCHTEC_DIAG_CROSS_HAIR_ERROR) {
-				crosshair_set_status(NULL, &ch[i], status);
-				fprintf(stderr, "\rLane %-2d  %-60s\n",
-					ch[i].lane_id, status);
-				return -1;
-			}
+			fprintf(stderr, "Lane %-2d  %s\n", ch[i].lane_id,
+				status);
+			ret = -1;
 		}
-
-		for (i = 0; i < num_lanes; i++) {
-			if (ch[i].state != SWITCHTEC_DIAG_CROSS_HAIR_DISABLED &&
-			    ch[i].state != SWITCHTEC_DIAG_CROSS_HAIR_DONE)
-				break;
-		}
-
-		if (i == num_lanes)
-			break;
 	}
 
-	fprintf(stderr, "\r%-60s\r", "");
-	return 0;
+	return ret;
 }
 
 static const struct crosshair_chars *crosshair_text_chars(void)
@@ -857,17 +1168,23 @@ static void crosshair_set_title(char *title, int port, int lane, int gen)
 static void crosshair_write_all_csv(struct switchtec_dev *dev,
 				    struct switchtec_diag_cross_hair *ch)
 {
-	struct switchtec_status status;
+	const struct switchtec_topo *topo;
 	char fname[100], title[100];
 	int i, port, lane, rc;
 	FILE *f;
 
+	topo = switchtec_topo(dev);
+	if (!topo) {
+		switchtec_perror("topology");
+		return;
+	}
+
 	for (i = 0; i < SWITCHTEC_MAX_LANES; i++) {
 		if (ch[i].state != SWITCHTEC_DIAG_CROSS_HAIR_DONE)
 			continue;
 
-		rc = switchtec_calc_port_lane(dev, ch[i].lane_id, &port, &lane,
-					      &status);
+		rc = switchtec_topo_port_lane(topo, ch[i].lane_id, &port,
+					      &lane);
 		if (rc) {
 			fprintf(stderr,
 				"Unable to get port information for lane: %d\n",
@@ -884,7 +1201,8 @@ static void crosshair_write_all_csv(struct switchtec_dev *dev,
 			continue;
 		}
 
-		crosshair_set_title(title, port, lane, status.link_rate);
+		crosshair_set_title(title, port, lane,
+			switchtec_topo_find_port(topo, port)->link_rate);
 		crosshair_csv(f, &ch[i], title);
 		fclose(f);
 		fprintf(stderr, "Wrote %s\n", fname);
@@ -1032,12 +1350,18 @@ static int crosshair(int argc, char **argv)
 	argconfig_parse(argc, argv, CMD_DESC_CROSS_HAIR, opts, &cfg,
 			sizeof(cfg));
 
+	if (cfg.fmt == FMT_BIN) {
+		fprintf(stderr,
+			"--format/-f bin is only supported for eye captures\n");
+		return -1;
+	}
+
 	if (cfg.plot_file) {
-		pixels = load_eye_csv(cfg.plot_file, &cfg.x_range,
+		pixels = load_eye_file(cfg.plot_file, &cfg.x_range,
 				&cfg.y_range, subtitle, sizeof(subtitle),
 				&eye_interval);
 		if (!pixels) {
-			fprintf(stderr, "Unable to parse CSV file: %s\n",
+			fprintf(stderr, "Unable to parse eye file: %s\n",
 				cfg.plot_filename);
 			return -1;
 		}
@@ -1109,18 +1433,18 @@ static int crosshair(int argc, char **argv)
 		else
 			snprintf(title, sizeof(title) - 1, "%s", subtitle);
 
-		switchtec_diag_cross_hair_disable(cfg.dev);
-
-		ret = switchtec_diag_cross_hair_enable(cfg.dev, lane);
-		if (ret) {
-			switchtec_perror("Unable to enable cross hair");
-			goto out;
-		}
-
 		if (cfg.fmt != FMT_CURSES) {
 			ret = crosshair_capture(cfg.dev, lane, ch, title);
 			if (ret)
-				return ret;
+				goto out;
+		} else {
+			switchtec_diag_cross_hair_disable(cfg.dev);
+
+			ret = switchtec_diag_cross_hair_enable(cfg.dev, lane);
+			if (ret) {
+				switchtec_perror("Unable to enable cross hair");
+				goto out;
+			}
 		}
 	}
 
@@ -1154,12 +1478,11 @@ static double *eye_observe_dev(struct switchtec_dev *dev, int port_id,
 {
 	size_t stride = RANGE_CNT(X) * RANGE_CNT(Y);
 	size_t pixel_cnt = stride * num_lanes;
+	struct switchtec_diag_eye_session *sess;
 	struct switchtec_status status;
-	int i, ret, first_lane, lane;
-	size_t lane_cnt[num_lanes];
+	int i, ret;
 	int lane_mask[4] = {};
-	double tmp[500];
-	double *pixels;
+	double *pixels, *tmp;
 
 	ret = switchtec_calc_lane_mask(dev, port_id, lane_id, num_lanes,
 				       lane_mask, &status);
@@ -1168,12 +1491,6 @@ static double *eye_observe_dev(struct switchtec_dev *dev, int port_id,
 		return NULL;
 	}
 
-	for (i = 0; i < 4; i++) {
-		first_lane = ffs(lane_mask[i]);
-		if (first_lane)
-			break;
-	}
-
 	pixels = calloc(pixel_cnt, sizeof(*pixels));
 	if (!pixels) {
 		perror("allocating pixels");
@@ -1182,14 +1499,9 @@ static double *eye_observe_dev(struct switchtec_dev *dev, int port_id,
 
 	switchtec_diag_eye_cancel(dev);
 
-	ret = switchtec_diag_eye_set_mode(dev, mode);
-	if (ret) {
-		switchtec_perror("eye_set_mode");
-		goto out_err;
-	}
-
-	ret = switchtec_diag_eye_start(dev, lane_mask, X, Y, interval);
-	if (ret) {
+	sess = switchtec_diag_eye_session_start(dev, lane_mask, mode, X, Y,
+						interval, pixels);
+	if (!sess) {
 		switchtec_perror("eye_start");
 		goto out_err;
 	}
@@ -1204,40 +1516,35 @@ static double *eye_observe_dev(struct switchtec_dev *dev, int port_id,
 
 	*gen = status.link_rate;
 
-	memset(lane_cnt, 0, sizeof(lane_cnt));
 	progress_start();
-	for (i = 0; i < pixel_cnt; i += ret) {
-		ret = switchtec_diag_eye_fetch(dev, tmp, ARRAY_SIZE(tmp),
-					       &lane);
-		if (ret == 0) {
-			fprintf(stderr, "No data for specified lane.\n");
-			goto out_err;
-		}
-
-		if (ret < 0) {
-			switchtec_perror("eye_fetch");
-			goto out_err;
-		}
+	ret = switchtec_diag_eye_session_wait(sess, progress_update_norate);
+	switchtec_diag_eye_session_free(sess);
+	if (ret) {
+		switchtec_perror("eye_fetch");
+		goto out_err;
+	}
+	progress_finish(false);
+	fprintf(stderr, "\n");
 
-		if (ret > ARRAY_SIZE(tmp)) {
-			fprintf(stderr, "Not enough pixels allocated!\n");
+	/* the session fills the blocks in physical lane order */
+	if (status.lane_reversal && num_lanes > 1) {
+		tmp = malloc(stride * sizeof(*tmp));
+		if (!tmp) {
+			perror("allocating pixels");
 			goto out_err;
 		}
 
-		lane -= first_lane;
-
-		if (status.lane_reversal)
-			lane = num_lanes - lane - 1;
-
-		memcpy(&pixels[lane * stride + lane_cnt[lane]], tmp,
-		       ret * sizeof(double));
-		lane_cnt[lane] += ret;
+		for (i = 0; i < num_lanes / 2; i++) {
+			double *a = &pixels[i * stride];
+			double *b = &pixels[(num_lanes - i - 1) * stride];
 
-		progress_update_norate(i, pixel_cnt);
+			memcpy(tmp, a, stride * sizeof(*tmp));
+			memcpy(a, b, stride * sizeof(*tmp));
+			memcpy(b, tmp, stride * sizeof(*tmp));
+		}
+		free(tmp);
 	}
 
-	progress_finish(false);
-	fprintf(stderr, "\n");
 	return pixels;
 
 out_err:
@@ -1336,11 +1643,12 @@ static int eye(int argc, char **argv)
 		 .choices=eye_modes},
 		{"num-lanes", 'n', "NUM", CFG_POSITIVE, &cfg.num_lanes,
 		 required_argument,
-		 "number of lanes to capture, if greater than one, format must be csv (default: 1)"},
+		 "number of lanes to capture, if greater than one, format must be csv or bin (default: 1)"},
 		{"port", 'p', "PORT_ID", CFG_NONNEGATIVE, &cfg.port_id,
 		 required_argument, "physical port ID to observe"},
 		{"plot", 'P', "FILE", CFG_FILE_R, &cfg.plot_file,
-		 required_argument, "plot a CSV file from an earlier capture"},
+		 required_argument,
+		 "plot a CSV or binary file from an earlier capture"},
 		{"t-start", 't', "NUM", CFG_NONNEGATIVE, &cfg.x_range.start,
 		 required_argument, "start time (0 to 63)"},
 		{"t-end", 'T', "NUM", CFG_NONNEGATIVE, &cfg.x_range.end,
@@ -1373,11 +1681,11 @@ static int eye(int argc, char **argv)
 	}
 
 	if (cfg.plot_file) {
-		pixels = load_eye_csv(cfg.plot_file, &cfg.x_range,
+		pixels = load_eye_file(cfg.plot_file, &cfg.x_range,
 				&cfg.y_range, subtitle, sizeof(subtitle),
 				&cfg.step_interval);
 		if (!pixels) {
-			fprintf(stderr, "Unable to parse CSV file: %s\n",
+			fprintf(stderr, "Unable to parse eye file: %s\n",
 				cfg.plot_filename);
 			return -1;
 		}
@@ -1425,8 +1733,8 @@ static int eye(int argc, char **argv)
 		return -1;
 	}
 
-	if (cfg.num_lanes > 1 && cfg.fmt != FMT_CSV) {
-		fprintf(stderr, "--format/-f must be CSV if --num-lanes/-n is greater than 1\n");
+	if (cfg.num_lanes > 1 && cfg.fmt != FMT_CSV && cfg.fmt != FMT_BIN) {
+		fprintf(stderr, "--format/-f must be CSV or BIN if --num-lanes/-n is greater than 1\n");
 		return -1;
 	}
 
@@ -1448,6 +1756,14 @@ static int eye(int argc, char **argv)
 		return 0;
 	}
 
+	if (cfg.fmt == FMT_BIN) {
+		write_eye_bin_files(cfg.port_id, cfg.lane_id, cfg.num_lanes,
+				    cfg.step_interval, gen, &cfg.x_range,
+				    &cfg.y_range, pixels);
+		free(pixels);
+		return 0;
+	}
+
 	ret = eye_graph(cfg.fmt, &cfg.x_range, &cfg.y_range, pixels, title,
 			ch_ptr);
 
@@ -1745,6 +2061,185 @@ static int pattern(int argc, char **argv)
 	return print_pattern_mode(cfg.dev, &cfg.port, cfg.port_id);
 }
 
+static const char *ber_verdict_str(enum switchtec_diag_ber_verdict v)
+{
+	switch (v) {
+	case SWITCHTEC_DIAG_BER_PASS:	return "PASS";
+	case SWITCHTEC_DIAG_BER_FAIL:	return "FAIL";
+	default:			return "-";
+	}
+}
+
+static int ber_progress(const struct switchtec_diag_ber_lane *lanes,
+			int nr_lanes, void *data)
+{
+	int i, decided = 0, failed = 0;
+	double bits = 0;
+
+	for (i = 0; i < nr_lanes; i++) {
+		if (lanes[i].verdict != SWITCHTEC_DIAG_BER_UNDECIDED)
+			decided++;
+		if (lanes[i].verdict == SWITCHTEC_DIAG_BER_FAIL)
+			failed++;
+		bits += lanes[i].bits;
+	}
+
+	if (!*(int *)data)
+		fprintf(stderr, "\r%.3g bits checked, %d of %d lanes decided, %d failed ",
+			bits, decided, nr_lanes, failed);
+
+	return ltssm_watch_stop;
+}
+
+#define CMD_DESC_BER "Measure the bit error rate of every lane of several ports at once"
+
+static int ber(int argc, char **argv)
+{
+	struct switchtec_diag_ber_lane lanes[SWITCHTEC_MAX_PORTS * 4];
+	int ports[SWITCHTEC_MAX_PORTS];
+	struct switchtec_diag_ber_opts o;
+	int i, num_ports, num_lanes;
+	int failed = 0, undecided = 0;
+
+	static struct {
+		struct switchtec_dev *dev;
+		const char *ports;
+		int pattern;
+		int enable_tx_to_rx;
+		int enable_rx_to_tx;
+		int enable_ltssm;
+		int speed;
+		double gbps;
+		double target;
+		double confidence;
+		unsigned settle;
+		unsigned interval;
+		unsigned duration;
+		int quiet;
+	} cfg = {
+		.pattern = SWITCHTEC_DIAG_PATTERN_PRBS_31,
+		.speed = SWITCHTEC_DIAG_LTSSM_GEN4,
+		.confidence = 95,
+		.interval = 1000,
+		.duration = 10,
+	};
+	const struct argconfig_options opts[] = {
+		DEVICE_OPTION,
+		{"ports", 'p', "LIST", CFG_STRING, &cfg.ports,
+		 required_argument,
+		 "comma separated list of physical port IDs to test (default: all ports)"},
+		{"pattern", 'P', "PATTERN", CFG_CHOICES, &cfg.pattern,
+		 required_argument, "pattern to generate and monitor (default: PRBS31)",
+		 .choices = pattern_types},
+		{"ltssm", 'l', "", CFG_NONE, &cfg.enable_ltssm, no_argument,
+		 "enable LTSSM loopback mode for the test"},
+		{"rx-to-tx", 'r', "", CFG_NONE, &cfg.enable_rx_to_tx, no_argument,
+		 "enable RX->TX loopback mode for the test"},
+		{"tx-to-rx", 't', "", CFG_NONE, &cfg.enable_tx_to_rx, no_argument,
+		 "enable TX->RX loopback mode for the test"},
+		{"speed", 's', "GEN", CFG_CHOICES, &cfg.speed, required_argument,
+		 "LTSSM Speed (if enabling the LTSSM loopback mode), default: GEN4",
+		 .choices = loopback_ltssm_speeds},
+		{"gbps", 'g', "GBPS", CFG_DOUBLE, &cfg.gbps, required_argument,
+		 "lane rate in Gb/s (default: the negotiated rate of each port)"},
+		{"target", 'b', "BER", CFG_DOUBLE, &cfg.target, required_argument,
+		 "BER each lane must be shown to be below; ends the test once every lane passed or failed"},
+		{"confidence", 'c', "PERCENT", CFG_DOUBLE, &cfg.confidence,
+		 required_argument, "confidence level of the verdicts (default: 95)"},
+		{"settle", 'S', "MS", CFG_NONNEGATIVE, &cfg.settle,
+		 required_argument,
+		 "time to let the monitors lock before counting (default: 0)"},
+		{"interval", 'i', "MS", CFG_POSITIVE, &cfg.interval,
+		 required_argument, "interval between reads in ms (default: 1000)"},
+		{"duration", 'd', "SEC", CFG_POSITIVE, &cfg.duration,
+		 required_argument, "longest time to run the test (default: 10)"},
+		{"quiet", 'q', "", CFG_NONE, &cfg.quiet, no_argument,
+		 "do not print progress"},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_BER, opts, &cfg, sizeof(cfg));
+
+	if (cfg.confidence <= 0 || cfg.confidence >= 100) {
+		fprintf(stderr, "Confidence must be between 0 and 100\n");
+		return -1;
+	}
+
+	num_ports = ltssm_watch_ports(cfg.dev, cfg.ports, ports,
+				      ARRAY_SIZE(ports));
+	if (num_ports < 0) {
+		switchtec_perror("ber");
+		return -1;
+	} else if (!num_ports) {
+		fprintf(stderr, "No ports to test\n");
+		return -1;
+	}
+
+	o = (struct switchtec_diag_ber_opts) {
+		.pattern = cfg.pattern,
+		.ltssm_speed = cfg.speed,
+		.lane_gbps = cfg.gbps,
+		.target_ber = cfg.target,
+		.confidence = cfg.confidence / 100,
+		.settle_ms = cfg.settle,
+		.poll_ms = cfg.interval,
+		.duration_ms = cfg.duration * 1000,
+		.cb = ber_progress,
+		.data = &cfg.quiet,
+	};
+	if (cfg.enable_rx_to_tx)
+		o.loopback |= SWITCHTEC_DIAG_LOOPBACK_RX_TO_TX;
+	if (cfg.enable_tx_to_rx)
+		o.loopback |= SWITCHTEC_DIAG_LOOPBACK_TX_TO_RX;
+	if (cfg.enable_ltssm)
+		o.loopback |= SWITCHTEC_DIAG_LOOPBACK_LTSSM;
+
+	ltssm_watch_stop = 0;
+	signal(SIGINT, ltssm_watch_sig);
+	signal(SIGTERM, ltssm_watch_sig);
+
+	num_lanes = switchtec_diag_ber_run(cfg.dev, ports, num_ports, &o,
+					   lanes, ARRAY_SIZE(lanes));
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	if (!cfg.quiet)
+		fprintf(stderr, "\n");
+
+	if (num_lanes < 0) {
+		switchtec_perror("ber");
+		return -1;
+	}
+
+	printf("Port  Lane  %12s  %10s  %10s  %10s  %10s  Verdict\n",
+	       "Errors", "Bits", "BER", "Lower", "Upper");
+	for (i = 0; i < num_lanes; i++) {
+		printf("%4d  %4d  %12llu  %10.3e  %10.3e  %10.3e  %10.3e  %s\n",
+		       lanes[i].phys_port_id, lanes[i].lane_id,
+		       lanes[i].errors, lanes[i].bits, lanes[i].ber,
+		       lanes[i].ber_lower, lanes[i].ber_upper,
+		       lanes[i].error ? "READ ERROR" :
+		       ber_verdict_str(lanes[i].verdict));
+		if (lanes[i].read_errors)
+			printf("%22s(%u monitor reads failed)\n", "",
+			       lanes[i].read_errors);
+
+		if (lanes[i].verdict == SWITCHTEC_DIAG_BER_FAIL)
+			failed++;
+		else if (lanes[i].verdict == SWITCHTEC_DIAG_BER_UNDECIDED)
+			undecided++;
+	}
+
+	if (cfg.target <= 0)
+		return 0;
+
+	printf("\n%d lanes passed, %d failed, %d undecided at %g%% confidence\n",
+	       num_lanes - failed - undecided, failed, undecided,
+	       cfg.confidence);
+
+	return failed || undecided;
+}
+
 #define CMD_DESC_LIST_MRPC "List permissible MRPC commands"
 
 static int list_mrpc(int argc, char **argv)
@@ -1970,6 +2465,185 @@ static int rcvr_extended(int argc, char **argv)
 	return 0;
 }
 
+#define CMD_DESC_SERDES_SNAPSHOT "Capture the SerDes state of every lane of several ports"
+
+static int serdes_snapshot(int argc, char **argv)
+{
+	struct switchtec_serdes_snapshot *snap;
+	int ports[SWITCHTEC_MAX_PORTS];
+	int i, l, num_ports = 0;
+	int lanes = 0, port_reads = 0, lane_reads = 0;
+
+	static struct {
+		struct switchtec_dev *dev;
+		const char *ports;
+		int prev;
+		FILE *out;
+		const char *out_filename;
+	} cfg = {};
+	const struct argconfig_options opts[] = {
+		DEVICE_OPTION,
+		{"ports", 'p', "LIST", CFG_STRING, &cfg.ports,
+		 required_argument,
+		 "comma separated list of physical port IDs (default: all ports)"},
+		PREV_OPTION,
+		{"output", 'o', "FILE", CFG_FILE_W, &cfg.out,
+		 required_argument, "file to save the snapshot to"},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_SERDES_SNAPSHOT, opts, &cfg,
+			sizeof(cfg));
+
+	if (cfg.ports) {
+		num_ports = ltssm_watch_ports(cfg.dev, cfg.ports, ports,
+					      ARRAY_SIZE(ports));
+		if (num_ports <= 0) {
+			fprintf(stderr, "No ports to capture\n");
+			return -1;
+		}
+	}
+
+	snap = switchtec_diag_serdes_snapshot(cfg.dev,
+			cfg.ports ? ports : NULL, num_ports,
+			cfg.prev ? SWITCHTEC_DIAG_LINK_PREVIOUS :
+			SWITCHTEC_DIAG_LINK_CURRENT);
+	if (!snap) {
+		switchtec_perror("serdes_snapshot");
+		return -1;
+	}
+
+	for (i = 0; i < snap->nr_ports; i++) {
+		port_reads += __builtin_popcount(snap->ports[i].valid);
+		lanes += snap->ports[i].lane_cnt;
+		for (l = 0; l < snap->ports[i].lane_cnt; l++)
+			lane_reads += __builtin_popcount(
+				snap->ports[i].lanes[l].valid);
+	}
+
+	printf("Captured %d ports, %d lanes %s\n", snap->nr_ports, lanes,
+	       cfg.prev ? "(Previous Link-Up)" : "");
+	printf("  Port reads: %d of %d\n", port_reads, snap->nr_ports * 3);
+	printf("  Lane reads: %d of %d\n", lane_reads, lanes * 4);
+
+	if (cfg.out) {
+		if (switchtec_diag_serdes_snapshot_save(snap, cfg.out)) {
+			switchtec_perror(cfg.out_filename);
+			fclose(cfg.out);
+			switchtec_diag_serdes_snapshot_free(snap);
+			return -1;
+		}
+		fclose(cfg.out);
+		printf("Saved to %s\n", cfg.out_filename);
+	}
+
+	switchtec_diag_serdes_snapshot_free(snap);
+	return 0;
+}
+
+static struct switchtec_serdes_snapshot *serdes_load(FILE *f,
+						     const char *name)
+{
+	struct switchtec_serdes_snapshot *snap;
+
+	snap = switchtec_diag_serdes_snapshot_load(f);
+	fclose(f);
+	if (!snap)
+		switchtec_perror(name);
+
+	return snap;
+}
+
+#define CMD_DESC_SERDES_DIFF "Compare two SerDes snapshots"
+
+static int serdes_diff(int argc, char **argv)
+{
+	struct switchtec_serdes_snapshot *a, *b = NULL;
+	struct switchtec_serdes_diff *diffs = NULL;
+	int i, n, ret = -1;
+	char name[64];
+
+	static struct {
+		FILE *a;
+		const char *a_name;
+		FILE *b;
+		const char *b_name;
+	} cfg = {};
+	const struct argconfig_options opts[] = {
+		{"a", .cfg_type=CFG_FILE_R, .value_addr=&cfg.a,
+		  .argument_type=required_positional,
+		  .help="snapshot saved by serdes_snapshot"},
+		{"b", .cfg_type=CFG_FILE_R, .value_addr=&cfg.b,
+		  .argument_type=required_positional,
+		  .help="snapshot to compare it with"},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_SERDES_DIFF, opts, &cfg,
+			sizeof(cfg));
+
+	a = serdes_load(cfg.a, cfg.a_name);
+	if (!a) {
+		fclose(cfg.b);
+		return -1;
+	}
+
+	b = serdes_load(cfg.b, cfg.b_name);
+	if (!b)
+		goto out;
+
+	if (a->link != b->link)
+		fprintf(stderr, "Warning: comparing current and previous link-up data\n");
+
+	n = switchtec_diag_serdes_diff(a, b, NULL, 0);
+	if (n < 0) {
+		switchtec_perror("serdes_diff");
+		goto out;
+	}
+
+	diffs = calloc(n ? n : 1, sizeof(*diffs));
+	if (!diffs) {
+		perror("serdes_diff");
+		goto out;
+	}
+
+	n = switchtec_diag_serdes_diff(a, b, diffs, n);
+	if (n < 0) {
+		switchtec_perror("serdes_diff");
+		goto out;
+	}
+
+	if (n)
+		printf("Port  Lane  %-32s  %6s  %6s\n", "Field", "A", "B");
+
+	for (i = 0; i < n; i++) {
+		switchtec_diag_serdes_field_name(diffs[i].field, name,
+						 sizeof(name));
+		printf("%4d  ", diffs[i].phys_port_id);
+		if (diffs[i].lane_id < 0)
+			printf("%4s  ", "-");
+		else
+			printf("%4d  ", diffs[i].lane_id);
+		printf("%-32s  ", name);
+
+		if (diffs[i].in_a)
+			printf("%6d  ", diffs[i].a);
+		else
+			printf("%6s  ", "-");
+		if (diffs[i].in_b)
+			printf("%6d\n", diffs[i].b);
+		else
+			printf("%6s\n", "-");
+	}
+
+	printf("%d difference%s\n", n, n == 1 ? "" : "s");
+	ret = n ? 1 : 0;
+
+out:
+	free(diffs);
+	switchtec_diag_serdes_snapshot_free(a);
+	switchtec_diag_serdes_snapshot_free(b);
+	return ret;
+}
+
 #define CMD_DESC_REF_CLK "Enable or disable the output reference clock of a stack"
 
 static int refclk(int argc, char **argv)
@@ -2065,13 +2739,17 @@ static const struct cmd commands[] = {
 	CMD(list_mrpc,		CMD_DESC_LIST_MRPC),
 	CMD(loopback,		CMD_DESC_LOOPBACK),
 	CMD(pattern,		CMD_DESC_PATTERN),
+	CMD(ber,		CMD_DESC_BER),
 	CMD(port_eq_txcoeff,	CMD_DESC_PORT_EQ_TXCOEFF),
 	CMD(port_eq_txfslf,	CMD_DESC_PORT_EQ_TXFSLF),
 	CMD(port_eq_txtable,	CMD_DESC_PORT_EQ_TXTABLE),
 	CMD(rcvr_extended,	CMD_DESC_RCVR_EXTENDED),
 	CMD(rcvr_obj,		CMD_DESC_RCVR_OBJ),
+	CMD(serdes_snapshot,	CMD_DESC_SERDES_SNAPSHOT),
+	CMD(serdes_diff,	CMD_DESC_SERDES_DIFF),
 	CMD(refclk,		CMD_DESC_REF_CLK),
 	CMD(ltssm_log,		CMD_DESC_LTSSM_LOG),
+	CMD(ltssm_watch,	CMD_DESC_LTSSM_WATCH),
 	CMD(aer_event_gen,	CMD_DESC_AER_EVENT_GEN),
 	{}
 };
@@ -0,0 +1,500 @@
+/*
+ * Microsemi Switchtec(tm) PCIe Management Command Line Interface
+ * Copyright (c) 2025, Microsemi Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * OpenMetrics exporter: keeps every device from switchtec_list() open,
+ * samples it on a timer and serves the last sample over HTTP. A scrape
+ * only copies the cached text and never talks to the hardware.
+ */
+
+#include "exporter.h"
+
+#include <switchtec/switchtec.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#define EXPORTER_NR_TEMPS 4
+#define EXPORTER_REQ_MAX 4096
+
+/*
+ * OpenMetrics wants all the samples of a family together, so each
+ * family is written to its own stream and they are joined at the end.
+ */
+enum exporter_family {
+	FAM_UP,
+	FAM_LINK_UP,
+	FAM_LINK_WIDTH,
+	FAM_LINK_RATE,
+	FAM_TEMP,
+	FAM_EVCNTR,
+	FAM_BW,
+	FAM_BW_PEAK,
+	FAM_LAT,
+	FAM_COUNT,
+};
+
+static const char *const family_names[FAM_COUNT] = {
+	[FAM_UP] = "switchtec_up",
+	[FAM_LINK_UP] = "switchtec_link_up",
+	[FAM_LINK_WIDTH] = "switchtec_link_width",
+	[FAM_LINK_RATE] = "switchtec_link_rate_gen",
+	[FAM_TEMP] = "switchtec_die_temperature_celsius",
+	[FAM_EVCNTR] = "switchtec_events",
+	[FAM_BW] = "switchtec_bandwidth_bytes_per_second",
+	[FAM_BW_PEAK] = "switchtec_bandwidth_peak_bytes_per_second",
+	[FAM_LAT] = "switchtec_latency_ns",
+};
+
+/*
+ * Families not listed are gauges. OpenMetrics names the samples of a
+ * counter family after the family with a "_total" suffix.
+ */
+static const char *const family_types[FAM_COUNT] = {
+	[FAM_EVCNTR] = "counter",
+};
+
+struct family_buf {
+	FILE *f;
+	char *text;
+	size_t len;
+};
+
+struct exporter_dev {
+	struct switchtec_dev *dev;
+	char name[256];
+
+	int nr_ports;
+	int phys_ids[SWITCHTEC_MAX_PORTS];
+	struct switchtec_bw_sampler *bw;
+	struct switchtec_lat_collector *lat;
+	struct switchtec_evcntr_snapshot evcntr;
+	int have_evcntr;
+};
+
+struct exporter {
+	struct exporter_dev *devs;
+	int nr_devs;
+	unsigned interval_ms;
+
+	pthread_mutex_t lock;
+	char *text;
+	size_t text_len;
+};
+
+/* Start a sample of family \p fam with the device label */
+static FILE *sample(struct family_buf *fams, enum exporter_family fam,
+		    struct exporter_dev *d)
+{
+	FILE *f = fams[fam].f;
+
+	fprintf(f, "%s%s{device=\"%s\"", family_names[fam],
+		family_types[fam] ? "_total" : "", d->name);
+	return f;
+}
+
+static void print_bw_dir(struct family_buf *fams, enum exporter_family fam,
+			 struct exporter_dev *d, int phys_id, const char *dir,
+			 struct switchtec_bw_rate_dir *r)
+{
+	static const char *types[] = {"posted", "nonposted", "completion"};
+	double vals[] = {r->posted, r->nonposted, r->comp};
+	int i;
+
+	for (i = 0; i < 3; i++)
+		fprintf(sample(fams, fam, d), ",port=\"%d\",direction=\"%s\",type=\"%s\"} %.0f\n",
+			phys_id, dir, types[i], vals[i]);
+}
+
+static void sample_bw(struct family_buf *fams, struct exporter_dev *d)
+{
+	struct switchtec_bw_rate latest, ewma, peak;
+	int i;
+
+	if (!d->bw)
+		return;
+
+	for (i = 0; i < d->nr_ports; i++) {
+		if (switchtec_bw_sampler_latest(d->bw, i, &latest, &ewma,
+						&peak))
+			continue;
+
+		print_bw_dir(fams, FAM_BW, d, d->phys_ids[i], "egress",
+			     &latest.egress);
+		print_bw_dir(fams, FAM_BW, d, d->phys_ids[i], "ingress",
+			     &latest.ingress);
+		print_bw_dir(fams, FAM_BW_PEAK, d, d->phys_ids[i], "egress",
+			     &peak.egress);
+		print_bw_dir(fams, FAM_BW_PEAK, d, d->phys_ids[i], "ingress",
+			     &peak.ingress);
+	}
+}
+
+static void sample_lat(struct family_buf *fams, struct exporter_dev *d)
+{
+	static const double quantiles[] = {50, 99, 99.9};
+	const struct switchtec_lat_hist *max;
+	int i, q;
+
+	if (!d->lat || switchtec_lat_collector_sample(d->lat))
+		return;
+
+	for (i = 0; i < d->nr_ports; i++) {
+		switchtec_lat_collector_hist(d->lat, i, NULL, &max);
+		if (!max->count)
+			continue;
+
+		for (q = 0; q < 3; q++)
+			fprintf(sample(fams, FAM_LAT, d),
+				",port=\"%d\",quantile=\"%g\"} %d\n",
+				d->phys_ids[i], quantiles[q] / 100,
+				switchtec_lat_hist_percentile(max,
+							      quantiles[q]));
+	}
+}
+
+static int sample_dev(struct family_buf *fams, struct exporter_dev *d)
+{
+	struct switchtec_status *status;
+	float temps[EXPORTER_NR_TEMPS];
+	int i, nr;
+
+	nr = switchtec_status(d->dev, &status);
+	if (nr < 0)
+		return nr;
+
+	for (i = 0; i < nr; i++) {
+		fprintf(sample(fams, FAM_LINK_UP, d), ",port=\"%d\"} %d\n",
+			status[i].port.phys_id, status[i].link_up);
+		fprintf(sample(fams, FAM_LINK_WIDTH, d), ",port=\"%d\"} %d\n",
+			status[i].port.phys_id, status[i].neg_lnk_width);
+		fprintf(sample(fams, FAM_LINK_RATE, d), ",port=\"%d\"} %d\n",
+			status[i].port.phys_id, status[i].link_rate);
+	}
+	switchtec_status_free(status, nr);
+
+	nr = switchtec_die_temps(d->dev, EXPORTER_NR_TEMPS, temps);
+	for (i = 0; i < nr; i++)
+		fprintf(sample(fams, FAM_TEMP, d), ",sensor=\"%d\"} %.2f\n",
+			i, temps[i]);
+
+	if (d->have_evcntr &&
+	    switchtec_evcntr_snapshot(d->dev, &d->evcntr, 0) >= 0) {
+		for (i = 0; i < d->evcntr.nr; i++)
+			fprintf(sample(fams, FAM_EVCNTR, d),
+				",stack=\"%d\",counter=\"%d\"} %u\n",
+				d->evcntr.stack_id[i], d->evcntr.cntr_id[i],
+				d->evcntr.count[i]);
+	}
+
+	sample_bw(fams, d);
+	sample_lat(fams, d);
+
+	return 0;
+}
+
+static void sample_all(struct exporter *e)
+{
+	struct family_buf fams[FAM_COUNT] = {};
+	char *text = NULL;
+	size_t len = 0;
+	FILE *f;
+	int i, ret;
+
+	for (i = 0; i < FAM_COUNT; i++) {
+		fams[i].f = open_memstream(&fams[i].text, &fams[i].len);
+		if (!fams[i].f)
+			goto out;
+	}
+
+	for (i = 0; i < e->nr_devs; i++) {
+		ret = sample_dev(fams, &e->devs[i]);
+		fprintf(sample(fams, FAM_UP, &e->devs[i]), "} %d\n",
+			ret ? 0 : 1);
+	}
+
+	f = open_memstream(&text, &len);
+	if (!f)
+		goto out;
+
+	for (i = 0; i < FAM_COUNT; i++) {
+		fclose(fams[i].f);
+		fams[i].f = NULL;
+		fprintf(f, "# TYPE %s %s\n", family_names[i],
+			family_types[i] ? family_types[i] : "gauge");
+		fwrite(fams[i].text, 1, fams[i].len, f);
+	}
+	fprintf(f, "# EOF\n");
+	fclose(f);
+
+	pthread_mutex_lock(&e->lock);
+	free(e->text);
+	e->text = text;
+	e->text_len = len;
+	pthread_mutex_unlock(&e->lock);
+
+out:
+	for (i = 0; i < FAM_COUNT; i++) {
+		if (fams[i].f)
+			fclose(fams[i].f);
+		free(fams[i].text);
+	}
+}
+
+static void *sample_thread(void *arg)
+{
+	struct exporter *e = arg;
+
+	while (1) {
+		sample_all(e);
+		usleep(e->interval_ms * 1000);
+	}
+
+	return NULL;
+}
+
+static int exporter_open(struct exporter *e, unsigned interval_ms, int latency)
+{
+	struct switchtec_device_info *list;
+	struct switchtec_status *status;
+	int ingress[SWITCHTEC_MAX_PORTS];
+	struct exporter_dev *d;
+	int i, j, n;
+
+	n = switchtec_list(&list);
+	if (n < 0)
+		return n;
+
+	e->devs = calloc(n ? n : 1, sizeof(*e->devs));
+	if (!e->devs) {
+		free(list);
+		return -1;
+	}
+
+	for (i = 0; i < n; i++) {
+		d = &e->devs[e->nr_devs];
+		d->dev = switchtec_open(list[i].path);
+		if (!d->dev) {
+			switchtec_perror(list[i].name);
+			continue;
+		}
+		snprintf(d->name, sizeof(d->name), "%s", list[i].name);
+
+		d->nr_ports = switchtec_status(d->dev, &status);
+		if (d->nr_ports < 0)
+			d->nr_ports = 0;
+		for (j = 0; j < d->nr_ports; j++) {
+			d->phys_ids[j] = status[j].port.phys_id;
+			ingress[j] = SWITCHTEC_LAT_ALL_INGRESS;
+		}
+		if (d->nr_ports)
+			switchtec_status_free(status, d->nr_ports);
+
+		if (d->nr_ports) {
+			d->bw = switchtec_bw_sampler_start(d->dev, d->nr_ports,
+							   d->phys_ids,
+							   interval_ms, 16, 0);
+			if (latency)
+				d->lat = switchtec_lat_collector_new(d->dev,
+						d->nr_ports, d->phys_ids,
+						ingress);
+		}
+
+		d->have_evcntr =
+			switchtec_evcntr_snapshot_setup(d->dev, &d->evcntr) >= 0;
+		e->nr_devs++;
+	}
+
+	free(list);
+	return e->nr_devs;
+}
+
+static int exporter_listen(const char *addr, int port)
+{
+	struct sockaddr_in sa = {
+		.sin_family = AF_INET,
+		.sin_port = htons(port),
+	};
+	int fd, one = 1;
+
+	if (!inet_aton(addr, &sa.sin_addr)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) ||
+	    listen(fd, 16)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+	ssize_t ret;
+
+	while (len) {
+		ret = send(fd, buf, len, MSG_NOSIGNAL);
+		if (ret <= 0)
+			return -1;
+		buf += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+static void serve_client(struct exporter *e, int fd)
+{
+	struct timeval tv = {.tv_sec = 2};
+	char req[EXPORTER_REQ_MAX];
+	size_t len = 0;
+	char hdr[256];
+	ssize_t ret;
+	char *text;
+	size_t text_len;
+
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	while (len < sizeof(req) - 1) {
+		ret = recv(fd, req + len, sizeof(req) - 1 - len, 0);
+		if (ret <= 0)
+			return;
+		len += ret;
+		req[len] = 0;
+		if (strstr(req, "\r\n\r\n"))
+			break;
+	}
+
+	if (strncmp(req, "GET /metrics ", 13) &&
+	    strncmp(req, "GET /metrics?", 13)) {
+		snprintf(hdr, sizeof(hdr), "HTTP/1.1 404 Not Found\r\n"
+			 "Content-Length: 0\r\nConnection: close\r\n\r\n");
+		write_all(fd, hdr, strlen(hdr));
+		return;
+	}
+
+	pthread_mutex_lock(&e->lock);
+	text_len = e->text_len;
+	text = malloc(text_len + 1);
+	if (text)
+		memcpy(text, e->text ? e->text : "", text_len);
+	pthread_mutex_unlock(&e->lock);
+
+	if (!text)
+		return;
+
+	snprintf(hdr, sizeof(hdr), "HTTP/1.1 200 OK\r\n"
+		 "Content-Type: application/openmetrics-text; "
+		 "version=1.0.0; charset=utf-8\r\n"
+		 "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+		 text_len);
+	if (!write_all(fd, hdr, strlen(hdr)))
+		write_all(fd, text, text_len);
+
+	free(text);
+}
+
+int exporter_main(const char *addr, int port, unsigned interval_ms,
+		  int latency)
+{
+	struct exporter e = {
+		.interval_ms = interval_ms,
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	pthread_t thread;
+	int lfd, fd, ret;
+
+	lfd = exporter_listen(addr, port);
+	if (lfd < 0) {
+		perror("listen");
+		return -1;
+	}
+
+	ret = exporter_open(&e, interval_ms, latency);
+	if (ret < 0) {
+		switchtec_perror("list");
+		close(lfd);
+		return -1;
+	}
+	fprintf(stderr, "Exporting %d device(s) on %s:%d\n", ret, addr, port);
+
+	sample_all(&e);
+
+	ret = pthread_create(&thread, NULL, sample_thread, &e);
+	if (ret) {
+		errno = ret;
+		perror("exporter");
+		close(lfd);
+		return -1;
+	}
+
+	while (1) {
+		fd = accept(lfd, NULL, NULL);
+		if (fd < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("accept");
+			break;
+		}
+
+		serve_client(&e, fd);
+		close(fd);
+	}
+
+	close(lfd);
+	return -1;
+}
+
+#else
+
+int exporter_main(const char *addr, int port, unsigned interval_ms,
+		  int latency)
+{
+	fprintf(stderr, "The exporter is only supported on Linux.\n");
+	errno = ENOTSUP;
+	return -1;
+}
+
+#endif
@@ -31,7 +31,9 @@
 #include <switchtec/switchtec.h>
 #include <switchtec/portable.h>
 #include <switchtec/fabric.h>
+#include <switchtec/errors.h>
 #include <switchtec/utils.h>
+#include <switchtec/endian.h>
 
 #include <unistd.h>
 #include <stdint.h>
@@ -39,6 +41,7 @@
 #include <errno.h>
 #include <ctype.h>
 #include <inttypes.h>
+#include <signal.h>
 
 enum {
 	HEX,
@@ -219,6 +222,131 @@ static int gfms_unbind(int argc, char **argv)
 	return 0;
 }
 
+static int gfms_bind_map_parse(FILE *f, const char *name,
+			       struct switchtec_gfms_bind_map_entry *map,
+			       int max)
+{
+	char line[256], funcs[192], *tok, *endptr;
+	int n = 0, lineno = 0;
+	unsigned long value;
+	int phys, log, cnt;
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		if (line[strspn(line, " \t")] == '#' ||
+		    line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+
+		cnt = sscanf(line, "%d %d %191s", &phys, &log, funcs);
+		if (cnt < 3 || phys < 0 || phys > 0xff || log < 0 ||
+		    log > 0xff) {
+			fprintf(stderr, "%s:%d: expected PHYS_PORT LOG_PORT PDFID[,PDFID...] or PHYS_PORT LOG_PORT -\n",
+				name, lineno);
+			return -1;
+		}
+
+		if (n == max) {
+			fprintf(stderr, "%s: too many logical ports\n", name);
+			return -1;
+		}
+
+		memset(&map[n], 0, sizeof(map[n]));
+		map[n].host_phys_port_id = phys;
+		map[n].host_log_port_id = log;
+
+		if (strcmp(funcs, "-")) {
+			for (tok = strtok(funcs, ","); tok;
+			     tok = strtok(NULL, ",")) {
+				errno = 0;
+				value = strtoul(tok, &endptr, 0);
+				if (errno || *endptr || value >= 0xffff ||
+				    map[n].ep_number ==
+					SWITCHTEC_FABRIC_MULTI_FUNC_NUM) {
+					fprintf(stderr, "%s:%d: invalid pdfid %s (at most %d per port)\n",
+						name, lineno, tok,
+						SWITCHTEC_FABRIC_MULTI_FUNC_NUM);
+					return -1;
+				}
+				map[n].ep_pdfid[map[n].ep_number++] = value;
+			}
+		}
+		n++;
+	}
+
+	return n;
+}
+
+#define CMD_DESC_GFMS_BIND_APPLY "move the EP bindings of the hosts to a desired map"
+
+static int gfms_bind_apply(int argc, char **argv)
+{
+	struct switchtec_gfms_bind_map_entry map[SWITCHTEC_MAX_PORTS * 4];
+	int i, f, n, ret;
+
+	static struct {
+		struct switchtec_dev *dev;
+		FILE *map_file;
+		const char *map_file_name;
+		unsigned timeout;
+	} cfg = {
+		.timeout = 5000,
+	};
+
+	const struct argconfig_options opts[] = {
+		DEVICE_OPTION,
+		{"map", .cfg_type=CFG_FILE_R, .value_addr=&cfg.map_file,
+		 .argument_type=required_positional,
+		 .help="file with one 'PHYS_PORT LOG_PORT PDFID[,PDFID...]' line per host logical port, or 'PHYS_PORT LOG_PORT -' to leave it unbound"},
+		{"timeout", 't', "MS", CFG_POSITIVE, &cfg.timeout,
+		 required_argument,
+		 "time to wait for all changes to complete (default: 5000)"},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_GFMS_BIND_APPLY, opts, &cfg,
+			sizeof(cfg));
+
+	n = gfms_bind_map_parse(cfg.map_file, cfg.map_file_name, map,
+				ARRAY_SIZE(map));
+	fclose(cfg.map_file);
+	if (n <= 0) {
+		if (!n)
+			fprintf(stderr, "No ports in %s\n", cfg.map_file_name);
+		return 1;
+	}
+
+	ret = switchtec_gfms_bind_apply(cfg.dev, map, n, cfg.timeout);
+	if (ret < 0) {
+		switchtec_perror("gfms_bind_apply");
+		return 1;
+	}
+
+	printf("Port  Logical  Change  Result  PDFIDs\n");
+	for (i = 0; i < n; i++) {
+		printf("%4d  %7d  %-6s  ", map[i].host_phys_port_id,
+		       map[i].host_log_port_id,
+		       switchtec_bind_op_str(map[i].op));
+
+		if (!map[i].ret) {
+			printf("OK    ");
+		} else {
+			if (map[i].ret > 0)
+				errno = map[i].ret |
+					SWITCHTEC_ERRNO_MRPC_FLAG_BIT;
+			else
+				errno = -map[i].ret;
+			printf("%s ", switchtec_strerror());
+		}
+
+		for (f = 0; f < map[i].ep_number; f++)
+			printf("%s0x%04hx", f ? "," : "  ", map[i].ep_pdfid[f]);
+		if (!map[i].ep_number)
+			printf("  -");
+		printf("\n");
+	}
+
+	return ret ? 1 : 0;
+}
+
 #define CMD_DESC_PORT_CONTROL "control a port"
 
 static int port_control(int argc, char **argv)
@@ -1191,6 +1319,83 @@ static int gfms_dump(int argc, char **argv)
 	return ret;
 }
 
+#define CMD_DESC_TOPO_CRAWL "show the topology of every switch in the fabric"
+
+static int topo_crawl(int argc, char **argv)
+{
+	struct switchtec_fab_topo_graph *graph;
+	struct switchtec_fab_topo_node *node;
+	int i, j, port, nports;
+	int ret;
+
+	static struct {
+		struct switchtec_dev *dev;
+		int gfms;
+	} cfg = {
+	};
+
+	const struct argconfig_options opts[] = {
+		DEVICE_OPTION,
+		{"gfms", 'g', "", CFG_NONE, &cfg.gfms, no_argument,
+		 "also dump each switch's GFMS PAX general section"},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_TOPO_CRAWL, opts, &cfg,
+			sizeof(cfg));
+
+	graph = malloc(sizeof(*graph));
+	if (!graph) {
+		perror("malloc");
+		return -1;
+	}
+
+	ret = switchtec_fab_topo_crawl(cfg.dev, graph,
+				       cfg.gfms ? SWITCHTEC_FAB_CRAWL_GFMS : 0);
+	if (ret) {
+		switchtec_perror("topo_crawl");
+		free(graph);
+		return ret;
+	}
+
+	printf("%-8s\t%-8s\t%-8s\t%s\n", "PAX ID", "Status", "Ports",
+	       "Routes (PAX:port)");
+	for (i = 0; i < SWITCHTEC_FAB_MAX_PAX; i++) {
+		if (!(graph->present & (1 << i)))
+			continue;
+
+		node = &graph->nodes[i];
+		if (node->ret) {
+			printf("%-8d\t%-8s\t%-8s\t%s\n", i, "Failed", "-",
+			       strerror(node->err));
+			continue;
+		}
+
+		nports = 0;
+		for (j = 0; j < SWITCHTEC_MAX_PORTS; j++) {
+			if (node->topo.port_info_list[j].phys_port_id == 0xff)
+				break;
+			nports++;
+		}
+
+		printf("%-8d\t%-8s\t%-8d\t", i,
+		       i == graph->local_pax_id ? "Local" : "OK", nports);
+		for (j = 0; j < SWITCHTEC_FAB_MAX_PAX; j++) {
+			port = switchtec_fab_topo_route(graph, i, j);
+			if (port >= 0 && j != i)
+				printf("%d:%d ", j, port);
+		}
+		printf("\n");
+
+		if (cfg.gfms)
+			printf("%-8s\tEPs: %d, HVDs: %d\n", "",
+			       node->pax_general.body.ep_count,
+			       node->pax_general.body.hvd_count);
+	}
+
+	free(graph);
+	return 0;
+}
+
 #define CMD_DESC_ROUTE "show routing information"
 
 static int route(int argc, char **argv)
@@ -1381,6 +1586,111 @@ static void print_gfms_event_list(struct switchtec_gfms_event *e, size_t cnt,
 	}
 }
 
+#define CMD_DESC_GFMS_WATCH "report GFMS database changes as they happen"
+
+static volatile sig_atomic_t gfms_watch_stop;
+
+static void gfms_watch_sig(int sig)
+{
+	gfms_watch_stop = 1;
+}
+
+static const char *gfms_section_str(enum switchtec_gfms_db_section section)
+{
+	switch (section) {
+	case SWITCHTEC_GFMS_DB_SECTION_PAX_GENERAL: return "PAX General";
+	case SWITCHTEC_GFMS_DB_SECTION_HVD: return "HVD";
+	case SWITCHTEC_GFMS_DB_SECTION_EP_PORT: return "EP Port";
+	default: return "Unknown";
+	}
+}
+
+static const char *gfms_change_str(enum switchtec_gfms_db_change_type type)
+{
+	switch (type) {
+	case SWITCHTEC_GFMS_DB_ADDED: return "added";
+	case SWITCHTEC_GFMS_DB_REMOVED: return "removed";
+	case SWITCHTEC_GFMS_DB_CHANGED: return "changed";
+	default: return "unknown";
+	}
+}
+
+static int gfms_watch(int argc, char **argv)
+{
+	struct switchtec_gfms_db_change changes[64];
+	struct switchtec_gfms_db_snapshot *snap;
+	int i, n;
+	int ret = 0;
+
+	static struct {
+		struct switchtec_dev *dev;
+		unsigned interval;
+	} cfg = {
+		.interval = 1000,
+	};
+
+	const struct argconfig_options opts[] = {
+		DEVICE_OPTION,
+		{"interval", 'i', "MS", CFG_POSITIVE, &cfg.interval,
+		 required_argument,
+		 "time between event queue polls in milliseconds (default: 1000)"},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_GFMS_WATCH, opts, &cfg,
+			sizeof(cfg));
+
+	snap = switchtec_fab_gfms_db_snapshot(cfg.dev);
+	if (!snap) {
+		switchtec_perror("gfms_watch");
+		return -1;
+	}
+
+	gfms_watch_stop = 0;
+	signal(SIGINT, gfms_watch_sig);
+	signal(SIGTERM, gfms_watch_sig);
+
+	while (!gfms_watch_stop) {
+		n = switchtec_fab_gfms_db_snapshot_update(cfg.dev, snap,
+							  changes,
+							  ARRAY_SIZE(changes));
+		if (n < 0) {
+			switchtec_perror("gfms_watch");
+			ret = n;
+			break;
+		}
+
+		for (i = 0; i < n && i < ARRAY_SIZE(changes); i++) {
+			if (changes[i].section ==
+			    SWITCHTEC_GFMS_DB_SECTION_PAX_GENERAL)
+				printf("%s %s\n",
+				       gfms_section_str(changes[i].section),
+				       gfms_change_str(changes[i].type));
+			else
+				printf("%s %d %s\n",
+				       gfms_section_str(changes[i].section),
+				       changes[i].id,
+				       gfms_change_str(changes[i].type));
+		}
+
+		if (n > ARRAY_SIZE(changes))
+			printf("... and %d more changes\n",
+			       n - (int)ARRAY_SIZE(changes));
+
+		fflush(stdout);
+
+		if (cfg.interval >= 1000)
+			sleep(cfg.interval / 1000);
+		usleep((cfg.interval % 1000) * 1000);
+	}
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	switchtec_fab_gfms_db_snapshot_free(snap);
+
+	return ret;
+}
+
 #define CMD_DESC_GFMS_EVENTS "display GFMS event information"
 
 static int gfms_events(int argc, char **argv)
@@ -1618,12 +1928,65 @@ static int ep_tunnel_cfg(int argc, char **argv)
 	return ret;
 }
 
+static int ep_range_alloc(uint8_t **buf, unsigned count, unsigned bytes)
+{
+	if (count > SIZE_MAX / bytes) {
+		fprintf(stderr, "Count is too large\n");
+		return -1;
+	}
+
+	*buf = malloc(count * bytes);
+	if (!*buf) {
+		perror("malloc");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int ep_range_print(const uint8_t *buf, unsigned long long addr,
+			  unsigned bytes, unsigned count, unsigned style)
+{
+	unsigned long long val;
+	uint16_t v16;
+	uint32_t v32;
+	uint64_t v64;
+	int i, ret = 0;
+
+	for (i = 0; i < count && !ret; i++) {
+		switch (bytes) {
+		case 1:
+			val = buf[0];
+			break;
+		case 2:
+			memcpy(&v16, buf, 2);
+			val = le16toh(v16);
+			break;
+		case 4:
+			memcpy(&v32, buf, 4);
+			val = le32toh(v32);
+			break;
+		default:
+			memcpy(&v64, buf, 8);
+			val = le64toh(v64);
+			break;
+		}
+
+		ret = raw_print_funcs[style](val, addr, bytes);
+		addr += bytes;
+		buf += bytes;
+	}
+
+	return ret;
+}
+
 #define CMD_DESC_EP_CSR_READ "read CSR of an EP"
 static int ep_csr_read(int argc, char **argv)
 {
 	uint32_t val;
 	uint16_t addr;
 	unsigned bytes;
+	uint8_t *buf;
 	int i;
 	int ret = 0;
 
@@ -1682,6 +2045,26 @@ static int ep_csr_read(int argc, char **argv)
 
 	addr = (uint16_t)cfg.addr;
 	bytes = cfg.bytes;
+
+	/* Dword reads of a range are batched rather than issued one by one */
+	if (cfg.count > 1 && bytes == 4) {
+		addr &= ~3;
+		ret = ep_range_alloc(&buf, cfg.count, bytes);
+		if (ret)
+			return ret;
+
+		ret = switchtec_ep_csr_read_range(cfg.dev, cfg.pdfid, addr,
+						  buf, cfg.count * bytes);
+		if (ret)
+			switchtec_perror("ep_csr_read");
+		else
+			ret = ep_range_print(buf, addr, bytes, cfg.count,
+					     cfg.print_style);
+
+		free(buf);
+		return ret;
+	}
+
 	for (i = 0; i < cfg.count; i++) {
 		addr = addr & ~(bytes - 1);
 
@@ -1880,6 +2263,12 @@ static int ep_bar_read(int argc, char **argv)
 
 	addr = cfg.addr;
 	bytes = cfg.bytes;
+
+	/*
+	 * BAR registers can have side effects that depend on the access
+	 * width, so every read is issued at the width that was asked for
+	 * rather than letting a range read pick it.
+	 */
 	for (i = 0; i < cfg.count; i++) {
 		addr = addr & ~(bytes - 1);
 		val = 0;
@@ -2020,12 +2409,15 @@ static const struct cmd commands[] = {
 	{"topo_info", topo_info, CMD_DESC_TOPO_INFO},
 	{"gfms_bind", gfms_bind, CMD_DESC_GFMS_BIND},
 	{"gfms_unbind", gfms_unbind, CMD_DESC_GFMS_UNBIND},
+	{"gfms_bind_apply", gfms_bind_apply, CMD_DESC_GFMS_BIND_APPLY},
 	{"gfms_dump", gfms_dump, CMD_DESC_GFMS_DUMP},
 	{"route", route, CMD_DESC_ROUTE},
+	{"topo_crawl", topo_crawl, CMD_DESC_TOPO_CRAWL},
 	{"port_control", port_control, CMD_DESC_PORT_CONTROL},
 	{"portcfg_show", portcfg_show, CMD_DESC_PORTCFG_SHOW},
 	{"portcfg_set", portcfg_set, CMD_DESC_PORTCFG_SET},
 	{"gfms_events", gfms_events, CMD_DESC_GFMS_EVENTS},
+	{"gfms_watch", gfms_watch, CMD_DESC_GFMS_WATCH},
 	{"ep_tunnel_cfg", ep_tunnel_cfg, CMD_DESC_EP_TNL_CFG},
 	{"ep_csr_read", ep_csr_read, CMD_DESC_EP_CSR_READ},
 	{"ep_csr_write", ep_csr_write, CMD_DESC_EP_CSR_WRITE},
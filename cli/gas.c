@@ -29,9 +29,13 @@
 #include <switchtec/switchtec.h>
 #include <switchtec/portable.h>
 #include <switchtec/gas.h>
+#include <switchtec/endian.h>
 
 #include <unistd.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
 #include <sys/types.h>
 #include <errno.h>
 #include <ctype.h>
@@ -606,10 +610,799 @@ static int gas_write(int argc, char **argv)
 	return ret;
 }
 
+/*
+ * GAS snapshots are stored in fixed size chunks so registers that are
+ * all zero (most of the NTB and unused PFF space) cost a few bytes.
+ * Every other chunk is run-length encoded by dword: a run of zero
+ * dwords followed by a run of literal dwords, repeated to the end of
+ * the chunk. All fields are little endian.
+ */
+#define GAS_SNAP_MAGIC "SWGASSNP"
+#define GAS_SNAP_VERSION 1
+#define GAS_SNAP_CHUNK 4096
+#define GAS_SNAP_DWORDS (GAS_SNAP_CHUNK / 4)
+
+enum {
+	GAS_SNAP_ABSENT,	//!< Not read, skipped by diff
+	GAS_SNAP_ZERO,
+	GAS_SNAP_RAW,
+	GAS_SNAP_RLE,
+};
+
+struct gas_snap_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t chunk_size;
+	uint64_t gas_size;
+	uint64_t timestamp;
+	uint32_t device_id;
+	uint32_t fw_version;
+};
+
+struct gas_snap_chunk {
+	uint8_t type;
+	uint8_t rsvd[3];
+	uint32_t len;
+};
+
+struct gas_snap_run {
+	uint16_t zeros;
+	uint16_t literals;
+};
+
+struct gas_snap {
+	struct gas_snap_hdr hdr;
+	uint8_t *data;
+	uint8_t *present;
+	size_t nr_chunks;
+};
+
+static size_t gas_snap_encode(const uint32_t *in, size_t dwords, uint8_t *out)
+{
+	struct gas_snap_run run;
+	size_t i = 0, len = 0, start;
+
+	while (i < dwords) {
+		start = i;
+		while (i < dwords && !in[i])
+			i++;
+		run.zeros = htole16(i - start);
+
+		start = i;
+		while (i < dwords && (in[i] || (i + 1 < dwords && in[i + 1])))
+			i++;
+		run.literals = htole16(i - start);
+
+		if (len + sizeof(run) + (i - start) * 4 >= dwords * 4)
+			return 0;
+
+		memcpy(out + len, &run, sizeof(run));
+		len += sizeof(run);
+		memcpy(out + len, &in[start], (i - start) * 4);
+		len += (i - start) * 4;
+	}
+
+	return len;
+}
+
+static int gas_snap_decode(const uint8_t *in, size_t len, uint8_t *out,
+			   size_t dwords)
+{
+	struct gas_snap_run run;
+	size_t pos = 0, i = 0, zeros, literals;
+
+	while (pos < len) {
+		if (len - pos < sizeof(run))
+			return -1;
+		memcpy(&run, in + pos, sizeof(run));
+		pos += sizeof(run);
+
+		zeros = le16toh(run.zeros);
+		literals = le16toh(run.literals);
+		if (i + zeros + literals > dwords ||
+		    len - pos < literals * 4)
+			return -1;
+
+		memset(out + i * 4, 0, zeros * 4);
+		i += zeros;
+		memcpy(out + i * 4, in + pos, literals * 4);
+		i += literals;
+		pos += literals * 4;
+	}
+
+	memset(out + i * 4, 0, (dwords - i) * 4);
+	return 0;
+}
+
+static int gas_snap_write_chunk(FILE *f, const uint8_t *buf, size_t len,
+				int type, uint8_t *rle)
+{
+	struct gas_snap_chunk chunk = {
+		.type = type,
+	};
+	const uint32_t *dw = (const uint32_t *)buf;
+	size_t i, rle_len = 0;
+
+	if (type == GAS_SNAP_RAW) {
+		for (i = 0; i < len / 4 && !dw[i]; i++)
+			;
+		if (i == len / 4)
+			chunk.type = GAS_SNAP_ZERO;
+		else
+			rle_len = gas_snap_encode(dw, len / 4, rle);
+
+		if (rle_len) {
+			chunk.type = GAS_SNAP_RLE;
+			buf = rle;
+			len = rle_len;
+		}
+	}
+
+	if (chunk.type != GAS_SNAP_RAW && chunk.type != GAS_SNAP_RLE)
+		len = 0;
+
+	chunk.len = htole32(len);
+	if (fwrite(&chunk, sizeof(chunk), 1, f) != 1)
+		return -1;
+	if (len && fwrite(buf, len, 1, f) != 1)
+		return -1;
+
+	return 0;
+}
+
+static int gas_snap_load(FILE *f, const char *name, struct gas_snap *snap)
+{
+	static uint8_t buf[GAS_SNAP_CHUNK];
+	struct gas_snap_chunk chunk;
+	size_t i, off, len;
+
+	memset(snap, 0, sizeof(*snap));
+
+	if (fread(&snap->hdr, sizeof(snap->hdr), 1, f) != 1 ||
+	    memcmp(snap->hdr.magic, GAS_SNAP_MAGIC, sizeof(snap->hdr.magic)))
+		goto invalid;
+
+	snap->hdr.version = le32toh(snap->hdr.version);
+	snap->hdr.chunk_size = le32toh(snap->hdr.chunk_size);
+	snap->hdr.gas_size = le64toh(snap->hdr.gas_size);
+	snap->hdr.timestamp = le64toh(snap->hdr.timestamp);
+	snap->hdr.device_id = le32toh(snap->hdr.device_id);
+	snap->hdr.fw_version = le32toh(snap->hdr.fw_version);
+
+	if (snap->hdr.version != GAS_SNAP_VERSION ||
+	    snap->hdr.chunk_size != GAS_SNAP_CHUNK ||
+	    !snap->hdr.gas_size || snap->hdr.gas_size % 4 ||
+	    snap->hdr.gas_size > sizeof(struct switchtec_gas))
+		goto invalid;
+
+	snap->nr_chunks = (snap->hdr.gas_size + GAS_SNAP_CHUNK - 1) /
+		GAS_SNAP_CHUNK;
+	snap->data = malloc(snap->hdr.gas_size);
+	snap->present = calloc(snap->nr_chunks, 1);
+	if (!snap->data || !snap->present) {
+		perror(name);
+		goto free_and_exit;
+	}
+
+	for (i = 0; i < snap->nr_chunks; i++) {
+		off = i * GAS_SNAP_CHUNK;
+		len = snap->hdr.gas_size - off;
+		if (len > GAS_SNAP_CHUNK)
+			len = GAS_SNAP_CHUNK;
+
+		if (fread(&chunk, sizeof(chunk), 1, f) != 1)
+			goto invalid;
+		chunk.len = le32toh(chunk.len);
+		if (chunk.len > len)
+			goto invalid;
+		if (chunk.len && fread(buf, chunk.len, 1, f) != 1)
+			goto invalid;
+
+		switch (chunk.type) {
+		case GAS_SNAP_ABSENT:
+			continue;
+		case GAS_SNAP_ZERO:
+			memset(snap->data + off, 0, len);
+			break;
+		case GAS_SNAP_RAW:
+			if (chunk.len != len)
+				goto invalid;
+			memcpy(snap->data + off, buf, len);
+			break;
+		case GAS_SNAP_RLE:
+			if (gas_snap_decode(buf, chunk.len, snap->data + off,
+					    len / 4))
+				goto invalid;
+			break;
+		default:
+			goto invalid;
+		}
+
+		snap->present[i] = 1;
+	}
+
+	return 0;
+
+invalid:
+	fprintf(stderr, "%s: Invalid GAS snapshot file\n", name);
+free_and_exit:
+	free(snap->data);
+	free(snap->present);
+	return -1;
+}
+
+static void gas_snap_free(struct gas_snap *snap)
+{
+	free(snap->data);
+	free(snap->present);
+}
+
+#define CMD_DESC_SNAPSHOT "save a compressed snapshot of the Global Address Space (Main Firmware only)"
+
+static int gas_snapshot(int argc, char **argv)
+{
+	static uint8_t buf[GAS_SNAP_CHUNK], rle[GAS_SNAP_CHUNK];
+	struct gas_snap_hdr hdr = {
+		.magic = GAS_SNAP_MAGIC,
+	};
+	size_t map_size, off, len, stored = 0, failed = 0;
+	uint32_t device_id, fw_version;
+	void __gas *base;
+	gasptr_t map;
+	int type, ret;
+
+	static struct {
+		struct switchtec_dev *dev;
+		FILE *out;
+		const char *out_name;
+		size_t count;
+	} cfg = {};
+	const struct argconfig_options opts[] = {
+		DEVICE_OPTION,
+		{"snapshot_file", .cfg_type=CFG_FILE_W, .value_addr=&cfg.out,
+		  .argument_type=required_positional,
+		  .help="file to store the snapshot in"},
+		{"count", 'n', "NUM", CFG_SIZE_SUFFIX, &cfg.count, required_argument,
+		 "number of bytes to capture (default is the entire GAS space)"},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_SNAPSHOT, opts, &cfg, sizeof(cfg));
+
+	if (switchtec_boot_phase(cfg.dev) != SWITCHTEC_BOOT_PHASE_FW) {
+		fprintf(stderr, "GAS is only available with Main Firmware!\n");
+		return -1;
+	}
+
+	map = switchtec_gas_map(cfg.dev, 0, &map_size);
+	if (map == SWITCHTEC_MAP_FAILED) {
+		switchtec_perror("gas_map");
+		return 1;
+	}
+
+	base = map;
+	if (map_size > sizeof(struct switchtec_gas))
+		map_size = sizeof(struct switchtec_gas);
+	if (!cfg.count || cfg.count > map_size)
+		cfg.count = map_size;
+	cfg.count = (cfg.count + 3) & ~(size_t)3;
+
+	if (gas_read32(cfg.dev, &map->sys_info.device_id, &device_id) ||
+	    gas_read32(cfg.dev, &map->sys_info.firmware_version,
+		       &fw_version)) {
+		switchtec_perror("gas read");
+		ret = 1;
+		goto unmap;
+	}
+
+	memcpy(hdr.magic, GAS_SNAP_MAGIC, sizeof(hdr.magic));
+	hdr.version = htole32(GAS_SNAP_VERSION);
+	hdr.chunk_size = htole32(GAS_SNAP_CHUNK);
+	hdr.gas_size = htole64(cfg.count);
+	hdr.timestamp = htole64(time(NULL));
+	hdr.device_id = htole32(device_id);
+	hdr.fw_version = htole32(fw_version);
+
+	if (fwrite(&hdr, sizeof(hdr), 1, cfg.out) != 1)
+		goto write_error;
+
+	for (off = 0; off < cfg.count; off += GAS_SNAP_CHUNK) {
+		len = cfg.count - off;
+		if (len > GAS_SNAP_CHUNK)
+			len = GAS_SNAP_CHUNK;
+
+		/* The MRPC region is scratch space for commands */
+		type = GAS_SNAP_RAW;
+		if (off < SWITCHTEC_GAS_TOP_CFG_OFFSET) {
+			type = GAS_SNAP_ABSENT;
+		} else if (memcpy_from_gas(cfg.dev, buf, base + off, len)) {
+			if (errno == EPERM) {
+				fprintf(stderr, "GAS snapshot: permission denied\n");
+				fclose(cfg.out);
+				ret = 1;
+				goto unmap;
+			}
+			type = GAS_SNAP_ABSENT;
+			failed++;
+		}
+
+		if (gas_snap_write_chunk(cfg.out, buf, len, type, rle))
+			goto write_error;
+	}
+
+	stored = ftell(cfg.out);
+	ret = fclose(cfg.out);
+	if (ret)
+		goto close_error;
+
+	fprintf(stderr, "Saved %zu bytes of GAS in %zu bytes to %s\n",
+		cfg.count, stored, cfg.out_name);
+	if (failed)
+		fprintf(stderr, "%zu chunks could not be read and were skipped\n",
+			failed);
+
+	goto unmap;
+
+write_error:
+	fclose(cfg.out);
+close_error:
+	perror(cfg.out_name);
+	ret = 1;
+unmap:
+	switchtec_gas_unmap(cfg.dev, map);
+	return ret;
+}
+
+struct gas_field {
+	const char *name;
+	size_t offset;
+	size_t size;
+	size_t elem;
+};
+
+#define GAS_REG(type, m) { #m, offsetof(struct type, m), \
+		sizeof(((struct type *)0)->m), sizeof(((struct type *)0)->m) }
+#define GAS_ARRAY(type, m) { #m, offsetof(struct type, m), \
+		sizeof(((struct type *)0)->m), sizeof(((struct type *)0)->m[0]) }
+#define GAS_EVENT(type, m) GAS_REG(type, m##_hdr), GAS_ARRAY(type, m##_data)
+#define GAS_PART_INFO(m) GAS_REG(flash_info_regs, m.address), \
+		GAS_REG(flash_info_regs, m.length)
+#define GAS_ACTIVE_INFO(m) GAS_REG(flash_info_regs, m.address), \
+		GAS_REG(flash_info_regs, m.build_version), \
+		GAS_REG(flash_info_regs, m.build_string)
+
+static const struct gas_field mrpc_fields[] = {
+	GAS_ARRAY(mrpc_regs, input_data),
+	GAS_ARRAY(mrpc_regs, output_data),
+	GAS_REG(mrpc_regs, cmd),
+	GAS_REG(mrpc_regs, status),
+	GAS_REG(mrpc_regs, ret_value),
+	{}
+};
+
+static const struct gas_field top_fields[] = {
+	GAS_REG(top_regs, bifur_valid),
+	GAS_ARRAY(top_regs, stack_valid),
+	GAS_REG(top_regs, partition_count),
+	GAS_REG(top_regs, partition_id),
+	GAS_REG(top_regs, pff_count),
+	GAS_ARRAY(top_regs, pff_port),
+	{}
+};
+
+static const struct gas_field sw_event_fields[] = {
+	GAS_REG(sw_event_regs, event_report_ctrl),
+	GAS_REG(sw_event_regs, part_event_bitmap),
+	GAS_REG(sw_event_regs, global_summary),
+	GAS_REG(sw_event_regs, stack_error_event_hdr),
+	GAS_REG(sw_event_regs, stack_error_event_data),
+	GAS_REG(sw_event_regs, ppu_error_event_hdr),
+	GAS_REG(sw_event_regs, ppu_error_event_data),
+	GAS_REG(sw_event_regs, isp_error_event_hdr),
+	GAS_REG(sw_event_regs, isp_error_event_data),
+	GAS_REG(sw_event_regs, sys_reset_event_hdr),
+	GAS_REG(sw_event_regs, fw_exception_hdr),
+	GAS_REG(sw_event_regs, fw_nmi_hdr),
+	GAS_REG(sw_event_regs, fw_non_fatal_hdr),
+	GAS_REG(sw_event_regs, fw_fatal_hdr),
+	GAS_REG(sw_event_regs, twi_mrpc_comp_hdr),
+	GAS_REG(sw_event_regs, twi_mrpc_comp_data),
+	GAS_REG(sw_event_regs, twi_mrpc_comp_async_hdr),
+	GAS_REG(sw_event_regs, twi_mrpc_comp_async_data),
+	GAS_REG(sw_event_regs, cli_mrpc_comp_hdr),
+	GAS_REG(sw_event_regs, cli_mrpc_comp_data),
+	GAS_REG(sw_event_regs, cli_mrpc_comp_async_hdr),
+	GAS_REG(sw_event_regs, cli_mrpc_comp_async_data),
+	GAS_REG(sw_event_regs, gpio_interrupt_hdr),
+	GAS_REG(sw_event_regs, gpio_interrupt_data),
+	GAS_REG(sw_event_regs, gfms_event_hdr),
+	GAS_REG(sw_event_regs, gfms_event_data),
+	GAS_ARRAY(sw_event_regs, customer_events),
+	{}
+};
+
+static const struct gas_field sys_info_fields[] = {
+	GAS_REG(sys_info_regs, device_id),
+	GAS_REG(sys_info_regs, device_version),
+	GAS_REG(sys_info_regs, firmware_version),
+	GAS_REG(sys_info_regs, vendor_table_revision),
+	GAS_REG(sys_info_regs, table_format_version),
+	GAS_REG(sys_info_regs, partition_id),
+	GAS_REG(sys_info_regs, cfg_file_fmt_version),
+	GAS_REG(sys_info_regs, cfg_running),
+	GAS_REG(sys_info_regs, img_running),
+	GAS_ARRAY(sys_info_regs, vendor_id),
+	GAS_ARRAY(sys_info_regs, product_id),
+	GAS_ARRAY(sys_info_regs, product_revision),
+	GAS_ARRAY(sys_info_regs, component_vendor),
+	GAS_REG(sys_info_regs, component_id),
+	GAS_REG(sys_info_regs, component_revision),
+	{}
+};
+
+static const struct gas_field flash_info_fields[] = {
+	GAS_REG(flash_info_regs, flash_part_map_upd_idx),
+	GAS_ACTIVE_INFO(active_img),
+	GAS_ACTIVE_INFO(active_cfg),
+	GAS_ACTIVE_INFO(inactive_img),
+	GAS_ACTIVE_INFO(inactive_cfg),
+	GAS_REG(flash_info_regs, flash_length),
+	GAS_PART_INFO(cfg0),
+	GAS_PART_INFO(cfg1),
+	GAS_PART_INFO(img0),
+	GAS_PART_INFO(img1),
+	GAS_PART_INFO(nvlog),
+	GAS_ARRAY(flash_info_regs, vendor),
+	{}
+};
+
+static const struct gas_field part_cfg_fields[] = {
+	GAS_REG(part_cfg_regs, status),
+	GAS_REG(part_cfg_regs, state),
+	GAS_REG(part_cfg_regs, port_cnt),
+	GAS_REG(part_cfg_regs, usp_port_mode),
+	GAS_REG(part_cfg_regs, usp_pff_inst_id),
+	GAS_REG(part_cfg_regs, vep_pff_inst_id),
+	GAS_ARRAY(part_cfg_regs, dsp_pff_inst_id),
+	GAS_REG(part_cfg_regs, vep_vector_number),
+	GAS_REG(part_cfg_regs, usp_vector_number),
+	GAS_REG(part_cfg_regs, port_event_bitmap),
+	GAS_REG(part_cfg_regs, part_event_summary),
+	GAS_EVENT(part_cfg_regs, part_reset),
+	GAS_EVENT(part_cfg_regs, mrpc_comp),
+	GAS_EVENT(part_cfg_regs, mrpc_comp_async),
+	GAS_EVENT(part_cfg_regs, dyn_binding),
+	GAS_ARRAY(part_cfg_regs, customer_events),
+	{}
+};
+
+static const struct gas_field ntb_info_fields[] = {
+	GAS_REG(ntb_info_regs, partition_count),
+	GAS_REG(ntb_info_regs, partition_id),
+	GAS_REG(ntb_info_regs, ep_map),
+	GAS_REG(ntb_info_regs, requester_id),
+	{}
+};
+
+static const struct gas_field ntb_ctrl_fields[] = {
+	GAS_REG(ntb_ctrl_regs, partition_status),
+	GAS_REG(ntb_ctrl_regs, partition_op),
+	GAS_REG(ntb_ctrl_regs, partition_ctrl),
+	GAS_REG(ntb_ctrl_regs, bar_setup),
+	GAS_REG(ntb_ctrl_regs, bar_error),
+	GAS_REG(ntb_ctrl_regs, lut_table_entries),
+	GAS_REG(ntb_ctrl_regs, lut_table_offset),
+	GAS_REG(ntb_ctrl_regs, lut_error),
+	GAS_REG(ntb_ctrl_regs, req_id_table_size),
+	GAS_REG(ntb_ctrl_regs, req_id_table_offset),
+	GAS_REG(ntb_ctrl_regs, req_id_error),
+	GAS_ARRAY(ntb_ctrl_regs, bar_entry),
+	GAS_ARRAY(ntb_ctrl_regs, req_id_table),
+	GAS_ARRAY(ntb_ctrl_regs, lut_entry),
+	{}
+};
+
+static const struct gas_field ntb_dbmsg_fields[] = {
+	GAS_REG(ntb_dbmsg_regs, odb),
+	GAS_REG(ntb_dbmsg_regs, odb_mask),
+	GAS_REG(ntb_dbmsg_regs, idb),
+	GAS_REG(ntb_dbmsg_regs, idb_mask),
+	GAS_ARRAY(ntb_dbmsg_regs, idb_vec_map),
+	GAS_REG(ntb_dbmsg_regs, msg_map),
+	GAS_ARRAY(ntb_dbmsg_regs, omsg),
+	GAS_ARRAY(ntb_dbmsg_regs, imsg),
+	GAS_ARRAY(ntb_dbmsg_regs, msix_table),
+	GAS_ARRAY(ntb_dbmsg_regs, pba),
+	{}
+};
+
+static const struct gas_field pff_csr_fields[] = {
+	GAS_REG(pff_csr_regs, vendor_id),
+	GAS_REG(pff_csr_regs, device_id),
+	GAS_ARRAY(pff_csr_regs, pci_cfg_header),
+	GAS_ARRAY(pff_csr_regs, pci_cap_region),
+	GAS_ARRAY(pff_csr_regs, pcie_cap_region),
+	GAS_ARRAY(pff_csr_regs, indirect_gas_window),
+	GAS_REG(pff_csr_regs, indirect_gas_window_off),
+	GAS_REG(pff_csr_regs, pff_event_summary),
+	GAS_EVENT(pff_csr_regs, aer_in_p2p),
+	GAS_EVENT(pff_csr_regs, aer_in_vep),
+	GAS_EVENT(pff_csr_regs, dpc),
+	GAS_EVENT(pff_csr_regs, cts),
+	GAS_EVENT(pff_csr_regs, uec),
+	GAS_EVENT(pff_csr_regs, hotplug),
+	GAS_EVENT(pff_csr_regs, ier),
+	GAS_EVENT(pff_csr_regs, threshold),
+	GAS_EVENT(pff_csr_regs, power_mgmt),
+	GAS_EVENT(pff_csr_regs, tlp_throttling),
+	GAS_EVENT(pff_csr_regs, force_speed),
+	GAS_EVENT(pff_csr_regs, credit_timeout),
+	GAS_EVENT(pff_csr_regs, link_state),
+	GAS_ARRAY(pff_csr_regs, customer_events),
+	{}
+};
+
+static const struct gas_region {
+	const char *name;
+	size_t base;
+	size_t size;
+	int count;
+	const struct gas_field *fields;
+} gas_regions[] = {
+	{"mrpc", SWITCHTEC_GAS_MRPC_OFFSET, sizeof(struct mrpc_regs), 1,
+	 mrpc_fields},
+	{"top", SWITCHTEC_GAS_TOP_CFG_OFFSET, sizeof(struct top_regs), 1,
+	 top_fields},
+	{"sw_event", SWITCHTEC_GAS_SW_EVENT_OFFSET,
+	 sizeof(struct sw_event_regs), 1, sw_event_fields},
+	{"sys_info", SWITCHTEC_GAS_SYS_INFO_OFFSET,
+	 sizeof(struct sys_info_regs), 1, sys_info_fields},
+	{"flash_info", SWITCHTEC_GAS_FLASH_INFO_OFFSET,
+	 sizeof(struct flash_info_regs), 1, flash_info_fields},
+	{"part_cfg", SWITCHTEC_GAS_PART_CFG_OFFSET,
+	 sizeof(struct part_cfg_regs), SWITCHTEC_MAX_PARTITIONS,
+	 part_cfg_fields},
+	{"ntb.info", SWITCHTEC_GAS_NTB_OFFSET + SWITCHTEC_NTB_REG_INFO_OFFSET,
+	 sizeof(struct ntb_info_regs), 1, ntb_info_fields},
+	{"ntb.ctrl", SWITCHTEC_GAS_NTB_OFFSET + SWITCHTEC_NTB_REG_CTRL_OFFSET,
+	 sizeof(struct ntb_ctrl_regs), SWITCHTEC_MAX_PARTITIONS,
+	 ntb_ctrl_fields},
+	{"ntb.dbmsg", SWITCHTEC_GAS_NTB_OFFSET + SWITCHTEC_NTB_REG_DBMSG_OFFSET,
+	 sizeof(struct ntb_dbmsg_regs), SWITCHTEC_MAX_PARTITIONS,
+	 ntb_dbmsg_fields},
+	{"pff_csr", SWITCHTEC_GAS_PFF_CSR_OFFSET,
+	 sizeof(struct pff_csr_regs), SWITCHTEC_MAX_PFF_CSR, pff_csr_fields},
+	{}
+};
+
+/*
+ * Name the register at a GAS offset, e.g. "pff_csr[3].hotplug_hdr" or
+ * "part_cfg[0].dsp_pff_inst_id[5]". Offsets within a structure but no
+ * named field are given relative to the structure.
+ */
+static const char *gas_reg_name(size_t offset)
+{
+	static char name[96];
+	const struct gas_region *r;
+	const struct gas_field *f;
+	size_t rel, idx;
+	int n;
+
+	for (r = gas_regions; r->name; r++)
+		if (offset >= r->base && offset < r->base + r->size * r->count)
+			break;
+
+	if (!r->name) {
+		snprintf(name, sizeof(name), "-");
+		return name;
+	}
+
+	idx = (offset - r->base) / r->size;
+	rel = (offset - r->base) % r->size;
+
+	if (r->count > 1)
+		n = snprintf(name, sizeof(name), "%s[%zu]", r->name, idx);
+	else
+		n = snprintf(name, sizeof(name), "%s", r->name);
+
+	for (f = r->fields; f->name; f++)
+		if (rel >= f->offset && rel < f->offset + f->size)
+			break;
+
+	if (!f->name) {
+		snprintf(name + n, sizeof(name) - n, "+0x%zx", rel);
+		return name;
+	}
+
+	n += snprintf(name + n, sizeof(name) - n, ".%s", f->name);
+	rel -= f->offset;
+
+	if (f->elem != f->size) {
+		n += snprintf(name + n, sizeof(name) - n, "[%zu]",
+			      rel / f->elem);
+		rel %= f->elem;
+	}
+
+	if (rel)
+		snprintf(name + n, sizeof(name) - n, "+0x%zx", rel);
+
+	return name;
+}
+
+/*
+ * Print every dword that differs between two copies of a GAS chunk.
+ * Unchanged chunks are the common case, so whole 64 byte blocks are
+ * compared with memcmp() first and only differing blocks are walked
+ * a dword at a time.
+ */
+static int gas_diff_chunk(size_t base, const uint8_t *a, const uint8_t *b,
+			  size_t len)
+{
+	const size_t block = 64;
+	uint32_t va, vb;
+	size_t off, i, n;
+	int changed = 0;
+
+	if (!memcmp(a, b, len))
+		return 0;
+
+	for (off = 0; off < len; off += block) {
+		n = len - off < block ? len - off : block;
+		if (!memcmp(a + off, b + off, n))
+			continue;
+
+		for (i = off; i < off + n; i += 4) {
+			memcpy(&va, a + i, sizeof(va));
+			memcpy(&vb, b + i, sizeof(vb));
+			if (va == vb)
+				continue;
+
+			printf("%06zx  %-44s 0x%08x -> 0x%08x\n", base + i,
+			       gas_reg_name(base + i), le32toh(va),
+			       le32toh(vb));
+			changed++;
+		}
+	}
+
+	return changed;
+}
+
+static void gas_snap_describe(const char *label, const char *name,
+			      const struct gas_snap_hdr *hdr)
+{
+	char ver[32];
+	char date[64];
+	time_t t = hdr->timestamp;
+
+	snprintf(ver, sizeof(ver), "%x.%02x B%03X", hdr->fw_version >> 24,
+		 (hdr->fw_version >> 16) & 0xff, hdr->fw_version & 0xffff);
+	strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&t));
+	printf("%s %s (device 0x%04x, firmware %s, %s)\n", label, name,
+	       hdr->device_id, ver, date);
+}
+
+#define CMD_DESC_DIFF "compare GAS snapshots or a snapshot and the live device (Main Firmware only)"
+#define CMD_DESC_DIFF_LONG CMD_DESC_DIFF "\n\n" \
+	"Each changed register is printed with its name and old and new " \
+	"values. The exit status is 1 if any register changed."
+
+static int gas_diff(int argc, char **argv)
+{
+	static uint8_t live[GAS_SNAP_CHUNK];
+	struct gas_snap a, b = {};
+	const uint8_t *new;
+	size_t i, off, len, size, map_size = 0;
+	gasptr_t map = SWITCHTEC_MAP_FAILED;
+	void __gas *base = NULL;
+	int changed = 0, skipped = 0;
+
+	static struct {
+		struct switchtec_dev *dev;
+		FILE *old;
+		const char *old_name;
+		FILE *new;
+		const char *new_name;
+	} cfg = {};
+	const struct argconfig_options opts[] = {
+		{"old", .cfg_type=CFG_FILE_R, .value_addr=&cfg.old,
+		  .argument_type=required_positional,
+		  .help="snapshot taken with 'gas snapshot'"},
+		{"new", .cfg_type=CFG_FILE_R, .value_addr=&cfg.new,
+		  .argument_type=optional_positional,
+		  .help="snapshot to compare against, required unless "
+		  "--device is given"},
+		{"device", 'd', "DEV", CFG_CUSTOM, &cfg.dev, required_argument,
+		 "compare against the live registers of this device",
+		 .custom_handler=switchtec_handler},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_DIFF_LONG, opts, &cfg,
+			sizeof(cfg));
+
+	if (!cfg.new == !cfg.dev) {
+		fprintf(stderr, "Specify either a second snapshot or --device\n");
+		return 1;
+	}
+
+	if (gas_snap_load(cfg.old, cfg.old_name, &a))
+		return 1;
+
+	size = a.hdr.gas_size;
+	gas_snap_describe("---", cfg.old_name, &a.hdr);
+
+	if (cfg.new) {
+		if (gas_snap_load(cfg.new, cfg.new_name, &b)) {
+			gas_snap_free(&a);
+			return 1;
+		}
+		if (b.hdr.gas_size < size)
+			size = b.hdr.gas_size;
+		gas_snap_describe("+++", cfg.new_name, &b.hdr);
+	} else {
+		if (switchtec_boot_phase(cfg.dev) != SWITCHTEC_BOOT_PHASE_FW) {
+			fprintf(stderr, "GAS is only available with Main Firmware!\n");
+			gas_snap_free(&a);
+			return 1;
+		}
+
+		map = switchtec_gas_map(cfg.dev, 0, &map_size);
+		if (map == SWITCHTEC_MAP_FAILED) {
+			switchtec_perror("gas_map");
+			gas_snap_free(&a);
+			return 1;
+		}
+		base = map;
+		if (map_size < size)
+			size = map_size;
+		printf("+++ live device\n");
+	}
+
+	for (i = 0, off = 0; off < size; i++, off += GAS_SNAP_CHUNK) {
+		len = size - off;
+		if (len > GAS_SNAP_CHUNK)
+			len = GAS_SNAP_CHUNK;
+
+		/* The MRPC region is never captured */
+		if (off < SWITCHTEC_GAS_TOP_CFG_OFFSET)
+			continue;
+
+		if (!a.present[i] || (cfg.new && !b.present[i])) {
+			skipped++;
+			continue;
+		}
+
+		if (cfg.new) {
+			new = b.data + off;
+		} else if (memcpy_from_gas(cfg.dev, live, base + off, len)) {
+			skipped++;
+			continue;
+		} else {
+			new = live;
+		}
+
+		changed += gas_diff_chunk(off, a.data + off, new, len);
+	}
+
+	printf("%d register%s changed", changed, changed == 1 ? "" : "s");
+	if (skipped)
+		printf(", %d chunk%s not compared", skipped,
+		       skipped == 1 ? "" : "s");
+	printf("\n");
+
+	if (cfg.dev)
+		switchtec_gas_unmap(cfg.dev, map);
+	gas_snap_free(&a);
+	if (cfg.new)
+		gas_snap_free(&b);
+
+	return changed != 0;
+}
+
 static const struct cmd commands[] = {
 	{"dump", gas_dump, CMD_DESC_DUMP},
 	{"read", gas_read, CMD_DESC_READ},
 	{"write", gas_write, CMD_DESC_WRITE},
+	{"snapshot", gas_snapshot, CMD_DESC_SNAPSHOT},
+	{"diff", gas_diff, CMD_DESC_DIFF},
 	{}
 };
 
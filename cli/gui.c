@@ -27,6 +27,7 @@
 #include <switchtec/switchtec.h>
 #include <switchtec/portable.h>
 #include <switchtec/utils.h>
+#include <switchtec/record.h>
 #include "suffix.h"
 
 #if defined(HAVE_LIBCURSES) || defined(HAVE_LIBNCURSES)
@@ -42,6 +43,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <signal.h>
 #include <math.h>
@@ -51,7 +53,13 @@
 #define WINPORTY 16
 #define WINPORTSIZE WINPORTY, WINPORTX
 
-#define GUI_INIT_TIME 100000
+  /* Width of the sparklines after their "I " / "E " prefix */
+#define SPARK_LEN (WINPORTX - 4)
+
+#define GUI_STATUS_PERIOD_MS 1000
+
+#define GUI_KEY_RESET  1
+#define GUI_KEY_RESIZE 2
 
 static WINDOW *mainwin;
 
@@ -60,6 +68,16 @@ struct portloc {
 	unsigned starty;
 };
 
+  /* A port window and the text currently drawn in it. */
+
+struct portview {
+	WINDOW *win;
+	char lines[WINPORTY][WINPORTX];
+	double spark_ingress[SPARK_LEN];
+	double spark_egress[SPARK_LEN];
+	int spark_len;
+};
+
 static void cleanup(void)
 {
 	delwin(mainwin);
@@ -121,6 +139,16 @@ static void gui_signals(void)
 	setup_sigusr1();
 }
 
+static uint64_t gui_time_ms(void)
+{
+	struct timeval tv;
+
+	if (gettimeofday(&tv, NULL))
+		cleanup_and_error("gettimeofday");
+
+	return tv.tv_sec * 1000ULL + tv.tv_usec / 1000;
+}
+
   /* Generate a port based string for the port windows */
 
 static void portid_str(char *str, struct switchtec_port_id *port_id)
@@ -174,6 +202,41 @@ static void gui_printbw(char *str, const char *prefix, double val,
 		sprintf(str, "%s: %-.3g %sB/s", prefix, val, suf);
 }
 
+  /* Draw the recent rates, oldest on the left, scaled to their peak. */
+
+static void gui_sparkline(char *str, const char *prefix, const double *vals,
+			  int n)
+{
+	static const char ramp[] = " .:-=+*#";
+	double max = 0;
+	int i, lvl;
+
+	for (i = 0; i < n; i++)
+		if (isfinite(vals[i]) && vals[i] > max)
+			max = vals[i];
+
+	str += sprintf(str, "%s ", prefix);
+	for (i = SPARK_LEN - 1; i >= 0; i--) {
+		lvl = 0;
+		if (i < n && max > 0 && isfinite(vals[i]) && vals[i] > 0)
+			lvl = 1 + (int)(vals[i] / max * (sizeof(ramp) - 3));
+		*str++ = ramp[lvl];
+	}
+	*str = 0;
+}
+
+static void gui_spark_push(struct portview *v, double ingress, double egress)
+{
+	memmove(&v->spark_ingress[1], &v->spark_ingress[0],
+		(SPARK_LEN - 1) * sizeof(v->spark_ingress[0]));
+	memmove(&v->spark_egress[1], &v->spark_egress[0],
+		(SPARK_LEN - 1) * sizeof(v->spark_egress[0]));
+	v->spark_ingress[0] = ingress;
+	v->spark_egress[0] = egress;
+	if (v->spark_len < SPARK_LEN)
+		v->spark_len++;
+}
+
 struct portstats {
 	double tot_val_ingress;
 	double tot_val_egress;
@@ -201,176 +264,278 @@ static void gui_portcalc(struct switchtec_bwcntr_res *after,
 	stats->bw_rate_egress = egress_tot / (this.time_us * 1e-6);
 }
 
-  /* Draw a window for the port. */
+  /* Set one line of a port window, clipped to fit inside the border. */
 
-static WINDOW *gui_portwin(struct portloc *portlocs,
-			   struct switchtec_status *s, struct portstats *stats)
+static void gui_setline(char lines[][WINPORTX], int row, const char *str)
+{
+	size_t len = strlen(str);
+
+	if (len > WINPORTX - 2)
+		len = WINPORTX - 2;
+
+	memcpy(lines[row], str, len);
+	lines[row][len] = 0;
+}
+
+  /* Generate the text of a port window. */
+
+static void gui_portlines(char lines[][WINPORTX], struct portview *v,
+			  struct switchtec_status *s, struct portstats *stats)
 {
-	WINDOW *portwin;
 	char str[256];
 	const char *tot_suf, *bw_suf;
 
-	portwin = newwin(WINPORTSIZE, portlocs->starty, portlocs->startx);
-	wborder(portwin, WINBORDER);
+	memset(lines, 0, WINPORTY * WINPORTX);
+
 	portid_str(&str[0], &s->port);
-	mvwaddstr(portwin, 1, 1, &str[0]);
+	gui_setline(lines, 1, str);
 
 	sprintf(&str[0], "Link %s", s->link_up ? "UP" : "DOWN");
-	mvwaddstr(portwin, 2, 1, &str[0]);
+	gui_setline(lines, 2, str);
 
 	sprintf(&str[0], "%s-x%d", s->ltssm_str, s->cfg_lnk_width);
-	mvwaddstr(portwin, 3, 1, &str[0]);
+	gui_setline(lines, 3, str);
 	if (!s->link_up)
-		goto out;
+		return;
 
 	sprintf(&str[0], "x%d-Gen%d - %g GT/s",
 		s->neg_lnk_width, s->link_rate,
 		switchtec_gen_transfers[s->link_rate]);
-	mvwaddstr(portwin, 4, 1, &str[0]);
+	gui_setline(lines, 4, str);
 
 	if (s->vendor_id && s->device_id) {
 		snprintf(str, sizeof(str), "%04x:%04x", s->vendor_id,
 			 s->device_id);
-		mvwaddstr(portwin, 5, 1, &str[0]);
+		gui_setline(lines, 5, str);
 	}
 
 	if (s->class_devices) {
 		snprintf(str, sizeof(str), "%s", s->class_devices);
 		if (strlen(str) > WINPORTX - 2)
 			strcpy(&str[WINPORTX - 6], "...");
-		mvwaddstr(portwin, 6, 1, &str[0]);
+		gui_setline(lines, 6, str);
 	}
 
 	tot_suf = suffix_si_get(&stats->tot_val_ingress);
 	sprintf(&str[0], "I: %-.3g %sB", stats->tot_val_ingress, tot_suf);
-	mvwaddstr(portwin, 8, 1, &str[0]);
+	gui_setline(lines, 8, str);
 
 	tot_suf = suffix_si_get(&stats->tot_val_egress);
 	sprintf(&str[0], "E: %-.3g %sB", stats->tot_val_egress, tot_suf);
-	mvwaddstr(portwin, 9, 1, &str[0]);
+	gui_setline(lines, 9, str);
 
 	bw_suf = suffix_si_get(&stats->bw_rate_ingress);
 	gui_printbw(str, "I", stats->bw_rate_ingress, bw_suf);
-	mvwaddstr(portwin, 11, 1, &str[0]);
+	gui_setline(lines, 11, str);
 
 	bw_suf = suffix_si_get(&stats->bw_rate_egress);
 	gui_printbw(str, "E", stats->bw_rate_egress, bw_suf);
-	mvwaddstr(portwin, 12, 1, &str[0]);
+	gui_setline(lines, 12, str);
+
+	gui_sparkline(str, "I", v->spark_ingress, v->spark_len);
+	gui_setline(lines, 13, str);
 
- out:
-	wrefresh(portwin);
-	return portwin;
+	gui_sparkline(str, "E", v->spark_egress, v->spark_len);
+	gui_setline(lines, 14, str);
 }
 
-static int gui_winports(struct switchtec_dev *dev, unsigned all_ports,
-			struct switchtec_bwcntr_res *bw_data,
-			unsigned reset_cntrs)
+  /* Redraw only the lines of a port window whose text changed. */
+
+static void gui_portupdate(struct portview *v, char lines[][WINPORTX])
 {
-	int ret, p, numports, port_ids[SWITCHTEC_MAX_PORTS];
-	struct switchtec_status *status;
-	struct switchtec_bwcntr_res bw_data_new[SWITCHTEC_MAX_PORTS];
+	int row, changed = 0;
+
+	for (row = 1; row < WINPORTY - 1; row++) {
+		if (!strcmp(v->lines[row], lines[row]))
+			continue;
+
+		mvwprintw(v->win, row, 1, "%-*s", WINPORTX - 2, lines[row]);
+		strcpy(v->lines[row], lines[row]);
+		changed = 1;
+	}
+
+	if (changed)
+		wnoutrefresh(v->win);
+}
+
+  /* (Re)create the port windows for the ports being shown. */
+
+static void gui_layout(struct portview *views, struct switchtec_status *status,
+		       int numports, unsigned all_ports)
+{
+	struct portloc portlocs[numports];
+	int p;
+
+	for (p = 0; p < numports; p++) {
+		if (views[p].win)
+			delwin(views[p].win);
+		views[p].win = NULL;
+	}
 
-	ret = switchtec_status(dev, &status);
-	if (errno == EINTR) {
+	werase(mainwin);
+	wborder(mainwin, WINBORDER);
+	wnoutrefresh(mainwin);
+
+	get_portlocs(portlocs, all_ports, status, numports);
+
+	for (p = 0; p < numports; p++) {
+		if (!all_ports && !status[p].link_up)
+			continue;
+
+		views[p].win = newwin(WINPORTSIZE, portlocs[p].starty,
+				      portlocs[p].startx);
+		if (!views[p].win)
+			continue;
+
+		memset(views[p].lines, 0, sizeof(views[p].lines));
+		wborder(views[p].win, WINBORDER);
+		wnoutrefresh(views[p].win);
+	}
+
+	doupdate();
+}
+
+static int gui_read_status(struct switchtec_dev *dev,
+			   struct switchtec_status **status)
+{
+	int ret, numports;
+
+retry:
+	ret = switchtec_status(dev, status);
+	if (ret < 0 && errno == EINTR) {
 		errno = 0;
-		return -1;
+		goto retry;
 	} else if (ret < 0) {
 		cleanup_and_error("status");
 	}
 	numports = ret;
 
-	ret = switchtec_get_devices(dev, status, numports);
+	ret = switchtec_get_devices(dev, *status, numports);
 	if (ret < 0)
 		cleanup_and_error("get_devices");
 
-	struct portloc portlocs[numports];
-	WINDOW *portwins[numports];
+	return numports;
+}
 
-	get_portlocs(portlocs, all_ports, status, numports);
+struct gui_state {
+	struct switchtec_dev *dev;
+	unsigned all_ports;
+	int numports;
+	int *port_ids;
+	struct switchtec_status *status;
+	struct portview *views;
+	struct switchtec_bw_sampler *sampler;
+};
 
-	for (p = 0; p < numports; p++)
-		port_ids[p] = status[p].port.phys_id;
+  /* Re-read the port status. Returns 1 if the ports shown changed. */
+
+static int gui_refresh_status(struct gui_state *g)
+{
+	struct switchtec_status *status;
+	int p, numports, changed = 0;
 
-	if (reset_cntrs) {
-		switchtec_bwcntr_many(dev, numports, port_ids, 1,
-				      NULL);
-		switchtec_bwcntr_many(dev, numports, port_ids, 0,
-				      bw_data);
+	numports = gui_read_status(g->dev, &status);
+	if (numports != g->numports) {
+		switchtec_status_free(status, numports);
+		return 0;
 	}
 
-	ret = switchtec_bwcntr_many(dev, numports, port_ids, 0, bw_data_new);
-	if (errno == EINTR) {
-		errno = 0;
-		goto free_and_return;
-	} else if (ret < 0) {
+	for (p = 0; p < numports; p++)
+		if (status[p].link_up != g->status[p].link_up)
+			changed = 1;
+
+	switchtec_status_free(g->status, g->numports);
+	g->status = status;
+
+	return changed && !g->all_ports;
+}
+
+static void gui_update(struct gui_state *g)
+{
+	struct switchtec_bw_rate rates[SPARK_LEN];
+	struct switchtec_bwcntr_res total;
+	char lines[WINPORTY][WINPORTX];
+	struct portstats stats;
+	struct portview *v;
+	int p, i, n, err;
+
+	err = switchtec_bw_sampler_error(g->sampler);
+	if (err && err != EINTR) {
+		errno = err;
 		cleanup_and_error("bwcntr");
 	}
 
-	for (p = 0; p < numports; p++) {
-		struct switchtec_status *s = &status[p];
-		struct portstats stats;
+	for (p = 0; p < g->numports; p++) {
+		v = &g->views[p];
+		if (!v->win)
+			continue;
 
-		if (all_ports || s->link_up) {
-			gui_portcalc(&bw_data_new[p], &bw_data[p], &stats);
-			portwins[p] = gui_portwin(&portlocs[p], s, &stats);
-			wrefresh(portwins[p]);
+		n = switchtec_bw_sampler_history(g->sampler, p, rates,
+						 SPARK_LEN);
+		if (n < 0)
+			n = 0;
+
+		for (i = 0; i < n; i++) {
+			v->spark_ingress[i] = rates[i].ingress.posted +
+				rates[i].ingress.comp +
+				rates[i].ingress.nonposted;
+			v->spark_egress[i] = rates[i].egress.posted +
+				rates[i].egress.comp +
+				rates[i].egress.nonposted;
 		}
-	}
+		v->spark_len = n;
+
+		stats.bw_rate_ingress = n ? v->spark_ingress[0] : NAN;
+		stats.bw_rate_egress = n ? v->spark_egress[0] : NAN;
 
-	memcpy(bw_data, bw_data_new, SWITCHTEC_MAX_PORTS *
-	       sizeof(struct switchtec_bwcntr_res));
-	ret = 0;
+		memset(&total, 0, sizeof(total));
+		switchtec_bw_sampler_total(g->sampler, p, &total);
+		stats.tot_val_ingress = switchtec_bwcntr_tot(&total.ingress);
+		stats.tot_val_egress = switchtec_bwcntr_tot(&total.egress);
 
-free_and_return:
-	switchtec_status_free(status, numports);
-	return ret;
+		gui_portlines(lines, v, &g->status[p], &stats);
+		gui_portupdate(v, lines);
+	}
+
+	doupdate();
 }
 
-static int gui_init(struct switchtec_dev *dev, unsigned reset,
-		    struct switchtec_bwcntr_res *bw_data,
-		    enum switchtec_bw_type bw_type)
+static void gui_init(struct gui_state *g, unsigned reset,
+		     unsigned refresh_ms, enum switchtec_bw_type bw_type)
 {
-	int ret, p, numports, port_ids[SWITCHTEC_MAX_PORTS];
-	struct switchtec_status *status;
+	int ret, p;
 
-retry:
-	ret = switchtec_status(dev, &status);
-	if (errno == EINTR) {
-		errno = 0;
-		goto retry;
-	} else if (ret < 0) {
-		cleanup_and_error("status");
-	}
-	numports = ret;
+	g->numports = gui_read_status(g->dev, &g->status);
 
-	for (p = 0; p < numports; p++)
-		port_ids[p] = status[p].port.phys_id;
+	g->port_ids = calloc(g->numports, sizeof(*g->port_ids));
+	g->views = calloc(g->numports, sizeof(*g->views));
+	if (!g->port_ids || !g->views)
+		cleanup_and_error("gui_init");
 
-	ret = switchtec_bwcntr_set_many(dev, numports, port_ids, bw_type);
+	for (p = 0; p < g->numports; p++)
+		g->port_ids[p] = g->status[p].port.phys_id;
+
+	ret = switchtec_bwcntr_set_many(g->dev, g->numports, g->port_ids,
+					bw_type);
 	if (ret < 0)
 		cleanup_and_error("Set bandwidth type");
 	/* switchtec_bwcntr_set_many will reset bandwidth counter and it needs
 	 * about 1s. */
 	sleep(1);
 
-	if (reset)
-		ret = switchtec_bwcntr_many(dev, numports, port_ids, 1, NULL);
-	else
-		ret = switchtec_bwcntr_many(dev, numports, port_ids, 0,
-					    bw_data);
-
-	if (errno == EINTR) {
-		errno = 0;
-		goto retry;
-	}
+	g->sampler = switchtec_bw_sampler_start(g->dev, g->numports,
+						g->port_ids, refresh_ms,
+						SPARK_LEN + 1, 0);
+	if (!g->sampler)
+		cleanup_and_error("gui_init");
 
-	switchtec_status_free(status, numports);
-	return ret;
+	if (reset)
+		switchtec_bw_sampler_reset(g->sampler);
 }
 
 /*
- * Function to handle keypresses when in GUI mode. For now only 'r'
- * has any significance (resets counters).
+ * Function to handle keypresses when in GUI mode. 'r' resets counters
+ * and 'q' quits.
  */
 
 static unsigned gui_keypress(void)
@@ -379,26 +544,19 @@ static unsigned gui_keypress(void)
 
 	switch (ch) {
 	case 'r':
-		return 1;
+		return GUI_KEY_RESET;
 	case 'q':
 		cleanup_and_exit();
 	case KEY_RESIZE:
 		clear();
-		wborder(mainwin, WINBORDER);
-		wrefresh(mainwin);
 		refresh();
-		break;
+		return GUI_KEY_RESIZE;
 	}
 	return 0;
 }
 
-  /* Main GUI window. */
-
-int gui_main(struct switchtec_dev *dev, unsigned all_ports, unsigned reset,
-	     unsigned refresh, int duration, enum switchtec_bw_type bw_type)
+static void gui_start(void)
 {
-	struct timeval endtime, now;
-
 	if ((mainwin = initscr()) == NULL) {
 		fprintf(stderr, "Error initialising ncurses.\n");
 		exit(EXIT_FAILURE);
@@ -409,48 +567,213 @@ int gui_main(struct switchtec_dev *dev, unsigned all_ports, unsigned reset,
 	nodelay(stdscr, TRUE);
 	noecho();
 	cbreak();
+	curs_set(0);
+}
 
-	int ret;
-	struct switchtec_bwcntr_res bw_data[SWITCHTEC_MAX_PORTS] = { {0} };
+  /* Sleep until the next tick of a refresh_ms period. */
 
-	ret = gui_init(dev, reset, bw_data, bw_type);
-	if (ret < 0) {
-		cleanup_and_error("gui_init");
-		return ret;
-	}
-	usleep(GUI_INIT_TIME);
+static uint64_t gui_tick(uint64_t next, unsigned refresh_ms)
+{
+	uint64_t now;
 
-	ret = gettimeofday(&endtime, NULL);
-	if (ret)
-		cleanup_and_error("gettimeofday");
-	endtime.tv_sec += duration;
+	next += refresh_ms;
+	now = gui_time_ms();
+	if (next > now)
+		usleep((next - now) * 1000);
+	else
+		next = now;
 
-	while (1) {
-		int do_reset;
+	return next;
+}
 
-		do_reset = gui_keypress();
-		do_reset |= reset_signal;
-		ret = gui_winports(dev, all_ports, bw_data, do_reset);
-		sleep(refresh);
+  /* Main GUI window. */
 
-		if (!ret && do_reset)
+int gui_main(struct switchtec_dev *dev, unsigned all_ports, unsigned reset,
+	     unsigned refresh_ms, int duration, enum switchtec_bw_type bw_type)
+{
+	struct gui_state g = {
+		.dev = dev,
+		.all_ports = all_ports,
+	};
+	uint64_t next, status_next, end;
+	unsigned keys;
+
+	gui_start();
+	gui_init(&g, reset, refresh_ms, bw_type);
+	gui_layout(g.views, g.status, g.numports, all_ports);
+
+	next = gui_time_ms();
+	status_next = next + GUI_STATUS_PERIOD_MS;
+	end = next + duration * 1000ULL;
+
+	while (1) {
+		keys = gui_keypress();
+		if ((keys & GUI_KEY_RESET) || reset_signal) {
+			switchtec_bw_sampler_reset(g.sampler);
 			reset_signal = 0;
+		}
+
+		if (next >= status_next) {
+			if (gui_refresh_status(&g))
+				keys |= GUI_KEY_RESIZE;
+			status_next = next + GUI_STATUS_PERIOD_MS;
+		}
 
-		ret = gettimeofday(&now, NULL);
-		if (ret)
-			cleanup_and_error("gettimeofday");
+		if (keys & GUI_KEY_RESIZE)
+			gui_layout(g.views, g.status, g.numports, all_ports);
 
-		if (duration > 0 && timercmp(&now, &endtime, >))
+		gui_update(&g);
+
+		next = gui_tick(next, refresh_ms);
+		if (duration > 0 && next > end)
 			cleanup_and_exit();
 	}
 
 	return 0;
 }
 
+  /* Rebuild enough of a port's status to draw it from a recording. */
+
+static void replay_status(struct switchtec_status *s,
+			  const struct switchtec_rec_channel *c)
+{
+	memset(s, 0, sizeof(*s));
+	s->port.phys_id = c->id;
+	s->port.partition = c->partition;
+	s->port.stack = c->stack;
+	s->port.stk_id = c->stk_id;
+	s->port.upstream = c->upstream;
+	s->cfg_lnk_width = c->cfg_link_width;
+	s->neg_lnk_width = c->link_width;
+	s->link_up = c->link_width != 0;
+	s->link_rate = c->link_rate;
+	s->ltssm = c->ltssm;
+	s->ltssm_str = switchtec_ltssm_str(c->ltssm, 1);
+}
+
+static void replay_update(struct portview *views,
+			  struct switchtec_status *status, int numports,
+			  struct switchtec_bwcntr_res *bw_data,
+			  struct switchtec_bwcntr_res *bw_data_new)
+{
+	char lines[WINPORTY][WINPORTX];
+	struct portstats stats;
+	int p;
+
+	for (p = 0; p < numports; p++) {
+		if (!views[p].win)
+			continue;
+
+		gui_portcalc(&bw_data_new[p], &bw_data[p], &stats);
+		gui_spark_push(&views[p], stats.bw_rate_ingress,
+			       stats.bw_rate_egress);
+		gui_portlines(lines, &views[p], &status[p], &stats);
+		gui_portupdate(&views[p], lines);
+	}
+}
+
+  /* Play a recording made with "bw --record" through the GUI. */
+
+int gui_replay(const char *path, unsigned all_ports, unsigned refresh_ms,
+	       int duration)
+{
+	struct switchtec_status status[SWITCHTEC_MAX_PORTS];
+	struct switchtec_bwcntr_res bw_data[SWITCHTEC_MAX_PORTS];
+	struct switchtec_bwcntr_res bw_data_new[SWITCHTEC_MAX_PORTS];
+	struct portview views[SWITCHTEC_MAX_PORTS] = {};
+	const struct switchtec_rec_header *hdr;
+	struct switchtec_rec *rec;
+	uint64_t start, pos, t;
+	uint64_t next, end;
+	long idx, last = 0;
+	unsigned keys;
+	char str[128];
+	int p, numports, ret;
+
+	rec = switchtec_rec_open(path);
+	if (!rec) {
+		perror(path);
+		return 1;
+	}
+
+	hdr = switchtec_rec_header(rec);
+	if (hdr->type != SWITCHTEC_REC_BW ||
+	    hdr->nr_channels > SWITCHTEC_MAX_PORTS) {
+		fprintf(stderr, "%s: not a bandwidth recording\n", path);
+		switchtec_rec_close(rec);
+		return 1;
+	}
+
+	ret = switchtec_rec_read(rec, 0, &start, bw_data);
+	if (ret) {
+		fprintf(stderr, "%s: recording has no samples\n", path);
+		switchtec_rec_close(rec);
+		return 1;
+	}
+
+	numports = hdr->nr_channels;
+	for (p = 0; p < numports; p++)
+		replay_status(&status[p], &hdr->channels[p]);
+
+	gui_start();
+	gui_layout(views, status, numports, all_ports);
+
+	next = gui_time_ms();
+	end = next + duration * 1000ULL;
+
+	pos = start;
+	while (1) {
+		keys = gui_keypress();
+		if (keys & GUI_KEY_RESET) {
+			pos = start;
+			last = 0;
+			switchtec_rec_read(rec, 0, NULL, bw_data);
+			for (p = 0; p < numports; p++)
+				views[p].spark_len = 0;
+		}
+
+		if (keys & GUI_KEY_RESIZE)
+			gui_layout(views, status, numports, all_ports);
+
+		next = gui_tick(next, refresh_ms);
+		pos += refresh_ms * 1000ULL;
+
+		/* The newest sample no later than the replay position */
+		idx = switchtec_rec_find(rec, pos + 1) - 1;
+		if (idx > last &&
+		    !switchtec_rec_read(rec, idx, &t, bw_data_new)) {
+			replay_update(views, status, numports, bw_data,
+				      bw_data_new);
+			memcpy(bw_data, bw_data_new, sizeof(bw_data));
+			last = idx;
+
+			snprintf(str, sizeof(str), " %s replay +%.1fs ",
+				 hdr->dev_name, (t - start) * 1e-6);
+			mvwaddstr(mainwin, 0, 2, str);
+			wnoutrefresh(mainwin);
+			doupdate();
+		}
+
+		if (duration > 0 && next > end)
+			break;
+	}
+
+	switchtec_rec_close(rec);
+	cleanup_and_exit();
+	return 0;
+}
+
 #else
 
 int gui_main(struct switchtec_dev *dev, unsigned all_ports, unsigned reset,
-	     unsigned refresh, int duration, enum switchtec_bw_type bw_type)
+	     unsigned refresh_ms, int duration, enum switchtec_bw_type bw_type)
+{
+	printf("gui requires libcurses support when switchtec-user is built\n");
+	return 0;
+}
+
+int gui_replay(const char *path, unsigned all_ports, unsigned refresh_ms,
+	       int duration)
 {
 	printf("gui requires libcurses support when switchtec-user is built\n");
 	return 0;
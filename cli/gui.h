@@ -28,6 +28,8 @@
 #include <switchtec/switchtec.h>
 
 int gui_main(struct switchtec_dev *dev, unsigned all_ports, unsigned reset,
-	     unsigned refresh, int duration, enum switchtec_bw_type bw_type);
+	     unsigned refresh_ms, int duration, enum switchtec_bw_type bw_type);
+int gui_replay(const char *path, unsigned all_ports, unsigned refresh_ms,
+	       int duration);
 
 #endif
@@ -27,14 +27,20 @@
 #include "suffix.h"
 #include "progress.h"
 #include "gui.h"
+#include "exporter.h"
 #include "common.h"
 
 #include <switchtec/switchtec.h>
 #include <switchtec/errors.h>
 #include <switchtec/utils.h>
 #include <switchtec/pci.h>
+#include <switchtec/record.h>
+#include <switchtec/flightrec.h>
 
+#include <ctype.h>
 #include <locale.h>
+#include <pthread.h>
+#include <sys/time.h>
 #include <time.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -43,7 +49,9 @@
 #include <stdio.h>
 
 static struct switchtec_dev *global_dev = NULL;
+static const char *global_dev_name;
 static int global_pax_id = SWITCHTEC_PAX_ID_LOCAL;
+static int batch_active;
 
 enum output_format {
 	FMT_NORMAL,
@@ -75,7 +83,14 @@ int switchtec_handler(const char *optarg, void *value_addr,
 {
 	struct switchtec_dev *dev;
 
+	/* Commands run by 'batch' share the device it opened */
+	if (batch_active && !strcmp(optarg, global_dev_name)) {
+		*((struct switchtec_dev  **) value_addr) = global_dev;
+		return 0;
+	}
+
 	global_dev = dev = switchtec_open(optarg);
+	global_dev_name = optarg;
 
 	if (dev == NULL) {
 		switchtec_perror(optarg);
@@ -273,8 +288,10 @@ static int gui(int argc, char **argv)
 		unsigned all_ports;
 		unsigned reset_bytes;
 		unsigned refresh;
+		unsigned interval;
 		int duration;
 		enum switchtec_bw_type bw_type;
+		char *replay;
 	} cfg = {
 	    .refresh  = 1,
 	    .duration = -1,
@@ -282,22 +299,42 @@ static int gui(int argc, char **argv)
 	};
 
 	const struct argconfig_options opts[] = {
-		DEVICE_OPTION,
+		DEVICE_OPTION_OPTIONAL,
 		{"all_ports", 'a', "", CFG_NONE, &cfg.all_ports, no_argument,
 		 "show all ports (including downed links)"},
 		{"reset", 'r', "", CFG_NONE, &cfg.reset_bytes, no_argument,
 		 "reset byte counters"},
 		{"refresh", 'f', "", CFG_POSITIVE, &cfg.refresh, required_argument,
 		 "GUI refresh period in seconds (default: 1 second)"},
+		{"interval", 'i', "MS", CFG_POSITIVE, &cfg.interval,
+		  required_argument,
+		 "GUI refresh period in milliseconds (overrides --refresh)"},
 		{"duration", 'd', "", CFG_INT, &cfg.duration, required_argument,
 		 "GUI duration in seconds (-1 = forever)"},
 		{"bw_type", 'b', "TYPE", CFG_CHOICES, &cfg.bw_type,
 		 required_argument, "GUI bandwidth type", .choices=bandwidth_types},
+		{"replay", 'R', "FILE", CFG_STRING, &cfg.replay, required_argument,
+		 "play back a recording made with 'bw --record' instead of "
+		 "reading a device"},
 		{NULL}};
 
 	argconfig_parse(argc, argv, CMD_DESC_GUI, opts, &cfg, sizeof(cfg));
 
-	ret = gui_main(cfg.dev, cfg.all_ports, cfg.reset_bytes, cfg.refresh,
+	if (!cfg.interval)
+		cfg.interval = cfg.refresh * 1000;
+
+	if (cfg.replay)
+		return gui_replay(cfg.replay, cfg.all_ports, cfg.interval,
+				  cfg.duration);
+
+	if (!cfg.dev) {
+		argconfig_print_usage(opts);
+		fprintf(stderr,
+			"Must specify a switchtec device if not using --replay\n");
+		return 1;
+	}
+
+	ret = gui_main(cfg.dev, cfg.all_ports, cfg.reset_bytes, cfg.interval,
 		       cfg.duration, cfg.bw_type);
 
 	return ret;
@@ -531,6 +568,149 @@ static void print_bw(const char *msg, uint64_t time_us, uint64_t bytes)
 	printf("\t%-8s\t%5.3g %sB/s\n", msg, rate, suf);
 }
 
+static volatile sig_atomic_t record_stop;
+
+static void record_sig(int sig)
+{
+	record_stop = 1;
+}
+
+static uint64_t record_time_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+static void record_port_channel(struct switchtec_rec_channel *c,
+				struct switchtec_status *s)
+{
+	c->id = s->port.phys_id;
+	c->ltssm = s->ltssm;
+	c->partition = s->port.partition;
+	c->stack = s->port.stack;
+	c->stk_id = s->port.stk_id;
+	c->upstream = s->port.upstream;
+	c->cfg_link_width = s->cfg_lnk_width;
+	c->link_width = s->link_up ? s->neg_lnk_width : 0;
+	c->link_rate = s->link_rate;
+}
+
+typedef int (*record_sample_fn)(struct switchtec_dev *dev, void *ctx,
+				void *data);
+
+/*
+ * Append a sample every period_ms to a new recording until interrupted.
+ * Samples are scheduled against absolute deadlines so slow reads do not
+ * make the period drift.
+ */
+static int record_loop(struct switchtec_dev *dev, const char *path,
+		       enum switchtec_rec_type type, unsigned period_ms,
+		       int nr_channels, struct switchtec_rec_channel *channels,
+		       record_sample_fn sample, void *ctx)
+{
+	struct switchtec_rec *rec;
+	uint64_t next, now;
+	long count = 0;
+	void *data;
+	int ret = 0;
+
+	data = calloc(nr_channels, switchtec_rec_channel_size(type));
+	if (!data) {
+		perror("record");
+		return -1;
+	}
+
+	rec = switchtec_rec_create(path, type, period_ms * 1000, dev,
+				   nr_channels, channels);
+	if (!rec) {
+		perror(path);
+		free(data);
+		return -1;
+	}
+
+	record_stop = 0;
+	signal(SIGINT, record_sig);
+	signal(SIGTERM, record_sig);
+
+	fprintf(stderr, "Recording %d channels to %s every %u ms, "
+		"press Ctrl-C to stop\n", nr_channels, path, period_ms);
+
+	next = record_time_us();
+	while (!record_stop) {
+		now = record_time_us();
+		ret = sample(dev, ctx, data);
+		if (ret < 0) {
+			switchtec_perror("record");
+			break;
+		}
+
+		ret = switchtec_rec_append(rec, now, data);
+		if (ret < 0) {
+			perror(path);
+			break;
+		}
+		count++;
+
+		next += period_ms * 1000ULL;
+		now = record_time_us();
+		if (next > now)
+			usleep(next - now);
+		else
+			next = now;
+	}
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	switchtec_rec_close(rec);
+	free(data);
+
+	fprintf(stderr, "Recorded %ld samples\n", count);
+
+	return ret < 0 ? ret : 0;
+}
+
+struct bw_record {
+	int nr_ports;
+	int port_ids[SWITCHTEC_MAX_PORTS];
+};
+
+static int bw_record_sample(struct switchtec_dev *dev, void *ctx,
+			    void *data)
+{
+	struct bw_record *r = ctx;
+	int ret;
+
+	ret = switchtec_bwcntr_many(dev, r->nr_ports, r->port_ids, 0, data);
+	return ret < 0 ? ret : 0;
+}
+
+static int bw_record(struct switchtec_dev *dev, const char *path,
+		     unsigned period_ms)
+{
+	struct switchtec_rec_channel channels[SWITCHTEC_MAX_PORTS] = {};
+	struct switchtec_status *status;
+	struct bw_record r;
+	int ret, p;
+
+	ret = switchtec_status(dev, &status);
+	if (ret < 0) {
+		switchtec_perror("status");
+		return ret;
+	}
+
+	r.nr_ports = ret;
+	for (p = 0; p < r.nr_ports; p++) {
+		r.port_ids[p] = status[p].port.phys_id;
+		record_port_channel(&channels[p], &status[p]);
+	}
+	switchtec_status_free(status, r.nr_ports);
+
+	return record_loop(dev, path, SWITCHTEC_REC_BW, period_ms,
+			   r.nr_ports, channels, bw_record_sample, &r);
+}
+
 #define CMD_DESC_BW "measure the traffic bandwidth through each port"
 
 static int bw(int argc, char **argv)
@@ -546,9 +726,12 @@ static int bw(int argc, char **argv)
 		unsigned meas_time;
 		int verbose;
 		enum switchtec_bw_type bw_type;
+		char *record;
+		unsigned period;
 	} cfg = {
 		.meas_time = 5,
 		.bw_type = SWITCHTEC_BW_TYPE_RAW,
+		.period = 100,
 	};
 
 	const struct argconfig_options opts[] = {
@@ -560,6 +743,13 @@ static int bw(int argc, char **argv)
 		 "print posted, non-posted and completion results"},
 		{"bw_type", 'b', "TYPE", CFG_CHOICES, &cfg.bw_type,
 		 required_argument, "bandwidth type", .choices=bandwidth_types},
+		{"record", 'R', "FILE", CFG_STRING, &cfg.record,
+		  required_argument,
+		 "sample continuously into a binary recording until "
+		 "interrupted"},
+		{"period", 'P', "MS", CFG_POSITIVE, &cfg.period,
+		  required_argument,
+		 "with --record, milliseconds between samples (default: 100)"},
 		{NULL}};
 
 	argconfig_parse(argc, argv, CMD_DESC_BW, opts, &cfg, sizeof(cfg));
@@ -573,6 +763,9 @@ static int bw(int argc, char **argv)
 	 * about 1s */
 	sleep(1);
 
+	if (cfg.record)
+		return bw_record(cfg.dev, cfg.record, cfg.period);
+
 	ret = switchtec_bwcntr_all(cfg.dev, 0, &port_ids, &before);
 	if (ret < 0) {
 		switchtec_perror("bw");
@@ -627,8 +820,131 @@ static int bw(int argc, char **argv)
 	return 0;
 }
 
+#define CMD_DESC_EXPORTER "serve OpenMetrics from all devices over HTTP"
+
+static int exporter(int argc, char **argv)
+{
+	static struct {
+		char *addr;
+		int port;
+		unsigned interval;
+		int latency;
+	} cfg = {
+		.addr = "0.0.0.0",
+		.port = 9873,
+		.interval = 1000,
+	};
+	const struct argconfig_options opts[] = {
+		{"listen", 'l', "ADDR", CFG_STRING, &cfg.addr, required_argument,
+		 "IPv4 address to listen on (default: 0.0.0.0)"},
+		{"port", 'p', "PORT", CFG_POSITIVE, &cfg.port, required_argument,
+		 "TCP port to listen on (default: 9873)"},
+		{"interval", 'i', "MS", CFG_POSITIVE, &cfg.interval,
+		  required_argument,
+		 "milliseconds between samples (default: 1000)"},
+		{"latency", 'L', "", CFG_NONE, &cfg.latency, no_argument,
+		 "program the latency counters of every port and export "
+		 "their percentiles"},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_EXPORTER, opts, &cfg, sizeof(cfg));
+
+	return exporter_main(cfg.addr, cfg.port, cfg.interval, cfg.latency);
+}
+
 #define CMD_DESC_LATENCY "measure the latency of a port"
 
+static void print_lat_hist(const char *name,
+			   const struct switchtec_lat_hist *h)
+{
+	printf("%-8s p50: %5d ns  p99: %5d ns  p99.9: %5d ns  max: %5d ns\n",
+	       name, switchtec_lat_hist_percentile(h, 50),
+	       switchtec_lat_hist_percentile(h, 99),
+	       switchtec_lat_hist_percentile(h, 99.9), h->max_ns);
+}
+
+static int latency_hist(struct switchtec_dev *dev, int egress, int ingress,
+			unsigned samples, unsigned interval_ms)
+{
+	const struct switchtec_lat_hist *cur, *max;
+	struct switchtec_lat_collector *c;
+	unsigned i;
+	int ret;
+
+	c = switchtec_lat_collector_new(dev, 1, &egress, &ingress);
+	if (!c) {
+		switchtec_perror("latency");
+		return -1;
+	}
+
+	for (i = 0; i < samples; i++) {
+		usleep(interval_ms * 1000);
+		ret = switchtec_lat_collector_sample(c);
+		if (ret < 0) {
+			switchtec_perror("latency");
+			switchtec_lat_collector_free(c);
+			return -1;
+		}
+	}
+
+	switchtec_lat_collector_hist(c, 0, &cur, &max);
+	printf("Samples: %llu of %u\n", (unsigned long long)max->count, samples);
+	if (max->count) {
+		print_lat_hist(switchtec_is_gen3(dev) ? "Current" : "Minimum",
+			       cur);
+		print_lat_hist("Maximum", max);
+	}
+
+	switchtec_lat_collector_free(c);
+	return 0;
+}
+
+static int lat_record_sample(struct switchtec_dev *dev, void *ctx,
+			     void *data)
+{
+	struct switchtec_rec_lat *lat = data;
+	int *egress = ctx;
+	int cur_ns, max_ns;
+	int ret;
+
+	ret = switchtec_lat_get(dev, 1, *egress, &cur_ns, &max_ns);
+	if (ret != 1)
+		return -1;
+
+	lat->cur_ns = cur_ns;
+	lat->max_ns = max_ns;
+	return 0;
+}
+
+static int lat_record(struct switchtec_dev *dev, int egress, int ingress,
+		      const char *path, unsigned period_ms)
+{
+	struct switchtec_rec_channel channel = {};
+	struct switchtec_status *status;
+	int ret, p;
+
+	ret = switchtec_status(dev, &status);
+	if (ret < 0) {
+		switchtec_perror("status");
+		return ret;
+	}
+
+	channel.id = egress;
+	for (p = 0; p < ret; p++)
+		if (status[p].port.phys_id == egress)
+			record_port_channel(&channel, &status[p]);
+	switchtec_status_free(status, ret);
+
+	ret = switchtec_lat_setup(dev, egress, ingress, 1);
+	if (ret != 1) {
+		switchtec_perror("latency");
+		return -1;
+	}
+
+	return record_loop(dev, path, SWITCHTEC_REC_LAT, period_ms, 1,
+			   &channel, lat_record_sample, &egress);
+}
+
 static int latency(int argc, char **argv)
 {
 	int ret;
@@ -639,10 +955,16 @@ static int latency(int argc, char **argv)
 		unsigned meas_time;
 		int egress;
 		int ingress;
+		unsigned samples;
+		unsigned interval;
+		char *record;
+		unsigned period;
 	} cfg = {
 		.meas_time = 5,
 		.egress = -1,
 		.ingress = SWITCHTEC_LAT_ALL_INGRESS,
+		.interval = 100,
+		.period = 100,
 	};
 	const struct argconfig_options opts[] = {
 		DEVICE_OPTION,
@@ -656,6 +978,20 @@ static int latency(int argc, char **argv)
 		{"ingress", 'i', "NUM", CFG_NONNEGATIVE, &cfg.ingress,
 		  required_argument,
 		 "physical port ID for the ingress side (default: use all ports)"},
+		{"samples", 'n', "NUM", CFG_POSITIVE, &cfg.samples,
+		  required_argument,
+		 "sample the counter this many times and report percentiles "
+		 "instead of a single measurement"},
+		{"interval", 'm', "MS", CFG_POSITIVE, &cfg.interval,
+		  required_argument,
+		 "with --samples, milliseconds between samples (default: 100)"},
+		{"record", 'R', "FILE", CFG_STRING, &cfg.record,
+		  required_argument,
+		 "sample continuously into a binary recording until "
+		 "interrupted"},
+		{"period", 'P', "MS", CFG_POSITIVE, &cfg.period,
+		  required_argument,
+		 "with --record, milliseconds between samples (default: 100)"},
 		{NULL}};
 
 	argconfig_parse(argc, argv, CMD_DESC_LATENCY, opts, &cfg, sizeof(cfg));
@@ -666,6 +1002,14 @@ static int latency(int argc, char **argv)
 		return 1;
 	}
 
+	if (cfg.record)
+		return lat_record(cfg.dev, cfg.egress, cfg.ingress, cfg.record,
+				  cfg.period);
+
+	if (cfg.samples)
+		return latency_hist(cfg.dev, cfg.egress, cfg.ingress,
+				    cfg.samples, cfg.interval);
+
 	ret = switchtec_lat_setup(cfg.dev, cfg.egress, cfg.ingress, 1);
 	if (ret != 1) {
 		switchtec_perror("latency");
@@ -821,6 +1165,263 @@ static int get_events(struct switchtec_dev *dev,
 
 #define CMD_DESC_EVENTS "display events that have occurred"
 
+struct follow_rec {
+	struct timeval tv;
+	enum switchtec_event_id eid;
+	int partition;
+	int port;
+	int count;
+	uint32_t data[5];
+};
+
+/*
+ * Events found by the wait thread are queued here for printing. When
+ * the ring is full the oldest entry is overwritten so a slow reader
+ * never stalls the wait loop; the number lost is reported instead.
+ */
+struct follow_ring {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct follow_rec *recs;
+	unsigned size;
+	unsigned head;
+	unsigned tail;
+	unsigned long dropped;
+	int error;
+
+	struct switchtec_dev *dev;
+	int show_all;
+	int interval;
+};
+
+static void follow_push(struct follow_ring *r, struct follow_rec *rec)
+{
+	pthread_mutex_lock(&r->lock);
+	if (r->head - r->tail == r->size) {
+		r->tail++;
+		r->dropped++;
+	}
+	r->recs[r->head++ % r->size] = *rec;
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+}
+
+static void follow_stop(struct follow_ring *r, int error)
+{
+	pthread_mutex_lock(&r->lock);
+	r->error = error ? error : EIO;
+	pthread_cond_signal(&r->cond);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/*
+ * Read and clear all the reported events of one global, partition or
+ * PFF block with a single block read, so an event storm costs a few
+ * transfers per block rather than several per event.
+ */
+static int follow_read_block(struct follow_ring *r,
+			     struct switchtec_event_summary *sum,
+			     enum switchtec_event_type type, int idx,
+			     int local_part)
+{
+	struct switchtec_event_block blk;
+	struct follow_rec rec;
+	uint64_t mask = 0;
+	int e, ret;
+
+	for (e = 0; e < SWITCHTEC_MAX_EVENTS; e++)
+		if (switchtec_event_info(e, NULL, NULL) == type &&
+		    switchtec_event_summary_test(sum, e, idx))
+			mask |= 1ULL << e;
+
+	if (!mask)
+		return 0;
+
+	switch (type) {
+	case SWITCHTEC_EVT_GLOBAL:
+		rec.partition = -1;
+		rec.port = -1;
+		break;
+	case SWITCHTEC_EVT_PART:
+		rec.partition = idx;
+		rec.port = -1;
+		break;
+	case SWITCHTEC_EVT_PFF:
+		ret = switchtec_pff_to_port(r->dev, idx, &rec.partition,
+					    &rec.port);
+		if (ret < 0)
+			return ret;
+		break;
+	}
+
+	if (!r->show_all && rec.partition != -1 &&
+	    rec.partition != local_part)
+		return 0;
+
+	/* Clear them so the next occurrence sets the summary bit again */
+	ret = switchtec_event_block_ctl(r->dev, type, idx, mask, &blk);
+	if (ret < 0)
+		return ret;
+
+	gettimeofday(&rec.tv, NULL);
+	for (e = 0; e < SWITCHTEC_MAX_EVENTS; e++) {
+		if (!(mask & (1ULL << e)))
+			continue;
+
+		rec.eid = e;
+		rec.count = blk.count[e];
+		memcpy(rec.data, blk.data[e], sizeof(rec.data));
+		follow_push(r, &rec);
+	}
+
+	return 0;
+}
+
+static int follow_read_events(struct follow_ring *r, int local_part)
+{
+	struct switchtec_event_summary sum;
+	int i, ret;
+
+	ret = switchtec_event_summary_since(r->dev, &sum);
+	if (ret <= 0)
+		return ret;
+
+	if (sum.global) {
+		ret = follow_read_block(r, &sum, SWITCHTEC_EVT_GLOBAL, 0,
+					local_part);
+		if (ret < 0)
+			return ret;
+	}
+
+	for (i = 0; i < SWITCHTEC_MAX_PARTS; i++) {
+		if (!sum.part[i])
+			continue;
+
+		ret = follow_read_block(r, &sum, SWITCHTEC_EVT_PART, i,
+					local_part);
+		if (ret < 0)
+			return ret;
+	}
+
+	for (i = 0; i < SWITCHTEC_MAX_PFF_CSR; i++) {
+		if (!sum.pff[i])
+			continue;
+
+		ret = follow_read_block(r, &sum, SWITCHTEC_EVT_PFF, i,
+					local_part);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void *follow_thread(void *arg)
+{
+	struct follow_ring *r = arg;
+	int local_part = switchtec_partition(r->dev);
+	int can_wait = 1;
+	int ret;
+
+	while (1) {
+		ret = follow_read_events(r, local_part);
+		if (ret < 0)
+			break;
+
+		if (can_wait) {
+			ret = switchtec_event_wait(r->dev, r->interval);
+			if (ret < 0 && errno == ENOTSUP)
+				can_wait = 0;
+			else if (ret < 0)
+				break;
+		}
+
+		if (!can_wait)
+			usleep(r->interval * 1000);
+	}
+
+	follow_stop(r, errno);
+	return NULL;
+}
+
+static void follow_print(struct follow_rec *rec)
+{
+	const char *name;
+
+	switchtec_event_info(rec->eid, &name, NULL);
+	printf("{\"time\":%lld.%06ld,\"event\":\"%s\",\"partition\":%d,"
+	       "\"port\":%d,\"count\":%d,\"data\":[%u,%u,%u,%u,%u]}\n",
+	       (long long)rec->tv.tv_sec, (long)rec->tv.tv_usec, name,
+	       rec->partition, rec->port, rec->count, rec->data[0],
+	       rec->data[1], rec->data[2], rec->data[3], rec->data[4]);
+}
+
+static int events_follow(struct switchtec_dev *dev, int show_all,
+			 int interval, int buffer)
+{
+	struct follow_ring r = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.size = buffer,
+		.dev = dev,
+		.show_all = show_all,
+		.interval = interval,
+	};
+	struct follow_rec rec;
+	struct timeval tv;
+	unsigned long dropped;
+	pthread_t thread;
+	int ret;
+
+	r.recs = calloc(r.size, sizeof(*r.recs));
+	if (!r.recs) {
+		perror("follow");
+		return -1;
+	}
+
+	ret = pthread_create(&thread, NULL, follow_thread, &r);
+	if (ret) {
+		errno = ret;
+		perror("follow");
+		free(r.recs);
+		return -1;
+	}
+
+	pthread_mutex_lock(&r.lock);
+	while (1) {
+		while (r.head == r.tail && !r.error)
+			pthread_cond_wait(&r.cond, &r.lock);
+
+		if (r.head == r.tail)
+			break;
+
+		dropped = r.dropped;
+		r.dropped = 0;
+		rec = r.recs[r.tail++ % r.size];
+		pthread_mutex_unlock(&r.lock);
+
+		if (dropped) {
+			gettimeofday(&tv, NULL);
+			printf("{\"time\":%lld.%06ld,\"dropped\":%lu}\n",
+			       (long long)tv.tv_sec, (long)tv.tv_usec,
+			       dropped);
+		}
+		follow_print(&rec);
+
+		pthread_mutex_lock(&r.lock);
+		if (r.head == r.tail)
+			fflush(stdout);
+	}
+	pthread_mutex_unlock(&r.lock);
+
+	pthread_join(thread, NULL);
+	free(r.recs);
+
+	errno = r.error;
+	switchtec_perror("follow");
+	return -1;
+}
+
 static int events(int argc, char **argv)
 {
 	struct event_list elist[256];
@@ -833,7 +1434,13 @@ static int events(int argc, char **argv)
 		int show_all;
 		int clear_all;
 		unsigned event_id;
-	} cfg = {};
+		int follow;
+		int interval;
+		int buffer;
+	} cfg = {
+		.interval = 100,
+		.buffer = 1024,
+	};
 	const struct argconfig_options opts[] = {
 		DEVICE_OPTION,
 		{"all", 'a', "", CFG_NONE, &cfg.show_all, no_argument,
@@ -843,11 +1450,25 @@ static int events(int argc, char **argv)
 		{"event", 'e', "EVENT", CFG_MULT_CHOICES, &cfg.event_id,
 		  required_argument, .choices=event_choices,
 		  .help="clear all events of a specified type"},
+		{"follow", 'F', "", CFG_NONE, &cfg.follow, no_argument,
+		 "keep running and print each new event as a JSON line; "
+		 "reported events are cleared"},
+		{"interval", 'i', "MS", CFG_POSITIVE, &cfg.interval,
+		  required_argument,
+		 "with --follow, how often to check for events (default: 100)"},
+		{"buffer", 'b', "NUM", CFG_POSITIVE, &cfg.buffer,
+		  required_argument,
+		 "with --follow, number of events queued before the oldest "
+		 "are dropped (default: 1024)"},
 		{NULL}};
 
 	populate_event_choices(event_choices, 1);
 	argconfig_parse(argc, argv, CMD_DESC_EVENTS, opts, &cfg, sizeof(cfg));
 
+	if (cfg.follow)
+		return events_follow(cfg.dev, cfg.show_all, cfg.interval,
+				     cfg.buffer);
+
 	ret = switchtec_event_summary(cfg.dev, &sum);
 	if (ret < 0) {
 		perror("event_summary");
@@ -960,16 +1581,399 @@ static int event_wait(int argc, char **argv)
 	return 0;
 }
 
-#define CMD_DESC_LOG_DUMP "dump the firmware log to a file"
+#define CMD_DESC_FLIGHT_RECORDER \
+	"keep recent device state in memory and dump it when an event occurs"
 
-#define LOG_FMT_TXT 0
-#define LOG_FMT_BIN 1
+#define FLR_DEFAULT_EVENTS \
+	(1 << SWITCHTEC_PFF_EVT_LINK_STATE | \
+	 1 << SWITCHTEC_PFF_EVT_AER_IN_P2P | \
+	 1 << SWITCHTEC_PFF_EVT_DPC | \
+	 1 << SWITCHTEC_PFF_EVT_HOTPLUG)
 
-static FILE *get_log_def_file(struct switchtec_dev *dev, unsigned type,
-			      int format)
+static void flight_recorder_print_fired(struct switchtec_event_summary *fired)
 {
-	int ret;
-	FILE *file;
+	enum switchtec_event_id e;
+	const char *name;
+	int idx;
+
+	while (switchtec_event_summary_iter(fired, &e, &idx)) {
+		switchtec_event_info(e, &name, NULL);
+		if (switchtec_event_info(e, NULL, NULL) == SWITCHTEC_EVT_GLOBAL)
+			fprintf(stderr, " %s", name);
+		else
+			fprintf(stderr, " %s[%d]", name, idx);
+	}
+}
+
+static int flight_recorder(int argc, char **argv)
+{
+	struct argconfig_choice event_choices[SWITCHTEC_MAX_EVENTS + 1] = {};
+	struct switchtec_event_summary fired;
+	struct switchtec_flightrec *fr;
+	char path[PATH_MAX];
+	int dumps = 0;
+	int ret = 0;
+	int e;
+
+	static struct {
+		struct switchtec_dev *dev;
+		unsigned events;
+		int period;
+		int depth;
+		const char *prefix;
+		int count;
+	} cfg = {
+		.period = 100,
+		.depth = 600,
+		.prefix = "switchtec-flr",
+		.count = 1,
+	};
+	const struct argconfig_options opts[] = {
+		DEVICE_OPTION,
+		{"event", 'e', "EVENT", CFG_MULT_CHOICES, &cfg.events,
+		  required_argument, .choices=event_choices,
+		  .help="event that triggers a dump, may be given more than "
+		  "once (default: LINK_STATE, AER_IN_P2P, DPC and HOTPLUG "
+		  "on every port)"},
+		{"period", 'p', "MS", CFG_POSITIVE, &cfg.period,
+		  required_argument,
+		  "sampling period in milliseconds (default: 100)"},
+		{"depth", 'd', "NUM", CFG_POSITIVE, &cfg.depth,
+		  required_argument,
+		  "number of samples kept and dumped (default: 600)"},
+		{"output", 'o', "PREFIX", CFG_STRING, &cfg.prefix,
+		  required_argument,
+		  "dumps are written to PREFIX-N.flr "
+		  "(default: switchtec-flr)"},
+		{"count", 'n', "NUM", CFG_NONNEGATIVE, &cfg.count,
+		  required_argument,
+		  "stop after this many dumps, 0 to run until interrupted "
+		  "(default: 1)"},
+		{NULL}};
+
+	populate_event_choices(event_choices, 1);
+	argconfig_parse(argc, argv, CMD_DESC_FLIGHT_RECORDER, opts, &cfg,
+			sizeof(cfg));
+
+	if (!cfg.events)
+		cfg.events = FLR_DEFAULT_EVENTS;
+
+	fr = switchtec_flightrec_new(cfg.dev, cfg.depth, cfg.period);
+	if (!fr) {
+		switchtec_perror("flight-recorder");
+		return -1;
+	}
+
+	for (e = 0; e < SWITCHTEC_MAX_EVENTS; e++) {
+		if (!(cfg.events & (1 << e)))
+			continue;
+
+		ret = switchtec_flightrec_trigger(fr, e, SWITCHTEC_EVT_IDX_ALL);
+		if (ret < 0) {
+			switchtec_perror("flight-recorder");
+			goto out;
+		}
+	}
+
+	record_stop = 0;
+	signal(SIGINT, record_sig);
+	signal(SIGTERM, record_sig);
+
+	fprintf(stderr, "Recording every %d ms (%.1f s kept), "
+		"press Ctrl-C to stop\n", cfg.period,
+		cfg.depth * cfg.period / 1000.0);
+
+	while (!record_stop) {
+		ret = switchtec_flightrec_poll(fr, &fired);
+		if (ret < 0 && errno == EINTR) {
+			ret = 0;
+			break;
+		} else if (ret < 0) {
+			switchtec_perror("flight-recorder");
+			break;
+		} else if (!ret) {
+			continue;
+		}
+
+		snprintf(path, sizeof(path), "%s-%d.flr", cfg.prefix, dumps);
+		ret = switchtec_flightrec_dump(fr, path, &fired);
+		if (ret < 0) {
+			perror(path);
+			break;
+		}
+
+		fprintf(stderr, "Wrote %s:", path);
+		flight_recorder_print_fired(&fired);
+		fprintf(stderr, "\n");
+
+		if (++dumps == cfg.count)
+			break;
+	}
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+out:
+	switchtec_flightrec_free(fr);
+	return ret < 0 ? ret : 0;
+}
+
+#define CMD_DESC_FLIGHT_RECORDER_SHOW "display a flight recorder dump"
+
+static int flr_read(FILE *f, uint64_t off, void *buf, size_t len)
+{
+	if (!len)
+		return 0;
+
+	if (fseek(f, off, SEEK_SET) || fread(buf, len, 1, f) != 1)
+		return -1;
+
+	return 0;
+}
+
+static int flr_copy(FILE *f, uint64_t off, uint64_t len, FILE *out)
+{
+	char buf[4096];
+	size_t n;
+
+	if (fseek(f, off, SEEK_SET))
+		return -1;
+
+	while (len) {
+		n = len < sizeof(buf) ? len : sizeof(buf);
+		if (fread(buf, n, 1, f) != 1 || fwrite(buf, n, 1, out) != 1)
+			return -1;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static void flr_print_port(const struct switchtec_flr_port *port,
+			   const struct switchtec_flr_port_sample *s)
+{
+	printf("%2d %-8s", port->phys_id,
+	       switchtec_ltssm_str(s->ltssm, 1));
+	if (s->link_up)
+		printf(" x%d Gen%d", s->link_width, s->link_rate);
+	else
+		printf(" down");
+}
+
+static void flr_print_triggers(FILE *f, const struct switchtec_flr_header *hdr,
+			       const struct switchtec_flr_trigger *trig)
+{
+	struct switchtec_flr_ltssm l;
+	const char *name;
+	unsigned i, j;
+
+	for (i = 0; i < hdr->nr_triggers; i++) {
+		switchtec_event_info(trig[i].event, &name, NULL);
+		printf("Trigger: %s", name);
+		if (trig[i].port >= 0)
+			printf(" partition %d port %d (physical %d)",
+			       trig[i].partition, trig[i].port,
+			       trig[i].phys_id);
+		else if (trig[i].partition >= 0)
+			printf(" partition %d", trig[i].partition);
+		printf("\n");
+
+		if (!trig[i].ltssm_count)
+			continue;
+
+		printf("  LTSSM log:\n");
+		for (j = 0; j < trig[i].ltssm_count; j++) {
+			if (flr_read(f, trig[i].ltssm_off + j * sizeof(l),
+				     &l, sizeof(l)))
+				break;
+
+			printf("  %3d  %02x%08x  %.1fG  %s\n", j,
+			       l.timestamp_high, l.timestamp, l.link_rate,
+			       switchtec_ltssm_str(l.link_state, 1));
+		}
+	}
+}
+
+static int flight_recorder_show(int argc, char **argv)
+{
+	struct switchtec_flr_port ports[SWITCHTEC_MAX_PORTS];
+	struct switchtec_flr_cntr cntr_info[SWITCHTEC_MAX_EVCNTRS];
+	struct switchtec_flr_trigger trig[SWITCHTEC_FLR_MAX_TRIGGERS];
+	struct switchtec_flr_header hdr;
+	struct switchtec_flr_sample *s, *prev_s = NULL;
+	struct switchtec_flr_port_sample *ps, *prev = NULL;
+	uint32_t *cntrs;
+	uint8_t *buf = NULL, *prev_buf = NULL, *tmp;
+	unsigned i, j, first = 0;
+	int changed;
+	int ret = -1;
+
+	static struct {
+		FILE *file;
+		const char *file_name;
+		FILE *log_file;
+		const char *log_file_name;
+		int samples;
+	} cfg = {};
+	const struct argconfig_options opts[] = {
+		{"file", .cfg_type=CFG_FILE_R, .value_addr=&cfg.file,
+		  .argument_type=required_positional,
+		  .help="dump written by flight-recorder"},
+		{"log", 'l', "FILE", CFG_FILE_W, &cfg.log_file,
+		  required_argument,
+		  "write the firmware log in the dump to FILE, for log-parse"},
+		{"samples", 's', "NUM", CFG_NONNEGATIVE, &cfg.samples,
+		  required_argument,
+		  "only show the last NUM samples (default: all)"},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_FLIGHT_RECORDER_SHOW, opts, &cfg,
+			sizeof(cfg));
+
+	if (fread(&hdr, sizeof(hdr), 1, cfg.file) != 1 ||
+	    memcmp(hdr.magic, SWITCHTEC_FLR_MAGIC,
+		   sizeof(SWITCHTEC_FLR_MAGIC)) ||
+	    hdr.version != SWITCHTEC_FLR_VERSION ||
+	    hdr.nr_ports > ARRAY_SIZE(ports) ||
+	    hdr.nr_cntrs > SWITCHTEC_MAX_EVCNTRS ||
+	    hdr.nr_triggers > ARRAY_SIZE(trig) ||
+	    hdr.sample_size != sizeof(*s) + hdr.nr_ports * sizeof(*ps) +
+		hdr.nr_cntrs * sizeof(*cntrs)) {
+		fprintf(stderr, "%s: not a flight recorder dump\n",
+			cfg.file_name);
+		goto out;
+	}
+
+	if (flr_read(cfg.file, hdr.ports_off, ports,
+		     hdr.nr_ports * sizeof(*ports)) ||
+	    flr_read(cfg.file, hdr.cntrs_off, cntr_info,
+		     hdr.nr_cntrs * sizeof(*cntr_info)) ||
+	    flr_read(cfg.file, hdr.triggers_off, trig,
+		     hdr.nr_triggers * sizeof(*trig))) {
+		fprintf(stderr, "%s: truncated dump\n", cfg.file_name);
+		goto out;
+	}
+
+	printf("Device:   %s (%04x)\n", hdr.dev_name, hdr.device_id);
+	printf("Samples:  %u every %u ms, %u ports, %u event counters\n",
+	       hdr.nr_samples, hdr.period_us / 1000, hdr.nr_ports,
+	       hdr.nr_cntrs);
+	flr_print_triggers(cfg.file, &hdr, trig);
+
+	buf = malloc(hdr.sample_size);
+	prev_buf = malloc(hdr.sample_size);
+	if (!buf || !prev_buf) {
+		perror("flight-recorder-show");
+		goto out;
+	}
+
+	if (cfg.samples && cfg.samples < hdr.nr_samples)
+		first = hdr.nr_samples - cfg.samples;
+
+	printf("\n%10s %6s  %s\n", "Time (ms)", "Temp", "Changes");
+	for (i = 0; i < hdr.nr_samples; i++) {
+		if (flr_read(cfg.file, hdr.samples_off +
+			     (uint64_t)i * hdr.sample_size,
+			     buf, hdr.sample_size)) {
+			fprintf(stderr, "%s: truncated dump\n",
+				cfg.file_name);
+			goto out;
+		}
+
+		s = (void *)buf;
+		ps = (void *)(s + 1);
+		cntrs = (void *)(ps + hdr.nr_ports);
+
+		if (i < first)
+			goto next;
+
+		printf("%10.1f %5.1fC ",
+		       ((int64_t)s->time_us - (int64_t)hdr.trigger_us) / 1000.0,
+		       s->die_temp);
+
+		changed = 0;
+		if (i == first || s->global != prev_s->global ||
+		    s->part_bitmap != prev_s->part_bitmap ||
+		    s->local_part != prev_s->local_part ||
+		    memcmp(s->pff_bitmap, prev_s->pff_bitmap,
+			   sizeof(s->pff_bitmap))) {
+			printf(" events global=%llx part=%llx local=%x",
+			       (unsigned long long)s->global,
+			       (unsigned long long)s->part_bitmap,
+			       s->local_part);
+			for (j = 0; j < SWITCHTEC_FLR_PFF_WORDS; j++)
+				if (s->pff_bitmap[j])
+					printf(" pff%u=%llx", j * 64,
+					       (unsigned long long)
+					       s->pff_bitmap[j]);
+			changed = 1;
+		}
+
+		for (j = 0; j < hdr.nr_ports; j++) {
+			/* The first sample shown has every port, then changes */
+			if (i > first && !memcmp(&ps[j], &prev[j], sizeof(*ps)))
+				continue;
+
+			printf("\n%18s", "port ");
+			flr_print_port(&ports[j], &ps[j]);
+			changed = 1;
+		}
+
+		for (j = 0; j < hdr.nr_cntrs; j++) {
+			if (!cntrs[j])
+				continue;
+
+			printf(" cntr%d.%d+%u", cntr_info[j].stack_id,
+			       cntr_info[j].cntr_id, cntrs[j]);
+			changed = 1;
+		}
+
+		if (!changed)
+			printf(" -");
+		printf("\n");
+
+next:
+		tmp = prev_buf;
+		prev_buf = buf;
+		buf = tmp;
+		prev_s = (void *)prev_buf;
+		prev = (void *)(prev_s + 1);
+	}
+
+	if (cfg.log_file) {
+		if (!hdr.fwlog_len) {
+			fprintf(stderr, "The dump has no firmware log\n");
+			goto out;
+		}
+
+		if (flr_copy(cfg.file, hdr.fwlog_off, hdr.fwlog_len,
+			     cfg.log_file)) {
+			perror(cfg.log_file_name);
+			goto out;
+		}
+	}
+
+	ret = 0;
+
+out:
+	free(buf);
+	free(prev_buf);
+	if (cfg.log_file)
+		fclose(cfg.log_file);
+	fclose(cfg.file);
+	return ret;
+}
+
+#define CMD_DESC_LOG_DUMP "dump the firmware log to a file"
+
+#define LOG_FMT_TXT 0
+#define LOG_FMT_BIN 1
+
+static FILE *get_log_def_file(struct switchtec_dev *dev, unsigned type,
+			      int format)
+{
+	int ret;
+	FILE *file;
 
 	file = tmpfile();
 	if (file == NULL) {
@@ -990,6 +1994,99 @@ static FILE *get_log_def_file(struct switchtec_dev *dev, unsigned type,
 	return file;
 }
 
+static int log_cursor_load(const char *path,
+			   struct switchtec_log_cursor *cursor)
+{
+	FILE *f;
+	unsigned int next_start, entries;
+	int ret;
+
+	f = fopen(path, "r");
+	if (!f)
+		return errno == ENOENT ? 0 : -1;
+
+	ret = fscanf(f, "%u %u", &next_start, &entries);
+	fclose(f);
+	if (ret != 2) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	cursor->next_start = next_start;
+	cursor->entries = entries;
+	cursor->valid = true;
+	return 0;
+}
+
+static int log_cursor_save(const char *path,
+			   const struct switchtec_log_cursor *cursor)
+{
+	FILE *f;
+	int ret;
+
+	f = fopen(path, "w");
+	if (!f)
+		return -1;
+
+	fprintf(f, "%u %u\n", cursor->next_start, cursor->entries);
+	ret = fclose(f);
+
+	return ret;
+}
+
+static int log_follow(struct switchtec_dev *dev, enum switchtec_log_type type,
+		      int fd, FILE *log_def_file, unsigned interval_ms,
+		      const char *cursor_file,
+		      struct switchtec_log_file_info *info)
+{
+	struct switchtec_log_file_info tail_info;
+	struct switchtec_log_cursor cursor = {};
+	unsigned int entries;
+	int ret = 0;
+
+	if (cursor_file && log_cursor_load(cursor_file, &cursor)) {
+		perror(cursor_file);
+		return -1;
+	}
+
+	record_stop = 0;
+	signal(SIGINT, record_sig);
+	signal(SIGTERM, record_sig);
+
+	memset(info, 0, sizeof(*info));
+
+	while (!record_stop) {
+		entries = cursor.entries;
+		ret = switchtec_log_tail(dev, type, fd, log_def_file,
+					 &cursor, &tail_info);
+		if (ret)
+			break;
+
+		if (tail_info.overflow)
+			fprintf(stderr, "WARNING: The log buffer pointer has wrapped. Some log entries were lost!\n");
+
+		if (!info->log_fw_version && !info->log_sdk_version) {
+			*info = tail_info;
+			info->overflow = false;
+		}
+
+		if (cursor_file && log_cursor_save(cursor_file, &cursor))
+			perror(cursor_file);
+
+		if (cursor.entries != entries)
+			fprintf(stderr, "%u entries\r", cursor.entries);
+
+		if (interval_ms >= 1000)
+			sleep(interval_ms / 1000);
+		usleep((interval_ms % 1000) * 1000);
+	}
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	return ret;
+}
+
 static int log_dump(int argc, char **argv)
 {
 	int ret;
@@ -1028,11 +2125,15 @@ static int log_dump(int argc, char **argv)
 		FILE *log_def_file;
 		const char *log_def_filename;
 		int format;
+		int follow;
+		unsigned interval;
+		const char *cursor_file;
 	} cfg = {
 		.type = SWITCHTEC_LOG_RAM,
 		.out_fd = 0,
 		.log_def_file = NULL,
-		.format = LOG_FMT_BIN
+		.format = LOG_FMT_BIN,
+		.interval = 1000,
 	};
 	const struct argconfig_options opts[] = {
 		DEVICE_OPTION,
@@ -1049,10 +2150,27 @@ static int log_dump(int argc, char **argv)
 		{"format", 'f', "FORMAT", CFG_CHOICES, &cfg.format,
 		  required_argument,
 		 "output log file format", .choices=format},
+		{"follow", 'F', "", CFG_NONE, &cfg.follow, no_argument,
+		 "keep appending new log entries to the output file until "
+		 "interrupted (RAM and FLASH logs only)"},
+		{"interval", 'i', "MS", CFG_POSITIVE, &cfg.interval,
+		 required_argument,
+		 "with --follow, how often to check for new entries "
+		 "(default: 1000)"},
+		{"cursor", 'C', "FILE", CFG_STRING, &cfg.cursor_file,
+		 required_argument,
+		 "with --follow, save the log position to FILE, and resume "
+		 "from it if it exists"},
 		{NULL}};
 
 	argconfig_parse(argc, argv, CMD_DESC_LOG_DUMP, opts, &cfg, sizeof(cfg));
 
+	if (cfg.follow && cfg.type != SWITCHTEC_LOG_RAM &&
+	    cfg.type != SWITCHTEC_LOG_FLASH) {
+		fprintf(stderr, "--follow is only supported for RAM and FLASH logs\n");
+		return -1;
+	}
+
 	ret = switchtec_get_device_info(cfg.dev, &boot_phase, NULL, NULL);
 	if (ret) {
 		switchtec_perror("log_dump");
@@ -1091,8 +2209,12 @@ static int log_dump(int argc, char **argv)
 			return ret;
 	}
 
-	ret = switchtec_log_to_file(cfg.dev, cfg.type, cfg.out_fd,
-				    log_def_to_use, &info);
+	if (cfg.follow)
+		ret = log_follow(cfg.dev, cfg.type, cfg.out_fd, log_def_to_use,
+				 cfg.interval, cfg.cursor_file, &info);
+	else
+		ret = switchtec_log_to_file(cfg.dev, cfg.type, cfg.out_fd,
+					    log_def_to_use, &info);
 	if (ret < 0)
 		switchtec_perror("log_dump");
 	else
@@ -1149,12 +2271,14 @@ static int log_parse(int argc, char **argv)
 		FILE *parsed_log_file;
 		const char *parsed_log_filename;
 		enum switchtec_gen gen;
+		unsigned jobs;
 	} cfg = {
 		.log_type = SWITCHTEC_LOG_PARSE_TYPE_APP,
 		.bin_log_file = NULL,
 		.log_def_file = NULL,
 		.parsed_log_file = NULL,
-		.gen = SWITCHTEC_GEN_UNKNOWN
+		.gen = SWITCHTEC_GEN_UNKNOWN,
+		.jobs = 1,
 	};
 	const struct argconfig_options opts[] = {
 		{"type", 't',
@@ -1171,6 +2295,8 @@ static int log_parse(int argc, char **argv)
 			 "earlier log files which do not contain device "
 			 "generation information. Default: UNKNOWN)",
 		 .choices = device_gen},
+		{"jobs", 'j', "NUM", CFG_POSITIVE, &cfg.jobs, required_argument,
+		 "number of threads to parse the log with (default: 1)"},
 		{"log_input", .cfg_type = CFG_FILE_R,
 		 .value_addr = &cfg.bin_log_file,
 		 .argument_type = required_positional,
@@ -1199,9 +2325,9 @@ static int log_parse(int argc, char **argv)
 	}
 	fseek(cfg.bin_log_file, 0, SEEK_SET);
 
-	ret = switchtec_parse_log(cfg.bin_log_file, cfg.log_def_file,
-				  cfg.parsed_log_file, cfg.log_type,
-				  cfg.gen, &info);
+	ret = switchtec_parse_log_mt(cfg.bin_log_file, cfg.log_def_file,
+				     cfg.parsed_log_file, cfg.log_type,
+				     cfg.gen, cfg.jobs, &info);
 	if (ret < 0)
 		switchtec_perror("log_parse");
 	else
@@ -1279,62 +2405,218 @@ static int test(int argc, char **argv)
 	return 0;
 }
 
-#define CMD_DESC_TEMP "display the die temperature"
+static unsigned long long mrpc_stats_pct(struct switchtec_mrpc_stats *st,
+					 double pct)
+{
+	uint64_t target = st->count * pct;
+	uint64_t seen = 0;
+	int i;
 
-static int temp(int argc, char **argv)
+	for (i = 0; i < SWITCHTEC_MRPC_STATS_BUCKETS; i++) {
+		seen += st->hist[i];
+		if (seen > target)
+			break;
+	}
+
+	if (i >= SWITCHTEC_MRPC_STATS_BUCKETS - 1)
+		return st->max_us;
+
+	return 1ULL << i;
+}
+
+static void print_mrpc_stats(FILE *out, struct switchtec_dev *dev)
 {
-	float ret;
-	int nr_reading;
-	float temps[4];
+	struct switchtec_mrpc_stats st;
+	const char *name;
+	int i;
+
+	fprintf(out, "%-5s  %-24s %8s %6s %10s %10s %9s %9s %9s %9s %9s\n",
+		"ID", "Command", "Calls", "Errs", "Bytes Out", "Bytes In",
+		"Avg(us)", "Wait(us)", "Max(us)", "p50(us)", "p99(us)");
+
+	for (i = 0; i < MRPC_MAX_ID; i++) {
+		if (switchtec_mrpc_stats_get(dev, i, &st))
+			return;
+		if (!st.count)
+			continue;
+
+		name = switchtec_mrpc_name(i);
+		fprintf(out, "0x%03x  %-24s %8llu %6llu %10llu %10llu %9llu "
+			"%9llu %9llu %9llu %9llu\n", i, name ? name : "",
+			(unsigned long long)st.count,
+			(unsigned long long)st.errors,
+			(unsigned long long)st.payload_bytes,
+			(unsigned long long)st.resp_bytes,
+			(unsigned long long)(st.total_us / st.count),
+			(unsigned long long)(st.wait_us / st.count),
+			(unsigned long long)st.max_us,
+			mrpc_stats_pct(&st, 0.50),
+			mrpc_stats_pct(&st, 0.99));
+	}
+}
+
+#define CMD_DESC_MRPC_STATS "measure MRPC command latency and throughput"
+
+static int mrpc_stats(int argc, char **argv)
+{
+	struct switchtec_status *status;
+	uint32_t out;
+	int i, ret;
 
 	static struct {
 		struct switchtec_dev *dev;
-		int verbose;
-	} cfg = {};
+		int count;
+	} cfg = {
+		.count = 10,
+	};
 	const struct argconfig_options opts[] = {
 		DEVICE_OPTION,
-		{"verbose", 'v', "", CFG_NONE, &cfg.verbose, no_argument,
-		 "print individual die temperature sensor reading"},
+		{"count", 'n', "NUM", CFG_POSITIVE, &cfg.count,
+		 required_argument,
+		 "number of times to run the health check commands "
+		 "(default: 10)"},
 		{NULL}};
 
-	argconfig_parse(argc, argv, CMD_DESC_TEMP, opts, &cfg, sizeof(cfg));
+	argconfig_parse(argc, argv, CMD_DESC_MRPC_STATS, opts, &cfg,
+			sizeof(cfg));
 
-	if (!cfg.verbose) {
-		ret = switchtec_die_temp(cfg.dev);
-		if (ret < 0) {
-			switchtec_perror("die_temp");
-			return 1;
+	ret = switchtec_mrpc_stats_enable(cfg.dev, 1);
+	if (ret) {
+		switchtec_perror("mrpc_stats");
+		return 1;
+	}
+
+	switchtec_mrpc_stats_reset(cfg.dev);
+
+	for (i = 0; i < cfg.count; i++) {
+		ret = switchtec_echo(cfg.dev, i, &out);
+		if (ret) {
+			switchtec_perror("echo");
+			break;
 		}
 
-		if (have_decent_term())
-			printf("%.3g °C\n", ret);
-		else
-			printf("%.3g degC\n", ret);
-	} else {
-		int i;
-		nr_reading = switchtec_die_temps(cfg.dev, 4, temps);
-		if (nr_reading < 0) {
+		if (switchtec_die_temp(cfg.dev) < 0) {
 			switchtec_perror("die_temp");
-			return 1;
+			break;
 		}
 
-		for (i = 0; i < nr_reading; i++) {
-			if (have_decent_term())
-				printf("Sensor %d: %.3g °C\n", i, temps[i]);
-			else
-				printf("Sensor %d: %.3g degC\n", i, temps[i]);
+		ret = switchtec_status(cfg.dev, &status);
+		if (ret < 0) {
+			switchtec_perror("status");
+			break;
 		}
+		switchtec_status_free(status, ret);
 	}
 
+	print_mrpc_stats(stdout, cfg.dev);
+
 	return 0;
 }
 
-static void print_bind_info(struct switchtec_bind_status_out status)
+#define CMD_DESC_TEMP "display the die temperature"
+
+static int temp_record_sample(struct switchtec_dev *dev, void *ctx,
+			      void *data)
 {
-	int i;
+	int *nr_sensors = ctx;
+	int ret;
 
-	for (i = 0; i < status.inf_cnt; i++) {
-		enum switchtec_bind_info_result result = status.port_info[i].bind_state & 0x0F;
+	ret = switchtec_die_temps(dev, *nr_sensors, data);
+	return ret < 0 ? ret : 0;
+}
+
+static int temp_record(struct switchtec_dev *dev, const char *path,
+		       unsigned period_ms)
+{
+	struct switchtec_rec_channel channels[4] = {};
+	float temps[4];
+	int nr_sensors;
+	int i;
+
+	nr_sensors = switchtec_die_temps(dev, 4, temps);
+	if (nr_sensors < 0) {
+		switchtec_perror("die_temp");
+		return 1;
+	}
+	if (nr_sensors > 4)
+		nr_sensors = 4;
+
+	for (i = 0; i < nr_sensors; i++)
+		channels[i].id = i;
+
+	return record_loop(dev, path, SWITCHTEC_REC_TEMP, period_ms,
+			   nr_sensors, channels, temp_record_sample,
+			   &nr_sensors);
+}
+
+static int temp(int argc, char **argv)
+{
+	float ret;
+	int nr_reading;
+	float temps[4];
+
+	static struct {
+		struct switchtec_dev *dev;
+		int verbose;
+		char *record;
+		unsigned period;
+	} cfg = {
+		.period = 100,
+	};
+	const struct argconfig_options opts[] = {
+		DEVICE_OPTION,
+		{"verbose", 'v', "", CFG_NONE, &cfg.verbose, no_argument,
+		 "print individual die temperature sensor reading"},
+		{"record", 'R', "FILE", CFG_STRING, &cfg.record,
+		  required_argument,
+		 "sample continuously into a binary recording until "
+		 "interrupted"},
+		{"period", 'P', "MS", CFG_POSITIVE, &cfg.period,
+		  required_argument,
+		 "with --record, milliseconds between samples (default: 100)"},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_TEMP, opts, &cfg, sizeof(cfg));
+
+	if (cfg.record)
+		return temp_record(cfg.dev, cfg.record, cfg.period);
+
+	if (!cfg.verbose) {
+		ret = switchtec_die_temp(cfg.dev);
+		if (ret < 0) {
+			switchtec_perror("die_temp");
+			return 1;
+		}
+
+		if (have_decent_term())
+			printf("%.3g °C\n", ret);
+		else
+			printf("%.3g degC\n", ret);
+	} else {
+		int i;
+		nr_reading = switchtec_die_temps(cfg.dev, 4, temps);
+		if (nr_reading < 0) {
+			switchtec_perror("die_temp");
+			return 1;
+		}
+
+		for (i = 0; i < nr_reading; i++) {
+			if (have_decent_term())
+				printf("Sensor %d: %.3g °C\n", i, temps[i]);
+			else
+				printf("Sensor %d: %.3g degC\n", i, temps[i]);
+		}
+	}
+
+	return 0;
+}
+
+static void print_bind_info(struct switchtec_bind_status_out status)
+{
+	int i;
+
+	for (i = 0; i < status.inf_cnt; i++) {
+		enum switchtec_bind_info_result result = status.port_info[i].bind_state & 0x0F;
 		int state = (status.port_info[i].bind_state & 0xF0) >> 4;
 
 		switch (result) {
@@ -1460,6 +2742,110 @@ static int port_unbind(int argc, char **argv)
 	return 0;
 }
 
+static const char *bind_apply_result(int ret)
+{
+	if (!ret)
+		return "OK";
+
+	if (ret > 0)
+		errno = ret | SWITCHTEC_ERRNO_MRPC_FLAG_BIT;
+	else
+		errno = -ret;
+
+	return switchtec_strerror();
+}
+
+static int bind_map_parse(FILE *f, const char *name,
+			  struct switchtec_bind_map_entry *map, int max)
+{
+	char line[256], par[16];
+	int n = 0, lineno = 0;
+	int phys, log, cnt;
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+		if (line[strspn(line, " \t")] == '#' ||
+		    line[strspn(line, " \t\r\n")] == '\0')
+			continue;
+
+		log = 0;
+		cnt = sscanf(line, "%d %15s %d", &phys, par, &log);
+		if (cnt < 2 || (strcmp(par, "-") && cnt < 3)) {
+			fprintf(stderr, "%s:%d: expected PHYS_PORT PARTITION LOGICAL_PORT or PHYS_PORT -\n",
+				name, lineno);
+			return -1;
+		}
+
+		if (n == max) {
+			fprintf(stderr, "%s: too many ports\n", name);
+			return -1;
+		}
+
+		map[n].phys_port_id = phys;
+		map[n].par_id = strcmp(par, "-") ? atoi(par) : -1;
+		map[n].log_port_id = log;
+		n++;
+	}
+
+	return n;
+}
+
+#define CMD_DESC_PORT_BIND_APPLY "move the bindings of physical ports to a desired map"
+
+static int port_bind_apply(int argc, char **argv)
+{
+	struct switchtec_bind_map_entry map[SWITCHTEC_MAX_PHY_PORTS];
+	int i, n, ret;
+	static struct {
+		struct switchtec_dev *dev;
+		FILE *map_file;
+		const char *map_file_name;
+		unsigned timeout;
+	} cfg = {
+		.timeout = 5000,
+	};
+	const struct argconfig_options opts[] = {
+		DEVICE_OPTION,
+		{"map", .cfg_type=CFG_FILE_R, .value_addr=&cfg.map_file,
+		  .argument_type=required_positional,
+		  .help="file with one 'PHYS_PORT PARTITION LOGICAL_PORT' line per port, or 'PHYS_PORT -' to leave it unbound"},
+		{"timeout", 't', "MS", CFG_POSITIVE, &cfg.timeout,
+		 required_argument,
+		 "time to wait for all changes to complete (default: 5000)"},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_PORT_BIND_APPLY, opts, &cfg,
+			sizeof(cfg));
+
+	n = bind_map_parse(cfg.map_file, cfg.map_file_name, map,
+			   ARRAY_SIZE(map));
+	fclose(cfg.map_file);
+	if (n <= 0) {
+		if (!n)
+			fprintf(stderr, "No ports in %s\n", cfg.map_file_name);
+		return 1;
+	}
+
+	ret = switchtec_bind_apply(cfg.dev, map, n, cfg.timeout);
+	if (ret < 0) {
+		switchtec_perror("port_bind_apply");
+		return 1;
+	}
+
+	printf("Port  Partition  Logical  Change  Result\n");
+	for (i = 0; i < n; i++) {
+		if (map[i].par_id < 0)
+			printf("%4d  %9s  %7s", map[i].phys_port_id, "-", "-");
+		else
+			printf("%4d  %9d  %7d", map[i].phys_port_id,
+			       map[i].par_id, map[i].log_port_id);
+		printf("  %-6s  %s\n", switchtec_bind_op_str(map[i].op),
+		       bind_apply_result(map[i].ret));
+	}
+
+	return ret ? 1 : 0;
+}
+
 int ask_if_sure(int always_yes)
 {
 	char buf[10];
@@ -2004,92 +3390,454 @@ set_boot_ro:
 	return ret;
 }
 
-#define CMD_DESC_FW_TOGGLE "toggle the active and inactive firmware partitions (BL2, Main Firmware)"
+#define CMD_DESC_FW_UPDATE_MULTI "upload a firmware image to many devices in parallel (BL2, Main Firmware)"
 
-static int fw_toggle(int argc, char **argv)
+struct fleet_dev {
+	char name[PATH_MAX];
+	int cur, tot;
+	int done;
+	int ret;
+};
+
+struct fleet {
+	pthread_mutex_t lock;
+	struct fleet_dev *devs;
+	int nr_devs;
+	int next;
+	int finished;
+	int failed;
+
+	uint8_t *img;
+	size_t img_len;
+	int img_fd;
+	struct switchtec_fw_image_info info;
+	int type;
+	int dont_activate;
+	int force;
+	int assume_yes;
+	int progress;
+};
+
+static void fleet_progress(void *data, int cur, int tot)
 {
-	int ret = 0;
-	int err = 0;
+	struct fleet_dev *d = data;
 
-	static struct {
-		struct switchtec_dev *dev;
-		int bl2;
-		int key;
-		int firmware;
-		int config;
-	} cfg = {};
-	const struct argconfig_options opts[] = {
-		DEVICE_OPTION,
-		{"bl2", 'b', "", CFG_NONE, &cfg.bl2, no_argument,
-			"toggle BL2 firmware"},
-		{"key", 'k', "", CFG_NONE, &cfg.key, no_argument,
-			"toggle Key manifest"},
-		{"firmware", 'f', "", CFG_NONE, &cfg.firmware, no_argument,
-		 "toggle IMG firmware"},
-		{"config", 'c', "", CFG_NONE, &cfg.config, no_argument,
-		 "toggle CFG data"},
-		{NULL}};
+	__atomic_store_n(&d->tot, tot, __ATOMIC_RELAXED);
+	__atomic_store_n(&d->cur, cur, __ATOMIC_RELAXED);
+}
 
-	argconfig_parse(argc, argv, CMD_DESC_FW_TOGGLE, opts, &cfg, sizeof(cfg));
+/* Per-device checks done by fw-update before it asks to go ahead */
+static int fleet_check(struct fleet *f, struct switchtec_dev *dev,
+		       const char **msg)
+{
+	int newer;
 
-	if (!cfg.bl2 && !cfg.key && !cfg.firmware && !cfg.config) {
-		fprintf(stderr, "NOTE: Not toggling images as no "
-			"partition type options were specified\n\n");
-	} else if ((cfg.bl2 || cfg.key) && switchtec_is_gen3(cfg.dev)) {
-		fprintf(stderr, "Firmware type BL2 and Key manifest"
-			"are not supported by Gen3 switches\n");
-		return 1;
+	if (switchtec_boot_phase(dev) == SWITCHTEC_BOOT_PHASE_BL1) {
+		*msg = "device is in the BL1 boot phase";
+		return -1;
+	}
+
+	if (switchtec_gen(dev) != f->info.gen) {
+		*msg = "image is for a different device generation";
+		return -1;
+	}
+
+	if ((f->type == SWITCHTEC_FW_TYPE_BOOT ||
+	     f->type == SWITCHTEC_FW_TYPE_MAP) &&
+	    switchtec_fw_is_boot_ro(dev) == SWITCHTEC_FW_RO) {
+		*msg = "the BOOT and MAP partition are read-only";
+		return -1;
+	}
+
+	/* This reads the image file so threads must take turns */
+	pthread_mutex_lock(&f->lock);
+	newer = switchtec_fw_file_secure_version_newer(dev, f->img_fd);
+	pthread_mutex_unlock(&f->lock);
+
+	if (newer && !f->assume_yes) {
+		*msg = "image would irreversibly update the secure version "
+			"(use --yes to allow)";
+		return -1;
+	}
+
+	return 0;
+}
+
+static void fleet_report(struct fleet *f, struct fleet_dev *d,
+			 const char *msg)
+{
+	char prefix[PATH_MAX + 32];
+
+	pthread_mutex_lock(&f->lock);
+	if (f->progress)
+		printf("\r\033[K");
+
+	if (!d->ret) {
+		printf("%s: updated\n", d->name);
+	} else if (msg) {
+		printf("%s: FAILED: %s\n", d->name, msg);
 	} else {
-		ret = switchtec_fw_toggle_active_partition(cfg.dev,
-							   cfg.bl2,
-							   cfg.key,
-							   cfg.firmware,
-							   cfg.config);
-		if (ret)
-			err = errno;
+		fflush(stdout);
+		snprintf(prefix, sizeof(prefix), "%s: FAILED", d->name);
+		switchtec_fw_perror(prefix, d->ret);
 	}
 
-	ret = print_fw_part_info(cfg.dev);
-	if (ret)
-		switchtec_perror("print fw info");
+	f->finished++;
+	if (d->ret)
+		f->failed++;
+	d->done = 1;
+	pthread_mutex_unlock(&f->lock);
+}
 
-	printf("\n");
+static void *fleet_worker(void *arg)
+{
+	struct fleet *f = arg;
+	struct switchtec_dev *dev;
+	struct fleet_dev *d;
+	const char *msg;
+	int i;
 
-	errno = err;
-	if (errno)
-		switchtec_perror("firmware toggle");
-	else
-		printf("firmware toggle: Success\n");
+	while (1) {
+		pthread_mutex_lock(&f->lock);
+		i = f->next++;
+		pthread_mutex_unlock(&f->lock);
+		if (i >= f->nr_devs)
+			break;
 
-	return ret;
+		d = &f->devs[i];
+		msg = NULL;
+
+		dev = switchtec_open(d->name);
+		if (!dev) {
+			d->ret = -errno;
+			fleet_report(f, d, NULL);
+			continue;
+		}
+
+		d->ret = fleet_check(f, dev, &msg);
+		if (!d->ret)
+			d->ret = switchtec_fw_write_buf(dev, f->img, f->img_len,
+							f->dont_activate,
+							f->force,
+							fleet_progress, d);
+
+		switchtec_close(dev);
+		fleet_report(f, d, msg);
+	}
+
+	return NULL;
 }
 
-#define CMD_DESC_FW_READ "read a firmware image from flash"
+static void fleet_print_progress(struct fleet *f)
+{
+	long long cur = 0, tot = 0;
+	int i, active = 0;
 
-static int fw_read(int argc, char **argv)
+	pthread_mutex_lock(&f->lock);
+	for (i = 0; i < f->next && i < f->nr_devs; i++) {
+		if (f->devs[i].done)
+			continue;
+		active++;
+		cur += __atomic_load_n(&f->devs[i].cur, __ATOMIC_RELAXED);
+		tot += __atomic_load_n(&f->devs[i].tot, __ATOMIC_RELAXED);
+	}
+
+	printf("\r\033[K%d of %d done, %d failed, %d in progress",
+	       f->finished, f->nr_devs, f->failed, active);
+	if (tot)
+		printf(" (%lld%%)", cur * 100 / tot);
+	fflush(stdout);
+	pthread_mutex_unlock(&f->lock);
+}
+
+static int fleet_add_devs(struct fleet *f, char *list, int all)
 {
-	struct switchtec_fw_part_summary *sum;
-	struct switchtec_fw_image_info *inf;
-	int ret = 0;
+	struct switchtec_device_info *devs;
+	char *tok;
+	int i, n;
+
+	if (all) {
+		n = switchtec_list(&devs);
+		if (n < 0) {
+			switchtec_perror("list");
+			return n;
+		}
+
+		f->devs = calloc(n ? n : 1, sizeof(*f->devs));
+		if (!f->devs) {
+			free(devs);
+			return -1;
+		}
+
+		for (i = 0; i < n; i++)
+			snprintf(f->devs[i].name, sizeof(f->devs[i].name),
+				 "%s", devs[i].path);
+		f->nr_devs = n;
+		free(devs);
+		return 0;
+	}
 
+	n = 1;
+	for (tok = list; *tok; tok++)
+		if (*tok == ',')
+			n++;
+
+	f->devs = calloc(n, sizeof(*f->devs));
+	if (!f->devs)
+		return -1;
+
+	for (tok = strtok(list, ","); tok; tok = strtok(NULL, ","))
+		snprintf(f->devs[f->nr_devs++].name,
+			 sizeof(f->devs[0].name), "%s", tok);
+
+	return 0;
+}
+
+static int fw_update_multi(int argc, char **argv)
+{
+	struct fleet f = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+	};
+	pthread_t *threads;
+	long img_len;
+	int ret, i;
+
+	const char *desc = CMD_DESC_FW_UPDATE_MULTI "\n\n"
+			   "The image is read and checked once and then "
+			   "written to each device from memory, with at most "
+			   "--jobs devices updated at a time. A failure on one "
+			   "device does not stop the others. Images that "
+			   "would update the secure version are only written "
+			   "with --yes.\n\n"
+			   BOOT_PHASE_HELP_TEXT;
 	static struct {
-		struct switchtec_dev *dev;
-		int out_fd;
-		char *out_filename;
+		FILE *fimg;
+		const char *img_filename;
+		char *devices;
+		int all;
+		unsigned jobs;
 		int assume_yes;
-		int inactive;
-		int data;
-		int bl2;
-		int key;
+		int dont_activate;
+		int force;
 		int no_progress_bar;
 	} cfg = {
-		.out_fd = -1
+		.jobs = 4,
 	};
 	const struct argconfig_options opts[] = {
-		DEVICE_OPTION,
-		{"filename", .cfg_type=CFG_FD_WR, .value_addr=&cfg.out_fd,
-		  .argument_type=optional_positional,
-		  .help="image output file"},
+		{"img_file", .cfg_type=CFG_FILE_R, .value_addr=&cfg.fimg,
+		  .argument_type=required_positional,
+		  .help="image file to upload"},
+		{"devices", 'd', "LIST", CFG_STRING, &cfg.devices,
+		  required_argument,
+		 "comma separated list of devices to update"},
+		{"all", 'a', "", CFG_NONE, &cfg.all, no_argument,
+		 "update every device found on this host"},
+		{"jobs", 'j', "NUM", CFG_POSITIVE, &cfg.jobs, required_argument,
+		 "number of devices to update at once (default: 4)"},
+		{"yes", 'y', "", CFG_NONE, &cfg.assume_yes, no_argument,
+		 "assume yes when prompted"},
+		{"dont-activate", 'A', "", CFG_NONE, &cfg.dont_activate, no_argument,
+		 "don't activate the new image, use fw-toggle to do so "
+		 "when it is safe"},
+		{"force", 'f', "", CFG_NONE, &cfg.force, no_argument,
+		 "force interrupting an existing fw-update command in case "
+		 "firmware is stuck in a busy state"},
+		{"no-progress", 'p', "", CFG_NONE, &cfg.no_progress_bar, no_argument,
+		"don't print progress to stdout"},
+		{NULL}};
+
+	argconfig_parse(argc, argv, desc, opts, &cfg, sizeof(cfg));
+
+	if (!cfg.all == !cfg.devices) {
+		argconfig_print_usage(opts);
+		fprintf(stderr, "Exactly one of --devices or --all must be given\n");
+		return 1;
+	}
+
+	f.img_fd = fileno(cfg.fimg);
+	f.type = check_and_print_fw_image(f.img_fd, cfg.img_filename);
+	if (f.type < 0)
+		return f.type;
+	switchtec_fw_file_info(f.img_fd, &f.info);
+
+	fseek(cfg.fimg, 0, SEEK_END);
+	img_len = ftell(cfg.fimg);
+	fseek(cfg.fimg, 0, SEEK_SET);
+	if (img_len < 0) {
+		perror(cfg.img_filename);
+		return 1;
+	}
+
+	f.img = malloc(img_len ? img_len : 1);
+	if (!f.img || fread(f.img, 1, img_len, cfg.fimg) != (size_t)img_len) {
+		perror(cfg.img_filename);
+		free(f.img);
+		return 1;
+	}
+	f.img_len = img_len;
+
+	ret = fleet_add_devs(&f, cfg.devices, cfg.all);
+	if (ret || !f.nr_devs) {
+		if (!ret)
+			fprintf(stderr, "No devices to update\n");
+		free(f.img);
+		free(f.devs);
+		return 1;
+	}
+
+	printf("\nWriting this image to %d device%s:\n", f.nr_devs,
+	       f.nr_devs == 1 ? "" : "s");
+	for (i = 0; i < f.nr_devs; i++)
+		printf("  %s\n", f.devs[i].name);
+
+	ret = ask_if_sure(cfg.assume_yes);
+	if (ret)
+		goto out;
+
+	f.dont_activate = cfg.dont_activate;
+	f.force = cfg.force;
+	f.assume_yes = cfg.assume_yes;
+	f.progress = !cfg.no_progress_bar;
+
+	if (cfg.jobs > f.nr_devs)
+		cfg.jobs = f.nr_devs;
+
+	threads = calloc(cfg.jobs, sizeof(*threads));
+	if (!threads) {
+		perror("fw-update-multi");
+		ret = 1;
+		goto out;
+	}
+
+	for (i = 0; i < cfg.jobs; i++) {
+		ret = pthread_create(&threads[i], NULL, fleet_worker, &f);
+		if (ret) {
+			errno = ret;
+			perror("fw-update-multi");
+			break;
+		}
+	}
+	cfg.jobs = i;
+
+	/* With no workers left to start, run the queue in this thread */
+	if (!cfg.jobs)
+		fleet_worker(&f);
+
+	while (f.progress && __atomic_load_n(&f.finished, __ATOMIC_RELAXED)
+	       < f.nr_devs) {
+		fleet_print_progress(&f);
+		usleep(500000);
+	}
+
+	for (i = 0; i < cfg.jobs; i++)
+		pthread_join(threads[i], NULL);
+	free(threads);
+
+	if (f.progress)
+		printf("\r\033[K");
+	printf("%d of %d devices updated, %d failed\n",
+	       f.nr_devs - f.failed, f.nr_devs, f.failed);
+
+	if (f.type == SWITCHTEC_FW_TYPE_MAP && f.failed < f.nr_devs)
+		printf("\nNOTE: Device partition map has been updated! All other partitions\n"
+		       "(BL2, Config and Main Image) MUST BE UPDATED to ensure your device can boot properly!\n");
+
+	ret = f.failed ? 1 : 0;
+
+out:
+	fclose(cfg.fimg);
+	free(f.img);
+	free(f.devs);
+	return ret;
+}
+
+#define CMD_DESC_FW_TOGGLE "toggle the active and inactive firmware partitions (BL2, Main Firmware)"
+
+static int fw_toggle(int argc, char **argv)
+{
+	int ret = 0;
+	int err = 0;
+
+	static struct {
+		struct switchtec_dev *dev;
+		int bl2;
+		int key;
+		int firmware;
+		int config;
+	} cfg = {};
+	const struct argconfig_options opts[] = {
+		DEVICE_OPTION,
+		{"bl2", 'b', "", CFG_NONE, &cfg.bl2, no_argument,
+			"toggle BL2 firmware"},
+		{"key", 'k', "", CFG_NONE, &cfg.key, no_argument,
+			"toggle Key manifest"},
+		{"firmware", 'f', "", CFG_NONE, &cfg.firmware, no_argument,
+		 "toggle IMG firmware"},
+		{"config", 'c', "", CFG_NONE, &cfg.config, no_argument,
+		 "toggle CFG data"},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_FW_TOGGLE, opts, &cfg, sizeof(cfg));
+
+	if (!cfg.bl2 && !cfg.key && !cfg.firmware && !cfg.config) {
+		fprintf(stderr, "NOTE: Not toggling images as no "
+			"partition type options were specified\n\n");
+	} else if ((cfg.bl2 || cfg.key) && switchtec_is_gen3(cfg.dev)) {
+		fprintf(stderr, "Firmware type BL2 and Key manifest"
+			"are not supported by Gen3 switches\n");
+		return 1;
+	} else {
+		ret = switchtec_fw_toggle_active_partition(cfg.dev,
+							   cfg.bl2,
+							   cfg.key,
+							   cfg.firmware,
+							   cfg.config);
+		if (ret)
+			err = errno;
+	}
+
+	ret = print_fw_part_info(cfg.dev);
+	if (ret)
+		switchtec_perror("print fw info");
+
+	printf("\n");
+
+	errno = err;
+	if (errno)
+		switchtec_perror("firmware toggle");
+	else
+		printf("firmware toggle: Success\n");
+
+	return ret;
+}
+
+#define CMD_DESC_FW_READ "read a firmware image from flash"
+
+static int fw_read(int argc, char **argv)
+{
+	struct switchtec_fw_part_summary *sum;
+	struct switchtec_fw_image_info *inf;
+	int ret = 0;
+
+	static struct {
+		struct switchtec_dev *dev;
+		int out_fd;
+		char *out_filename;
+		int assume_yes;
+		int inactive;
+		int data;
+		int bl2;
+		int key;
+		int no_progress_bar;
+		int verify;
+	} cfg = {
+		.out_fd = -1
+	};
+	const struct argconfig_options opts[] = {
+		DEVICE_OPTION,
+		{"filename", .cfg_type=CFG_FD_WR, .value_addr=&cfg.out_fd,
+		  .argument_type=optional_positional,
+		  .help="image output file"},
 		{"yes", 'y', "", CFG_NONE, &cfg.assume_yes, no_argument,
 		 "assume yes when prompted"},
 		{"inactive", 'i', "", CFG_NONE, &cfg.inactive, no_argument,
@@ -2104,11 +3852,21 @@ static int fw_read(int argc, char **argv)
 		 "read the key manifest partiton instead of the main firmware"},
 		{"no-progress", 'p', "", CFG_NONE, &cfg.no_progress_bar, no_argument,
 		"don't print progress to stdout"},
+		{"verify", 'V', "", CFG_NONE, &cfg.verify, no_argument,
+		 "check the image CRC against its header instead of writing "
+		 "a file"},
 		{NULL}};
+	uint32_t crc;
 
 	argconfig_parse(argc, argv, CMD_DESC_FW_READ, opts, &cfg, sizeof(cfg));
 
-	if(cfg.out_fd == -1) {
+	if (cfg.verify && cfg.out_fd != -1) {
+		fprintf(stderr, "An output file cannot be given with --verify\n");
+		close(cfg.out_fd);
+		return 1;
+	}
+
+	if (cfg.out_fd == -1 && !cfg.verify) {
 		if (switchtec_is_gen3(cfg.dev))
 			cfg.out_filename = "image.pmc";
 		else
@@ -2154,38 +3912,206 @@ static int fw_read(int argc, char **argv)
 
 		ret = ask_if_sure(cfg.assume_yes);
 		if (ret) {
-			close(cfg.out_fd);
+			if (cfg.out_fd >= 0)
+				close(cfg.out_fd);
 			return ret;
 		}
 	}
 
-	ret = switchtec_fw_img_write_hdr(cfg.out_fd, inf);
-	if (ret < 0) {
-		switchtec_perror(cfg.out_filename);
-		goto close_and_exit;
+	if (!cfg.verify) {
+		ret = switchtec_fw_img_write_hdr(cfg.out_fd, inf);
+		if (ret < 0) {
+			switchtec_perror(cfg.out_filename);
+			goto close_and_exit;
+		}
 	}
 
 	progress_start();
-	if (cfg.no_progress_bar)
-		ret = switchtec_fw_body_read_fd(cfg.dev, cfg.out_fd,
-						inf, NULL);
-	else
-		ret = switchtec_fw_body_read_fd(cfg.dev, cfg.out_fd,
-						inf, progress_update);
+	ret = switchtec_fw_body_verify(cfg.dev, cfg.out_fd, inf, &crc,
+				       cfg.no_progress_bar ? NULL :
+				       progress_update);
 	progress_finish(cfg.no_progress_bar);
 
-	if (ret < 0)
+	if (ret < 0) {
 		switchtec_perror("fw_read");
-	else
+	} else if (cfg.verify) {
+		fprintf(stderr, "\nRead CRC: 0x%08x (%s)\n", crc,
+			ret ? "MISMATCH" : "OK");
+	} else {
+		fprintf(stderr, "\nRead CRC: 0x%08x\n", crc);
+		fprintf(stderr, "Firmware read to %s.\n", cfg.out_filename);
 		ret = 0;
-
-	fprintf(stderr, "\nFirmware read to %s.\n", cfg.out_filename);
+	}
 
 	switchtec_fw_part_summary_free(sum);
 
 close_and_exit:
-	close(cfg.out_fd);
+	if (cfg.out_fd >= 0)
+		close(cfg.out_fd);
+
+	return ret;
+}
+
+#define CMD_DESC_FW_DIFF "compare a flash partition against a firmware image file"
+
+static struct switchtec_fw_part_type *
+fw_part_of_type(struct switchtec_fw_part_summary *sum,
+		enum switchtec_fw_type type)
+{
+	switch (type) {
+	case SWITCHTEC_FW_TYPE_BOOT:	return &sum->boot;
+	case SWITCHTEC_FW_TYPE_MAP:	return &sum->map;
+	case SWITCHTEC_FW_TYPE_IMG:	return &sum->img;
+	case SWITCHTEC_FW_TYPE_CFG:	return &sum->cfg;
+	case SWITCHTEC_FW_TYPE_KEY:	return &sum->key;
+	case SWITCHTEC_FW_TYPE_BL2:	return &sum->bl2;
+	case SWITCHTEC_FW_TYPE_RIOT:	return &sum->riot;
+	default:			return NULL;
+	}
+}
+
+#define FW_DIFF_MAX_RANGES 64
+
+static int fw_diff(int argc, char **argv)
+{
+	struct switchtec_fw_diff_range ranges[FW_DIFF_MAX_RANGES];
+	struct switchtec_fw_image_info info, *inf;
+	struct switchtec_fw_part_summary *sum;
+	struct switchtec_fw_part_type *part;
+	uint8_t *img = NULL;
+	long img_len;
+	size_t body_off;
+	int ret, i;
+
+	static struct {
+		struct switchtec_dev *dev;
+		FILE *fimg;
+		const char *img_filename;
+		int inactive;
+		unsigned chunk;
+		int quick;
+		int no_progress_bar;
+	} cfg = {
+		.chunk = 64,
+	};
+	const struct argconfig_options opts[] = {
+		DEVICE_OPTION,
+		{"img_file", .cfg_type=CFG_FILE_R, .value_addr=&cfg.fimg,
+		  .argument_type=required_positional,
+		  .help="image file to compare against"},
+		{"inactive", 'i', "", CFG_NONE, &cfg.inactive, no_argument,
+		 "compare against the inactive partition"},
+		{"chunk", 'c', "KB", CFG_POSITIVE, &cfg.chunk, required_argument,
+		 "size of each compared chunk in KiB (default: 64)"},
+		{"quick", 'q', "", CFG_NONE, &cfg.quick, no_argument,
+		 "stop at the first difference"},
+		{"no-progress", 'p', "", CFG_NONE, &cfg.no_progress_bar, no_argument,
+		"don't print progress to stdout"},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_FW_DIFF, opts, &cfg, sizeof(cfg));
+
+	ret = switchtec_fw_file_info(fileno(cfg.fimg), &info);
+	if (ret < 0) {
+		fprintf(stderr, "%s: Invalid image file format\n",
+			cfg.img_filename);
+		fclose(cfg.fimg);
+		return ret;
+	}
+
+	/* The image body follows the file's header */
+	body_off = info.part_body_offset;
+
+	fseek(cfg.fimg, 0, SEEK_END);
+	img_len = ftell(cfg.fimg);
+	fseek(cfg.fimg, 0, SEEK_SET);
+	if (img_len < 0 || body_off > img_len ||
+	    img_len - body_off < info.image_len) {
+		fprintf(stderr, "%s: Image file is truncated\n",
+			cfg.img_filename);
+		fclose(cfg.fimg);
+		return 1;
+	}
+
+	img = malloc(img_len ? img_len : 1);
+	if (!img || fread(img, 1, img_len, cfg.fimg) != (size_t)img_len) {
+		perror(cfg.img_filename);
+		ret = 1;
+		goto out;
+	}
+
+	sum = switchtec_fw_part_summary(cfg.dev);
+	if (!sum) {
+		switchtec_perror("fw_part_summary");
+		ret = 1;
+		goto out;
+	}
+
+	part = fw_part_of_type(sum, info.type);
+	inf = !part ? NULL : cfg.inactive ? part->inactive : part->active;
+	if (!inf) {
+		fprintf(stderr, "The device has no %s %s partition\n",
+			cfg.inactive ? "inactive" : "active",
+			switchtec_fw_image_type(&info));
+		ret = 1;
+		goto free_sum;
+	}
+
+	printf("Partition:  %s (%s)\n", switchtec_fw_image_type(&info),
+	       cfg.inactive ? "inactive" : "active");
+	printf("Version:    %-16s File: %s\n", inf->version, info.version);
+	printf("Img Len:    0x%-14zx File: 0x%zx\n", inf->image_len,
+	       info.image_len);
+	printf("CRC:        0x%08lx       File: 0x%08lx\n",
+	       inf->image_crc, info.image_crc);
+
+	if (info.image_len > inf->part_len - inf->part_body_offset) {
+		printf("\nThe image does not fit in the partition\n");
+		ret = 1;
+		goto free_sum;
+	}
+
+	progress_start();
+	ret = switchtec_fw_diff(cfg.dev, inf->part_addr + inf->part_body_offset,
+				img + body_off, info.image_len,
+				cfg.chunk * 1024,
+				cfg.quick ? NULL : ranges, FW_DIFF_MAX_RANGES,
+				cfg.no_progress_bar ? NULL : progress_update);
+	progress_finish(cfg.no_progress_bar);
+	printf("\n");
 
+	if (ret < 0) {
+		switchtec_perror("fw_diff");
+		goto free_sum;
+	}
+
+	if (!ret) {
+		printf("The partition matches the image\n");
+		goto free_sum;
+	}
+
+	if (cfg.quick) {
+		printf("The partition differs from the image\n");
+		goto free_sum;
+	}
+
+	printf("%d range%s differ%s:\n", ret, ret == 1 ? "" : "s",
+	       ret == 1 ? "s" : "");
+	for (i = 0; i < ret && i < FW_DIFF_MAX_RANGES; i++)
+		printf("  0x%08zx - 0x%08zx (flash 0x%08zx)\n",
+		       ranges[i].offset,
+		       ranges[i].offset + ranges[i].len - 1,
+		       inf->part_addr + inf->part_body_offset +
+		       ranges[i].offset);
+	if (ret > FW_DIFF_MAX_RANGES)
+		printf("  ... and %d more\n", ret - FW_DIFF_MAX_RANGES);
+	ret = 1;
+
+free_sum:
+	switchtec_fw_part_summary_free(sum);
+out:
+	free(img);
+	fclose(cfg.fimg);
 	return ret;
 }
 
@@ -2310,6 +4236,41 @@ static int display_event_counters(struct switchtec_dev *dev, int stack,
 	return 0;
 }
 
+static int display_all_event_counters(struct switchtec_dev *dev, int reset)
+{
+	static struct switchtec_evcntr_snapshot snap;
+	char buf[1024];
+	unsigned i;
+	int ret;
+
+	ret = switchtec_evcntr_snapshot_setup(dev, &snap);
+	if (ret < 0)
+		return ret;
+
+	ret = switchtec_evcntr_snapshot(dev, &snap, reset);
+	if (ret < 0)
+		return ret;
+
+	if (!snap.nr)
+		printf("No event counters enabled.\n");
+
+	for (i = 0; i < snap.nr; i++) {
+		if (!i || snap.stack_id[i] != snap.stack_id[i - 1])
+			printf("Stack %d:\n", snap.stack_id[i]);
+
+		port_mask_to_string(snap.port_mask[i], buf, sizeof(buf));
+		printf("   %2d - %-11s", snap.cntr_id[i], buf);
+
+		type_mask_to_string(snap.type_mask[i], buf, sizeof(buf));
+		if (strlen(buf) > 39)
+			strcpy(buf, "MANY");
+
+		printf("%-40s   %10u\n", buf, snap.count[i]);
+	}
+
+	return 0;
+}
+
 static int get_free_counter(struct switchtec_dev *dev, int stack)
 {
 	struct switchtec_evcntr_setup setups[SWITCHTEC_MAX_EVENT_COUNTERS];
@@ -2443,16 +4404,63 @@ static int evcntr_setup(int argc, char **argv)
 
 #define CMD_DESC_EVCNTR "display event counters"
 
-static int evcntr(int argc, char **argv)
+static int evcntr_record_sample(struct switchtec_dev *dev, void *ctx,
+				void *data)
 {
+	struct switchtec_evcntr_snapshot *snap = ctx;
+	uint32_t *counts = data;
 	int ret, i;
 
+	ret = switchtec_evcntr_snapshot(dev, snap, 0);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < snap->nr; i++)
+		counts[i] = snap->count[i];
+
+	return 0;
+}
+
+static int evcntr_record(struct switchtec_dev *dev, const char *path,
+			 unsigned period_ms)
+{
+	static struct switchtec_rec_channel channels[SWITCHTEC_MAX_EVCNTRS];
+	static struct switchtec_evcntr_snapshot snap;
+	int ret, i;
+
+	ret = switchtec_evcntr_snapshot_setup(dev, &snap);
+	if (ret < 0) {
+		switchtec_perror("evcntr");
+		return ret;
+	}
+
+	if (!snap.nr) {
+		fprintf(stderr, "No event counters are configured\n");
+		return 1;
+	}
+
+	for (i = 0; i < snap.nr; i++) {
+		channels[i].id = snap.stack_id[i] << 8 | snap.cntr_id[i];
+		channels[i].stack = snap.stack_id[i];
+	}
+
+	return record_loop(dev, path, SWITCHTEC_REC_EVCNTR, period_ms,
+			   snap.nr, channels, evcntr_record_sample, &snap);
+}
+
+static int evcntr(int argc, char **argv)
+{
+	int ret;
+
 	static struct {
 		struct switchtec_dev *dev;
 		int stack;
 		int reset;
+		char *record;
+		unsigned period;
 	} cfg = {
 		.stack = -1,
+		.period = 100,
 	};
 
 	const struct argconfig_options opts[] = {
@@ -2461,123 +4469,430 @@ static int evcntr(int argc, char **argv)
 		 "reset counters back to zero"},
 		{"stack", 's', "NUM", CFG_NONNEGATIVE, &cfg.stack, required_argument,
 		 "stack to show the counters for"},
+		{"record", 'R', "FILE", CFG_STRING, &cfg.record,
+		  required_argument,
+		 "sample continuously into a binary recording until "
+		 "interrupted"},
+		{"period", 'P', "MS", CFG_POSITIVE, &cfg.period,
+		  required_argument,
+		 "with --record, milliseconds between samples (default: 100)"},
 		{}};
 
 	argconfig_parse(argc, argv, CMD_DESC_EVCNTR, opts, &cfg, sizeof(cfg));
 
+	if (cfg.record)
+		return evcntr_record(cfg.dev, cfg.record, cfg.period);
+
 	if (cfg.stack < 0) {
-		for (i = 0; i < SWITCHTEC_MAX_STACKS; i++)
-			display_event_counters(cfg.dev, i, cfg.reset);
-		return 0;
+		ret = display_all_event_counters(cfg.dev, cfg.reset);
+		if (ret)
+			switchtec_perror("display events");
+		return ret;
 	}
 
 	ret = display_event_counters(cfg.dev, cfg.stack, cfg.reset);
 	if (ret)
 		switchtec_perror("display events");
 
-	return ret;
-}
+	return ret;
+}
+
+#define CMD_DESC_EVCNTR_SHOW "display an event counter's configuration"
+
+static int evcntr_show(int argc, char **argv)
+{
+	struct switchtec_evcntr_setup setup;
+	int ret;
+
+	static struct {
+		struct switchtec_dev *dev;
+		int stack;
+		int counter;
+	} cfg = {
+		.stack = -1,
+		.counter = -1,
+	};
+
+	const struct argconfig_options opts[] = {
+		DEVICE_OPTION,
+		{"stack", 's', "NUM", CFG_NONNEGATIVE, &cfg.stack, required_argument,
+		 "stack to show the configuration for",
+		 .require_in_usage=1},
+		{"counter", 'c', "NUM", CFG_NONNEGATIVE, &cfg.counter, required_argument,
+		 "counter index",
+		 .require_in_usage=1},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_EVCNTR_SHOW, opts, &cfg, sizeof(cfg));
+
+	if (cfg.stack < 0) {
+		argconfig_print_usage(opts);
+		fprintf(stderr, "The --stack argument is required!\n");
+		return 1;
+	}
+
+	if (cfg.counter < 0) {
+		argconfig_print_usage(opts);
+		fprintf(stderr, "The --counter argument is required!\n");
+		return 1;
+	}
+
+	ret = switchtec_evcntr_get_setup(cfg.dev, cfg.stack, cfg.counter, 1,
+					 &setup);
+	if (ret < 0) {
+		switchtec_perror("evcntr_show");
+		return ret;
+	}
+
+	show_event_counter(cfg.stack, cfg.counter, &setup);
+
+	return 0;
+}
+
+#define CMD_DESC_EVCNTR_DEL "deconfigure an event counter"
+
+static int evcntr_del(int argc, char **argv)
+{
+	struct switchtec_evcntr_setup setup = {};
+	int ret;
+
+	static struct {
+		struct switchtec_dev *dev;
+		int stack;
+		int counter;
+	} cfg = {
+		.stack = -1,
+		.counter = -1,
+	};
+
+	const struct argconfig_options opts[] = {
+		DEVICE_OPTION,
+		{"stack", 's', "NUM", CFG_NONNEGATIVE, &cfg.stack, required_argument,
+		 "stack to deconfigure the counter in",
+		 .require_in_usage=1},
+		{"counter", 'c', "NUM", CFG_NONNEGATIVE, &cfg.counter, required_argument,
+		 "counter index",
+		 .require_in_usage=1},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_EVCNTR_DEL, opts, &cfg, sizeof(cfg));
+
+	if (cfg.stack < 0) {
+		argconfig_print_usage(opts);
+		fprintf(stderr, "The --stack argument is required!\n");
+		return 1;
+	}
+
+	if (cfg.counter < 0) {
+		argconfig_print_usage(opts);
+		fprintf(stderr, "The --counter argument is required!\n");
+		return 1;
+	}
+
+	ret = switchtec_evcntr_setup(cfg.dev, cfg.stack, cfg.counter, &setup);
+	if (ret < 0) {
+		switchtec_perror("evcntr_del");
+		return ret;
+	}
+
+
+	return 0;
+}
+
+#define CMD_DESC_EVCNTR_ALERT \
+	"set up event counter thresholds from rules and report alerts"
+
+#define EVCNTR_ALERT_MAX_RULES 64
+#define EVCNTR_ALERT_MAX_DEVS 32
+
+static int evcntr_alert_ports(const char *str, uint64_t *mask)
+{
+	int nums[64];
+	int cnt, i;
+
+	*mask = 0;
+	if (!strcasecmp(str, "all"))
+		return 0;
+
+	cnt = argconfig_parse_comma_range(str, nums, ARRAY_SIZE(nums));
+	if (cnt <= 0)
+		return -1;
+
+	for (i = 0; i < cnt; i++) {
+		if (nums[i] < 0 || nums[i] >= 64)
+			return -1;
+		*mask |= 1ULL << nums[i];
+	}
+
+	return 0;
+}
+
+static int evcntr_alert_types(char *str, unsigned *mask)
+{
+	const struct switchtec_evcntr_type_list *t;
+	char *tok;
+
+	*mask = 0;
+	for (tok = strtok(str, ","); tok; tok = strtok(NULL, ",")) {
+		for (t = switchtec_evcntr_type_list; t->name; t++)
+			if (!strcasecmp(tok, t->name))
+				break;
+
+		if (!t->name)
+			return -1;
+		*mask |= t->mask;
+	}
+
+	return *mask ? 0 : -1;
+}
+
+/*
+ * Each line of a rules file is:
+ *
+ *   EVENT[,EVENT...] THRESHOLD [PORTS|all] [ingress|egress]
+ *
+ * Blank lines and lines starting with '#' are ignored.
+ */
+static int evcntr_alert_read_rules(FILE *f, const char *name,
+				   struct switchtec_evcntr_rule *rules,
+				   int max)
+{
+	char line[512], types[256], ports[256], dir[16];
+	char *p;
+	int n, nr = 0, lineno = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+
+		p = line;
+		while (isspace(*p))
+			p++;
+		if (!*p || *p == '#')
+			continue;
+
+		if (nr == max) {
+			fprintf(stderr, "%s:%d: too many rules\n", name,
+				lineno);
+			return -1;
+		}
+
+		strcpy(ports, "all");
+		strcpy(dir, "ingress");
+		rules[nr] = (struct switchtec_evcntr_rule) {};
+
+		n = sscanf(p, "%255s %u %255s %15s", types,
+			   &rules[nr].threshold, ports, dir);
+		if (n < 2 || !rules[nr].threshold ||
+		    evcntr_alert_types(types, &rules[nr].type_mask) ||
+		    evcntr_alert_ports(ports, &rules[nr].port_mask) ||
+		    (strcmp(dir, "ingress") && strcmp(dir, "egress"))) {
+			fprintf(stderr, "%s:%d: invalid rule\n", name, lineno);
+			return -1;
+		}
+
+		rules[nr].egress = !strcmp(dir, "egress");
+		nr++;
+	}
+
+	return nr;
+}
+
+static void evcntr_alert_print(struct switchtec_evcntr_alert *a)
+{
+	int type_mask = a->type_mask;
+	const char *type = switchtec_evcntr_type_str(&type_mask);
+	time_t t = a->time_us / 1000000;
+	int ms = a->time_us % 1000000 / 1000;
+	char tbuf[32];
+
+	strftime(tbuf, sizeof(tbuf), "%Y-%m-%d %H:%M:%S", localtime(&t));
+
+	if (a->error) {
+		printf("%s.%03d %s: %s\n", tbuf, ms, (const char *)a->data,
+		       strerror(a->error));
+		return;
+	}
 
-#define CMD_DESC_EVCNTR_SHOW "display an event counter's configuration"
+	printf("%s.%03d %s: port %d (partition %d, logical %d, stack %d "
+	       "counter %d) %s reached %u (threshold %u, rule %d)\n",
+	       tbuf, ms, (const char *)a->data,
+	       a->port.phys_id, a->port.partition, a->port.log_id,
+	       a->stack_id, a->cntr_id, type ? type : "?", a->count,
+	       a->threshold, a->rule + 1);
+}
 
-static int evcntr_show(int argc, char **argv)
+static int evcntr_alert(int argc, char **argv)
 {
-	struct switchtec_evcntr_setup setup;
-	int ret;
+	int nr_type_choices = switchtec_evcntr_type_count();
+	struct argconfig_choice type_choices[nr_type_choices+1];
+	struct switchtec_evcntr_rule rules[EVCNTR_ALERT_MAX_RULES];
+	struct switchtec_dev *devs[EVCNTR_ALERT_MAX_DEVS];
+	const char *names[EVCNTR_ALERT_MAX_DEVS];
+	struct switchtec_evcntr_alert alerts[16];
+	struct switchtec_evcntr_alerts *al;
+	int nr_rules, nr_devs = 0;
+	int seen = 0;
+	int ret = 0, i, n;
+	char *tok;
+
+	const char *desc = CMD_DESC_EVCNTR_ALERT "\n\n"
+		"Either give one rule with --event, or a rules file with a "
+		"rule per line:\n\n"
+		"  EVENT[,EVENT...] THRESHOLD [PORTS|all] [ingress|egress]\n\n"
+		"Every rule gets a counter for each port and event it names, "
+		"on every device. Counters are only read when a device "
+		"signals that one has reached its threshold, and each one "
+		"restarts from zero after an alert. The counters are removed "
+		"on exit.";
 
 	static struct {
 		struct switchtec_dev *dev;
-		int stack;
-		int counter;
+		FILE *rules_file;
+		const char *rules_name;
+		char *devices;
+		unsigned type_mask;
+		const char *ports;
+		int egress;
+		unsigned threshold;
+		int count;
 	} cfg = {
-		.stack = -1,
-		.counter = -1,
+		.ports = "all",
+		.threshold = 1,
 	};
-
 	const struct argconfig_options opts[] = {
 		DEVICE_OPTION,
-		{"stack", 's', "NUM", CFG_NONNEGATIVE, &cfg.stack, required_argument,
-		 "stack to show the configuration for",
-		 .require_in_usage=1},
-		{"counter", 'c', "NUM", CFG_NONNEGATIVE, &cfg.counter, required_argument,
-		 "counter index",
-		 .require_in_usage=1},
+		{"rules", 'f', "FILE", CFG_FILE_R, &cfg.rules_file,
+		  required_argument, "read the rules from FILE"},
+		{"event", 'e', "EVENT", CFG_MULT_CHOICES, &cfg.type_mask,
+		  required_argument,
+		 "event to count, may be given more than once",
+		 .choices=type_choices},
+		{"ports", 'p', "#,#-#|all", CFG_STRING, &cfg.ports,
+		  required_argument,
+		 "physical ports to watch with --event (default: all)"},
+		{"thresh", 't', "NUM", CFG_POSITIVE, &cfg.threshold,
+		  required_argument,
+		 "count that raises an alert with --event (default: 1)"},
+		{"egress", 'g', "", CFG_NONE, &cfg.egress, no_argument,
+		 "count egress TLPs instead of ingress with --event"},
+		{"devices", 'D', "LIST", CFG_STRING, &cfg.devices,
+		  required_argument,
+		 "comma separated list of more devices to watch"},
+		{"count", 'n', "NUM", CFG_NONNEGATIVE, &cfg.count,
+		  required_argument,
+		 "exit after this many alerts (default: run until "
+		 "interrupted)"},
 		{NULL}};
 
-	argconfig_parse(argc, argv, CMD_DESC_EVCNTR_SHOW, opts, &cfg, sizeof(cfg));
-
-	if (cfg.stack < 0) {
-		argconfig_print_usage(opts);
-		fprintf(stderr, "The --stack argument is required!\n");
-		return 1;
-	}
+	create_type_choices(type_choices);
+	argconfig_parse(argc, argv, desc, opts, &cfg, sizeof(cfg));
 
-	if (cfg.counter < 0) {
+	if (!cfg.rules_file == !cfg.type_mask) {
 		argconfig_print_usage(opts);
-		fprintf(stderr, "The --counter argument is required!\n");
+		fprintf(stderr, "Exactly one of --rules or --event must be "
+			"given\n");
 		return 1;
 	}
 
-	ret = switchtec_evcntr_get_setup(cfg.dev, cfg.stack, cfg.counter, 1,
-					 &setup);
-	if (ret < 0) {
-		switchtec_perror("evcntr_show");
-		return ret;
+	if (cfg.rules_file) {
+		nr_rules = evcntr_alert_read_rules(cfg.rules_file,
+						   cfg.rules_name, rules,
+						   ARRAY_SIZE(rules));
+		fclose(cfg.rules_file);
+		if (nr_rules < 0)
+			return 1;
+		if (!nr_rules) {
+			fprintf(stderr, "%s: no rules\n", cfg.rules_name);
+			return 1;
+		}
+	} else {
+		rules[0] = (struct switchtec_evcntr_rule) {
+			.type_mask = cfg.type_mask,
+			.egress = cfg.egress,
+			.threshold = cfg.threshold,
+		};
+		if (evcntr_alert_ports(cfg.ports, &rules[0].port_mask)) {
+			fprintf(stderr, "Invalid port list '%s'\n", cfg.ports);
+			return 1;
+		}
+		nr_rules = 1;
 	}
 
-	show_event_counter(cfg.stack, cfg.counter, &setup);
+	devs[nr_devs] = cfg.dev;
+	names[nr_devs++] = switchtec_name(cfg.dev);
 
-	return 0;
-}
+	if (cfg.devices) {
+		for (tok = strtok(cfg.devices, ","); tok;
+		     tok = strtok(NULL, ",")) {
+			if (nr_devs == ARRAY_SIZE(devs)) {
+				fprintf(stderr, "Too many devices\n");
+				ret = 1;
+				goto close_devs;
+			}
 
-#define CMD_DESC_EVCNTR_DEL "deconfigure an event counter"
+			devs[nr_devs] = switchtec_open(tok);
+			if (!devs[nr_devs]) {
+				switchtec_perror(tok);
+				ret = 1;
+				goto close_devs;
+			}
+			names[nr_devs++] = tok;
+		}
+	}
 
-static int evcntr_del(int argc, char **argv)
-{
-	struct switchtec_evcntr_setup setup = {};
-	int ret;
+	al = switchtec_evcntr_alerts_new();
+	if (!al) {
+		perror("evcntr-alert");
+		ret = 1;
+		goto close_devs;
+	}
 
-	static struct {
-		struct switchtec_dev *dev;
-		int stack;
-		int counter;
-	} cfg = {
-		.stack = -1,
-		.counter = -1,
-	};
+	for (i = 0; i < nr_devs; i++) {
+		ret = switchtec_evcntr_alerts_add(al, devs[i], rules, nr_rules,
+						  (void *)names[i]);
+		if (ret < 0) {
+			switchtec_perror(names[i]);
+			goto out;
+		}
+	}
 
-	const struct argconfig_options opts[] = {
-		DEVICE_OPTION,
-		{"stack", 's', "NUM", CFG_NONNEGATIVE, &cfg.stack, required_argument,
-		 "stack to deconfigure the counter in",
-		 .require_in_usage=1},
-		{"counter", 'c', "NUM", CFG_NONNEGATIVE, &cfg.counter, required_argument,
-		 "counter index",
-		 .require_in_usage=1},
-		{NULL}};
+	record_stop = 0;
+	signal(SIGINT, record_sig);
+	signal(SIGTERM, record_sig);
 
-	argconfig_parse(argc, argv, CMD_DESC_EVCNTR_DEL, opts, &cfg, sizeof(cfg));
+	fprintf(stderr, "Watching %d rule%s on %d device%s, "
+		"press Ctrl-C to stop\n", nr_rules, nr_rules == 1 ? "" : "s",
+		nr_devs, nr_devs == 1 ? "" : "s");
 
-	if (cfg.stack < 0) {
-		argconfig_print_usage(opts);
-		fprintf(stderr, "The --stack argument is required!\n");
-		return 1;
-	}
+	while (!record_stop && (!cfg.count || seen < cfg.count)) {
+		/* Wake up now and then to notice Ctrl-C */
+		n = switchtec_evcntr_alerts_wait(al, alerts,
+						 ARRAY_SIZE(alerts), 500);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0) {
+			switchtec_perror("evcntr-alert");
+			ret = n;
+			break;
+		}
 
-	if (cfg.counter < 0) {
-		argconfig_print_usage(opts);
-		fprintf(stderr, "The --counter argument is required!\n");
-		return 1;
+		for (i = 0; i < n && (!cfg.count || seen < cfg.count); i++) {
+			evcntr_alert_print(&alerts[i]);
+			seen++;
+		}
+		fflush(stdout);
 	}
 
-	ret = switchtec_evcntr_setup(cfg.dev, cfg.stack, cfg.counter, &setup);
-	if (ret < 0) {
-		switchtec_perror("evcntr_del");
-		return ret;
-	}
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
 
+out:
+	switchtec_evcntr_alerts_free(al);
+close_devs:
+	for (i = 1; i < nr_devs; i++)
+		switchtec_close(devs[i]);
 
-	return 0;
+	return ret < 0 ? ret : 0;
 }
 
 #define CMD_DESC_EVCNTR_WAIT "wait for an event counter to exceed its threshold"
@@ -2823,6 +5138,500 @@ static int lnkerr_cto(int argc, char **argv)
 	return ret;
 }
 
+#define CMD_DESC_LNKERR_CAMPAIGN \
+	"inject link error bursts on many ports and measure the impact"
+
+#define LNKERR_CAMPAIGN_MAX_BURSTS 256
+
+static const struct argconfig_choice lnkerr_type_choices[] = {
+	{"dllp", SWITCHTEC_LNKERR_DLLP, "DLLP"},
+	{"dllp-crc", SWITCHTEC_LNKERR_DLLP_CRC, "DLLP CRC error"},
+	{"tlp-lcrc", SWITCHTEC_LNKERR_TLP_LCRC, "TLP LCRC error"},
+	{"tlp-seq", SWITCHTEC_LNKERR_TLP_SEQ, "TLP sequence number error"},
+	{"ack-nack", SWITCHTEC_LNKERR_ACK_NACK, "ACK to NACK error"},
+	{"cto", SWITCHTEC_LNKERR_CTO, "credit timeout (Gen5 only)"},
+	{}
+};
+
+static int lnkerr_campaign_type(const char *str)
+{
+	const struct argconfig_choice *c;
+
+	for (c = lnkerr_type_choices; c->name; c++)
+		if (!strcasecmp(str, c->name))
+			return c->value;
+
+	return -1;
+}
+
+/* Add one burst per port in a port list */
+static int lnkerr_campaign_add(struct switchtec_lnkerr_burst *bursts,
+			       int nr, int max, const char *ports,
+			       const struct switchtec_lnkerr_burst *b)
+{
+	uint64_t mask;
+	int p;
+
+	if (evcntr_alert_ports(ports, &mask) || !mask)
+		return -1;
+
+	for (p = 0; p < 64; p++) {
+		if (!(mask & (1ULL << p)))
+			continue;
+		if (nr == max)
+			return -1;
+
+		bursts[nr] = *b;
+		bursts[nr].phys_port_id = p;
+		nr++;
+	}
+
+	return nr;
+}
+
+/*
+ * Each line of a campaign file is:
+ *
+ *   PORTS TYPE START_MS DURATION_MS RATE [DATA [COUNT]]
+ *
+ * RATE is injections per second, or the hardware rate for dllp-crc and
+ * tlp-lcrc. Blank lines and lines starting with '#' are ignored.
+ */
+static int lnkerr_campaign_read(FILE *f, const char *name,
+				struct switchtec_lnkerr_burst *bursts, int max)
+{
+	struct switchtec_lnkerr_burst b;
+	char line[512], ports[256], type[32];
+	unsigned rate, data, count;
+	int n, nr = 0, lineno = 0;
+	char *p;
+
+	while (fgets(line, sizeof(line), f)) {
+		lineno++;
+
+		p = line;
+		while (isspace(*p))
+			p++;
+		if (!*p || *p == '#')
+			continue;
+
+		b = (struct switchtec_lnkerr_burst) {};
+		data = 0;
+		count = 1;
+
+		n = sscanf(p, "%255s %31s %u %u %u %u %u", ports, type,
+			   &b.start_ms, &b.duration_ms, &rate, &data, &count);
+		if (n < 5 || lnkerr_campaign_type(type) < 0 ||
+		    !b.duration_ms || data > 0xFFFF || count > 0xFF) {
+			fprintf(stderr, "%s:%d: invalid burst\n", name, lineno);
+			return -1;
+		}
+
+		b.type = lnkerr_campaign_type(type);
+		b.rate = rate;
+		b.hw_rate = rate;
+		b.data = data;
+		b.count = count;
+
+		nr = lnkerr_campaign_add(bursts, nr, max, ports, &b);
+		if (nr < 0) {
+			fprintf(stderr, "%s:%d: invalid or too many ports\n",
+				name, lineno);
+			return -1;
+		}
+	}
+
+	return nr;
+}
+
+static int lnkerr_campaign_sample(const struct switchtec_lnkerr_sample *s,
+				  void *data)
+{
+	FILE *csv = data;
+
+	if (csv)
+		fprintf(csv, "%.3f,%d,%.0f,%u,%d\n", s->time_us / 1e6,
+			s->phys_port_id, s->bps, s->events, s->bursting);
+
+	return record_stop;
+}
+
+static int lnkerr_campaign(int argc, char **argv)
+{
+	int nr_type_choices = switchtec_evcntr_type_count();
+	struct argconfig_choice evcntr_choices[nr_type_choices + 1];
+	struct switchtec_lnkerr_burst bursts[LNKERR_CAMPAIGN_MAX_BURSTS];
+	struct switchtec_lnkerr_result results[LNKERR_CAMPAIGN_MAX_BURSTS];
+	struct switchtec_lnkerr_campaign c = {};
+	struct switchtec_lnkerr_burst b = {};
+	int nr_bursts, nr, i;
+
+	const char *desc = CMD_DESC_LNKERR_CAMPAIGN "\n\n"
+		"Either give one burst for a list of ports with --ports and "
+		"--type, or a campaign file with a burst per line:\n\n"
+		"  PORTS TYPE START_MS DURATION_MS RATE [DATA [COUNT]]\n\n"
+		"RATE is injections per second, except for dllp-crc and "
+		"tlp-lcrc where it is the hardware rate and injection stays "
+		"on for the whole burst. DATA is the DLLP data or the ACK "
+		"sequence number and COUNT the number of NACKs.\n\n"
+		"All bursts run at once. Bandwidth and the --event error "
+		"counts of every port are sampled throughout. For each port "
+		"the throughput before its first burst is the baseline, and "
+		"the drop and the time to get back within --recover percent "
+		"of it after its last burst are reported. Run traffic over "
+		"the ports while the campaign runs.";
+
+	static struct {
+		struct switchtec_dev *dev;
+		FILE *campaign_file;
+		const char *campaign_name;
+		const char *ports;
+		int type;
+		unsigned rate;
+		unsigned start;
+		unsigned duration;
+		unsigned data;
+		unsigned count;
+		unsigned sample_ms;
+		unsigned settle_ms;
+		unsigned recover;
+		unsigned evcntr_mask;
+		FILE *csv_file;
+		const char *csv_name;
+	} cfg = {
+		.type = -1,
+		.rate = 100,
+		.start = 2000,
+		.duration = 1000,
+		.count = 1,
+		.sample_ms = 100,
+		.settle_ms = 3000,
+		.recover = 90,
+	};
+	const struct argconfig_options opts[] = {
+		DEVICE_OPTION,
+		{"campaign", 'f', "FILE", CFG_FILE_R, &cfg.campaign_file,
+		  required_argument, "read the bursts from FILE"},
+		{"ports", 'p', "#,#-#", CFG_STRING, &cfg.ports,
+		  required_argument, "physical ports to inject on"},
+		{"type", 't', "TYPE", CFG_CHOICES, &cfg.type,
+		  required_argument, "link error to inject",
+		  .choices=lnkerr_type_choices},
+		{"rate", 'r', "NUM", CFG_POSITIVE, &cfg.rate,
+		  required_argument,
+		 "injections per second, or the hardware rate (default: 100)"},
+		{"start", 's', "MS", CFG_NONNEGATIVE, &cfg.start,
+		  required_argument,
+		 "start of the burst in milliseconds (default: 2000)"},
+		{"duration", 'd', "MS", CFG_POSITIVE, &cfg.duration,
+		  required_argument,
+		 "length of the burst in milliseconds (default: 1000)"},
+		{"data", 'a', "NUM", CFG_NONNEGATIVE, &cfg.data,
+		  required_argument,
+		 "DLLP data, or ACK sequence number for ack-nack"},
+		{"count", 'n', "NUM", CFG_POSITIVE, &cfg.count,
+		  required_argument,
+		 "number of ACKs to replace for ack-nack (default: 1)"},
+		{"interval", 'i', "MS", CFG_POSITIVE, &cfg.sample_ms,
+		  required_argument,
+		 "sample interval in milliseconds (default: 100)"},
+		{"settle", 'S', "MS", CFG_NONNEGATIVE, &cfg.settle_ms,
+		  required_argument,
+		 "time to keep sampling after the last burst (default: 3000)"},
+		{"recover", 'R', "PCT", CFG_POSITIVE, &cfg.recover,
+		  required_argument,
+		 "percent of the baseline that counts as recovered "
+		 "(default: 90)"},
+		{"event", 'e', "EVENT", CFG_MULT_CHOICES, &cfg.evcntr_mask,
+		  required_argument,
+		 "error type to count on each port, may be given more than "
+		 "once", .choices=evcntr_choices},
+		{"samples", 'o', "FILE", CFG_FILE_W, &cfg.csv_file,
+		  required_argument,
+		 "write every sample to FILE as CSV"},
+		{NULL}};
+
+	create_type_choices(evcntr_choices);
+	argconfig_parse(argc, argv, desc, opts, &cfg, sizeof(cfg));
+
+	if (!cfg.campaign_file == !cfg.ports ||
+	    (cfg.ports && cfg.type < 0)) {
+		argconfig_print_usage(opts);
+		fprintf(stderr, "Give either --campaign, or --ports and "
+			"--type\n");
+		return 1;
+	}
+
+	if (cfg.campaign_file) {
+		nr_bursts = lnkerr_campaign_read(cfg.campaign_file,
+						 cfg.campaign_name, bursts,
+						 ARRAY_SIZE(bursts));
+		fclose(cfg.campaign_file);
+		if (nr_bursts < 0)
+			return 1;
+		if (!nr_bursts) {
+			fprintf(stderr, "%s: no bursts\n", cfg.campaign_name);
+			return 1;
+		}
+	} else {
+		if (cfg.data > 0xFFFF || cfg.count > 0xFF) {
+			fprintf(stderr, "Invalid --data or --count\n");
+			return 1;
+		}
+
+		b.type = cfg.type;
+		b.start_ms = cfg.start;
+		b.duration_ms = cfg.duration;
+		b.rate = cfg.rate;
+		b.hw_rate = cfg.rate;
+		b.data = cfg.data;
+		b.count = cfg.count;
+
+		nr_bursts = lnkerr_campaign_add(bursts, 0, ARRAY_SIZE(bursts),
+						cfg.ports, &b);
+		if (nr_bursts < 0) {
+			fprintf(stderr, "Invalid port list '%s'\n", cfg.ports);
+			return 1;
+		}
+	}
+
+	for (i = 0; i < nr_bursts; i++) {
+		if (bursts[i].type == SWITCHTEC_LNKERR_CTO &&
+		    !switchtec_is_gen5(cfg.dev)) {
+			fprintf(stderr, "Credit timeout error injection is "
+				"only supported on Gen5.\n");
+			return 1;
+		}
+	}
+
+	c.bursts = bursts;
+	c.nr_bursts = nr_bursts;
+	c.sample_ms = cfg.sample_ms;
+	c.settle_ms = cfg.settle_ms;
+	c.recover_frac = cfg.recover / 100.0;
+	c.evcntr_mask = cfg.evcntr_mask;
+	c.cb = lnkerr_campaign_sample;
+	c.data = cfg.csv_file;
+
+	if (cfg.csv_file)
+		fprintf(cfg.csv_file, "time_s,port,bytes_per_s,events,"
+			"bursting\n");
+
+	record_stop = 0;
+	signal(SIGINT, record_sig);
+	signal(SIGTERM, record_sig);
+
+	fprintf(stderr, "Running %d burst%s, press Ctrl-C to stop\n",
+		nr_bursts, nr_bursts == 1 ? "" : "s");
+	nr = switchtec_lnkerr_campaign_run(cfg.dev, &c, results,
+					   ARRAY_SIZE(results));
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+
+	if (cfg.csv_file)
+		fclose(cfg.csv_file);
+
+	if (nr < 0) {
+		switchtec_perror("lnkerr-campaign");
+		return 1;
+	}
+
+	printf("%5s %9s %7s %13s %13s %7s %12s", "PORT", "INJECTED",
+	       "FAILED", "BASELINE", "MINIMUM", "DROP", "RECOVERY");
+	if (cfg.evcntr_mask)
+		printf(" %10s", "EVENTS");
+	printf("\n");
+
+	for (i = 0; i < nr; i++) {
+		struct switchtec_lnkerr_result *r = &results[i];
+		char recovery[32];
+
+		if (r->recovered)
+			snprintf(recovery, sizeof(recovery), "%.1f ms",
+				 r->recovery_us / 1000.0);
+		else
+			snprintf(recovery, sizeof(recovery), "none");
+
+		printf("%5d %9u %7u %8.1f MB/s %8.1f MB/s %6.1f%% %12s",
+		       r->phys_port_id, r->injected, r->inject_failed,
+		       r->baseline / 1e6, r->minimum / 1e6, r->drop_pct,
+		       recovery);
+		if (cfg.evcntr_mask)
+			printf(" %10u", r->events);
+		printf("\n");
+	}
+
+	return 0;
+}
+
+#define CMD_DESC_BATCH "run several commands on one device without reopening it"
+#define BATCH_MAX_ARGS 64
+
+/*
+ * Split a script line into arguments in place. Single and double quotes
+ * group words and '#' starts a comment. Returns the number of
+ * arguments or a negative errno.
+ */
+static int batch_split(char *line, char **args, int max)
+{
+	char *in = line, *out = line;
+	int nargs = 0;
+	char quote;
+
+	while (1) {
+		while (isspace((unsigned char)*in))
+			in++;
+		if (!*in || *in == '#')
+			break;
+
+		if (nargs == max - 1)
+			return -E2BIG;
+		args[nargs++] = out;
+
+		for (quote = 0; *in; in++) {
+			if (quote && *in == quote) {
+				quote = 0;
+				continue;
+			} else if (!quote && (*in == '"' || *in == '\'')) {
+				quote = *in;
+				continue;
+			} else if (!quote && isspace((unsigned char)*in)) {
+				break;
+			}
+			*out++ = *in;
+		}
+
+		if (quote)
+			return -EINVAL;
+		if (*in)
+			in++;
+		*out++ = 0;
+	}
+
+	args[nargs] = NULL;
+	return nargs;
+}
+
+static int batch(int argc, char **argv)
+{
+	static jmp_buf parse_error;
+	char line[4096], echo[sizeof(line)];
+	char *args[BATCH_MAX_ARGS];
+	struct switchtec_dev *batch_dev;
+	const char *batch_dev_name;
+	volatile int cmd_ret;
+	int nargs, lineno = 0, batch_pax, ret = 0;
+	char *env;
+
+	static struct {
+		struct switchtec_dev *dev;
+		FILE *script;
+		const char *script_name;
+		int keep_going;
+		int echo;
+		int no_cache;
+	} cfg = {};
+	const struct argconfig_options opts[] = {
+		DEVICE_OPTION,
+		{"script", .cfg_type=CFG_FILE_R, .value_addr=&cfg.script,
+		 .argument_type=optional_positional,
+		 .help="file with one command per line, without the device "
+		 "argument (default: read from stdin)"},
+		{"keep-going", 'k', "", CFG_NONE, &cfg.keep_going, no_argument,
+		 "run the remaining commands after one fails"},
+		{"echo", 'e', "", CFG_NONE, &cfg.echo, no_argument,
+		 "print each command before its output"},
+		{"no-cache", 'C', "", CFG_NONE, &cfg.no_cache, no_argument,
+		 "read the system info registers again for every command"},
+		{NULL}};
+
+	argconfig_parse(argc, argv, CMD_DESC_BATCH, opts, &cfg, sizeof(cfg));
+
+	if (!cfg.script) {
+		cfg.script = stdin;
+		cfg.script_name = "<stdin>";
+	}
+
+	if (!cfg.no_cache)
+		switchtec_gas_cache_enable(cfg.dev, 1);
+
+	/* Commands take the device from the environment like a default */
+	env = malloc(strlen("SWITCHTEC_DEV=") + strlen(global_dev_name) + 1);
+	if (!env) {
+		perror("batch");
+		return 1;
+	}
+	sprintf(env, "SWITCHTEC_DEV=%s", global_dev_name);
+	putenv(env);
+
+	batch_dev = global_dev;
+	batch_dev_name = global_dev_name;
+	batch_pax = global_pax_id;
+	batch_active = 1;
+	argconfig_set_batch(&parse_error);
+
+	while (fgets(line, sizeof(line), cfg.script)) {
+		lineno++;
+		line[strcspn(line, "\r\n")] = 0;
+		strcpy(echo, line);
+
+		nargs = batch_split(line, args, ARRAY_SIZE(args));
+		if (nargs == 0)
+			continue;
+
+		if (nargs < 0) {
+			fprintf(stderr, "%s:%d: %s\n", cfg.script_name, lineno,
+				nargs == -E2BIG ? "too many arguments" :
+				"unterminated quote");
+			cmd_ret = 1;
+		} else if (!strcmp(args[0], "batch")) {
+			fprintf(stderr, "%s:%d: batch can't be nested\n",
+				cfg.script_name, lineno);
+			cmd_ret = 1;
+		} else {
+			if (cfg.echo)
+				printf("# %s\n", echo);
+			fflush(stdout);
+
+			global_pax_id = batch_pax;
+			set_global_pax_id();
+
+			if (setjmp(parse_error))
+				cmd_ret = 1;
+			else
+				cmd_ret = commands_run(nargs, args);
+
+			/*
+			 * A line that named another device opened it in
+			 * place of the batch's own; close it and go back.
+			 */
+			if (global_dev != batch_dev) {
+				switchtec_close(global_dev);
+				global_dev = batch_dev;
+				global_dev_name = batch_dev_name;
+			}
+
+			fflush(stdout);
+			if (cmd_ret)
+				fprintf(stderr, "%s:%d: '%s' failed (%d)\n",
+					cfg.script_name, lineno, args[0],
+					cmd_ret);
+		}
+
+		if (cmd_ret) {
+			ret = cmd_ret;
+			if (!cfg.keep_going)
+				break;
+		}
+	}
+
+	argconfig_set_batch(NULL);
+	batch_active = 0;
+
+	return ret;
+}
+
 static const struct cmd commands[] = {
 	CMD(list, CMD_DESC_LIST),
 	CMD(info, CMD_DESC_INFO),
@@ -2830,33 +5639,43 @@ static const struct cmd commands[] = {
 	CMD(status, CMD_DESC_STATUS),
 	CMD(bw, CMD_DESC_BW),
 	CMD(latency, CMD_DESC_LATENCY),
+	CMD(exporter, CMD_DESC_EXPORTER),
 	CMD(events, CMD_DESC_EVENTS),
 	CMD(event_wait, CMD_DESC_EVENT_WAIT),
+	CMD(flight_recorder, CMD_DESC_FLIGHT_RECORDER),
+	CMD(flight_recorder_show, CMD_DESC_FLIGHT_RECORDER_SHOW),
 	CMD(log_dump, CMD_DESC_LOG_DUMP),
 	CMD(log_parse, CMD_DESC_LOG_PARSE),
 	CMD(test, CMD_DESC_TEST),
 	CMD(temp, CMD_DESC_TEMP),
+	CMD(mrpc_stats, CMD_DESC_MRPC_STATS),
+	CMD(batch, CMD_DESC_BATCH),
 	CMD(port_bind_info, CMD_DESC_PORT_BIND_INFO),
 	CMD(port_bind, CMD_DESC_PORT_BIND),
 	CMD(port_unbind, CMD_DESC_PORT_UNBIND),
+	CMD(port_bind_apply, CMD_DESC_PORT_BIND_APPLY),
 	CMD(stack_bif, CMD_DESC_STACK_BIF),
 	CMD(hard_reset, CMD_DESC_HARD_RESET),
 	CMD(fw_update, CMD_DESC_FW_UPDATE),
+	CMD(fw_update_multi, CMD_DESC_FW_UPDATE_MULTI),
 	CMD(fw_info, CMD_DESC_FW_INFO),
 	CMD(fw_toggle, CMD_DESC_FW_TOGGLE),
 	CMD(fw_read, CMD_DESC_FW_READ),
+	CMD(fw_diff, CMD_DESC_FW_DIFF),
 	CMD(fw_img_info, CMD_DESC_FW_IMG_INFO),
 	CMD(evcntr, CMD_DESC_EVCNTR),
 	CMD(evcntr_setup, CMD_DESC_EVCNTR_SETUP),
 	CMD(evcntr_show, CMD_DESC_EVCNTR_SHOW),
 	CMD(evcntr_del, CMD_DESC_EVCNTR_DEL),
 	CMD(evcntr_wait, CMD_DESC_EVCNTR_WAIT),
+	CMD(evcntr_alert, CMD_DESC_EVCNTR_ALERT),
 	CMD(lnkerr_dllp, CMD_DESC_ERR_INJECT_DLLP),
 	CMD(lnkerr_dllp_crc, CMD_DESC_ERR_INJECT_DLLP_CRC),
 	CMD(lnkerr_tlp_lcrc, CMD_DESC_ERR_INJECT_TLP_LCRC),
 	CMD(lnkerr_tlp_seq, CMD_DESC_ERR_INJECT_SEQ),
 	CMD(lnkerr_nack, CMD_DESC_ERR_INJECT_ACK_NACK),
 	CMD(lnkerr_cto, CMD_DESC_ERR_INJECT_CTO),
+	CMD(lnkerr_campaign, CMD_DESC_LNKERR_CAMPAIGN),
 	{},
 };
 
@@ -2894,6 +5713,9 @@ int main(int argc, char **argv)
 
 	ret = commands_handle(argc, argv, &prog_info);
 
+	if (global_dev && getenv("SWITCHTEC_MRPC_STATS"))
+		print_mrpc_stats(stderr, global_dev);
+
 	switchtec_close(global_dev);
 
 	return ret;
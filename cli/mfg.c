@@ -1526,6 +1526,360 @@ static int debug_unlock_token(int argc, char **argv)
 	return 0;
 }
 
+#define CMD_DESC_PROVISION "provision many devices in parallel (BL1 and Main Firmware only)"
+
+static const char * const prov_step_names[] = {
+	[SWITCHTEC_PROV_STEP_OPEN] = "open",
+	[SWITCHTEC_PROV_STEP_CHECK] = "check",
+	[SWITCHTEC_PROV_STEP_CONFIG] = "config-set",
+	[SWITCHTEC_PROV_STEP_KMSK] = "kmsk-entry-add",
+	[SWITCHTEC_PROV_STEP_INDEX] = "image-select",
+	[SWITCHTEC_PROV_STEP_FW_EXEC] = "fw-execute",
+	[SWITCHTEC_PROV_STEP_DONE] = "done",
+};
+
+struct prov_log {
+	FILE *log;
+	int finished;
+	int count;
+};
+
+static void prov_error_str(const struct switchtec_prov_result *res,
+			   char *buf, size_t len)
+{
+	if (!res->ret)
+		snprintf(buf, len, "ok");
+	else if (res->msg)
+		snprintf(buf, len, "%s", res->msg);
+	else if (res->ret > 0)
+		snprintf(buf, len, "MRPC error 0x%x", res->ret);
+	else if (res->ret == -1)
+		snprintf(buf, len, "%s", strerror(res->err));
+	else
+		snprintf(buf, len, "%s", strerror(-res->ret));
+}
+
+/* Called by the library with its lock held, so no locking here */
+static void prov_cb(const struct switchtec_prov_result *res, void *data)
+{
+	struct prov_log *pl = data;
+	char err[128];
+
+	if (!res->finished)
+		return;
+
+	pl->finished++;
+	prov_error_str(res, err, sizeof(err));
+
+	printf("[%d/%d] %s: serial 0x%08x: %s%s%s\n", pl->finished, pl->count,
+	       res->device, res->chip_serial,
+	       res->ret ? "FAILED at " : "provisioned",
+	       res->ret ? prov_step_names[res->step] : "",
+	       res->ret ? "" : (res->kmsk_present ?
+				" (KMSK entry already present)" : ""));
+	if (res->ret)
+		printf("    %s\n", err);
+	fflush(stdout);
+
+	if (pl->log) {
+		fprintf(pl->log, "%ld,%s,0x%08x,%s,%s,%s,%.3f\n",
+			(long)time(NULL), res->device, res->chip_serial,
+			res->ret ? "FAIL" : "PASS", prov_step_names[res->step],
+			err, res->elapsed_us / 1e6);
+		fflush(pl->log);
+	}
+}
+
+static int prov_add_dev(char ***devs, int *count, int *alloc, const char *name)
+{
+	char **tmp;
+
+	if (*count == *alloc) {
+		*alloc = *alloc ? *alloc * 2 : 16;
+		tmp = realloc(*devs, *alloc * sizeof(**devs));
+		if (!tmp)
+			return -1;
+		*devs = tmp;
+	}
+
+	(*devs)[*count] = strdup(name);
+	if (!(*devs)[*count])
+		return -1;
+	(*count)++;
+
+	return 0;
+}
+
+static int prov_read_devs(char *list, FILE *f, char ***devs, int *count)
+{
+	char line[PATH_MAX];
+	int alloc = 0;
+	char *tok;
+
+	if (list)
+		for (tok = strtok(list, ","); tok; tok = strtok(NULL, ","))
+			if (prov_add_dev(devs, count, &alloc, tok))
+				return -1;
+
+	while (f && fgets(line, sizeof(line), f)) {
+		tok = strtok(line, " \t\r\n");
+		if (!tok || *tok == '#')
+			continue;
+		if (prov_add_dev(devs, count, &alloc, tok))
+			return -1;
+	}
+
+	return 0;
+}
+
+static int provision(int argc, char **argv)
+{
+	struct switchtec_security_cfg_set settings;
+	struct switchtec_prov_result *results = NULL;
+	struct switchtec_active_index index;
+	struct prov_log pl = {};
+	struct switchtec_prov *prov;
+	char **devs = NULL;
+	int count = 0;
+	int ret, i;
+
+	const char *desc = CMD_DESC_PROVISION "\n\n"
+			   "Runs the config-set, kmsk-entry-add, image-select "
+			   "and fw-execute steps, in that order, on every "
+			   "device listed, provisioning up to --jobs devices at "
+			   "a time. Only the steps whose files or options are "
+			   "given are run. The files are read and checked once "
+			   "before any device is touched.\n\n"
+			   "Each device is checked the way the individual "
+			   "commands check it, and a failure stops only that "
+			   "device. Devices that already hold the KMSK entry "
+			   "skip that step, so a failed run can be repeated.\n\n"
+			   "With --log, one line per device is appended: time, "
+			   "device, chip serial, PASS or FAIL, the last step, "
+			   "the error and the seconds taken.";
+
+	static struct {
+		char *devices;
+		FILE *devices_fimg;
+		char *devices_file;
+		FILE *setting_fimg;
+		char *setting_file;
+		FILE *uds_fimg;
+		char *uds_file;
+		FILE *kmsk_fimg;
+		char *kmsk_file;
+		FILE *pubk_fimg;
+		char *pubk_file;
+		FILE *sig_fimg;
+		char *sig_file;
+		unsigned char bl2;
+		unsigned char firmware;
+		unsigned char config;
+		unsigned char keyman;
+		unsigned char riot;
+		int fw_exec;
+		enum switchtec_bl2_recovery_mode bl2_rec_mode;
+		FILE *log_fimg;
+		char *log_file;
+		unsigned jobs;
+		int assume_yes;
+	} cfg = {
+		.bl2 = SWITCHTEC_ACTIVE_INDEX_NOT_SET,
+		.firmware = SWITCHTEC_ACTIVE_INDEX_NOT_SET,
+		.config = SWITCHTEC_ACTIVE_INDEX_NOT_SET,
+		.keyman = SWITCHTEC_ACTIVE_INDEX_NOT_SET,
+		.riot = SWITCHTEC_ACTIVE_INDEX_NOT_SET,
+		.bl2_rec_mode = SWITCHTEC_BL2_RECOVERY_I2C_AND_XMODEM,
+		.jobs = 8,
+	};
+	const struct argconfig_options opts[] = {
+		{"devices", 'd', "LIST", CFG_STRING, &cfg.devices,
+			required_argument,
+			"comma separated list of devices to provision"},
+		{"devices-file", 'D', .cfg_type=CFG_FILE_R,
+			.value_addr=&cfg.devices_fimg,
+			.argument_type=required_argument,
+			.help="file listing one device per line"},
+		{"setting_file", 'c', .cfg_type=CFG_FILE_R,
+			.value_addr=&cfg.setting_fimg,
+			.argument_type=required_argument,
+			.help="security setting file to program"},
+		{"uds_file", 'u', .cfg_type=CFG_FILE_R,
+			.value_addr=&cfg.uds_fimg,
+			.argument_type=required_argument,
+			.help="UDS file"},
+		{"kmsk_entry_file", 'k', .cfg_type=CFG_FILE_R,
+			.value_addr=&cfg.kmsk_fimg,
+			.argument_type=required_argument,
+			.help="KMSK entry file to add"},
+		{"pub_key_file", 'p', .cfg_type=CFG_FILE_R,
+			.value_addr=&cfg.pubk_fimg,
+			.argument_type=required_argument,
+			.help="public key file"},
+		{"signature_file", 's', .cfg_type=CFG_FILE_R,
+			.value_addr=&cfg.sig_fimg,
+			.argument_type=required_argument,
+			.help="signature file"},
+		{"bl2", 'b', "", CFG_BYTE, &cfg.bl2,
+			required_argument, "active image index for BL2"},
+		{"firmware", 'm', "", CFG_BYTE, &cfg.firmware,
+			required_argument, "active image index for FIRMWARE"},
+		{"config", 'C', "", CFG_BYTE, &cfg.config,
+			required_argument, "active image index for CONFIG"},
+		{"keyman", 'K', "", CFG_BYTE, &cfg.keyman, required_argument,
+			"active image index for KEY MANIFEST"},
+		{"riot", 'r', "", CFG_BYTE, &cfg.riot, required_argument,
+			"active image index for RIOT (Gen5 device only)"},
+		{"fw-execute", 'x', "", CFG_NONE, &cfg.fw_exec, no_argument,
+			"execute the transferred image as the last step"},
+		{"bl2_recovery_mode", 'M', "MODE",
+			CFG_CHOICES, &cfg.bl2_rec_mode,
+			required_argument, "BL2 recovery mode for --fw-execute",
+			.choices = recovery_mode_choices},
+		{"log", 'l', .cfg_type=CFG_FILE_A,
+			.value_addr=&cfg.log_fimg,
+			.argument_type=required_argument,
+			.help="append one result line per device to this file"},
+		{"jobs", 'j', "NUM", CFG_POSITIVE, &cfg.jobs, required_argument,
+			"number of devices to provision at once (default: 8)"},
+		{"yes", 'y', "", CFG_NONE, &cfg.assume_yes, no_argument,
+			"assume yes when prompted"},
+		{NULL}
+	};
+
+	argconfig_parse(argc, argv, desc, opts, &cfg, sizeof(cfg));
+
+	prov = switchtec_prov_new();
+	if (!prov) {
+		perror("mfg provision");
+		return -1;
+	}
+
+	if (cfg.setting_fimg) {
+		ret = switchtec_prov_set_sec_cfg(prov, cfg.setting_fimg,
+						 cfg.uds_fimg, &settings);
+		if (ret == -EBADF) {
+			fprintf(stderr, "Invalid secure setting or UDS file: %s!\n",
+				cfg.setting_file);
+			goto out;
+		} else if (ret == -EINVAL) {
+			fprintf(stderr, "Invalid SPI Clock Rate value specified in the security setting file!\n");
+			goto out;
+		} else if (ret == -ENOENT) {
+			fprintf(stderr, "ERROR: UDS file is required for the current configuration!\n");
+			goto out;
+		} else if (ret) {
+			switchtec_perror("mfg provision");
+			goto out;
+		}
+	}
+
+	if (cfg.kmsk_fimg) {
+		ret = switchtec_prov_set_kmsk(prov, cfg.kmsk_fimg,
+					      cfg.pubk_fimg, cfg.sig_fimg);
+		if (ret == -ENOTSUP) {
+			fprintf(stderr, "Public keys need OpenSSL support, which is not built in!\n");
+			goto out;
+		} else if (ret) {
+			fprintf(stderr, "Invalid KMSK, public key or signature file!\n");
+			goto out;
+		}
+	}
+
+	if (cfg.bl2 != SWITCHTEC_ACTIVE_INDEX_NOT_SET ||
+	    cfg.firmware != SWITCHTEC_ACTIVE_INDEX_NOT_SET ||
+	    cfg.config != SWITCHTEC_ACTIVE_INDEX_NOT_SET ||
+	    cfg.keyman != SWITCHTEC_ACTIVE_INDEX_NOT_SET ||
+	    cfg.riot != SWITCHTEC_ACTIVE_INDEX_NOT_SET) {
+		index.bl2 = cfg.bl2;
+		index.firmware = cfg.firmware;
+		index.config = cfg.config;
+		index.keyman = cfg.keyman;
+		index.riot = cfg.riot;
+
+		ret = switchtec_prov_set_active_index(prov, &index);
+		if (ret) {
+			fprintf(stderr, "Active image indices must be within 0-1!\n");
+			goto out;
+		}
+	}
+
+	if (cfg.fw_exec)
+		switchtec_prov_set_fw_exec(prov, cfg.bl2_rec_mode);
+
+	if (!cfg.setting_fimg && !cfg.kmsk_fimg && !cfg.fw_exec &&
+	    cfg.bl2 == SWITCHTEC_ACTIVE_INDEX_NOT_SET &&
+	    cfg.firmware == SWITCHTEC_ACTIVE_INDEX_NOT_SET &&
+	    cfg.config == SWITCHTEC_ACTIVE_INDEX_NOT_SET &&
+	    cfg.keyman == SWITCHTEC_ACTIVE_INDEX_NOT_SET &&
+	    cfg.riot == SWITCHTEC_ACTIVE_INDEX_NOT_SET) {
+		fprintf(stderr, "Nothing to provision!\n");
+		ret = -1;
+		goto out;
+	}
+
+	ret = prov_read_devs(cfg.devices, cfg.devices_fimg, &devs, &count);
+	if (ret) {
+		perror("mfg provision");
+		goto out;
+	}
+
+	if (!count) {
+		fprintf(stderr, "No devices to provision, use --devices or --devices-file\n");
+		ret = -1;
+		goto out;
+	}
+
+	printf("Provisioning %d device%s with %d job%s:\n", count,
+	       count == 1 ? "" : "s", cfg.jobs, cfg.jobs == 1 ? "" : "s");
+	if (cfg.setting_fimg) {
+		printf("\nSecurity settings:\n");
+		print_security_cfg_set(&settings);
+	}
+	if (cfg.kmsk_fimg)
+		printf("KMSK entry: %s\n", cfg.kmsk_file);
+	if (cfg.fw_exec)
+		printf("Execute the transferred image when done\n");
+
+	if (!cfg.assume_yes && (cfg.setting_fimg || cfg.kmsk_fimg))
+		fprintf(stderr,
+			"\nWARNING: This operation makes changes to the device OTP memory and is IRREVERSIBLE!\n");
+	ret = ask_if_sure(cfg.assume_yes);
+	if (ret)
+		goto out;
+
+	results = calloc(count, sizeof(*results));
+	if (!results) {
+		perror("mfg provision");
+		ret = -1;
+		goto out;
+	}
+
+	pl.log = cfg.log_fimg;
+	pl.count = count;
+
+	ret = switchtec_prov_run(prov, (const char * const *)devs, count,
+				 cfg.jobs, results, prov_cb, &pl);
+	if (ret < 0) {
+		perror("mfg provision");
+		goto out;
+	}
+
+	printf("\n%d of %d devices provisioned, %d failed\n",
+	       count - ret, count, ret);
+	ret = ret ? 1 : 0;
+
+out:
+	if (cfg.log_fimg)
+		fclose(cfg.log_fimg);
+	for (i = 0; i < count; i++)
+		free(devs[i]);
+	free(devs);
+	free(results);
+	switchtec_prov_free(prov);
+	return ret;
+}
+
 static const struct cmd commands[] = {
 	CMD(ping, CMD_DESC_PING),
 	CMD(info, CMD_DESC_INFO),
@@ -1538,6 +1892,7 @@ static const struct cmd commands[] = {
 	CMD(state_set, CMD_DESC_STATE_SET),
 	CMD(config_set, CMD_DESC_CONFIG_SET),
 	CMD(kmsk_entry_add, CMD_DESC_KMSK_ENTRY_ADD),
+	CMD(provision, CMD_DESC_PROVISION),
 	CMD(debug_unlock_token, CMD_DESC_DEBUG_TOKEN),
 	CMD(debug_unlock, CMD_DESC_DEBUG_UNLOCK),
 	CMD(debug_lock_update, CMD_DESC_DEBUG_LOCK_UPDATE),
@@ -0,0 +1,785 @@
+/*
+ * Microsemi Switchtec(tm) PCIe Management Library
+ * Copyright (c) 2017, Microsemi Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * switchtecd: own Switchtec devices on behalf of many local clients.
+ *
+ * Clients connect to a unix socket and name the device they want (see
+ * lib/platform/switchtecd.h for the protocol). Each device is opened
+ * once, with its GAS cache enabled, and stays open so its probed state,
+ * cached registers and PFF index are shared by every later client.
+ *
+ * Requests are served in rounds. In each round every client of a
+ * device gets up to a quantum of its queued requests run, taking turns
+ * in round-robin order, so a client streaming a large transfer cannot
+ * starve the others. Consecutive MRPC commands in a round are issued as
+ * one switchtec_cmd_batch(), which pipelines them on transports that
+ * support it.
+ */
+
+#include "lib/switchtec_priv.h"
+#include "lib/platform/switchtecd.h"
+#include <switchtec/switchtec.h>
+#include <switchtec/gas.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SD_MAX_CLIENTS 64
+#define SD_MAX_QUANTUM 32
+#define SD_DEFAULT_QUANTUM 8
+
+/* Enough for a whole window of the client transport and then some */
+#define SD_CLIENT_BUF (SD_MAX_QUANTUM * (sizeof(struct switchtecd_req) + \
+					 SWITCHTECD_MAX_DATA))
+
+/*
+ * A client's requests are not run while more than SD_CLIENT_BUF of its
+ * responses are still queued, so only a client that stops reading
+ * altogether can reach the limit, and it is dropped when it does.
+ */
+#define SD_CLIENT_OUT_MAX (4 * SD_CLIENT_BUF)
+
+struct sd_device {
+	char name[PATH_MAX];
+	struct switchtec_dev *dev;
+	void __gas *gas;
+	size_t gas_size;
+	unsigned int rr;
+	struct sd_device *next;
+};
+
+struct sd_client {
+	int fd;
+	bool dead;
+	struct sd_device *sdev;
+	uint8_t buf[SD_CLIENT_BUF];
+	size_t len;
+	size_t taken;
+
+	/* Responses the socket has not taken yet */
+	uint8_t *out;
+	size_t out_len;
+	size_t out_cap;
+};
+
+struct sd_job {
+	struct sd_client *client;
+	const struct switchtecd_req *req;
+	const void *data;
+	struct switchtecd_resp resp;
+	uint8_t out[SWITCHTECD_MAX_DATA];
+};
+
+static struct sd_client *clients[SD_MAX_CLIENTS];
+static int nr_clients;
+static struct sd_device *devices;
+static struct sd_job jobs[SD_MAX_CLIENTS * SD_MAX_QUANTUM];
+static struct switchtec_cmd_desc descs[SD_MAX_CLIENTS * SD_MAX_QUANTUM];
+static int quantum = SD_DEFAULT_QUANTUM;
+static int verbose;
+static volatile sig_atomic_t stop;
+
+static void sd_sig(int sig)
+{
+	stop = 1;
+}
+
+static void sd_log(const char *fmt, ...)
+	__attribute__((format(printf, 1, 2)));
+
+static void sd_log(const char *fmt, ...)
+{
+	va_list args;
+
+	if (!verbose)
+		return;
+
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+}
+
+/*
+ * Return the complete request at offset off of the client's buffer, or
+ * NULL if it has not all arrived. A malformed request kills the client.
+ */
+static const struct switchtecd_req *sd_peek(struct sd_client *c, size_t off)
+{
+	struct switchtecd_req *req = (void *)(c->buf + off);
+
+	if (c->len - off < sizeof(*req))
+		return NULL;
+
+	if (req->len > SWITCHTECD_MAX_DATA ||
+	    req->resp_len > SWITCHTECD_MAX_DATA) {
+		c->dead = true;
+		return NULL;
+	}
+
+	if (c->len - off < sizeof(*req) + req->len)
+		return NULL;
+
+	return req;
+}
+
+static bool sd_would_block(void)
+{
+	return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+}
+
+static int sd_queue(struct sd_client *c, const void *buf, size_t len)
+{
+	size_t cap;
+	void *out;
+
+	if (c->out_len + len > SD_CLIENT_OUT_MAX) {
+		sd_log("dropping a client that stopped reading\n");
+		c->dead = true;
+		return -1;
+	}
+
+	if (c->out_len + len > c->out_cap) {
+		cap = c->out_cap ? c->out_cap : SD_CLIENT_BUF;
+		while (cap < c->out_len + len)
+			cap *= 2;
+
+		out = realloc(c->out, cap);
+		if (!out) {
+			c->dead = true;
+			return -1;
+		}
+		c->out = out;
+		c->out_cap = cap;
+	}
+
+	memcpy(c->out + c->out_len, buf, len);
+	c->out_len += len;
+	return 0;
+}
+
+/* Write out as much of the client's queued responses as it will take */
+static void sd_flush(struct sd_client *c)
+{
+	ssize_t ret;
+
+	while (c->out_len && !c->dead) {
+		ret = send(c->fd, c->out, c->out_len,
+			   MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret < 0) {
+			if (!sd_would_block())
+				c->dead = true;
+			return;
+		}
+
+		memmove(c->out, c->out + ret, c->out_len - ret);
+		c->out_len -= ret;
+	}
+}
+
+/*
+ * Send a response without blocking; whatever the socket doesn't take
+ * now is queued and written out once the client reads again.
+ */
+static int sd_send(struct sd_client *c, const struct switchtecd_resp *resp,
+		   const void *data)
+{
+	struct iovec iov[2] = {
+		{ .iov_base = (void *)resp, .iov_len = sizeof(*resp) },
+		{ .iov_base = (void *)data, .iov_len = resp->len },
+	};
+	struct msghdr msg = {
+		.msg_iov = iov,
+		.msg_iovlen = resp->len ? 2 : 1,
+	};
+	size_t sent = 0, n;
+	ssize_t ret;
+	int i;
+
+	if (c->dead)
+		return -1;
+
+	if (!c->out_len) {
+		ret = sendmsg(c->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (ret < 0 && !sd_would_block()) {
+			c->dead = true;
+			return -1;
+		}
+		if (ret > 0)
+			sent = ret;
+	}
+
+	for (i = 0; i < msg.msg_iovlen; i++) {
+		n = iov[i].iov_len;
+		if (sent >= n) {
+			sent -= n;
+			continue;
+		}
+
+		if (sd_queue(c, (uint8_t *)iov[i].iov_base + sent, n - sent))
+			return -1;
+		sent = 0;
+	}
+
+	return 0;
+}
+
+/* Whether the client's queued requests may be run this round */
+static bool sd_ready(const struct sd_client *c)
+{
+	return c->sdev && !c->dead && c->out_len <= SD_CLIENT_BUF;
+}
+
+static void sd_consume(struct sd_client *c, size_t n)
+{
+	memmove(c->buf, c->buf + n, c->len - n);
+	c->len -= n;
+}
+
+static struct sd_device *sd_device_get(const char *name)
+{
+	struct sd_device *d;
+	gasptr_t map;
+
+	for (d = devices; d; d = d->next)
+		if (!strcmp(d->name, name))
+			return d;
+
+	d = calloc(1, sizeof(*d));
+	if (!d)
+		return NULL;
+
+	d->dev = switchtec_open(name);
+	if (!d->dev) {
+		free(d);
+		return NULL;
+	}
+
+	/*
+	 * Clients are handed the identity below as already probed, so it
+	 * must be read even if SWITCHTEC_LAZY_PROBE deferred it.
+	 */
+	if (switchtec_probe(d->dev)) {
+		switchtec_close(d->dev);
+		free(d);
+		return NULL;
+	}
+
+	switchtec_gas_cache_enable(d->dev, 1);
+	map = switchtec_gas_map(d->dev, 1, &d->gas_size);
+	if (map == SWITCHTEC_MAP_FAILED)
+		d->gas_size = 0;
+	else
+		d->gas = (void __gas *)map;
+
+	snprintf(d->name, sizeof(d->name), "%s", name);
+	d->next = devices;
+	devices = d;
+
+	sd_log("opened %s (%s %s)\n", name, switchtec_gen_str(d->dev),
+	       switchtec_variant_str(d->dev));
+
+	return d;
+}
+
+static void sd_open(struct sd_client *c, const struct switchtecd_req *req)
+{
+	const char *name = (const char *)(req + 1);
+	struct switchtecd_resp resp = {};
+	struct switchtecd_dev_info info = {};
+	struct sd_device *d;
+
+	if (req->type != SWITCHTECD_REQ_OPEN ||
+	    req->arg != SWITCHTECD_PROTO_VERSION ||
+	    !req->len || name[req->len - 1] ||
+	    !strncmp(name, SWITCHTECD_DEVICE_PREFIX,
+		     strlen(SWITCHTECD_DEVICE_PREFIX))) {
+		resp.ret = -EINVAL;
+		resp.err = EINVAL;
+		goto out;
+	}
+
+	d = sd_device_get(name);
+	if (!d) {
+		resp.err = errno ? errno : ENODEV;
+		resp.ret = -resp.err;
+		goto out;
+	}
+
+	info.device_id = d->dev->device_id;
+	info.gen = d->dev->gen;
+	info.var = d->dev->var;
+	info.boot_phase = d->dev->boot_phase;
+	info.local_pax_id = d->dev->local_pax_id;
+	info.gas_map_size = d->gas_size;
+
+	resp.len = sizeof(info);
+	c->sdev = d;
+
+out:
+	sd_send(c, &resp, &info);
+	sd_consume(c, sizeof(*req) + req->len);
+	if (!c->sdev)
+		c->dead = true;
+}
+
+/* Point the device at the PAX a client addressed its request to */
+static int sd_set_pax(struct switchtec_dev *dev, int pax)
+{
+	if (!switchtec_is_pax_all(dev))
+		return 0;
+
+	if (pax == SWITCHTEC_PAX_ID_LOCAL)
+		pax = dev->local_pax_id;
+
+	if (dev->pax_id == pax)
+		return 0;
+
+	return switchtec_set_pax_id(dev, pax);
+}
+
+static int sd_cmd_pax(uint32_t cmd)
+{
+	return (cmd >> SWITCHTEC_PAX_ID_SHIFT) & SWITCHTEC_PAX_ID_MASK;
+}
+
+static void sd_job_error(struct sd_job *j, int ret)
+{
+	j->resp.ret = ret;
+	j->resp.err = ret < 0 ? errno : 0;
+	j->resp.len = 0;
+}
+
+static void sd_run_cmds(struct sd_device *d, struct sd_job *j, int n)
+{
+	int i, ret;
+
+	if (sd_set_pax(d->dev, sd_cmd_pax(j[0].req->arg))) {
+		for (i = 0; i < n; i++)
+			sd_job_error(&j[i], -errno);
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		descs[i].cmd = j[i].req->arg;
+		descs[i].payload = j[i].data;
+		descs[i].payload_len = j[i].req->len;
+		descs[i].resp = j[i].out;
+		descs[i].resp_len = j[i].req->resp_len;
+	}
+
+	switchtec_cmd_batch(d->dev, descs, n);
+
+	for (i = 0; i < n; i++) {
+		ret = descs[i].ret;
+
+		/* Another client's failure must not cost this one its command */
+		if (ret == -ECANCELED)
+			ret = switchtec_cmd(d->dev, descs[i].cmd,
+					    descs[i].payload,
+					    descs[i].payload_len,
+					    j[i].out, descs[i].resp_len);
+
+		if (ret) {
+			sd_job_error(&j[i], ret);
+			if (ret < 0)
+				j[i].resp.err = -ret;
+		} else {
+			j[i].resp.len = j[i].req->resp_len;
+		}
+	}
+}
+
+static void sd_run_one(struct sd_device *d, struct sd_job *j)
+{
+	const struct switchtecd_req *req = j->req;
+	int32_t *out = (void *)j->out;
+	int part, port, pff;
+	int ret = 0;
+
+	if (sd_set_pax(d->dev, SWITCHTEC_PAX_ID_LOCAL)) {
+		sd_job_error(j, -errno);
+		return;
+	}
+
+	switch (req->type) {
+	case SWITCHTECD_REQ_GAS_READ:
+	case SWITCHTECD_REQ_GAS_WRITE:
+		if ((size_t)req->arg + req->len + req->resp_len >
+		    d->gas_size) {
+			errno = EINVAL;
+			ret = -EINVAL;
+			break;
+		}
+
+		if (req->type == SWITCHTECD_REQ_GAS_WRITE) {
+			memcpy_to_gas(d->dev, d->gas + req->arg, j->data,
+				      req->len);
+			break;
+		}
+
+		ret = memcpy_from_gas(d->dev, j->out, d->gas + req->arg,
+				      req->resp_len);
+		if (ret)
+			ret = -errno;
+		else
+			j->resp.len = req->resp_len;
+		break;
+	case SWITCHTECD_REQ_PFF_TO_PORT:
+		ret = switchtec_pff_to_port(d->dev, req->arg, &part, &port);
+		if (!ret) {
+			out[0] = part;
+			out[1] = port;
+			j->resp.len = 2 * sizeof(*out);
+		}
+		break;
+	case SWITCHTECD_REQ_PORT_TO_PFF:
+		ret = switchtec_port_to_pff(d->dev, req->arg >> 16,
+					    req->arg & 0xffff, &pff);
+		if (!ret) {
+			out[0] = pff;
+			j->resp.len = sizeof(*out);
+		}
+		break;
+	default:
+		errno = EINVAL;
+		ret = -EINVAL;
+		break;
+	}
+
+	if (ret)
+		sd_job_error(j, ret < 0 ? ret : -errno);
+
+	if (j->resp.len != req->resp_len && !ret)
+		sd_job_error(j, -EIO);
+}
+
+static bool sd_same_pax(const struct sd_job *a, const struct sd_job *b)
+{
+	return sd_cmd_pax(a->req->arg) == sd_cmd_pax(b->req->arg);
+}
+
+/*
+ * Run one round for a device: up to a quantum of requests from each of
+ * its clients, starting with a different client each round.
+ */
+static bool sd_service(struct sd_device *d)
+{
+	struct sd_client *c;
+	const struct switchtecd_req *req;
+	int i, k, n = 0, start, taken;
+	size_t off;
+
+	start = d->rr++ % (nr_clients ? nr_clients : 1);
+
+	for (k = 0; k < nr_clients; k++) {
+		c = clients[(start + k) % nr_clients];
+		if (c->sdev != d || !sd_ready(c))
+			continue;
+
+		for (off = 0, taken = 0; taken < quantum; taken++) {
+			req = sd_peek(c, off);
+			if (!req)
+				break;
+
+			jobs[n].client = c;
+			jobs[n].req = req;
+			jobs[n].data = req + 1;
+			memset(&jobs[n].resp, 0, sizeof(jobs[n].resp));
+			n++;
+
+			off += sizeof(*req) + req->len;
+		}
+
+		c->taken = off;
+	}
+
+	for (i = 0; i < n; i += k) {
+		if (jobs[i].req->type != SWITCHTECD_REQ_CMD) {
+			sd_run_one(d, &jobs[i]);
+			k = 1;
+			continue;
+		}
+
+		for (k = 1; i + k < n; k++)
+			if (jobs[i + k].req->type != SWITCHTECD_REQ_CMD ||
+			    !sd_same_pax(&jobs[i], &jobs[i + k]))
+				break;
+
+		sd_run_cmds(d, &jobs[i], k);
+	}
+
+	for (i = 0; i < n; i++)
+		sd_send(jobs[i].client, &jobs[i].resp, jobs[i].out);
+
+	for (k = 0; k < nr_clients; k++) {
+		c = clients[k];
+		if (c->sdev == d && c->taken) {
+			sd_consume(c, c->taken);
+			c->taken = 0;
+		}
+	}
+
+	return n > 0;
+}
+
+static void sd_accept(int lfd)
+{
+	struct sd_client *c;
+	int fd;
+
+	fd = accept(lfd, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	if (fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK) ||
+	    fcntl(fd, F_SETFD, FD_CLOEXEC)) {
+		close(fd);
+		return;
+	}
+
+	if (nr_clients == SD_MAX_CLIENTS) {
+		close(fd);
+		return;
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (!c) {
+		close(fd);
+		return;
+	}
+
+	c->fd = fd;
+	clients[nr_clients++] = c;
+}
+
+static void sd_read(struct sd_client *c)
+{
+	const struct switchtecd_req *req;
+	ssize_t ret;
+
+	ret = recv(c->fd, c->buf + c->len, sizeof(c->buf) - c->len,
+		   MSG_DONTWAIT);
+	if (ret <= 0) {
+		if (!ret || (errno != EAGAIN && errno != EINTR))
+			c->dead = true;
+		return;
+	}
+
+	c->len += ret;
+
+	if (!c->sdev) {
+		req = sd_peek(c, 0);
+		if (req)
+			sd_open(c, req);
+	}
+}
+
+static void sd_reap(void)
+{
+	int i, j;
+
+	for (i = 0, j = 0; i < nr_clients; i++) {
+		if (!clients[i]->dead) {
+			clients[j++] = clients[i];
+			continue;
+		}
+
+		close(clients[i]->fd);
+		free(clients[i]->out);
+		free(clients[i]);
+	}
+
+	nr_clients = j;
+}
+
+static bool sd_pending(void)
+{
+	int i;
+
+	for (i = 0; i < nr_clients; i++)
+		if (sd_ready(clients[i]) && sd_peek(clients[i], 0))
+			return true;
+
+	return false;
+}
+
+static int sd_listen(const char *path, mode_t mode)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	unlink(path);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+	    chmod(path, mode) || listen(fd, SD_MAX_CLIENTS)) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d] [-v] [-s SOCKET] [-m MODE] [-q QUANTUM]\n"
+		"\n"
+		"Serve Switchtec devices to local clients, which open them\n"
+		"as 'switchtecd:<device>'. Devices stay open until exit.\n"
+		"\n"
+		"  -d          run in the background\n"
+		"  -v          log devices as they are opened\n"
+		"  -s SOCKET   socket path (default %s)\n"
+		"  -m MODE     socket permissions, in octal (default 0660)\n"
+		"  -q QUANTUM  requests each client may run per round\n"
+		"              (1-%d, default %d)\n",
+		prog, SWITCHTECD_SOCKET_PATH, SD_MAX_QUANTUM,
+		SD_DEFAULT_QUANTUM);
+}
+
+int main(int argc, char **argv)
+{
+	struct pollfd fds[SD_MAX_CLIENTS + 1];
+	const char *path = SWITCHTECD_SOCKET_PATH;
+	bool background = false;
+	mode_t mode = 0660;
+	struct sd_device *d;
+	bool busy;
+	int lfd, i, opt;
+
+	while ((opt = getopt(argc, argv, "dvs:m:q:h")) != -1) {
+		switch (opt) {
+		case 'd':
+			background = true;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 's':
+			path = optarg;
+			break;
+		case 'm':
+			mode = strtoul(optarg, NULL, 8);
+			break;
+		case 'q':
+			quantum = atoi(optarg);
+			if (quantum < 1 || quantum > SD_MAX_QUANTUM) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return opt != 'h';
+		}
+	}
+
+	lfd = sd_listen(path, mode);
+	if (lfd < 0) {
+		perror(path);
+		return 1;
+	}
+
+	if (background && daemon(0, 0)) {
+		perror("daemon");
+		return 1;
+	}
+
+	signal(SIGINT, sd_sig);
+	signal(SIGTERM, sd_sig);
+	signal(SIGPIPE, SIG_IGN);
+
+	busy = false;
+	while (!stop) {
+		fds[0].fd = lfd;
+		fds[0].events = POLLIN;
+		for (i = 0; i < nr_clients; i++) {
+			fds[i + 1].fd = clients[i]->fd;
+			fds[i + 1].events =
+				clients[i]->len < sizeof(clients[i]->buf) ?
+				POLLIN : 0;
+			if (clients[i]->out_len)
+				fds[i + 1].events |= POLLOUT;
+		}
+
+		if (poll(fds, nr_clients + 1, busy ? 0 : -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+
+		for (i = 0; i < nr_clients; i++) {
+			if (fds[i + 1].revents & POLLOUT)
+				sd_flush(clients[i]);
+			if (fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))
+				sd_read(clients[i]);
+		}
+
+		if (fds[0].revents & POLLIN)
+			sd_accept(lfd);
+
+		for (d = devices; d; d = d->next)
+			sd_service(d);
+
+		sd_reap();
+		busy = sd_pending();
+	}
+
+	close(lfd);
+	unlink(path);
+
+	while (devices) {
+		d = devices;
+		devices = d->next;
+		switchtec_close(d->dev);
+		free(d);
+	}
+
+	return 0;
+}
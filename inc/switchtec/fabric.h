@@ -119,6 +119,22 @@ int switchtec_gfms_bind(struct switchtec_dev *dev,
 int switchtec_gfms_unbind(struct switchtec_dev *dev,
 			  struct switchtec_gfms_unbind_req *req);
 
+/**
+ * @brief Desired functions of one host logical port
+ */
+struct switchtec_gfms_bind_map_entry {
+	uint8_t host_phys_port_id;
+	uint8_t host_log_port_id;
+	int ep_number;			//!< 0 to leave the port unbound
+	uint16_t ep_pdfid[SWITCHTEC_FABRIC_MULTI_FUNC_NUM];
+	enum switchtec_bind_op op;	//!< Set by switchtec_gfms_bind_apply()
+	int ret;			//!< Set by switchtec_gfms_bind_apply()
+};
+
+int switchtec_gfms_bind_apply(struct switchtec_dev *dev,
+			      struct switchtec_gfms_bind_map_entry *map,
+			      int nr, unsigned int timeout_ms);
+
 /********** PORT CONTROL *********/
 
 enum switchtec_fabric_port_control_type {
@@ -513,6 +529,50 @@ int switchtec_fab_gfms_db_dump_hvd_detail(
 		uint8_t hvd_idx,
 		struct switchtec_gfms_db_hvd_detail *hvd_detail);
 
+/********** FABRIC CRAWL *********/
+
+#define SWITCHTEC_FAB_MAX_PAX 16
+
+/**
+ * @brief Flags for switchtec_fab_topo_crawl()
+ */
+enum switchtec_fab_crawl_flags {
+	SWITCHTEC_FAB_CRAWL_GFMS = 1 << 0,	//!< Also dump the GFMS PAX
+						//!< general section
+};
+
+/**
+ * @brief One switch in a crawled fabric.
+ */
+struct switchtec_fab_topo_node {
+	int ret;				//!< Result of the dump
+	int err;				//!< errno if the dump failed
+	struct switchtec_fab_topo_info topo;	//!< Topology info
+	struct switchtec_gfms_db_pax_general pax_general; //!< GFMS PAX
+							  //!< general section
+};
+
+/**
+ * @brief Topology of every reachable switch in a fabric.
+ *
+ * Nodes are indexed by PAX ID. The route_port[] table of each node's
+ * topology gives the physical port used to reach every other PAX ID,
+ * so together they form the fabric graph.
+ */
+struct switchtec_fab_topo_graph {
+	int local_pax_id;			//!< PAX ID of the local switch
+	int num_nodes;				//!< Number of PAX IDs found
+	uint32_t present;			//!< Bitmap of PAX IDs found
+	uint32_t dumped;			//!< Bitmap of PAX IDs dumped
+	struct switchtec_fab_topo_node nodes[SWITCHTEC_FAB_MAX_PAX];
+};
+
+int switchtec_fab_topo_crawl(struct switchtec_dev *dev,
+			     struct switchtec_fab_topo_graph *graph,
+			     int flags);
+int switchtec_fab_topo_route(const struct switchtec_fab_topo_graph *graph,
+			     int from_pax, int to_pax);
+
 /********** GFMS Event *********/
 
 /**
@@ -621,6 +681,63 @@ int switchtec_get_gfms_events(struct switchtec_dev *dev,
 
 int switchtec_clear_gfms_events(struct switchtec_dev *dev);
 
+/********** GFMS DB SNAPSHOT *********/
+
+struct switchtec_gfms_db_snapshot;
+
+/**
+ * @brief The GFMS database sections tracked by a snapshot
+ */
+enum switchtec_gfms_db_section {
+	SWITCHTEC_GFMS_DB_SECTION_PAX_GENERAL,
+	SWITCHTEC_GFMS_DB_SECTION_HVD,
+	SWITCHTEC_GFMS_DB_SECTION_EP_PORT,
+};
+
+/**
+ * @brief How a snapshot section changed
+ */
+enum switchtec_gfms_db_change_type {
+	SWITCHTEC_GFMS_DB_ADDED,
+	SWITCHTEC_GFMS_DB_REMOVED,
+	SWITCHTEC_GFMS_DB_CHANGED,
+};
+
+/**
+ * @brief One entry of a snapshot diff
+ */
+struct switchtec_gfms_db_change {
+	enum switchtec_gfms_db_section section;
+	enum switchtec_gfms_db_change_type type;
+	int id;		//!< HVD instance ID or EP physical port ID
+};
+
+struct switchtec_gfms_db_snapshot *
+switchtec_fab_gfms_db_snapshot(struct switchtec_dev *dev);
+void switchtec_fab_gfms_db_snapshot_free(
+		struct switchtec_gfms_db_snapshot *snap);
+void switchtec_fab_gfms_db_snapshot_mark(
+		struct switchtec_gfms_db_snapshot *snap,
+		const struct switchtec_gfms_event *elist, int count,
+		int overflow);
+int switchtec_fab_gfms_db_snapshot_refresh(
+		struct switchtec_dev *dev,
+		struct switchtec_gfms_db_snapshot *snap,
+		struct switchtec_gfms_db_change *changes, int max_changes);
+int switchtec_fab_gfms_db_snapshot_update(
+		struct switchtec_dev *dev,
+		struct switchtec_gfms_db_snapshot *snap,
+		struct switchtec_gfms_db_change *changes, int max_changes);
+const struct switchtec_gfms_db_pax_general *
+switchtec_fab_gfms_db_snapshot_pax_general(
+		const struct switchtec_gfms_db_snapshot *snap);
+const struct switchtec_gfms_db_hvd_detail *
+switchtec_fab_gfms_db_snapshot_hvd(
+		const struct switchtec_gfms_db_snapshot *snap, int hvd_inst_id);
+const struct switchtec_gfms_db_ep_port_section *
+switchtec_fab_gfms_db_snapshot_ep_port(
+		const struct switchtec_gfms_db_snapshot *snap, int phy_pid);
+
 /********** DEVICE MANAGE *********/
 #define SWITCHTEC_DEVICE_MANAGE_MAX_RESP 1016
 
@@ -702,12 +819,38 @@ int switchtec_ep_bar_write32(struct switchtec_dev *dev, uint16_t pdfid,
 int switchtec_ep_bar_write64(struct switchtec_dev *dev, uint16_t pdfid,
 			     uint8_t bar_index, uint64_t val, uint64_t addr);
 
+int switchtec_ep_csr_read_range(struct switchtec_dev *dev, uint16_t pdfid,
+				uint16_t addr, void *buf, size_t len);
+int switchtec_ep_csr_write_range(struct switchtec_dev *dev, uint16_t pdfid,
+				 uint16_t addr, const void *buf, size_t len);
+int switchtec_ep_bar_read_range(struct switchtec_dev *dev, uint16_t pdfid,
+				uint8_t bar_index, uint64_t addr, void *buf,
+				size_t len);
+int switchtec_ep_bar_write_range(struct switchtec_dev *dev, uint16_t pdfid,
+				 uint8_t bar_index, uint64_t addr,
+				 const void *buf, size_t len);
+
 /********** ADMIN PASSTHRU COMMAND *********/
 #define SWITCHTEC_NVME_ADMIN_PASSTHRU_MAX_DATA_LEN (4096 + 16 * 4)
 
+/**
+ * @brief One command for switchtec_nvme_admin_passthru_multi()
+ */
+struct switchtec_nvme_passthru_req {
+	uint16_t pdfid;		//!< PDFID of the endpoint
+	size_t data_len;	//!< Length of the command data
+	const void *data;	//!< Command data
+	size_t rsp_len;		//!< Expected, then actual, reply length
+	void *rsp;		//!< Reply buffer of at least rsp_len bytes
+	int ret;		//!< Result of this command
+};
+
 int switchtec_nvme_admin_passthru(struct switchtec_dev *dev, uint16_t pdfid,
 				  size_t data_len, void *data,
 				  size_t *rsp_len, void *rsp);
+int switchtec_nvme_admin_passthru_multi(struct switchtec_dev *dev,
+					struct switchtec_nvme_passthru_req *reqs,
+					int n);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,172 @@
+/*
+ * Microsemi Switchtec(tm) PCIe Management Library
+ * Copyright (c) 2025, Microsemi Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef LIBSWITCHTEC_FLIGHTREC_H
+#define LIBSWITCHTEC_FLIGHTREC_H
+
+/**
+ * @file
+ * @brief Always-on flight recorder
+ *
+ * A flight recorder keeps the last few seconds of compact device state
+ * (port status, event counter deltas, die temperature and the event
+ * summary) in an in-memory ring. When one of its trigger events fires,
+ * the ring is written to a dump file together with the LTSSM log of
+ * every port the events point at and the firmware RAM log, so the state
+ * leading up to a link failure is captured without a trace having been
+ * started in advance.
+ *
+ * A dump is a header followed by the sections it gives the offsets of.
+ * Values are stored in host byte order.
+ */
+
+#include <switchtec/switchtec.h>
+
+#include <stdint.h>
+
+#define SWITCHTEC_FLR_MAGIC		"SWTCFLR"
+#define SWITCHTEC_FLR_VERSION		1
+#define SWITCHTEC_FLR_MAX_TRIGGERS	64
+#define SWITCHTEC_FLR_MAX_LTSSM		1024
+#define SWITCHTEC_FLR_PFF_WORDS		((SWITCHTEC_MAX_PFF_CSR + 63) / 64)
+
+#pragma pack(push, 1)
+
+/**
+ * @brief A port covered by each sample
+ */
+struct switchtec_flr_port {
+	uint8_t phys_id;
+	uint8_t partition;
+	uint8_t log_id;
+	uint8_t stack;
+	uint8_t stk_id;
+	uint8_t upstream;
+	uint8_t cfg_link_width;
+	uint8_t rsvd;
+};
+
+/**
+ * @brief An event counter covered by each sample
+ */
+struct switchtec_flr_cntr {
+	uint8_t stack_id;
+	uint8_t cntr_id;
+	uint16_t rsvd;
+	uint32_t port_mask;
+	uint32_t type_mask;
+};
+
+/**
+ * @brief Fixed part of a sample
+ *
+ * Followed by one struct switchtec_flr_port_sample per port and then
+ * one uint32_t counter delta per event counter.
+ */
+struct switchtec_flr_sample {
+	uint64_t time_us;	//!< Wall clock time of the sample
+	float die_temp;		//!< Degrees Celsius, -100 if it could not be read
+	uint32_t local_part;	//!< Event summary of the local partition
+	uint64_t global;	//!< Global event summary
+	uint64_t part_bitmap;	//!< Partitions with active events
+
+	/** @brief Port functions with active events, one bit per PFF */
+	uint64_t pff_bitmap[SWITCHTEC_FLR_PFF_WORDS];
+};
+
+/**
+ * @brief Link status of one port in a sample
+ */
+struct switchtec_flr_port_sample {
+	uint16_t ltssm;
+	uint8_t link_up;
+	uint8_t link_width;	//!< Negotiated link width
+	uint8_t link_rate;
+	uint8_t rsvd[3];
+};
+
+/**
+ * @brief An event that triggered the dump
+ */
+struct switchtec_flr_trigger {
+	uint32_t event;		//!< enum switchtec_event_id
+	int32_t index;		//!< Partition or PFF, depending on the event
+	int32_t partition;	//!< Partition of the event, -1 for global ones
+	int32_t port;		//!< Logical port of a PFF event, otherwise -1
+	int32_t phys_id;	//!< Physical port of a PFF event, otherwise -1
+	uint32_t ltssm_count;	//!< Entries in the port's LTSSM log
+	uint64_t ltssm_off;	//!< File offset of the port's LTSSM log
+};
+
+/**
+ * @brief LTSSM log entry, as returned by switchtec_diag_ltssm_log()
+ */
+struct switchtec_flr_ltssm {
+	uint32_t timestamp;
+	uint32_t timestamp_high;
+	float link_rate;
+	int32_t link_state;
+};
+
+/**
+ * @brief Dump file header
+ */
+struct switchtec_flr_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t device_id;
+	char dev_name[64];
+	uint64_t trigger_us;	//!< Wall clock time the triggers were seen
+	uint32_t period_us;	//!< Intended sampling period
+	uint32_t sample_size;	//!< Size of each sample with its ports and counters
+	uint32_t nr_ports;
+	uint32_t nr_cntrs;
+	uint32_t nr_samples;
+	uint32_t nr_triggers;
+	uint64_t ports_off;	//!< struct switchtec_flr_port[nr_ports]
+	uint64_t cntrs_off;	//!< struct switchtec_flr_cntr[nr_cntrs]
+	uint64_t samples_off;	//!< Samples, oldest first
+	uint64_t triggers_off;	//!< struct switchtec_flr_trigger[nr_triggers]
+	uint64_t fwlog_off;	//!< Binary firmware RAM log, as from log-dump
+	uint64_t fwlog_len;	//!< 0 if the log could not be read
+};
+
+#pragma pack(pop)
+
+struct switchtec_flightrec;
+
+struct switchtec_flightrec *
+switchtec_flightrec_new(struct switchtec_dev *dev, unsigned depth,
+			unsigned period_ms);
+int switchtec_flightrec_trigger(struct switchtec_flightrec *fr,
+				enum switchtec_event_id e, int index);
+int switchtec_flightrec_sample(struct switchtec_flightrec *fr);
+int switchtec_flightrec_poll(struct switchtec_flightrec *fr,
+			     struct switchtec_event_summary *fired);
+int switchtec_flightrec_dump(struct switchtec_flightrec *fr,
+			     const char *path,
+			     const struct switchtec_event_summary *fired);
+void switchtec_flightrec_free(struct switchtec_flightrec *fr);
+
+#endif
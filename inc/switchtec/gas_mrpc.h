@@ -41,12 +41,28 @@ struct gas_mrpc_read {
 	uint32_t len;
 };
 
+/**
+ * @brief Called by gas_mrpc_read_stream() with each chunk read
+ * @param[in] ctx	Context passed to gas_mrpc_read_stream()
+ * @param[in] data	Chunk data
+ * @param[in] offset	Offset of the chunk from the start of the transfer
+ * @param[in] len	Chunk length
+ * @return 0 to continue, non-zero to stop the transfer
+ */
+typedef int (*gas_mrpc_chunk_fn)(void *ctx, const void *data, size_t offset,
+				 size_t len);
+
 void gas_mrpc_memcpy_to_gas(struct switchtec_dev *dev, void __gas *dest,
 			    const void *src, size_t n);
 int gas_mrpc_memcpy_from_gas(struct switchtec_dev *dev, void *dest,
 			     const void __gas *src, size_t n);
 ssize_t gas_mrpc_write_from_gas(struct switchtec_dev *dev, int fd,
 				const void __gas *src, size_t n);
+ssize_t gas_mrpc_write_from_gas_progress(struct switchtec_dev *dev, int fd,
+		const void __gas *src, size_t n,
+		void (*progress_callback)(int cur, int tot));
+int gas_mrpc_read_stream(struct switchtec_dev *dev, const void __gas *src,
+			 size_t n, gas_mrpc_chunk_fn fn, void *ctx);
 
 // noop conversion functions to make macros below work
 static inline uint8_t le8toh(uint8_t x) { return x; }
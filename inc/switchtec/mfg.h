@@ -233,6 +233,39 @@ struct switchtec_security_spi_avail_rate {
 	float rates[SWITCHTEC_SECURITY_SPI_RATE_MAX_NUM];
 };
 
+/**
+ * @brief Steps of a unit provisioned by switchtec_prov_run()
+ */
+enum switchtec_prov_step {
+	SWITCHTEC_PROV_STEP_OPEN,	//!< Opening the device
+	SWITCHTEC_PROV_STEP_CHECK,	//!< Checking boot phase and secure state
+	SWITCHTEC_PROV_STEP_CONFIG,	//!< Programming security settings
+	SWITCHTEC_PROV_STEP_KMSK,	//!< Adding the KMSK entry
+	SWITCHTEC_PROV_STEP_INDEX,	//!< Selecting the active images
+	SWITCHTEC_PROV_STEP_FW_EXEC,	//!< Executing the transferred image
+	SWITCHTEC_PROV_STEP_DONE,	//!< All steps completed
+};
+
+/**
+ * @brief Outcome of one unit of switchtec_prov_run()
+ */
+struct switchtec_prov_result {
+	const char *device;		//!< Device string the unit was opened with
+	enum switchtec_prov_step step;	//!< Current step, or the one that failed
+	int finished;			//!< Set once the unit is done, or failed
+	int ret;			//!< 0, or the error returned by the step
+	int err;			//!< errno at the time of the failure
+	const char *msg;		//!< Reason the unit was refused, or NULL
+	uint32_t chip_serial;		//!< Chip serial number, 0 if not read
+	int kmsk_present;		//!< The KMSK entry was already programmed
+	uint64_t elapsed_us;		//!< Time spent on the unit
+};
+
+typedef void (*switchtec_prov_fn)(const struct switchtec_prov_result *res,
+				  void *data);
+
+struct switchtec_prov;
+
 int switchtec_sn_ver_get(struct switchtec_dev *dev,
 			 struct switchtec_sn_ver_info *info);
 int switchtec_security_config_get(struct switchtec_dev *dev,
@@ -276,4 +309,20 @@ int
 switchtec_security_state_has_kmsk(struct switchtec_security_cfg_state *state,
 				  struct switchtec_kmsk *kmsk);
 
+struct switchtec_prov *switchtec_prov_new(void);
+void switchtec_prov_free(struct switchtec_prov *prov);
+int switchtec_prov_set_sec_cfg(struct switchtec_prov *prov,
+			       FILE *setting_file, FILE *uds_file,
+			       struct switchtec_security_cfg_set *set);
+int switchtec_prov_set_kmsk(struct switchtec_prov *prov, FILE *kmsk_file,
+			    FILE *pubk_file, FILE *sig_file);
+int switchtec_prov_set_active_index(struct switchtec_prov *prov,
+				    struct switchtec_active_index *index);
+void switchtec_prov_set_fw_exec(struct switchtec_prov *prov,
+				enum switchtec_bl2_recovery_mode recovery_mode);
+int switchtec_prov_run(const struct switchtec_prov *prov,
+		       const char * const *devices, int count, int jobs,
+		       struct switchtec_prov_result *results,
+		       switchtec_prov_fn cb, void *data);
+
 #endif // LIBSWITCHTEC_MFG_H
@@ -0,0 +1,122 @@
+/*
+ * Microsemi Switchtec(tm) PCIe Management Library
+ * Copyright (c) 2025, Microsemi Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef LIBSWITCHTEC_RECORD_H
+#define LIBSWITCHTEC_RECORD_H
+
+/**
+ * @file
+ * @brief Binary telemetry recordings
+ *
+ * A recording is a fixed-size header followed by fixed-size samples, so
+ * sample \p n starts at header_size + n * sample_size and the file can
+ * be memory mapped for analysis. Values are stored in host byte order.
+ */
+
+#include <switchtec/switchtec.h>
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SWITCHTEC_REC_MAGIC		"SWTCREC"
+#define SWITCHTEC_REC_VERSION		1
+#define SWITCHTEC_REC_MAX_CHANNELS	SWITCHTEC_MAX_EVCNTRS
+
+/**
+ * @brief What a recording holds; selects the per-channel sample type
+ */
+enum switchtec_rec_type {
+	SWITCHTEC_REC_BW = 1,	//!< struct switchtec_bwcntr_res (not cleared)
+	SWITCHTEC_REC_LAT,	//!< struct switchtec_rec_lat (cleared each sample)
+	SWITCHTEC_REC_EVCNTR,	//!< uint32_t count (not cleared)
+	SWITCHTEC_REC_TEMP,	//!< float degrees Celsius
+};
+
+#pragma pack(push, 1)
+
+/**
+ * @brief One recorded channel (a port, event counter or sensor)
+ */
+struct switchtec_rec_channel {
+	/** @brief Physical port ID, stack << 8 | counter, or sensor index */
+	uint16_t id;
+	uint16_t ltssm;		//!< Link state when the recording started
+	uint8_t partition;
+	uint8_t stack;
+	uint8_t stk_id;
+	uint8_t upstream;
+	uint8_t cfg_link_width;
+	uint8_t link_width;	//!< Negotiated link width, 0 if the link is down
+	uint8_t link_rate;
+	uint8_t rsvd;
+};
+
+/**
+ * @brief Recording file header
+ */
+struct switchtec_rec_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;	//!< Offset of the first sample
+	uint32_t sample_size;	//!< Size of each sample, including time_us
+	uint32_t type;		//!< enum switchtec_rec_type
+	uint32_t period_us;	//!< Sampling period
+	uint32_t device_id;
+	uint64_t start_us;	//!< Host time the recording was created
+	uint32_t nr_channels;
+	uint32_t rsvd;
+	char dev_name[64];
+	struct switchtec_rec_channel channels[SWITCHTEC_REC_MAX_CHANNELS];
+};
+
+/**
+ * @brief Latency counter sample in a SWITCHTEC_REC_LAT recording
+ */
+struct switchtec_rec_lat {
+	uint32_t cur_ns;	//!< Current (Gen3) or minimum latency
+	uint32_t max_ns;
+};
+
+#pragma pack(pop)
+
+struct switchtec_rec;
+
+size_t switchtec_rec_channel_size(enum switchtec_rec_type type);
+struct switchtec_rec *
+switchtec_rec_create(const char *path, enum switchtec_rec_type type,
+		     unsigned period_us, struct switchtec_dev *dev,
+		     int nr_channels,
+		     const struct switchtec_rec_channel *channels);
+int switchtec_rec_append(struct switchtec_rec *rec, uint64_t time_us,
+			 const void *data);
+struct switchtec_rec *switchtec_rec_open(const char *path);
+const struct switchtec_rec_header *
+switchtec_rec_header(struct switchtec_rec *rec);
+long switchtec_rec_count(struct switchtec_rec *rec);
+int switchtec_rec_read(struct switchtec_rec *rec, long idx,
+		       uint64_t *time_us, void *data);
+long switchtec_rec_find(struct switchtec_rec *rec, uint64_t time_us);
+void switchtec_rec_close(struct switchtec_rec *rec);
+
+#endif
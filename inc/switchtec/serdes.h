@@ -0,0 +1,118 @@
+/*
+ * Microsemi Switchtec(tm) PCIe Management Library
+ * Copyright (c) 2025, Microsemi Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef LIBSWITCHTEC_SERDES_H
+#define LIBSWITCHTEC_SERDES_H
+
+/**
+ * @file
+ * @brief Whole-switch SerDes state snapshots
+ *
+ * A snapshot holds the receiver objects, extended receiver objects,
+ * TX equalization coefficients, far end TX equalization table and FS/LF
+ * values of every lane of a set of ports, as returned by
+ * switchtec_diag_rcvr_obj(), switchtec_diag_rcvr_ext(),
+ * switchtec_diag_port_eq_tx_coeff(), switchtec_diag_port_eq_tx_table()
+ * and switchtec_diag_port_eq_tx_fslf(). All the reads are issued as one
+ * command batch.
+ *
+ * Snapshots can be saved to and loaded from a compact binary file and
+ * compared value by value.
+ */
+
+#include <switchtec/switchtec.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SWITCHTEC_SERDES_MAGIC		"SWTCSDS"
+#define SWITCHTEC_SERDES_VERSION	1
+#define SWITCHTEC_SERDES_MAX_LANES	16
+
+/**
+ * @brief Which parts of a port or lane were read successfully
+ */
+enum switchtec_serdes_valid {
+	SWITCHTEC_SERDES_LOCAL_COEFF	= 1 << 0,	//!< Port
+	SWITCHTEC_SERDES_FAR_COEFF	= 1 << 1,	//!< Port
+	SWITCHTEC_SERDES_FAR_TABLE	= 1 << 2,	//!< Port
+	SWITCHTEC_SERDES_RCVR_OBJ	= 1 << 3,	//!< Lane
+	SWITCHTEC_SERDES_RCVR_EXT	= 1 << 4,	//!< Lane
+	SWITCHTEC_SERDES_LOCAL_FSLF	= 1 << 5,	//!< Lane
+	SWITCHTEC_SERDES_FAR_FSLF	= 1 << 6,	//!< Lane
+};
+
+struct switchtec_serdes_lane {
+	unsigned valid;		//!< switchtec_serdes_valid lane flags
+	struct switchtec_rcvr_obj rcvr_obj;
+	struct switchtec_rcvr_ext rcvr_ext;
+	struct switchtec_port_eq_tx_fslf local_fslf;
+	struct switchtec_port_eq_tx_fslf far_fslf;
+};
+
+struct switchtec_serdes_port {
+	int phys_port_id;
+	int lane_cnt;
+	unsigned valid;		//!< switchtec_serdes_valid port flags
+	struct switchtec_port_eq_coeff local_coeff;
+	struct switchtec_port_eq_coeff far_coeff;
+	struct switchtec_port_eq_table far_table;
+	struct switchtec_serdes_lane lanes[SWITCHTEC_SERDES_MAX_LANES];
+};
+
+struct switchtec_serdes_snapshot {
+	int device_id;
+	enum switchtec_diag_link link;
+	uint64_t time;		//!< Seconds since the epoch when taken
+	int nr_ports;
+	struct switchtec_serdes_port *ports;
+};
+
+/**
+ * @brief A value that differs between two snapshots
+ */
+struct switchtec_serdes_diff {
+	int phys_port_id;
+	int lane_id;		//!< -1 for per-port values
+	uint32_t field;		//!< See switchtec_diag_serdes_field_name()
+	bool in_a;		//!< The first snapshot has the value
+	bool in_b;		//!< The second snapshot has the value
+	int a;
+	int b;
+};
+
+struct switchtec_serdes_snapshot *
+switchtec_diag_serdes_snapshot(struct switchtec_dev *dev, const int *ports,
+			       int nr_ports, enum switchtec_diag_link link);
+void switchtec_diag_serdes_snapshot_free(struct switchtec_serdes_snapshot *s);
+int switchtec_diag_serdes_snapshot_save(const struct switchtec_serdes_snapshot *s,
+					FILE *f);
+struct switchtec_serdes_snapshot *switchtec_diag_serdes_snapshot_load(FILE *f);
+int switchtec_diag_serdes_diff(const struct switchtec_serdes_snapshot *a,
+			       const struct switchtec_serdes_snapshot *b,
+			       struct switchtec_serdes_diff *diffs, int max);
+int switchtec_diag_serdes_field_name(uint32_t field, char *buf, size_t len);
+
+#endif
@@ -181,6 +181,20 @@ struct switchtec_status {
 	unsigned int acs_ctrl;		//!< ACS Setting of the Port
 };
 
+/**
+ * @brief Numeric port status, as filled in by switchtec_status_snapshot()
+ */
+struct switchtec_port_snapshot {
+	struct switchtec_port_id port;	//!< Port ID
+	unsigned char cfg_lnk_width;	//!< Configured link width
+	unsigned char neg_lnk_width;	//!< Negotiated link width
+	unsigned char link_up;		//!< 1 if the link is up
+	unsigned char link_rate;	//!< Link rate/gen
+	uint16_t ltssm;			//!< Link state
+	unsigned char lane_reversal;	//!< Lane reversal
+	unsigned char first_act_lane;	//!< First active lane
+};
+
 /**
  * @brief The types of bandwidth
  */
@@ -226,6 +240,16 @@ struct switchtec_log_file_info {
 	bool gen_ignored;
 };
 
+/**
+ * @brief Position in an app log, for tailing it with switchtec_log_tail()
+ */
+struct switchtec_log_cursor {
+	uint32_t next_start;	//!< log index the next read starts at
+	unsigned int entries;	//!< number of entries read so far
+	bool valid;		//!< next_start is valid (else read the whole log)
+	bool header_written;	//!< the file header has been written
+};
+
 /**
  * @brief Log definition data types
  */
@@ -273,6 +297,15 @@ struct switchtec_fw_image_info {
 	bool signed_image;
 };
 
+/**
+ * @brief A range of an image that differs from flash
+ * @see switchtec_fw_diff()
+ */
+struct switchtec_fw_diff_range {
+	size_t offset;				//!< Offset into the image
+	size_t len;				//!< Length of the range
+};
+
 struct switchtec_fw_part_summary {
 	struct switchtec_fw_part_type {
 		struct switchtec_fw_image_info *active, *inactive;
@@ -299,6 +332,20 @@ struct switchtec_event_summary {
 	unsigned pff[SWITCHTEC_MAX_PFF_CSR];
 };
 
+struct switchtec_monitor;
+
+/**
+ * @brief A device reported by switchtec_monitor_wait()
+ */
+struct switchtec_monitor_event {
+	struct switchtec_dev *dev;	//!< Device that signalled
+	void *data;			//!< Pointer given to switchtec_monitor_add()
+	int error;			//!< errno if the device failed, otherwise 0
+
+	/** @brief Pending events, restricted to the registered mask */
+	struct switchtec_event_summary sum;
+};
+
 /**
  * @brief Enumeration of all possible events
  */
@@ -338,17 +385,187 @@ enum switchtec_event_id {
 	SWITCHTEC_MAX_EVENTS,
 };
 
+/**
+ * @brief Event headers and data of one global, partition or PFF block,
+ *	as read by switchtec_event_block_ctl()
+ *
+ * The arrays are indexed by event ID; entries for events of other types
+ * are zero.
+ */
+struct switchtec_event_block {
+	uint64_t occurred;	//!< Bitmask (1 << event ID) of events that occurred
+	uint32_t hdr[SWITCHTEC_MAX_EVENTS];	//!< Raw event header
+	unsigned char count[SWITCHTEC_MAX_EVENTS];	//!< Occurrence count
+	uint32_t data[SWITCHTEC_MAX_EVENTS][5];	//!< Event data words
+};
+
+/**
+ * @brief How MRPC completion is polled on transports that read the
+ *	MRPC status register directly (I2C and UART)
+ *
+ * The status register is read \p spin_count times back to back. After
+ * that, the library sleeps \p initial_delay_us between reads, multiplying
+ * the delay by \p backoff_factor each time up to \p max_delay_us. The
+ * initial delay must be at least 1 microsecond.
+ */
+struct switchtec_mrpc_poll_policy {
+	int spin_count;		//!< Status reads before the first sleep
+	int initial_delay_us;	//!< First sleep after spinning
+	int backoff_factor;	//!< Delay multiplier applied after each sleep
+	int max_delay_us;	//!< Upper bound for the sleep between reads
+};
+
+#define SWITCHTEC_MRPC_STATS_BUCKETS 24
+
+/**
+ * @brief Instrumentation counters for a single MRPC command ID
+ *
+ * Latencies are in microseconds. Histogram bucket \p i counts calls
+ * which took fewer than 2^i microseconds (and at least 2^(i-1)); the
+ * last bucket also counts everything slower.
+ */
+struct switchtec_mrpc_stats {
+	uint64_t count;		//!< Number of calls
+	uint64_t errors;	//!< Calls that returned non-zero
+	uint64_t payload_bytes;	//!< Total bytes sent
+	uint64_t resp_bytes;	//!< Total bytes received
+	uint64_t total_us;	//!< Sum of all call latencies
+	uint64_t wait_us;	//!< Part of total_us spent waiting for the
+				//!< firmware (only on polled transports)
+	uint64_t min_us;	//!< Fastest call
+	uint64_t max_us;	//!< Slowest call
+	uint64_t hist[SWITCHTEC_MRPC_STATS_BUCKETS];
+};
+
+/**
+ * @brief A single command in a switchtec_cmd_batch() call
+ */
+struct switchtec_cmd_desc {
+	uint32_t cmd;		//!< Command ID
+	const void *payload;	//!< Input data
+	size_t payload_len;	//!< Input data length (in bytes)
+	void *resp;		//!< Output data
+	size_t resp_len;	//!< Output data length (in bytes)
+	int ret;		//!< Result, as would be returned by switchtec_cmd()
+};
+
+/**
+ * @brief Events which invalidate entries in the GAS shadow cache
+ */
+enum switchtec_gas_cache_event {
+	SWITCHTEC_GAS_CACHE_INV_RESET = 1 << 0,	//!< Device was reset
+	SWITCHTEC_GAS_CACHE_INV_FW = 1 << 1,	//!< Firmware written or
+						//!< partition toggled
+	SWITCHTEC_GAS_CACHE_INV_BIND = 1 << 2,	//!< Port bound or unbound
+	SWITCHTEC_GAS_CACHE_INV_ALL = 0x7,
+};
+
+/**
+ * @brief Flags for switchtec_open_flags() and switchtec_open_many()
+ */
+enum switchtec_open_flags {
+	SWITCHTEC_OPEN_LAZY_PROBE = 1 << 0,	//!< Defer the identity MRPCs
+						//!< until first use
+};
+
+/**
+ * @brief Kinds of call reported to a ::switchtec_trace_fn
+ */
+enum switchtec_trace_op {
+	SWITCHTEC_TRACE_CMD,		//!< MRPC command; id is the command ID
+	SWITCHTEC_TRACE_GAS_READ,	//!< GAS read; id is the GAS offset
+	SWITCHTEC_TRACE_GAS_WRITE,	//!< GAS write; id is the GAS offset
+	SWITCHTEC_TRACE_EVENT_WAIT,	//!< Event wait; id is the timeout
+					//!< in milliseconds
+};
+
+/**
+ * @brief One call through a device's transport
+ */
+struct switchtec_trace_rec {
+	enum switchtec_trace_op op;	//!< Kind of call
+	uint32_t id;			//!< Command ID, GAS offset or timeout
+	size_t len;			//!< Bytes transferred (payload plus
+					//!< response for commands)
+	int ret;			//!< Result of the call
+	uint64_t start_us;		//!< Start time, in microseconds
+	uint64_t elapsed_us;		//!< Duration, in microseconds
+};
+
+/**
+ * @brief Callback installed with switchtec_set_trace()
+ *
+ * Called with the device lock held, after each traced call completes.
+ * It must not issue commands on the same device.
+ */
+typedef void (*switchtec_trace_fn)(struct switchtec_dev *dev,
+				   const struct switchtec_trace_rec *rec,
+				   void *arg);
+
+/**
+ * @brief Scheduling class of an I2C device handle
+ *
+ * All handles opened on the same I2C adapter share one bus. When
+ * several are waiting, interactive transfers go first; bulk transfers
+ * (such as firmware downloads) are still granted one transaction in
+ * every few so they are never starved.
+ */
+enum switchtec_i2c_prio {
+	SWITCHTEC_I2C_PRIO_INTERACTIVE,	//!< Health polls and short commands
+	SWITCHTEC_I2C_PRIO_BULK,	//!< Long, throughput bound transfers
+	SWITCHTEC_I2C_PRIO_NUM,
+};
+
+/**
+ * @brief Bus counters for one scheduling class
+ *
+ * Times are in microseconds.
+ */
+struct switchtec_i2c_prio_stats {
+	uint64_t xfers;		//!< I2C_RDWR transactions issued
+	uint64_t bytes;		//!< Bytes on the bus, both directions
+	uint64_t errors;	//!< Transactions the adapter failed
+	uint64_t busy_us;	//!< Time the bus was held for this class
+	uint64_t wait_us;	//!< Time spent queued for the bus
+	uint64_t max_wait_us;	//!< Longest single wait for the bus
+};
+
+/**
+ * @brief Utilization of an I2C adapter shared by several handles
+ *
+ * Counters cover every handle in this process opened on the adapter,
+ * since the bus was first opened or last reset.
+ */
+struct switchtec_i2c_bus_stats {
+	int adapter;		//!< Adapter number (N in /dev/i2c-N)
+	int handles;		//!< Handles currently open on the bus
+	uint64_t elapsed_us;	//!< Time covered by the counters
+	uint64_t busy_us;	//!< Time the bus was held by any handle
+	struct switchtec_i2c_prio_stats prio[SWITCHTEC_I2C_PRIO_NUM];
+};
+
 /*********** Platform Functions ***********/
 
 struct switchtec_dev *switchtec_open(const char *device);
+struct switchtec_dev *switchtec_open_flags(const char *device, int flags);
+int switchtec_open_many(const char * const *devices, int count,
+			struct switchtec_dev **devs, int flags);
 struct switchtec_dev *switchtec_open_by_path(const char *path);
 struct switchtec_dev *switchtec_open_by_index(int index);
 struct switchtec_dev *switchtec_open_by_pci_addr(int domain, int bus,
 						 int device, int func);
 struct switchtec_dev *switchtec_open_i2c(const char *path, int i2c_addr);
 struct switchtec_dev *switchtec_open_i2c_by_adapter(int adapter, int i2c_addr);
+int switchtec_i2c_set_prio(struct switchtec_dev *dev,
+			   enum switchtec_i2c_prio prio);
+int switchtec_i2c_bus_stats_get(struct switchtec_dev *dev,
+				struct switchtec_i2c_bus_stats *stats);
+int switchtec_i2c_bus_stats_reset(struct switchtec_dev *dev);
 struct switchtec_dev *switchtec_open_uart(int fd);
 struct switchtec_dev *switchtec_open_eth(const char *ip, const int inst);
+struct switchtec_dev *switchtec_open_daemon(const char *socket_path,
+					    const char *device);
+struct switchtec_dev *switchtec_open_sim(const char *options);
 
 void switchtec_close(struct switchtec_dev *dev);
 int switchtec_list(struct switchtec_device_info **devlist);
@@ -358,6 +575,30 @@ int switchtec_get_fw_version(struct switchtec_dev *dev, char *buf,
 int switchtec_cmd(struct switchtec_dev *dev, uint32_t cmd,
 		  const void *payload, size_t payload_len, void *resp,
 		  size_t resp_len);
+int switchtec_cmd_batch(struct switchtec_dev *dev,
+			struct switchtec_cmd_desc *cmds, int n);
+int switchtec_cmd_submit(struct switchtec_dev *dev, uint32_t cmd,
+			 const void *payload, size_t payload_len,
+			 void *resp, size_t resp_len);
+int switchtec_cmd_poll(struct switchtec_dev *dev);
+int switchtec_cmd_poll_fd(struct switchtec_dev *dev);
+void *switchtec_cmd_poll_handle(struct switchtec_dev *dev);
+int switchtec_cmd_complete(struct switchtec_dev *dev);
+int switchtec_set_mrpc_poll_policy(struct switchtec_dev *dev,
+			const struct switchtec_mrpc_poll_policy *policy);
+int switchtec_get_mrpc_poll_policy(struct switchtec_dev *dev,
+				   struct switchtec_mrpc_poll_policy *policy);
+int switchtec_set_mrpc_poll_hint(struct switchtec_dev *dev, int mrpc_id,
+				 int delay_us);
+int switchtec_mrpc_stats_enable(struct switchtec_dev *dev, int enable);
+int switchtec_mrpc_stats_get(struct switchtec_dev *dev, int mrpc_id,
+			     struct switchtec_mrpc_stats *stats);
+void switchtec_mrpc_stats_reset(struct switchtec_dev *dev);
+void switchtec_set_trace(struct switchtec_dev *dev, switchtec_trace_fn fn,
+			 void *arg);
+const char *switchtec_mrpc_name(int mrpc_id);
+int switchtec_gas_cache_enable(struct switchtec_dev *dev, int enable);
+void switchtec_gas_cache_invalidate(struct switchtec_dev *dev, int events);
 int switchtec_get_devices(struct switchtec_dev *dev,
 			  struct switchtec_status *status,
 			  int ports);
@@ -367,6 +608,8 @@ int switchtec_port_to_pff(struct switchtec_dev *dev, int partition,
 			  int port, int *pff);
 int switchtec_event_summary(struct switchtec_dev *dev,
 			    struct switchtec_event_summary *sum);
+int switchtec_event_summary_since(struct switchtec_dev *dev,
+				  struct switchtec_event_summary *sum);
 int switchtec_event_check(struct switchtec_dev *dev,
 			  struct switchtec_event_summary *check,
 			  struct switchtec_event_summary *res);
@@ -376,21 +619,38 @@ int switchtec_event_ctl(struct switchtec_dev *dev,
 			uint32_t data[5]);
 int switchtec_event_wait(struct switchtec_dev *dev, int timeout_ms);
 
+struct switchtec_monitor *switchtec_monitor_new(void);
+void switchtec_monitor_free(struct switchtec_monitor *mon);
+void switchtec_monitor_set_poll_interval(struct switchtec_monitor *mon,
+					 int interval_ms);
+int switchtec_monitor_add(struct switchtec_monitor *mon,
+			  struct switchtec_dev *dev,
+			  const struct switchtec_event_summary *mask,
+			  void *data);
+int switchtec_monitor_remove(struct switchtec_monitor *mon,
+			     struct switchtec_dev *dev);
+int switchtec_monitor_wait(struct switchtec_monitor *mon,
+			   struct switchtec_monitor_event *evts, int max,
+			   int timeout_ms);
+
 /*********** Generic Accessors ***********/
 
 _PURE const char *switchtec_name(struct switchtec_dev *dev);
 _PURE int switchtec_partition(struct switchtec_dev *dev);
-_PURE int switchtec_device_id(struct switchtec_dev *dev);
-_PURE enum switchtec_gen switchtec_gen(struct switchtec_dev *dev);
-_PURE enum switchtec_variant switchtec_variant(struct switchtec_dev *dev);
-_PURE enum switchtec_boot_phase
-switchtec_boot_phase(struct switchtec_dev *dev);
+int switchtec_device_id(struct switchtec_dev *dev);
+enum switchtec_gen switchtec_gen(struct switchtec_dev *dev);
+enum switchtec_variant switchtec_variant(struct switchtec_dev *dev);
+enum switchtec_boot_phase switchtec_boot_phase(struct switchtec_dev *dev);
+int switchtec_probe(struct switchtec_dev *dev);
 int switchtec_set_pax_id(struct switchtec_dev *dev, int pax_id);
 int switchtec_echo(struct switchtec_dev *dev, uint32_t input, uint32_t *output);
 int switchtec_hard_reset(struct switchtec_dev *dev);
 int switchtec_status(struct switchtec_dev *dev,
 		     struct switchtec_status **status);
 void switchtec_status_free(struct switchtec_status *status, int ports);
+int switchtec_status_snapshot(struct switchtec_dev *dev,
+			      struct switchtec_port_snapshot *ports,
+			      int max_ports);
 int switchtec_get_device_info(struct switchtec_dev *dev,
 			      enum switchtec_boot_phase *phase,
 			      enum switchtec_gen *gen,
@@ -400,11 +660,21 @@ void switchtec_perror(const char *str);
 int switchtec_log_to_file(struct switchtec_dev *dev,
 		enum switchtec_log_type type, int fd, FILE *log_def_file,
 		struct switchtec_log_file_info *info);
+int switchtec_log_tail(struct switchtec_dev *dev,
+		       enum switchtec_log_type type, int fd,
+		       FILE *log_def_file,
+		       struct switchtec_log_cursor *cursor,
+		       struct switchtec_log_file_info *info);
 int switchtec_parse_log(FILE *bin_log_file, FILE *log_def_file,
 			FILE *parsed_log_file,
 			enum switchtec_log_parse_type log_type,
 			enum switchtec_gen gen,
 			struct switchtec_log_file_info *info);
+int switchtec_parse_log_mt(FILE *bin_log_file, FILE *log_def_file,
+			   FILE *parsed_log_file,
+			   enum switchtec_log_parse_type log_type,
+			   enum switchtec_gen gen, int jobs,
+			   struct switchtec_log_file_info *info);
 int switchtec_log_def_to_file(struct switchtec_dev *dev,
 			      enum switchtec_log_def_type type,
 			      FILE* file);
@@ -420,6 +690,46 @@ int switchtec_calc_lane_mask(struct switchtec_dev *dev, int phys_port_id,
 		int lane_id, int num_lanes, int *lane_mask,
 		struct switchtec_status *port);
 
+/**
+ * @brief A port in the cached lane topology
+ */
+struct switchtec_topo_port {
+	struct switchtec_port_id port;	//!< Port ID
+	unsigned char cfg_lnk_width;	//!< Configured link width
+	unsigned char neg_lnk_width;	//!< Negotiated link width
+	unsigned char link_up;		//!< 1 if the link is up
+	unsigned char link_rate;	//!< Link rate/gen
+	unsigned char lane_reversal;	//!< Lane reversal
+	int first_lane;			//!< Global lane ID of the port's
+					/*!< lowest numbered lane */
+};
+
+/**
+ * @brief Cached port/lane topology of a device
+ *
+ * Lookup tables hold indexes into ports, or -1 where there is no port.
+ */
+struct switchtec_topo {
+	int num_ports;
+	struct switchtec_topo_port ports[SWITCHTEC_MAX_PORTS];
+	signed char phys_port[SWITCHTEC_MAX_PORTS];
+	signed char lane_port[SWITCHTEC_MAX_LANES];
+	signed char stack_port[SWITCHTEC_MAX_STACKS][SWITCHTEC_PORTS_PER_STACK];
+};
+
+const struct switchtec_topo *switchtec_topo(struct switchtec_dev *dev);
+int switchtec_topo_refresh(struct switchtec_dev *dev);
+void switchtec_topo_invalidate(struct switchtec_dev *dev);
+const struct switchtec_topo_port *
+switchtec_topo_find_port(const struct switchtec_topo *topo, int phys_port_id);
+int switchtec_topo_lane_id(const struct switchtec_topo *topo,
+			   int phys_port_id, int lane_id);
+int switchtec_topo_port_lane(const struct switchtec_topo *topo, int lane_id,
+			     int *phys_port_id, int *port_lane_id);
+int switchtec_topo_lane_mask(const struct switchtec_topo *topo,
+			     int phys_port_id, int lane_id, int num_lanes,
+			     int *lane_mask);
+
 /**
  * @brief Return Link error injection command outputs for DLLP, DLLP_CRC,
  * LCRC, SEQ_NUM, ACK_NACK, CTO.
@@ -438,6 +748,89 @@ int switchtec_inject_err_ack_nack(struct switchtec_dev *dev, int phys_port_id,
                 uint16_t seq_num, uint8_t count);
 int switchtec_inject_err_cto(struct switchtec_dev *dev, int phys_port_id);
 
+/**
+ * @brief Link errors a campaign can inject
+ */
+enum switchtec_lnkerr_type {
+	SWITCHTEC_LNKERR_DLLP,		//!< DLLP, once per injection
+	SWITCHTEC_LNKERR_DLLP_CRC,	//!< DLLP CRC errors at a hardware rate
+	SWITCHTEC_LNKERR_TLP_LCRC,	//!< TLP LCRC errors at a hardware rate
+	SWITCHTEC_LNKERR_TLP_SEQ,	//!< TLP sequence number error, once
+	SWITCHTEC_LNKERR_ACK_NACK,	//!< ACK to NACK replacement, once
+	SWITCHTEC_LNKERR_CTO,		//!< Credit timeout, once (Gen5 only)
+};
+
+/**
+ * @brief A burst of injections on one port
+ *
+ * DLLP CRC and TLP LCRC injection is enabled with \p hw_rate when the
+ * burst starts and disabled when it ends. The other types are single
+ * shot commands that are repeated \p rate times a second.
+ */
+struct switchtec_lnkerr_burst {
+	int phys_port_id;
+	enum switchtec_lnkerr_type type;
+	unsigned start_ms;	//!< Start, from the start of the campaign
+	unsigned duration_ms;
+	unsigned rate;		//!< Injections per second for single shot types
+	int hw_rate;		//!< Rate for DLLP CRC and TLP LCRC injection
+	uint16_t data;		//!< DLLP data, or the ACK sequence number
+	uint8_t count;		//!< Number of ACKs to replace with NACKs
+};
+
+/**
+ * @brief One port's throughput and error count over a sample interval
+ */
+struct switchtec_lnkerr_sample {
+	uint64_t time_us;	//!< Time since the campaign started
+	int phys_port_id;
+	double bps;		//!< Ingress plus egress bytes per second
+	unsigned events;	//!< Error events counted in the interval
+	int bursting;		//!< A burst was running on the port
+};
+
+/**
+ * @brief Called for each port at every sample; non-zero stops the campaign
+ */
+typedef int (*switchtec_lnkerr_sample_fn)(
+	const struct switchtec_lnkerr_sample *sample, void *data);
+
+/**
+ * @brief Settings of a link error injection campaign
+ */
+struct switchtec_lnkerr_campaign {
+	const struct switchtec_lnkerr_burst *bursts;
+	int nr_bursts;
+	unsigned sample_ms;	//!< Sample interval
+	unsigned settle_ms;	//!< Time to keep sampling after the last burst
+	double recover_frac;	//!< Fraction of the baseline that counts as
+				//!< recovered, 0.9 if 0
+	unsigned evcntr_mask;	//!< Error types (::switchtec_evcntr_type_mask)
+				//!< counted on each port, 0 for none
+	switchtec_lnkerr_sample_fn cb;
+	void *data;		//!< Passed to \p cb
+};
+
+/**
+ * @brief Outcome of a campaign for one port
+ */
+struct switchtec_lnkerr_result {
+	int phys_port_id;
+	unsigned injected;	//!< Injection commands that succeeded
+	unsigned inject_failed;	//!< Injection commands that failed
+	double baseline;	//!< Mean bytes per second before the first burst
+	double minimum;		//!< Lowest bytes per second from the first burst
+	double drop_pct;	//!< Drop from the baseline to the minimum
+	int recovered;		//!< Throughput recovered after the last burst
+	uint64_t recovery_us;	//!< From the end of the last burst to recovery
+	unsigned events;	//!< Error events counted over the campaign
+};
+
+int switchtec_lnkerr_campaign_run(struct switchtec_dev *dev,
+				  const struct switchtec_lnkerr_campaign *c,
+				  struct switchtec_lnkerr_result *results,
+				  int max_results);
+
 /**
  * @brief Return whether a Switchtec device is a Gen 3 device.
  */
@@ -809,6 +1202,10 @@ int switchtec_event_summary_iter(struct switchtec_event_summary *sum,
 enum switchtec_event_type switchtec_event_info(enum switchtec_event_id e,
 					       const char **name,
 					       const char **desc);
+int switchtec_event_block_ctl(struct switchtec_dev *dev,
+			      enum switchtec_event_type type, int index,
+			      uint64_t clear,
+			      struct switchtec_event_block *blk);
 int switchtec_event_wait_for(struct switchtec_dev *dev,
 			     enum switchtec_event_id e, int index,
 			     struct switchtec_event_summary *res,
@@ -865,12 +1262,28 @@ int switchtec_fw_write_fd(struct switchtec_dev *dev, int img_fd,
 int switchtec_fw_write_file(struct switchtec_dev *dev, FILE *fimg,
 			    int dont_activate, int force,
 			    void (*progress_callback)(int cur, int tot));
+int switchtec_fw_write_buf(struct switchtec_dev *dev, const void *img,
+			   size_t img_len, int dont_activate, int force,
+			   void (*progress_callback)(void *data, int cur,
+						     int tot),
+			   void *data);
 int switchtec_fw_read_fd(struct switchtec_dev *dev, int fd,
 			 unsigned long addr, size_t len,
 			 void (*progress_callback)(int cur, int tot));
 int switchtec_fw_body_read_fd(struct switchtec_dev *dev, int fd,
 			      struct switchtec_fw_image_info *info,
 			      void (*progress_callback)(int cur, int tot));
+int switchtec_fw_readback(struct switchtec_dev *dev, int fd,
+			  unsigned long addr, size_t len, uint32_t *crc,
+			  void (*progress_callback)(int cur, int tot));
+int switchtec_fw_body_verify(struct switchtec_dev *dev, int fd,
+			     struct switchtec_fw_image_info *info,
+			     uint32_t *crc,
+			     void (*progress_callback)(int cur, int tot));
+int switchtec_fw_diff(struct switchtec_dev *dev, unsigned long addr,
+		      const void *img, size_t len, size_t chunk,
+		      struct switchtec_fw_diff_range *ranges, int max_ranges,
+		      void (*progress_callback)(int cur, int tot));
 int switchtec_fw_read(struct switchtec_dev *dev, unsigned long addr,
 		      size_t len, void *buf);
 void switchtec_fw_perror(const char *s, int ret);
@@ -894,6 +1307,46 @@ int switchtec_bind_info(struct switchtec_dev *dev,
 int switchtec_bind(struct switchtec_dev *dev, int par_id,
 		   int log_port, int phy_port);
 int switchtec_unbind(struct switchtec_dev *dev, int par_id, int log_port);
+
+/**
+ * @brief Change made to a port by a batch binding update
+ */
+enum switchtec_bind_op {
+	SWITCHTEC_BIND_OP_NONE,		//!< Already as desired
+	SWITCHTEC_BIND_OP_BIND,
+	SWITCHTEC_BIND_OP_UNBIND,
+	SWITCHTEC_BIND_OP_REBIND,	//!< Unbound, then bound elsewhere
+};
+
+/**
+ * @brief Return the name of a batch binding change
+ */
+static inline const char *switchtec_bind_op_str(enum switchtec_bind_op op)
+{
+	const char *str;
+
+	str =  (op == SWITCHTEC_BIND_OP_NONE) ? "none" :
+	       (op == SWITCHTEC_BIND_OP_BIND) ? "bind" :
+	       (op == SWITCHTEC_BIND_OP_UNBIND) ? "unbind" :
+	       (op == SWITCHTEC_BIND_OP_REBIND) ? "rebind" : "Unknown";
+
+	return str;
+}
+
+/**
+ * @brief Desired binding of one physical port
+ */
+struct switchtec_bind_map_entry {
+	int phys_port_id;
+	int par_id;			//!< Partition, -1 to leave unbound
+	int log_port_id;
+	enum switchtec_bind_op op;	//!< Set by switchtec_bind_apply()
+	int ret;			//!< Set by switchtec_bind_apply()
+};
+
+int switchtec_bind_apply(struct switchtec_dev *dev,
+			 struct switchtec_bind_map_entry *map, int nr,
+			 unsigned int timeout_ms);
 bool switchtec_stack_bif_port_valid(struct switchtec_dev *dev, int stack_id,
 				    int port_id);
 int switchtec_stack_bif_width(struct switchtec_dev *dev, int stack_id,
@@ -998,6 +1451,82 @@ int switchtec_evcntr_get_both(struct switchtec_dev *dev, unsigned stack_id,
 			      unsigned *counts, int clear);
 int switchtec_evcntr_wait(struct switchtec_dev *dev, int timeout_ms);
 
+#define SWITCHTEC_MAX_EVCNTRS \
+	(SWITCHTEC_MAX_STACKS * SWITCHTEC_MAX_EVENT_COUNTERS)
+
+/**
+ * @brief Counts of every configured event counter on every stack
+ *
+ * Entry \p i of each array describes the same counter. Entries are
+ * ordered by stack and then counter ID.
+ */
+struct switchtec_evcntr_snapshot {
+	uint64_t time_us;			//!< Host time of the last read
+	unsigned nr;				//!< Number of counters
+	int cleared;				//!< The last read cleared them
+	uint8_t stack_id[SWITCHTEC_MAX_EVCNTRS];
+	uint8_t cntr_id[SWITCHTEC_MAX_EVCNTRS];
+	unsigned port_mask[SWITCHTEC_MAX_EVCNTRS];
+	unsigned type_mask[SWITCHTEC_MAX_EVCNTRS];
+	unsigned count[SWITCHTEC_MAX_EVCNTRS];
+};
+
+int switchtec_evcntr_snapshot_setup(struct switchtec_dev *dev,
+				    struct switchtec_evcntr_snapshot *snap);
+int switchtec_evcntr_snapshot(struct switchtec_dev *dev,
+			      struct switchtec_evcntr_snapshot *snap,
+			      int clear);
+int switchtec_evcntr_snapshot_delta(const struct switchtec_evcntr_snapshot *new,
+				    const struct switchtec_evcntr_snapshot *old,
+				    unsigned *delta);
+
+/**
+ * @brief A threshold rule for switchtec_evcntr_alerts_add()
+ *
+ * A rule gets one counter for every combination of a selected port and
+ * one of its event types, because a counter can only raise a threshold
+ * event when it counts a single port and type.
+ */
+struct switchtec_evcntr_rule {
+	uint64_t port_mask;	//!< Physical ports to watch, 0 for all ports
+
+	/** @brief Event counter types to watch, each counted separately */
+	enum switchtec_evcntr_type_mask type_mask;
+	int egress;		//!< If 1, count egress, otherwise on ingress
+	unsigned threshold;	//!< Count that raises an alert
+};
+
+/**
+ * @brief A counter that reached its threshold
+ */
+struct switchtec_evcntr_alert {
+	struct switchtec_dev *dev;	//!< Device the counter is on
+	void *data;		//!< Pointer given to switchtec_evcntr_alerts_add()
+	int error;		//!< errno if the device failed, otherwise 0
+	int rule;		//!< Index of the rule that set up the counter
+	unsigned char stack_id;
+	unsigned char cntr_id;
+	struct switchtec_port_id port;	//!< Port the counter counts
+
+	/** @brief The single event type counted */
+	enum switchtec_evcntr_type_mask type_mask;
+	unsigned count;		//!< Count read when the alert was raised
+	unsigned threshold;
+	uint64_t time_us;	//!< Host time the alert was decoded
+};
+
+struct switchtec_evcntr_alerts;
+
+struct switchtec_evcntr_alerts *switchtec_evcntr_alerts_new(void);
+int switchtec_evcntr_alerts_add(struct switchtec_evcntr_alerts *al,
+				struct switchtec_dev *dev,
+				const struct switchtec_evcntr_rule *rules,
+				int nr_rules, void *data);
+int switchtec_evcntr_alerts_wait(struct switchtec_evcntr_alerts *al,
+				 struct switchtec_evcntr_alert *alerts,
+				 int max, int timeout_ms);
+void switchtec_evcntr_alerts_free(struct switchtec_evcntr_alerts *al);
+
 /********** BANDWIDTH COUNTER *********/
 
 /**
@@ -1028,6 +1557,37 @@ int switchtec_bwcntr_all(struct switchtec_dev *dev, int clear,
 			 struct switchtec_bwcntr_res **res);
 uint64_t switchtec_bwcntr_tot(struct switchtec_bwcntr_dir *d);
 
+/**
+ * @brief Bandwidth rates computed by the bandwidth sampler
+ */
+struct switchtec_bw_rate {
+	uint64_t time_us;		//!< Host time of the sample
+	struct switchtec_bw_rate_dir {
+		double posted;		//!< Posted TLP bytes per second
+		double comp;		//!< Completion TLP bytes per second
+		double nonposted;	//!< Non-Posted TLP bytes per second
+	} egress,			//!< Bandwidth out of the port
+	  ingress;			//!< Bandwidth into the port
+};
+
+struct switchtec_bw_sampler;
+
+struct switchtec_bw_sampler *
+switchtec_bw_sampler_start(struct switchtec_dev *dev, int nr_ports,
+			   int *phys_port_ids, int interval_ms, int depth,
+			   double ewma_alpha);
+void switchtec_bw_sampler_stop(struct switchtec_bw_sampler *s);
+int switchtec_bw_sampler_latest(struct switchtec_bw_sampler *s, int port,
+				struct switchtec_bw_rate *latest,
+				struct switchtec_bw_rate *ewma,
+				struct switchtec_bw_rate *peak);
+int switchtec_bw_sampler_history(struct switchtec_bw_sampler *s, int port,
+				 struct switchtec_bw_rate *rates, int max);
+int switchtec_bw_sampler_total(struct switchtec_bw_sampler *s, int port,
+			       struct switchtec_bwcntr_res *total);
+void switchtec_bw_sampler_reset(struct switchtec_bw_sampler *s);
+int switchtec_bw_sampler_error(struct switchtec_bw_sampler *s);
+
 /********** LATENCY COUNTER *********/
 
 #define SWITCHTEC_LAT_ALL_INGRESS 63
@@ -1043,6 +1603,38 @@ int switchtec_lat_get(struct switchtec_dev *dev, int clear,
 		      int egress_port_ids, int *cur_ns,
 		      int *max_ns);
 
+#define SWITCHTEC_LAT_HIST_SUB_BITS 4
+#define SWITCHTEC_LAT_HIST_BUCKETS \
+	((16 - SWITCHTEC_LAT_HIST_SUB_BITS + 1) << SWITCHTEC_LAT_HIST_SUB_BITS)
+
+/**
+ * @brief Log-linear histogram of latency values
+ *
+ * Values below 32 ns are exact, larger ones are grouped in buckets
+ * 1/16th of a power of two wide (about 6% relative precision).
+ */
+struct switchtec_lat_hist {
+	uint64_t count;		//!< Number of values recorded
+	int min_ns;		//!< Smallest value recorded
+	int max_ns;		//!< Largest value recorded
+	uint64_t buckets[SWITCHTEC_LAT_HIST_BUCKETS];
+};
+
+void switchtec_lat_hist_record(struct switchtec_lat_hist *h, int ns);
+int switchtec_lat_hist_percentile(const struct switchtec_lat_hist *h,
+				  double pct);
+
+struct switchtec_lat_collector;
+
+struct switchtec_lat_collector *
+switchtec_lat_collector_new(struct switchtec_dev *dev, int nr_pairs,
+			    int *egress_port_ids, int *ingress_port_ids);
+void switchtec_lat_collector_free(struct switchtec_lat_collector *c);
+int switchtec_lat_collector_sample(struct switchtec_lat_collector *c);
+int switchtec_lat_collector_hist(struct switchtec_lat_collector *c, int pair,
+				 const struct switchtec_lat_hist **cur,
+				 const struct switchtec_lat_hist **max);
+
 /********** GLOBAL ADDRESS SPACE ACCESS *********/
 
 /*
@@ -1160,6 +1752,7 @@ struct switchtec_mrpc {
 	const char *tag;
 	const char *desc;
 	bool reserved;
+	int poll_delay_us;	//!< Typical completion time, 0 if short
 };
 
 enum switchtec_diag_eye_data_mode {
@@ -1211,6 +1804,12 @@ int switchtec_diag_cross_hair_enable(struct switchtec_dev *dev, int lane_id);
 int switchtec_diag_cross_hair_disable(struct switchtec_dev *dev);
 int switchtec_diag_cross_hair_get(struct switchtec_dev *dev, int start_lane_id,
 		int num_lanes, struct switchtec_diag_cross_hair *res);
+int switchtec_diag_cross_hair_run(struct switchtec_dev *dev, const int *lanes,
+		int num_lanes, struct switchtec_diag_cross_hair *res,
+		void (*progress_callback)(int cur, int tot));
+int switchtec_diag_cross_hair_port(struct switchtec_dev *dev,
+		int phys_port_id, struct switchtec_diag_cross_hair *res,
+		int max_lanes, void (*progress_callback)(int cur, int tot));
 
 int switchtec_diag_eye_set_mode(struct switchtec_dev *dev,
 				enum switchtec_diag_eye_data_mode mode);
@@ -1221,6 +1820,31 @@ int switchtec_diag_eye_fetch(struct switchtec_dev *dev, double *pixels,
 			     size_t pixel_cnt, int *lane_id);
 int switchtec_diag_eye_cancel(struct switchtec_dev *dev);
 
+#define SWITCHTEC_DIAG_EYE_MAX_LANES 128
+
+struct switchtec_diag_eye_session;
+
+struct switchtec_diag_eye_session *
+switchtec_diag_eye_session_start(struct switchtec_dev *dev, int lane_mask[4],
+				 enum switchtec_diag_eye_data_mode mode,
+				 struct range *x_range, struct range *y_range,
+				 int step_interval, double *pixels);
+struct switchtec_diag_eye_session *
+switchtec_diag_eye_session_start_float(struct switchtec_dev *dev,
+				       int lane_mask[4],
+				       enum switchtec_diag_eye_data_mode mode,
+				       struct range *x_range,
+				       struct range *y_range,
+				       int step_interval, float *pixels);
+int switchtec_diag_eye_session_poll(struct switchtec_diag_eye_session *s);
+int switchtec_diag_eye_session_wait(struct switchtec_diag_eye_session *s,
+				    void (*progress_callback)(int cur, int tot));
+size_t switchtec_diag_eye_session_progress(struct switchtec_diag_eye_session *s,
+					   size_t *total);
+int switchtec_diag_eye_session_lanes(struct switchtec_diag_eye_session *s,
+				     int *lanes, int max);
+void switchtec_diag_eye_session_free(struct switchtec_diag_eye_session *s);
+
 int switchtec_diag_loopback_set(struct switchtec_dev *dev, int port_id,
 		int enable, enum switchtec_diag_ltssm_speed ltssm_speed);
 int switchtec_diag_loopback_get(struct switchtec_dev *dev, int port_id,
@@ -1237,6 +1861,56 @@ int switchtec_diag_pattern_mon_get(struct switchtec_dev *dev, int port_id,
 int switchtec_diag_pattern_inject(struct switchtec_dev *dev, int port_id,
 				  unsigned int err_cnt);
 
+enum switchtec_diag_ber_verdict {
+	SWITCHTEC_DIAG_BER_UNDECIDED,
+	SWITCHTEC_DIAG_BER_PASS,
+	SWITCHTEC_DIAG_BER_FAIL,
+};
+
+struct switchtec_diag_ber_lane {
+	int phys_port_id;
+	int lane_id;
+	int error;		//!< Result of the last monitor read
+	unsigned int read_errors;	//!< Monitor reads that failed
+	unsigned long long errors;
+	double bits;		//!< Bits covered by successful reads
+	double ber;
+	double ber_lower;	//!< Lower confidence bound of the BER
+	double ber_upper;	//!< Upper confidence bound of the BER
+	enum switchtec_diag_ber_verdict verdict;
+	double lane_bps;	//!< Bit rate the bit count is based on
+	unsigned long long last_count;	//!< Last raw monitor count
+	uint64_t last_read_us;	//!< Time of \p last_count, 0 if none yet
+};
+
+/**
+ * @brief Called after every poll of a BER test; return non-zero to stop
+ */
+typedef int (*switchtec_diag_ber_fn)(const struct switchtec_diag_ber_lane *lanes,
+				     int nr_lanes, void *data);
+
+struct switchtec_diag_ber_opts {
+	enum switchtec_diag_pattern pattern;
+	int loopback;		//!< switchtec_diag_loopback_enable flags
+	enum switchtec_diag_ltssm_speed ltssm_speed;
+	double lane_gbps;	//!< Lane rate, 0 to use the negotiated rate
+	double target_ber;	//!< 0 to always run for duration_ms
+	double confidence;	//!< Of each bound, 0 for 0.95
+	unsigned int settle_ms;	//!< Wait before counting starts
+	unsigned int poll_ms;
+	unsigned int duration_ms;
+	switchtec_diag_ber_fn cb;
+	void *data;
+};
+
+int switchtec_diag_ber_bounds(unsigned long long errors, double bits,
+			      double confidence, double *lower, double *upper);
+int switchtec_diag_ber_run(struct switchtec_dev *dev, const int *ports,
+			   int nr_ports,
+			   const struct switchtec_diag_ber_opts *opts,
+			   struct switchtec_diag_ber_lane *lanes,
+			   int max_lanes);
+
 int switchtec_diag_rcvr_obj(struct switchtec_dev *dev, int port_id,
 		int lane_id, enum switchtec_diag_link link,
 		struct switchtec_rcvr_obj *res);
@@ -1262,6 +1936,25 @@ int switchtec_diag_ltssm_log(struct switchtec_dev *dev,
 			     int port, int *log_count,
 			     struct switchtec_diag_ltssm_log *log_data);
 
+struct switchtec_diag_ltssm_capture_entry {
+	int port;
+	uint64_t host_time_us;
+	bool gap;		//!< Entries before this one may have been lost
+	struct switchtec_diag_ltssm_log log;
+};
+
+struct switchtec_diag_ltssm_capture;
+
+struct switchtec_diag_ltssm_capture *
+switchtec_diag_ltssm_capture_start(struct switchtec_dev *dev,
+				   const int *ports, int num_ports);
+int switchtec_diag_ltssm_capture_poll(struct switchtec_diag_ltssm_capture *c,
+		void (*callback)(void *arg,
+			const struct switchtec_diag_ltssm_capture_entry *ent,
+			int count),
+		void *arg);
+void switchtec_diag_ltssm_capture_free(struct switchtec_diag_ltssm_capture *c);
+
 int switchtec_aer_event_gen(struct switchtec_dev *dev, int port_id,
 				 int aer_error_id, int trigger_event);
 #ifdef __cplusplus
@@ -24,6 +24,8 @@
 
 #include "crc.h"
 
+#include <pthread.h>
+
 #define CRC32_WIDTH             (8 * sizeof(uint32_t))    /* in bits  */
 #define CRC32_INIT_REMAINDER	0xFFFFFFFF
 #define CRC32_FINAL_XOR_VALUE	0xFFFFFFFF
@@ -111,34 +113,164 @@ static const uint32_t crc32_lut[] =
 	0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
 };
 
+/*
+ * Slice-by-8 tables: entry [k][i] is the CRC contribution of byte i
+ * followed by k zero bytes, so eight bytes can be folded in with eight
+ * independent lookups. They are built once from the byte tables above.
+ */
+static uint8_t crc8_slice[8][256];
+static uint32_t crc32_slice[8][256];
+static int crc_use_slice;
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static uint8_t crc8_bytewise(const uint8_t *msg_ptr, uint32_t byte_cnt,
+			     uint8_t remainder)
+{
+	uint32_t offset;
+
+	for (offset = 0; offset < byte_cnt; offset++)
+		remainder = crc8_0107_lut[remainder ^ msg_ptr[offset]];
+
+	return remainder;
+}
+
+static uint8_t crc8_sliced(const uint8_t *p, uint32_t len, uint8_t r)
+{
+	while (len >= 8) {
+		r = crc8_slice[7][r ^ p[0]] ^ crc8_slice[6][p[1]] ^
+		    crc8_slice[5][p[2]] ^ crc8_slice[4][p[3]] ^
+		    crc8_slice[3][p[4]] ^ crc8_slice[2][p[5]] ^
+		    crc8_slice[1][p[6]] ^ crc8_slice[0][p[7]];
+		p += 8;
+		len -= 8;
+	}
+
+	return crc8_bytewise(p, len, r);
+}
+
+static uint32_t crc32_bytewise(const uint8_t *msg_ptr, uint32_t byte_cnt,
+			       uint32_t remainder)
+{
+	uint8_t  byte;
+	uint32_t offset;
+
+	for (offset = 0; offset < byte_cnt; offset++) {
+		byte = (remainder >> (CRC32_WIDTH - 8)) ^
+				msg_ptr[offset];
+		remainder = crc32_lut[byte] ^ (remainder << 8);
+	}
+
+	return remainder;
+}
+
+static uint32_t crc32_sliced(const uint8_t *p, uint32_t len, uint32_t r)
+{
+	while (len >= 8) {
+		r ^= (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+		     (uint32_t)p[2] << 8 | p[3];
+		r = crc32_slice[7][r >> 24] ^
+		    crc32_slice[6][(r >> 16) & 0xff] ^
+		    crc32_slice[5][(r >> 8) & 0xff] ^
+		    crc32_slice[4][r & 0xff] ^
+		    crc32_slice[3][p[4]] ^ crc32_slice[2][p[5]] ^
+		    crc32_slice[1][p[6]] ^ crc32_slice[0][p[7]];
+		p += 8;
+		len -= 8;
+	}
+
+	return crc32_bytewise(p, len, r);
+}
+
+/*
+ * Check the sliced versions against the standard check values and the
+ * byte-at-a-time versions; if anything disagrees they are not used.
+ */
+static int crc_self_test(void)
+{
+	static const uint8_t check[] = "123456789";
+	uint8_t buf[64];
+	int i, off;
+
+	if (crc8_sliced(check, 9, 0) != 0xF4)
+		return 0;
+
+	if ((crc32_sliced(check, 9, CRC32_INIT_REMAINDER) ^
+	     CRC32_FINAL_XOR_VALUE) != 0xFC891918)
+		return 0;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = i * 37 + 11;
+
+	for (off = 0; off < 8; off++) {
+		if (crc8_sliced(buf + off, sizeof(buf) - off, off) !=
+		    crc8_bytewise(buf + off, sizeof(buf) - off, off))
+			return 0;
+
+		if (crc32_sliced(buf + off, sizeof(buf) - off, ~off) !=
+		    crc32_bytewise(buf + off, sizeof(buf) - off, ~off))
+			return 0;
+	}
+
+	return 1;
+}
+
+static void crc_init(void)
+{
+	int i, k;
+
+	for (i = 0; i < 256; i++) {
+		crc8_slice[0][i] = crc8_0107_lut[i];
+		crc32_slice[0][i] = crc32_lut[i];
+	}
+
+	for (k = 1; k < 8; k++) {
+		for (i = 0; i < 256; i++) {
+			crc8_slice[k][i] =
+				crc8_0107_lut[crc8_slice[k - 1][i]];
+			crc32_slice[k][i] = (crc32_slice[k - 1][i] << 8) ^
+				crc32_lut[crc32_slice[k - 1][i] >> 24];
+		}
+	}
+
+	crc_use_slice = crc_self_test();
+}
+
+/* Short messages, such as I2C PEC bytes, stay on the byte loop */
+#define CRC_SLICE_MIN 16
+
 uint8_t crc8(uint8_t *msg_ptr, uint32_t byte_cnt, uint32_t oldchksum,
 	      bool init)
 {
-	uint32_t  offset;
 	uint8_t   remainder;
 
 	remainder = ((init == true) ? 0 : oldchksum);
 
-	for (offset = 0; offset < byte_cnt; offset++) {
-		remainder = crc8_0107_lut[remainder ^ msg_ptr[offset]];
-	}
+	if (byte_cnt < CRC_SLICE_MIN)
+		return crc8_bytewise(msg_ptr, byte_cnt, remainder);
 
-	return remainder;
+	pthread_once(&crc_once, crc_init);
+	if (!crc_use_slice)
+		return crc8_bytewise(msg_ptr, byte_cnt, remainder);
+
+	return crc8_sliced(msg_ptr, byte_cnt, remainder);
 }
 
 uint32_t crc32(const uint8_t *msg_ptr, uint32_t byte_cnt,
 	       uint32_t oldchksum, int init, int last)
 {
-	uint8_t  byte;
-	uint32_t offset;
 	uint32_t remainder;
 
 	remainder = (init) ? CRC32_INIT_REMAINDER : oldchksum;
 
-	for (offset = 0; offset < byte_cnt; offset++) {
-		byte = (remainder >> (CRC32_WIDTH - 8)) ^
-				msg_ptr[offset];
-		remainder = crc32_lut[byte] ^ (remainder << 8);
+	if (byte_cnt < CRC_SLICE_MIN) {
+		remainder = crc32_bytewise(msg_ptr, byte_cnt, remainder);
+	} else {
+		pthread_once(&crc_once, crc_init);
+		if (crc_use_slice)
+			remainder = crc32_sliced(msg_ptr, byte_cnt, remainder);
+		else
+			remainder = crc32_bytewise(msg_ptr, byte_cnt,
+						   remainder);
 	}
 
 	if (last)
@@ -31,14 +31,17 @@
 
 #include "switchtec_priv.h"
 #include "switchtec/diag.h"
+#include "switchtec/serdes.h"
 #include "switchtec/endian.h"
 #include "switchtec/switchtec.h"
 #include "switchtec/utils.h"
 
 #include <errno.h>
 #include <math.h>
+#include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <time.h>
 #include <unistd.h>
 
 /**
@@ -76,10 +79,11 @@ int switchtec_diag_cross_hair_disable(struct switchtec_dev *dev)
 }
 
 /**
- * @brief Disable active cross hair
+ * @brief Get cross hair results
  * @param[in]  dev		Switchtec device handle
  * @param[in]  start_lane_id	Start lane ID to get
- * @param[in]  num_lanes	Number of lanes to get
+ * @param[in]  num_lanes	Number of lanes to get (at most
+ *				SWITCHTEC_DIAG_CROSS_HAIR_MAX_LANES)
  * @param[out] res		Resulting cross hair data
  *
  * @return 0 on success, error code on failure
@@ -92,11 +96,16 @@ int switchtec_diag_cross_hair_get(struct switchtec_dev *dev, int start_lane_id,
 		.lane_id = start_lane_id,
 		.num_lanes = num_lanes,
 	};
-	struct switchtec_diag_cross_hair_get out[num_lanes];
+	struct switchtec_diag_cross_hair_get out[SWITCHTEC_DIAG_CROSS_HAIR_MAX_LANES];
 	int i, ret;
 
+	if (num_lanes <= 0 || num_lanes > SWITCHTEC_DIAG_CROSS_HAIR_MAX_LANES) {
+		errno = EINVAL;
+		return -1;
+	}
+
 	ret = switchtec_cmd(dev, MRPC_CROSS_HAIR, &in, sizeof(in), &out,
-			    sizeof(out));
+			    sizeof(out[0]) * num_lanes);
 	if (ret)
 		return ret;
 
@@ -127,6 +136,196 @@ int switchtec_diag_cross_hair_get(struct switchtec_dev *dev, int start_lane_id,
 	return 0;
 }
 
+#define CROSS_HAIR_POLL_MIN_US 10000
+#define CROSS_HAIR_POLL_MAX_US 200000
+
+static bool cross_hair_finished(enum switchtec_diag_cross_hair_state state)
+{
+	return state == SWITCHTEC_DIAG_CROSS_HAIR_DISABLED ||
+		state == SWITCHTEC_DIAG_CROSS_HAIR_DONE ||
+		state == SWITCHTEC_DIAG_CROSS_HAIR_ERROR;
+}
+
+/*
+ * Poll every lane in order[] (global lane IDs sorted ascending) that
+ * hasn't finished yet. Consecutive pending lanes are fetched with a
+ * single command. The number of lanes whose state changed is added
+ * to *changed.
+ */
+static int cross_hair_poll(struct switchtec_dev *dev, const int *lanes,
+			   const int *order, int num_lanes,
+			   struct switchtec_diag_cross_hair *res, int *changed)
+{
+	struct switchtec_diag_cross_hair out[SWITCHTEC_DIAG_CROSS_HAIR_MAX_LANES];
+	int i, j, n, ret;
+
+	for (i = 0; i < num_lanes; i += n) {
+		if (cross_hair_finished(res[order[i]].state)) {
+			n = 1;
+			continue;
+		}
+
+		for (n = 1; i + n < num_lanes &&
+		     n < SWITCHTEC_DIAG_CROSS_HAIR_MAX_LANES; n++) {
+			if (lanes[order[i + n]] != lanes[order[i]] + n ||
+			    cross_hair_finished(res[order[i + n]].state))
+				break;
+		}
+
+		ret = switchtec_diag_cross_hair_get(dev, lanes[order[i]], n,
+						    out);
+		if (ret)
+			return ret;
+
+		for (j = 0; j < n; j++) {
+			if (out[j].state != res[order[i + j]].state)
+				(*changed)++;
+			res[order[i + j]] = out[j];
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Run a cross hair measurement on a set of lanes to completion
+ * @param[in]  dev		Switchtec device handle
+ * @param[in]  lanes		Global lane IDs to measure
+ * @param[in]  num_lanes	Number of entries in lanes
+ * @param[out] res		Result for each entry in lanes
+ * @param[in]  progress_callback Called with the number of finished lanes
+ *	whenever a lane finishes. May be NULL.
+ *
+ * @return 0 on success, error code on failure
+ *
+ * The measurement is enabled (on all lanes when more than one lane is
+ * requested) and only lanes that have not yet reached
+ * SWITCHTEC_DIAG_CROSS_HAIR_DONE, SWITCHTEC_DIAG_CROSS_HAIR_ERROR or
+ * SWITCHTEC_DIAG_CROSS_HAIR_DISABLED are polled. The poll interval grows
+ * while no lane changes state. A lane that fails reports
+ * SWITCHTEC_DIAG_CROSS_HAIR_ERROR in its result without stopping the
+ * other lanes. The cross hair is disabled before returning.
+ */
+int switchtec_diag_cross_hair_run(struct switchtec_dev *dev, const int *lanes,
+		int num_lanes, struct switchtec_diag_cross_hair *res,
+		void (*progress_callback)(int cur, int tot))
+{
+	int order[SWITCHTEC_MAX_LANES];
+	int i, j, ret, changed, done, last_done = 0;
+	int poll_us = CROSS_HAIR_POLL_MIN_US;
+
+	if (num_lanes <= 0 || num_lanes > SWITCHTEC_MAX_LANES) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < num_lanes; i++) {
+		memset(&res[i], 0, sizeof(res[i]));
+		res[i].state = SWITCHTEC_DIAG_CROSS_HAIR_WAITING;
+		res[i].lane_id = lanes[i];
+
+		/* Insertion sort so adjacent lanes can be fetched together */
+		for (j = i; j > 0 && lanes[order[j - 1]] > lanes[i]; j--)
+			order[j] = order[j - 1];
+		order[j] = i;
+	}
+
+	switchtec_diag_cross_hair_disable(dev);
+
+	ret = switchtec_diag_cross_hair_enable(dev, num_lanes == 1 ? lanes[0] :
+					SWITCHTEC_DIAG_CROSS_HAIR_ALL_LANES);
+	if (ret)
+		return ret;
+
+	while (true) {
+		usleep(poll_us);
+
+		changed = 0;
+		ret = cross_hair_poll(dev, lanes, order, num_lanes, res,
+				      &changed);
+		if (ret)
+			break;
+
+		if (changed) {
+			poll_us = CROSS_HAIR_POLL_MIN_US;
+		} else {
+			poll_us *= 2;
+			if (poll_us > CROSS_HAIR_POLL_MAX_US)
+				poll_us = CROSS_HAIR_POLL_MAX_US;
+		}
+
+		for (done = 0, i = 0; i < num_lanes; i++)
+			if (cross_hair_finished(res[i].state))
+				done++;
+
+		if (done != last_done && progress_callback)
+			progress_callback(done, num_lanes);
+		last_done = done;
+
+		if (done == num_lanes)
+			break;
+	}
+
+	switchtec_diag_cross_hair_disable(dev);
+	return ret;
+}
+
+/**
+ * @brief Run a cross hair measurement on every lane of a port
+ * @param[in]  dev		Switchtec device handle
+ * @param[in]  phys_port_id	Physical port ID
+ * @param[out] res		Result for each lane of the port, indexed by
+ *				the lane number within the port
+ * @param[in]  max_lanes	Number of entries available in res
+ * @param[in]  progress_callback Called with the number of finished lanes
+ *	whenever a lane finishes. May be NULL.
+ *
+ * @return The number of lanes measured, or a negative value on failure
+ *	(with errno set)
+ *
+ * See switchtec_diag_cross_hair_run() for how the lanes are polled.
+ */
+int switchtec_diag_cross_hair_port(struct switchtec_dev *dev,
+		int phys_port_id, struct switchtec_diag_cross_hair *res,
+		int max_lanes, void (*progress_callback)(int cur, int tot))
+{
+	const struct switchtec_topo_port *port;
+	const struct switchtec_topo *topo;
+	int lanes[SWITCHTEC_MAX_LANES];
+	int l, num_lanes, ret;
+
+	topo = switchtec_topo(dev);
+	if (!topo)
+		return -1;
+
+	port = switchtec_topo_find_port(topo, phys_port_id);
+	if (!port)
+		return -1;
+
+	num_lanes = port->neg_lnk_width;
+	if (num_lanes > max_lanes || num_lanes > SWITCHTEC_MAX_LANES) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (l = 0; l < num_lanes; l++) {
+		lanes[l] = switchtec_topo_lane_id(topo, phys_port_id, l);
+		if (lanes[l] < 0)
+			return -1;
+	}
+
+	ret = switchtec_diag_cross_hair_run(dev, lanes, num_lanes, res,
+					    progress_callback);
+	if (ret > 0) {
+		errno = ret;
+		return -1;
+	}
+	if (ret < 0)
+		return ret;
+
+	return num_lanes;
+}
+
 static int switchtec_diag_eye_status(int status)
 {
 	switch (status) {
@@ -230,6 +429,146 @@ static uint64_t hi_lo_to_uint64(uint32_t lo, uint32_t hi)
 	return ret;
 }
 
+/*
+ * Issue one eye fetch. Returns 0 with the data in out, 1 if the capture
+ * has no data ready yet, or an error code.
+ */
+static int eye_fetch_once(struct switchtec_dev *dev,
+			  struct switchtec_diag_port_eye_fetch *out)
+{
+	struct switchtec_diag_port_eye_cmd in = {
+		.sub_cmd = MRPC_EYE_OBSERVE_FETCH,
+	};
+	int ret;
+
+	ret = switchtec_cmd(dev, MRPC_EYE_OBSERVE, &in, sizeof(in), out,
+			    sizeof(*out));
+	if (ret)
+		return ret;
+
+	if (out->status == 1)
+		return 1;
+
+	return switchtec_diag_eye_status(out->status);
+}
+
+static int eye_data_count(struct switchtec_diag_port_eye_fetch *out)
+{
+	return out->data_count_lo | ((int)out->data_count_hi << 8);
+}
+
+static inline double eye_raw_pixel(uint32_t err_lo, uint32_t err_hi,
+				   uint32_t smp_lo, uint32_t smp_hi)
+{
+	uint64_t errors = hi_lo_to_uint64(err_lo, err_hi);
+	uint64_t samples = hi_lo_to_uint64(smp_lo, smp_hi);
+
+	return samples ? (double)errors / samples : NAN;
+}
+
+/*
+ * Ratio pixels are 16-bit fixed point, so eight of them can be widened
+ * and scaled per SSE2 step. The ratio data in a fetch is little endian,
+ * as are all SSE2 targets.
+ */
+#ifdef __SSE2__
+#include <emmintrin.h>
+
+static size_t eye_ratio_sse2(const uint16_t *ratio, size_t cnt,
+			     double *pixels, float *fpixels)
+{
+	const __m128d scale_d = _mm_set1_pd(1.0 / 65536);
+	const __m128 scale_f = _mm_set1_ps(1.0f / 65536);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v, lo, hi;
+	size_t i;
+
+	for (i = 0; i + 8 <= cnt; i += 8) {
+		v = _mm_loadu_si128((const __m128i *)&ratio[i]);
+		lo = _mm_unpacklo_epi16(v, zero);
+		hi = _mm_unpackhi_epi16(v, zero);
+
+		if (fpixels) {
+			_mm_storeu_ps(&fpixels[i],
+				_mm_mul_ps(_mm_cvtepi32_ps(lo), scale_f));
+			_mm_storeu_ps(&fpixels[i + 4],
+				_mm_mul_ps(_mm_cvtepi32_ps(hi), scale_f));
+			continue;
+		}
+
+		_mm_storeu_pd(&pixels[i],
+			_mm_mul_pd(_mm_cvtepi32_pd(lo), scale_d));
+		_mm_storeu_pd(&pixels[i + 2],
+			_mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(lo, 8)),
+				   scale_d));
+		_mm_storeu_pd(&pixels[i + 4],
+			_mm_mul_pd(_mm_cvtepi32_pd(hi), scale_d));
+		_mm_storeu_pd(&pixels[i + 6],
+			_mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(hi, 8)),
+				   scale_d));
+	}
+
+	return i;
+}
+#else
+static size_t eye_ratio_sse2(const uint16_t *ratio, size_t cnt,
+			     double *pixels, float *fpixels)
+{
+	return 0;
+}
+#endif
+
+/*
+ * Convert the pixels of one fetch. The data mode is checked once per
+ * fetch rather than once per pixel. Ratio data goes through the SSE2
+ * path where there is one, leaving only the tail for the scalar loop.
+ * Raw data is bounded by the 64-bit integer to double conversion, which
+ * most targets can only vectorize with AVX-512, so it stays scalar.
+ */
+static void eye_convert(struct switchtec_diag_port_eye_fetch *out,
+			double *pixels, size_t pixel_cnt)
+{
+	size_t i, cnt = eye_data_count(out);
+
+	if (cnt > pixel_cnt)
+		cnt = pixel_cnt;
+
+	if (out->data_mode == SWITCHTEC_DIAG_EYE_RAW) {
+		for (i = 0; i < cnt; i++)
+			pixels[i] = eye_raw_pixel(out->raw[i].error_cnt_lo,
+						  out->raw[i].error_cnt_hi,
+						  out->raw[i].sample_cnt_lo,
+						  out->raw[i].sample_cnt_hi);
+	} else if (out->data_mode == SWITCHTEC_DIAG_EYE_RATIO) {
+		i = eye_ratio_sse2(&out->ratio[0].ratio, cnt, pixels, NULL);
+		for (; i < cnt; i++)
+			pixels[i] = le16toh(out->ratio[i].ratio) *
+				(1.0 / 65536);
+	}
+}
+
+static void eye_convert_float(struct switchtec_diag_port_eye_fetch *out,
+			      float *pixels, size_t pixel_cnt)
+{
+	size_t i, cnt = eye_data_count(out);
+
+	if (cnt > pixel_cnt)
+		cnt = pixel_cnt;
+
+	if (out->data_mode == SWITCHTEC_DIAG_EYE_RAW) {
+		for (i = 0; i < cnt; i++)
+			pixels[i] = eye_raw_pixel(out->raw[i].error_cnt_lo,
+						  out->raw[i].error_cnt_hi,
+						  out->raw[i].sample_cnt_lo,
+						  out->raw[i].sample_cnt_hi);
+	} else if (out->data_mode == SWITCHTEC_DIAG_EYE_RATIO) {
+		i = eye_ratio_sse2(&out->ratio[0].ratio, cnt, NULL, pixels);
+		for (; i < cnt; i++)
+			pixels[i] = le16toh(out->ratio[i].ratio) *
+				(1.0f / 65536);
+	}
+}
+
 /**
  * @brief Start a PCIe Eye Capture
  * @param[in]  dev	       Switchtec device handle
@@ -246,25 +585,12 @@ static uint64_t hi_lo_to_uint64(uint32_t lo, uint32_t hi)
 int switchtec_diag_eye_fetch(struct switchtec_dev *dev, double *pixels,
 			     size_t pixel_cnt, int *lane_id)
 {
-	struct switchtec_diag_port_eye_cmd in = {
-		.sub_cmd = MRPC_EYE_OBSERVE_FETCH,
-	};
 	struct switchtec_diag_port_eye_fetch out;
-	uint64_t samples, errors;
-	int i, ret, data_count;
-
-retry:
-	ret = switchtec_cmd(dev, MRPC_EYE_OBSERVE, &in, sizeof(in), &out,
-			    sizeof(out));
-	if (ret)
-		return ret;
+	int i, ret;
 
-	if (out.status == 1) {
+	while ((ret = eye_fetch_once(dev, &out)) == 1)
 		usleep(5000);
-		goto retry;
-	}
 
-	ret = switchtec_diag_eye_status(out.status);
 	if (ret)
 		return ret;
 
@@ -274,27 +600,290 @@ retry:
 			break;
 	}
 
-	data_count = out.data_count_lo | ((int)out.data_count_hi << 8);
+	eye_convert(&out, pixels, pixel_cnt);
 
-	for (i = 0; i < data_count && i < pixel_cnt; i++) {
-		switch (out.data_mode) {
-		case SWITCHTEC_DIAG_EYE_RAW:
-			errors = hi_lo_to_uint64(out.raw[i].error_cnt_lo,
-						 out.raw[i].error_cnt_hi);
-			samples = hi_lo_to_uint64(out.raw[i].sample_cnt_lo,
-						  out.raw[i].sample_cnt_hi);
-			if (samples)
-				pixels[i] = (double)errors / samples;
-			else
-				pixels[i] = nan("");
-			break;
-		case SWITCHTEC_DIAG_EYE_RATIO:
-			pixels[i] = le32toh(out.ratio[i].ratio) / 65536.;
+	return eye_data_count(&out);
+}
+
+#define EYE_POLL_MIN_US 1000
+#define EYE_POLL_MAX_US 20000
+
+/*
+ * An eye capture running on several lanes at once. The pixels of each
+ * lane go to their own block of the caller's buffer, in lane order.
+ */
+struct switchtec_diag_eye_session {
+	struct switchtec_dev *dev;
+	double *pixels;
+	float *fpixels;
+	size_t stride;
+	size_t fetched;
+	size_t total;
+	int nr_lanes;
+	int lanes[SWITCHTEC_DIAG_EYE_MAX_LANES];
+	int block[SWITCHTEC_DIAG_EYE_MAX_LANES];
+	size_t lane_cnt[SWITCHTEC_DIAG_EYE_MAX_LANES];
+	unsigned int poll_us;
+};
+
+static struct switchtec_diag_eye_session *
+eye_session_start(struct switchtec_dev *dev, int lane_mask[4],
+		  enum switchtec_diag_eye_data_mode mode,
+		  struct range *x_range, struct range *y_range,
+		  int step_interval, double *pixels, float *fpixels)
+{
+	struct switchtec_diag_eye_session *s;
+	int i;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->dev = dev;
+	s->pixels = pixels;
+	s->fpixels = fpixels;
+	s->stride = RANGE_CNT(x_range) * RANGE_CNT(y_range);
+	s->poll_us = EYE_POLL_MIN_US;
+
+	for (i = 0; i < SWITCHTEC_DIAG_EYE_MAX_LANES; i++) {
+		s->block[i] = -1;
+		if (!(lane_mask[i / 32] & (1u << (i % 32))))
+			continue;
+
+		s->block[i] = s->nr_lanes;
+		s->lanes[s->nr_lanes++] = i;
+	}
+
+	if (!s->nr_lanes) {
+		errno = EINVAL;
+		goto err_free;
+	}
+
+	s->total = s->stride * s->nr_lanes;
+
+	if (switchtec_diag_eye_set_mode(dev, mode))
+		goto err_free;
+
+	if (switchtec_diag_eye_start(dev, lane_mask, x_range, y_range,
+				     step_interval))
+		goto err_free;
+
+	return s;
+
+err_free:
+	free(s);
+	return NULL;
+}
+
+/**
+ * @brief Start an eye capture on several lanes
+ * @param[in]  dev	       Switchtec device handle
+ * @param[in]  lane_mask       Bitmap of the lanes to capture
+ * @param[in]  mode	       Data mode to use (raw or ratio)
+ * @param[in]  x_range         Time range (see switchtec_diag_eye_start())
+ * @param[in]  y_range         Voltage range (see switchtec_diag_eye_start())
+ * @param[in]  step_interval   Sampling time in milliseconds for each step
+ * @param[out] pixels          Buffer for the results: one block of
+ *	RANGE_CNT(x_range) * RANGE_CNT(y_range) pixels for each lane in
+ *	lane_mask, lowest lane first
+ *
+ * @return the session on success, NULL on failure (with errno set)
+ *
+ * All the lanes are captured at the same time. Results are collected
+ * with switchtec_diag_eye_session_poll() or
+ * switchtec_diag_eye_session_wait() and the session must be freed with
+ * switchtec_diag_eye_session_free().
+ */
+struct switchtec_diag_eye_session *
+switchtec_diag_eye_session_start(struct switchtec_dev *dev, int lane_mask[4],
+				 enum switchtec_diag_eye_data_mode mode,
+				 struct range *x_range, struct range *y_range,
+				 int step_interval, double *pixels)
+{
+	return eye_session_start(dev, lane_mask, mode, x_range, y_range,
+				 step_interval, pixels, NULL);
+}
+
+/**
+ * @brief Start an eye capture on several lanes, with single precision
+ *	results
+ * @param[in]  dev	       Switchtec device handle
+ * @param[in]  lane_mask       Bitmap of the lanes to capture
+ * @param[in]  mode	       Data mode to use (raw or ratio)
+ * @param[in]  x_range         Time range (see switchtec_diag_eye_start())
+ * @param[in]  y_range         Voltage range (see switchtec_diag_eye_start())
+ * @param[in]  step_interval   Sampling time in milliseconds for each step
+ * @param[out] pixels          Buffer for the results, laid out as for
+ *	switchtec_diag_eye_session_start()
+ *
+ * @return the session on success, NULL on failure (with errno set)
+ *
+ * This is the same as switchtec_diag_eye_session_start() but stores
+ * the pixels as floats, halving the memory needed for the results.
+ */
+struct switchtec_diag_eye_session *
+switchtec_diag_eye_session_start_float(struct switchtec_dev *dev,
+				       int lane_mask[4],
+				       enum switchtec_diag_eye_data_mode mode,
+				       struct range *x_range,
+				       struct range *y_range,
+				       int step_interval, float *pixels)
+{
+	return eye_session_start(dev, lane_mask, mode, x_range, y_range,
+				 step_interval, NULL, pixels);
+}
+
+/**
+ * @brief Collect any eye capture data that is ready
+ * @param[in]  s	       Eye capture session
+ *
+ * @return 0 on success (whether or not there was data), error code on
+ *	failure
+ *
+ * This issues a single fetch and doesn't wait. Use
+ * switchtec_diag_eye_session_progress() to see how much data has been
+ * collected.
+ */
+int switchtec_diag_eye_session_poll(struct switchtec_diag_eye_session *s)
+{
+	struct switchtec_diag_port_eye_fetch out;
+	int i, lane = -1, blk, ret;
+	size_t room, cnt;
+
+	if (s->fetched >= s->total)
+		return 0;
+
+	ret = eye_fetch_once(s->dev, &out);
+	if (ret == 1)
+		return 0;
+	if (ret)
+		return ret;
+
+	for (i = 0; i < 4; i++) {
+		if (out.lane_mask[i]) {
+			lane = i * 32 + ffs(out.lane_mask[i]) - 1;
 			break;
 		}
 	}
 
-	return data_count;
+	cnt = eye_data_count(&out);
+	if (!cnt) {
+		/* the capture produced nothing for the lanes requested */
+		errno = ENODATA;
+		return -ENODATA;
+	}
+
+	if (lane < 0 || s->block[lane] < 0)
+		return 0;
+
+	blk = s->block[lane];
+	room = s->stride - s->lane_cnt[blk];
+	if (cnt > room)
+		cnt = room;
+
+	if (s->fpixels)
+		eye_convert_float(&out, &s->fpixels[blk * s->stride +
+						   s->lane_cnt[blk]], cnt);
+	else
+		eye_convert(&out, &s->pixels[blk * s->stride +
+					     s->lane_cnt[blk]], cnt);
+	s->lane_cnt[blk] += cnt;
+	s->fetched += cnt;
+
+	return 0;
+}
+
+/**
+ * @brief Collect eye capture data until every lane is complete
+ * @param[in]  s	       Eye capture session
+ * @param[in]  progress_callback Called with the number of pixels
+ *	collected so far whenever new data arrives. May be NULL.
+ *
+ * @return 0 on success, error code on failure
+ *
+ * The device is polled quickly while it is producing data and
+ * progressively less often while it isn't.
+ */
+int switchtec_diag_eye_session_wait(struct switchtec_diag_eye_session *s,
+				    void (*progress_callback)(int cur, int tot))
+{
+	size_t before;
+	int ret;
+
+	while (s->fetched < s->total) {
+		before = s->fetched;
+
+		ret = switchtec_diag_eye_session_poll(s);
+		if (ret)
+			return ret;
+
+		if (s->fetched != before) {
+			s->poll_us = EYE_POLL_MIN_US;
+			if (progress_callback)
+				progress_callback(s->fetched, s->total);
+			continue;
+		}
+
+		usleep(s->poll_us);
+		s->poll_us *= 2;
+		if (s->poll_us > EYE_POLL_MAX_US)
+			s->poll_us = EYE_POLL_MAX_US;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Get the progress of an eye capture session
+ * @param[in]  s	       Eye capture session
+ * @param[out] total	       Total number of pixels expected (may be NULL)
+ *
+ * @return the number of pixels collected so far
+ */
+size_t switchtec_diag_eye_session_progress(struct switchtec_diag_eye_session *s,
+					   size_t *total)
+{
+	if (total)
+		*total = s->total;
+
+	return s->fetched;
+}
+
+/**
+ * @brief Get the lanes of an eye capture session
+ * @param[in]  s	       Eye capture session
+ * @param[out] lanes	       The lane of each block of the pixel buffer
+ *	(may be NULL)
+ * @param[in]  max	       Space in the lanes array
+ *
+ * @return the number of lanes in the session
+ */
+int switchtec_diag_eye_session_lanes(struct switchtec_diag_eye_session *s,
+				     int *lanes, int max)
+{
+	int i;
+
+	for (i = 0; lanes && i < s->nr_lanes && i < max; i++)
+		lanes[i] = s->lanes[i];
+
+	return s->nr_lanes;
+}
+
+/**
+ * @brief Finish an eye capture session
+ * @param[in]  s	       Eye capture session
+ *
+ * The capture is cancelled if it hasn't completed.
+ */
+void switchtec_diag_eye_session_free(struct switchtec_diag_eye_session *s)
+{
+	if (!s)
+		return;
+
+	if (s->fetched < s->total)
+		switchtec_diag_eye_cancel(s->dev);
+
+	free(s);
 }
 
 /**
@@ -565,291 +1154,1668 @@ int switchtec_diag_pattern_inject(struct switchtec_dev *dev, int port_id,
 	return 0;
 }
 
-/**
- * @brief Get the receiver object
- * @param[in]  dev	Switchtec device handle
- * @param[in]  port_id	Physical port ID
- * @param[in]  lane_id  Lane ID
- * @param[in]  link     Current or previous link-up
- * @param[out] res      Resulting receiver object
- *
- * @return 0 on success, error code on failure
+static double ber_poisson_cdf(unsigned long long k, double lambda)
+{
+	double sum = 0;
+	unsigned long long i;
+
+	if (lambda <= 0)
+		return 1;
+
+	for (i = 0; i <= k; i++)
+		sum += exp(-lambda + i * log(lambda) - lgamma(i + 1.0));
+
+	return sum;
+}
+
+/* Smallest lambda for which P(X <= k) drops to p */
+static double ber_poisson_lambda(unsigned long long k, double p)
+{
+	double lo = 0, hi = k + 10 * sqrt(k + 1.0) + 50, mid;
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		mid = (lo + hi) / 2;
+		if (ber_poisson_cdf(k, mid) > p)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return (lo + hi) / 2;
+}
+
+static double ber_normal_quantile(double p)
+{
+	double lo = -40, hi = 40, mid;
+	int i;
+
+	for (i = 0; i < 100; i++) {
+		mid = (lo + hi) / 2;
+		if (0.5 * erfc(-mid / sqrt(2)) < p)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return (lo + hi) / 2;
+}
+
+/* Wilson-Hilferty approximation of the chi-square quantile */
+static double ber_chi2_quantile(double dof, double p)
+{
+	double a = 2 / (9 * dof);
+	double t = 1 - a + ber_normal_quantile(p) * sqrt(a);
+
+	return t > 0 ? dof * t * t * t : 0;
+}
+
+#define BER_EXACT_MAX_ERRORS 100
+
+/**
+ * @brief Compute confidence bounds of a bit error rate
+ * @param[in]  errors		Errors counted
+ * @param[in]  bits		Bits checked
+ * @param[in]  confidence	Confidence level of each bound, e.g. 0.95
+ * @param[out] lower		The true BER is above this with the given
+ *				confidence (may be NULL)
+ * @param[out] upper		The true BER is below this with the given
+ *				confidence (may be NULL)
+ * @return 0 on success, or -1 with errno set to EINVAL
+ *
+ * Errors are treated as a Poisson process. For up to 100 errors the
+ * bounds are exact; above that the Wilson-Hilferty approximation of
+ * the chi-square quantiles is used, which is well within 1% there.
+ * With no errors the lower bound is 0 and the upper bound is the
+ * familiar -ln(1 - confidence) / bits.
+ */
+int switchtec_diag_ber_bounds(unsigned long long errors, double bits,
+			      double confidence, double *lower, double *upper)
+{
+	double lambda_lo, lambda_hi;
+
+	if (bits <= 0 || confidence <= 0 || confidence >= 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (errors <= BER_EXACT_MAX_ERRORS) {
+		lambda_hi = ber_poisson_lambda(errors, 1 - confidence);
+		lambda_lo = errors ?
+			ber_poisson_lambda(errors - 1, confidence) : 0;
+	} else {
+		lambda_hi = ber_chi2_quantile(2.0 * errors + 2,
+					      confidence) / 2;
+		lambda_lo = ber_chi2_quantile(2.0 * errors,
+					      1 - confidence) / 2;
+	}
+
+	if (lower)
+		*lower = lambda_lo / bits;
+	if (upper)
+		*upper = lambda_hi / bits;
+
+	return 0;
+}
+
+/* Bits per second per lane for each link rate */
+static const double ber_lane_bps[] = {
+	0, 2.5e9, 5e9, 8e9, 16e9, 32e9, 64e9,
+};
+
+struct ber_port_cmds {
+	struct switchtec_diag_loopback_in lb_rx;
+	struct switchtec_diag_loopback_in lb_tx;
+	struct switchtec_diag_loopback_ltssm_in lb_ltssm;
+	struct switchtec_diag_pat_gen_in gen;
+	struct switchtec_diag_pat_gen_in mon;
+};
+
+#define BER_CMDS_PER_PORT 5
+
+/*
+ * Set up (or with pattern SWITCHTEC_DIAG_PATTERN_PRBS_DISABLED, tear
+ * down) loopback, the generator and the monitor of every port in one
+ * batch of commands.
+ */
+static int ber_setup(struct switchtec_dev *dev, const int *ports,
+		     int nr_ports, int loopback,
+		     enum switchtec_diag_ltssm_speed speed,
+		     enum switchtec_diag_pattern pattern)
+{
+	struct switchtec_cmd_desc *desc;
+	struct ber_port_cmds *c;
+	int i, n = 0, ret;
+
+	c = calloc(nr_ports, sizeof(*c));
+	desc = calloc(nr_ports * BER_CMDS_PER_PORT, sizeof(*desc));
+	if (!c || !desc) {
+		free(c);
+		free(desc);
+		return -1;
+	}
+
+	for (i = 0; i < nr_ports; i++) {
+		c[i].lb_rx = (struct switchtec_diag_loopback_in) {
+			.sub_cmd = MRPC_LOOPBACK_SET_INT_LOOPBACK,
+			.port_id = ports[i],
+			.enable = !!(loopback & SWITCHTEC_DIAG_LOOPBACK_RX_TO_TX),
+			.type = DIAG_LOOPBACK_RX_TO_TX,
+		};
+		c[i].lb_tx = (struct switchtec_diag_loopback_in) {
+			.sub_cmd = MRPC_LOOPBACK_SET_INT_LOOPBACK,
+			.port_id = ports[i],
+			.enable = !!(loopback & SWITCHTEC_DIAG_LOOPBACK_TX_TO_RX),
+			.type = DIAG_LOOPBACK_TX_TO_RX,
+		};
+		c[i].lb_ltssm = (struct switchtec_diag_loopback_ltssm_in) {
+			.sub_cmd = MRPC_LOOPBACK_SET_LTSSM_LOOPBACK,
+			.port_id = ports[i],
+			.enable = !!(loopback & SWITCHTEC_DIAG_LOOPBACK_LTSSM),
+			.speed = speed,
+		};
+		c[i].gen = (struct switchtec_diag_pat_gen_in) {
+			.sub_cmd = MRPC_PAT_GEN_SET_GEN,
+			.port_id = ports[i],
+			.pattern_type = pattern,
+		};
+		c[i].mon = (struct switchtec_diag_pat_gen_in) {
+			.sub_cmd = MRPC_PAT_GEN_SET_MON,
+			.port_id = ports[i],
+			.pattern_type = pattern,
+		};
+
+		/* Loopback goes up before, and down after, the pattern */
+		if (!loopback || pattern != SWITCHTEC_DIAG_PATTERN_PRBS_DISABLED) {
+			if (loopback) {
+				desc[n++] = (struct switchtec_cmd_desc) {
+					MRPC_INT_LOOPBACK, &c[i].lb_rx,
+					sizeof(c[i].lb_rx) };
+				desc[n++] = (struct switchtec_cmd_desc) {
+					MRPC_INT_LOOPBACK, &c[i].lb_tx,
+					sizeof(c[i].lb_tx) };
+				desc[n++] = (struct switchtec_cmd_desc) {
+					MRPC_INT_LOOPBACK, &c[i].lb_ltssm,
+					sizeof(c[i].lb_ltssm) };
+			}
+			desc[n++] = (struct switchtec_cmd_desc) {
+				MRPC_PAT_GEN, &c[i].gen, sizeof(c[i].gen) };
+			desc[n++] = (struct switchtec_cmd_desc) {
+				MRPC_PAT_GEN, &c[i].mon, sizeof(c[i].mon) };
+		} else {
+			desc[n++] = (struct switchtec_cmd_desc) {
+				MRPC_PAT_GEN, &c[i].gen, sizeof(c[i].gen) };
+			desc[n++] = (struct switchtec_cmd_desc) {
+				MRPC_PAT_GEN, &c[i].mon, sizeof(c[i].mon) };
+			desc[n++] = (struct switchtec_cmd_desc) {
+				MRPC_INT_LOOPBACK, &c[i].lb_rx,
+				sizeof(c[i].lb_rx) };
+			desc[n++] = (struct switchtec_cmd_desc) {
+				MRPC_INT_LOOPBACK, &c[i].lb_tx,
+				sizeof(c[i].lb_tx) };
+			desc[n++] = (struct switchtec_cmd_desc) {
+				MRPC_INT_LOOPBACK, &c[i].lb_ltssm,
+				sizeof(c[i].lb_ltssm) };
+		}
+	}
+
+	ret = switchtec_cmd_batch(dev, desc, n);
+
+	free(c);
+	free(desc);
+	return ret;
+}
+
+/* Read the monitor of every lane in one batch of commands */
+static int ber_read(struct switchtec_dev *dev,
+		    struct switchtec_diag_ber_lane *lanes, int nr_lanes,
+		    unsigned long long *counts)
+{
+	struct switchtec_diag_pat_gen_out *out;
+	struct switchtec_diag_pat_gen_in *in;
+	struct switchtec_cmd_desc *desc;
+	int i, ret;
+
+	in = calloc(nr_lanes, sizeof(*in));
+	out = calloc(nr_lanes, sizeof(*out));
+	desc = calloc(nr_lanes, sizeof(*desc));
+	if (!in || !out || !desc) {
+		ret = -1;
+		goto out;
+	}
+
+	for (i = 0; i < nr_lanes; i++) {
+		in[i] = (struct switchtec_diag_pat_gen_in) {
+			.sub_cmd = MRPC_PAT_GEN_GET_MON,
+			.port_id = lanes[i].phys_port_id,
+			.lane_id = lanes[i].lane_id,
+		};
+		desc[i] = (struct switchtec_cmd_desc) {
+			.cmd = MRPC_PAT_GEN,
+			.payload = &in[i],
+			.payload_len = sizeof(in[i]),
+			.resp = &out[i],
+			.resp_len = sizeof(out[i]),
+		};
+	}
+
+	ret = switchtec_cmd_batch(dev, desc, nr_lanes);
+	if (ret < 0)
+		goto out;
+
+	for (i = 0; i < nr_lanes; i++) {
+		lanes[i].error = desc[i].ret;
+		if (!desc[i].ret)
+			counts[i] = le32toh(out[i].err_cnt_lo) |
+				((uint64_t)le32toh(out[i].err_cnt_hi) << 32);
+	}
+	ret = 0;
+
+out:
+	free(in);
+	free(out);
+	free(desc);
+	return ret;
+}
+
+/*
+ * Account for a monitor read taken at now. Errors and bits are only
+ * credited between two successful reads, and a lane whose last read
+ * failed stays undecided.
+ */
+static void ber_update(struct switchtec_diag_ber_lane *l,
+		       const struct switchtec_diag_ber_opts *opts,
+		       double confidence, unsigned long long count,
+		       uint64_t now)
+{
+	if (l->error) {
+		l->read_errors++;
+		l->verdict = SWITCHTEC_DIAG_BER_UNDECIDED;
+		return;
+	}
+
+	if (l->last_read_us) {
+		/* A count that went backwards restarted from zero */
+		if (count >= l->last_count)
+			l->errors += count - l->last_count;
+		else
+			l->errors += count;
+		l->bits += l->lane_bps * (now - l->last_read_us) / 1e6;
+	}
+
+	l->last_count = count;
+	l->last_read_us = now;
+
+	if (l->bits <= 0)
+		return;
+
+	l->ber = l->errors / l->bits;
+	switchtec_diag_ber_bounds(l->errors, l->bits, confidence,
+				  &l->ber_lower, &l->ber_upper);
+
+	if (opts->target_ber <= 0)
+		l->verdict = SWITCHTEC_DIAG_BER_UNDECIDED;
+	else if (l->ber_upper < opts->target_ber)
+		l->verdict = SWITCHTEC_DIAG_BER_PASS;
+	else if (l->ber_lower > opts->target_ber)
+		l->verdict = SWITCHTEC_DIAG_BER_FAIL;
+	else
+		l->verdict = SWITCHTEC_DIAG_BER_UNDECIDED;
+}
+
+/**
+ * @brief Run a bit error rate test on several ports at once
+ * @param[in]  dev	 Switchtec device handle
+ * @param[in]  ports	 Physical port IDs to test
+ * @param[in]  nr_ports	 Number of entries in \p ports
+ * @param[in]  opts	 Test settings
+ * @param[out] lanes	 Result for every configured lane of every port,
+ *			 ordered by port and then lane
+ * @param[in]  max_lanes Number of entries in \p lanes
+ *
+ * @return The number of lanes tested, or -1 on failure with errno set
+ *	(MRPC errors are flagged with SWITCHTEC_ERRNO_MRPC_FLAG_BIT)
+ *
+ * Loopback, the pattern generator and the pattern monitor of all the
+ * ports are configured in one batch of commands. After \p opts->settle_ms
+ * the monitor counts are taken as the starting point, and from then on
+ * every lane is read in one batch every \p opts->poll_ms. The bit count
+ * of each lane is its bit rate times the time between its successful
+ * reads; a lane whose last read failed is left undecided.
+ *
+ * With a target BER, a lane passes once the upper confidence bound of
+ * its BER is below the target, and fails once the lower bound is above
+ * it. The test ends early when every lane has passed or failed, and
+ * otherwise after \p opts->duration_ms. The generators, monitors and
+ * any loopback set up are disabled again before returning.
+ */
+int switchtec_diag_ber_run(struct switchtec_dev *dev, const int *ports,
+			   int nr_ports,
+			   const struct switchtec_diag_ber_opts *opts,
+			   struct switchtec_diag_ber_lane *lanes,
+			   int max_lanes)
+{
+	double confidence = opts->confidence > 0 ? opts->confidence : 0.95;
+	const struct switchtec_topo_port *port;
+	const struct switchtec_topo *topo;
+	unsigned long long *counts;
+	uint64_t start, now, end;
+	int i, l, nr_lanes = 0;
+	int decided, ret, err;
+	double bps;
+
+	if (!ports || nr_ports < 1 || !lanes || !opts->poll_ms ||
+	    !opts->duration_ms ||
+	    opts->pattern >= SWITCHTEC_DIAG_PATTERN_PRBS_DISABLED) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	topo = switchtec_topo(dev);
+	if (!topo)
+		return -1;
+
+	for (i = 0; i < nr_ports; i++) {
+		port = switchtec_topo_find_port(topo, ports[i]);
+		if (!port)
+			return -1;
+
+		bps = opts->lane_gbps * 1e9;
+		if (!bps && port->link_rate < ARRAY_SIZE(ber_lane_bps))
+			bps = ber_lane_bps[port->link_rate];
+		if (!bps) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		for (l = 0; l < port->cfg_lnk_width; l++) {
+			if (nr_lanes == max_lanes) {
+				errno = ENOSPC;
+				return -1;
+			}
+
+			memset(&lanes[nr_lanes], 0, sizeof(lanes[nr_lanes]));
+			lanes[nr_lanes].phys_port_id = ports[i];
+			lanes[nr_lanes].lane_id = l;
+			lanes[nr_lanes].lane_bps = bps;
+			nr_lanes++;
+		}
+	}
+
+	counts = calloc(nr_lanes, sizeof(*counts));
+	if (!counts)
+		return -1;
+
+	ret = ber_setup(dev, ports, nr_ports, opts->loopback,
+			opts->ltssm_speed, opts->pattern);
+	if (ret) {
+		ret = -1;
+		goto out_teardown;
+	}
+
+	if (opts->settle_ms)
+		usleep(opts->settle_ms * 1000);
+
+	ret = ber_read(dev, lanes, nr_lanes, counts);
+	if (ret) {
+		ret = -1;
+		goto out_teardown;
+	}
+
+	start = platform_time_us();
+	end = start + opts->duration_ms * 1000ULL;
+
+	for (i = 0; i < nr_lanes; i++)
+		ber_update(&lanes[i], opts, confidence, counts[i], start);
+
+	do {
+		now = platform_time_us();
+		if (now < end)
+			usleep(opts->poll_ms * 1000ULL < end - now ?
+			       opts->poll_ms * 1000 : end - now);
+
+		ret = ber_read(dev, lanes, nr_lanes, counts);
+		if (ret) {
+			ret = -1;
+			goto out_teardown;
+		}
+
+		now = platform_time_us();
+		decided = 0;
+		for (i = 0; i < nr_lanes; i++) {
+			ber_update(&lanes[i], opts, confidence, counts[i], now);
+			if (lanes[i].verdict != SWITCHTEC_DIAG_BER_UNDECIDED)
+				decided++;
+		}
+
+		if (opts->cb && opts->cb(lanes, nr_lanes, opts->data))
+			break;
+	} while (now < end && !(opts->target_ber > 0 &&
+				decided == nr_lanes));
+
+	ret = nr_lanes;
+
+out_teardown:
+	err = errno;
+	ber_setup(dev, ports, nr_ports, opts->loopback, opts->ltssm_speed,
+		  SWITCHTEC_DIAG_PATTERN_PRBS_DISABLED);
+	errno = err;
+
+	free(counts);
+	return ret;
+}
+
+/*
+ * Every SerDes dump takes a 4 byte request. The *_req() helpers fill
+ * one in and pick the command, and the *_parse() helpers convert the
+ * response, so the same code serves single reads and batched snapshots.
+ */
+union diag_serdes_in {
+	struct switchtec_diag_rcvr_obj_dump_in rcvr_obj;
+	struct switchtec_diag_ext_recv_obj_dump_in ext;
+	struct switchtec_diag_port_eq_status_in eq;
+	struct switchtec_diag_port_eq_status_in2 eq2;
+	struct switchtec_diag_ext_dump_coeff_prev_in coeff_prev;
+};
+
+static int rcvr_obj_req(int port_id, int lane_id,
+			enum switchtec_diag_link link,
+			union diag_serdes_in *in, uint32_t *cmd)
+{
+	memset(in, 0, sizeof(*in));
+
+	if (link == SWITCHTEC_DIAG_LINK_CURRENT) {
+		in->rcvr_obj.port_id = port_id;
+		in->rcvr_obj.lane_id = lane_id;
+		*cmd = MRPC_RCVR_OBJ_DUMP;
+	} else if (link == SWITCHTEC_DIAG_LINK_PREVIOUS) {
+		in->ext.sub_cmd = MRPC_EXT_RCVR_OBJ_DUMP_PREV;
+		in->ext.port_id = port_id;
+		in->ext.lane_id = lane_id;
+		*cmd = MRPC_EXT_RCVR_OBJ_DUMP;
+	} else {
+		errno = -EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void rcvr_obj_parse(const struct switchtec_diag_rcvr_obj_dump_out *out,
+			   struct switchtec_rcvr_obj *res)
+{
+	int i;
+
+	res->port_id = out->port_id;
+	res->lane_id = out->lane_id;
+	res->ctle = out->ctle;
+	res->target_amplitude = out->target_amplitude;
+	res->speculative_dfe = out->speculative_dfe;
+	for (i = 0; i < ARRAY_SIZE(res->dynamic_dfe); i++)
+		res->dynamic_dfe[i] = out->dynamic_dfe[i];
+}
+
+/**
+ * @brief Get the receiver object
+ * @param[in]  dev	Switchtec device handle
+ * @param[in]  port_id	Physical port ID
+ * @param[in]  lane_id  Lane ID
+ * @param[in]  link     Current or previous link-up
+ * @param[out] res      Resulting receiver object
+ *
+ * @return 0 on success, error code on failure
  */
 int switchtec_diag_rcvr_obj(struct switchtec_dev *dev, int port_id,
 		int lane_id, enum switchtec_diag_link link,
 		struct switchtec_rcvr_obj *res)
 {
 	struct switchtec_diag_rcvr_obj_dump_out out = {};
-	struct switchtec_diag_rcvr_obj_dump_in in = {
-		.port_id = port_id,
-		.lane_id = lane_id,
-	};
-	struct switchtec_diag_ext_recv_obj_dump_in ext_in = {
-		.sub_cmd = MRPC_EXT_RCVR_OBJ_DUMP_PREV,
-		.port_id = port_id,
-		.lane_id = lane_id,
-	};
+	union diag_serdes_in in;
+	uint32_t cmd;
+	int ret;
+
+	if (!res) {
+		errno = -EINVAL;
+		return -1;
+	}
+
+	if (rcvr_obj_req(port_id, lane_id, link, &in, &cmd))
+		return -1;
+
+	ret = switchtec_cmd(dev, cmd, &in, sizeof(in), &out, sizeof(out));
+	if (ret)
+		return -1;
+
+	rcvr_obj_parse(&out, res);
+
+	return 0;
+}
+
+static int eq_tx_coeff_req(int port_id, enum switchtec_diag_end end,
+			   enum switchtec_diag_link link,
+			   union diag_serdes_in *in, uint32_t *cmd)
+{
+	memset(in, 0, sizeof(*in));
+
+	if (end != SWITCHTEC_DIAG_LOCAL && end != SWITCHTEC_DIAG_FAR_END) {
+		errno = -EINVAL;
+		return -1;
+	}
+
+	if (link == SWITCHTEC_DIAG_LINK_CURRENT) {
+		in->eq.sub_cmd = end == SWITCHTEC_DIAG_LOCAL ?
+			MRPC_PORT_EQ_LOCAL_TX_COEFF_DUMP :
+			MRPC_PORT_EQ_FAR_END_TX_COEFF_DUMP;
+		in->eq.op_type = DIAG_PORT_EQ_STATUS_OP_PER_PORT;
+		in->eq.port_id = port_id;
+		*cmd = MRPC_PORT_EQ_STATUS;
+	} else if (link == SWITCHTEC_DIAG_LINK_PREVIOUS) {
+		in->coeff_prev.sub_cmd = end == SWITCHTEC_DIAG_LOCAL ?
+			MRPC_EXT_RCVR_OBJ_DUMP_LOCAL_TX_COEFF_PREV :
+			MRPC_EXT_RCVR_OBJ_DUMP_FAR_END_TX_COEFF_PREV;
+		in->coeff_prev.op_type = DIAG_PORT_EQ_STATUS_OP_PER_PORT;
+		in->coeff_prev.port_id = port_id;
+		*cmd = MRPC_EXT_RCVR_OBJ_DUMP;
+	} else {
+		errno = -EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void eq_tx_coeff_parse(const struct switchtec_diag_port_eq_status_out *out,
+			      struct switchtec_port_eq_coeff *res)
+{
+	int i;
+
+	res->lane_cnt = out->lane_id + 1;
+	if (res->lane_cnt > ARRAY_SIZE(res->cursors))
+		res->lane_cnt = ARRAY_SIZE(res->cursors);
+
+	for (i = 0; i < res->lane_cnt; i++) {
+		res->cursors[i].pre = out->cursors[i].pre;
+		res->cursors[i].post = out->cursors[i].post;
+	}
+}
+
+/**
+ * @brief Get the port equalization TX coefficients
+ * @param[in]  dev	Switchtec device handle
+ * @param[in]  port_id	Physical port ID
+ * @param[in]  end      Get coefficents for the Local or the Far End
+ * @param[out] res      Resulting port equalization coefficients
+ *
+ * @return 0 on success, error code on failure
+ */
+int switchtec_diag_port_eq_tx_coeff(struct switchtec_dev *dev, int port_id,
+		enum switchtec_diag_end end, enum switchtec_diag_link link,
+		struct switchtec_port_eq_coeff *res)
+{
+	struct switchtec_diag_port_eq_status_out out = {};
+	union diag_serdes_in in;
+	uint32_t cmd;
+	int ret;
+
+	if (!res) {
+		errno = -EINVAL;
+		return -1;
+	}
+
+	if (eq_tx_coeff_req(port_id, end, link, &in, &cmd))
+		return -1;
+
+	ret = switchtec_cmd(dev, cmd, &in, sizeof(in), &out, sizeof(out));
+	if (ret)
+		return -1;
+
+	eq_tx_coeff_parse(&out, res);
+
+	return 0;
+}
+
+static int eq_tx_table_req(int port_id, enum switchtec_diag_link link,
+			   union diag_serdes_in *in, uint32_t *cmd)
+{
+	memset(in, 0, sizeof(*in));
+	in->eq2.port_id = port_id;
+
+	if (link == SWITCHTEC_DIAG_LINK_CURRENT) {
+		in->eq2.sub_cmd = MRPC_PORT_EQ_FAR_END_TX_EQ_TABLE_DUMP;
+		*cmd = MRPC_PORT_EQ_STATUS;
+	} else if (link == SWITCHTEC_DIAG_LINK_PREVIOUS) {
+		in->eq2.sub_cmd = MRPC_EXT_RCVR_OBJ_DUMP_EQ_TX_TABLE_PREV;
+		*cmd = MRPC_EXT_RCVR_OBJ_DUMP;
+	} else {
+		errno = -EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void eq_tx_table_parse(const struct switchtec_diag_port_eq_table_out *out,
+			      struct switchtec_port_eq_table *res)
+{
+	int i;
+
+	res->lane_id = out->lane_id;
+	res->step_cnt = out->step_cnt;
+	if (res->step_cnt > ARRAY_SIZE(res->steps))
+		res->step_cnt = ARRAY_SIZE(res->steps);
+
+	for (i = 0; i < res->step_cnt; i++) {
+		res->steps[i].pre_cursor     = out->steps[i].pre_cursor;
+		res->steps[i].post_cursor    = out->steps[i].post_cursor;
+		res->steps[i].fom            = out->steps[i].fom;
+		res->steps[i].pre_cursor_up  = out->steps[i].pre_cursor_up;
+		res->steps[i].post_cursor_up = out->steps[i].post_cursor_up;
+		res->steps[i].error_status   = out->steps[i].error_status;
+		res->steps[i].active_status  = out->steps[i].active_status;
+		res->steps[i].speed          = out->steps[i].speed;
+	}
+}
+
+/**
+ * @brief Get the far end TX equalization table
+ * @param[in]  dev	Switchtec device handle
+ * @param[in]  port_id	Physical port ID
+ * @param[out] res      Resulting port equalization table
+ *
+ * @return 0 on success, error code on failure
+ */
+int switchtec_diag_port_eq_tx_table(struct switchtec_dev *dev, int port_id,
+				    enum switchtec_diag_link link,
+				    struct switchtec_port_eq_table *res)
+{
+	struct switchtec_diag_port_eq_table_out out = {};
+	union diag_serdes_in in;
+	uint32_t cmd;
+	int ret;
+
+	if (!res) {
+		errno = -EINVAL;
+		return -1;
+	}
+
+	if (eq_tx_table_req(port_id, link, &in, &cmd))
+		return -1;
+
+	ret = switchtec_cmd(dev, cmd, &in, sizeof(in), &out, sizeof(out));
+	if (ret)
+		return -1;
+
+	eq_tx_table_parse(&out, res);
+
+	return 0;
+}
+
+static int eq_tx_fslf_req(int port_id, int lane_id,
+			  enum switchtec_diag_end end,
+			  enum switchtec_diag_link link,
+			  union diag_serdes_in *in, uint32_t *cmd)
+{
+	memset(in, 0, sizeof(*in));
+
+	if (end != SWITCHTEC_DIAG_LOCAL && end != SWITCHTEC_DIAG_FAR_END) {
+		errno = -EINVAL;
+		return -1;
+	}
+
+	if (link == SWITCHTEC_DIAG_LINK_CURRENT) {
+		in->eq2.sub_cmd = end == SWITCHTEC_DIAG_LOCAL ?
+			MRPC_PORT_EQ_LOCAL_TX_FSLF_DUMP :
+			MRPC_PORT_EQ_FAR_END_TX_FSLF_DUMP;
+		in->eq2.port_id = port_id;
+		in->eq2.lane_id = lane_id;
+		*cmd = MRPC_PORT_EQ_STATUS;
+	} else if (link == SWITCHTEC_DIAG_LINK_PREVIOUS) {
+		in->ext.sub_cmd = end == SWITCHTEC_DIAG_LOCAL ?
+			MRPC_EXT_RCVR_OBJ_DUMP_LOCAL_TX_FSLF_PREV :
+			MRPC_EXT_RCVR_OBJ_DUMP_FAR_END_TX_FSLF_PREV;
+		in->ext.port_id = port_id;
+		in->ext.lane_id = lane_id;
+		*cmd = MRPC_EXT_RCVR_OBJ_DUMP;
+	} else {
+		errno = -EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void eq_tx_fslf_parse(const struct switchtec_diag_port_eq_tx_fslf_out *out,
+			     struct switchtec_port_eq_tx_fslf *res)
+{
+	res->fs = out->fs;
+	res->lf = out->lf;
+}
+
+/**
+ * @brief Get the equalization FS/LF
+ * @param[in]  dev	Switchtec device handle
+ * @param[in]  port_id	Physical port ID
+ * @param[in]  lane_id	Physical port ID
+ * @param[in]  end      Get coefficents for the Local or the Far End
+ * @param[out] res      Resulting FS/LF values
+ *
+ * @return 0 on success, error code on failure
+ */
+int switchtec_diag_port_eq_tx_fslf(struct switchtec_dev *dev, int port_id,
+				   int lane_id, enum switchtec_diag_end end,
+				   enum switchtec_diag_link link,
+				   struct switchtec_port_eq_tx_fslf *res)
+{
+	struct switchtec_diag_port_eq_tx_fslf_out out = {};
+	union diag_serdes_in in;
+	uint32_t cmd;
+	int ret;
+
+	if (!res) {
+		errno = -EINVAL;
+		return -1;
+	}
+
+	if (eq_tx_fslf_req(port_id, lane_id, end, link, &in, &cmd))
+		return -1;
+
+	ret = switchtec_cmd(dev, cmd, &in, sizeof(in), &out, sizeof(out));
+	if (ret)
+		return -1;
+
+	eq_tx_fslf_parse(&out, res);
+
+	return 0;
+}
+
+static int rcvr_ext_req(int port_id, int lane_id,
+			enum switchtec_diag_link link,
+			union diag_serdes_in *in, uint32_t *cmd)
+{
+	memset(in, 0, sizeof(*in));
+	in->ext.port_id = port_id;
+	in->ext.lane_id = lane_id;
+	*cmd = MRPC_EXT_RCVR_OBJ_DUMP;
+
+	if (link == SWITCHTEC_DIAG_LINK_CURRENT) {
+		in->ext.sub_cmd = MRPC_EXT_RCVR_OBJ_DUMP_RCVR_EXT;
+	} else if (link == SWITCHTEC_DIAG_LINK_PREVIOUS) {
+		in->ext.sub_cmd = MRPC_EXT_RCVR_OBJ_DUMP_RCVR_EXT_PREV;
+	} else {
+		errno = -EINVAL;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void rcvr_ext_parse(const struct switchtec_diag_rcvr_ext_out *out,
+			   struct switchtec_rcvr_ext *res)
+{
+	res->ctle2_rx_mode = out->ctle2_rx_mode;
+	res->dtclk_9 = out->dtclk_9;
+	res->dtclk_8_6 = out->dtclk_8_6;
+	res->dtclk_5 = out->dtclk_5;
+}
+
+/**
+ * @brief Get the Extended Receiver Object
+ * @param[in]  dev	Switchtec device handle
+ * @param[in]  port_id	Physical port ID
+ * @param[in]  lane_id  Lane ID
+ * @param[in]  link     Current or previous link-up
+ * @param[out] res      Resulting receiver object
+ *
+ * @return 0 on success, error code on failure
+ */
+int switchtec_diag_rcvr_ext(struct switchtec_dev *dev, int port_id,
+			    int lane_id, enum switchtec_diag_link link,
+			    struct switchtec_rcvr_ext *res)
+{
+	struct switchtec_diag_rcvr_ext_out out = {};
+	union diag_serdes_in in;
+	uint32_t cmd;
+	int ret;
+
+	if (!res) {
+		errno = -EINVAL;
+		return -1;
+	}
+
+	if (rcvr_ext_req(port_id, lane_id, link, &in, &cmd))
+		return -1;
+
+	ret = switchtec_cmd(dev, cmd, &in, sizeof(in), &out, sizeof(out));
+	if (ret)
+		return -1;
+
+	rcvr_ext_parse(&out, res);
+
+	return 0;
+}
+
+/*
+ * SerDes snapshots
+ *
+ * Every value in a snapshot has a field ID made of its section (which
+ * matches its bit in enum switchtec_serdes_valid), lane, index and
+ * sub-field. serdes_port_walk() visits the values of a port in
+ * ascending field order, which saving, loading and diffing all build on.
+ */
+
+enum serdes_section {
+	SERDES_SEC_LOCAL_COEFF,
+	SERDES_SEC_FAR_COEFF,
+	SERDES_SEC_FAR_TABLE,
+	SERDES_SEC_RCVR_OBJ,
+	SERDES_SEC_RCVR_EXT,
+	SERDES_SEC_LOCAL_FSLF,
+	SERDES_SEC_FAR_FSLF,
+};
+
+enum serdes_type {
+	SERDES_U8,
+	SERDES_S8,
+	SERDES_U16,
+};
+
+#define SERDES_FIELD(sec, lane, idx, sub) \
+	((uint32_t)(sec) << 24 | (lane) << 16 | (idx) << 8 | (sub))
+#define SERDES_FIELD_SEC(f)	((f) >> 24)
+#define SERDES_FIELD_LANE(f)	(((f) >> 16) & 0xff)
+#define SERDES_FIELD_IDX(f)	(((f) >> 8) & 0xff)
+#define SERDES_FIELD_SUB(f)	((f) & 0xff)
+
+/* Most values a port can have: coefficients, table and lane values */
+#define SERDES_MAX_FIELDS	(2 * 16 * 2 + 1 + 126 * 8 + \
+				 SWITCHTEC_SERDES_MAX_LANES * (10 + 4 + 2 + 2))
+
+typedef int (*serdes_visit_fn)(void *ctx, uint32_t field,
+			       enum serdes_type type, int *val);
+
+static int serdes_walk_coeff(struct switchtec_port_eq_coeff *c, int sec,
+			     serdes_visit_fn fn, void *ctx)
+{
 	int i, ret;
 
-	if (!res) {
-		errno = -EINVAL;
-		return -1;
+	for (i = 0; i < c->lane_cnt; i++) {
+		ret = fn(ctx, SERDES_FIELD(sec, 0, i, 0), SERDES_U8,
+			 &c->cursors[i].pre);
+		if (!ret)
+			ret = fn(ctx, SERDES_FIELD(sec, 0, i, 1), SERDES_U8,
+				 &c->cursors[i].post);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int serdes_walk_table(struct switchtec_port_eq_table *t,
+			     serdes_visit_fn fn, void *ctx)
+{
+	int i, j, ret;
+
+	ret = fn(ctx, SERDES_FIELD(SERDES_SEC_FAR_TABLE, 0, 0, 0), SERDES_U8,
+		 &t->lane_id);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < t->step_cnt; i++) {
+		int *v[] = {
+			&t->steps[i].pre_cursor,
+			&t->steps[i].post_cursor,
+			&t->steps[i].fom,
+			&t->steps[i].pre_cursor_up,
+			&t->steps[i].post_cursor_up,
+			&t->steps[i].error_status,
+			&t->steps[i].active_status,
+			&t->steps[i].speed,
+		};
+
+		for (j = 0; j < ARRAY_SIZE(v); j++) {
+			ret = fn(ctx, SERDES_FIELD(SERDES_SEC_FAR_TABLE, 0,
+						   i + 1, j),
+				 SERDES_U8, v[j]);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int serdes_walk_lane(struct switchtec_serdes_lane *l, int sec,
+			    int lane, serdes_visit_fn fn, void *ctx)
+{
+	struct switchtec_port_eq_tx_fslf *fslf;
+	int i, ret = 0;
+
+	switch (sec) {
+	case SERDES_SEC_RCVR_OBJ:
+		ret = fn(ctx, SERDES_FIELD(sec, lane, 0, 0), SERDES_U8,
+			 &l->rcvr_obj.ctle);
+		if (!ret)
+			ret = fn(ctx, SERDES_FIELD(sec, lane, 0, 1), SERDES_U8,
+				 &l->rcvr_obj.target_amplitude);
+		if (!ret)
+			ret = fn(ctx, SERDES_FIELD(sec, lane, 0, 2), SERDES_U8,
+				 &l->rcvr_obj.speculative_dfe);
+		for (i = 0; !ret && i < ARRAY_SIZE(l->rcvr_obj.dynamic_dfe);
+		     i++)
+			ret = fn(ctx, SERDES_FIELD(sec, lane, 0, 3 + i),
+				 SERDES_S8, &l->rcvr_obj.dynamic_dfe[i]);
+		break;
+	case SERDES_SEC_RCVR_EXT:
+		ret = fn(ctx, SERDES_FIELD(sec, lane, 0, 0), SERDES_U16,
+			 &l->rcvr_ext.ctle2_rx_mode);
+		if (!ret)
+			ret = fn(ctx, SERDES_FIELD(sec, lane, 0, 1), SERDES_U8,
+				 &l->rcvr_ext.dtclk_5);
+		if (!ret)
+			ret = fn(ctx, SERDES_FIELD(sec, lane, 0, 2), SERDES_U8,
+				 &l->rcvr_ext.dtclk_8_6);
+		if (!ret)
+			ret = fn(ctx, SERDES_FIELD(sec, lane, 0, 3), SERDES_U8,
+				 &l->rcvr_ext.dtclk_9);
+		break;
+	case SERDES_SEC_LOCAL_FSLF:
+	case SERDES_SEC_FAR_FSLF:
+		fslf = sec == SERDES_SEC_LOCAL_FSLF ? &l->local_fslf :
+			&l->far_fslf;
+		ret = fn(ctx, SERDES_FIELD(sec, lane, 0, 0), SERDES_U8,
+			 &fslf->fs);
+		if (!ret)
+			ret = fn(ctx, SERDES_FIELD(sec, lane, 0, 1), SERDES_U8,
+				 &fslf->lf);
+		break;
+	}
+
+	return ret;
+}
+
+static int serdes_port_walk(struct switchtec_serdes_port *p,
+			    serdes_visit_fn fn, void *ctx)
+{
+	int sec, lane, ret;
+
+	if (p->valid & SWITCHTEC_SERDES_LOCAL_COEFF) {
+		ret = serdes_walk_coeff(&p->local_coeff, SERDES_SEC_LOCAL_COEFF,
+					fn, ctx);
+		if (ret)
+			return ret;
+	}
+
+	if (p->valid & SWITCHTEC_SERDES_FAR_COEFF) {
+		ret = serdes_walk_coeff(&p->far_coeff, SERDES_SEC_FAR_COEFF,
+					fn, ctx);
+		if (ret)
+			return ret;
+	}
+
+	if (p->valid & SWITCHTEC_SERDES_FAR_TABLE) {
+		ret = serdes_walk_table(&p->far_table, fn, ctx);
+		if (ret)
+			return ret;
+	}
+
+	for (sec = SERDES_SEC_RCVR_OBJ; sec <= SERDES_SEC_FAR_FSLF; sec++) {
+		for (lane = 0; lane < p->lane_cnt; lane++) {
+			if (!(p->lanes[lane].valid & (1 << sec)))
+				continue;
+
+			ret = serdes_walk_lane(&p->lanes[lane], sec, lane,
+					       fn, ctx);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+struct serdes_port_io {
+	union diag_serdes_in in[3 + 4 * SWITCHTEC_SERDES_MAX_LANES];
+	struct switchtec_diag_port_eq_status_out coeff[2];
+	struct switchtec_diag_port_eq_table_out table;
+	struct {
+		struct switchtec_diag_rcvr_obj_dump_out rcvr_obj;
+		struct switchtec_diag_rcvr_ext_out rcvr_ext;
+		struct switchtec_diag_port_eq_tx_fslf_out fslf[2];
+	} lane[SWITCHTEC_SERDES_MAX_LANES];
+};
+
+static void serdes_desc(struct switchtec_cmd_desc *desc, uint32_t cmd,
+			union diag_serdes_in *in, void *out, size_t out_len)
+{
+	*desc = (struct switchtec_cmd_desc) {
+		.cmd = cmd,
+		.payload = in,
+		.payload_len = sizeof(*in),
+		.resp = out,
+		.resp_len = out_len,
+	};
+}
+
+/* Queue every read of a port; returns the number of commands added */
+static int serdes_port_queue(struct switchtec_serdes_port *p,
+			     struct serdes_port_io *io,
+			     enum switchtec_diag_link link,
+			     struct switchtec_cmd_desc *desc)
+{
+	int lane, end, n = 0;
+	uint32_t cmd;
+
+	for (end = 0; end < 2; end++) {
+		eq_tx_coeff_req(p->phys_port_id, end ? SWITCHTEC_DIAG_FAR_END :
+				SWITCHTEC_DIAG_LOCAL, link, &io->in[n], &cmd);
+		serdes_desc(&desc[n], cmd, &io->in[n], &io->coeff[end],
+			    sizeof(io->coeff[end]));
+		n++;
+	}
+
+	eq_tx_table_req(p->phys_port_id, link, &io->in[n], &cmd);
+	serdes_desc(&desc[n], cmd, &io->in[n], &io->table, sizeof(io->table));
+	n++;
+
+	for (lane = 0; lane < p->lane_cnt; lane++) {
+		rcvr_obj_req(p->phys_port_id, lane, link, &io->in[n], &cmd);
+		serdes_desc(&desc[n], cmd, &io->in[n], &io->lane[lane].rcvr_obj,
+			    sizeof(io->lane[lane].rcvr_obj));
+		n++;
+
+		rcvr_ext_req(p->phys_port_id, lane, link, &io->in[n], &cmd);
+		serdes_desc(&desc[n], cmd, &io->in[n], &io->lane[lane].rcvr_ext,
+			    sizeof(io->lane[lane].rcvr_ext));
+		n++;
+
+		for (end = 0; end < 2; end++) {
+			eq_tx_fslf_req(p->phys_port_id, lane,
+				       end ? SWITCHTEC_DIAG_FAR_END :
+				       SWITCHTEC_DIAG_LOCAL, link,
+				       &io->in[n], &cmd);
+			serdes_desc(&desc[n], cmd, &io->in[n],
+				    &io->lane[lane].fslf[end],
+				    sizeof(io->lane[lane].fslf[end]));
+			n++;
+		}
+	}
+
+	return n;
+}
+
+/* Parse the results of serdes_port_queue(), in the same order */
+static int serdes_port_parse(struct switchtec_serdes_port *p,
+			     struct serdes_port_io *io,
+			     const struct switchtec_cmd_desc *desc)
+{
+	struct switchtec_serdes_lane *l;
+	int lane, n = 0;
+
+	if (!desc[n++].ret) {
+		eq_tx_coeff_parse(&io->coeff[0], &p->local_coeff);
+		p->valid |= SWITCHTEC_SERDES_LOCAL_COEFF;
+	}
+	if (!desc[n++].ret) {
+		eq_tx_coeff_parse(&io->coeff[1], &p->far_coeff);
+		p->valid |= SWITCHTEC_SERDES_FAR_COEFF;
+	}
+	if (!desc[n++].ret) {
+		eq_tx_table_parse(&io->table, &p->far_table);
+		p->valid |= SWITCHTEC_SERDES_FAR_TABLE;
+	}
+
+	for (lane = 0; lane < p->lane_cnt; lane++) {
+		l = &p->lanes[lane];
+
+		if (!desc[n++].ret) {
+			rcvr_obj_parse(&io->lane[lane].rcvr_obj, &l->rcvr_obj);
+			l->valid |= SWITCHTEC_SERDES_RCVR_OBJ;
+		}
+		if (!desc[n++].ret) {
+			rcvr_ext_parse(&io->lane[lane].rcvr_ext, &l->rcvr_ext);
+			l->valid |= SWITCHTEC_SERDES_RCVR_EXT;
+		}
+		if (!desc[n++].ret) {
+			eq_tx_fslf_parse(&io->lane[lane].fslf[0],
+					 &l->local_fslf);
+			l->valid |= SWITCHTEC_SERDES_LOCAL_FSLF;
+		}
+		if (!desc[n++].ret) {
+			eq_tx_fslf_parse(&io->lane[lane].fslf[1],
+					 &l->far_fslf);
+			l->valid |= SWITCHTEC_SERDES_FAR_FSLF;
+		}
+	}
+
+	return n;
+}
+
+/**
+ * @brief Take a snapshot of the SerDes state of several ports
+ * @param[in] dev	Switchtec device handle
+ * @param[in] ports	Physical port IDs, or NULL for every port
+ * @param[in] nr_ports	Number of entries in \p ports
+ * @param[in] link	Current or previous link-up
+ *
+ * @return The snapshot, to be freed with
+ *	switchtec_diag_serdes_snapshot_free(), or NULL on error (with
+ *	errno set)
+ *
+ * Each configured lane of each port is covered. All the reads of all
+ * the ports go out as one command batch. A read the firmware rejects,
+ * for example because a port has never linked up, only leaves its
+ * valid flag clear; the snapshot fails only if the batch could not be
+ * sent.
+ */
+struct switchtec_serdes_snapshot *
+switchtec_diag_serdes_snapshot(struct switchtec_dev *dev, const int *ports,
+			       int nr_ports, enum switchtec_diag_link link)
+{
+	struct switchtec_serdes_snapshot *s = NULL;
+	struct switchtec_cmd_desc *desc = NULL;
+	struct switchtec_status *status;
+	struct serdes_port_io *io = NULL;
+	struct switchtec_serdes_port *p;
+	int i, j, nr_status, n = 0;
+	int ret;
+
+	if (link != SWITCHTEC_DIAG_LINK_CURRENT &&
+	    link != SWITCHTEC_DIAG_LINK_PREVIOUS) {
+		errno = EINVAL;
+		return NULL;
 	}
 
-	if (link == SWITCHTEC_DIAG_LINK_CURRENT) {
-		ret = switchtec_cmd(dev, MRPC_RCVR_OBJ_DUMP, &in, sizeof(in),
-				    &out, sizeof(out));
-	} else if (link == SWITCHTEC_DIAG_LINK_PREVIOUS) {
-		ret = switchtec_cmd(dev, MRPC_EXT_RCVR_OBJ_DUMP, &ext_in,
-				    sizeof(ext_in), &out, sizeof(out));
-	} else {
-		errno = -EINVAL;
-		return -1;
+	nr_status = switchtec_status(dev, &status);
+	if (nr_status < 0)
+		return NULL;
+
+	if (!ports)
+		nr_ports = nr_status;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		goto err;
+
+	s->ports = calloc(nr_ports ? nr_ports : 1, sizeof(*s->ports));
+	io = calloc(nr_ports ? nr_ports : 1, sizeof(*io));
+	desc = calloc(nr_ports ? nr_ports : 1,
+		      sizeof(*desc) * ARRAY_SIZE(io->in));
+	if (!s->ports || !io || !desc)
+		goto err;
+
+	s->device_id = switchtec_device_id(dev);
+	s->link = link;
+	s->time = time(NULL);
+	s->nr_ports = nr_ports;
+
+	for (i = 0; i < nr_ports; i++) {
+		p = &s->ports[i];
+
+		if (ports) {
+			for (j = 0; j < nr_status; j++)
+				if (status[j].port.phys_id == ports[i])
+					break;
+			if (j == nr_status) {
+				errno = EINVAL;
+				goto err;
+			}
+		} else {
+			j = i;
+		}
+
+		p->phys_port_id = status[j].port.phys_id;
+		p->lane_cnt = status[j].cfg_lnk_width;
+		if (p->lane_cnt > SWITCHTEC_SERDES_MAX_LANES)
+			p->lane_cnt = SWITCHTEC_SERDES_MAX_LANES;
+
+		n += serdes_port_queue(p, &io[i], link, &desc[n]);
 	}
 
-	if (ret)
+	ret = switchtec_cmd_batch(dev, desc, n);
+	if (ret < 0)
+		goto err;
+
+	for (i = 0, n = 0; i < nr_ports; i++)
+		n += serdes_port_parse(&s->ports[i], &io[i], &desc[n]);
+
+	free(desc);
+	free(io);
+	switchtec_status_free(status, nr_status);
+	return s;
+
+err:
+	free(desc);
+	free(io);
+	switchtec_diag_serdes_snapshot_free(s);
+	switchtec_status_free(status, nr_status);
+	return NULL;
+}
+
+/**
+ * @brief Free a SerDes snapshot
+ * @param[in] s		Snapshot to free (may be NULL)
+ */
+void switchtec_diag_serdes_snapshot_free(struct switchtec_serdes_snapshot *s)
+{
+	if (!s)
+		return;
+
+	free(s->ports);
+	free(s);
+}
+
+#pragma pack(push, 1)
+
+struct serdes_file_hdr {
+	char magic[8];
+	uint8_t version;
+	uint8_t link;
+	uint16_t device_id;
+	uint16_t nr_ports;
+	uint16_t rsvd;
+	uint64_t time;
+};
+
+struct serdes_file_port {
+	uint8_t phys_port_id;
+	uint8_t lane_cnt;
+	uint8_t valid;
+	uint8_t local_coeff_cnt;
+	uint8_t far_coeff_cnt;
+	uint8_t far_table_steps;
+	uint8_t lane_valid[];
+};
+
+#pragma pack(pop)
+
+static int serdes_save_value(void *ctx, uint32_t field,
+			     enum serdes_type type, int *val)
+{
+	FILE *f = ctx;
+
+	if (fputc(*val & 0xff, f) == EOF)
 		return -1;
 
-	res->port_id = out.port_id;
-	res->lane_id = out.lane_id;
-	res->ctle = out.ctle;
-	res->target_amplitude = out.target_amplitude;
-	res->speculative_dfe = out.speculative_dfe;
-	for (i = 0; i < ARRAY_SIZE(res->dynamic_dfe); i++)
-		res->dynamic_dfe[i] = out.dynamic_dfe[i];
+	if (type == SERDES_U16)
+		return fputc((*val >> 8) & 0xff, f) == EOF ? -1 : 0;
 
 	return 0;
 }
 
 /**
- * @brief Get the port equalization TX coefficients
- * @param[in]  dev	Switchtec device handle
- * @param[in]  port_id	Physical port ID
- * @param[in]  end      Get coefficents for the Local or the Far End
- * @param[out] res      Resulting port equalization coefficients
+ * @brief Save a SerDes snapshot to a file
+ * @param[in] s		Snapshot to save
+ * @param[in] f		File to write to
  *
- * @return 0 on success, error code on failure
+ * @return 0 on success, or -1 on error (with errno set)
+ *
+ * The file holds a header, then for each port a short header with the
+ * valid flags and counts, followed by every value it has in field
+ * order. Values take one byte, or two little endian bytes for the 16
+ * bit CTLE2 RX mode, so a whole switch takes a few kilobytes. The
+ * header fields are little endian too, so files can be compared
+ * across hosts.
  */
-int switchtec_diag_port_eq_tx_coeff(struct switchtec_dev *dev, int port_id,
-		enum switchtec_diag_end end, enum switchtec_diag_link link,
-		struct switchtec_port_eq_coeff *res)
+int switchtec_diag_serdes_snapshot_save(const struct switchtec_serdes_snapshot *s,
+					FILE *f)
 {
-	struct switchtec_diag_port_eq_status_out out = {};
-	struct switchtec_diag_port_eq_status_in in = {
-		.op_type = DIAG_PORT_EQ_STATUS_OP_PER_PORT,
-		.port_id = port_id,
-	};
-	struct switchtec_diag_ext_dump_coeff_prev_in in_prev = {
-		.op_type = DIAG_PORT_EQ_STATUS_OP_PER_PORT,
-		.port_id = port_id,
+	uint8_t buf[sizeof(struct serdes_file_port) +
+		    SWITCHTEC_SERDES_MAX_LANES];
+	struct serdes_file_port *fp = (void *)buf;
+	struct switchtec_serdes_port *p;
+	struct serdes_file_hdr hdr = {
+		.version = SWITCHTEC_SERDES_VERSION,
+		.link = s->link,
+		.device_id = htole16(s->device_id),
+		.nr_ports = htole16(s->nr_ports),
+		.time = htole64(s->time),
 	};
-	int ret, i;
+	int i, lane;
 
-	if (!res) {
-		errno = -EINVAL;
-		return -1;
-	}
+	memcpy(hdr.magic, SWITCHTEC_SERDES_MAGIC,
+	       sizeof(SWITCHTEC_SERDES_MAGIC));
 
-	if (end == SWITCHTEC_DIAG_LOCAL) {
-		in.sub_cmd = MRPC_PORT_EQ_LOCAL_TX_COEFF_DUMP;
-		in_prev.sub_cmd = MRPC_EXT_RCVR_OBJ_DUMP_LOCAL_TX_COEFF_PREV;
-	} else if (end == SWITCHTEC_DIAG_FAR_END) {
-		in.sub_cmd = MRPC_PORT_EQ_FAR_END_TX_COEFF_DUMP;
-		in_prev.sub_cmd = MRPC_EXT_RCVR_OBJ_DUMP_FAR_END_TX_COEFF_PREV;
-	} else {
-		errno = -EINVAL;
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
 		return -1;
-	}
 
-	if (link == SWITCHTEC_DIAG_LINK_CURRENT) {
-		ret = switchtec_cmd(dev, MRPC_PORT_EQ_STATUS, &in, sizeof(in),
-				    &out, sizeof(out));
-	} else if (link == SWITCHTEC_DIAG_LINK_PREVIOUS) {
-		ret = switchtec_cmd(dev, MRPC_EXT_RCVR_OBJ_DUMP, &in_prev,
-				    sizeof(in_prev), &out, sizeof(out));
-	} else {
-		errno = -EINVAL;
-		return -1;
+	for (i = 0; i < s->nr_ports; i++) {
+		p = &s->ports[i];
+
+		fp->phys_port_id = p->phys_port_id;
+		fp->lane_cnt = p->lane_cnt;
+		fp->valid = p->valid;
+		fp->local_coeff_cnt = p->local_coeff.lane_cnt;
+		fp->far_coeff_cnt = p->far_coeff.lane_cnt;
+		fp->far_table_steps = p->far_table.step_cnt;
+		for (lane = 0; lane < p->lane_cnt; lane++)
+			fp->lane_valid[lane] = p->lanes[lane].valid;
+
+		if (fwrite(buf, sizeof(*fp) + p->lane_cnt, 1, f) != 1)
+			return -1;
+
+		if (serdes_port_walk(p, serdes_save_value, f))
+			return -1;
 	}
 
-	if (ret)
+	return 0;
+}
+
+static int serdes_load_value(void *ctx, uint32_t field,
+			     enum serdes_type type, int *val)
+{
+	FILE *f = ctx;
+	int hi = 0, lo;
+
+	lo = fgetc(f);
+	if (lo == EOF)
 		return -1;
 
-	res->lane_cnt = out.lane_id + 1;
-	for (i = 0; i < res->lane_cnt; i++) {
-		res->cursors[i].pre = out.cursors[i].pre;
-		res->cursors[i].post = out.cursors[i].post;
+	if (type == SERDES_U16) {
+		hi = fgetc(f);
+		if (hi == EOF)
+			return -1;
 	}
 
+	if (type == SERDES_S8)
+		*val = (int8_t)lo;
+	else
+		*val = hi << 8 | lo;
+
 	return 0;
 }
 
 /**
- * @brief Get the far end TX equalization table
- * @param[in]  dev	Switchtec device handle
- * @param[in]  port_id	Physical port ID
- * @param[out] res      Resulting port equalization table
+ * @brief Load a SerDes snapshot saved by switchtec_diag_serdes_snapshot_save()
+ * @param[in] f		File to read from
  *
- * @return 0 on success, error code on failure
+ * @return The snapshot, to be freed with
+ *	switchtec_diag_serdes_snapshot_free(), or NULL on error (with
+ *	errno set; EINVAL if the file is not a valid snapshot)
  */
-int switchtec_diag_port_eq_tx_table(struct switchtec_dev *dev, int port_id,
-				    enum switchtec_diag_link link,
-				    struct switchtec_port_eq_table *res)
+struct switchtec_serdes_snapshot *switchtec_diag_serdes_snapshot_load(FILE *f)
 {
-	struct switchtec_diag_port_eq_table_out out = {};
-	struct switchtec_diag_port_eq_status_in2 in = {
-		.sub_cmd = MRPC_PORT_EQ_FAR_END_TX_EQ_TABLE_DUMP,
-		.port_id = port_id,
-	};
-	struct switchtec_diag_port_eq_status_in2 in_prev = {
-		.sub_cmd = MRPC_EXT_RCVR_OBJ_DUMP_EQ_TX_TABLE_PREV,
-		.port_id = port_id,
-	};
-	int ret, i;
-
-	if (!res) {
-		errno = -EINVAL;
-		return -1;
+	uint8_t buf[sizeof(struct serdes_file_port) +
+		    SWITCHTEC_SERDES_MAX_LANES];
+	struct serdes_file_port *fp = (void *)buf;
+	struct switchtec_serdes_snapshot *s;
+	struct switchtec_serdes_port *p;
+	struct serdes_file_hdr hdr;
+	int i, lane;
+
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    memcmp(hdr.magic, SWITCHTEC_SERDES_MAGIC,
+		   sizeof(SWITCHTEC_SERDES_MAGIC)) ||
+	    hdr.version != SWITCHTEC_SERDES_VERSION) {
+		errno = EINVAL;
+		return NULL;
 	}
 
-	if (link == SWITCHTEC_DIAG_LINK_CURRENT) {
-		ret = switchtec_cmd(dev, MRPC_PORT_EQ_STATUS, &in, sizeof(in),
-				    &out, sizeof(out));
-	} else if (link == SWITCHTEC_DIAG_LINK_PREVIOUS) {
-		ret = switchtec_cmd(dev, MRPC_EXT_RCVR_OBJ_DUMP, &in_prev,
-				    sizeof(in_prev), &out, sizeof(out));
-	} else {
-		errno = -EINVAL;
-		return -1;
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->device_id = le16toh(hdr.device_id);
+	s->link = hdr.link;
+	s->time = le64toh(hdr.time);
+	s->nr_ports = le16toh(hdr.nr_ports);
+	s->ports = calloc(s->nr_ports ? s->nr_ports : 1, sizeof(*s->ports));
+	if (!s->ports)
+		goto err;
+
+	for (i = 0; i < s->nr_ports; i++) {
+		p = &s->ports[i];
+
+		if (fread(fp, sizeof(*fp), 1, f) != 1 ||
+		    fp->lane_cnt > SWITCHTEC_SERDES_MAX_LANES ||
+		    fp->local_coeff_cnt > ARRAY_SIZE(p->local_coeff.cursors) ||
+		    fp->far_coeff_cnt > ARRAY_SIZE(p->far_coeff.cursors) ||
+		    fp->far_table_steps > ARRAY_SIZE(p->far_table.steps) ||
+		    (fp->lane_cnt &&
+		     fread(fp->lane_valid, fp->lane_cnt, 1, f) != 1))
+			goto err_inval;
+
+		p->phys_port_id = fp->phys_port_id;
+		p->lane_cnt = fp->lane_cnt;
+		p->valid = fp->valid;
+		p->local_coeff.lane_cnt = fp->local_coeff_cnt;
+		p->far_coeff.lane_cnt = fp->far_coeff_cnt;
+		p->far_table.step_cnt = fp->far_table_steps;
+		for (lane = 0; lane < p->lane_cnt; lane++) {
+			p->lanes[lane].valid = fp->lane_valid[lane];
+			p->lanes[lane].rcvr_obj.port_id = p->phys_port_id;
+			p->lanes[lane].rcvr_obj.lane_id = lane;
+		}
+
+		if (serdes_port_walk(p, serdes_load_value, f))
+			goto err_inval;
 	}
 
-	if (ret)
+	return s;
+
+err_inval:
+	errno = EINVAL;
+err:
+	switchtec_diag_serdes_snapshot_free(s);
+	return NULL;
+}
+
+struct serdes_value {
+	uint32_t field;
+	int val;
+};
+
+struct serdes_collect {
+	struct serdes_value *v;
+	int n;
+};
+
+static int serdes_collect_value(void *ctx, uint32_t field,
+				enum serdes_type type, int *val)
+{
+	struct serdes_collect *c = ctx;
+
+	if (c->n == SERDES_MAX_FIELDS)
 		return -1;
 
-	res->lane_id = out.lane_id;
-	res->step_cnt = out.step_cnt;
-	for (i = 0; i < res->step_cnt; i++) {
-		res->steps[i].pre_cursor     = out.steps[i].pre_cursor;
-		res->steps[i].post_cursor    = out.steps[i].post_cursor;
-		res->steps[i].fom            = out.steps[i].fom;
-		res->steps[i].pre_cursor_up  = out.steps[i].pre_cursor_up;
-		res->steps[i].post_cursor_up = out.steps[i].post_cursor_up;
-		res->steps[i].error_status   = out.steps[i].error_status;
-		res->steps[i].active_status  = out.steps[i].active_status;
-		res->steps[i].speed          = out.steps[i].speed;
-	}
+	c->v[c->n].field = field;
+	c->v[c->n].val = *val;
+	c->n++;
 
 	return 0;
 }
 
-/**
- * @brief Get the equalization FS/LF
- * @param[in]  dev	Switchtec device handle
- * @param[in]  port_id	Physical port ID
- * @param[in]  lane_id	Physical port ID
- * @param[in]  end      Get coefficents for the Local or the Far End
- * @param[out] res      Resulting FS/LF values
- *
- * @return 0 on success, error code on failure
- */
-int switchtec_diag_port_eq_tx_fslf(struct switchtec_dev *dev, int port_id,
-				   int lane_id, enum switchtec_diag_end end,
-				   enum switchtec_diag_link link,
-				   struct switchtec_port_eq_tx_fslf *res)
+struct serdes_diff_out {
+	struct switchtec_serdes_diff *diffs;
+	int max;
+	int count;
+};
+
+static void serdes_diff_add(struct serdes_diff_out *out, int phys_port_id,
+			    const struct serdes_value *a,
+			    const struct serdes_value *b)
 {
-	struct switchtec_diag_port_eq_tx_fslf_out out = {};
-	struct switchtec_diag_port_eq_status_in2 in = {
-		.port_id = port_id,
-		.lane_id = lane_id,
+	struct switchtec_serdes_diff *d;
+	uint32_t field = a ? a->field : b->field;
+
+	if (out->count++ >= out->max)
+		return;
+
+	d = &out->diffs[out->count - 1];
+	*d = (struct switchtec_serdes_diff) {
+		.phys_port_id = phys_port_id,
+		.lane_id = SERDES_FIELD_SEC(field) >= SERDES_SEC_RCVR_OBJ ?
+			(int)SERDES_FIELD_LANE(field) : -1,
+		.field = field,
+		.in_a = a,
+		.in_b = b,
+		.a = a ? a->val : 0,
+		.b = b ? b->val : 0,
 	};
-	struct switchtec_diag_ext_recv_obj_dump_in in_prev = {
-		.port_id = port_id,
-		.lane_id = lane_id,
-	};
-	int ret;
+}
 
-	if (!res) {
-		errno = -EINVAL;
-		return -1;
-	}
+static int serdes_diff_port(struct serdes_diff_out *out,
+			    const struct switchtec_serdes_port *pa,
+			    const struct switchtec_serdes_port *pb,
+			    struct serdes_collect *ca,
+			    struct serdes_collect *cb)
+{
+	int i = 0, j = 0;
 
-	if (end == SWITCHTEC_DIAG_LOCAL) {
-		in.sub_cmd = MRPC_PORT_EQ_LOCAL_TX_FSLF_DUMP;
-		in_prev.sub_cmd = MRPC_EXT_RCVR_OBJ_DUMP_LOCAL_TX_FSLF_PREV;
-	} else if (end == SWITCHTEC_DIAG_FAR_END) {
-		in.sub_cmd = MRPC_PORT_EQ_FAR_END_TX_FSLF_DUMP;
-		in_prev.sub_cmd = MRPC_EXT_RCVR_OBJ_DUMP_FAR_END_TX_FSLF_PREV;
-	} else {
-		errno = -EINVAL;
+	ca->n = cb->n = 0;
+	if ((pa && serdes_port_walk((struct switchtec_serdes_port *)pa,
+				    serdes_collect_value, ca)) ||
+	    (pb && serdes_port_walk((struct switchtec_serdes_port *)pb,
+				    serdes_collect_value, cb)))
 		return -1;
-	}
 
-	if (link == SWITCHTEC_DIAG_LINK_CURRENT) {
-		ret = switchtec_cmd(dev, MRPC_PORT_EQ_STATUS, &in, sizeof(in),
-				    &out, sizeof(out));
-	} else if (link == SWITCHTEC_DIAG_LINK_PREVIOUS) {
-		ret = switchtec_cmd(dev, MRPC_EXT_RCVR_OBJ_DUMP, &in_prev,
-				    sizeof(in_prev), &out, sizeof(out));
-	} else {
-		errno = -EINVAL;
-		return -1;
+	while (i < ca->n || j < cb->n) {
+		if (j == cb->n ||
+		    (i < ca->n && ca->v[i].field < cb->v[j].field)) {
+			serdes_diff_add(out, pa->phys_port_id, &ca->v[i++],
+					NULL);
+		} else if (i == ca->n || cb->v[j].field < ca->v[i].field) {
+			serdes_diff_add(out, pb->phys_port_id, NULL,
+					&cb->v[j++]);
+		} else {
+			if (ca->v[i].val != cb->v[j].val)
+				serdes_diff_add(out, pa->phys_port_id,
+						&ca->v[i], &cb->v[j]);
+			i++;
+			j++;
+		}
 	}
 
-	if (ret)
-		return -1;
+	return 0;
+}
 
-	res->fs = out.fs;
-	res->lf = out.lf;
+static const struct switchtec_serdes_port *
+serdes_find_port(const struct switchtec_serdes_snapshot *s, int phys_port_id)
+{
+	int i;
 
-	return 0;
+	for (i = 0; i < s->nr_ports; i++)
+		if (s->ports[i].phys_port_id == phys_port_id)
+			return &s->ports[i];
+
+	return NULL;
 }
 
 /**
- * @brief Get the Extended Receiver Object
- * @param[in]  dev	Switchtec device handle
- * @param[in]  port_id	Physical port ID
- * @param[in]  lane_id  Lane ID
- * @param[in]  link     Current or previous link-up
- * @param[out] res      Resulting receiver object
+ * @brief Compare two SerDes snapshots
+ * @param[in]  a	First snapshot
+ * @param[in]  b	Second snapshot
+ * @param[out] diffs	Differences found, in port and then field order
+ * @param[in]  max	Number of entries in \p diffs
  *
- * @return 0 on success, error code on failure
+ * @return The number of differences, which may be more than \p max
+ *	(only the first \p max are stored), or -1 on error (with errno set)
+ *
+ * Ports are matched by physical port ID. A value only one snapshot has,
+ * because the port, lane or read is missing from the other, is reported
+ * with only one of in_a and in_b set.
  */
-int switchtec_diag_rcvr_ext(struct switchtec_dev *dev, int port_id,
-			    int lane_id, enum switchtec_diag_link link,
-			    struct switchtec_rcvr_ext *res)
+int switchtec_diag_serdes_diff(const struct switchtec_serdes_snapshot *a,
+			       const struct switchtec_serdes_snapshot *b,
+			       struct switchtec_serdes_diff *diffs, int max)
 {
-	struct switchtec_diag_rcvr_ext_out out = {};
-	struct switchtec_diag_ext_recv_obj_dump_in in = {
-		.port_id = port_id,
-		.lane_id = lane_id,
+	struct serdes_diff_out out = {
+		.diffs = diffs,
+		.max = diffs ? max : 0,
 	};
-	int ret;
+	struct serdes_collect ca, cb;
+	int i, ret = -1;
+
+	ca.v = calloc(SERDES_MAX_FIELDS, sizeof(*ca.v));
+	cb.v = calloc(SERDES_MAX_FIELDS, sizeof(*cb.v));
+	if (!ca.v || !cb.v)
+		goto out;
+
+	for (i = 0; i < a->nr_ports; i++)
+		if (serdes_diff_port(&out, &a->ports[i],
+				     serdes_find_port(b, a->ports[i].phys_port_id),
+				     &ca, &cb))
+			goto out;
+
+	for (i = 0; i < b->nr_ports; i++)
+		if (!serdes_find_port(a, b->ports[i].phys_port_id) &&
+		    serdes_diff_port(&out, NULL, &b->ports[i], &ca, &cb))
+			goto out;
+
+	ret = out.count;
+
+out:
+	free(ca.v);
+	free(cb.v);
+	return ret;
+}
 
-	if (!res) {
-		errno = -EINVAL;
-		return -1;
-	}
+/**
+ * @brief Get the name of a SerDes snapshot field
+ * @param[in]  field	Field ID from a struct switchtec_serdes_diff
+ * @param[out] buf	Buffer for the name, e.g. "far_end_tx_coeff[2].pre"
+ * @param[in]  len	Size of \p buf
+ *
+ * @return The length of the name, or -1 for an unknown field (with
+ *	errno set to EINVAL)
+ *
+ * The lane of per-lane values is not part of the name.
+ */
+int switchtec_diag_serdes_field_name(uint32_t field, char *buf, size_t len)
+{
+	static const char * const table_names[] = {
+		"pre_cursor", "post_cursor", "fom", "pre_cursor_up",
+		"post_cursor_up", "error_status", "active_status", "speed",
+	};
+	static const char * const rcvr_obj_names[] = {
+		"ctle", "target_amplitude", "speculative_dfe",
+	};
+	static const char * const rcvr_ext_names[] = {
+		"ctle2_rx_mode", "dtclk_5", "dtclk_8_6", "dtclk_9",
+	};
+	unsigned idx = SERDES_FIELD_IDX(field);
+	unsigned sub = SERDES_FIELD_SUB(field);
 
-	if (link == SWITCHTEC_DIAG_LINK_CURRENT) {
-		in.sub_cmd = MRPC_EXT_RCVR_OBJ_DUMP_RCVR_EXT;
-	} else if (link == SWITCHTEC_DIAG_LINK_PREVIOUS) {
-		in.sub_cmd = MRPC_EXT_RCVR_OBJ_DUMP_RCVR_EXT_PREV;
-	} else {
-		errno = -EINVAL;
-		return -1;
+	switch (SERDES_FIELD_SEC(field)) {
+	case SERDES_SEC_LOCAL_COEFF:
+	case SERDES_SEC_FAR_COEFF:
+		if (sub > 1)
+			break;
+		return snprintf(buf, len, "%s_tx_coeff[%u].%s",
+				SERDES_FIELD_SEC(field) ==
+				SERDES_SEC_LOCAL_COEFF ? "local" : "far_end",
+				idx, sub ? "post" : "pre");
+	case SERDES_SEC_FAR_TABLE:
+		if (!idx)
+			return snprintf(buf, len, "far_end_tx_eq_table.lane_id");
+		if (sub >= ARRAY_SIZE(table_names))
+			break;
+		return snprintf(buf, len, "far_end_tx_eq_table[%u].%s",
+				idx - 1, table_names[sub]);
+	case SERDES_SEC_RCVR_OBJ:
+		if (sub < ARRAY_SIZE(rcvr_obj_names))
+			return snprintf(buf, len, "rcvr_obj.%s",
+					rcvr_obj_names[sub]);
+		if (sub >= 3 + 7)
+			break;
+		return snprintf(buf, len, "rcvr_obj.dynamic_dfe[%u]",
+				sub - 3);
+	case SERDES_SEC_RCVR_EXT:
+		if (sub >= ARRAY_SIZE(rcvr_ext_names))
+			break;
+		return snprintf(buf, len, "rcvr_ext.%s", rcvr_ext_names[sub]);
+	case SERDES_SEC_LOCAL_FSLF:
+	case SERDES_SEC_FAR_FSLF:
+		if (sub > 1)
+			break;
+		return snprintf(buf, len, "%s_tx_fslf.%s",
+				SERDES_FIELD_SEC(field) ==
+				SERDES_SEC_LOCAL_FSLF ? "local" : "far_end",
+				sub ? "lf" : "fs");
 	}
 
-	ret = switchtec_cmd(dev, MRPC_EXT_RCVR_OBJ_DUMP, &in, sizeof(in),
-			    &out, sizeof(out));
-	if (ret)
-		return -1;
-
-	res->ctle2_rx_mode = out.ctle2_rx_mode;
-	res->dtclk_9 = out.dtclk_9;
-	res->dtclk_8_6 = out.dtclk_8_6;
-	res->dtclk_5 = out.dtclk_5;
-
-	return 0;
+	errno = EINVAL;
+	return -1;
 }
 
 /**
@@ -1207,6 +3173,196 @@ int switchtec_diag_ltssm_log(struct switchtec_dev *dev,
 	return ret;
 }
 
+#define LTSSM_CAPTURE_MAX_ENTRIES 1024
+
+struct ltssm_capture_port {
+	int port;
+	int count;
+	bool seen;
+	struct switchtec_diag_ltssm_log *prev;
+};
+
+struct switchtec_diag_ltssm_capture {
+	struct switchtec_dev *dev;
+	int num_ports;
+	struct ltssm_capture_port *ports;
+	struct switchtec_diag_ltssm_log *snap;
+	struct switchtec_diag_ltssm_capture_entry *out;
+};
+
+/**
+ * @brief Start watching the LTSSM logs of several ports
+ * @param[in]  dev	 Switchtec device handle
+ * @param[in]  ports	 Physical port IDs to watch
+ * @param[in]  num_ports Number of entries in ports
+ *
+ * @return A capture handle to pass to switchtec_diag_ltssm_capture_poll(),
+ *	or NULL on failure (with errno set). It must be freed with
+ *	switchtec_diag_ltssm_capture_free().
+ *
+ * Each poll dumps the log of every port and only reports the entries
+ * that were not in that port's previous dump, so polling often enough
+ * that the logs don't wrap between polls yields each port's complete
+ * history. The first poll reports everything already in the logs.
+ */
+struct switchtec_diag_ltssm_capture *
+switchtec_diag_ltssm_capture_start(struct switchtec_dev *dev,
+				   const int *ports, int num_ports)
+{
+	struct switchtec_diag_ltssm_capture *c;
+	int i;
+
+	if (!switchtec_is_gen4(dev) && !switchtec_is_gen5(dev)) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+
+	if (num_ports <= 0) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+
+	c->dev = dev;
+	c->num_ports = num_ports;
+	c->ports = calloc(num_ports, sizeof(*c->ports));
+	c->snap = calloc(LTSSM_CAPTURE_MAX_ENTRIES, sizeof(*c->snap));
+	c->out = calloc(LTSSM_CAPTURE_MAX_ENTRIES, sizeof(*c->out));
+	if (!c->ports || !c->snap || !c->out)
+		goto err;
+
+	for (i = 0; i < num_ports; i++) {
+		c->ports[i].port = ports[i];
+		c->ports[i].prev = calloc(LTSSM_CAPTURE_MAX_ENTRIES,
+					  sizeof(*c->ports[i].prev));
+		if (!c->ports[i].prev)
+			goto err;
+	}
+
+	return c;
+
+err:
+	switchtec_diag_ltssm_capture_free(c);
+	errno = ENOMEM;
+	return NULL;
+}
+
+static bool ltssm_log_equal(const struct switchtec_diag_ltssm_log *a,
+			    const struct switchtec_diag_ltssm_log *b)
+{
+	return a->timestamp == b->timestamp &&
+		a->timestamp_high == b->timestamp_high &&
+		a->link_rate == b->link_rate &&
+		a->link_state == b->link_state;
+}
+
+/*
+ * Find the longest tail of the previous dump that the new dump starts
+ * with. Everything in the new dump after that overlap is new.
+ */
+static int ltssm_log_overlap(const struct switchtec_diag_ltssm_log *prev,
+			     int prev_cnt,
+			     const struct switchtec_diag_ltssm_log *cur,
+			     int cur_cnt)
+{
+	int k, i;
+
+	k = prev_cnt < cur_cnt ? prev_cnt : cur_cnt;
+	for (; k > 0; k--) {
+		for (i = 0; i < k; i++)
+			if (!ltssm_log_equal(&prev[prev_cnt - k + i], &cur[i]))
+				break;
+
+		if (i == k)
+			break;
+	}
+
+	return k;
+}
+
+/**
+ * @brief Drain the LTSSM log of every watched port once
+ * @param[in]  c	LTSSM capture handle
+ * @param[in]  callback Called once per port that has new entries, with
+ *	the entries in log order
+ * @param[in]  arg	Passed to the callback
+ *
+ * @return 0 on success, error code on failure
+ *
+ * Entries are stamped with the host time (in microseconds) of the dump
+ * they were found in. If none of a port's previous dump could be found
+ * in the new one, the log wrapped between polls and the first new
+ * entry is flagged with gap.
+ */
+int switchtec_diag_ltssm_capture_poll(struct switchtec_diag_ltssm_capture *c,
+		void (*callback)(void *arg,
+			const struct switchtec_diag_ltssm_capture_entry *ent,
+			int count),
+		void *arg)
+{
+	struct switchtec_diag_ltssm_log *tmp;
+	struct ltssm_capture_port *p;
+	int i, j, k, count, ret;
+	uint64_t now;
+
+	for (i = 0; i < c->num_ports; i++) {
+		p = &c->ports[i];
+
+		count = LTSSM_CAPTURE_MAX_ENTRIES;
+		ret = switchtec_diag_ltssm_log(c->dev, p->port, &count,
+					       c->snap);
+		if (ret)
+			return ret;
+
+		now = platform_wall_time_us();
+		k = ltssm_log_overlap(p->prev, p->count, c->snap, count);
+
+		for (j = k; j < count; j++) {
+			c->out[j - k].port = p->port;
+			c->out[j - k].host_time_us = now;
+			c->out[j - k].gap = false;
+			c->out[j - k].log = c->snap[j];
+		}
+
+		if (count > k) {
+			c->out[0].gap = p->seen && p->count && !k;
+			callback(arg, c->out, count - k);
+		}
+
+		tmp = p->prev;
+		p->prev = c->snap;
+		c->snap = tmp;
+		p->count = count;
+		p->seen = true;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Free an LTSSM capture handle
+ * @param[in]  c	LTSSM capture handle
+ */
+void switchtec_diag_ltssm_capture_free(struct switchtec_diag_ltssm_capture *c)
+{
+	int i;
+
+	if (!c)
+		return;
+
+	if (c->ports)
+		for (i = 0; i < c->num_ports; i++)
+			free(c->ports[i].prev);
+
+	free(c->ports);
+	free(c->snap);
+	free(c->out);
+	free(c);
+}
+
 /**
  * @brief Call the aer event gen function to generate AER events
  * @param[in]   dev    Switchtec device handle
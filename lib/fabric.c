@@ -25,6 +25,7 @@
 #include <stddef.h>
 #include <errno.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "switchtec/fabric.h"
 #include "switchtec_priv.h"
@@ -123,11 +124,51 @@ enum switchtec_fab_topo_info_dump_status {
 	SWITCHTEC_FAB_TOPO_INFO_DUMP_WRONG_SUB_CMD = 5,
 };
 
+#define TOPO_INFO_DUMP_POLL_MIN_US 1000
+#define TOPO_INFO_DUMP_POLL_MAX_US 50000
+#define TOPO_INFO_DUMP_TIMEOUT_US 10000000
+
+/*
+ * Wait for the firmware to assemble the topology dump. The status query
+ * is itself an MRPC, so back off between polls rather than keeping the
+ * channel busy while the switch gathers the data from the fabric.
+ */
+static int topo_info_dump_wait(struct switchtec_dev *dev, uint16_t *info_len)
+{
+	uint64_t start = platform_time_us();
+	int delay = TOPO_INFO_DUMP_POLL_MIN_US;
+	int status;
+	int ret;
+
+	while (1) {
+		ret = topo_info_dump_status_get(dev, &status, info_len);
+		if (ret)
+			return ret;
+
+		if (status != SWITCHTEC_FAB_TOPO_INFO_DUMP_WAIT)
+			break;
+
+		if (platform_time_us() - start > TOPO_INFO_DUMP_TIMEOUT_US) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+
+		usleep(delay);
+		delay *= 2;
+		if (delay > TOPO_INFO_DUMP_POLL_MAX_US)
+			delay = TOPO_INFO_DUMP_POLL_MAX_US;
+	}
+
+	if (status != SWITCHTEC_FAB_TOPO_INFO_DUMP_READY)
+		return -1;
+
+	return 0;
+}
+
 static int topo_info_dump_gen4(struct switchtec_dev *dev,
 			       struct switchtec_fab_topo_info *topo_info)
 {
 	int ret;
-	int status;
 	uint16_t total_info_len, offset, buf_len;
 	struct topo_info_reply_gen4 {
 		uint8_t sw_idx;
@@ -145,14 +186,9 @@ static int topo_info_dump_gen4(struct switchtec_dev *dev,
 	if (ret)
 		return ret;
 
-	do {
-		ret = topo_info_dump_status_get(dev, &status, &total_info_len);
-		if (ret)
-			return ret;
-	} while (status == SWITCHTEC_FAB_TOPO_INFO_DUMP_WAIT);
-
-	if (status != SWITCHTEC_FAB_TOPO_INFO_DUMP_READY)
-		return -1;
+	ret = topo_info_dump_wait(dev, &total_info_len);
+	if (ret)
+		return ret;
 
 	if (total_info_len > sizeof(reply))
 		return -1;
@@ -189,7 +225,6 @@ static int topo_info_dump_gen5(struct switchtec_dev *dev,
 			       struct switchtec_fab_topo_info *topo_info)
 {
 	int ret;
-	int status;
 	uint16_t total_info_len, offset, buf_len;
 	struct topo_info_reply_gen5 {
 		uint8_t sw_idx;
@@ -207,14 +242,9 @@ static int topo_info_dump_gen5(struct switchtec_dev *dev,
 	if (ret)
 		return ret;
 
-	do {
-		ret = topo_info_dump_status_get(dev, &status, &total_info_len);
-		if (ret)
-			return ret;
-	} while (status == SWITCHTEC_FAB_TOPO_INFO_DUMP_WAIT);
-
-	if (status != SWITCHTEC_FAB_TOPO_INFO_DUMP_READY)
-		return -1;
+	ret = topo_info_dump_wait(dev, &total_info_len);
+	if (ret)
+		return ret;
 
 	if (total_info_len > sizeof(reply))
 		return -1;
@@ -267,39 +297,69 @@ int switchtec_topo_info_dump(struct switchtec_dev *dev,
 		return topo_info_dump_gen5(dev, topo_info);
 }
 
-int switchtec_gfms_bind(struct switchtec_dev *dev,
-			struct switchtec_gfms_bind_req *req)
-{
-	int i;
-
+struct gfms_bind_cmd {
+	uint8_t subcmd;
+	uint8_t host_sw_idx;
+	uint8_t host_phys_port_id;
+	uint8_t host_log_port_id;
 	struct {
-		uint8_t subcmd;
-		uint8_t host_sw_idx;
-		uint8_t host_phys_port_id;
-		uint8_t host_log_port_id;
-		struct {
-			uint16_t pdfid;
-			uint8_t next_valid;
-			uint8_t reserved;
-		} function[SWITCHTEC_FABRIC_MULTI_FUNC_NUM];
-	} cmd;
+		uint16_t pdfid;
+		uint8_t next_valid;
+		uint8_t reserved;
+	} function[SWITCHTEC_FABRIC_MULTI_FUNC_NUM];
+};
 
-	struct {
-		uint8_t status;
-		uint8_t reserved[3];
-	} result;
+struct gfms_bind_result {
+	uint8_t status;
+	uint8_t reserved[3];
+};
+
+struct gfms_unbind_cmd {
+	uint8_t subcmd;
+	uint8_t host_sw_idx;
+	uint8_t host_phys_port_id;
+	uint8_t host_log_port_id;
+	uint16_t pdfid;
+	uint8_t option;
+	uint8_t reserved;
+};
+
+static void gfms_bind_cmd_fill(struct gfms_bind_cmd *cmd,
+			       const struct switchtec_gfms_bind_req *req)
+{
+	int i;
 
-	cmd.subcmd = MRPC_GFMS_BIND;
-	cmd.host_sw_idx = req->host_sw_idx;
-	cmd.host_phys_port_id = req->host_phys_port_id;
-	cmd.host_log_port_id = req->host_log_port_id;
+	cmd->subcmd = MRPC_GFMS_BIND;
+	cmd->host_sw_idx = req->host_sw_idx;
+	cmd->host_phys_port_id = req->host_phys_port_id;
+	cmd->host_log_port_id = req->host_log_port_id;
 
 	for (i = 0; i < req->ep_number; i++) {
-		cmd.function[i].pdfid = req->ep_pdfid[i];
-		cmd.function[i].next_valid = 0;
+		cmd->function[i].pdfid = req->ep_pdfid[i];
+		cmd->function[i].next_valid = 0;
 		if (i)
-			cmd.function[i - 1].next_valid = 1;
+			cmd->function[i - 1].next_valid = 1;
 	}
+}
+
+static void gfms_unbind_cmd_fill(struct gfms_unbind_cmd *cmd,
+				 const struct switchtec_gfms_unbind_req *req)
+{
+	cmd->subcmd = MRPC_GFMS_UNBIND;
+	cmd->host_sw_idx = req->host_sw_idx;
+	cmd->host_phys_port_id = req->host_phys_port_id;
+	cmd->host_log_port_id = req->host_log_port_id;
+	cmd->pdfid = req->pdfid;
+	cmd->option = req->option;
+}
+
+int switchtec_gfms_bind(struct switchtec_dev *dev,
+			struct switchtec_gfms_bind_req *req)
+{
+	struct gfms_bind_cmd cmd;
+	struct gfms_bind_result result;
+
+	gfms_bind_cmd_fill(&cmd, req);
 
 	return switchtec_cmd(dev, MRPC_GFMS_BIND_UNBIND, &cmd, sizeof(cmd),
 			     &result, sizeof(result));
@@ -308,31 +368,394 @@ int switchtec_gfms_bind(struct switchtec_dev *dev,
 int switchtec_gfms_unbind(struct switchtec_dev *dev,
 			  struct switchtec_gfms_unbind_req *req)
 {
-	struct {
-		uint8_t subcmd;
-		uint8_t host_sw_idx;
-		uint8_t host_phys_port_id;
-		uint8_t host_log_port_id;
-		uint16_t pdfid;
-		uint8_t option;
-		uint8_t reserved;
-	} cmd;
-
+	struct gfms_unbind_cmd cmd;
 	struct {
 		uint8_t status;
 	} result;
 
-	cmd.subcmd = MRPC_GFMS_UNBIND;
-	cmd.host_sw_idx = req->host_sw_idx;
-	cmd.host_phys_port_id = req->host_phys_port_id;
-	cmd.host_log_port_id = req->host_log_port_id;
-	cmd.pdfid = req->pdfid;
-	cmd.option = req->option;
+	gfms_unbind_cmd_fill(&cmd, req);
 
 	return switchtec_cmd(dev, MRPC_GFMS_BIND_UNBIND, &cmd, sizeof(cmd),
 			     &result, sizeof(result));
 }
 
+#define GFMS_BIND_POLL_US 10000
+
+struct gfms_bind_wait {
+	int entry;
+	uint8_t phys_port_id;
+	uint8_t log_port_id;
+	uint16_t pdfid;		//!< Function to wait to be unbound
+	int done;
+};
+
+static const struct switchtec_gfms_db_hvd_body *
+gfms_hvd_find(const struct switchtec_gfms_db_pax_all *all, int phy_pid)
+{
+	int i;
+
+	for (i = 0; i < all->hvd_all.hvd_count; i++)
+		if (all->hvd_all.bodies[i].phy_pid == phy_pid)
+			return &all->hvd_all.bodies[i];
+
+	return NULL;
+}
+
+static int gfms_hvd_slots(const struct switchtec_gfms_db_hvd_body *hvd)
+{
+	int n = hvd->logical_port_count * SWITCHTEC_FABRIC_MULTI_FUNC_NUM;
+
+	return n < ARRAY_SIZE(hvd->bound) ? n : ARRAY_SIZE(hvd->bound);
+}
+
+/* Functions bound to a host logical port, in function order */
+static int gfms_bound_pdfids(const struct switchtec_gfms_db_pax_all *all,
+			     int phy_pid, int log_pid, uint16_t *pdfids)
+{
+	const struct switchtec_gfms_db_hvd_body *hvd;
+	int i, n = 0;
+
+	hvd = gfms_hvd_find(all, phy_pid);
+	if (!hvd)
+		return -1;
+
+	for (i = 0; i < gfms_hvd_slots(hvd); i++)
+		if (hvd->bound[i].bound && hvd->bound[i].log_pid == log_pid &&
+		    n < SWITCHTEC_FABRIC_MULTI_FUNC_NUM)
+			pdfids[n++] = hvd->bound[i].bound_pdfid;
+
+	return n;
+}
+
+static bool gfms_bind_matches(const struct switchtec_gfms_db_pax_all *all,
+			      const struct switchtec_gfms_bind_map_entry *e)
+{
+	uint16_t pdfids[SWITCHTEC_FABRIC_MULTI_FUNC_NUM];
+	int n;
+
+	n = gfms_bound_pdfids(all, e->host_phys_port_id, e->host_log_port_id,
+			      pdfids);
+
+	return n == e->ep_number &&
+		!memcmp(pdfids, e->ep_pdfid, n * sizeof(*pdfids));
+}
+
+static bool gfms_pdfid_bound(const struct switchtec_gfms_db_pax_all *all,
+			     int phy_pid, int log_pid, uint16_t pdfid)
+{
+	uint16_t pdfids[SWITCHTEC_FABRIC_MULTI_FUNC_NUM];
+	int i, n;
+
+	n = gfms_bound_pdfids(all, phy_pid, log_pid, pdfids);
+	for (i = 0; i < n; i++)
+		if (pdfids[i] == pdfid)
+			return true;
+
+	return false;
+}
+
+static void gfms_bind_fail(struct switchtec_gfms_bind_map_entry *e, int ret)
+{
+	if (!e->ret)
+		e->ret = ret;
+}
+
+/*
+ * Wait for a phase: with unbind set, for every function in the list to
+ * be released, otherwise for every entry in the list to be bound as
+ * desired. One GFMS database dump covers all of them per poll.
+ */
+static int gfms_bind_wait_all(struct switchtec_dev *dev,
+			      struct switchtec_gfms_db_pax_all *all,
+			      struct gfms_bind_wait *w, int nr, bool unbind,
+			      struct switchtec_gfms_bind_map_entry *map,
+			      uint64_t deadline)
+{
+	int i, pending;
+	bool done;
+
+	do {
+		if (switchtec_fab_gfms_db_dump_pax_all(dev, all))
+			return -1;
+
+		pending = 0;
+		for (i = 0; i < nr; i++) {
+			if (w[i].done)
+				continue;
+
+			if (unbind)
+				done = !gfms_pdfid_bound(all, w[i].phys_port_id,
+							 w[i].log_port_id,
+							 w[i].pdfid);
+			else
+				done = gfms_bind_matches(all, &map[w[i].entry]);
+
+			if (done)
+				w[i].done = 1;
+			else
+				pending++;
+		}
+
+		if (!pending)
+			return 0;
+
+		usleep(GFMS_BIND_POLL_US);
+	} while (platform_time_us() < deadline);
+
+	for (i = 0; i < nr; i++)
+		if (!w[i].done)
+			gfms_bind_fail(&map[w[i].entry], -ETIMEDOUT);
+
+	return 0;
+}
+
+static int gfms_bind_run_phase(struct switchtec_dev *dev,
+			       struct switchtec_gfms_db_pax_all *all,
+			       struct switchtec_cmd_desc *desc,
+			       struct gfms_bind_wait *w, int nr, bool unbind,
+			       struct switchtec_gfms_bind_map_entry *map,
+			       uint64_t deadline)
+{
+	int i, ret;
+
+	if (!nr)
+		return 0;
+
+	ret = switchtec_cmd_batch(dev, desc, nr);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < nr; i++) {
+		if (desc[i].ret) {
+			gfms_bind_fail(&map[w[i].entry], desc[i].ret);
+			w[i].done = 1;
+		}
+	}
+
+	return gfms_bind_wait_all(dev, all, w, nr, unbind, map, deadline);
+}
+
+static int gfms_bind_add_unbind(struct gfms_unbind_cmd *cmd,
+				struct gfms_bind_wait *w, int n, int entry,
+				int sw_idx, int phy_pid, int log_pid,
+				uint16_t pdfid)
+{
+	struct switchtec_gfms_unbind_req req = {
+		.host_sw_idx = sw_idx,
+		.host_phys_port_id = phy_pid,
+		.host_log_port_id = log_pid,
+		.pdfid = pdfid,
+	};
+
+	gfms_unbind_cmd_fill(&cmd[n], &req);
+	w[n] = (struct gfms_bind_wait) {
+		.entry = entry,
+		.phys_port_id = phy_pid,
+		.log_port_id = log_pid,
+		.pdfid = pdfid,
+	};
+
+	return n + 1;
+}
+
+static int gfms_map_find(const struct switchtec_gfms_bind_map_entry *map,
+			 int nr, int phy_pid, int log_pid)
+{
+	int i;
+
+	for (i = 0; i < nr; i++)
+		if (map[i].host_phys_port_id == phy_pid &&
+		    map[i].host_log_port_id == log_pid)
+			return i;
+
+	return -1;
+}
+
+/**
+ * @brief Move the GFMS bindings of the hosts of a PAX to a desired map
+ * @param[in]     dev		Switchtec device handle
+ * @param[in,out] map		Desired functions of each host logical port
+ * @param[in]     nr		Number of entries in \p map
+ * @param[in]     timeout_ms	Time to wait for the whole set of changes
+ * @return The number of entries that failed, or -1 on error (with
+ *	errno set); the reason of each failure is in its ret field
+ *
+ * This is the fabric counterpart of switchtec_bind_apply() for the
+ * hosts of the PAX the handle currently targets. The GFMS database is
+ * dumped once to find the functions bound to every host logical port.
+ * Logical ports already bound to exactly the desired functions are
+ * left alone. Every other entry has its current functions unbound, as
+ * does any logical port outside the map that holds a function the map
+ * wants, before the new functions are bound in a single bind command.
+ *
+ * All unbinds are issued as one command batch and waited for together
+ * with one database dump per poll, then the same is done for the binds.
+ * The ret field of an entry is 0 on success, the MRPC error of a
+ * rejected command, -ETIMEDOUT if the database did not show the change
+ * in time, or -EINVAL/-ENODEV for a bad entry.
+ */
+int switchtec_gfms_bind_apply(struct switchtec_dev *dev,
+			      struct switchtec_gfms_bind_map_entry *map,
+			      int nr, unsigned int timeout_ms)
+{
+	const int funcs = SWITCHTEC_FABRIC_MULTI_FUNC_NUM;
+	uint16_t pdfids[SWITCHTEC_FABRIC_MULTI_FUNC_NUM];
+	const struct switchtec_gfms_db_hvd_body *hvd;
+	struct switchtec_gfms_db_pax_all *all = NULL;
+	struct switchtec_cmd_desc *desc = NULL;
+	struct gfms_unbind_cmd *unb = NULL;
+	struct gfms_bind_result *res = NULL;
+	struct gfms_bind_cmd *bnd = NULL;
+	struct gfms_bind_wait *w = NULL;
+	int i, j, k, f, h, cnt, n = 0;
+	int sw_idx, ret = -1;
+	uint64_t deadline;
+
+	if (!map || nr < 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Each entry unbinds at most its own and the holders' functions */
+	all = malloc(sizeof(*all));
+	desc = calloc(2 * funcs * nr, sizeof(*desc));
+	unb = calloc(2 * funcs * nr, sizeof(*unb));
+	res = calloc(2 * funcs * nr, sizeof(*res));
+	bnd = calloc(nr, sizeof(*bnd));
+	w = calloc(2 * funcs * nr, sizeof(*w));
+	if (!all || !desc || !unb || !res || !bnd || !w)
+		goto out;
+
+	if (switchtec_fab_gfms_db_dump_pax_all(dev, all))
+		goto out;
+
+	sw_idx = all->pax_general.hdr.pax_idx;
+
+	for (i = 0; i < nr; i++) {
+		map[i].op = SWITCHTEC_BIND_OP_NONE;
+		map[i].ret = 0;
+	}
+
+	for (i = 0; i < nr; i++) {
+		if (map[i].ep_number < 0 || map[i].ep_number > funcs ||
+		    gfms_map_find(map, i, map[i].host_phys_port_id,
+				  map[i].host_log_port_id) >= 0)
+			gfms_bind_fail(&map[i], -EINVAL);
+
+		for (j = 0; j < i; j++)
+			for (f = 0; f < map[i].ep_number; f++)
+				for (k = 0; k < map[j].ep_number; k++)
+					if (map[i].ep_pdfid[f] ==
+					    map[j].ep_pdfid[k]) {
+						gfms_bind_fail(&map[i], -EINVAL);
+						gfms_bind_fail(&map[j], -EINVAL);
+					}
+
+		if (!gfms_hvd_find(all, map[i].host_phys_port_id))
+			gfms_bind_fail(&map[i], -ENODEV);
+	}
+
+	for (i = 0; i < nr; i++) {
+		if (map[i].ret || gfms_bind_matches(all, &map[i]))
+			continue;
+
+		cnt = gfms_bound_pdfids(all, map[i].host_phys_port_id,
+					map[i].host_log_port_id, pdfids);
+		for (f = 0; f < cnt; f++)
+			n = gfms_bind_add_unbind(unb, w, n, i, sw_idx,
+						 map[i].host_phys_port_id,
+						 map[i].host_log_port_id,
+						 pdfids[f]);
+
+		if (!map[i].ep_number)
+			map[i].op = SWITCHTEC_BIND_OP_UNBIND;
+		else
+			map[i].op = cnt ? SWITCHTEC_BIND_OP_REBIND :
+				SWITCHTEC_BIND_OP_BIND;
+
+		/* Release wanted functions held by ports outside the map */
+		for (h = 0; h < all->hvd_all.hvd_count; h++) {
+			hvd = &all->hvd_all.bodies[h];
+			for (k = 0; k < gfms_hvd_slots(hvd); k++) {
+				if (!hvd->bound[k].bound ||
+				    gfms_map_find(map, nr, hvd->phy_pid,
+						  hvd->bound[k].log_pid) >= 0)
+					continue;
+
+				for (f = 0; f < map[i].ep_number; f++)
+					if (map[i].ep_pdfid[f] ==
+					    hvd->bound[k].bound_pdfid)
+						n = gfms_bind_add_unbind(unb,
+							w, n, i, sw_idx,
+							hvd->phy_pid,
+							hvd->bound[k].log_pid,
+							hvd->bound[k].bound_pdfid);
+			}
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		desc[i] = (struct switchtec_cmd_desc) {
+			.cmd = MRPC_GFMS_BIND_UNBIND,
+			.payload = &unb[i],
+			.payload_len = sizeof(unb[i]),
+			.resp = &res[i],
+			.resp_len = sizeof(res[i].status),
+		};
+
+	deadline = platform_time_us() + timeout_ms * 1000ULL;
+
+	ret = gfms_bind_run_phase(dev, all, desc, w, n, true, map, deadline);
+	if (ret)
+		goto out;
+
+	n = 0;
+	for (i = 0; i < nr; i++) {
+		struct switchtec_gfms_bind_req req = {
+			.host_sw_idx = sw_idx,
+			.host_phys_port_id = map[i].host_phys_port_id,
+			.host_log_port_id = map[i].host_log_port_id,
+			.ep_number = map[i].ep_number,
+		};
+
+		if (map[i].ret || !map[i].ep_number ||
+		    map[i].op == SWITCHTEC_BIND_OP_NONE)
+			continue;
+
+		memcpy(req.ep_pdfid, map[i].ep_pdfid, sizeof(req.ep_pdfid));
+		memset(&bnd[n], 0, sizeof(bnd[n]));
+		gfms_bind_cmd_fill(&bnd[n], &req);
+		desc[n] = (struct switchtec_cmd_desc) {
+			.cmd = MRPC_GFMS_BIND_UNBIND,
+			.payload = &bnd[n],
+			.payload_len = sizeof(bnd[n]),
+			.resp = &res[n],
+			.resp_len = sizeof(res[n]),
+		};
+		w[n] = (struct gfms_bind_wait) {
+			.entry = i,
+		};
+		n++;
+	}
+
+	ret = gfms_bind_run_phase(dev, all, desc, w, n, false, map, deadline);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < nr; i++)
+		if (map[i].ret)
+			ret++;
+
+out:
+	free(all);
+	free(desc);
+	free(unb);
+	free(res);
+	free(bnd);
+	free(w);
+	return ret;
+}
+
 int switchtec_port_control(struct switchtec_dev *dev, uint8_t control_type,
 			   uint8_t phys_port_id, uint8_t hot_reset_flag)
 {
@@ -1044,6 +1467,231 @@ int switchtec_fab_gfms_db_dump_pax_all(
 	return ret;
 }
 
+static int fab_crawl_dump(struct switchtec_dev *dev, int pax_id, int flags,
+			  struct switchtec_fab_topo_node *node)
+{
+	int ret, i;
+
+	for (i = 0; i < SWITCHTEC_MAX_PORTS; i++)
+		node->topo.port_info_list[i].phys_port_id = 0xff;
+
+	ret = switchtec_set_pax_id(dev, pax_id);
+	if (ret)
+		return ret;
+
+	ret = switchtec_topo_info_dump(dev, &node->topo);
+	if (ret)
+		return ret;
+
+	if (flags & SWITCHTEC_FAB_CRAWL_GFMS)
+		ret = switchtec_fab_gfms_db_dump_pax_general(dev,
+							     &node->pax_general);
+
+	return ret;
+}
+
+/*
+ * Dump one PAX through the caller's handle, restoring its PAX ID
+ * afterwards. The handle lock keeps other users of the handle from
+ * seeing the temporary PAX ID.
+ */
+static void fab_crawl_dump_serial(struct switchtec_dev *dev, int pax_id,
+				  int flags, struct switchtec_fab_topo_node *node)
+{
+	int saved;
+
+	platform_lock(dev);
+	saved = dev->pax_id;
+
+	node->ret = fab_crawl_dump(dev, pax_id, flags, node);
+	node->err = node->ret ? errno : 0;
+
+	if (dev->pax_id != saved)
+		switchtec_topo_invalidate(dev);
+	dev->pax_id = saved;
+	platform_unlock(dev);
+}
+
+struct fab_crawl_job {
+	struct switchtec_dev *dev;
+	struct switchtec_fab_topo_node *node;
+	int pax_id;
+	int flags;
+	pthread_t thread;
+	bool started;
+};
+
+static void *fab_crawl_worker(void *arg)
+{
+	struct fab_crawl_job *job = arg;
+
+	job->node->ret = fab_crawl_dump(job->dev, job->pax_id, job->flags,
+					job->node);
+	job->node->err = job->node->ret ? errno : 0;
+
+	return NULL;
+}
+
+static uint32_t fab_crawl_routes(const struct switchtec_fab_topo_info *topo)
+{
+	uint32_t map = 0;
+	int i;
+
+	for (i = 0; i < SWITCHTEC_FAB_MAX_PAX; i++)
+		if (topo->route_port[i] != 0xff)
+			map |= 1 << i;
+
+	return map;
+}
+
+/**
+ * @brief Dump the topology of every switch reachable in the fabric
+ * @param[in]  dev	Switchtec device handle
+ * @param[out] graph	Per-PAX topology, indexed by PAX ID
+ * @param[in]  flags	Bitmask of ::switchtec_fab_crawl_flags
+ * @return 0 on success, error code if the local switch could not be
+ *	dumped
+ *
+ * The local switch is dumped first and its route table names the other
+ * PAX IDs in the fabric. Newly discovered PAX IDs are crawled in further
+ * rounds until no new ones appear.
+ *
+ * When the transport serializes MRPCs between handles (the kernel
+ * driver or switchtecd), the PAX IDs of a round are dumped concurrently,
+ * each over its own handle opened with the name \p dev was opened with,
+ * so the firmware's per-switch dump latency overlaps. If such a handle
+ * cannot be opened that PAX is dumped through \p dev instead. Transports
+ * that drive the MRPC mailbox directly (I2C, UART and Ethernet) always
+ * dump through \p dev, one PAX at a time, since commands from separate
+ * handles would clobber each other.
+ *
+ * A failure on a remote PAX does not fail the crawl; check the
+ * graph->dumped bitmap and each node's ret and err fields.
+ */
+int switchtec_fab_topo_crawl(struct switchtec_dev *dev,
+			     struct switchtec_fab_topo_graph *graph,
+			     int flags)
+{
+	struct fab_crawl_job jobs[SWITCHTEC_FAB_MAX_PAX];
+	struct switchtec_fab_topo_node *node;
+	uint32_t pending;
+	bool fan_out;
+	int local, i;
+
+	if (!switchtec_is_pax_all(dev)) {
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	memset(graph, 0, sizeof(*graph));
+
+	local = dev->local_pax_id;
+	if (local < 0 || local >= SWITCHTEC_FAB_MAX_PAX) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	graph->local_pax_id = local;
+	graph->present = 1 << local;
+	graph->num_nodes = 1;
+
+	node = &graph->nodes[local];
+	fab_crawl_dump_serial(dev, SWITCHTEC_PAX_ID_LOCAL, flags, node);
+	if (node->ret) {
+		errno = node->err;
+		return node->ret;
+	}
+	graph->dumped = 1 << local;
+
+	pending = fab_crawl_routes(&node->topo) & ~graph->present;
+	fan_out = dev->ops->flags & SWITCHTEC_OPS_FLAG_CMD_SHARED;
+
+	while (pending) {
+		memset(jobs, 0, sizeof(jobs));
+
+		for (i = 0; i < SWITCHTEC_FAB_MAX_PAX; i++) {
+			if (!(pending & (1 << i)))
+				continue;
+
+			graph->present |= 1 << i;
+			graph->num_nodes++;
+
+			jobs[i].node = &graph->nodes[i];
+			jobs[i].pax_id = i;
+			jobs[i].flags = flags;
+			if (!fan_out)
+				continue;
+
+			jobs[i].dev = switchtec_open_flags(switchtec_name(dev),
+						SWITCHTEC_OPEN_LAZY_PROBE);
+			if (!jobs[i].dev)
+				continue;
+
+			if (pthread_create(&jobs[i].thread, NULL,
+					   fab_crawl_worker, &jobs[i])) {
+				switchtec_close(jobs[i].dev);
+				jobs[i].dev = NULL;
+				continue;
+			}
+			jobs[i].started = true;
+		}
+
+		for (i = 0; i < SWITCHTEC_FAB_MAX_PAX; i++) {
+			if (!(pending & (1 << i)))
+				continue;
+
+			if (jobs[i].started) {
+				pthread_join(jobs[i].thread, NULL);
+				switchtec_close(jobs[i].dev);
+			} else {
+				fab_crawl_dump_serial(dev, i, flags,
+						      jobs[i].node);
+			}
+		}
+
+		pending = 0;
+		for (i = 0; i < SWITCHTEC_FAB_MAX_PAX; i++) {
+			node = &graph->nodes[i];
+			if (!(graph->present & (1 << i)) || node->ret ||
+			    (graph->dumped & (1 << i)))
+				continue;
+
+			graph->dumped |= 1 << i;
+			pending |= fab_crawl_routes(&node->topo);
+		}
+		pending &= ~graph->present;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Look up the port a switch uses to reach another in a crawled fabric
+ * @param[in] graph	Graph filled by switchtec_fab_topo_crawl()
+ * @param[in] from_pax	PAX ID of the switch the route starts at
+ * @param[in] to_pax	PAX ID of the destination switch
+ * @return The physical port on \p from_pax, or -1 if there is no route
+ *	or \p from_pax was not dumped
+ */
+int switchtec_fab_topo_route(const struct switchtec_fab_topo_graph *graph,
+			     int from_pax, int to_pax)
+{
+	int port;
+
+	if (from_pax < 0 || from_pax >= SWITCHTEC_FAB_MAX_PAX ||
+	    to_pax < 0 || to_pax >= SWITCHTEC_FAB_MAX_PAX)
+		return -1;
+
+	if (!(graph->dumped & (1 << from_pax)))
+		return -1;
+
+	port = graph->nodes[from_pax].topo.route_port[to_pax];
+	if (port == 0xff)
+		return -1;
+
+	return port;
+}
+
 int switchtec_get_gfms_events(struct switchtec_dev *dev,
 			      struct switchtec_gfms_event *elist,
 			      size_t elist_len, int *overflow,
@@ -1124,7 +1772,556 @@ int switchtec_clear_gfms_events(struct switchtec_dev *dev)
 	return 0;
 }
 
-int switchtec_device_manage(struct switchtec_dev *dev,
+#define GFMS_SNAP_MAX_HVD 256
+
+struct switchtec_gfms_db_snapshot {
+	int pax_idx;
+	bool resync;
+	struct switchtec_gfms_db_pax_general pax_general;
+	struct switchtec_gfms_db_hvd_detail *hvd[GFMS_SNAP_MAX_HVD];
+	struct switchtec_gfms_db_ep_port_section *ep[SWITCHTEC_MAX_PORTS];
+	uint32_t hvd_dirty[GFMS_SNAP_MAX_HVD / 32];
+	uint64_t ep_dirty;
+};
+
+struct gfms_snap_diff {
+	struct switchtec_gfms_db_change *changes;
+	int max;
+	int count;
+};
+
+static void gfms_snap_record(struct gfms_snap_diff *diff,
+			     enum switchtec_gfms_db_section section,
+			     enum switchtec_gfms_db_change_type type, int id)
+{
+	if (diff->count < diff->max) {
+		diff->changes[diff->count].section = section;
+		diff->changes[diff->count].type = type;
+		diff->changes[diff->count].id = id;
+	}
+
+	diff->count++;
+}
+
+static void gfms_snap_set_hvd(struct switchtec_gfms_db_snapshot *snap, int id,
+			      struct switchtec_gfms_db_hvd_detail *hvd,
+			      struct gfms_snap_diff *diff)
+{
+	struct switchtec_gfms_db_hvd_detail *old = snap->hvd[id];
+
+	if (!old && hvd)
+		gfms_snap_record(diff, SWITCHTEC_GFMS_DB_SECTION_HVD,
+				 SWITCHTEC_GFMS_DB_ADDED, id);
+	else if (old && !hvd)
+		gfms_snap_record(diff, SWITCHTEC_GFMS_DB_SECTION_HVD,
+				 SWITCHTEC_GFMS_DB_REMOVED, id);
+	else if (old && memcmp(old, hvd, sizeof(*hvd)))
+		gfms_snap_record(diff, SWITCHTEC_GFMS_DB_SECTION_HVD,
+				 SWITCHTEC_GFMS_DB_CHANGED, id);
+
+	free(old);
+	snap->hvd[id] = hvd;
+}
+
+/*
+ * EP port sections taken from a PAX_ALL dump and from a single EP_PORT
+ * dump carry different section headers, so only the port data itself
+ * is compared.
+ */
+static void gfms_snap_set_ep(struct switchtec_gfms_db_snapshot *snap, int id,
+			     struct switchtec_gfms_db_ep_port_section *ep,
+			     struct gfms_snap_diff *diff)
+{
+	struct switchtec_gfms_db_ep_port_section *old = snap->ep[id];
+
+	if (!old && ep)
+		gfms_snap_record(diff, SWITCHTEC_GFMS_DB_SECTION_EP_PORT,
+				 SWITCHTEC_GFMS_DB_ADDED, id);
+	else if (old && !ep)
+		gfms_snap_record(diff, SWITCHTEC_GFMS_DB_SECTION_EP_PORT,
+				 SWITCHTEC_GFMS_DB_REMOVED, id);
+	else if (old && memcmp(&old->ep_port, &ep->ep_port,
+			       sizeof(ep->ep_port)))
+		gfms_snap_record(diff, SWITCHTEC_GFMS_DB_SECTION_EP_PORT,
+				 SWITCHTEC_GFMS_DB_CHANGED, id);
+
+	free(old);
+	snap->ep[id] = ep;
+}
+
+static void gfms_snap_set_pax_general(struct switchtec_gfms_db_snapshot *snap,
+		const struct switchtec_gfms_db_pax_general *pax_general,
+		struct gfms_snap_diff *diff)
+{
+	if (memcmp(&snap->pax_general.body, &pax_general->body,
+		   sizeof(pax_general->body)))
+		gfms_snap_record(diff, SWITCHTEC_GFMS_DB_SECTION_PAX_GENERAL,
+				 SWITCHTEC_GFMS_DB_CHANGED, 0);
+
+	snap->pax_general = *pax_general;
+	snap->pax_idx = pax_general->hdr.pax_idx;
+}
+
+/*
+ * Dump one HVD. An MRPC error means the instance no longer exists, which
+ * is reported as a NULL section rather than a failure.
+ */
+static int gfms_snap_dump_hvd(struct switchtec_dev *dev, int id,
+			      struct switchtec_gfms_db_hvd_detail **hvd)
+{
+	int ret;
+
+	*hvd = calloc(1, sizeof(**hvd));
+	if (!*hvd)
+		return -1;
+
+	ret = switchtec_fab_gfms_db_dump_hvd_detail(dev, id, *hvd);
+	if (ret) {
+		free(*hvd);
+		*hvd = NULL;
+	}
+
+	return ret < 0 ? ret : 0;
+}
+
+static int gfms_snap_dump_ep(struct switchtec_dev *dev, int id,
+			     struct switchtec_gfms_db_ep_port_section **ep)
+{
+	int ret;
+
+	*ep = calloc(1, sizeof(**ep));
+	if (!*ep)
+		return -1;
+
+	ret = switchtec_fab_gfms_db_dump_ep_port(dev, id, *ep);
+	if (ret) {
+		free(*ep);
+		*ep = NULL;
+	}
+
+	return ret < 0 ? ret : 0;
+}
+
+static int gfms_snap_resync(struct switchtec_dev *dev,
+			    struct switchtec_gfms_db_snapshot *snap,
+			    struct gfms_snap_diff *diff)
+{
+	struct switchtec_gfms_db_hvd_detail *hvd[GFMS_SNAP_MAX_HVD] = {};
+	struct switchtec_gfms_db_ep_port_section *ep[SWITCHTEC_MAX_PORTS] = {};
+	struct switchtec_gfms_db_pax_all *pax_all;
+	struct switchtec_gfms_db_ep_port *port;
+	int i, id, ret;
+
+	pax_all = calloc(1, sizeof(*pax_all));
+	if (!pax_all)
+		return -1;
+
+	ret = switchtec_fab_gfms_db_dump_pax_all(dev, pax_all);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < pax_all->hvd_all.hvd_count &&
+		    i < SWITCHTEC_FABRIC_MAX_HOST_PER_SWITCH; i++) {
+		id = pax_all->hvd_all.bodies[i].hvd_inst_id;
+		if (hvd[id])
+			continue;
+
+		ret = gfms_snap_dump_hvd(dev, id, &hvd[id]);
+		if (ret)
+			goto out;
+	}
+
+	for (i = 0; i < pax_all->ep_port_all.ep_port_count &&
+		    i < SWITCHTEC_FABRIC_MAX_DEV_PER_SWITCH; i++) {
+		port = &pax_all->ep_port_all.ep_ports[i];
+		id = port->port_hdr.phy_pid;
+		if (id >= SWITCHTEC_MAX_PORTS || ep[id])
+			continue;
+
+		ep[id] = calloc(1, sizeof(*ep[id]));
+		if (!ep[id]) {
+			ret = -1;
+			goto out;
+		}
+
+		ep[id]->hdr = pax_all->ep_port_all.hdr;
+		ep[id]->ep_port = *port;
+	}
+
+	gfms_snap_set_pax_general(snap, &pax_all->pax_general, diff);
+
+	for (i = 0; i < GFMS_SNAP_MAX_HVD; i++) {
+		gfms_snap_set_hvd(snap, i, hvd[i], diff);
+		hvd[i] = NULL;
+	}
+
+	for (i = 0; i < SWITCHTEC_MAX_PORTS; i++) {
+		gfms_snap_set_ep(snap, i, ep[i], diff);
+		ep[i] = NULL;
+	}
+
+	snap->resync = false;
+	memset(snap->hvd_dirty, 0, sizeof(snap->hvd_dirty));
+	snap->ep_dirty = 0;
+
+out:
+	for (i = 0; i < GFMS_SNAP_MAX_HVD; i++)
+		free(hvd[i]);
+	for (i = 0; i < SWITCHTEC_MAX_PORTS; i++)
+		free(ep[i]);
+	free(pax_all);
+
+	return ret;
+}
+
+/**
+ * @brief Take a snapshot of the GFMS database of a switch
+ * @param[in] dev	Switchtec device handle
+ * @return The snapshot, or NULL on failure
+ *
+ * The snapshot holds the PAX general section plus the detail of every
+ * HVD and EP port of the switch \p dev currently addresses (see
+ * switchtec_set_pax_id()). It is kept up to date with
+ * switchtec_fab_gfms_db_snapshot_update(), which re-dumps only the
+ * sections named by pending GFMS events. Free it with
+ * switchtec_fab_gfms_db_snapshot_free().
+ */
+struct switchtec_gfms_db_snapshot *
+switchtec_fab_gfms_db_snapshot(struct switchtec_dev *dev)
+{
+	struct switchtec_gfms_db_snapshot *snap;
+	struct gfms_snap_diff diff = {};
+	int ret;
+
+	if (!switchtec_is_pax_all(dev)) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+
+	snap = calloc(1, sizeof(*snap));
+	if (!snap)
+		return NULL;
+
+	ret = gfms_snap_resync(dev, snap, &diff);
+	if (ret) {
+		switchtec_fab_gfms_db_snapshot_free(snap);
+		if (ret > 0)
+			errno = ret;
+		return NULL;
+	}
+
+	return snap;
+}
+
+/**
+ * @brief Free a GFMS database snapshot
+ * @param[in] snap	Snapshot from switchtec_fab_gfms_db_snapshot()
+ */
+void switchtec_fab_gfms_db_snapshot_free(
+		struct switchtec_gfms_db_snapshot *snap)
+{
+	int i;
+
+	if (!snap)
+		return;
+
+	for (i = 0; i < GFMS_SNAP_MAX_HVD; i++)
+		free(snap->hvd[i]);
+	for (i = 0; i < SWITCHTEC_MAX_PORTS; i++)
+		free(snap->ep[i]);
+
+	free(snap);
+}
+
+static void gfms_snap_mark_hvd_port(struct switchtec_gfms_db_snapshot *snap,
+				    int phy_pid)
+{
+	int i;
+
+	for (i = 0; i < GFMS_SNAP_MAX_HVD; i++)
+		if (snap->hvd[i] && snap->hvd[i]->body.phy_pid == phy_pid)
+			snap->hvd_dirty[i / 32] |= 1u << (i % 32);
+}
+
+static void gfms_snap_mark_ep(struct switchtec_gfms_db_snapshot *snap,
+			      int phy_pid)
+{
+	if (phy_pid < SWITCHTEC_MAX_PORTS)
+		snap->ep_dirty |= 1ull << phy_pid;
+}
+
+static bool gfms_snap_ep_has_pdfid(const struct switchtec_gfms_db_ep_port_ep *ep,
+				   int pdfid)
+{
+	int i;
+
+	for (i = 0; i < ep->ep_hdr.function_number &&
+		    i < SWITCHTEC_FABRIC_MAX_FUNC_PER_DEV; i++)
+		if (ep->functions[i].pdfid == pdfid)
+			return true;
+
+	return false;
+}
+
+static void gfms_snap_mark_pdfid(struct switchtec_gfms_db_snapshot *snap,
+				 int pdfid)
+{
+	const struct switchtec_gfms_db_ep_port *port;
+	int i, j;
+
+	for (i = 0; i < SWITCHTEC_MAX_PORTS; i++) {
+		if (!snap->ep[i])
+			continue;
+
+		port = &snap->ep[i]->ep_port;
+		if (port->port_hdr.type == SWITCHTEC_GFMS_DB_TYPE_EP) {
+			if (gfms_snap_ep_has_pdfid(&port->ep_ep, pdfid))
+				gfms_snap_mark_ep(snap, i);
+		} else if (port->port_hdr.type ==
+			   SWITCHTEC_GFMS_DB_TYPE_SWITCH) {
+			for (j = 0; j < port->port_hdr.ep_count &&
+				    j < SWITCHTEC_FABRIC_MAX_DEV_PER_SWITCH; j++)
+				if (gfms_snap_ep_has_pdfid(
+					&port->ep_switch.switch_eps[j], pdfid))
+					gfms_snap_mark_ep(snap, i);
+		}
+	}
+}
+
+/**
+ * @brief Mark the snapshot sections affected by GFMS events as stale
+ * @param[in] snap	Snapshot to update
+ * @param[in] elist	Events as returned by switchtec_get_gfms_events()
+ * @param[in] count	Number of events in \p elist
+ * @param[in] overflow	Non-zero if the event queue overflowed, in which
+ *	case the whole snapshot is re-dumped on the next refresh
+ *
+ * Use this when the application reads the GFMS events itself. Events for
+ * other switches are ignored, except bindings that involve a function of
+ * this switch. Fabric link changes and database change events force a
+ * full re-dump.
+ */
+void switchtec_fab_gfms_db_snapshot_mark(
+		struct switchtec_gfms_db_snapshot *snap,
+		const struct switchtec_gfms_event *elist, int count,
+		int overflow)
+{
+	const struct switchtec_gfms_event *e;
+	bool local;
+	int i;
+
+	if (overflow)
+		snap->resync = true;
+
+	for (i = 0; i < count; i++) {
+		e = &elist[i];
+		local = e->src_sw_id == snap->pax_idx;
+
+		switch (e->event_code) {
+		case SWITCHTEC_GFMS_EVENT_HOST_LINK_UP:
+		case SWITCHTEC_GFMS_EVENT_HOST_LINK_DOWN:
+			if (local)
+				gfms_snap_mark_hvd_port(snap,
+						e->data.host.phys_port_id);
+			break;
+		case SWITCHTEC_GFMS_EVENT_DEV_ADD:
+		case SWITCHTEC_GFMS_EVENT_DEV_DEL:
+			if (local)
+				gfms_snap_mark_ep(snap,
+						  e->data.dev.phys_port_id);
+			break;
+		case SWITCHTEC_GFMS_EVENT_EP_PORT_ADD:
+		case SWITCHTEC_GFMS_EVENT_EP_PORT_REMOVE:
+			if (local)
+				gfms_snap_mark_ep(snap,
+						  e->data.ep.phys_port_id);
+			break;
+		case SWITCHTEC_GFMS_EVENT_HVD_INST_ENABLE:
+		case SWITCHTEC_GFMS_EVENT_HVD_INST_DISABLE:
+			if (local)
+				snap->hvd_dirty[e->data.hvd.hvd_inst_id / 32] |=
+					1u << (e->data.hvd.hvd_inst_id % 32);
+			break;
+		case SWITCHTEC_GFMS_EVENT_BIND:
+		case SWITCHTEC_GFMS_EVENT_UNBIND:
+			if (e->data.bind.host_sw_idx == snap->pax_idx)
+				gfms_snap_mark_hvd_port(snap,
+					e->data.bind.host_phys_port_id);
+			gfms_snap_mark_pdfid(snap, e->data.bind.pdfid);
+			break;
+		case SWITCHTEC_GFMS_EVENT_FAB_LINK_UP:
+		case SWITCHTEC_GFMS_EVENT_FAB_LINK_DOWN:
+		case SWITCHTEC_GFMS_EVENT_DATABASE_CHANGED:
+			snap->resync = true;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+/**
+ * @brief Re-dump the stale sections of a snapshot and diff them
+ * @param[in]  dev		Switchtec device handle
+ * @param[in]  snap		Snapshot to refresh
+ * @param[out] changes		Sections that differ from the previous
+ *	snapshot (may be NULL if \p max_changes is 0)
+ * @param[in]  max_changes	Number of entries in \p changes
+ * @return The number of changed sections, which may exceed
+ *	\p max_changes, or an error code on failure
+ *
+ * On failure the sections not yet re-dumped stay marked and are retried
+ * by the next refresh.
+ */
+int switchtec_fab_gfms_db_snapshot_refresh(
+		struct switchtec_dev *dev,
+		struct switchtec_gfms_db_snapshot *snap,
+		struct switchtec_gfms_db_change *changes, int max_changes)
+{
+	struct gfms_snap_diff diff = {
+		.changes = changes,
+		.max = max_changes,
+	};
+	struct switchtec_gfms_db_pax_general pax_general;
+	struct switchtec_gfms_db_hvd_detail *hvd;
+	struct switchtec_gfms_db_ep_port_section *ep;
+	bool dirty = snap->ep_dirty;
+	int i, ret;
+
+	if (snap->resync) {
+		ret = gfms_snap_resync(dev, snap, &diff);
+		return ret ? ret : diff.count;
+	}
+
+	for (i = 0; i < GFMS_SNAP_MAX_HVD / 32; i++)
+		if (snap->hvd_dirty[i])
+			dirty = true;
+
+	if (!dirty)
+		return 0;
+
+	/* Instance and EP counts live here, so refresh it with any change */
+	ret = switchtec_fab_gfms_db_dump_pax_general(dev, &pax_general);
+	if (ret)
+		return ret;
+	gfms_snap_set_pax_general(snap, &pax_general, &diff);
+
+	for (i = 0; i < GFMS_SNAP_MAX_HVD; i++) {
+		if (!(snap->hvd_dirty[i / 32] & (1u << (i % 32))))
+			continue;
+
+		ret = gfms_snap_dump_hvd(dev, i, &hvd);
+		if (ret)
+			return ret;
+
+		gfms_snap_set_hvd(snap, i, hvd, &diff);
+		snap->hvd_dirty[i / 32] &= ~(1u << (i % 32));
+	}
+
+	for (i = 0; i < SWITCHTEC_MAX_PORTS; i++) {
+		if (!(snap->ep_dirty & (1ull << i)))
+			continue;
+
+		ret = gfms_snap_dump_ep(dev, i, &ep);
+		if (ret)
+			return ret;
+
+		gfms_snap_set_ep(snap, i, ep, &diff);
+		snap->ep_dirty &= ~(1ull << i);
+	}
+
+	return diff.count;
+}
+
+#define GFMS_SNAP_EVENT_BATCH 64
+
+/**
+ * @brief Read pending GFMS events and refresh the affected sections
+ * @param[in]  dev		Switchtec device handle
+ * @param[in]  snap		Snapshot to update
+ * @param[out] changes		Sections that differ from the previous
+ *	snapshot (may be NULL if \p max_changes is 0)
+ * @param[in]  max_changes	Number of entries in \p changes
+ * @return The number of changed sections, which may exceed
+ *	\p max_changes, or an error code on failure
+ *
+ * This consumes the switch's GFMS event queue. Applications that also
+ * need the events should read them with switchtec_get_gfms_events() and
+ * pass them to switchtec_fab_gfms_db_snapshot_mark() and
+ * switchtec_fab_gfms_db_snapshot_refresh() instead.
+ */
+int switchtec_fab_gfms_db_snapshot_update(
+		struct switchtec_dev *dev,
+		struct switchtec_gfms_db_snapshot *snap,
+		struct switchtec_gfms_db_change *changes, int max_changes)
+{
+	struct switchtec_gfms_event elist[GFMS_SNAP_EVENT_BATCH];
+	size_t remain;
+	int overflow;
+	int n;
+
+	do {
+		overflow = 0;
+		remain = 0;
+		n = switchtec_get_gfms_events(dev, elist, ARRAY_SIZE(elist),
+					      &overflow, &remain);
+		if (n < 0)
+			return n;
+
+		switchtec_fab_gfms_db_snapshot_mark(snap, elist, n, overflow);
+	} while (n && remain);
+
+	return switchtec_fab_gfms_db_snapshot_refresh(dev, snap, changes,
+						      max_changes);
+}
+
+/**
+ * @brief Get the PAX general section of a snapshot
+ * @param[in] snap	GFMS database snapshot
+ * @return The section, valid until the next refresh
+ */
+const struct switchtec_gfms_db_pax_general *
+switchtec_fab_gfms_db_snapshot_pax_general(
+		const struct switchtec_gfms_db_snapshot *snap)
+{
+	return &snap->pax_general;
+}
+
+/**
+ * @brief Get the detail of one HVD from a snapshot
+ * @param[in] snap		GFMS database snapshot
+ * @param[in] hvd_inst_id	HVD instance ID
+ * @return The section, valid until the next refresh, or NULL if the
+ *	HVD is not present
+ */
+const struct switchtec_gfms_db_hvd_detail *
+switchtec_fab_gfms_db_snapshot_hvd(
+		const struct switchtec_gfms_db_snapshot *snap, int hvd_inst_id)
+{
+	if (hvd_inst_id < 0 || hvd_inst_id >= GFMS_SNAP_MAX_HVD)
+		return NULL;
+
+	return snap->hvd[hvd_inst_id];
+}
+
+/**
+ * @brief Get one EP port section from a snapshot
+ * @param[in] snap	GFMS database snapshot
+ * @param[in] phy_pid	Physical port ID of the EP port
+ * @return The section, valid until the next refresh, or NULL if the
+ *	port has no EP section
+ */
+const struct switchtec_gfms_db_ep_port_section *
+switchtec_fab_gfms_db_snapshot_ep_port(
+		const struct switchtec_gfms_db_snapshot *snap, int phy_pid)
+{
+	if (phy_pid < 0 || phy_pid >= SWITCHTEC_MAX_PORTS)
+		return NULL;
+
+	return snap->ep[phy_pid];
+}
+
+int switchtec_device_manage(struct switchtec_dev *dev,
 			    struct switchtec_device_manage_req *req,
 			    struct switchtec_device_manage_rsp *rsp)
 {
@@ -1216,6 +2413,48 @@ int switchtec_ep_tunnel_status(struct switchtec_dev *dev, uint16_t pdfid,
 	return ret;
 }
 
+struct ep_cfg_read {
+	uint8_t subcmd;
+	uint8_t reserved0;
+	uint16_t pdfid;
+	uint16_t addr;
+	uint8_t bytes;
+	uint8_t reserved1;
+};
+
+struct ep_cfg_write {
+	uint8_t subcmd;
+	uint8_t reserved0;
+	uint16_t pdfid;
+	uint16_t addr;
+	uint8_t bytes;
+	uint8_t reserved1;
+	uint32_t data;
+};
+
+struct ep_bar_read {
+	uint8_t subcmd;
+	uint8_t reserved0;
+	uint16_t pdfid;
+	uint8_t bar;
+	uint8_t reserved1;
+	uint16_t bytes;
+	uint32_t addr_low;
+	uint32_t addr_high;
+};
+
+struct ep_bar_write {
+	uint8_t subcmd;
+	uint8_t reserved0;
+	uint16_t pdfid;
+	uint8_t bar;
+	uint8_t reserved1;
+	uint16_t bytes;
+	uint32_t addr_low;
+	uint32_t addr_high;
+	uint32_t data[128];
+};
+
 static int ep_csr_read(struct switchtec_dev *dev,
 		       uint16_t pdfid, void *dest,
 		       uint16_t src, size_t n)
@@ -1228,14 +2467,7 @@ static int ep_csr_read(struct switchtec_dev *dev,
 	if (!n)
 		return n;
 
-	struct ep_cfg_read {
-		uint8_t subcmd;
-		uint8_t reserved0;
-		uint16_t pdfid;
-		uint16_t addr;
-		uint8_t bytes;
-		uint8_t reserved1;
-	} cmd = {
+	struct ep_cfg_read cmd = {
 		.subcmd = 0,
 		.pdfid = htole16(pdfid),
 		.addr = htole16(src),
@@ -1292,15 +2524,7 @@ static int ep_csr_write(struct switchtec_dev *dev, uint16_t pdfid,
 	if (!n)
 		return n;
 
-	struct ep_cfg_write {
-		uint8_t subcmd;
-		uint8_t reserved0;
-		uint16_t pdfid;
-		uint16_t addr;
-		uint8_t bytes;
-		uint8_t reserved1;
-		uint32_t data;
-	} cmd = {
+	struct ep_cfg_write cmd = {
 		.subcmd = 1,
 		.pdfid = htole16(pdfid),
 		.addr = htole16(addr),
@@ -1345,16 +2569,7 @@ static size_t ep_bar_read(struct switchtec_dev *dev, uint16_t pdfid,
 
 	src = htole64(src);
 
-	struct ep_bar_read {
-		uint8_t subcmd;
-		uint8_t reserved0;
-		uint16_t pdfid;
-		uint8_t bar;
-		uint8_t reserved1;
-		uint16_t bytes;
-		uint32_t addr_low;
-		uint32_t addr_high;
-	} cmd = {
+	struct ep_bar_read cmd = {
 		.subcmd = 2,
 		.pdfid = htole16(pdfid),
 		.bar = bar,
@@ -1418,17 +2633,7 @@ static int ep_bar_write(struct switchtec_dev *dev, uint16_t pdfid,
 
 	addr = htole64(addr);
 
-	struct ep_bar_write {
-		uint8_t subcmd;
-		uint8_t reserved0;
-		uint16_t pdfid;
-		uint8_t bar;
-		uint8_t reserved1;
-		uint16_t bytes;
-		uint32_t addr_low;
-		uint32_t addr_high;
-		uint32_t data[128];
-	} cmd = {
+	struct ep_bar_write cmd = {
 		.subcmd = 3,
 		.pdfid = htole16(pdfid),
 		.bar = bar,
@@ -1470,99 +2675,343 @@ int switchtec_ep_bar_write64(struct switchtec_dev *dev, uint16_t pdfid,
 	return ep_bar_write(dev, pdfid, bar, addr, &val, 8);
 }
 
-static int admin_passthru_start(struct switchtec_dev *dev, uint16_t pdfid,
-				size_t data_len, void *data,
-				size_t *rsp_len)
+#define EP_RANGE_BATCH 32
+
+/*
+ * Config space accesses are at most a dword and must be naturally
+ * aligned, so split the range into the widest access that fits.
+ */
+static size_t ep_csr_access_size(uint16_t addr, size_t len)
 {
-	int ret;
-	uint16_t copy_len;
-	uint16_t offset = 0;
+	if (!(addr & 3) && len >= 4)
+		return 4;
+	if (!(addr & 1) && len >= 2)
+		return 2;
+	return 1;
+}
 
-	struct {
-		uint8_t subcmd;
-		uint8_t rsvd[3];
-		uint16_t pdfid;
-		uint16_t expected_rsp_len;
-		uint8_t more_data;
-		uint8_t rsvd1[3];
-		uint16_t data_offset;
-		uint16_t data_len;
-		uint8_t data[MRPC_MAX_DATA_LEN - 16];
-	} cmd = {
-		.subcmd = MRPC_NVME_ADMIN_PASSTHRU_START,
-		.pdfid = htole16(pdfid)
-	};
+/**
+ * @brief Read a range of an endpoint's configuration space
+ * @param[in]  dev	Switchtec device handle
+ * @param[in]  pdfid	PDFID of the endpoint
+ * @param[in]  addr	Configuration space offset to start at
+ * @param[out] buf	Buffer for the data, in device byte order
+ * @param[in]  len	Number of bytes to read
+ * @return 0 on success, error code on failure
+ *
+ * The range is split into naturally aligned accesses of up to four
+ * bytes which are issued with switchtec_cmd_batch(), so platforms that
+ * pipeline MRPCs only pay the round trip once per batch.
+ */
+int switchtec_ep_csr_read_range(struct switchtec_dev *dev, uint16_t pdfid,
+				uint16_t addr, void *buf, size_t len)
+{
+	struct switchtec_cmd_desc desc[EP_RANGE_BATCH];
+	struct ep_cfg_read cmd[EP_RANGE_BATCH];
+	uint32_t rsp[EP_RANGE_BATCH];
+	size_t size[EP_RANGE_BATCH];
+	uint8_t *p = buf;
+	int i, n, ret;
+
+	if (addr + len > 0x10000) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
 
-	struct {
-		uint16_t rsp_len;
-		uint16_t rsvd1;
-	} reply = {};
+	while (len) {
+		for (n = 0; n < EP_RANGE_BATCH && len; n++) {
+			size[n] = ep_csr_access_size(addr, len);
 
-	if (data_len && data != NULL) {
-		cmd.more_data = data_len > sizeof(cmd.data);
-		while (cmd.more_data) {
-			copy_len = sizeof(cmd.data);
-			memcpy(cmd.data, data + offset, copy_len);
+			memset(&cmd[n], 0, sizeof(cmd[n]));
+			cmd[n].subcmd = 0;
+			cmd[n].pdfid = htole16(pdfid);
+			cmd[n].addr = htole16(addr);
+			cmd[n].bytes = size[n];
 
-			cmd.data_offset = htole16(offset);
-			cmd.data_len = htole16(copy_len);
+			desc[n].cmd = MRPC_EP_RESOURCE_ACCESS;
+			desc[n].payload = &cmd[n];
+			desc[n].payload_len = sizeof(cmd[n]);
+			desc[n].resp = &rsp[n];
+			desc[n].resp_len = sizeof(rsp[n]);
 
-			ret = switchtec_cmd(dev, MRPC_NVME_ADMIN_PASSTHRU,
-					    &cmd, sizeof(cmd), NULL, 0);
-			if (ret)
-				return ret;
+			addr += size[n];
+			len -= size[n];
+		}
 
-			offset += copy_len;
-			data_len -= copy_len;
-			cmd.more_data = data_len > sizeof(cmd.data);
+		ret = switchtec_cmd_batch(dev, desc, n);
+		if (ret)
+			return ret;
+
+		for (i = 0; i < n; i++) {
+			memcpy(p, &rsp[i], size[i]);
+			p += size[i];
 		}
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Write a range of an endpoint's configuration space
+ * @param[in] dev	Switchtec device handle
+ * @param[in] pdfid	PDFID of the endpoint
+ * @param[in] addr	Configuration space offset to start at
+ * @param[in] buf	Data to write, in device byte order
+ * @param[in] len	Number of bytes to write
+ * @return 0 on success, error code on failure
+ *
+ * See switchtec_ep_csr_read_range(). If a write fails, the writes
+ * preceding it in the range have already been made.
+ */
+int switchtec_ep_csr_write_range(struct switchtec_dev *dev, uint16_t pdfid,
+				 uint16_t addr, const void *buf, size_t len)
+{
+	struct switchtec_cmd_desc desc[EP_RANGE_BATCH];
+	struct ep_cfg_write cmd[EP_RANGE_BATCH];
+	const uint8_t *p = buf;
+	size_t size;
+	int n, ret;
+
+	if (addr + len > 0x10000) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	while (len) {
+		for (n = 0; n < EP_RANGE_BATCH && len; n++) {
+			size = ep_csr_access_size(addr, len);
+
+			memset(&cmd[n], 0, sizeof(cmd[n]));
+			cmd[n].subcmd = 1;
+			cmd[n].pdfid = htole16(pdfid);
+			cmd[n].addr = htole16(addr);
+			cmd[n].bytes = size;
+			memcpy(&cmd[n].data, p, size);
+
+			desc[n].cmd = MRPC_EP_RESOURCE_ACCESS;
+			desc[n].payload = &cmd[n];
+			desc[n].payload_len = sizeof(cmd[n]);
+			desc[n].resp = NULL;
+			desc[n].resp_len = 0;
+
+			addr += size;
+			p += size;
+			len -= size;
+		}
+
+		ret = switchtec_cmd_batch(dev, desc, n);
+		if (ret)
+			return ret;
+	}
 
-		if (data_len) {
-			memcpy(cmd.data, data + offset, data_len);
+	return 0;
+}
 
-			cmd.data_offset = htole16(offset);
-			cmd.data_len = htole16(data_len);
-		} else {
-			cmd.data_len = 0;
-			cmd.data_offset = 0;
+/**
+ * @brief Read a range of an endpoint's BAR
+ * @param[in]  dev	Switchtec device handle
+ * @param[in]  pdfid	PDFID of the endpoint
+ * @param[in]  bar	BAR index
+ * @param[in]  addr	Offset into the BAR to start at
+ * @param[out] buf	Buffer for the data, in device byte order
+ * @param[in]  len	Number of bytes to read
+ * @return 0 on success, error code on failure
+ *
+ * Each MRPC carries up to SWITCHTEC_EP_BAR_MAX_READ_LEN bytes and the
+ * commands are issued with switchtec_cmd_batch().
+ */
+int switchtec_ep_bar_read_range(struct switchtec_dev *dev, uint16_t pdfid,
+				uint8_t bar, uint64_t addr, void *buf,
+				size_t len)
+{
+	struct switchtec_cmd_desc desc[EP_RANGE_BATCH];
+	struct ep_bar_read cmd[EP_RANGE_BATCH];
+	uint8_t *p = buf;
+	size_t size;
+	int n, ret;
+
+	while (len) {
+		for (n = 0; n < EP_RANGE_BATCH && len; n++) {
+			size = len;
+			if (size > SWITCHTEC_EP_BAR_MAX_READ_LEN)
+				size = SWITCHTEC_EP_BAR_MAX_READ_LEN;
+
+			memset(&cmd[n], 0, sizeof(cmd[n]));
+			cmd[n].subcmd = 2;
+			cmd[n].pdfid = htole16(pdfid);
+			cmd[n].bar = bar;
+			cmd[n].bytes = htole16((uint16_t)size);
+			cmd[n].addr_low = htole32((uint32_t)addr);
+			cmd[n].addr_high = htole32((uint32_t)(addr >> 32));
+
+			desc[n].cmd = MRPC_EP_RESOURCE_ACCESS;
+			desc[n].payload = &cmd[n];
+			desc[n].payload_len = sizeof(cmd[n]);
+			desc[n].resp = p;
+			desc[n].resp_len = size;
+
+			addr += size;
+			p += size;
+			len -= size;
 		}
+
+		ret = switchtec_cmd_batch(dev, desc, n);
+		if (ret)
+			return ret;
 	}
 
-	cmd.expected_rsp_len = htole16(*rsp_len);
+	return 0;
+}
 
-	ret = switchtec_cmd(dev, MRPC_NVME_ADMIN_PASSTHRU,
-			    &cmd, sizeof(cmd), &reply, sizeof(reply));
-	if (ret) {
-		*rsp_len = 0;
-		return ret;
+/**
+ * @brief Write a range of an endpoint's BAR
+ * @param[in] dev	Switchtec device handle
+ * @param[in] pdfid	PDFID of the endpoint
+ * @param[in] bar	BAR index
+ * @param[in] addr	Offset into the BAR to start at
+ * @param[in] buf	Data to write, in device byte order
+ * @param[in] len	Number of bytes to write
+ * @return 0 on success, error code on failure
+ *
+ * Each MRPC carries up to SWITCHTEC_EP_BAR_MAX_WRITE_LEN bytes. See
+ * switchtec_ep_bar_read_range().
+ */
+int switchtec_ep_bar_write_range(struct switchtec_dev *dev, uint16_t pdfid,
+				 uint8_t bar, uint64_t addr, const void *buf,
+				 size_t len)
+{
+	struct switchtec_cmd_desc desc[EP_RANGE_BATCH];
+	struct ep_bar_write cmd[EP_RANGE_BATCH];
+	const uint8_t *p = buf;
+	size_t size;
+	int n, ret;
+
+	while (len) {
+		for (n = 0; n < EP_RANGE_BATCH && len; n++) {
+			size = len;
+			if (size > SWITCHTEC_EP_BAR_MAX_WRITE_LEN)
+				size = SWITCHTEC_EP_BAR_MAX_WRITE_LEN;
+
+			cmd[n].subcmd = 3;
+			cmd[n].reserved0 = 0;
+			cmd[n].pdfid = htole16(pdfid);
+			cmd[n].bar = bar;
+			cmd[n].reserved1 = 0;
+			cmd[n].bytes = htole16((uint16_t)size);
+			cmd[n].addr_low = htole32((uint32_t)addr);
+			cmd[n].addr_high = htole32((uint32_t)(addr >> 32));
+			memcpy(cmd[n].data, p, size);
+
+			/* Only send the part of the data buffer in use */
+			desc[n].cmd = MRPC_EP_RESOURCE_ACCESS;
+			desc[n].payload = &cmd[n];
+			desc[n].payload_len = offsetof(struct ep_bar_write,
+						       data) + size;
+			desc[n].resp = NULL;
+			desc[n].resp_len = 0;
+
+			addr += size;
+			p += size;
+			len -= size;
+		}
+
+		ret = switchtec_cmd_batch(dev, desc, n);
+		if (ret)
+			return ret;
 	}
 
-	*rsp_len = le16toh(reply.rsp_len);
 	return 0;
 }
 
-static int admin_passthru_data(struct switchtec_dev *dev, uint16_t pdfid,
-			       size_t rsp_len, void *rsp)
+struct admin_passthru_start_cmd {
+	uint8_t subcmd;
+	uint8_t rsvd[3];
+	uint16_t pdfid;
+	uint16_t expected_rsp_len;
+	uint8_t more_data;
+	uint8_t rsvd1[3];
+	uint16_t data_offset;
+	uint16_t data_len;
+	uint8_t data[MRPC_MAX_DATA_LEN - 16];
+};
+
+struct admin_passthru_start_reply {
+	uint16_t rsp_len;
+	uint16_t rsvd1;
+};
+
+struct admin_passthru_data_cmd {
+	uint8_t subcmd;
+	uint8_t rsvd[3];
+	uint16_t pdfid;
+	uint16_t offset;
+};
+
+struct admin_passthru_data_reply {
+	uint16_t offset;
+	uint16_t len;
+	uint8_t data[MRPC_MAX_DATA_LEN - 4];
+};
+
+struct admin_passthru_end_cmd {
+	uint8_t subcmd;
+	uint8_t rsvd[3];
+	uint16_t pdfid;
+	uint16_t rsvd1;
+};
+
+#define ADMIN_PASSTHRU_CHUNK \
+	sizeof(((struct admin_passthru_start_cmd *)0)->data)
+#define ADMIN_PASSTHRU_DATA_CHUNK \
+	sizeof(((struct admin_passthru_data_reply *)0)->data)
+
+static size_t admin_passthru_nr_chunks(size_t len, size_t chunk)
 {
-	size_t offset = 0;
-	int ret;
-	struct {
-		uint8_t subcmd;
-		uint8_t rsvd[3];
-		uint16_t pdfid;
-		uint16_t offset;
-	} cmd = {
+	return (len + chunk - 1) / chunk;
+}
+
+/*
+ * Fill in the START command that carries the chunk of the input data at
+ * offset. A command is only sent with more_data cleared once every
+ * earlier chunk has been accepted.
+ */
+static void admin_passthru_start_fill(struct admin_passthru_start_cmd *cmd,
+				      const struct switchtec_nvme_passthru_req *r,
+				      size_t offset)
+{
+	size_t len = r->data_len - offset;
+
+	memset(cmd, 0, offsetof(struct admin_passthru_start_cmd, data));
+	cmd->subcmd = MRPC_NVME_ADMIN_PASSTHRU_START;
+	cmd->pdfid = htole16(r->pdfid);
+
+	cmd->more_data = len > ADMIN_PASSTHRU_CHUNK;
+	if (len > ADMIN_PASSTHRU_CHUNK)
+		len = ADMIN_PASSTHRU_CHUNK;
+
+	if (len) {
+		memcpy(cmd->data, (const uint8_t *)r->data + offset, len);
+		cmd->data_offset = htole16(offset);
+		cmd->data_len = htole16(len);
+	}
+
+	if (!cmd->more_data)
+		cmd->expected_rsp_len = htole16(r->rsp_len);
+}
+
+static int admin_passthru_data_serial(struct switchtec_dev *dev,
+				      struct switchtec_nvme_passthru_req *r,
+				      size_t offset)
+{
+	struct admin_passthru_data_cmd cmd = {
 		.subcmd = MRPC_NVME_ADMIN_PASSTHRU_DATA,
-		.pdfid = htole16(pdfid),
+		.pdfid = htole16(r->pdfid),
 	};
+	struct admin_passthru_data_reply reply = {};
+	size_t len;
+	int ret;
 
-	struct {
-		uint16_t offset;
-		uint16_t len;
-		uint8_t data[MRPC_MAX_DATA_LEN - 4];
-	} reply = {};
-
-	while (offset < rsp_len) {
+	while (offset < r->rsp_len) {
 		cmd.offset = htole16(offset);
 
 		ret = switchtec_cmd(dev, MRPC_NVME_ADMIN_PASSTHRU,
@@ -1571,28 +3020,310 @@ static int admin_passthru_data(struct switchtec_dev *dev, uint16_t pdfid,
 		if (ret)
 			return ret;
 
-		memcpy((uint8_t*)rsp + offset, reply.data,
-		       htole16(reply.len));
-		offset += htole16(reply.len);
+		len = le16toh(reply.len);
+		if (!len || len > sizeof(reply.data))
+			return -1;
+		if (len > r->rsp_len - offset)
+			len = r->rsp_len - offset;
+
+		memcpy((uint8_t *)r->rsp + offset, reply.data, len);
+		offset += len;
 	}
 
 	return 0;
 }
 
-static int admin_passthru_end(struct switchtec_dev *dev, uint16_t pdfid)
+/*
+ * Issue one stage of the passthru protocol for every command still in
+ * flight. After a system error the commands the batch did not get to
+ * report that error too.
+ */
+static void admin_passthru_run(struct switchtec_dev *dev,
+			       struct switchtec_cmd_desc *desc, int n)
 {
-	struct {
-		uint8_t subcmd;
-		uint8_t rsvd[3];
-		uint16_t pdfid;
-		uint16_t rsvd1;
-	} cmd = {};
+	int i, ret;
 
-	cmd.subcmd = MRPC_NVME_ADMIN_PASSTHRU_END;
-	cmd.pdfid = htole16(pdfid);
+	if (!n)
+		return;
 
-	return switchtec_cmd(dev, MRPC_NVME_ADMIN_PASSTHRU,
-			     &cmd, sizeof(cmd), NULL, 0);
+	for (i = 0; i < n; i++)
+		desc[i].ret = -ECANCELED;
+
+	ret = switchtec_cmd_batch(dev, desc, n);
+	if (ret >= 0)
+		return;
+
+	for (i = 0; i < n; i++)
+		if (desc[i].ret == -ECANCELED)
+			desc[i].ret = ret;
+}
+
+static void admin_passthru_desc(struct switchtec_cmd_desc *desc,
+				const void *cmd, size_t cmd_len,
+				void *reply, size_t reply_len)
+{
+	desc->cmd = MRPC_NVME_ADMIN_PASSTHRU;
+	desc->payload = cmd;
+	desc->payload_len = cmd_len;
+	desc->resp = reply;
+	desc->resp_len = reply_len;
+}
+
+/*
+ * Copy the reply chunks read for one command into its buffer, stopping
+ * at the first chunk that is not the one expected at that offset.
+ * Returns the number of bytes copied or sets r->ret on an error.
+ */
+static size_t admin_passthru_copy(struct switchtec_nvme_passthru_req *r,
+				  int idx, const int *owner,
+				  const struct switchtec_cmd_desc *desc,
+				  const struct admin_passthru_data_reply *reply,
+				  int n)
+{
+	size_t off = 0, len;
+	int j;
+
+	for (j = 0; j < n && off < r->rsp_len; j++) {
+		if (owner[j] != idx)
+			continue;
+
+		if (desc[j].ret) {
+			r->ret = desc[j].ret;
+			break;
+		}
+
+		len = le16toh(reply[j].len);
+		if (le16toh(reply[j].offset) != off || !len ||
+		    len > ADMIN_PASSTHRU_DATA_CHUNK)
+			break;
+		if (len > r->rsp_len - off)
+			len = r->rsp_len - off;
+
+		memcpy((uint8_t *)r->rsp + off, reply[j].data, len);
+		off += len;
+
+		/* A short chunk shifts every later offset */
+		if (len < ADMIN_PASSTHRU_DATA_CHUNK)
+			break;
+	}
+
+	return off;
+}
+
+/**
+ * @brief Send several ADMIN PASSTHRU commands, overlapping their transfers
+ * @param[in]     dev	Switchtec device handle
+ * @param[in,out] reqs	The commands. rsp_len is the expected reply
+ *			length on input and the actual length on output;
+ *			ret receives each command's result.
+ * @param[in]     n	Number of commands
+ * @return 0 if every command succeeded, otherwise the result of the
+ *	first command that failed
+ *
+ * Each stage of the passthru protocol (sending the command data, starting
+ * the command, reading the reply and finishing) is issued for every
+ * command at once with switchtec_cmd_batch(). All chunks of the command
+ * data are sent in one batch, and the reply is read by requesting every
+ * chunk offset up front, so platforms that pipeline MRPCs pay a handful
+ * of round trips however large the transfer. If the firmware returns a
+ * short chunk, the rest of that reply is read one chunk at a time.
+ *
+ * The commands must target distinct PDFIDs since the firmware keeps its
+ * passthru state per endpoint. A command whose data could not be sent
+ * in full is never started.
+ */
+int switchtec_nvme_admin_passthru_multi(struct switchtec_dev *dev,
+					struct switchtec_nvme_passthru_req *reqs,
+					int n)
+{
+	struct admin_passthru_start_reply *start_reply;
+	struct admin_passthru_data_reply *data_reply;
+	struct admin_passthru_start_cmd *start_cmd;
+	struct admin_passthru_data_cmd *data_cmd;
+	struct admin_passthru_end_cmd *end_cmd;
+	struct switchtec_nvme_passthru_req *r;
+	struct switchtec_cmd_desc *desc;
+	size_t nr_chunks = 0, nr_data = 0, max, off, len;
+	int *owner, *state;
+	int i, j, k, ret = 0;
+
+	enum {
+		ST_LIVE,
+		ST_STARTED,
+		ST_FAILED,
+	};
+
+	for (i = 0; i < n; i++) {
+		r = &reqs[i];
+		if (r->data_len > SWITCHTEC_NVME_ADMIN_PASSTHRU_MAX_DATA_LEN ||
+		    r->rsp_len > UINT16_MAX || (r->data_len && !r->data)) {
+			errno = EINVAL;
+			return -EINVAL;
+		}
+
+		for (j = 0; j < i; j++) {
+			if (reqs[j].pdfid == r->pdfid) {
+				errno = EINVAL;
+				return -EINVAL;
+			}
+		}
+
+		nr_chunks += admin_passthru_nr_chunks(r->data_len,
+						      ADMIN_PASSTHRU_CHUNK);
+		if (r->rsp)
+			nr_data += admin_passthru_nr_chunks(r->rsp_len,
+						ADMIN_PASSTHRU_DATA_CHUNK);
+		r->ret = 0;
+	}
+
+	max = nr_chunks + nr_data + n;
+	desc = calloc(max, sizeof(*desc));
+	owner = calloc(max, sizeof(*owner));
+	state = calloc(n, sizeof(*state));
+	start_cmd = calloc(nr_chunks + n, sizeof(*start_cmd));
+	start_reply = calloc(n, sizeof(*start_reply));
+	data_cmd = calloc(nr_data + 1, sizeof(*data_cmd));
+	data_reply = calloc(nr_data + 1, sizeof(*data_reply));
+	end_cmd = calloc(n, sizeof(*end_cmd));
+	if (!desc || !owner || !state || !start_cmd || !start_reply ||
+	    !data_cmd || !data_reply || !end_cmd) {
+		ret = -ENOMEM;
+		errno = ENOMEM;
+		goto out;
+	}
+
+	/* Stage 1: every chunk of command data except each final one */
+	k = 0;
+	for (i = 0; i < n; i++) {
+		r = &reqs[i];
+		for (off = 0; r->data_len - off > ADMIN_PASSTHRU_CHUNK;
+		     off += ADMIN_PASSTHRU_CHUNK) {
+			admin_passthru_start_fill(&start_cmd[k], r, off);
+			admin_passthru_desc(&desc[k], &start_cmd[k],
+					    sizeof(start_cmd[k]), NULL, 0);
+			owner[k++] = i;
+		}
+	}
+
+	admin_passthru_run(dev, desc, k);
+	for (j = 0; j < k; j++) {
+		r = &reqs[owner[j]];
+		if (desc[j].ret && !r->ret) {
+			r->ret = desc[j].ret;
+			state[owner[j]] = ST_FAILED;
+		}
+	}
+
+	/* Stage 2: the final chunk, which starts the command */
+	k = 0;
+	for (i = 0; i < n; i++) {
+		r = &reqs[i];
+		if (state[i] != ST_LIVE)
+			continue;
+
+		off = 0;
+		if (r->data_len > ADMIN_PASSTHRU_CHUNK)
+			off = (admin_passthru_nr_chunks(r->data_len,
+					ADMIN_PASSTHRU_CHUNK) - 1) *
+				ADMIN_PASSTHRU_CHUNK;
+
+		admin_passthru_start_fill(&start_cmd[k], r, off);
+		admin_passthru_desc(&desc[k], &start_cmd[k],
+				    sizeof(start_cmd[k]), &start_reply[i],
+				    sizeof(start_reply[i]));
+		owner[k++] = i;
+	}
+
+	admin_passthru_run(dev, desc, k);
+	for (j = 0; j < k; j++) {
+		i = owner[j];
+		r = &reqs[i];
+		if (desc[j].ret) {
+			r->ret = desc[j].ret;
+			state[i] = ST_FAILED;
+			continue;
+		}
+
+		state[i] = ST_STARTED;
+		len = le16toh(start_reply[i].rsp_len);
+		if (len < r->rsp_len)
+			r->rsp_len = len;
+		else if (!r->rsp)
+			r->rsp_len = len;
+	}
+
+	/* Stage 3: request every chunk of every reply up front */
+	k = 0;
+	for (i = 0; i < n; i++) {
+		r = &reqs[i];
+		if (state[i] != ST_STARTED || !r->rsp)
+			continue;
+
+		for (off = 0; off < r->rsp_len;
+		     off += ADMIN_PASSTHRU_DATA_CHUNK) {
+			data_cmd[k].subcmd = MRPC_NVME_ADMIN_PASSTHRU_DATA;
+			data_cmd[k].pdfid = htole16(r->pdfid);
+			data_cmd[k].offset = htole16(off);
+			admin_passthru_desc(&desc[k], &data_cmd[k],
+					    sizeof(data_cmd[k]), &data_reply[k],
+					    sizeof(data_reply[k]));
+			owner[k++] = i;
+		}
+	}
+
+	admin_passthru_run(dev, desc, k);
+
+	for (i = 0; i < n; i++) {
+		r = &reqs[i];
+		if (state[i] != ST_STARTED || !r->rsp)
+			continue;
+
+		off = admin_passthru_copy(r, i, owner, desc, data_reply, k);
+		if (!r->ret && off < r->rsp_len)
+			r->ret = admin_passthru_data_serial(dev, r, off);
+
+		if (r->ret)
+			state[i] = ST_FAILED;
+	}
+
+	/* Stage 4: finish every command that was started */
+	k = 0;
+	for (i = 0; i < n; i++) {
+		if (state[i] != ST_STARTED)
+			continue;
+
+		end_cmd[i].subcmd = MRPC_NVME_ADMIN_PASSTHRU_END;
+		end_cmd[i].pdfid = htole16(reqs[i].pdfid);
+		admin_passthru_desc(&desc[k], &end_cmd[i], sizeof(end_cmd[i]),
+				    NULL, 0);
+		owner[k++] = i;
+	}
+
+	admin_passthru_run(dev, desc, k);
+	for (j = 0; j < k; j++)
+		if (desc[j].ret)
+			reqs[owner[j]].ret = desc[j].ret;
+
+	for (i = 0; i < n; i++) {
+		if (!reqs[i].ret)
+			continue;
+
+		reqs[i].rsp_len = 0;
+		if (!ret)
+			ret = reqs[i].ret;
+	}
+
+out:
+	free(desc);
+	free(owner);
+	free(state);
+	free(start_cmd);
+	free(start_reply);
+	free(data_cmd);
+	free(data_reply);
+	free(end_cmd);
+
+	return ret;
 }
 
 /**
@@ -1604,26 +3335,28 @@ static int admin_passthru_end(struct switchtec_dev *dev, uint16_t pdfid)
  * @param[in/out] rsp_len Expected reply length/actual response length
  * @param[out] rsp	Reply from device
  * @return 0 on success, error code on failure
+ *
+ * The data and reply are transferred with the pipelined stages of
+ * switchtec_nvme_admin_passthru_multi().
  */
 int switchtec_nvme_admin_passthru(struct switchtec_dev *dev, uint16_t pdfid,
 				  size_t data_len, void *data,
 				  size_t *rsp_len, void *rsp)
 {
+	struct switchtec_nvme_passthru_req req = {
+		.pdfid = pdfid,
+		.data_len = data_len,
+		.data = data,
+		.rsp_len = *rsp_len,
+		.rsp = rsp,
+	};
 	int ret;
 
-	ret = admin_passthru_start(dev, pdfid, data_len, data, rsp_len);
-	if (ret)
-		return ret;
-
-	if (*rsp_len && rsp != NULL) {
-		ret = admin_passthru_data(dev, pdfid, *rsp_len, rsp);
-		if (ret) {
-			*rsp_len = 0;
-			return ret;
-		}
-	}
+	if (!data)
+		req.data_len = 0;
 
-	ret = admin_passthru_end(dev, pdfid);
+	ret = switchtec_nvme_admin_passthru_multi(dev, &req, 1);
+	*rsp_len = req.rsp_len;
 
 	return ret;
 }
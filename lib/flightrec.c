@@ -0,0 +1,604 @@
+/*
+ * Microsemi Switchtec(tm) PCIe Management Library
+ * Copyright (c) 2025, Microsemi Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * @file
+ * @brief Always-on flight recorder
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#define SWITCHTEC_LIB_CORE
+
+#include "switchtec_priv.h"
+#include "switchtec/flightrec.h"
+#include "switchtec/portable.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __WINDOWS__
+#define flr_seek(f, off, whence)	_fseeki64(f, off, whence)
+#define flr_tell(f)			_ftelli64(f)
+#else
+#define flr_seek(f, off, whence)	fseeko(f, off, whence)
+#define flr_tell(f)			ftello(f)
+#endif
+
+struct switchtec_flightrec {
+	struct switchtec_dev *dev;
+	uint8_t *ring;
+	unsigned depth;
+	unsigned head;		//!< Number of samples ever taken
+	size_t sample_size;
+	unsigned period_us;
+	uint64_t next_us;
+	int can_wait;
+
+	unsigned nr_ports;
+	struct switchtec_flr_port ports[SWITCHTEC_MAX_PORTS];
+
+	int evc_ok;
+	int evc_cur;
+	struct switchtec_evcntr_snapshot evc[2];
+
+	struct switchtec_event_summary triggers;
+};
+
+/**
+ * @brief Create a flight recorder
+ * @param[in] dev	Switchtec device handle
+ * @param[in] depth	Number of samples kept in the ring
+ * @param[in] period_ms	Sampling period used by switchtec_flightrec_poll()
+ * @return The recorder, or NULL on failure (with errno set)
+ *
+ * The ports and event counters covered by each sample are the ones
+ * present when the recorder is created. Event counters must already be
+ * set up (with switchtec_evcntr_setup()) to be recorded; none is an
+ * error only if the device does not have any.
+ */
+struct switchtec_flightrec *
+switchtec_flightrec_new(struct switchtec_dev *dev, unsigned depth,
+			unsigned period_ms)
+{
+	struct switchtec_port_snapshot snap[SWITCHTEC_MAX_PORTS];
+	struct switchtec_flightrec *fr;
+	int ret, i;
+
+	if (!depth || !period_ms) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	ret = switchtec_status_snapshot(dev, snap, ARRAY_SIZE(snap));
+	if (ret < 0)
+		return NULL;
+	if (ret > ARRAY_SIZE(snap))
+		ret = ARRAY_SIZE(snap);
+
+	fr = calloc(1, sizeof(*fr));
+	if (!fr)
+		return NULL;
+
+	fr->dev = dev;
+	fr->depth = depth;
+	fr->period_us = period_ms * 1000;
+	fr->next_us = platform_time_us();
+	fr->can_wait = 1;
+
+	fr->nr_ports = ret;
+	for (i = 0; i < fr->nr_ports; i++) {
+		fr->ports[i] = (struct switchtec_flr_port) {
+			.phys_id = snap[i].port.phys_id,
+			.partition = snap[i].port.partition,
+			.log_id = snap[i].port.log_id,
+			.stack = snap[i].port.stack,
+			.stk_id = snap[i].port.stk_id,
+			.upstream = snap[i].port.upstream,
+			.cfg_link_width = snap[i].cfg_lnk_width,
+		};
+	}
+
+	/* Devices without event counters (or with none set up) still record */
+	fr->evc_ok = !switchtec_evcntr_snapshot_setup(dev, &fr->evc[0]) &&
+		!switchtec_evcntr_snapshot(dev, &fr->evc[0], 0);
+	if (!fr->evc_ok)
+		fr->evc[0].nr = 0;
+	fr->evc[1] = fr->evc[0];
+
+	fr->sample_size = sizeof(struct switchtec_flr_sample) +
+		fr->nr_ports * sizeof(struct switchtec_flr_port_sample) +
+		fr->evc[0].nr * sizeof(uint32_t);
+
+	fr->ring = calloc(depth, fr->sample_size);
+	if (!fr->ring) {
+		free(fr);
+		return NULL;
+	}
+
+	return fr;
+}
+
+/**
+ * @brief Add an event that triggers a dump
+ * @param[in] fr	Flight recorder
+ * @param[in] e		Event ID
+ * @param[in] index	Partition or PFF, or SWITCHTEC_EVT_IDX_ALL
+ * @return 0 on success, negative on failure
+ *
+ * The event is cleared and enabled for polling, so only occurrences
+ * from now on fire.
+ */
+int switchtec_flightrec_trigger(struct switchtec_flightrec *fr,
+				enum switchtec_event_id e, int index)
+{
+	int ret;
+
+	if (index == SWITCHTEC_EVT_IDX_LOCAL &&
+	    switchtec_event_info(e, NULL, NULL) == SWITCHTEC_EVT_PART)
+		index = switchtec_partition(fr->dev);
+
+	ret = switchtec_event_summary_set(&fr->triggers, e, index);
+	if (ret)
+		return ret;
+
+	ret = switchtec_event_ctl(fr->dev, e, index,
+				  SWITCHTEC_EVT_FLAG_CLEAR |
+				  SWITCHTEC_EVT_FLAG_EN_POLL, NULL);
+
+	return ret < 0 ? ret : 0;
+}
+
+static struct switchtec_port_snapshot *
+find_port(struct switchtec_port_snapshot *snap, int nr, int i, int phys_id)
+{
+	int j;
+
+	/* Ports are normally reported in the same order every time */
+	if (i < nr && snap[i].port.phys_id == phys_id)
+		return &snap[i];
+
+	for (j = 0; j < nr; j++)
+		if (snap[j].port.phys_id == phys_id)
+			return &snap[j];
+
+	return NULL;
+}
+
+/**
+ * @brief Add one sample to the ring, overwriting the oldest
+ * @param[in] fr	Flight recorder
+ * @return 0 on success, negative on failure
+ */
+int switchtec_flightrec_sample(struct switchtec_flightrec *fr)
+{
+	struct switchtec_port_snapshot snap[SWITCHTEC_MAX_PORTS];
+	struct switchtec_port_snapshot *p;
+	struct switchtec_event_summary sum;
+	struct switchtec_evcntr_snapshot *old, *new;
+	unsigned delta[SWITCHTEC_MAX_EVCNTRS];
+	struct switchtec_flr_sample *s;
+	struct switchtec_flr_port_sample *ps;
+	uint32_t *cntrs;
+	int nr, ret, i;
+
+	s = (void *)(fr->ring + (fr->head % fr->depth) * fr->sample_size);
+	ps = (void *)(s + 1);
+	cntrs = (void *)(ps + fr->nr_ports);
+
+	memset(s, 0, fr->sample_size);
+	s->time_us = platform_wall_time_us();
+
+	nr = switchtec_status_snapshot(fr->dev, snap, ARRAY_SIZE(snap));
+	if (nr < 0)
+		return nr;
+	if (nr > ARRAY_SIZE(snap))
+		nr = ARRAY_SIZE(snap);
+
+	for (i = 0; i < fr->nr_ports; i++) {
+		p = find_port(snap, nr, i, fr->ports[i].phys_id);
+		if (!p)
+			continue;
+
+		ps[i].ltssm = p->ltssm;
+		ps[i].link_up = p->link_up;
+		ps[i].link_width = p->neg_lnk_width;
+		ps[i].link_rate = p->link_rate;
+	}
+
+	if (fr->evc_ok && fr->evc[0].nr) {
+		old = &fr->evc[fr->evc_cur];
+		new = &fr->evc[!fr->evc_cur];
+
+		ret = switchtec_evcntr_snapshot(fr->dev, new, 0);
+		if (ret < 0)
+			return ret;
+
+		ret = switchtec_evcntr_snapshot_delta(new, old, delta);
+		if (ret < 0)
+			return ret;
+
+		for (i = 0; i < new->nr; i++)
+			cntrs[i] = delta[i];
+
+		fr->evc_cur = !fr->evc_cur;
+	}
+
+	s->die_temp = switchtec_die_temp(fr->dev);
+
+	ret = switchtec_event_summary(fr->dev, &sum);
+	if (ret < 0)
+		return ret;
+
+	s->global = sum.global;
+	s->part_bitmap = sum.part_bitmap;
+	s->local_part = sum.local_part;
+	for (i = 0; i < SWITCHTEC_MAX_PFF_CSR; i++)
+		if (sum.pff[i])
+			s->pff_bitmap[i / 64] |= 1ULL << (i % 64);
+
+	fr->head++;
+
+	return 0;
+}
+
+static void fired_mask(struct switchtec_event_summary *fired,
+		       const struct switchtec_event_summary *res,
+		       const struct switchtec_event_summary *trig)
+{
+	int i;
+
+	memset(fired, 0, sizeof(*fired));
+
+	fired->global = res->global & trig->global;
+
+	for (i = 0; i < SWITCHTEC_MAX_PARTS; i++) {
+		fired->part[i] = res->part[i] & trig->part[i];
+		if (fired->part[i])
+			fired->part_bitmap |= 1ULL << i;
+	}
+
+	for (i = 0; i < SWITCHTEC_MAX_PFF_CSR; i++)
+		fired->pff[i] = res->pff[i] & trig->pff[i];
+}
+
+/**
+ * @brief Sample when due and wait for a trigger event
+ * @param[in]  fr	Flight recorder
+ * @param[out] fired	Trigger events that occurred (may be NULL)
+ * @return 1 if a trigger event occurred, 0 if the sampling period ended
+ *	first, or negative on failure
+ *
+ * Call this in a loop. It takes a sample if one is due and then blocks
+ * in switchtec_event_wait() until the next one is, or until an event
+ * occurs. Samples are scheduled against absolute deadlines so the time
+ * spent reading the device does not make the period drift. The trigger
+ * events that fired are cleared so the next occurrence fires again.
+ */
+int switchtec_flightrec_poll(struct switchtec_flightrec *fr,
+			     struct switchtec_event_summary *fired)
+{
+	struct switchtec_event_summary res, tmp;
+	enum switchtec_event_id e;
+	uint64_t now;
+	int timeout_ms = 0;
+	int ret, idx;
+
+	now = platform_time_us();
+	if (now >= fr->next_us) {
+		ret = switchtec_flightrec_sample(fr);
+		if (ret < 0)
+			return ret;
+
+		fr->next_us += fr->period_us;
+		if (fr->next_us <= now)
+			fr->next_us = now + fr->period_us;
+		now = platform_time_us();
+	}
+
+	if (fr->next_us > now)
+		timeout_ms = (fr->next_us - now + 999) / 1000;
+
+	ret = 1;
+	if (fr->can_wait) {
+		ret = switchtec_event_wait(fr->dev, timeout_ms);
+		if (ret < 0 && errno == ENOTSUP)
+			fr->can_wait = 0;
+		else if (ret < 0)
+			return ret;
+	}
+
+	if (!fr->can_wait) {
+		usleep(timeout_ms * 1000);
+		ret = 1;
+	}
+
+	if (!ret)
+		return 0;
+
+	ret = switchtec_event_check(fr->dev, &fr->triggers, &res);
+	if (ret <= 0)
+		return ret;
+
+	fired_mask(&tmp, &res, &fr->triggers);
+	if (fired)
+		*fired = tmp;
+
+	while (switchtec_event_summary_iter(&tmp, &e, &idx)) {
+		ret = switchtec_event_ctl(fr->dev, e, idx,
+					  SWITCHTEC_EVT_FLAG_CLEAR |
+					  SWITCHTEC_EVT_FLAG_EN_POLL, NULL);
+		if (ret < 0)
+			return ret;
+	}
+
+	return 1;
+}
+
+static int fetch_ltssm(struct switchtec_flightrec *fr, int phys_id,
+		       struct switchtec_flr_ltssm **out)
+{
+	struct switchtec_diag_ltssm_log *log;
+	int count = SWITCHTEC_FLR_MAX_LTSSM;
+	int ret, i;
+
+	*out = NULL;
+
+	log = calloc(count, sizeof(*log));
+	if (!log)
+		return 0;
+
+	/* Freezes the log while it is read and unfreezes it after */
+	ret = switchtec_diag_ltssm_log(fr->dev, phys_id, &count, log);
+	if (ret || count <= 0) {
+		free(log);
+		return 0;
+	}
+
+	*out = calloc(count, sizeof(**out));
+	if (!*out) {
+		free(log);
+		return 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		(*out)[i].timestamp = log[i].timestamp;
+		(*out)[i].timestamp_high = log[i].timestamp_high;
+		(*out)[i].link_rate = log[i].link_rate;
+		(*out)[i].link_state = log[i].link_state;
+	}
+
+	free(log);
+	return count;
+}
+
+static int port_index(struct switchtec_flightrec *fr, int partition,
+		      int port)
+{
+	int i;
+
+	for (i = 0; i < fr->nr_ports; i++)
+		if (fr->ports[i].partition == partition &&
+		    fr->ports[i].log_id == port)
+			return i;
+
+	return -1;
+}
+
+/**
+ * @brief Write the ring and the captures for some events to a file
+ * @param[in] fr	Flight recorder
+ * @param[in] path	File to create (truncated if it exists)
+ * @param[in] fired	Events to record as triggers, usually as returned
+ *	by switchtec_flightrec_poll() (may be NULL)
+ * @return 0 on success, negative on failure
+ *
+ * The LTSSM log of every port a PFF event in \p fired belongs to is
+ * read from the device, as is the firmware RAM log. Either is left out
+ * of the dump if the device can not provide it.
+ */
+int switchtec_flightrec_dump(struct switchtec_flightrec *fr,
+			     const char *path,
+			     const struct switchtec_event_summary *fired)
+{
+	struct switchtec_flr_trigger trig[SWITCHTEC_FLR_MAX_TRIGGERS];
+	struct switchtec_flr_ltssm *logs[SWITCHTEC_MAX_PORTS] = {};
+	int log_count[SWITCHTEC_MAX_PORTS] = {};
+	int log_read[SWITCHTEC_MAX_PORTS] = {};
+	uint64_t log_off[SWITCHTEC_MAX_PORTS] = {};
+	struct switchtec_flr_header hdr = {};
+	struct switchtec_flr_cntr cntr;
+	struct switchtec_event_summary sum = {};
+	struct switchtec_log_cursor cursor = {};
+	const struct switchtec_evcntr_snapshot *evc;
+	enum switchtec_event_id e;
+	unsigned nr_samples, first, i;
+	int64_t end;
+	uint64_t off;
+	FILE *f;
+	int ret = -1;
+	int idx, p;
+
+	hdr.trigger_us = platform_wall_time_us();
+
+	if (fired)
+		sum = *fired;
+
+	while (hdr.nr_triggers < ARRAY_SIZE(trig) &&
+	       switchtec_event_summary_iter(&sum, &e, &idx)) {
+		struct switchtec_flr_trigger *t = &trig[hdr.nr_triggers++];
+
+		*t = (struct switchtec_flr_trigger) {
+			.event = e,
+			.index = idx,
+			.partition = -1,
+			.port = -1,
+			.phys_id = -1,
+		};
+
+		switch (switchtec_event_info(e, NULL, NULL)) {
+		case SWITCHTEC_EVT_PART:
+			t->partition = idx;
+			break;
+		case SWITCHTEC_EVT_PFF:
+			if (switchtec_pff_to_port(fr->dev, idx, &t->partition,
+						  &t->port))
+				break;
+
+			p = port_index(fr, t->partition, t->port);
+			if (p < 0)
+				break;
+
+			t->phys_id = fr->ports[p].phys_id;
+			if (!log_read[p]) {
+				log_count[p] = fetch_ltssm(fr, t->phys_id,
+							   &logs[p]);
+				log_read[p] = 1;
+			}
+			t->ltssm_count = log_count[p];
+			break;
+		default:
+			break;
+		}
+	}
+
+	nr_samples = fr->head < fr->depth ? fr->head : fr->depth;
+	first = fr->head - nr_samples;
+	evc = &fr->evc[fr->evc_cur];
+
+	memcpy(hdr.magic, SWITCHTEC_FLR_MAGIC, sizeof(SWITCHTEC_FLR_MAGIC));
+	hdr.version = SWITCHTEC_FLR_VERSION;
+	hdr.device_id = switchtec_device_id(fr->dev);
+	snprintf(hdr.dev_name, sizeof(hdr.dev_name), "%s",
+		 switchtec_name(fr->dev));
+	hdr.period_us = fr->period_us;
+	hdr.sample_size = fr->sample_size;
+	hdr.nr_ports = fr->nr_ports;
+	hdr.nr_cntrs = evc->nr;
+	hdr.nr_samples = nr_samples;
+
+	hdr.ports_off = sizeof(hdr);
+	hdr.cntrs_off = hdr.ports_off +
+		hdr.nr_ports * sizeof(struct switchtec_flr_port);
+	hdr.samples_off = hdr.cntrs_off +
+		hdr.nr_cntrs * sizeof(struct switchtec_flr_cntr);
+	hdr.triggers_off = hdr.samples_off +
+		(uint64_t)nr_samples * fr->sample_size;
+
+	off = hdr.triggers_off + hdr.nr_triggers * sizeof(*trig);
+	for (p = 0; p < fr->nr_ports; p++) {
+		log_off[p] = off;
+		off += log_count[p] * sizeof(struct switchtec_flr_ltssm);
+	}
+	hdr.fwlog_off = off;
+
+	for (i = 0; i < hdr.nr_triggers; i++) {
+		if (!trig[i].ltssm_count)
+			continue;
+
+		p = port_index(fr, trig[i].partition, trig[i].port);
+		trig[i].ltssm_off = log_off[p];
+	}
+
+	f = fopen(path, "wb");
+	if (!f)
+		goto out;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+	    fwrite(fr->ports, sizeof(*fr->ports), hdr.nr_ports, f) !=
+		hdr.nr_ports)
+		goto out_close;
+
+	for (i = 0; i < evc->nr; i++) {
+		cntr = (struct switchtec_flr_cntr) {
+			.stack_id = evc->stack_id[i],
+			.cntr_id = evc->cntr_id[i],
+			.port_mask = evc->port_mask[i],
+			.type_mask = evc->type_mask[i],
+		};
+
+		if (fwrite(&cntr, sizeof(cntr), 1, f) != 1)
+			goto out_close;
+	}
+
+	for (i = first; i < fr->head; i++)
+		if (fwrite(fr->ring + (i % fr->depth) * fr->sample_size,
+			   fr->sample_size, 1, f) != 1)
+			goto out_close;
+
+	if (fwrite(trig, sizeof(*trig), hdr.nr_triggers, f) !=
+	    hdr.nr_triggers)
+		goto out_close;
+
+	for (p = 0; p < fr->nr_ports; p++)
+		if (log_count[p] && fwrite(logs[p], sizeof(*logs[p]),
+					   log_count[p], f) != log_count[p])
+			goto out_close;
+
+	if (fflush(f))
+		goto out_close;
+
+	/* The log is written straight to the descriptor, after the buffer */
+	if (!switchtec_log_tail(fr->dev, SWITCHTEC_LOG_RAM, fileno(f), NULL,
+				&cursor, NULL)) {
+		if (flr_seek(f, 0, SEEK_END))
+			goto out_close;
+
+		end = flr_tell(f);
+		if (end < 0)
+			goto out_close;
+
+		hdr.fwlog_len = end - hdr.fwlog_off;
+	}
+
+	if (flr_seek(f, 0, SEEK_SET) ||
+	    fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+		goto out_close;
+
+	ret = 0;
+
+out_close:
+	if (fclose(f) && !ret)
+		ret = -1;
+out:
+	for (p = 0; p < fr->nr_ports; p++)
+		free(logs[p]);
+
+	return ret < 0 ? -errno : 0;
+}
+
+/**
+ * @brief Free a flight recorder
+ * @param[in] fr	Flight recorder
+ *
+ * The trigger events are left enabled for polling.
+ */
+void switchtec_flightrec_free(struct switchtec_flightrec *fr)
+{
+	free(fr->ring);
+	free(fr);
+}
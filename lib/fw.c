@@ -35,11 +35,17 @@
 #include "switchtec/endian.h"
 #include "switchtec/utils.h"
 #include "switchtec/mfg.h"
+#include "crc.h"
 
 #include <unistd.h>
 
+#ifndef _WIN32
+#include <poll.h>
+#endif
+
 #include <errno.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 /**
@@ -203,16 +209,39 @@ static int switchtec_fw_dlstatus(struct switchtec_dev *dev,
 	return 0;
 }
 
+#define FW_POLL_MIN_US 500
+#define FW_POLL_MAX_US 5000
+
+/*
+ * Programming time of recent blocks, used to sleep through most of the
+ * next block's programming before polling its status.
+ */
+struct fw_poll {
+	uint64_t est_us;
+};
+
 static int switchtec_fw_wait(struct switchtec_dev *dev,
-			     enum switchtec_fw_dlstatus *status)
+			     enum switchtec_fw_dlstatus *status,
+			     uint64_t sent_us, struct fw_poll *poll)
 {
 	enum mrpc_bg_status bgstatus;
+	uint64_t now, target;
+	unsigned delay;
 	int ret;
 
-	do {
-		// Delay slightly to avoid interrupting the firmware too much
-		usleep(5000);
+	/*
+	 * Delay to avoid interrupting the firmware too much: sleep for most
+	 * of the expected programming time and then back off between polls.
+	 */
+	target = sent_us + (poll->est_us ? poll->est_us * 7 / 8 :
+			    FW_POLL_MIN_US);
+	now = platform_time_us();
+	if (target > now)
+		usleep(target - now);
+
+	delay = FW_POLL_MIN_US;
 
+	while (1) {
 		ret = switchtec_fw_dlstatus(dev, status, &bgstatus);
 		if (ret < 0)
 			return ret;
@@ -230,7 +259,17 @@ static int switchtec_fw_wait(struct switchtec_dev *dev,
 				return SWITCHTEC_DLSTAT_ERROR_PROGRAM;
 		}
 
-	} while (bgstatus == MRPC_BG_STAT_INPROGRESS);
+		if (bgstatus != MRPC_BG_STAT_INPROGRESS)
+			break;
+
+		usleep(delay);
+		delay *= 2;
+		if (delay > FW_POLL_MAX_US)
+			delay = FW_POLL_MAX_US;
+	}
+
+	now = platform_time_us() - sent_us;
+	poll->est_us = poll->est_us ? (3 * poll->est_us + now) / 4 : now;
 
 	return 0;
 }
@@ -287,36 +326,124 @@ struct cmd_fwdl {
 	uint8_t data[MRPC_MAX_DATA_LEN - sizeof(struct cmd_fwdl_hdr)];
 };
 
-/**
- * @brief Write a firmware file to the switchtec device
- * @param[in] dev		Switchtec device handle
- * @param[in] img_fd		File descriptor for the image file to write
- * @param[in] force		If 1, ignore if another download command is
- *			        already in progress.
- * @param[in] dont_activate	If 1, the new image will not be activated
- * @param[in] progress_callback If not NULL, this function will be called to
- * 	indicate the progress.
- * @return 0 on success, error code on failure
+typedef ssize_t (*fw_read_fn)(void *ctx, void *buf, size_t len);
+
+static ssize_t fw_read_fd(void *ctx, void *buf, size_t len)
+{
+	int fd = *(int *)ctx;
+	ssize_t ret;
+
+	while ((ret = read(fd, buf, len)) < 0) {
+		if (errno == EINTR)
+			continue;
+
+#ifndef _WIN32
+		/* Sleep until a non-blocking fd has data rather than spin */
+		if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			struct pollfd pfd = {
+				.fd = fd,
+				.events = POLLIN,
+			};
+
+			if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+				return -errno;
+			continue;
+		}
+#endif
+
+		return -errno;
+	}
+
+	return ret;
+}
+
+static ssize_t fw_read_file(void *ctx, void *buf, size_t len)
+{
+	FILE *f = ctx;
+	size_t ret;
+
+	ret = fread(buf, 1, len, f);
+	if (!ret && ferror(f)) {
+		errno = EIO;
+		return -errno;
+	}
+
+	return ret;
+}
+
+struct fw_buf {
+	const uint8_t *data;
+	size_t len;
+	size_t pos;
+};
+
+static ssize_t fw_read_buf(void *ctx, void *buf, size_t len)
+{
+	struct fw_buf *b = ctx;
+
+	if (len > b->len - b->pos)
+		len = b->len - b->pos;
+
+	memcpy(buf, b->data + b->pos, len);
+	b->pos += len;
+
+	return len;
+}
+
+struct fw_progress_compat {
+	void (*cb)(int cur, int tot);
+};
+
+static void fw_progress_compat(void *data, int cur, int tot)
+{
+	struct fw_progress_compat *p = data;
+
+	if (p->cb)
+		p->cb(cur, tot);
+}
+
+/* Fill a whole block unless the image ends first */
+static ssize_t fw_read_block(fw_read_fn rd, void *ctx, uint8_t *buf,
+			     size_t len)
+{
+	size_t got = 0;
+	ssize_t ret;
+
+	while (got < len) {
+		ret = rd(ctx, buf + got, len - got);
+		if (ret < 0)
+			return ret;
+		if (!ret)
+			break;
+		got += ret;
+	}
+
+	return got;
+}
+
+/*
+ * Download an image block by block. Two command buffers are used so the
+ * next block is read from the image while the device programs the one
+ * just sent.
  */
-int switchtec_fw_write_fd(struct switchtec_dev *dev, int img_fd,
-			  int dont_activate, int force,
-			  void (*progress_callback)(int cur, int tot))
+static int fw_download(struct switchtec_dev *dev, size_t image_size,
+		       int dont_activate, int force, fw_read_fn rd, void *ctx,
+		       void (*progress_callback)(void *data, int cur, int tot),
+		       void *progress_data)
 {
 	enum switchtec_fw_dlstatus status;
 	enum mrpc_bg_status bgstatus;
-	ssize_t image_size, offset = 0;
-	int ret;
-	struct cmd_fwdl cmd = {};
+	struct cmd_fwdl cmd[2] = {};
+	struct fw_poll poll = {};
+	size_t offset = 0;
+	ssize_t blklen, next;
 	uint32_t cmd_id = MRPC_FWDNLD;
+	uint64_t sent_us;
+	int ret, cur = 0;
 
 	if (switchtec_boot_phase(dev) != SWITCHTEC_BOOT_PHASE_FW)
 		cmd_id = get_fw_tx_id(dev);
 
-	image_size = lseek(img_fd, 0, SEEK_END);
-	if (image_size < 0)
-		return -errno;
-	lseek(img_fd, 0, SEEK_SET);
-
 	switchtec_fw_dlstatus(dev, &status, &bgstatus);
 
 	if (!force && status == SWITCHTEC_DLSTAT_INPROGRESS) {
@@ -329,45 +456,53 @@ int switchtec_fw_write_fd(struct switchtec_dev *dev, int img_fd,
 		return -EBUSY;
 	}
 
-	if (switchtec_boot_phase(dev) == SWITCHTEC_BOOT_PHASE_BL2)
-		cmd.hdr.subcmd = MRPC_FW_TX_FLASH;
-	else
-		cmd.hdr.subcmd = MRPC_FWDNLD_DOWNLOAD;
-
-	cmd.hdr.dont_activate = !!dont_activate;
-	cmd.hdr.img_length = htole32(image_size);
-
-	while (offset < image_size) {
-		ssize_t blklen = read(img_fd, &cmd.data,
-				      sizeof(cmd.data));
+	for (cur = 0; cur < 2; cur++) {
+		if (switchtec_boot_phase(dev) == SWITCHTEC_BOOT_PHASE_BL2)
+			cmd[cur].hdr.subcmd = MRPC_FW_TX_FLASH;
+		else
+			cmd[cur].hdr.subcmd = MRPC_FWDNLD_DOWNLOAD;
 
-		if (blklen == -EAGAIN || blklen == -EWOULDBLOCK)
-			continue;
+		cmd[cur].hdr.dont_activate = !!dont_activate;
+		cmd[cur].hdr.img_length = htole32(image_size);
+	}
 
-		if (blklen < 0)
-			return -errno;
+	cur = 0;
+	blklen = 0;
+	if (image_size)
+		blklen = fw_read_block(rd, ctx, cmd[cur].data,
+				       sizeof(cmd[cur].data));
+	if (blklen < 0)
+		return blklen;
 
-		if (blklen == 0)
-			break;
+	while (offset < image_size && blklen > 0) {
+		cmd[cur].hdr.offset = htole32(offset);
+		cmd[cur].hdr.blk_length = htole32(blklen);
 
-		cmd.hdr.offset = htole32(offset);
-		cmd.hdr.blk_length = htole32(blklen);
-
-		ret = switchtec_cmd(dev, cmd_id, &cmd, sizeof(cmd),
+		ret = switchtec_cmd(dev, cmd_id, &cmd[cur], sizeof(cmd[cur]),
 				    NULL, 0);
-
 		if (ret)
 			return ret;
 
-		ret = switchtec_fw_wait(dev, &status);
+		sent_us = platform_time_us();
+		offset += blklen;
+
+		next = 0;
+		if (offset < image_size)
+			next = fw_read_block(rd, ctx, cmd[!cur].data,
+					     sizeof(cmd[!cur].data));
+
+		ret = switchtec_fw_wait(dev, &status, sent_us, &poll);
 		if (ret != 0)
 			return ret;
 
-		offset += le32toh(cmd.hdr.blk_length);
+		if (next < 0)
+			return next;
 
 		if (progress_callback)
-			progress_callback(offset, image_size);
+			progress_callback(progress_data, offset, image_size);
 
+		blklen = next;
+		cur = !cur;
 	}
 
 	if (status == SWITCHTEC_DLSTAT_COMPLETES)
@@ -385,6 +520,64 @@ int switchtec_fw_write_fd(struct switchtec_dev *dev, int img_fd,
 	return status;
 }
 
+/**
+ * @brief Write a firmware file to the switchtec device
+ * @param[in] dev		Switchtec device handle
+ * @param[in] img_fd		File descriptor for the image file to write
+ * @param[in] force		If 1, ignore if another download command is
+ *			        already in progress.
+ * @param[in] dont_activate	If 1, the new image will not be activated
+ * @param[in] progress_callback If not NULL, this function will be called to
+ * 	indicate the progress.
+ * @return 0 on success, error code on failure
+ */
+int switchtec_fw_write_fd(struct switchtec_dev *dev, int img_fd,
+			  int dont_activate, int force,
+			  void (*progress_callback)(int cur, int tot))
+{
+	struct fw_progress_compat progress = {progress_callback};
+	off_t image_size;
+
+	image_size = lseek(img_fd, 0, SEEK_END);
+	if (image_size < 0)
+		return -errno;
+	lseek(img_fd, 0, SEEK_SET);
+
+	return fw_download(dev, image_size, dont_activate, force,
+			   fw_read_fd, &img_fd, fw_progress_compat, &progress);
+}
+
+/**
+ * @brief Write a firmware image in memory to the switchtec device
+ * @param[in] dev		Switchtec device handle
+ * @param[in] img		Image to write
+ * @param[in] img_len		Length of the image in bytes
+ * @param[in] dont_activate	If 1, the new image will not be activated
+ * @param[in] force		If 1, ignore if another download command is
+ *			        already in progress.
+ * @param[in] progress_callback If not NULL, this function will be called
+ *	with \p data to indicate the progress.
+ * @param[in] data		Passed to \p progress_callback
+ * @return 0 on success, error code on failure
+ *
+ * The image is only read, so one copy may be written to several devices
+ * from different threads at once.
+ */
+int switchtec_fw_write_buf(struct switchtec_dev *dev, const void *img,
+			   size_t img_len, int dont_activate, int force,
+			   void (*progress_callback)(void *data, int cur,
+						     int tot),
+			   void *data)
+{
+	struct fw_buf buf = {
+		.data = img,
+		.len = img_len,
+	};
+
+	return fw_download(dev, img_len, dont_activate, force, fw_read_buf,
+			   &buf, progress_callback, data);
+}
+
 /**
  * @brief Extract generation information from FW version number
  * @param[in] version		Firmware version number
@@ -422,15 +615,9 @@ int switchtec_fw_write_file(struct switchtec_dev *dev, FILE *fimg,
 			    int dont_activate, int force,
 			    void (*progress_callback)(int cur, int tot))
 {
-	enum switchtec_fw_dlstatus status;
-	enum mrpc_bg_status bgstatus;
-	ssize_t image_size, offset = 0;
+	struct fw_progress_compat progress = {progress_callback};
+	long image_size;
 	int ret;
-	struct cmd_fwdl cmd = {};
-	uint32_t cmd_id = MRPC_FWDNLD;
-
-	if (switchtec_boot_phase(dev) != SWITCHTEC_BOOT_PHASE_FW)
-		cmd_id = get_fw_tx_id(dev);
 
 	ret = fseek(fimg, 0, SEEK_END);
 	if (ret)
@@ -442,68 +629,8 @@ int switchtec_fw_write_file(struct switchtec_dev *dev, FILE *fimg,
 	if (ret)
 		return -errno;
 
-	switchtec_fw_dlstatus(dev, &status, &bgstatus);
-
-	if (!force && status == SWITCHTEC_DLSTAT_INPROGRESS) {
-		errno = EBUSY;
-		return -EBUSY;
-	}
-
-	if (bgstatus == MRPC_BG_STAT_INPROGRESS) {
-		errno = EBUSY;
-		return -EBUSY;
-	}
-
-	if (switchtec_boot_phase(dev) == SWITCHTEC_BOOT_PHASE_BL2)
-		cmd.hdr.subcmd = MRPC_FW_TX_FLASH;
-	else
-		cmd.hdr.subcmd = MRPC_FWDNLD_DOWNLOAD;
-
-	cmd.hdr.dont_activate = !!dont_activate;
-	cmd.hdr.img_length = htole32(image_size);
-
-	while (offset < image_size) {
-		ssize_t blklen = fread(&cmd.data, 1, sizeof(cmd.data), fimg);
-
-		if (blklen == 0) {
-			ret = ferror(fimg);
-			if (ret)
-				return ret;
-			break;
-		}
-
-		cmd.hdr.offset = htole32(offset);
-		cmd.hdr.blk_length = htole32(blklen);
-
-		ret = switchtec_cmd(dev, cmd_id, &cmd, sizeof(cmd),
-				    NULL, 0);
-
-		if (ret)
-			return ret;
-
-		ret = switchtec_fw_wait(dev, &status);
-		if (ret != 0)
-			return ret;
-
-		offset += le32toh(cmd.hdr.blk_length);
-
-		if (progress_callback)
-			progress_callback(offset, image_size);
-	}
-
-	if (status == SWITCHTEC_DLSTAT_COMPLETES)
-		return 0;
-
-	if (status == SWITCHTEC_DLSTAT_SUCCESS_FIRM_ACT)
-		return 0;
-
-	if (status == SWITCHTEC_DLSTAT_SUCCESS_DATA_ACT)
-		return 0;
-
-	if (status == 0)
-		return SWITCHTEC_DLSTAT_HARDWARE_ERR;
-
-	return status;
+	return fw_download(dev, image_size, dont_activate, force,
+			   fw_read_file, fimg, fw_progress_compat, &progress);
 }
 
 /**
@@ -669,6 +796,7 @@ static int switchtec_fw_file_info_gen3(int fd,
 	info->image_crc = le32toh(hdr.image_crc);
 	version_to_string(hdr.version, info->version, sizeof(info->version));
 	info->image_len = le32toh(hdr.image_len);
+	info->part_body_offset = sizeof(hdr);
 
 	info->type = switchtec_fw_id_to_type(info);
 
@@ -782,6 +910,7 @@ static int switchtec_fw_file_info_gen45(int fd,
 	version = le32toh(hdr.version);
 	version_to_string(version, info->version, sizeof(info->version));
 	info->image_len = le32toh(hdr.image_len);
+	info->part_body_offset = le32toh(hdr.header_len);
 	info->gen = switchtec_fw_version_to_gen(version);
 
 	info->type = switchtec_fw_id_to_type(info);
@@ -801,6 +930,9 @@ invalid_file:
  * @param[in]  fd	File descriptor for the image file to inspect
  * @param[out] info	Structure populated with information about the file
  * @return 0 on success, error code on failure
+ *
+ * \p info->part_body_offset is set to the offset of the image body in
+ * the file, as given by the file's header.
  */
 int switchtec_fw_file_info(int fd, struct switchtec_fw_image_info *info)
 {
@@ -1325,7 +1457,7 @@ static int switchtec_fw_part_info(struct switchtec_dev *dev, int nr_info,
 	if (info == NULL || nr_info == 0)
 		return -EINVAL;
 
-	if (dev->gen == SWITCHTEC_GEN4) {
+	if (switchtec_gen(dev) == SWITCHTEC_GEN4) {
 		ret = switchtec_cmd(dev, MRPC_PART_INFO, &subcmd,
 				    sizeof(subcmd), &all_info_gen4,
 				    sizeof(all_info_gen4));
@@ -1335,7 +1467,7 @@ static int switchtec_fw_part_info(struct switchtec_dev *dev, int nr_info,
 			le32toh(all_info_gen4.firmware_version);
 		all_info_gen4.flash_size = le32toh(all_info_gen4.flash_size);
 		all_info_gen4.device_id = le16toh(all_info_gen4.device_id);
-	} else if (dev->gen == SWITCHTEC_GEN5) {
+	} else if (switchtec_gen(dev) == SWITCHTEC_GEN5) {
 		subcmd = MRPC_PART_INFO_GET_ALL_INFO_GEN5;
 		ret = switchtec_cmd(dev, MRPC_PART_INFO, &subcmd,
 				    sizeof(subcmd), &all_info_gen5,
@@ -1352,7 +1484,7 @@ static int switchtec_fw_part_info(struct switchtec_dev *dev, int nr_info,
 		struct switchtec_fw_image_info *inf = &info[i];
 		ret = 0;
 
-		inf->gen = dev->gen;
+		inf->gen = switchtec_gen(dev);
 		inf->type = switchtec_fw_id_to_type(inf);
 		inf->active = false;
 		inf->running = false;
@@ -1559,7 +1691,7 @@ switchtec_fw_part_summary(struct switchtec_dev *dev)
 	size_t st_sz;
 	int ret, i;
 
-	switch (dev->gen) {
+	switch (switchtec_gen(dev)) {
 	case SWITCHTEC_GEN3:
 		nr_info = ARRAY_SIZE(switchtec_fw_partitions_gen3);
 		break;
@@ -1583,7 +1715,7 @@ switchtec_fw_part_summary(struct switchtec_dev *dev)
 	memset(summary, 0, st_sz);
 	summary->nr_info = nr_info;
 
-	switch (dev->gen) {
+	switch (switchtec_gen(dev)) {
 	case SWITCHTEC_GEN3:
 		for (i = 0; i < nr_info; i++)
 			summary->all[i].part_id =
@@ -1692,44 +1824,147 @@ int switchtec_fw_read(struct switchtec_dev *dev, unsigned long addr,
 	return read;
 }
 
+#define FW_READBACK_BUF_LEN ((MRPC_MAX_DATA_LEN - 8) * 16)
+
+/*
+ * Two buffers shared between the caller, which fills them from flash,
+ * and a writer thread, which drains them to the file.
+ */
+struct fw_readback {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int fd;
+	uint8_t *buf[2];
+	size_t len[2];
+	int full[2];
+	int done;
+	int error;
+};
+
+static int fw_write_all(int fd, const uint8_t *buf, size_t len)
+{
+	size_t total_wrote = 0;
+	ssize_t wrote;
+
+	while (total_wrote < len) {
+		wrote = write(fd, &buf[total_wrote], len - total_wrote);
+		if (wrote < 0)
+			return -errno;
+		total_wrote += wrote;
+	}
+
+	return 0;
+}
+
+static void *fw_readback_writer(void *arg)
+{
+	struct fw_readback *rb = arg;
+	int i = 0, ret;
+
+	while (1) {
+		pthread_mutex_lock(&rb->lock);
+		while (!rb->full[i] && !rb->done)
+			pthread_cond_wait(&rb->cond, &rb->lock);
+		if (!rb->full[i]) {
+			pthread_mutex_unlock(&rb->lock);
+			break;
+		}
+		pthread_mutex_unlock(&rb->lock);
+
+		ret = fw_write_all(rb->fd, rb->buf[i], rb->len[i]);
+
+		pthread_mutex_lock(&rb->lock);
+		rb->full[i] = 0;
+		if (ret)
+			rb->error = -ret;
+		pthread_cond_signal(&rb->cond);
+		pthread_mutex_unlock(&rb->lock);
+
+		if (ret)
+			break;
+		i = !i;
+	}
+
+	return NULL;
+}
+
 /**
- * @brief Read a Switchtec device's flash data into a file
- * @param[in] dev	Switchtec device handle
- * @param[in] fd	File descriptor of the file to save the firmware
- *	data to
- * @param[in] addr	Address to read from
- * @param[in] len	Number of bytes to read
- * @param[in] progress_callback This function is called periodically to
+ * @brief Read a Switchtec device's flash data, optionally into a file,
+ *	computing its CRC32
+ * @param[in]  dev	Switchtec device handle
+ * @param[in]  fd	File descriptor to save the data to, or -1 to only
+ *	compute the CRC
+ * @param[in]  addr	Address to read from
+ * @param[in]  len	Number of bytes to read
+ * @param[out] crc	CRC32 of the data read (may be NULL)
+ * @param[in]  progress_callback This function is called periodically to
  *	indicate the progress of the read. May be NULL.
- * @return 0 on success, error code on failure
+ * @return Number of bytes read on success, error code on failure
+ *
+ * Writing to the file happens in a separate thread, so the next part of
+ * the flash is read while the previous part is being written.
  */
-int switchtec_fw_read_fd(struct switchtec_dev *dev, int fd,
-			 unsigned long addr, size_t len,
-			 void (*progress_callback)(int cur, int tot))
+int switchtec_fw_readback(struct switchtec_dev *dev, int fd,
+			  unsigned long addr, size_t len, uint32_t *crc,
+			  void (*progress_callback)(int cur, int tot))
 {
-	int ret;
-	unsigned char buf[(MRPC_MAX_DATA_LEN-8)*4];
+	struct fw_readback rb = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.fd = fd,
+	};
+	pthread_t writer;
 	size_t read = 0;
 	size_t total_len = len;
-	size_t total_wrote;
-	ssize_t wrote;
+	uint32_t sum = 0;
+	int ret = 0, i = 0, err;
+
+	rb.buf[0] = malloc(FW_READBACK_BUF_LEN);
+	rb.buf[1] = fd < 0 ? rb.buf[0] : malloc(FW_READBACK_BUF_LEN);
+	if (!rb.buf[0] || !rb.buf[1]) {
+		ret = -1;
+		goto out_free;
+	}
 
-	while(len) {
+	if (fd >= 0) {
+		ret = pthread_create(&writer, NULL, fw_readback_writer, &rb);
+		if (ret) {
+			errno = ret;
+			ret = -1;
+			goto out_free;
+		}
+	}
+
+	while (len) {
 		size_t chunk_len = len;
-		if (chunk_len > sizeof(buf))
-			chunk_len = sizeof(buf);
+		if (chunk_len > FW_READBACK_BUF_LEN)
+			chunk_len = FW_READBACK_BUF_LEN;
+
+		pthread_mutex_lock(&rb.lock);
+		while (rb.full[i] && !rb.error)
+			pthread_cond_wait(&rb.cond, &rb.lock);
+		err = rb.error;
+		pthread_mutex_unlock(&rb.lock);
+
+		if (err) {
+			errno = err;
+			ret = -1;
+			break;
+		}
 
-		ret = switchtec_fw_read(dev, addr, chunk_len, buf);
+		ret = switchtec_fw_read(dev, addr, chunk_len, rb.buf[i]);
 		if (ret < 0)
-			return ret;
+			break;
+
+		sum = crc32(rb.buf[i], ret, sum, !read, 0);
 
-		total_wrote = 0;
-		while (total_wrote < ret) {
-			wrote = write(fd, &buf[total_wrote],
-				      ret - total_wrote);
-			if (wrote < 0)
-				return -1;
-			total_wrote += wrote;
+		if (fd >= 0) {
+			pthread_mutex_lock(&rb.lock);
+			rb.len[i] = ret;
+			rb.full[i] = 1;
+			pthread_cond_signal(&rb.cond);
+			pthread_mutex_unlock(&rb.lock);
+			i = !i;
 		}
 
 		read += ret;
@@ -1740,7 +1975,49 @@ int switchtec_fw_read_fd(struct switchtec_dev *dev, int fd,
 			progress_callback(read, total_len);
 	}
 
-	return read;
+	if (fd >= 0) {
+		pthread_mutex_lock(&rb.lock);
+		rb.done = 1;
+		pthread_cond_signal(&rb.cond);
+		pthread_mutex_unlock(&rb.lock);
+		pthread_join(writer, NULL);
+
+		if (ret >= 0 && rb.error) {
+			errno = rb.error;
+			ret = -1;
+		}
+	}
+
+	if (ret >= 0) {
+		ret = read;
+		if (crc)
+			*crc = read ? sum ^ 0xFFFFFFFF : 0;
+	}
+
+out_free:
+	if (rb.buf[1] != rb.buf[0])
+		free(rb.buf[1]);
+	free(rb.buf[0]);
+	return ret;
+}
+
+/**
+ * @brief Read a Switchtec device's flash data into a file
+ * @param[in] dev	Switchtec device handle
+ * @param[in] fd	File descriptor of the file to save the firmware
+ *	data to
+ * @param[in] addr	Address to read from
+ * @param[in] len	Number of bytes to read
+ * @param[in] progress_callback This function is called periodically to
+ *	indicate the progress of the read. May be NULL.
+ * @return 0 on success, error code on failure
+ */
+int switchtec_fw_read_fd(struct switchtec_dev *dev, int fd,
+			 unsigned long addr, size_t len,
+			 void (*progress_callback)(int cur, int tot))
+{
+	return switchtec_fw_readback(dev, fd, addr, len, NULL,
+				     progress_callback);
 }
 
 /**
@@ -1761,6 +2038,116 @@ int switchtec_fw_body_read_fd(struct switchtec_dev *dev, int fd,
 				    info->image_len, progress_callback);
 }
 
+/**
+ * @brief Read a Switchtec device's flash image body and check its CRC
+ * @param[in]  dev     Switchtec device handle
+ * @param[in]  fd      File descriptor for image file to write, or -1 to
+ *     only verify the image
+ * @param[in]  info    Partition information structure
+ * @param[out] crc     CRC32 of the body read (may be NULL)
+ * @param[in]  progress_callback This function is called periodically to
+ *     indicate the progress of the read. May be NULL.
+ * @return 0 if the CRC matches the image header, 1 if it does not, or
+ *     negative on failure
+ */
+int switchtec_fw_body_verify(struct switchtec_dev *dev, int fd,
+			     struct switchtec_fw_image_info *info,
+			     uint32_t *crc,
+			     void (*progress_callback)(int cur, int tot))
+{
+	uint32_t sum;
+	int ret;
+
+	ret = switchtec_fw_readback(dev, fd,
+				    info->part_addr + info->part_body_offset,
+				    info->image_len, &sum, progress_callback);
+	if (ret < 0)
+		return ret;
+
+	if (crc)
+		*crc = sum;
+
+	return sum != info->image_crc;
+}
+
+#define FW_DIFF_DEFAULT_CHUNK (64 * 1024)
+
+/**
+ * @brief Compare a region of flash against an image in memory
+ * @param[in]  dev	Switchtec device handle
+ * @param[in]  addr	Flash address of the start of the image
+ * @param[in]  img	Image to compare against
+ * @param[in]  len	Number of bytes to compare
+ * @param[in]  chunk	Granularity of the comparison in bytes (0 selects
+ *	64KiB)
+ * @param[out] ranges	Differing ranges, as offsets into \p img, with
+ *	adjacent chunks merged (may be NULL to stop at the first
+ *	difference)
+ * @param[in]  max_ranges Number of entries in \p ranges
+ * @param[in]  progress_callback This function is called periodically to
+ *	indicate the progress of the read. May be NULL.
+ * @return The number of differing ranges (which may be more than
+ *	\p max_ranges), 0 if the flash matches, or negative on failure
+ *
+ * The flash has no way to hash itself, so each chunk is read with
+ * switchtec_fw_read() and compared directly.
+ */
+int switchtec_fw_diff(struct switchtec_dev *dev, unsigned long addr,
+		      const void *img, size_t len, size_t chunk,
+		      struct switchtec_fw_diff_range *ranges, int max_ranges,
+		      void (*progress_callback)(int cur, int tot))
+{
+	const uint8_t *cimg = img;
+	size_t off = 0, chunk_len;
+	int nr = 0, in_range = 0;
+	uint8_t *buf;
+	int ret;
+
+	if (!chunk)
+		chunk = FW_DIFF_DEFAULT_CHUNK;
+
+	buf = malloc(chunk);
+	if (!buf)
+		return -1;
+
+	while (off < len) {
+		chunk_len = len - off;
+		if (chunk_len > chunk)
+			chunk_len = chunk;
+
+		ret = switchtec_fw_read(dev, addr + off, chunk_len, buf);
+		if (ret < 0) {
+			free(buf);
+			return ret;
+		}
+
+		if (!memcmp(buf, cimg + off, chunk_len)) {
+			in_range = 0;
+		} else if (!ranges) {
+			free(buf);
+			return 1;
+		} else if (in_range) {
+			if (nr <= max_ranges)
+				ranges[nr - 1].len += chunk_len;
+		} else {
+			if (nr < max_ranges) {
+				ranges[nr].offset = off;
+				ranges[nr].len = chunk_len;
+			}
+			nr++;
+			in_range = 1;
+		}
+
+		off += chunk_len;
+
+		if (progress_callback)
+			progress_callback(off, len);
+	}
+
+	free(buf);
+	return nr;
+}
+
 static int switchtec_fw_img_write_hdr_gen3(int fd,
 		struct switchtec_fw_image_info *info)
 {
@@ -26,6 +26,7 @@
 #include "switchtec/switchtec.h"
 #include "switchtec_priv.h"
 
+#include <errno.h>
 #include <string.h>
 #include <signal.h>
 #include <unistd.h>
@@ -83,6 +84,96 @@ void gas_mrpc_memcpy_to_gas(struct switchtec_dev *dev, void __gas *dest,
 	}
 }
 
+static int gas_mrpc_submit_read(struct switchtec_dev *dev, uint32_t offset,
+				void *dest, size_t len)
+{
+	struct gas_mrpc_read cmd = {
+		.gas_offset = htole32(offset),
+		.len = htole32(len),
+	};
+
+	return switchtec_cmd_submit(dev, MRPC_GAS_READ, &cmd, sizeof(cmd),
+				    dest, len);
+}
+
+/**
+ * @brief Stream data from the GAS using MRPC commands
+ * @param[in] dev	Switchtec device handle
+ * @param[in] src	Source gas address
+ * @param[in] n		Number of bytes to transfer
+ * @param[in] fn	Called with each chunk of data, in order. A non-zero
+ *			return stops the transfer and is returned.
+ * @param[in] ctx	Passed to \p fn
+ * @return 0 on success, error code on failure
+ *
+ * The read for the next chunk is started before \p fn is called for
+ * the current one, so whatever \p fn does (copying, writing to a file,
+ * reporting progress) overlaps with the firmware servicing the next
+ * command.
+ *
+ * The device handle stays locked for the whole transfer; \p fn must
+ * not issue commands to \p dev from another thread.
+ */
+int gas_mrpc_read_stream(struct switchtec_dev *dev, const void __gas *src,
+			 size_t n, gas_mrpc_chunk_fn fn, void *ctx)
+{
+	uint8_t buf[2][GAS_MRPC_MEMCPY_MAX];
+	uint32_t offset = (uint32_t)(src - (void __gas *)dev->gas_map);
+	size_t done = 0, len, next_len;
+	int cur = 0;
+	int ret;
+
+	if (!n)
+		return 0;
+
+	platform_lock(dev);
+
+	len = n > GAS_MRPC_MEMCPY_MAX ? GAS_MRPC_MEMCPY_MAX : n;
+	ret = gas_mrpc_submit_read(dev, offset, buf[cur], len);
+
+	while (!ret) {
+		ret = switchtec_cmd_complete(dev);
+		if (ret)
+			break;
+
+		next_len = n - done - len;
+		if (next_len > GAS_MRPC_MEMCPY_MAX)
+			next_len = GAS_MRPC_MEMCPY_MAX;
+
+		if (next_len) {
+			ret = gas_mrpc_submit_read(dev, offset + done + len,
+						   buf[!cur], next_len);
+			if (ret)
+				break;
+		}
+
+		ret = fn(ctx, buf[cur], done, len);
+		if (ret) {
+			if (next_len)
+				switchtec_cmd_complete(dev);
+			break;
+		}
+
+		done += len;
+		if (!next_len)
+			break;
+
+		len = next_len;
+		cur = !cur;
+	}
+
+	platform_unlock(dev);
+
+	return ret;
+}
+
+static int gas_mrpc_copy_chunk(void *ctx, const void *data, size_t offset,
+			       size_t len)
+{
+	memcpy((uint8_t *)ctx + offset, data, len);
+	return 0;
+}
+
 /**
  * @brief Copy data from the GAS using MRPC commands
  * @param[in]  dev	Switchtec device handle
@@ -96,31 +187,83 @@ int gas_mrpc_memcpy_from_gas(struct switchtec_dev *dev, void *dest,
 {
 	struct gas_mrpc_read cmd;
 	int ret;
-	uint32_t len;
+
+	if (n > GAS_MRPC_MEMCPY_MAX) {
+		ret = gas_mrpc_read_stream(dev, src, n, gas_mrpc_copy_chunk,
+					   dest);
+		if (ret)
+			memset(dest, 0xff, n);
+		return ret;
+	}
 
 	cmd.gas_offset = htole32((uint32_t)(src - (void __gas *)dev->gas_map));
+	cmd.len = htole32(n);
 
-	while (n) {
-		len = n;
-		if (len > GAS_MRPC_MEMCPY_MAX)
-			len = GAS_MRPC_MEMCPY_MAX;
-		cmd.len = htole32(len);
+	ret = switchtec_cmd(dev, MRPC_GAS_READ, &cmd, sizeof(cmd), dest, n);
+	if (ret)
+		memset(dest, 0xff, n);
 
-		ret = switchtec_cmd(dev, MRPC_GAS_READ, &cmd,
-				    sizeof(cmd), dest, len);
-		if (ret) {
-			memset(dest, 0xff, n);
-			return ret;
-		}
+	return ret;
+}
 
-		n -= len;
-		dest += len;
-		cmd.gas_offset += len;
+struct gas_mrpc_fd_ctx {
+	int fd;
+	size_t total;
+	void (*progress_callback)(int cur, int tot);
+};
+
+static int gas_mrpc_write_chunk(void *ctx, const void *data, size_t offset,
+				size_t len)
+{
+	struct gas_mrpc_fd_ctx *fctx = ctx;
+	ssize_t ret;
+	size_t cnt = 0;
+
+	while (cnt < len) {
+		ret = write(fctx->fd, (const uint8_t *)data + cnt, len - cnt);
+		if (ret < 0)
+			return -errno;
+		cnt += ret;
 	}
 
+	if (fctx->progress_callback)
+		fctx->progress_callback(offset + len, fctx->total);
+
 	return 0;
 }
 
+/**
+ * @brief Call write() with data from the GAS using MRPC commands and
+ *	report progress
+ * @param[in] dev		Switchtec device handle
+ * @param[in] fd		Destination file descriptor
+ * @param[in] src		Source gas address
+ * @param[in] n			Number of bytes to transfer
+ * @param[in] progress_callback	If not NULL, called after each chunk is
+ *				written with the bytes done and the total
+ * @return The number of bytes written, or -1 on failure
+ */
+ssize_t gas_mrpc_write_from_gas_progress(struct switchtec_dev *dev, int fd,
+		const void __gas *src, size_t n,
+		void (*progress_callback)(int cur, int tot))
+{
+	struct gas_mrpc_fd_ctx fctx = {
+		.fd = fd,
+		.total = n,
+		.progress_callback = progress_callback,
+	};
+	int ret;
+
+	ret = gas_mrpc_read_stream(dev, src, n, gas_mrpc_write_chunk, &fctx);
+	if (ret) {
+		if (ret > 0)
+			errno = ret;
+		return -1;
+	}
+
+	return n;
+}
+
 /**
  * @brief Call write() with data from the GAS using an MRPC command
  * @param[in] dev	Switchtec device handle
@@ -131,27 +274,7 @@ int gas_mrpc_memcpy_from_gas(struct switchtec_dev *dev, void *dest,
 ssize_t gas_mrpc_write_from_gas(struct switchtec_dev *dev, int fd,
 				const void __gas *src, size_t n)
 {
-	char buf[MRPC_MAX_DATA_LEN];
-	ssize_t ret, total = 0;
-	size_t txfr_sz;
-
-	while (n) {
-		txfr_sz = n;
-		if (txfr_sz > sizeof(buf))
-			txfr_sz = sizeof(buf);
-
-		gas_mrpc_memcpy_from_gas(dev, buf, src, txfr_sz);
-
-		ret = write(fd, buf, txfr_sz);
-		if (ret < 0)
-			return ret;
-
-		n -= ret;
-		src += ret;
-		total += ret;
-	}
-
-	return total;
+	return gas_mrpc_write_from_gas_progress(dev, fd, src, n, NULL);
 }
 
 /**@}*/
@@ -0,0 +1,534 @@
+/*
+ * Microsemi Switchtec(tm) PCIe Management Library
+ * Copyright (c) 2025, Microsemi Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+
+/**
+ * @file
+ * @brief Link error injection campaigns
+ */
+
+#define SWITCHTEC_LIB_CORE
+
+#include "switchtec_priv.h"
+#include "switchtec/switchtec.h"
+#include "switchtec/utils.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct lnkerr_port {
+	struct switchtec_lnkerr_result *res;
+	struct switchtec_port_id id;
+	int cntr;		//!< Index in the counter snapshot, or -1
+	uint64_t first_start_us;
+	uint64_t last_end_us;
+	double baseline_sum;
+	unsigned baseline_n;
+	int sampled;		//!< Sampled since the first burst started
+};
+
+struct lnkerr_burst {
+	const struct switchtec_lnkerr_burst *b;
+	struct lnkerr_port *port;
+	uint64_t start_us;
+	uint64_t end_us;
+	uint64_t next_us;	//!< Next single shot injection
+	int enabled;		//!< Hardware rate injection is on
+	int done;
+};
+
+struct lnkerr_ctx {
+	struct switchtec_dev *dev;
+	const struct switchtec_lnkerr_campaign *c;
+	struct lnkerr_port *ports;
+	int nr_ports;
+	struct lnkerr_burst *bursts;
+	int *ids;
+	struct switchtec_bwcntr_res *bw;
+	struct switchtec_evcntr_snapshot snap;
+	unsigned delta[SWITCHTEC_MAX_EVCNTRS];
+	uint64_t t0;
+	uint64_t last_sample_us;
+};
+
+static int lnkerr_hw_rate(enum switchtec_lnkerr_type type)
+{
+	return type == SWITCHTEC_LNKERR_DLLP_CRC ||
+		type == SWITCHTEC_LNKERR_TLP_LCRC;
+}
+
+static int lnkerr_inject(struct switchtec_dev *dev,
+			 const struct switchtec_lnkerr_burst *b, int enable)
+{
+	int port = b->phys_port_id;
+
+	switch (b->type) {
+	case SWITCHTEC_LNKERR_DLLP:
+		return switchtec_inject_err_dllp(dev, port, b->data);
+	case SWITCHTEC_LNKERR_DLLP_CRC:
+		return switchtec_inject_err_dllp_crc(dev, port, enable,
+						     enable ? b->hw_rate : 0);
+	case SWITCHTEC_LNKERR_TLP_LCRC:
+		if (switchtec_is_gen5(dev))
+			return switchtec_inject_err_tlp_lcrc_gen5(dev, port,
+					enable, enable ? b->hw_rate : 0);
+		return switchtec_inject_err_tlp_lcrc_gen4(dev, port, enable,
+					enable ? b->hw_rate : 0);
+	case SWITCHTEC_LNKERR_TLP_SEQ:
+		return switchtec_inject_err_tlp_seq_num(dev, port);
+	case SWITCHTEC_LNKERR_ACK_NACK:
+		return switchtec_inject_err_ack_nack(dev, port, b->data,
+						     b->count);
+	case SWITCHTEC_LNKERR_CTO:
+		return switchtec_inject_err_cto(dev, port);
+	}
+
+	errno = EINVAL;
+	return -1;
+}
+
+static void lnkerr_count(struct lnkerr_burst *lb, int ret)
+{
+	if (ret)
+		lb->port->res->inject_failed++;
+	else
+		lb->port->res->injected++;
+}
+
+/* Issue whatever is due on a burst and return when it next needs work */
+static uint64_t lnkerr_burst_run(struct lnkerr_ctx *ctx,
+				 struct lnkerr_burst *lb, uint64_t now)
+{
+	uint64_t period;
+
+	if (lb->done)
+		return UINT64_MAX;
+
+	if (now < lb->start_us)
+		return lb->start_us;
+
+	if (lnkerr_hw_rate(lb->b->type)) {
+		if (now >= lb->end_us) {
+			if (lb->enabled)
+				lnkerr_inject(ctx->dev, lb->b, 0);
+			lb->enabled = 0;
+			lb->done = 1;
+			return UINT64_MAX;
+		}
+
+		if (!lb->enabled) {
+			lnkerr_count(lb, lnkerr_inject(ctx->dev, lb->b, 1));
+			lb->enabled = 1;
+		}
+
+		return lb->end_us;
+	}
+
+	if (now >= lb->end_us) {
+		lb->done = 1;
+		return UINT64_MAX;
+	}
+
+	if (now >= lb->next_us) {
+		lnkerr_count(lb, lnkerr_inject(ctx->dev, lb->b, 1));
+
+		/*
+		 * If the commands can't keep up with the rate, drop the
+		 * missed injections rather than bunching them together.
+		 */
+		period = 1000000ULL / lb->b->rate;
+		lb->next_us += period;
+		if (lb->next_us < now)
+			lb->next_us = now;
+	}
+
+	return lb->next_us < lb->end_us ? lb->next_us : lb->end_us;
+}
+
+static int lnkerr_bursting(struct lnkerr_ctx *ctx, struct lnkerr_port *p,
+			   uint64_t now)
+{
+	int i;
+
+	for (i = 0; i < ctx->c->nr_bursts; i++)
+		if (ctx->bursts[i].port == p &&
+		    now >= ctx->bursts[i].start_us &&
+		    now < ctx->bursts[i].end_us)
+			return 1;
+
+	return 0;
+}
+
+static int lnkerr_sample(struct lnkerr_ctx *ctx)
+{
+	const struct switchtec_lnkerr_campaign *c = ctx->c;
+	double frac = c->recover_frac > 0 ? c->recover_frac : 0.9;
+	struct switchtec_lnkerr_sample smp;
+	struct switchtec_lnkerr_result *res;
+	struct lnkerr_port *p;
+	uint64_t window, now;
+	int stop = 0;
+	int ret, i;
+
+	ret = switchtec_bwcntr_many(ctx->dev, ctx->nr_ports, ctx->ids, 1,
+				    ctx->bw);
+	if (ret < 0)
+		return ret;
+
+	/* Read with clear set, so the counts are the deltas */
+	ret = switchtec_evcntr_snapshot(ctx->dev, &ctx->snap, 1);
+	if (ret < 0)
+		return ret;
+
+	now = platform_time_us();
+
+	for (i = 0; i < ctx->nr_ports; i++) {
+		p = &ctx->ports[i];
+		res = p->res;
+
+		/* The counters were cleared, so this is the window length */
+		window = ctx->bw[i].time_us;
+		if (!window)
+			window = now - ctx->last_sample_us;
+
+		smp.time_us = now - ctx->t0;
+		smp.phys_port_id = res->phys_port_id;
+		smp.bps = window ? (switchtec_bwcntr_tot(&ctx->bw[i].egress) +
+				    switchtec_bwcntr_tot(&ctx->bw[i].ingress)) *
+				   1e6 / window : 0;
+		smp.events = p->cntr >= 0 ? ctx->snap.count[p->cntr] : 0;
+		smp.bursting = lnkerr_bursting(ctx, p, now);
+
+		res->events += smp.events;
+
+		if (now <= p->first_start_us) {
+			p->baseline_sum += smp.bps;
+			p->baseline_n++;
+			res->baseline = p->baseline_sum / p->baseline_n;
+		} else {
+			if (!p->sampled || smp.bps < res->minimum)
+				res->minimum = smp.bps;
+			p->sampled = 1;
+		}
+
+		if (now >= p->last_end_us && !res->recovered &&
+		    smp.bps >= frac * res->baseline) {
+			res->recovered = 1;
+			res->recovery_us = now - p->last_end_us;
+		}
+
+		if (c->cb && c->cb(&smp, c->data))
+			stop = 1;
+	}
+
+	ctx->last_sample_us = now;
+	return stop;
+}
+
+/*
+ * Count the campaign's error types on a free counter of each port's
+ * stack. Counters are taken in ascending order per stack, which is the
+ * order switchtec_evcntr_snapshot() needs.
+ */
+static int lnkerr_setup_counters(struct lnkerr_ctx *ctx)
+{
+	struct switchtec_evcntr_snapshot *existing;
+	uint8_t used[SWITCHTEC_MAX_STACKS][SWITCHTEC_MAX_EVENT_COUNTERS] = {};
+	struct switchtec_evcntr_setup setup = {
+		.type_mask = ctx->c->evcntr_mask,
+	};
+	struct lnkerr_port *p;
+	int stack, cntr, i, ret;
+	unsigned n;
+
+	existing = calloc(1, sizeof(*existing));
+	if (!existing)
+		return -1;
+
+	ret = switchtec_evcntr_snapshot_setup(ctx->dev, existing);
+	if (ret < 0) {
+		free(existing);
+		return ret;
+	}
+
+	for (n = 0; n < existing->nr; n++)
+		used[existing->stack_id[n]][existing->cntr_id[n]] = 1;
+	free(existing);
+
+	for (stack = 0; stack < SWITCHTEC_MAX_STACKS; stack++) {
+		cntr = 0;
+		for (i = 0; i < ctx->nr_ports; i++) {
+			p = &ctx->ports[i];
+			if (p->id.stack != stack)
+				continue;
+
+			while (cntr < SWITCHTEC_MAX_EVENT_COUNTERS &&
+			       used[stack][cntr])
+				cntr++;
+			if (cntr >= SWITCHTEC_MAX_EVENT_COUNTERS) {
+				errno = ENOSPC;
+				return -1;
+			}
+
+			setup.port_mask = 1 << p->id.stk_id;
+			ret = switchtec_evcntr_setup(ctx->dev, stack, cntr,
+						     &setup);
+			if (ret)
+				return -1;
+
+			n = ctx->snap.nr++;
+			ctx->snap.stack_id[n] = stack;
+			ctx->snap.cntr_id[n] = cntr;
+			ctx->snap.port_mask[n] = setup.port_mask;
+			ctx->snap.type_mask[n] = setup.type_mask;
+			p->cntr = n;
+			cntr++;
+		}
+	}
+
+	return 0;
+}
+
+static void lnkerr_remove_counters(struct lnkerr_ctx *ctx)
+{
+	struct switchtec_evcntr_setup setup = {};
+	unsigned i;
+
+	for (i = 0; i < ctx->snap.nr; i++)
+		switchtec_evcntr_setup(ctx->dev, ctx->snap.stack_id[i],
+				       ctx->snap.cntr_id[i], &setup);
+}
+
+static int lnkerr_add_ports(struct lnkerr_ctx *ctx,
+			    struct switchtec_lnkerr_result *results,
+			    int max_results)
+{
+	struct switchtec_port_snapshot status[SWITCHTEC_MAX_PORTS];
+	const struct switchtec_lnkerr_burst *b;
+	struct lnkerr_port *p;
+	int nr_status, i, j, k;
+
+	nr_status = switchtec_status_snapshot(ctx->dev, status,
+					      ARRAY_SIZE(status));
+	if (nr_status < 0)
+		return nr_status;
+	if (nr_status > ARRAY_SIZE(status))
+		nr_status = ARRAY_SIZE(status);
+
+	for (i = 0; i < ctx->c->nr_bursts; i++) {
+		b = &ctx->c->bursts[i];
+
+		for (j = 0; j < ctx->nr_ports; j++)
+			if (ctx->ports[j].res->phys_port_id == b->phys_port_id)
+				break;
+
+		p = &ctx->ports[j];
+		ctx->bursts[i].b = b;
+		ctx->bursts[i].port = p;
+
+		if (j < ctx->nr_ports)
+			continue;
+
+		if (j >= max_results) {
+			errno = ENOSPC;
+			return -1;
+		}
+
+		for (k = 0; k < nr_status; k++)
+			if (status[k].port.phys_id == b->phys_port_id)
+				break;
+		if (k == nr_status) {
+			errno = EINVAL;
+			return -1;
+		}
+
+		memset(&results[j], 0, sizeof(results[j]));
+		p->res = &results[j];
+		p->res->phys_port_id = b->phys_port_id;
+		p->id = status[k].port;
+		p->cntr = -1;
+		p->first_start_us = UINT64_MAX;
+		ctx->ids[j] = b->phys_port_id;
+		ctx->nr_ports++;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Run a rate controlled link error injection campaign
+ * @param[in]  dev		Switchtec device handle
+ * @param[in]  c		Bursts to inject and how to sample
+ * @param[out] results		One entry per port named in the bursts, in
+ *				the order the ports first appear
+ * @param[in]  max_results	Number of entries in \p results
+ * @return The number of ports in \p results, or negative on failure
+ *
+ * The bursts run concurrently from one scheduling loop, so injections
+ * on many ports keep to their own rates. Every \p c->sample_ms the
+ * bandwidth counters of all the ports are read in one command, and the
+ * error counters the campaign sets up on free event counters in one
+ * batch. A port's baseline is its mean throughput over the samples
+ * before its first burst, so the first burst should start a few sample
+ * intervals in. Its recovery time runs from the end of its last burst
+ * to the first sample at or above the recovery fraction of the
+ * baseline; recovered stays 0 if that does not happen within
+ * \p c->settle_ms.
+ *
+ * Failed injections are counted but don't stop the campaign. Hardware
+ * rate injection is always disabled again and the event counters are
+ * released before returning. errno is ENOSPC if there are more ports
+ * than \p max_results or no free counter on a stack.
+ */
+int switchtec_lnkerr_campaign_run(struct switchtec_dev *dev,
+				  const struct switchtec_lnkerr_campaign *c,
+				  struct switchtec_lnkerr_result *results,
+				  int max_results)
+{
+	struct lnkerr_ctx *ctx;
+	struct lnkerr_burst *lb;
+	uint64_t now, end, wake, next_sample, t;
+	int i, ret = -1;
+
+	if (!c || !c->bursts || c->nr_bursts < 1 || !c->sample_ms ||
+	    !results || max_results < 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < c->nr_bursts; i++) {
+		if (!lnkerr_hw_rate(c->bursts[i].type) && !c->bursts[i].rate) {
+			errno = EINVAL;
+			return -1;
+		}
+	}
+
+	ctx = calloc(1, sizeof(*ctx));
+	if (!ctx)
+		return -1;
+
+	ctx->dev = dev;
+	ctx->c = c;
+	ctx->ports = calloc(c->nr_bursts, sizeof(*ctx->ports));
+	ctx->bursts = calloc(c->nr_bursts, sizeof(*ctx->bursts));
+	ctx->ids = calloc(c->nr_bursts, sizeof(*ctx->ids));
+	ctx->bw = calloc(c->nr_bursts, sizeof(*ctx->bw));
+	if (!ctx->ports || !ctx->bursts || !ctx->ids || !ctx->bw)
+		goto out_free;
+
+	ret = lnkerr_add_ports(ctx, results, max_results);
+	if (ret)
+		goto out_free;
+
+	if (c->evcntr_mask) {
+		ret = lnkerr_setup_counters(ctx);
+		if (ret)
+			goto out_counters;
+	}
+
+	/* Start the bandwidth and error counts of every port from zero */
+	ret = switchtec_bwcntr_many(dev, ctx->nr_ports, ctx->ids, 1, ctx->bw);
+	if (ret < 0)
+		goto out_counters;
+	ret = switchtec_evcntr_snapshot(dev, &ctx->snap, 1);
+	if (ret < 0)
+		goto out_counters;
+
+	ctx->t0 = platform_time_us();
+	ctx->last_sample_us = ctx->t0;
+	end = ctx->t0;
+
+	for (i = 0; i < c->nr_bursts; i++) {
+		lb = &ctx->bursts[i];
+		lb->start_us = ctx->t0 + lb->b->start_ms * 1000ULL;
+		lb->end_us = lb->start_us + lb->b->duration_ms * 1000ULL;
+		lb->next_us = lb->start_us;
+
+		if (lb->start_us < lb->port->first_start_us)
+			lb->port->first_start_us = lb->start_us;
+		if (lb->end_us > lb->port->last_end_us)
+			lb->port->last_end_us = lb->end_us;
+		if (lb->end_us > end)
+			end = lb->end_us;
+	}
+	end += c->settle_ms * 1000ULL;
+
+	next_sample = ctx->t0 + c->sample_ms * 1000ULL;
+	ret = 0;
+
+	while (1) {
+		now = platform_time_us();
+		wake = next_sample;
+
+		for (i = 0; i < c->nr_bursts; i++) {
+			t = lnkerr_burst_run(ctx, &ctx->bursts[i], now);
+			if (t < wake)
+				wake = t;
+		}
+
+		if (now >= next_sample) {
+			ret = lnkerr_sample(ctx);
+			if (ret)
+				break;
+
+			next_sample += c->sample_ms * 1000ULL;
+			if (next_sample <= now)
+				next_sample = now + c->sample_ms * 1000ULL;
+			if (now >= end)
+				break;
+			continue;
+		}
+
+		now = platform_time_us();
+		if (wake > now)
+			usleep(wake - now);
+	}
+
+	for (i = 0; i < ctx->nr_ports; i++) {
+		struct switchtec_lnkerr_result *res = ctx->ports[i].res;
+
+		if (!ctx->ports[i].sampled)
+			res->minimum = res->baseline;
+		if (res->baseline > 0 && res->minimum < res->baseline)
+			res->drop_pct = (res->baseline - res->minimum) * 100 /
+				res->baseline;
+	}
+
+out_counters:
+	for (i = 0; i < c->nr_bursts; i++)
+		if (ctx->bursts[i].enabled)
+			lnkerr_inject(dev, ctx->bursts[i].b, 0);
+	lnkerr_remove_counters(ctx);
+out_free:
+	if (ret >= 0)
+		ret = ctx->nr_ports;
+	free(ctx->ports);
+	free(ctx->bursts);
+	free(ctx->ids);
+	free(ctx->bw);
+	free(ctx);
+	return ret;
+}
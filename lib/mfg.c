@@ -50,6 +50,7 @@
 #include "switchtec/endian.h"
 #include "switchtec/mrpc.h"
 #include "switchtec/errors.h"
+#include "switchtec/utils.h"
 #include <unistd.h>
 
 #include <errno.h>
@@ -1148,11 +1149,16 @@ int switchtec_dbg_unlock_version_update(struct switchtec_dev *dev,
 	return switchtec_mfg_cmd(dev, cmd_id, &cmd, sizeof(cmd), NULL, 0);
 }
 
-static int check_sec_cfg_header(struct switchtec_dev *dev,
-				FILE *setting_file)
+#define SEC_CFG_DATA_MAX	64
+
+/*
+ * Check the header and CRC of a security setting file and read the
+ * settings that follow it into data.
+ */
+static int sec_cfg_file_load(FILE *setting_file, enum switchtec_gen *gen,
+			     uint8_t *data, size_t *len)
 {
 	ssize_t rlen;
-	enum switchtec_gen gen;
 	char magic[4] = {'S', 'S', 'F', 'F'};
 	uint32_t crc;
 	struct setting_file_header {
@@ -1162,8 +1168,7 @@ static int check_sec_cfg_header(struct switchtec_dev *dev,
 		uint8_t rsvd[3];
 		uint32_t crc;
 	} hdr;
-	int data_len;
-	uint8_t data[64];
+	long data_len;
 
 	rlen = fread(&hdr, sizeof(hdr), 1, setting_file);
 
@@ -1175,22 +1180,22 @@ static int check_sec_cfg_header(struct switchtec_dev *dev,
 
 	switch (hdr.hw_gen) {
 	case 0:
-		gen = SWITCHTEC_GEN4;
+		*gen = SWITCHTEC_GEN4;
 		break;
 	case 1:
-		gen = SWITCHTEC_GEN5;
+		*gen = SWITCHTEC_GEN5;
 		break;
 	default:
 		return -EBADF;
 	}
 
-	if (gen != switchtec_gen(dev))
-		return -ENODEV;
-
 	fseek(setting_file, 0, SEEK_END);
-	data_len = ftell(setting_file) - sizeof(hdr);
+	data_len = ftell(setting_file) - (long)sizeof(hdr);
 	fseek(setting_file, sizeof(hdr), SEEK_SET);
 
+	if (data_len < 0 || data_len > SEC_CFG_DATA_MAX)
+		return -EBADF;
+
 	rlen = fread(data, 1, data_len, setting_file);
 	if (rlen < data_len)
 		return -EBADF;
@@ -1199,37 +1204,28 @@ static int check_sec_cfg_header(struct switchtec_dev *dev,
 	if (crc != le32toh(hdr.crc))
 		return -EBADF;
 
-	fseek(setting_file, sizeof(hdr), SEEK_SET);
+	*len = data_len;
 	return 0;
 }
 
-static int read_sec_cfg_file(struct switchtec_dev *dev,
-			     FILE *setting_file,
-			     struct switchtec_security_cfg_set *set)
+static int decode_sec_cfg(const uint8_t *buf, size_t len, int clk_high,
+			  struct switchtec_security_cfg_set *set)
 {
 	struct setting_file_data {
 		uint64_t cfg;
 		uint32_t pub_key_exponent;
 		uint8_t rsvd[36];
 	} data;
-	struct get_cfgs_reply reply;
 	uint32_t addr_shift;
 	uint32_t map_shift;
 	uint32_t map_mask;
 	int spi_clk;
-	int ret;
-	int otp_valid;
-
-	ret = get_configs(dev, &reply, &otp_valid);
-	if (ret)
-		return ret;
 
 	memset(set, 0, sizeof(struct switchtec_security_cfg_set));
 
-	ret = fread(&data, sizeof(data), 1, setting_file);
-
-	if (ret != 1)
+	if (len < sizeof(data))
 		return -EBADF;
+	memcpy(&data, buf, sizeof(data));
 
 	data.cfg = le64toh(data.cfg);
 
@@ -1251,7 +1247,7 @@ static int read_sec_cfg_file(struct switchtec_dev *dev,
 	if (spi_clk > 10)
 		return -EINVAL;
 
-	if (reply.spi_core_clk_high)
+	if (clk_high)
 		set->spi_clk_rate = spi_clk_hi_rate_float[spi_clk - 1];
 	else
 		set->spi_clk_rate = spi_clk_rate_float[spi_clk - 1];
@@ -1263,7 +1259,7 @@ static int read_sec_cfg_file(struct switchtec_dev *dev,
 		(data.cfg >> SWITCHTEC_I2C_PORT_BITSHIFT) &
 		SWITCHTEC_I2C_PORT_BITMASK;
 
-	get_i2c_operands(switchtec_gen(dev), &addr_shift, &map_shift,
+	get_i2c_operands(SWITCHTEC_GEN4, &addr_shift, &map_shift,
 			 &map_mask);
 	set->i2c_addr =
 		(data.cfg >> addr_shift) &
@@ -1278,9 +1274,8 @@ static int read_sec_cfg_file(struct switchtec_dev *dev,
 	return 0;
 }
 
-static int read_sec_cfg_file_gen5(struct switchtec_dev *dev,
-				  FILE *setting_file,
-				  struct switchtec_security_cfg_set *set)
+static int decode_sec_cfg_gen5(const uint8_t *buf, size_t len, int clk_high,
+			       struct switchtec_security_cfg_set *set)
 {
 	struct setting_data {
 		uint64_t cfg;
@@ -1288,24 +1283,17 @@ static int read_sec_cfg_file_gen5(struct switchtec_dev *dev,
 		uint8_t rsvd[4];
 		uint32_t cdi_efuse_inc_mask;
 	} data;
-	struct get_cfgs_reply_gen5 reply;
 	uint32_t addr_shift;
 	uint32_t map_shift;
 	uint32_t map_mask;
 	int spi_clk;
-	int ret;
 	int attest_mode;
 
-	ret = get_configs_gen5(dev, &reply);
-	if (ret)
-		return ret;
-
 	memset(set, 0, sizeof(struct switchtec_security_cfg_set));
 
-	ret = fread(&data, sizeof(data), 1, setting_file);
-
-	if (ret != 1)
+	if (len < sizeof(data))
 		return -EBADF;
+	memcpy(&data, buf, sizeof(data));
 
 	data.cfg = le64toh(data.cfg);
 
@@ -1327,7 +1315,7 @@ static int read_sec_cfg_file_gen5(struct switchtec_dev *dev,
 	if (spi_clk > 10)
 		return -EINVAL;
 
-	if (reply.spi_core_clk_high)
+	if (clk_high)
 		set->spi_clk_rate = spi_clk_hi_rate_float[spi_clk - 1];
 	else
 		set->spi_clk_rate = spi_clk_rate_float[spi_clk - 1];
@@ -1339,7 +1327,7 @@ static int read_sec_cfg_file_gen5(struct switchtec_dev *dev,
 		(data.cfg >> SWITCHTEC_I2C_PORT_BITSHIFT) &
 		SWITCHTEC_I2C_PORT_BITMASK;
 
-	get_i2c_operands(switchtec_gen(dev), &addr_shift, &map_shift,
+	get_i2c_operands(SWITCHTEC_GEN5, &addr_shift, &map_shift,
 			 &map_mask);
 	set->i2c_addr =
 		(data.cfg >> addr_shift) &
@@ -1363,6 +1351,33 @@ static int read_sec_cfg_file_gen5(struct switchtec_dev *dev,
 	return 0;
 }
 
+/*
+ * Decode settings read by sec_cfg_file_load(). The SPI clock rate
+ * depends on the core clock of the device, so that is queried here.
+ */
+static int read_sec_cfg_data(struct switchtec_dev *dev, const uint8_t *buf,
+			     size_t len, struct switchtec_security_cfg_set *set)
+{
+	struct get_cfgs_reply_gen5 reply_gen5;
+	struct get_cfgs_reply reply;
+	int otp_valid;
+	int ret;
+
+	if (switchtec_is_gen4(dev)) {
+		ret = get_configs(dev, &reply, &otp_valid);
+		if (ret)
+			return ret;
+
+		return decode_sec_cfg(buf, len, reply.spi_core_clk_high, set);
+	}
+
+	ret = get_configs_gen5(dev, &reply_gen5);
+	if (ret)
+		return ret;
+
+	return decode_sec_cfg_gen5(buf, len, reply_gen5.spi_core_clk_high, set);
+}
+
 /**
  * @brief Read security settings from config file
  * @param[in]  dev		Switchtec device handle
@@ -1374,16 +1389,19 @@ int switchtec_read_sec_cfg_file(struct switchtec_dev *dev,
 				FILE *setting_file,
 				struct switchtec_security_cfg_set *set)
 {
+	uint8_t data[SEC_CFG_DATA_MAX];
+	enum switchtec_gen gen;
+	size_t len;
 	int ret;
 
-	ret = check_sec_cfg_header(dev, setting_file);
+	ret = sec_cfg_file_load(setting_file, &gen, data, &len);
 	if (ret)
 		return ret;
 
-	if (switchtec_is_gen4(dev))
-		return read_sec_cfg_file(dev, setting_file, set);
-	else
-		return read_sec_cfg_file_gen5(dev, setting_file, set);
+	if (gen != switchtec_gen(dev))
+		return -ENODEV;
+
+	return read_sec_cfg_data(dev, data, len, set);
 }
 
 static int kmsk_set_send_pubkey(struct switchtec_dev *dev,
@@ -1616,6 +1634,490 @@ switchtec_security_state_has_kmsk(struct switchtec_security_cfg_state *state,
 	return 0;
 }
 
+/**
+ * @brief A provisioning plan shared by every unit of switchtec_prov_run()
+ *
+ * The files are parsed and checked once when the plan is built so
+ * each unit only has to send the commands.
+ */
+struct switchtec_prov {
+	int has_sec_cfg;
+	enum switchtec_gen sec_cfg_gen;
+	uint8_t sec_cfg[SEC_CFG_DATA_MAX];
+	size_t sec_cfg_len;
+	int has_uds;
+	struct switchtec_uds uds;
+
+	int has_kmsk;
+	struct switchtec_kmsk kmsk;
+	int has_pubk;
+	struct switchtec_pubkey pubk;
+	int has_sig;
+	struct switchtec_signature sig;
+
+	int has_index;
+	struct switchtec_active_index index;
+
+	int has_fw_exec;
+	enum switchtec_bl2_recovery_mode recovery_mode;
+};
+
+/**
+ * @brief Allocate an empty provisioning plan
+ * @return The plan, or NULL with errno set on failure
+ *
+ * Add steps with switchtec_prov_set_sec_cfg(), switchtec_prov_set_kmsk(),
+ * switchtec_prov_set_active_index() and switchtec_prov_set_fw_exec().
+ * Each unit runs the steps that were added, in that order.
+ */
+struct switchtec_prov *switchtec_prov_new(void)
+{
+	return calloc(1, sizeof(struct switchtec_prov));
+}
+
+/**
+ * @brief Free a provisioning plan
+ * @param[in] prov Plan from switchtec_prov_new()
+ */
+void switchtec_prov_free(struct switchtec_prov *prov)
+{
+	free(prov);
+}
+
+/**
+ * @brief Program security settings on each unit
+ * @param[in]  prov		Provisioning plan
+ * @param[in]  setting_file	Security setting file
+ * @param[in]  uds_file		UDS file, or NULL
+ * @param[out] set		Settings as they will be programmed, or
+ *				NULL. The SPI clock rate assumes the core
+ *				clock is not high; units are decoded again.
+ * @return 0 on success, error code on failure:
+ *	-EBADF if a file is invalid, -EINVAL if the SPI clock rate is
+ *	invalid and -ENOENT if the settings need a UDS but none was given
+ *
+ * A UDS is only programmed when the settings enable DICE attestation
+ * without a self-generated UDS; otherwise \p uds_file is ignored.
+ */
+int switchtec_prov_set_sec_cfg(struct switchtec_prov *prov,
+			       FILE *setting_file, FILE *uds_file,
+			       struct switchtec_security_cfg_set *set)
+{
+	struct switchtec_security_cfg_set tmp;
+	int ret;
+
+	if (!set)
+		set = &tmp;
+
+	prov->has_sec_cfg = 0;
+	prov->has_uds = 0;
+
+	ret = sec_cfg_file_load(setting_file, &prov->sec_cfg_gen,
+				prov->sec_cfg, &prov->sec_cfg_len);
+	if (ret)
+		return ret;
+
+	if (prov->sec_cfg_gen == SWITCHTEC_GEN4)
+		ret = decode_sec_cfg(prov->sec_cfg, prov->sec_cfg_len, 0, set);
+	else
+		ret = decode_sec_cfg_gen5(prov->sec_cfg, prov->sec_cfg_len,
+					  0, set);
+	if (ret)
+		return ret;
+
+	if (set->attn_set.attestation_mode == SWITCHTEC_ATTESTATION_MODE_DICE &&
+	    !set->attn_set.uds_selfgen) {
+		if (!uds_file)
+			return -ENOENT;
+
+		ret = switchtec_read_uds_file(uds_file, &prov->uds);
+		if (ret)
+			return ret;
+
+		memcpy(set->attn_set.uds_data, prov->uds.uds,
+		       SWITCHTEC_UDS_LEN);
+		set->attn_set.uds_valid = true;
+		prov->has_uds = 1;
+	}
+
+	prov->has_sec_cfg = 1;
+	return 0;
+}
+
+/**
+ * @brief Add a KMSK entry to each unit
+ * @param[in] prov	Provisioning plan
+ * @param[in] kmsk_file	KMSK entry file
+ * @param[in] pubk_file	Public key file, or NULL
+ * @param[in] sig_file	Signature file, or NULL
+ * @return 0 on success, error code on failure: -EBADF if a file is
+ *	invalid and -ENOTSUP for a public key without OpenSSL support
+ *
+ * The public key and signature are only needed for units whose secure
+ * state is INITIALIZED_SECURED; units already holding the entry are
+ * left alone.
+ */
+int switchtec_prov_set_kmsk(struct switchtec_prov *prov, FILE *kmsk_file,
+			    FILE *pubk_file, FILE *sig_file)
+{
+	int ret;
+
+	prov->has_kmsk = 0;
+	prov->has_pubk = 0;
+	prov->has_sig = 0;
+
+	ret = switchtec_read_kmsk_file(kmsk_file, &prov->kmsk);
+	if (ret)
+		return ret;
+
+	if (pubk_file) {
+#if HAVE_LIBCRYPTO
+		if (switchtec_read_pubk_file(pubk_file, &prov->pubk))
+			return -EBADF;
+		prov->has_pubk = 1;
+#else
+		return -ENOTSUP;
+#endif
+	}
+
+	if (sig_file) {
+		ret = switchtec_read_signature_file(sig_file, &prov->sig);
+		if (ret)
+			return ret;
+		prov->has_sig = 1;
+	}
+
+	prov->has_kmsk = 1;
+	return 0;
+}
+
+/**
+ * @brief Select the active images on each unit (BL1 only)
+ * @param[in] prov	Provisioning plan
+ * @param[in] index	Active indices; entries not to be changed are
+ *			SWITCHTEC_ACTIVE_INDEX_NOT_SET
+ * @return 0 on success, or -EINVAL if an index is out of range
+ */
+int switchtec_prov_set_active_index(struct switchtec_prov *prov,
+				    struct switchtec_active_index *index)
+{
+	enum switchtec_active_index_id ids[] = {
+		index->bl2, index->firmware, index->config, index->keyman,
+		index->riot,
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ids); i++)
+		if (ids[i] > SWITCHTEC_ACTIVE_INDEX_1 &&
+		    ids[i] != SWITCHTEC_ACTIVE_INDEX_NOT_SET)
+			return -EINVAL;
+
+	prov->index = *index;
+	prov->has_index = 1;
+	return 0;
+}
+
+/**
+ * @brief Execute the transferred image on each unit (BL1 only)
+ * @param[in] prov		Provisioning plan
+ * @param[in] recovery_mode	BL2 recovery mode
+ *
+ * This is always the last step of a unit.
+ */
+void switchtec_prov_set_fw_exec(struct switchtec_prov *prov,
+				enum switchtec_bl2_recovery_mode recovery_mode)
+{
+	prov->recovery_mode = recovery_mode;
+	prov->has_fw_exec = 1;
+}
+
+struct prov_ctx {
+	const struct switchtec_prov *prov;
+	struct switchtec_prov_result *results;
+	int count;
+	int next;
+	switchtec_prov_fn cb;
+	void *data;
+	pthread_mutex_t lock;
+};
+
+static void prov_report(struct prov_ctx *ctx, struct switchtec_prov_result *res)
+{
+	if (!ctx->cb)
+		return;
+
+	pthread_mutex_lock(&ctx->lock);
+	ctx->cb(res, ctx->data);
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+static void prov_step(struct prov_ctx *ctx, struct switchtec_prov_result *res,
+		      enum switchtec_prov_step step)
+{
+	res->step = step;
+	prov_report(ctx, res);
+}
+
+static int prov_check_failed(struct switchtec_prov_result *res,
+			     const char *msg)
+{
+	res->msg = msg;
+	res->ret = -1;
+	res->err = EPERM;
+	return -1;
+}
+
+/* Refuse units the single-device mfg commands would also refuse */
+static int prov_check(const struct switchtec_prov *prov,
+		      struct switchtec_dev *dev,
+		      struct switchtec_security_cfg_state *state,
+		      struct switchtec_prov_result *res)
+{
+	struct switchtec_sn_ver_info sn;
+	enum switchtec_boot_phase phase;
+	int ret;
+
+	phase = switchtec_boot_phase(dev);
+	if ((prov->has_index || prov->has_fw_exec) &&
+	    phase != SWITCHTEC_BOOT_PHASE_BL1)
+		return prov_check_failed(res,
+			"image select and firmware execute need the BL1 phase");
+
+	if ((prov->has_sec_cfg || prov->has_kmsk) &&
+	    phase == SWITCHTEC_BOOT_PHASE_BL2)
+		return prov_check_failed(res,
+			"security settings cannot be changed in the BL2 phase");
+
+	if (prov->has_sec_cfg && switchtec_gen(dev) != prov->sec_cfg_gen)
+		return prov_check_failed(res,
+			"the security setting file is for a different generation");
+
+	if (prov->has_index && switchtec_is_gen4(dev) &&
+	    prov->index.riot != SWITCHTEC_ACTIVE_INDEX_NOT_SET)
+		return prov_check_failed(res,
+			"RIOT image is not available on Gen4 devices");
+
+	if (!switchtec_sn_ver_get(dev, &sn))
+		res->chip_serial = sn.chip_serial;
+
+	if (!prov->has_sec_cfg && !prov->has_kmsk)
+		return 0;
+
+	ret = switchtec_security_config_get(dev, state);
+	if (ret) {
+		res->ret = ret;
+		res->err = errno;
+		return ret;
+	}
+
+	if (prov->has_sec_cfg &&
+	    state->secure_state != SWITCHTEC_UNINITIALIZED_UNSECURED)
+		return prov_check_failed(res,
+			"secure state is not UNINITIALIZED_UNSECURED");
+
+	if (prov->has_kmsk &&
+	    state->secure_state == SWITCHTEC_INITIALIZED_UNSECURED)
+		return prov_check_failed(res,
+			"KMSK entries cannot be added in the INITIALIZED_UNSECURED state");
+
+	if (prov->has_kmsk &&
+	    state->secure_state == SWITCHTEC_INITIALIZED_SECURED &&
+	    !(prov->has_pubk && prov->has_sig))
+		return prov_check_failed(res,
+			"a public key and signature are needed in the INITIALIZED_SECURED state");
+
+	return 0;
+}
+
+static int prov_unit_steps(struct prov_ctx *ctx, struct switchtec_dev *dev,
+			   struct switchtec_prov_result *res)
+{
+	const struct switchtec_prov *prov = ctx->prov;
+	struct switchtec_security_cfg_state state = {};
+	struct switchtec_security_cfg_set set;
+	struct switchtec_active_index index;
+	struct switchtec_signature sig;
+	struct switchtec_pubkey pubk;
+	struct switchtec_kmsk kmsk;
+	int secured;
+	int ret;
+
+	prov_step(ctx, res, SWITCHTEC_PROV_STEP_CHECK);
+	ret = prov_check(prov, dev, &state, res);
+	if (ret)
+		return ret;
+
+	if (prov->has_sec_cfg) {
+		prov_step(ctx, res, SWITCHTEC_PROV_STEP_CONFIG);
+		ret = read_sec_cfg_data(dev, prov->sec_cfg,
+					prov->sec_cfg_len, &set);
+		if (!ret && prov->has_uds) {
+			memcpy(set.attn_set.uds_data, prov->uds.uds,
+			       SWITCHTEC_UDS_LEN);
+			set.attn_set.uds_valid = true;
+		}
+		if (!ret)
+			ret = switchtec_security_config_set(dev, &set);
+		if (ret)
+			goto out_err;
+	}
+
+	if (prov->has_kmsk) {
+		prov_step(ctx, res, SWITCHTEC_PROV_STEP_KMSK);
+		secured = state.secure_state == SWITCHTEC_INITIALIZED_SECURED;
+		kmsk = prov->kmsk;
+		pubk = prov->pubk;
+		sig = prov->sig;
+
+		if (switchtec_security_state_has_kmsk(&state, &kmsk)) {
+			res->kmsk_present = 1;
+		} else {
+			ret = switchtec_kmsk_set(dev, secured ? &pubk : NULL,
+						 secured ? &sig : NULL, &kmsk);
+			if (ret)
+				goto out_err;
+		}
+	}
+
+	if (prov->has_index) {
+		prov_step(ctx, res, SWITCHTEC_PROV_STEP_INDEX);
+		index = prov->index;
+		ret = switchtec_active_image_index_set(dev, &index);
+		if (ret)
+			goto out_err;
+	}
+
+	if (prov->has_fw_exec) {
+		prov_step(ctx, res, SWITCHTEC_PROV_STEP_FW_EXEC);
+		ret = switchtec_fw_exec(dev, prov->recovery_mode);
+		if (ret)
+			goto out_err;
+	}
+
+	return 0;
+
+out_err:
+	res->ret = ret;
+	res->err = errno;
+	return ret;
+}
+
+static void *prov_worker(void *arg)
+{
+	struct prov_ctx *ctx = arg;
+	struct switchtec_prov_result *res;
+	struct switchtec_dev *dev;
+	uint64_t start;
+	int i;
+
+	while (1) {
+		pthread_mutex_lock(&ctx->lock);
+		i = ctx->next++;
+		pthread_mutex_unlock(&ctx->lock);
+
+		if (i >= ctx->count)
+			break;
+
+		res = &ctx->results[i];
+		start = platform_time_us();
+
+		prov_step(ctx, res, SWITCHTEC_PROV_STEP_OPEN);
+		dev = switchtec_open(res->device);
+		if (!dev) {
+			res->ret = -1;
+			res->err = errno;
+		} else {
+			if (!prov_unit_steps(ctx, dev, res))
+				res->step = SWITCHTEC_PROV_STEP_DONE;
+			switchtec_close(dev);
+		}
+
+		res->elapsed_us = platform_time_us() - start;
+		res->finished = 1;
+		prov_report(ctx, res);
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Provision several units concurrently
+ * @param[in]  prov	Provisioning plan
+ * @param[in]  devices	Array of device strings, as accepted by
+ *			switchtec_open()
+ * @param[in]  count	Number of entries in \p devices
+ * @param[in]  jobs	Number of units to provision at once
+ * @param[out] results	Array of \p count results, one per device
+ * @param[in]  cb	Called on every step of every unit, or NULL
+ * @param[in]  data	Passed to \p cb
+ * @return The number of units that failed, or -1 on error
+ *
+ * Each unit is opened on a worker thread and steps through its own
+ * state machine: it is checked, then the security settings, the KMSK
+ * entry, the active image indices and firmware execute are applied in
+ * that order, skipping steps that did not go into the plan. A failure
+ * stops that unit only; its result records the step and the error.
+ *
+ * Calls to \p cb are serialized, so it may write a log without locking.
+ * It must not keep the result pointer after returning.
+ */
+int switchtec_prov_run(const struct switchtec_prov *prov,
+		       const char * const *devices, int count, int jobs,
+		       struct switchtec_prov_result *results,
+		       switchtec_prov_fn cb, void *data)
+{
+	struct prov_ctx ctx = {
+		.prov = prov,
+		.results = results,
+		.count = count,
+		.cb = cb,
+		.data = data,
+	};
+	pthread_t *threads;
+	int started = 0;
+	int i, failed = 0;
+
+	if (count < 0 || jobs < 1 || (count && (!devices || !results))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < count; i++) {
+		memset(&results[i], 0, sizeof(results[i]));
+		results[i].device = devices[i];
+	}
+
+	/* The calling thread works through the list as well */
+	if (jobs > count)
+		jobs = count;
+
+	threads = calloc(jobs ? jobs : 1, sizeof(*threads));
+	if (!threads)
+		return -1;
+
+	pthread_mutex_init(&ctx.lock, NULL);
+
+	for (i = 0; i < jobs - 1; i++) {
+		if (pthread_create(&threads[i], NULL, prov_worker, &ctx))
+			break;
+		started++;
+	}
+
+	prov_worker(&ctx);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&ctx.lock);
+	free(threads);
+
+	for (i = 0; i < count; i++)
+		if (results[i].ret)
+			failed++;
+
+	return failed;
+}
+
 #endif /* __linux__ */
 
 static int switchtec_mfg_cmd(struct switchtec_dev *dev, uint32_t cmd,
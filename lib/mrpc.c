@@ -25,26 +25,30 @@
 #include "switchtec_priv.h"
 #include "switchtec/mrpc.h"
 
+#include <errno.h>
+#include <string.h>
+
 #define M(k, d) [MRPC_ ## k] = {#k, d}
 #define R(k, d) [MRPC_ ## k] = {#k, d, .reserved = true}
+#define S(k, d, us) [MRPC_ ## k] = {#k, d, .poll_delay_us = us}
 
 const struct switchtec_mrpc switchtec_mrpc_table[MRPC_MAX_ID] = {
 	M(TWI,				"TWI Access"),
 	M(VGPIO,			"GPIO"),
 	M(PWM,				"Pulse Width Modulator"),
 	M(DIETEMP,			"Die Temperature"),
-	M(FWDNLD,			"Firmware Download"),
+	S(FWDNLD,			"Firmware Download", 1000),
 	M(FWLOGRD,			"Firmware Log Retrieval"),
 	M(PMON,				"Performance Monitor"),
 	M(PORTARB,			"Port Arbitration Set"),
 	M(MCOVRLY,			"MC Overlay Setting"),
-	M(STACKBIF,			"Dynamic Port Bifurcation"),
+	S(STACKBIF,			"Dynamic Port Bifurcation", 2000),
 	M(PORTPARTP2P,			"Port Partition P2P Binding"),
 	M(DIAG_TLP_INJECT,		"TLP Injection"),
 	R(RESERVED1,			"Internal MRPC"),
-	M(DIAG_PORT_EYE,		"2D Eye Capture"),
+	S(DIAG_PORT_EYE,		"2D Eye Capture", 2000),
 	M(DIAG_POT_VHIST,		"Real Time Eye Capture"),
-	M(DIAG_PORT_LTSSM_LOG,		"LTSSM Monitor"),
+	S(DIAG_PORT_LTSSM_LOG,		"LTSSM Monitor", 1000),
 	M(DIAG_PORT_TLP_ANL,		"PCIe Analyzer"),
 	M(DIAG_PORT_LN_ADPT,		"Port Adaptation Objects"),
 	M(SRDS_PCIE_PEAK,		"Receiver Peaking Control"),
@@ -54,10 +58,10 @@ const struct switchtec_mrpc switchtec_mrpc_table[MRPC_MAX_ID] = {
 	M(TCH,				"Tachometer"),
 	M(ARB,				"Port Arbitration"),
 	M(SMBUS,			"SMBus"),
-	M(RESET,			"Reset"),
+	S(RESET,			"Reset", 5000),
 	M(LNKSTAT,			"Link Status Retrieve"),
 	M(MULTI_CFG,			"Multi-Configuration"),
-	M(RD_FLASH,			"Read Flash"),
+	S(RD_FLASH,			"Read Flash", 1000),
 	M(SPI_ECC,			"SPI Single Bit ECC"),
 	M(PAT_GEN,			"Pattern Generator and Monitor"),
 	M(INT_LOOPBACK,			"Internal Loopback"),
@@ -87,24 +91,24 @@ const struct switchtec_mrpc switchtec_mrpc_table[MRPC_MAX_ID] = {
 	M(SECURITY_CONFIG_GET_EXT,	"Secure Configuration Get Extended"),
 	M(ECHO,				"Echo"),
 	M(GET_PAX_ID,			"Local Fabric Switch Index"),
-	M(TOPO_INFO_DUMP,		"Fabric Switch Topology Info"),
-	M(GFMS_DB_DUMP,			"GFMS Database Info"),
-	M(GFMS_BIND_UNBIND,		"Bind/Unbind EP Function"),
+	S(TOPO_INFO_DUMP,		"Fabric Switch Topology Info", 1000),
+	S(GFMS_DB_DUMP,			"GFMS Database Info", 2000),
+	S(GFMS_BIND_UNBIND,		"Bind/Unbind EP Function", 5000),
 	M(DEVICE_MANAGE_CMD,		"Send EP Management"),
 	M(PORT_CONFIG,			"Configure Fabric Physical Port"),
 	M(GFMS_EVENT,			"GFMS Event Data Registers"),
 	M(PORT_CONTROL,			"Port Link Control"),
 	M(EP_RESOURCE_ACCESS,		"Endpoint Device CSR and MS Raw Access"),
 	M(EP_TUNNEL_CFG,		"Endpoint Device Tunnel Configuration"),
-	M(NVME_ADMIN_PASSTHRU,		"NVMe Admin Passthrough"),
+	S(NVME_ADMIN_PASSTHRU,		"NVMe Admin Passthrough", 2000),
 	M(I2C_TWI_PING,			"I2C/TWI Ping"),
 	M(SECURITY_CONFIG_GET,		"Secure Configuration Get"),
-	M(SECURITY_CONFIG_SET,		"Secure Configuration Set"),
-	M(KMSK_ENTRY_SET,		"Public Key Entry Hash Key Set"),
+	S(SECURITY_CONFIG_SET,		"Secure Configuration Set", 5000),
+	S(KMSK_ENTRY_SET,		"Public Key Entry Hash Key Set", 5000),
 	M(SECURE_STATE_SET,		"Secure State Set"),
 	M(ACT_IMG_IDX_GET,		"Firmware Active Image Index Get"),
 	M(ACT_IMG_IDX_SET,		"Firmware Active Image Index Select"),
-	M(FW_TX,			"Image Transfer and Execution"),
+	S(FW_TX,			"Image Transfer and Execution", 2000),
 	M(MAILBOX_GET,			"Mailbox Log Get"),
 	M(SN_VER_GET,			"Chip Serial Number and Secure Versions"),
 	M(DBG_UNLOCK,			"Resource Unlock"),
@@ -112,3 +116,135 @@ const struct switchtec_mrpc switchtec_mrpc_table[MRPC_MAX_ID] = {
 	M(SECURITY_CONFIG_GET_GEN5,	"Secure Configuration Get (Gen5)"),
 	M(SECURITY_CONFIG_SET_GEN5,	"Secure Configuration Set (Gen5)"),
 };
+
+/**
+ * @brief Get the short name of an MRPC command
+ * @ingroup Device
+ * @param[in] mrpc_id	MRPC command ID
+ * @return The name (e.g. "LNKSTAT") or NULL if the ID is unknown
+ */
+const char *switchtec_mrpc_name(int mrpc_id)
+{
+	if (mrpc_id < 0 || mrpc_id >= MRPC_MAX_ID)
+		return NULL;
+
+	return switchtec_mrpc_table[mrpc_id].tag;
+}
+
+static int stats_bucket(uint64_t us)
+{
+	int bucket = 0;
+
+	while (us && bucket < SWITCHTEC_MRPC_STATS_BUCKETS - 1) {
+		us >>= 1;
+		bucket++;
+	}
+
+	return bucket;
+}
+
+void mrpc_stats_record(struct switchtec_dev *dev, uint32_t cmd,
+		       size_t payload_len, size_t resp_len,
+		       uint64_t elapsed_us, int ret)
+{
+	struct switchtec_mrpc_stats *st;
+
+	cmd &= SWITCHTEC_CMD_MASK;
+	if (!dev->mrpc_stats || cmd >= MRPC_MAX_ID)
+		return;
+
+	st = &dev->mrpc_stats[cmd];
+
+	if (!st->count || elapsed_us < st->min_us)
+		st->min_us = elapsed_us;
+	if (elapsed_us > st->max_us)
+		st->max_us = elapsed_us;
+
+	st->count++;
+	if (ret)
+		st->errors++;
+	st->payload_bytes += payload_len;
+	st->resp_bytes += resp_len;
+	st->total_us += elapsed_us;
+	st->wait_us += dev->mrpc_wait_us;
+	st->hist[stats_bucket(elapsed_us)]++;
+}
+
+/**
+ * @brief Enable or disable MRPC instrumentation on a device handle
+ * @ingroup Device
+ * @param[in] dev	Switchtec device handle
+ * @param[in] enable	Non-zero to start recording, zero to stop and
+ *			discard the recorded statistics
+ * @return 0 on success, negative on failure
+ *
+ * Instrumentation can also be enabled for every handle by setting the
+ * SWITCHTEC_MRPC_STATS environment variable.
+ */
+int switchtec_mrpc_stats_enable(struct switchtec_dev *dev, int enable)
+{
+	int ret = 0;
+
+	platform_lock(dev);
+
+	if (!enable) {
+		free(dev->mrpc_stats);
+		dev->mrpc_stats = NULL;
+	} else if (!dev->mrpc_stats) {
+		dev->mrpc_stats = calloc(MRPC_MAX_ID,
+					 sizeof(*dev->mrpc_stats));
+		if (!dev->mrpc_stats)
+			ret = -errno;
+	}
+
+	platform_unlock(dev);
+
+	return ret;
+}
+
+/**
+ * @brief Get the recorded statistics for one MRPC command
+ * @ingroup Device
+ * @param[in]  dev	Switchtec device handle
+ * @param[in]  mrpc_id	MRPC command ID (see switchtec_mrpc_table)
+ * @param[out] stats	Statistics recorded since instrumentation was
+ *			enabled or last reset
+ * @return 0 on success, negative on failure
+ */
+int switchtec_mrpc_stats_get(struct switchtec_dev *dev, int mrpc_id,
+			     struct switchtec_mrpc_stats *stats)
+{
+	if (mrpc_id < 0 || mrpc_id >= MRPC_MAX_ID || !stats) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	platform_lock(dev);
+
+	if (!dev->mrpc_stats) {
+		platform_unlock(dev);
+		errno = ENODATA;
+		return -ENODATA;
+	}
+
+	*stats = dev->mrpc_stats[mrpc_id];
+
+	platform_unlock(dev);
+	return 0;
+}
+
+/**
+ * @brief Clear all the recorded MRPC statistics
+ * @ingroup Device
+ * @param[in] dev	Switchtec device handle
+ */
+void switchtec_mrpc_stats_reset(struct switchtec_dev *dev)
+{
+	platform_lock(dev);
+
+	if (dev->mrpc_stats)
+		memset(dev->mrpc_stats, 0,
+		       MRPC_MAX_ID * sizeof(*dev->mrpc_stats));
+
+	platform_unlock(dev);
+}
@@ -0,0 +1,432 @@
+/*
+ * Microsemi Switchtec(tm) PCIe Management Library
+ * Copyright (c) 2021, Microsemi Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * @file
+ * @brief Shadow copies of read-mostly GAS regions
+ *
+ * On the I2C, UART and Ethernet transports every GAS access is a bus
+ * transaction. The regions listed in gas_cache_regions are read once
+ * as a block and then served from memory until they expire or are
+ * invalidated by an event that may change them.
+ */
+
+#include "../switchtec_priv.h"
+#include "switchtec/switchtec.h"
+#include "switchtec/registers.h"
+#include "switchtec/utils.h"
+#include "switchtec/endian.h"
+#include "switchtec/mrpc.h"
+
+#include <errno.h>
+#include <stddef.h>
+#include <string.h>
+
+/* Writes update the shadow copy instead of discarding it */
+#define GAS_CACHE_WRITE_THROUGH (1 << 16)
+
+struct gas_cache_region {
+	size_t offset;
+	size_t len;
+	size_t stride;
+	int count;
+	int ttl_ms;	/* 0 means the copy only goes away on invalidation */
+	int flags;	/* enum switchtec_gas_cache_event and the above */
+};
+
+#define PART_CFG_IDS_OFFSET (offsetof(struct switchtec_gas, part_cfg) + \
+			     offsetof(struct part_cfg_regs, usp_pff_inst_id))
+#define PART_CFG_IDS_LEN (offsetof(struct part_cfg_regs, reserved1) - \
+			  offsetof(struct part_cfg_regs, usp_pff_inst_id))
+
+static const struct gas_cache_region gas_cache_regions[] = {
+	{
+		.offset = offsetof(struct switchtec_gas, sys_info),
+		.len = sizeof(struct sys_info_regs),
+		.count = 1,
+		.flags = SWITCHTEC_GAS_CACHE_INV_RESET,
+	}, {
+		.offset = offsetof(struct switchtec_gas, flash_info),
+		.len = sizeof(struct flash_info_regs),
+		.count = 1,
+		.ttl_ms = 5000,
+		.flags = SWITCHTEC_GAS_CACHE_INV_RESET |
+			 SWITCHTEC_GAS_CACHE_INV_FW,
+	}, {
+		.offset = PART_CFG_IDS_OFFSET,
+		.len = PART_CFG_IDS_LEN,
+		.stride = sizeof(struct part_cfg_regs),
+		.count = SWITCHTEC_MAX_PARTITIONS,
+		.ttl_ms = 1000,
+		.flags = SWITCHTEC_GAS_CACHE_INV_RESET |
+			 SWITCHTEC_GAS_CACHE_INV_BIND |
+			 GAS_CACHE_WRITE_THROUGH,
+	},
+};
+
+struct gas_cache_entry {
+	const struct gas_cache_region *region;
+	size_t offset;
+	bool valid;
+	uint64_t fill_us;
+	uint8_t *data;
+};
+
+struct gas_cache {
+	size_t lo, hi;
+	int nr_entries;
+	struct gas_cache_entry entries[];
+};
+
+static struct gas_cache *gas_cache_alloc(void)
+{
+	const struct gas_cache_region *r;
+	struct gas_cache *cache;
+	struct gas_cache_entry *e;
+	size_t data_len = 0;
+	uint8_t *data;
+	int nr = 0;
+	int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(gas_cache_regions); i++) {
+		nr += gas_cache_regions[i].count;
+		data_len += gas_cache_regions[i].count *
+			gas_cache_regions[i].len;
+	}
+
+	cache = calloc(1, sizeof(*cache) + nr * sizeof(*e) + data_len);
+	if (!cache)
+		return NULL;
+
+	cache->lo = SIZE_MAX;
+	data = (uint8_t *)&cache->entries[nr];
+	e = cache->entries;
+
+	for (i = 0; i < ARRAY_SIZE(gas_cache_regions); i++) {
+		r = &gas_cache_regions[i];
+		for (j = 0; j < r->count; j++, e++) {
+			e->region = r;
+			e->offset = r->offset + j * r->stride;
+			e->data = data;
+			data += r->len;
+
+			if (e->offset < cache->lo)
+				cache->lo = e->offset;
+			if (e->offset + r->len > cache->hi)
+				cache->hi = e->offset + r->len;
+		}
+	}
+
+	cache->nr_entries = nr;
+
+	return cache;
+}
+
+static size_t gas_offset(struct switchtec_dev *dev, const void __gas *addr)
+{
+	return addr - (const void __gas *)dev->gas_map;
+}
+
+/* Find the entry holding all of [off, off + n) */
+static struct gas_cache_entry *gas_cache_find(struct gas_cache *cache,
+					      size_t off, size_t n)
+{
+	struct gas_cache_entry *e;
+	int i;
+
+	if (off + n <= cache->lo || off >= cache->hi)
+		return NULL;
+
+	for (i = 0; i < cache->nr_entries; i++) {
+		e = &cache->entries[i];
+
+		if (off >= e->offset && off + n <= e->offset + e->region->len)
+			return e;
+	}
+
+	return NULL;
+}
+
+static void gas_cache_fill(struct switchtec_dev *dev,
+			   struct gas_cache_entry *e)
+{
+	uint64_t now = platform_time_us();
+	int ttl_ms = e->region->ttl_ms;
+
+	if (e->valid && (!ttl_ms || now - e->fill_us < ttl_ms * 1000ULL))
+		return;
+
+	platform_gas_op(dev, memcpy_from_gas)(dev, e->data,
+			(void __gas *)dev->gas_map + e->offset,
+			e->region->len);
+	e->valid = true;
+	e->fill_us = now;
+}
+
+/**
+ * @brief Copy a range out of the GAS shadow cache
+ * @param[in]  dev	Switchtec device handle
+ * @param[out] dest	Destination buffer
+ * @param[in]  src	GAS address to read from
+ * @param[in]  n	Number of bytes to copy
+ * @return 0 if the range was served from the cache, -1 if it must be
+ *	read from the device
+ */
+int gas_cache_memcpy_from(struct switchtec_dev *dev, void *dest,
+			  const void __gas *src, size_t n)
+{
+	struct gas_cache_entry *e;
+	size_t off = gas_offset(dev, src);
+	int ret = -1;
+
+	platform_lock(dev);
+
+	if (!dev->gas_cache)
+		goto out;
+
+	e = gas_cache_find(dev->gas_cache, off, n);
+	if (!e)
+		goto out;
+
+	gas_cache_fill(dev, e);
+	memcpy(dest, e->data + off - e->offset, n);
+	ret = 0;
+
+out:
+	platform_unlock(dev);
+	return ret;
+}
+
+/**
+ * @brief Read a single register from the GAS shadow cache
+ * @param[in]  dev	Switchtec device handle
+ * @param[in]  addr	GAS address of the register
+ * @param[in]  size	Register width in bytes (1, 2, 4 or 8)
+ * @param[out] val	Register value in host byte order
+ * @return 0 if the register was served from the cache, -1 if it must be
+ *	read from the device
+ */
+int gas_cache_read(struct switchtec_dev *dev, const void __gas *addr,
+		   size_t size, uint64_t *val)
+{
+	union {
+		uint8_t u8;
+		uint16_t u16;
+		uint32_t u32;
+		uint64_t u64;
+	} reg;
+
+	if (gas_cache_memcpy_from(dev, &reg, addr, size))
+		return -1;
+
+	switch (size) {
+	case 1: *val = reg.u8; break;
+	case 2: *val = le16toh(reg.u16); break;
+	case 4: *val = le32toh(reg.u32); break;
+	default: *val = le64toh(reg.u64); break;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Account for data written to the device in the GAS shadow cache
+ * @param[in] dev	Switchtec device handle
+ * @param[in] dest	GAS address that was written
+ * @param[in] src	Data that was written
+ * @param[in] n		Number of bytes written
+ *
+ * Write-through regions have their valid copies updated, all other
+ * overlapping entries are discarded.
+ */
+void gas_cache_memcpy_to(struct switchtec_dev *dev, void __gas *dest,
+			 const void *src, size_t n)
+{
+	struct gas_cache *cache;
+	struct gas_cache_entry *e;
+	size_t off = gas_offset(dev, dest);
+	size_t start, end;
+	int i;
+
+	platform_lock(dev);
+
+	cache = dev->gas_cache;
+	if (!cache || off + n <= cache->lo || off >= cache->hi)
+		goto out;
+
+	for (i = 0; i < cache->nr_entries; i++) {
+		e = &cache->entries[i];
+
+		start = off > e->offset ? off : e->offset;
+		end = off + n;
+		if (end > e->offset + e->region->len)
+			end = e->offset + e->region->len;
+		if (start >= end)
+			continue;
+
+		if (e->valid && e->region->flags & GAS_CACHE_WRITE_THROUGH)
+			memcpy(e->data + start - e->offset,
+			       (const uint8_t *)src + start - off,
+			       end - start);
+		else
+			e->valid = false;
+	}
+
+out:
+	platform_unlock(dev);
+}
+
+/**
+ * @brief Account for a register written to the device in the GAS
+ *	shadow cache
+ * @param[in] dev	Switchtec device handle
+ * @param[in] addr	GAS address of the register
+ * @param[in] size	Register width in bytes (1, 2, 4 or 8)
+ * @param[in] val	Value written, in host byte order
+ */
+void gas_cache_write(struct switchtec_dev *dev, void __gas *addr,
+		     size_t size, uint64_t val)
+{
+	union {
+		uint8_t u8;
+		uint16_t u16;
+		uint32_t u32;
+		uint64_t u64;
+	} reg;
+
+	switch (size) {
+	case 1: reg.u8 = val; break;
+	case 2: reg.u16 = htole16(val); break;
+	case 4: reg.u32 = htole32(val); break;
+	default: reg.u64 = htole64(val); break;
+	}
+
+	gas_cache_memcpy_to(dev, addr, &reg, size);
+}
+
+/**
+ * @brief Enable or disable the GAS shadow cache on a device handle
+ * @ingroup Device
+ * @param[in] dev	Switchtec device handle
+ * @param[in] enable	Non-zero to enable, zero to disable and drop all
+ *			cached data
+ * @return 0 on success, negative on failure
+ *
+ * When enabled, the system info, flash info and partition PFF instance
+ * ID registers are read from the device once and then served from
+ * memory. This saves a bus round trip per register on the I2C, UART
+ * and Ethernet transports. Cached data expires after a per-region time
+ * or when switchtec_gas_cache_invalidate() reports a relevant event;
+ * the library does the latter itself for resets, firmware updates and
+ * port binding done through this handle.
+ *
+ * The cache can also be enabled for every handle by setting the
+ * SWITCHTEC_GAS_CACHE environment variable.
+ */
+int switchtec_gas_cache_enable(struct switchtec_dev *dev, int enable)
+{
+	int ret = 0;
+
+	platform_lock(dev);
+
+	if (!enable) {
+		free(dev->gas_cache);
+		dev->gas_cache = NULL;
+	} else if (!dev->gas_cache) {
+		dev->gas_cache = gas_cache_alloc();
+		if (!dev->gas_cache)
+			ret = -errno;
+	}
+
+	platform_unlock(dev);
+
+	return ret;
+}
+
+/**
+ * @brief Discard cached GAS data affected by an event
+ * @ingroup Device
+ * @param[in] dev	Switchtec device handle
+ * @param[in] events	Mask of enum switchtec_gas_cache_event values
+ *
+ * This also drops the PFF to port table kept by the I2C, UART,
+ * Ethernet and Windows transports. Use this after something outside
+ * this handle (another host, a different interface) may have changed
+ * the device.
+ */
+void switchtec_gas_cache_invalidate(struct switchtec_dev *dev, int events)
+{
+	struct gas_cache_entry *e;
+	int i;
+
+	platform_lock(dev);
+
+	for (i = 0; dev->gas_cache && i < dev->gas_cache->nr_entries; i++) {
+		e = &dev->gas_cache->entries[i];
+		if (e->region->flags & events)
+			e->valid = false;
+	}
+
+	/* Built by gasop_pff_to_port() and gasop_port_to_pff() */
+	if (events & (SWITCHTEC_GAS_CACHE_INV_RESET |
+		      SWITCHTEC_GAS_CACHE_INV_BIND)) {
+		free(dev->pff_map);
+		dev->pff_map = NULL;
+	}
+
+	platform_unlock(dev);
+}
+
+/**
+ * @brief Discard cached GAS data that an executed MRPC command may
+ *	have changed
+ * @param[in] dev	Switchtec device handle
+ * @param[in] cmd	Command ID (may include the PAX ID bits)
+ */
+void gas_cache_cmd_done(struct switchtec_dev *dev, uint32_t cmd)
+{
+	int events;
+
+	switch (cmd & SWITCHTEC_CMD_MASK) {
+	case MRPC_RESET:
+	case MRPC_FW_TX:
+	case MRPC_FW_TX_GEN5:
+		events = SWITCHTEC_GAS_CACHE_INV_ALL;
+		break;
+	case MRPC_FWDNLD:
+	case MRPC_ACT_IMG_IDX_SET:
+	case MRPC_ACT_IMG_IDX_SET_GEN5:
+		events = SWITCHTEC_GAS_CACHE_INV_FW;
+		break;
+	case MRPC_PORTPARTP2P:
+	case MRPC_GFMS_BIND_UNBIND:
+	case MRPC_STACKBIF:
+		events = SWITCHTEC_GAS_CACHE_INV_BIND;
+		break;
+	default:
+		return;
+	}
+
+	switchtec_gas_cache_invalidate(dev, events);
+}
@@ -26,6 +26,7 @@
 #include "switchtec/gas.h"
 #include "../switchtec_priv.h"
 #include "switchtec/utils.h"
+#include "switchtec/endian.h"
 
 #include <errno.h>
 #include <stddef.h>
@@ -108,45 +109,53 @@ void gasop_set_partition_info(struct switchtec_dev *dev)
 	dev->partition_count = gas_reg_read8(dev, top.partition_count);
 }
 
-int gasop_cmd(struct switchtec_dev *dev, uint32_t cmd,
-	      const void *payload, size_t payload_len, void *resp,
-	      size_t resp_len)
+static int gasop_wait_status(struct switchtec_dev *dev, int first_delay_us)
 {
+	const struct switchtec_mrpc_poll_policy *policy = &dev->mrpc_poll;
 	struct mrpc_regs __gas *mrpc = &dev->gas_map->mrpc;
+	uint64_t start = 0;
+	int delay, spins = 0;
 	int status;
-	int ret;
-	uint8_t subcmd = 0xff;
 
-	__memcpy_to_gas(dev, &mrpc->input_data, payload, payload_len);
+	if (dev->mrpc_stats)
+		start = platform_time_us();
 
-       /* Due to the possible unreliable nature of hardware
-        * communication, function __gas_write32() is implemented
-        * with automatic retry.
-        *
-        * This poses a potential issue when a command is critical
-        * and is expected to be sent only once (e.g., command that
-        * adds a KMSK entry to chip OTP memory). Retrying could
-        * cause the command be sent multiple times (and multiple
-        * KMSK entry being added, if unlucky).
-        *
-        * Here we filter out the specific commands and use 'no retry'
-        * version of gas_write32 for these commands.
-        */
-	if (payload)
-		subcmd = *(uint8_t*)payload;
-	if (gasop_is_no_retry_cmd(cmd, subcmd))
-		__gas_write32_no_retry(dev, cmd, &mrpc->cmd);
-	else
-		__gas_write32(dev, cmd, &mrpc->cmd);
+	if (first_delay_us)
+		usleep(first_delay_us);
 
-	while (1) {
-		usleep(5000);
+	delay = policy->initial_delay_us;
 
+	while (1) {
 		status = __gas_read32(dev, &mrpc->status);
 		if (status != SWITCHTEC_MRPC_STATUS_INPROGRESS)
 			break;
+
+		if (spins < policy->spin_count) {
+			spins++;
+			continue;
+		}
+
+		usleep(delay);
+
+		/* Clamp first so the multiply can't overflow */
+		if (delay > policy->max_delay_us / policy->backoff_factor)
+			delay = policy->max_delay_us;
+		else
+			delay *= policy->backoff_factor;
 	}
 
+	if (dev->mrpc_stats)
+		dev->mrpc_wait_us += platform_time_us() - start;
+
+	return status;
+}
+
+static int gasop_cmd_result(struct switchtec_dev *dev, int status,
+			    void *resp, size_t resp_len)
+{
+	struct mrpc_regs __gas *mrpc = &dev->gas_map->mrpc;
+	int ret;
+
 	if (status == SWITCHTEC_MRPC_STATUS_INTERRUPTED) {
 		errno = ENXIO;
 		return -errno;
@@ -172,6 +181,71 @@ int gasop_cmd(struct switchtec_dev *dev, uint32_t cmd,
 	return ret;
 }
 
+int gasop_cmd_submit(struct switchtec_dev *dev, uint32_t cmd,
+		     const void *payload, size_t payload_len,
+		     size_t resp_len)
+{
+	struct mrpc_regs __gas *mrpc = &dev->gas_map->mrpc;
+	uint8_t subcmd = 0xff;
+
+	__memcpy_to_gas(dev, &mrpc->input_data, payload, payload_len);
+
+       /* Due to the possible unreliable nature of hardware
+        * communication, function __gas_write32() is implemented
+        * with automatic retry.
+        *
+        * This poses a potential issue when a command is critical
+        * and is expected to be sent only once (e.g., command that
+        * adds a KMSK entry to chip OTP memory). Retrying could
+        * cause the command be sent multiple times (and multiple
+        * KMSK entry being added, if unlucky).
+        *
+        * Here we filter out the specific commands and use 'no retry'
+        * version of gas_write32 for these commands.
+        */
+	if (payload)
+		subcmd = *(uint8_t*)payload;
+	if (gasop_is_no_retry_cmd(cmd, subcmd))
+		__gas_write32_no_retry(dev, cmd, &mrpc->cmd);
+	else
+		__gas_write32(dev, cmd, &mrpc->cmd);
+
+	return 0;
+}
+
+int gasop_cmd_poll(struct switchtec_dev *dev)
+{
+	struct mrpc_regs __gas *mrpc = &dev->gas_map->mrpc;
+	int status;
+
+	status = __gas_read32(dev, &mrpc->status);
+
+	return status != SWITCHTEC_MRPC_STATUS_INPROGRESS;
+}
+
+int gasop_cmd_complete(struct switchtec_dev *dev, void *resp,
+		       size_t resp_len)
+{
+	int status;
+
+	status = gasop_wait_status(dev, 0);
+
+	return gasop_cmd_result(dev, status, resp, resp_len);
+}
+
+int gasop_cmd(struct switchtec_dev *dev, uint32_t cmd,
+	      const void *payload, size_t payload_len, void *resp,
+	      size_t resp_len)
+{
+	int status;
+
+	gasop_cmd_submit(dev, cmd, payload, payload_len, resp_len);
+
+	status = gasop_wait_status(dev, platform_mrpc_poll_hint(dev, cmd));
+
+	return gasop_cmd_result(dev, status, resp, resp_len);
+}
+
 int gasop_get_device_id(struct switchtec_dev *dev)
 {
 	return gas_reg_read32(dev, sys_info.device_id);
@@ -188,52 +262,131 @@ int gasop_get_fw_version(struct switchtec_dev *dev, char *buf,
 	return 0;
 }
 
-int gasop_pff_to_port(struct switchtec_dev *dev, int pff,
-		      int *partition, int *port)
+/*
+ * The USP, VEP and DSP instance ID registers are contiguous, so they
+ * are fetched with a single block read. On transports with small
+ * transfer sizes (e.g. I2C) this turns 49 register reads per
+ * partition into a handful of maximum sized reads.
+ */
+struct pff_inst_ids {
+	uint32_t usp;
+	uint32_t vep;
+	uint32_t dsp[ARRAY_SIZE(((struct part_cfg_regs *)0)->dsp_pff_inst_id)];
+};
+
+/*
+ * The PFF instance IDs of the first \p loaded partitions, plus the
+ * reverse mapping. Partitions are read in order, only as far as a
+ * lookup needs, and the map is dropped by
+ * switchtec_gas_cache_invalidate() on reset and bind/unbind.
+ */
+struct gasop_pff_map {
+	int loaded;
+	struct pff_inst_ids ids[SWITCHTEC_MAX_PARTITIONS];
+	struct {
+		int16_t partition;
+		int16_t port;
+	} pff[SWITCHTEC_MAX_PFF_CSR];
+};
+
+static void pff_map_add(struct gasop_pff_map *map, uint32_t pff,
+			int partition, int port)
 {
+	if (pff >= SWITCHTEC_MAX_PFF_CSR || map->pff[pff].port >= 0)
+		return;
+
+	map->pff[pff].partition = partition;
+	map->pff[pff].port = port;
+}
+
+/* Read the partitions up to, but not including, \p nr into the map */
+static void pff_map_load(struct switchtec_dev *dev, struct gasop_pff_map *map,
+			 int nr)
+{
+	struct pff_inst_ids *ids;
 	int i, part;
-	uint32_t reg;
-	struct part_cfg_regs __gas *pcfg;
 
-	*port = -1;
+	/* Same order as the old linear search so the first match wins */
+	for (part = map->loaded; part < nr; part++) {
+		ids = &map->ids[part];
+		__memcpy_from_gas(dev, ids,
+				  &dev->gas_map->part_cfg[part].usp_pff_inst_id,
+				  sizeof(*ids));
+
+		ids->usp = le32toh(ids->usp);
+		ids->vep = le32toh(ids->vep);
+		for (i = 0; i < ARRAY_SIZE(ids->dsp); i++)
+			ids->dsp[i] = le32toh(ids->dsp[i]);
+
+		pff_map_add(map, ids->usp, part, 0);
+		pff_map_add(map, ids->vep, part, SWITCHTEC_PFF_PORT_VEP);
+		for (i = 0; i < ARRAY_SIZE(ids->dsp); i++)
+			pff_map_add(map, ids->dsp[i], part, i + 1);
+	}
+
+	if (nr > map->loaded)
+		map->loaded = nr;
+}
 
-	for (part = 0; part < dev->partition_count; part++) {
-		pcfg = &dev->gas_map->part_cfg[part];
-		*partition = part;
+static struct gasop_pff_map *gasop_get_pff_map(struct switchtec_dev *dev)
+{
+	struct gasop_pff_map *map;
+	int i;
 
-		reg = __gas_read32(dev, &pcfg->usp_pff_inst_id);
-		if (reg == pff) {
-			*port = 0;
-			return 0;
-		}
+	if (dev->pff_map)
+		return dev->pff_map;
 
-		reg = __gas_read32(dev, &pcfg->vep_pff_inst_id);
-		if (reg == pff) {
-			*port = SWITCHTEC_PFF_PORT_VEP;
-			return 0;
-		}
+	map = malloc(sizeof(*map));
+	if (!map)
+		return NULL;
 
-		for (i = 0; i < ARRAY_SIZE(pcfg->dsp_pff_inst_id); i++) {
-			reg = __gas_read32(dev, &pcfg->dsp_pff_inst_id[i]);
-			if (reg != pff)
-				continue;
+	map->loaded = 0;
+	for (i = 0; i < ARRAY_SIZE(map->pff); i++)
+		map->pff[i].port = -1;
 
-			*port = i + 1;
-			break;
-		}
+	dev->pff_map = map;
+	return map;
+}
 
-		if (*port != -1)
-			return 0;
+int gasop_pff_to_port(struct switchtec_dev *dev, int pff,
+		      int *partition, int *port)
+{
+	struct gasop_pff_map *map;
+	int ret = 0;
+
+	*port = -1;
+
+	platform_lock(dev);
+
+	map = gasop_get_pff_map(dev);
+	if (map && pff >= 0 && pff < SWITCHTEC_MAX_PFF_CSR) {
+		while (map->pff[pff].port < 0 &&
+		       map->loaded < dev->partition_count)
+			pff_map_load(dev, map, map->loaded + 1);
 	}
 
-	errno = EINVAL;
-	return -EINVAL;
+	if (!map) {
+		ret = -errno;
+	} else if (pff < 0 || pff >= SWITCHTEC_MAX_PFF_CSR ||
+		   map->pff[pff].port < 0) {
+		errno = EINVAL;
+		ret = -EINVAL;
+	} else {
+		*partition = map->pff[pff].partition;
+		*port = map->pff[pff].port;
+	}
+
+	platform_unlock(dev);
+
+	return ret;
 }
 
 int gasop_port_to_pff(struct switchtec_dev *dev, int partition,
 		      int port, int *pff)
 {
-	struct part_cfg_regs __gas *pcfg;
+	struct gasop_pff_map *map;
+	struct pff_inst_ids *ids;
+	int ret = 0;
 
 	if (partition < 0) {
 		partition = dev->partition;
@@ -242,34 +395,68 @@ int gasop_port_to_pff(struct switchtec_dev *dev, int partition,
 		return -errno;
 	}
 
-	pcfg = &dev->gas_map->part_cfg[partition];
+	if (port != SWITCHTEC_PFF_PORT_VEP &&
+	    (port < 0 || port > ARRAY_SIZE(ids->dsp))) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	platform_lock(dev);
+
+	map = gasop_get_pff_map(dev);
+	if (!map) {
+		ret = -errno;
+		goto out;
+	}
+
+	/* A partition not in the map yet only needs the one register */
+	if (partition >= map->loaded) {
+		switch (port) {
+		case 0:
+			*pff = gas_reg_read32(dev,
+					      part_cfg[partition].usp_pff_inst_id);
+			break;
+		case SWITCHTEC_PFF_PORT_VEP:
+			*pff = gas_reg_read32(dev,
+					      part_cfg[partition].vep_pff_inst_id);
+			break;
+		default:
+			*pff = gas_reg_read32(dev,
+				part_cfg[partition].dsp_pff_inst_id[port - 1]);
+			break;
+		}
+		goto out;
+	}
+
+	ids = &map->ids[partition];
 
 	switch (port) {
 	case 0:
-		*pff = __gas_read32(dev, &pcfg->usp_pff_inst_id);
+		*pff = ids->usp;
 		break;
 	case SWITCHTEC_PFF_PORT_VEP:
-		*pff = __gas_read32(dev, &pcfg->vep_pff_inst_id);
+		*pff = ids->vep;
 		break;
 	default:
-		if (port > ARRAY_SIZE(pcfg->dsp_pff_inst_id)) {
-			errno = EINVAL;
-			return -errno;
-		}
-
-		*pff = __gas_read32(dev, &pcfg->dsp_pff_inst_id[port - 1]);
+		*pff = ids->dsp[port - 1];
 		break;
 	}
 
-	return 0;
+out:
+	platform_unlock(dev);
+	return ret;
 }
 
 static void set_fw_info_part(struct switchtec_dev *dev,
 			     struct switchtec_fw_image_info *info,
 			     struct partition_info __gas *pi)
 {
-	info->part_addr = __gas_read32(dev, &pi->address);
-	info->part_len = __gas_read32(dev, &pi->length);
+	uint32_t regs[2];
+
+	/* address and length are adjacent; read them together */
+	__memcpy_from_gas(dev, regs, &pi->address, sizeof(regs));
+	info->part_addr = le32toh(regs[0]);
+	info->part_len = le32toh(regs[1]);
 }
 
 int gasop_flash_part(struct switchtec_dev *dev,
@@ -340,14 +527,22 @@ int gasop_event_summary(struct switchtec_dev *dev,
 {
 	int i;
 	uint32_t reg;
+	struct {
+		uint64_t part_event_bitmap;
+		uint64_t reserved2;
+		uint32_t global_summary;
+	} __attribute__((packed)) glb;
 
 	if (!sum)
 		return 0;
 
 	memset(sum, 0, sizeof(*sum));
 
-	sum->global = gas_reg_read32(dev, sw_event.global_summary);
-	sum->part_bitmap = gas_reg_read64(dev, sw_event.part_event_bitmap);
+	/* The partition bitmap and global summary share one block read */
+	__memcpy_from_gas(dev, &glb, &dev->gas_map->sw_event.part_event_bitmap,
+			  sizeof(glb));
+	sum->global = le32toh(glb.global_summary);
+	sum->part_bitmap = le64toh(glb.part_event_bitmap);
 
 	for (i = 0; i < dev->partition_count; i++) {
 		reg = gas_reg_read32(dev, part_cfg[i].part_event_summary);
@@ -367,6 +562,59 @@ int gasop_event_summary(struct switchtec_dev *dev,
 	return 0;
 }
 
+/*
+ * Like gasop_event_summary() but only reads the summaries under a set
+ * parent bit: a partition's summary and the summaries of its PFFs are
+ * read only when the partition's bit in the partition event bitmap is
+ * set. PFFs that are not part of any partition are not read.
+ */
+int gasop_event_summary_sparse(struct switchtec_dev *dev,
+			       struct switchtec_event_summary *sum)
+{
+	struct gasop_pff_map *map;
+	int i;
+	uint32_t reg;
+	struct {
+		uint64_t part_event_bitmap;
+		uint64_t reserved2;
+		uint32_t global_summary;
+	} __attribute__((packed)) glb;
+
+	map = gasop_get_pff_map(dev);
+	if (!map)
+		return gasop_event_summary(dev, sum);
+
+	pff_map_load(dev, map, dev->partition_count);
+
+	memset(sum, 0, sizeof(*sum));
+
+	__memcpy_from_gas(dev, &glb, &dev->gas_map->sw_event.part_event_bitmap,
+			  sizeof(glb));
+	sum->global = le32toh(glb.global_summary);
+	sum->part_bitmap = le64toh(glb.part_event_bitmap);
+
+	for (i = 0; i < dev->partition_count; i++) {
+		if (!(sum->part_bitmap & (1ULL << i)))
+			continue;
+
+		reg = gas_reg_read32(dev, part_cfg[i].part_event_summary);
+		sum->part[i] = reg;
+		if (i == dev->partition)
+			sum->local_part = reg;
+	}
+
+	for (i = 0; i < SWITCHTEC_MAX_PFF_CSR; i++) {
+		if (map->pff[i].port < 0)
+			continue;
+		if (!(sum->part_bitmap & (1ULL << map->pff[i].partition)))
+			continue;
+
+		sum->pff[i] = gas_reg_read32(dev, pff_csr[i].pff_event_summary);
+	}
+
+	return 0;
+}
+
 static uint32_t __gas *global_ev_reg(struct switchtec_dev *dev,
 				     size_t offset, int index)
 {
@@ -430,9 +678,9 @@ static const struct event_reg {
 	EV_PFF(LINK_STATE, link_state_hdr),
 };
 
-static uint32_t __gas *event_hdr_addr(struct switchtec_dev *dev,
-				      enum switchtec_event_id e,
-				      int index)
+uint32_t __gas *gasop_event_hdr_addr(struct switchtec_dev *dev,
+				     enum switchtec_event_id e,
+				     int index)
 {
 	size_t off;
 
@@ -461,7 +709,7 @@ static int event_ctl(struct switchtec_dev *dev, enum switchtec_event_id e,
 	uint32_t __gas *reg;
 	uint32_t hdr;
 
-	reg = event_hdr_addr(dev, e, index);
+	reg = gasop_event_hdr_addr(dev, e, index);
 	if (!reg) {
 		errno = EINVAL;
 		return -errno;
@@ -532,6 +780,93 @@ einval:
 	return -errno;
 }
 
+static uint32_t __gas *(*const event_type_reg[])(struct switchtec_dev *stdev,
+						  size_t offset, int index) = {
+	[SWITCHTEC_EVT_GLOBAL] = global_ev_reg,
+	[SWITCHTEC_EVT_PART] = part_ev_reg,
+	[SWITCHTEC_EVT_PFF] = pff_ev_reg,
+};
+
+/*
+ * The headers and data words of every event of one type sit back to
+ * back, so a whole block is read with one transfer. Clearing takes one
+ * write per selected event that occurred, as each header is its own
+ * write-one-to-clear register.
+ */
+int gasop_event_block_ctl(struct switchtec_dev *dev,
+			  enum switchtec_event_type type, int index,
+			  uint64_t clear, struct switchtec_event_block *blk)
+{
+	uint32_t buf[SWITCHTEC_MAX_EVENTS * 6];
+	size_t first = SIZE_MAX, last = 0, off;
+	uint32_t __gas *base;
+	enum switchtec_event_id e;
+	uint32_t hdr;
+	int i, nr = 0;
+
+	if (type < SWITCHTEC_EVT_GLOBAL || type > SWITCHTEC_EVT_PFF)
+		goto einval;
+
+	if (type == SWITCHTEC_EVT_PART) {
+		if (index == SWITCHTEC_EVT_IDX_LOCAL)
+			index = dev->partition;
+		else if (index < 0 || index >= dev->partition_count)
+			goto einval;
+	} else if (type == SWITCHTEC_EVT_PFF) {
+		if (index < 0 || index >= SWITCHTEC_MAX_PFF_CSR)
+			goto einval;
+	} else {
+		index = 0;
+	}
+
+	for (e = 0; e < SWITCHTEC_MAX_EVENTS; e++) {
+		if (event_regs[e].map_reg != event_type_reg[type])
+			continue;
+
+		if (event_regs[e].offset < first)
+			first = event_regs[e].offset;
+		if (event_regs[e].offset + 6 * sizeof(uint32_t) > last)
+			last = event_regs[e].offset + 6 * sizeof(uint32_t);
+	}
+
+	if (last - first > sizeof(buf))
+		goto einval;
+
+	base = event_type_reg[type](dev, first, index);
+	__memcpy_from_gas(dev, buf, base, last - first);
+
+	memset(blk, 0, sizeof(*blk));
+
+	for (e = 0; e < SWITCHTEC_MAX_EVENTS; e++) {
+		if (event_regs[e].map_reg != event_type_reg[type])
+			continue;
+
+		off = (event_regs[e].offset - first) / sizeof(uint32_t);
+		hdr = le32toh(buf[off]);
+
+		blk->hdr[e] = hdr;
+		blk->count[e] = (hdr >> 5) & 0xFF;
+		for (i = 0; i < 5; i++)
+			blk->data[e][i] = le32toh(buf[off + 1 + i]);
+
+		if (!(hdr & SWITCHTEC_EVENT_OCCURRED))
+			continue;
+
+		blk->occurred |= 1ULL << e;
+		nr++;
+
+		/* Writing the header back as read clears the event */
+		if (clear & (1ULL << e))
+			__gas_write32(dev, buf[off], &base[off]);
+	}
+
+	return nr;
+
+einval:
+	errno = EINVAL;
+	return -errno;
+}
+
 int gasop_event_wait_for(struct switchtec_dev *dev,
 			 enum switchtec_event_id e, int index,
 			 struct switchtec_event_summary *res,
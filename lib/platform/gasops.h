@@ -33,6 +33,12 @@ void gasop_set_partition_info(struct switchtec_dev *dev);
 int gasop_cmd(struct switchtec_dev *dev, uint32_t cmd,
 	      const void *payload, size_t payload_len, void *resp,
 	      size_t resp_len);
+int gasop_cmd_submit(struct switchtec_dev *dev, uint32_t cmd,
+		     const void *payload, size_t payload_len,
+		     size_t resp_len);
+int gasop_cmd_poll(struct switchtec_dev *dev);
+int gasop_cmd_complete(struct switchtec_dev *dev, void *resp,
+		       size_t resp_len);
 int gasop_get_device_id(struct switchtec_dev *dev);
 int gasop_get_fw_version(struct switchtec_dev *dev, char *buf,
 			 size_t buflen);
@@ -45,8 +51,16 @@ int gasop_flash_part(struct switchtec_dev *dev,
 		     enum switchtec_fw_image_part_id_gen3 part);
 int gasop_event_summary(struct switchtec_dev *dev,
 			struct switchtec_event_summary *sum);
+int gasop_event_summary_sparse(struct switchtec_dev *dev,
+			       struct switchtec_event_summary *sum);
+uint32_t __gas *gasop_event_hdr_addr(struct switchtec_dev *dev,
+				     enum switchtec_event_id e,
+				     int index);
 int gasop_event_ctl(struct switchtec_dev *dev, enum switchtec_event_id e,
 		    int index, int flags, uint32_t data[5]);
+int gasop_event_block_ctl(struct switchtec_dev *dev,
+			  enum switchtec_event_type type, int index,
+			  uint64_t clear, struct switchtec_event_block *blk);
 int gasop_event_wait_for(struct switchtec_dev *dev,
 			 enum switchtec_event_id e, int index,
 			 struct switchtec_event_summary *res,
@@ -45,6 +45,8 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <poll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include <errno.h>
 #include <string.h>
@@ -80,15 +82,10 @@
 
 #define ETH_MAX_READ 512
 
-struct switchtec_eth {
-	struct switchtec_dev dev;
-	int cmd_fd;
-	int evt_fd;
-};
-
-#define to_switchtec_eth(d)  \
-	((struct switchtec_eth *) \
-	((char *)d - offsetof(struct switchtec_eth, dev)))
+/* Requests sent together in one window by the bulk operations */
+#define ETH_MAX_BATCH 8
+/* Requests which may be awaiting a response at any time */
+#define ETH_MAX_INFLIGHT (ETH_MAX_BATCH * 2)
 
 struct eth_header {
 	uint32_t signature;
@@ -117,115 +114,235 @@ struct eth_packet {
 	uint8_t body[MRPC_MAX_DATA_LEN + 4];
 };
 
-static int send_eth_command(int cmd_fd, int func_type, uint8_t *data,
-			    uint32_t data_len, uint32_t mrpc_output_len)
-{
-	size_t packet_len;
-	struct eth_packet *command_p;
+/*
+ * The wire protocol has no request ID and the server answers requests
+ * in order, so each request gets a local sequence number (tag) and
+ * responses are matched to the oldest outstanding one. This lets GAS
+ * accesses run while an asynchronous MRPC command is outstanding:
+ * the command's response is parked until switchtec_cmd_complete().
+ */
+struct eth_req {
+	bool in_use;
+	bool done;
+	uint8_t resp_type;
+	int ret;
+	uint32_t result;
+	void *out;
+	size_t out_max;
+	uint32_t out_len;
+};
 
-	packet_len = offsetof(struct eth_packet, body) + data_len;
-	command_p = malloc(packet_len);
+struct switchtec_eth {
+	struct switchtec_dev dev;
+	int cmd_fd;
+	int evt_fd;
 
-	command_p->hdr.signature = htonl(ETH_PROT_SIGNATURE);
-	command_p->hdr.version_id = ETH_PROT_VERSION;
-	command_p->hdr.function_type = func_type;
-	command_p->hdr.packet_type = ETH_PACKET_TYPE_CMD;
-	command_p->hdr.payload_bytes = htons(data_len);
-	command_p->hdr.mrpc_output_bytes = htons(mrpc_output_len);
+	uint8_t tx_buf[ETH_MAX_BATCH * sizeof(struct eth_packet)];
+	size_t tx_len;
+	struct eth_packet rx_pkt;
 
-	memcpy(command_p->body, data, data_len);
+	struct eth_req reqs[ETH_MAX_INFLIGHT];
+	unsigned int next_tag;
+	unsigned int recv_tag;
 
-	if (send(cmd_fd, command_p, packet_len, 0) < 0) {
-		free(command_p);
+	int async_tag;
+	uint8_t async_resp[MRPC_MAX_DATA_LEN];
+};
+
+#define to_switchtec_eth(d)  \
+	((struct switchtec_eth *) \
+	((char *)d - offsetof(struct switchtec_eth, dev)))
+
+static struct eth_req *eth_req(struct switchtec_eth *edev, unsigned int tag)
+{
+	return &edev->reqs[tag % ETH_MAX_INFLIGHT];
+}
+
+/*
+ * Append a request to the transmit buffer. The body is \p hdr followed
+ * by \p data. The response data is copied to \p out. Returns the
+ * request's tag or -1 if too many requests are outstanding.
+ */
+static int eth_queue(struct switchtec_eth *edev, int func_type,
+		     const void *hdr, size_t hdr_len,
+		     const void *data, size_t data_len,
+		     uint32_t mrpc_output_len, void *out, size_t out_max)
+{
+	struct eth_packet *p = (void *)(edev->tx_buf + edev->tx_len);
+	size_t body_len = hdr_len + data_len;
+	struct eth_req *req = eth_req(edev, edev->next_tag);
+
+	if (req->in_use || body_len > sizeof(p->body) ||
+	    edev->tx_len + sizeof(*p) > sizeof(edev->tx_buf)) {
+		errno = EBUSY;
 		return -1;
 	}
 
-	free(command_p);
-	return 0;
+	memset(&p->hdr, 0, sizeof(p->hdr));
+	p->hdr.signature = htonl(ETH_PROT_SIGNATURE);
+	p->hdr.version_id = ETH_PROT_VERSION;
+	p->hdr.function_type = func_type;
+	p->hdr.packet_type = ETH_PACKET_TYPE_CMD;
+	p->hdr.payload_bytes = htons(body_len);
+	p->hdr.mrpc_output_bytes = htons(mrpc_output_len);
+
+	memcpy(p->body, hdr, hdr_len);
+	if (data_len)
+		memcpy(p->body + hdr_len, data, data_len);
+
+	edev->tx_len += offsetof(struct eth_packet, body) + body_len;
+
+	memset(req, 0, sizeof(*req));
+	req->in_use = true;
+	req->resp_type = func_type == ETH_FUNC_TYPE_MRPC_CMD ?
+		ETH_FUNC_TYPE_MRPC_RESP : ETH_FUNC_TYPE_MOE_RESP;
+	req->out = out;
+	req->out_max = out_max;
+
+	return edev->next_tag++;
 }
 
-static int recv_eth_response(int cmd_fd, uint32_t *result,
-			     uint8_t *output, uint32_t *output_len)
+static int eth_queue_mrpc(struct switchtec_eth *edev, uint32_t cmd,
+			  const void *payload, size_t payload_len,
+			  void *resp, size_t resp_len)
 {
-	struct eth_packet recvd_p;
-	void *p;
-	uint32_t len;
-	uint16_t func_type;
-	uint16_t packet_type;
+	uint32_t command_id = htole32(cmd);
 
-	len = sizeof(struct eth_header);
+	return eth_queue(edev, ETH_FUNC_TYPE_MRPC_CMD,
+			 &command_id, sizeof(command_id),
+			 payload, payload_len, resp_len, resp, resp_len);
+}
 
-	if (recv(cmd_fd, &recvd_p.hdr, len, 0) < 0)
-		return -1;
+/* Send everything queued since the last flush */
+static int eth_flush(struct switchtec_eth *edev)
+{
+	size_t off = 0;
+	ssize_t ret;
+
+	while (off < edev->tx_len) {
+		ret = send(edev->cmd_fd, edev->tx_buf + off,
+			   edev->tx_len - off, 0);
+		if (ret < 0)
+			goto fail;
+		off += ret;
+	}
 
-	func_type = recvd_p.hdr.function_type;
-	packet_type = recvd_p.hdr.packet_type;
+	edev->tx_len = 0;
+	return 0;
 
-	if ((func_type == ETH_FUNC_TYPE_OPEN_CLOSE)
-	&& (packet_type == ETH_PACKET_TYPE_OPEN))
-		return -2;
+fail:
+	/* The stream is out of sync; fail everything outstanding */
+	for (; edev->recv_tag != edev->next_tag; edev->recv_tag++) {
+		eth_req(edev, edev->recv_tag)->done = true;
+		eth_req(edev, edev->recv_tag)->ret = -1;
+	}
 
-	len = ntohs(recvd_p.hdr.payload_bytes);
-	p = recvd_p.body;
+	edev->tx_len = 0;
+	return -1;
+}
 
-	if (!len)
-		return 0;
+static int eth_recv_all(int fd, void *buf, size_t len)
+{
+	ssize_t ret;
+
+	ret = recv(fd, buf, len, MSG_WAITALL);
+	if (ret < 0)
+		return -1;
 
-	if (recv(cmd_fd, p, len, 0) < 0)
-		return -3;
-
-	if (packet_type == ETH_PACKET_TYPE_CMD) {
-		*result = le32toh(*(uint32_t *)p);
-		p += sizeof(uint32_t);
-		len -= sizeof(uint32_t);
-		if (output)
-			memcpy(output, p, len);
-		if (output_len)
-			*output_len = len;
+	if (ret != len) {
+		errno = ECONNRESET;
+		return -1;
 	}
 
 	return 0;
 }
 
-static int switchtec_submit_cmd_eth(struct switchtec_dev *dev, uint32_t cmd,
-				    const void *payload, size_t payload_len,
-				    size_t resp_len)
+/* Receive the response to the oldest outstanding request */
+static void eth_recv_one(struct switchtec_eth *edev)
 {
-	struct switchtec_eth *edev = to_switchtec_eth(dev);
-	uint32_t body_len;
-	int ret;
+	struct eth_packet *p = &edev->rx_pkt;
+	struct eth_req *req = eth_req(edev, edev->recv_tag++);
+	uint8_t *body = p->body;
+	uint32_t len;
 
-	struct eth_mrpc_body{
-		uint32_t command_id;
-		uint8_t data[];
-	} __attribute__(( packed )) *mrpc_body;
+	req->done = true;
+	req->ret = -1;
 
-	body_len = offsetof(struct eth_mrpc_body, data) + payload_len;
-	mrpc_body = malloc(body_len);
-	memset(mrpc_body, 0, body_len);
+	if (eth_recv_all(edev->cmd_fd, &p->hdr, sizeof(p->hdr)))
+		return;
 
-	mrpc_body->command_id = htole32(cmd);
-	memcpy(mrpc_body->data, payload, payload_len);
+	if (p->hdr.function_type == ETH_FUNC_TYPE_OPEN_CLOSE &&
+	    p->hdr.packet_type == ETH_PACKET_TYPE_OPEN) {
+		errno = ECONNRESET;
+		return;
+	}
 
-	ret = send_eth_command(edev->cmd_fd, ETH_FUNC_TYPE_MRPC_CMD,
-			       (uint8_t *)mrpc_body, body_len, resp_len);
-	free(mrpc_body);
+	len = ntohs(p->hdr.payload_bytes);
+	if (len > sizeof(p->body)) {
+		errno = EPROTO;
+		return;
+	}
 
-	return ret;
+	if (len && eth_recv_all(edev->cmd_fd, body, len))
+		return;
+
+	if (p->hdr.packet_type == ETH_PACKET_TYPE_CMD &&
+	    p->hdr.function_type != req->resp_type &&
+	    (p->hdr.function_type == ETH_FUNC_TYPE_MRPC_RESP ||
+	     p->hdr.function_type == ETH_FUNC_TYPE_MOE_RESP)) {
+		/* The response belongs to a different kind of request */
+		errno = EPROTO;
+		return;
+	}
+
+	req->ret = 0;
+
+	if (p->hdr.packet_type != ETH_PACKET_TYPE_CMD ||
+	    len < sizeof(uint32_t))
+		return;
+
+	memcpy(&req->result, body, sizeof(req->result));
+	req->result = le32toh(req->result);
+	body += sizeof(uint32_t);
+	len -= sizeof(uint32_t);
+
+	req->out_len = len;
+	if (req->out)
+		memcpy(req->out, body, len < req->out_max ? len : req->out_max);
 }
 
-static int switchtec_read_resp_eth(struct switchtec_dev *dev, void *resp,
-				   size_t resp_len)
+/*
+ * Wait for the response to the request with \p tag and release it.
+ * Returns 0 with the firmware's result in \p result, or -1 if the
+ * response could not be received.
+ */
+static int eth_wait(struct switchtec_eth *edev, int tag, uint32_t *result,
+		    uint32_t *out_len)
 {
-	struct switchtec_eth *edev = to_switchtec_eth(dev);
-	uint32_t ret;
-	uint32_t result;
-	uint8_t buf[resp_len];
-	uint32_t received_len;
+	struct eth_req *req = eth_req(edev, tag);
+
+	eth_flush(edev);
+
+	while (!req->done)
+		eth_recv_one(edev);
+
+	req->in_use = false;
+	if (req->ret)
+		return req->ret;
+
+	if (result)
+		*result = req->result;
+	if (out_len)
+		*out_len = req->out_len;
 
-	ret = recv_eth_response(edev->cmd_fd, &result, buf, &received_len);
+	return 0;
+}
+
+static int eth_mrpc_result(int ret, uint32_t result, uint32_t received_len,
+			   size_t resp_len)
+{
 	if (ret)
-		return ret;
+		return -errno;
 
 	if (received_len != resp_len) {
 		errno = EIO;
@@ -235,11 +352,6 @@ static int switchtec_read_resp_eth(struct switchtec_dev *dev, void *resp,
 	if (result)
 		errno = result;
 
-	if (!resp)
-		return result;
-
-	memcpy(resp, buf, resp_len);
-
 	return result;
 }
 
@@ -247,92 +359,214 @@ static int eth_cmd(struct switchtec_dev *dev, uint32_t cmd,
 		   const void *payload, size_t payload_len,
 		   void *resp, size_t resp_len)
 {
-	int ret;
+	struct switchtec_eth *edev = to_switchtec_eth(dev);
+	uint32_t result, received_len;
+	int tag, ret;
 
-	ret = switchtec_submit_cmd_eth(dev, cmd, payload,
-				       payload_len, resp_len);
+	tag = eth_queue_mrpc(edev, cmd, payload, payload_len,
+			     resp, resp_len);
+	if (tag < 0)
+		return -errno;
 
-	if (ret < 0)
-		return ret;
+	ret = eth_wait(edev, tag, &result, &received_len);
 
-	return switchtec_read_resp_eth(dev, resp, resp_len);
+	return eth_mrpc_result(ret, result, received_len, resp_len);
 }
 
-#ifdef __CHECKER__
-#define __force __attribute__((force))
-#else
-#define __force
-#endif
-
-static int eth_gas_write_exec(int fd, uint32_t offset,
-			      const void *data, uint16_t bytes)
+/*
+ * Queue up to ETH_MAX_BATCH requests in a single send() and then
+ * collect the responses.
+ */
+static int eth_cmd_batch(struct switchtec_dev *dev,
+			 struct switchtec_cmd_desc *cmds, int n)
 {
-	uint32_t result;
-	uint32_t body_len;
+	struct switchtec_eth *edev = to_switchtec_eth(dev);
+	struct switchtec_cmd_desc *c;
+	uint32_t result, received_len;
+	int tags[ETH_MAX_BATCH];
+	int i, j, cnt;
 	int ret;
 
-	struct eth_gas_write_body{
-		uint32_t command_id;
-		uint32_t offset;
-		uint16_t bytes;
-		uint16_t reserved;
-		uint8_t data[];
-	} __attribute__(( packed )) *gas_write_body;
+	for (i = 0; i < n; i += cnt) {
+		cnt = n - i < ETH_MAX_BATCH ? n - i : ETH_MAX_BATCH;
+
+		for (j = 0; j < cnt; j++) {
+			c = &cmds[i + j];
+			tags[j] = eth_queue_mrpc(edev,
+						 platform_cmd_id(dev, c->cmd),
+						 c->payload, c->payload_len,
+						 c->resp, c->resp_len);
+			if (tags[j] < 0) {
+				cnt = j;
+				break;
+			}
+		}
+
+		if (!cnt)
+			return cmds[i].ret = -errno;
+
+		for (j = 0; j < cnt; j++) {
+			c = &cmds[i + j];
+			ret = eth_wait(edev, tags[j], &result, &received_len);
+			c->ret = eth_mrpc_result(ret, result, received_len,
+						 c->resp_len);
+		}
+
+		for (j = 0; j < cnt; j++)
+			if (cmds[i + j].ret < 0)
+				return cmds[i + j].ret;
+	}
 
-	body_len = offsetof(struct eth_gas_write_body, data) + bytes;
-	gas_write_body = malloc(body_len);
-	memset(gas_write_body, 0, body_len);
+	return 0;
+}
 
-	gas_write_body->command_id = htole32(ETH_GAS_WRITE_CMD_ID);
-	gas_write_body->offset = htole32(offset);
-	gas_write_body->bytes = htole16(bytes);
+static int eth_cmd_submit(struct switchtec_dev *dev, uint32_t cmd,
+			  const void *payload, size_t payload_len,
+			  size_t resp_len)
+{
+	struct switchtec_eth *edev = to_switchtec_eth(dev);
+	int tag;
 
-	memcpy(gas_write_body->data, data, bytes);
+	tag = eth_queue_mrpc(edev, cmd, payload, payload_len,
+			     edev->async_resp, resp_len);
+	if (tag < 0)
+		return -errno;
 
-	ret = send_eth_command(fd, ETH_FUNC_TYPE_MOE_CMD,
-			       (uint8_t *)gas_write_body, body_len, 0);
+	if (eth_flush(edev)) {
+		eth_req(edev, tag)->in_use = false;
+		return -errno;
+	}
 
-	free(gas_write_body);
+	edev->async_tag = tag;
 
-	if (ret)
-		return ret;
+	return 0;
+}
 
-	ret = recv_eth_response(fd, &result, NULL, NULL);
+static int eth_cmd_poll(struct switchtec_dev *dev)
+{
+	struct switchtec_eth *edev = to_switchtec_eth(dev);
+	struct pollfd fds = {
+		.fd = edev->cmd_fd,
+		.events = POLLIN,
+	};
+	int ret;
 
-	return ret;
+	if (eth_req(edev, edev->async_tag)->done)
+		return 1;
+
+	/* Earlier responses would have to be received first */
+	if (edev->recv_tag != edev->async_tag)
+		return 0;
+
+	ret = poll(&fds, 1, 0);
+	if (ret < 0)
+		return -errno;
+
+	return ret > 0;
 }
 
-static int eth_gas_read_exec(struct switchtec_dev *dev, uint32_t offset,
-			     uint8_t *data, size_t bytes)
+static int eth_cmd_poll_fd(struct switchtec_dev *dev)
 {
 	struct switchtec_eth *edev = to_switchtec_eth(dev);
-	uint32_t result;
-	uint32_t data_len;
-	size_t body_len;
+
+	return edev->cmd_fd;
+}
+
+static int eth_cmd_complete(struct switchtec_dev *dev, void *resp,
+			    size_t resp_len)
+{
+	struct switchtec_eth *edev = to_switchtec_eth(dev);
+	uint32_t result, received_len;
 	int ret;
 
-	struct eth_gas_write_body{
-		uint32_t command_id;
-		uint32_t offset;
-		uint16_t bytes;
-		uint16_t reserved;
-	} __attribute__(( packed )) gas_read_body;
+	ret = eth_wait(edev, edev->async_tag, &result, &received_len);
+	ret = eth_mrpc_result(ret, result, received_len, resp_len);
+	if (ret >= 0 && resp)
+		memcpy(resp, edev->async_resp, resp_len);
 
-	gas_read_body.command_id = htole32(ETH_GAS_READ_CMD_ID);
-	gas_read_body.offset = htole32(offset);
-	gas_read_body.bytes = htole16(bytes);
+	return ret;
+}
 
-	body_len = sizeof(gas_read_body);
+#ifdef __CHECKER__
+#define __force __attribute__((force))
+#else
+#define __force
+#endif
 
-	ret = send_eth_command(edev->cmd_fd, ETH_FUNC_TYPE_MOE_CMD,
-			       (uint8_t *)&gas_read_body, body_len, 0);
+struct eth_gas_body {
+	uint32_t command_id;
+	uint32_t offset;
+	uint16_t bytes;
+	uint16_t reserved;
+} __attribute__(( packed ));
 
-	if (ret)
-		return ret;
+static int eth_queue_gas_read(struct switchtec_eth *edev, uint32_t offset,
+			      void *data, size_t bytes)
+{
+	struct eth_gas_body body = {
+		.command_id = htole32(ETH_GAS_READ_CMD_ID),
+		.offset = htole32(offset),
+		.bytes = htole16(bytes),
+	};
 
-	ret = recv_eth_response(edev->cmd_fd, &result, data, &data_len);
+	return eth_queue(edev, ETH_FUNC_TYPE_MOE_CMD, &body, sizeof(body),
+			 NULL, 0, 0, data, bytes);
+}
 
-	return ret;
+static int eth_gas_write_exec(struct switchtec_eth *edev, uint32_t offset,
+			      const void *data, uint16_t bytes)
+{
+	struct eth_gas_body body = {
+		.command_id = htole32(ETH_GAS_WRITE_CMD_ID),
+		.offset = htole32(offset),
+		.bytes = htole16(bytes),
+	};
+	int tag;
+
+	tag = eth_queue(edev, ETH_FUNC_TYPE_MOE_CMD, &body, sizeof(body),
+			data, bytes, 0, NULL, 0);
+	if (tag < 0)
+		return tag;
+
+	return eth_wait(edev, tag, NULL, NULL);
+}
+
+/*
+ * Read n bytes, keeping up to ETH_MAX_BATCH requests of ETH_MAX_READ
+ * bytes in flight so a high latency link is not idle between chunks.
+ */
+static int eth_gas_read_exec(struct switchtec_dev *dev, uint32_t offset,
+			     uint8_t *data, size_t n)
+{
+	struct switchtec_eth *edev = to_switchtec_eth(dev);
+	int tags[ETH_MAX_BATCH];
+	int i, cnt, ret = 0;
+	size_t len;
+
+	while (n) {
+		for (cnt = 0; cnt < ETH_MAX_BATCH && n; cnt++) {
+			len = n > ETH_MAX_READ ? ETH_MAX_READ : n;
+			tags[cnt] = eth_queue_gas_read(edev, offset, data, len);
+			if (tags[cnt] < 0)
+				break;
+
+			offset += len;
+			data += len;
+			n -= len;
+		}
+
+		if (!cnt)
+			return -1;
+
+		for (i = 0; i < cnt; i++)
+			if (eth_wait(edev, tags[i], NULL, NULL))
+				ret = -1;
+
+		if (ret)
+			return ret;
+	}
+
+	return 0;
 }
 
 static void eth_gas_read(struct switchtec_dev *dev, void *dest,
@@ -355,7 +589,7 @@ static void eth_gas_write(struct switchtec_dev *dev, void __gas *dest,
 	int ret;
 
 	gas_addr = (uint32_t)(dest - (void __gas *)dev->gas_map);
-	ret = eth_gas_write_exec(edev->cmd_fd, gas_addr, src, n);
+	ret = eth_gas_write_exec(edev, gas_addr, src, n);
 	if (ret)
 		raise(SIGBUS);
 }
@@ -403,11 +637,11 @@ static ssize_t eth_write_from_gas(struct switchtec_dev *dev, int fd,
 				  const void __gas *src, size_t n)
 {
 	ssize_t ret = 0;
-	uint8_t buf[ETH_MAX_READ];
+	uint8_t buf[ETH_MAX_READ * ETH_MAX_BATCH];
 	int cnt;
 
 	while (n) {
-		cnt = n > ETH_MAX_READ ? ETH_MAX_READ : n;
+		cnt = n > sizeof(buf) ? sizeof(buf) : n;
 		eth_memcpy_from_gas(dev, buf, src, cnt);
 		ret +=write(fd, buf, cnt);
 
@@ -458,6 +692,7 @@ static void eth_close(struct switchtec_dev *dev)
 		munmap((void __force *)dev->gas_map, dev->gas_map_size);
 
 	close(edev->cmd_fd);
+	platform_dev_fini(dev);
 	free(edev);
 }
 
@@ -511,6 +746,16 @@ static int eth_event_wait(struct switchtec_dev *dev, int timeout_ms)
 	if (ret <= 0)
 		return ret;
 
+	/* Drain the body so the next wait starts on a packet boundary */
+	len = ntohs(recvd_p.hdr.payload_bytes);
+	if (len > sizeof(recvd_p.body))
+		len = sizeof(recvd_p.body);
+	if (len) {
+		ret = recv(edev->evt_fd, recvd_p.body, len, MSG_WAITALL);
+		if (ret <= 0)
+			return ret;
+	}
+
 	if ((recvd_p.hdr.packet_type == ETH_PACKET_TYPE_CMD)
 	    && (recvd_p.hdr.function_type == ETH_FUNC_TYPE_EVENT))
 		return 1;
@@ -518,18 +763,34 @@ static int eth_event_wait(struct switchtec_dev *dev, int timeout_ms)
 	return 0;
 }
 
+static int eth_event_wait_fd(struct switchtec_dev *dev, short *events)
+{
+	struct switchtec_eth *edev = to_switchtec_eth(dev);
+
+	*events = POLLIN;
+	return edev->evt_fd;
+}
+
 static const struct switchtec_ops eth_ops = {
 	.close = eth_close,
 	.gas_map = eth_gas_map,
 	.cmd = eth_cmd,
+	.cmd_batch = eth_cmd_batch,
+	.cmd_submit = eth_cmd_submit,
+	.cmd_poll = eth_cmd_poll,
+	.cmd_poll_fd = eth_cmd_poll_fd,
+	.cmd_complete = eth_cmd_complete,
 	.get_device_id = gasop_get_device_id,
 	.get_fw_version = gasop_get_fw_version,
 	.pff_to_port = gasop_pff_to_port,
 	.port_to_pff = gasop_port_to_pff,
 	.flash_part = gasop_flash_part,
 	.event_summary = gasop_event_summary,
+	.event_summary_sparse = gasop_event_summary_sparse,
 	.event_ctl = gasop_event_ctl,
+	.event_block_ctl = gasop_event_block_ctl,
 	.event_wait = eth_event_wait,
+	.event_wait_fd = eth_event_wait_fd,
 
 	.gas_read8 = eth_gas_read8,
 	.gas_read16 = eth_gas_read16,
@@ -553,6 +814,7 @@ static int open_eth_chan(const char *server_ip, int server_port,
 
 	struct sockaddr_in server;
 	uint32_t len;
+	int one = 1;
 	int ret;
 
 	fd = socket(AF_INET, SOCK_STREAM, 0);
@@ -560,6 +822,9 @@ static int open_eth_chan(const char *server_ip, int server_port,
 		return -1;
 	ret = fd;
 
+	/* Requests are small and latency bound; don't let Nagle hold them */
+	setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
 	server.sin_addr.s_addr = inet_addr(server_ip);
 	server.sin_family = AF_INET;
 	server.sin_port = htons(server_port);
@@ -596,6 +861,8 @@ static int open_eth_chan(const char *server_ip, int server_port,
 		ret = -5;
 out_free:
 	free(open_p);
+	if (ret < 0)
+		close(fd);
 	return ret;
 
 }
@@ -604,7 +871,7 @@ struct switchtec_dev *switchtec_open_eth(const char *ip, const int inst)
 {
 	struct switchtec_eth *edev;
 
-	edev = malloc(sizeof(*edev));
+	edev = calloc(1, sizeof(*edev));
 	if (!edev)
 		return NULL;
 
@@ -621,6 +888,7 @@ struct switchtec_dev *switchtec_open_eth(const char *ip, const int inst)
 	if (map_gas(&edev->dev))
 		goto err_close_free;
 
+	platform_dev_init(&edev->dev);
 	edev->dev.ops = &eth_ops;
 
 	gasop_set_partition_info(&edev->dev);
@@ -42,15 +42,78 @@
 #include <stddef.h>
 #include <assert.h>
 #include <string.h>
+#include <pthread.h>
 
 #include <linux/i2c.h>
 #include <linux/i2c-dev.h>
 
+/*
+ * One I2C transaction can write a maximum of 26 bytes, but it is better to
+ * write the GAS with dword.
+ */
+#define I2C_MAX_WRITE 24
+/*
+ * One I2C transaction can read a maximum of 27 bytes, but it is better to
+ * read GAS with dword.
+ */
+#define I2C_MAX_READ 24
+
+/* Largest command and response headers plus the PEC/status tail */
+#define I2C_XFER_HDR_LEN 8
+#define I2C_XFER_BUF_LEN (I2C_XFER_HDR_LEN + I2C_MAX_READ + \
+			  I2C_MAX_WRITE)
+
+/*
+ * After this many interactive transactions are granted in a row while
+ * bulk transfers wait, one bulk transaction goes next.
+ */
+#define I2C_BULK_STARVE_LIMIT 4
+
+/*
+ * Every handle in the process opened on the same adapter shares one of
+ * these. The bus is granted one I2C_RDWR transaction at a time: higher
+ * priority classes go first and, within a class, waiters are served in
+ * ticket order. A handle moving a large buffer takes a new ticket for
+ * every chunk, so concurrent transfers interleave instead of one
+ * holding the bus until it is done.
+ */
+struct i2c_bus {
+	struct i2c_bus *next;
+	dev_t rdev;
+	int refcnt;
+
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool busy;
+	int starve;
+	struct {
+		uint64_t head;
+		uint64_t tail;
+	} queue[SWITCHTEC_I2C_PRIO_NUM];
+
+	uint64_t stats_start_us;
+	uint64_t busy_us;
+	struct switchtec_i2c_prio_stats stats[SWITCHTEC_I2C_PRIO_NUM];
+};
+
+static struct i2c_bus *i2c_buses;
+static pthread_mutex_t i2c_buses_lock = PTHREAD_MUTEX_INITIALIZER;
+
 struct switchtec_i2c {
 	struct switchtec_dev dev;
 	int fd;
 	int i2c_addr;
 	uint8_t tag;
+
+	struct i2c_bus *bus;
+	enum switchtec_i2c_prio prio;
+
+	/*
+	 * Transaction buffers, reused for every GAS access. They are
+	 * protected by the device handle lock.
+	 */
+	uint8_t tx_buf[I2C_XFER_BUF_LEN];
+	uint8_t rx_buf[I2C_XFER_BUF_LEN];
 };
 
 #define CMD_GET_CAP  0xE0
@@ -151,6 +214,178 @@ static int i2c_set_timeout(struct switchtec_i2c *idev, int time)
 	return ioctl(idev->fd, I2C_TIMEOUT, time);
 }
 
+/*
+ * Find or create the bus for the adapter behind idev->fd. The adapter
+ * timeout is a property of the adapter, not of the file, so it is only
+ * set when the bus is first opened.
+ */
+static int i2c_bus_get(struct switchtec_i2c *idev)
+{
+	struct i2c_bus *bus;
+	struct stat st;
+	int ret = 0;
+
+	if (fstat(idev->fd, &st))
+		return -1;
+
+	pthread_mutex_lock(&i2c_buses_lock);
+
+	for (bus = i2c_buses; bus; bus = bus->next)
+		if (bus->rdev == st.st_rdev)
+			break;
+
+	if (bus) {
+		bus->refcnt++;
+		goto out;
+	}
+
+	ret = i2c_set_timeout(idev, 10);
+	if (ret)
+		goto out;
+
+	bus = calloc(1, sizeof(*bus));
+	if (!bus) {
+		ret = -1;
+		goto out;
+	}
+
+	bus->rdev = st.st_rdev;
+	bus->refcnt = 1;
+	pthread_mutex_init(&bus->lock, NULL);
+	pthread_cond_init(&bus->cond, NULL);
+	bus->stats_start_us = platform_time_us();
+
+	bus->next = i2c_buses;
+	i2c_buses = bus;
+
+out:
+	pthread_mutex_unlock(&i2c_buses_lock);
+	idev->bus = bus;
+	return ret;
+}
+
+static void i2c_bus_put(struct i2c_bus *bus)
+{
+	struct i2c_bus **p;
+
+	pthread_mutex_lock(&i2c_buses_lock);
+
+	if (--bus->refcnt) {
+		pthread_mutex_unlock(&i2c_buses_lock);
+		return;
+	}
+
+	for (p = &i2c_buses; *p != bus; p = &(*p)->next)
+		;
+	*p = bus->next;
+
+	pthread_mutex_unlock(&i2c_buses_lock);
+
+	pthread_cond_destroy(&bus->cond);
+	pthread_mutex_destroy(&bus->lock);
+	free(bus);
+}
+
+static bool i2c_bus_waiting(struct i2c_bus *bus, int prio)
+{
+	return bus->queue[prio].head != bus->queue[prio].tail;
+}
+
+/* Class the next grant goes to, called with the bus lock held */
+static int i2c_bus_next_prio(struct i2c_bus *bus)
+{
+	int prio;
+
+	if (bus->starve >= I2C_BULK_STARVE_LIMIT &&
+	    i2c_bus_waiting(bus, SWITCHTEC_I2C_PRIO_BULK))
+		return SWITCHTEC_I2C_PRIO_BULK;
+
+	for (prio = 0; prio < SWITCHTEC_I2C_PRIO_NUM; prio++)
+		if (i2c_bus_waiting(bus, prio))
+			return prio;
+
+	return -1;
+}
+
+static void i2c_bus_acquire(struct i2c_bus *bus, int prio)
+{
+	struct switchtec_i2c_prio_stats *st = &bus->stats[prio];
+	uint64_t ticket, start, wait;
+
+	pthread_mutex_lock(&bus->lock);
+
+	ticket = bus->queue[prio].tail++;
+	start = platform_time_us();
+
+	while (bus->busy || i2c_bus_next_prio(bus) != prio ||
+	       bus->queue[prio].head != ticket)
+		pthread_cond_wait(&bus->cond, &bus->lock);
+
+	bus->queue[prio].head++;
+	bus->busy = true;
+
+	if (prio != SWITCHTEC_I2C_PRIO_BULK &&
+	    i2c_bus_waiting(bus, SWITCHTEC_I2C_PRIO_BULK))
+		bus->starve++;
+	else
+		bus->starve = 0;
+
+	wait = platform_time_us() - start;
+	st->wait_us += wait;
+	if (wait > st->max_wait_us)
+		st->max_wait_us = wait;
+
+	pthread_mutex_unlock(&bus->lock);
+}
+
+static void i2c_bus_release(struct i2c_bus *bus, int prio, uint64_t busy_us,
+			    size_t bytes, int ret)
+{
+	struct switchtec_i2c_prio_stats *st = &bus->stats[prio];
+
+	pthread_mutex_lock(&bus->lock);
+
+	bus->busy = false;
+	bus->busy_us += busy_us;
+	st->busy_us += busy_us;
+	st->xfers++;
+	st->bytes += bytes;
+	if (ret < 0)
+		st->errors++;
+
+	pthread_cond_broadcast(&bus->cond);
+	pthread_mutex_unlock(&bus->lock);
+}
+
+/*
+ * Issue one I2C_RDWR transaction once the bus has been granted to this
+ * handle. Callers keep their retry delays outside of this so the bus is
+ * free for other handles while they sleep.
+ */
+static int i2c_xfer(struct switchtec_i2c *idev,
+		    struct i2c_rdwr_ioctl_data *rwdata)
+{
+	int prio = idev->prio;
+	uint64_t start;
+	size_t bytes = 0;
+	int i, ret, err;
+
+	for (i = 0; i < rwdata->nmsgs; i++)
+		bytes += rwdata->msgs[i].len;
+
+	i2c_bus_acquire(idev->bus, prio);
+
+	start = platform_time_us();
+	ret = ioctl(idev->fd, I2C_RDWR, rwdata);
+	err = errno;
+
+	i2c_bus_release(idev->bus, prio, platform_time_us() - start,
+			bytes, ret);
+
+	errno = err;
+	return ret;
+}
+
 #ifdef __CHECKER__
 #define __force __attribute__((force))
 #else
@@ -164,7 +399,9 @@ static void i2c_close(struct switchtec_dev *dev)
 	if (dev->gas_map)
 		munmap((void __force *)dev->gas_map, dev->gas_map_size);
 
+	i2c_bus_put(idev->bus);
 	close(idev->fd);
+	platform_dev_fini(dev);
 	free(idev);
 }
 
@@ -229,7 +466,7 @@ static uint8_t i2c_gas_cap_get(struct switchtec_dev *dev)
 	msgs[1].buf = rx_buf;
 
 	do {
-		ret = ioctl(idev->fd, I2C_RDWR, &rwdata);
+		ret = i2c_xfer(idev, &rwdata);
 		if (ret < 0)
 			goto i2c_ioctl_fail;
 
@@ -252,17 +489,6 @@ i2c_ioctl_fail:
 	return -1;
 }
 
-/*
- * One I2C transaction can write a maximum of 26 bytes, but it is better to
- * write the GAS with dword.
- */
-#define I2C_MAX_WRITE 24
-/*
- * One I2C transaction can read a maximum of 27 bytes, but it is better to
- * read GAS with dword.
- */
-#define I2C_MAX_READ 24
-
 static uint8_t i2c_gas_data_write(struct switchtec_dev *dev, void __gas *dest,
 				  const void *src, size_t n, uint8_t tag)
 {
@@ -287,7 +513,7 @@ static uint8_t i2c_gas_data_write(struct switchtec_dev *dev, void __gas *dest,
 	assert(n <= I2C_MAX_WRITE);
 
 	/* PEC is the last byte */
-	i2c_data = malloc(sizeof(*i2c_data) + n + PEC_BYTE_COUNT);
+	i2c_data = (void *)idev->tx_buf;
 
 	i2c_data->command_code = CMD_GAS_WRITE;
 	i2c_data->byte_count = (sizeof(i2c_data->tag)
@@ -306,16 +532,11 @@ static uint8_t i2c_gas_data_write(struct switchtec_dev *dev, void __gas *dest,
 	i2c_data->data[n] = i2c_msg_pec(&msg, msg.len - PEC_BYTE_COUNT, 0,
 					 true);
 
-	ret = ioctl(idev->fd, I2C_RDWR, &wdata);
+	ret = i2c_xfer(idev, &wdata);
 	if (ret < 0)
-		goto i2c_write_fail;
+		return -1;
 
-	free(i2c_data);
 	return 0;
-
-i2c_write_fail:
-	free(i2c_data);
-	return -1;
 }
 
 static uint8_t i2c_gas_write_status_get(struct switchtec_dev *dev,
@@ -345,7 +566,7 @@ static uint8_t i2c_gas_write_status_get(struct switchtec_dev *dev,
 	msgs[1].buf = rx_buf;
 
 	do {
-		ret = ioctl(idev->fd, I2C_RDWR, &rwdata);
+		ret = i2c_xfer(idev, &rwdata);
 		if (ret < 0) {
 			retry_count++;
 			/* Delay is typically only needed for BL1/2 phase */
@@ -461,9 +682,10 @@ static uint8_t i2c_gas_data_read(struct switchtec_dev *dev, void *dest,
 		uint8_t data_and_tail[];
 	}*read_response;
 
-	read_command = malloc(sizeof(*read_command));
-	read_response = malloc(sizeof(*read_response) + n \
-			       + DATA_TAIL_BYTE_COUNT);
+	assert(n <= I2C_MAX_READ);
+
+	read_command = (void *)idev->tx_buf;
+	read_response = (void *)idev->rx_buf;
 
 	msgs[0].addr = msgs[1].addr = idev->i2c_addr;
 	msgs[0].flags = 0;
@@ -483,9 +705,9 @@ static uint8_t i2c_gas_data_read(struct switchtec_dev *dev, void *dest,
 	msgs[1].buf = (uint8_t *)read_response;
 
 	do {
-		ret = ioctl(idev->fd, I2C_RDWR, &rwdata);
+		ret = i2c_xfer(idev, &rwdata);
 		if (ret < 0)
-			goto i2c_read_fail;
+			return -1;
 
 		msg_0_pec = i2c_msg_pec(&msgs[0], msgs[0].len, 0, true);
 		pec = i2c_msg_pec(&msgs[1], msgs[1].len - PEC_BYTE_COUNT, \
@@ -499,21 +721,14 @@ static uint8_t i2c_gas_data_read(struct switchtec_dev *dev, void *dest,
 	} while(retry_count < MAX_RETRY_COUNT);
 
 	if (retry_count == MAX_RETRY_COUNT)
-		goto i2c_read_fail;
+		return -1;
 
 	memcpy(dest, read_response->data_and_tail, n);
 	status_index = msgs[1].len - sizeof(read_response->byte_count) \
 		       - DATA_TAIL_BYTE_COUNT;
 	status = read_response->data_and_tail[ status_index ];
 
-	free(read_command);
-	free(read_response);
 	return status;
-
-i2c_read_fail:
-	free(read_command);
-	free(read_response);
-	return -1;
 }
 
 static void i2c_gas_read(struct switchtec_dev *dev, void *dest,
@@ -621,13 +836,18 @@ static const struct switchtec_ops i2c_ops = {
 	.gas_map = i2c_gas_map,
 
 	.cmd = gasop_cmd,
+	.cmd_submit = gasop_cmd_submit,
+	.cmd_poll = gasop_cmd_poll,
+	.cmd_complete = gasop_cmd_complete,
 	.get_device_id = gasop_get_device_id,
 	.get_fw_version = gasop_get_fw_version,
 	.pff_to_port = gasop_pff_to_port,
 	.port_to_pff = gasop_port_to_pff,
 	.flash_part = gasop_flash_part,
 	.event_summary = gasop_event_summary,
+	.event_summary_sparse = gasop_event_summary_sparse,
 	.event_ctl = gasop_event_ctl,
+	.event_block_ctl = gasop_event_block_ctl,
 	.event_wait_for = gasop_event_wait_for,
 
 	.gas_read8 = i2c_gas_read8,
@@ -662,21 +882,25 @@ struct switchtec_dev *switchtec_open_i2c(const char *path, int i2c_addr)
 	if (i2c_set_addr(idev, i2c_addr))
 		goto err_close_free;
 
-	if (i2c_set_timeout(idev, 10))
+	idev->prio = SWITCHTEC_I2C_PRIO_INTERACTIVE;
+	if (i2c_bus_get(idev))
 		goto err_close_free;
 
 	if (i2c_gas_cap_get(&idev->dev) != TWI_ENHANCED_MODE)
-		goto err_close_free;
+		goto err_put_bus;
 
 	if (map_gas(&idev->dev))
-		goto err_close_free;
+		goto err_put_bus;
 
+	platform_dev_init(&idev->dev);
 	idev->dev.ops = &i2c_ops;
 
 	gasop_set_partition_info(&idev->dev);
 
 	return &idev->dev;
 
+err_put_bus:
+	i2c_bus_put(idev->bus);
 err_close_free:
 	close(idev->fd);
 err_free:
@@ -693,4 +917,100 @@ struct switchtec_dev *switchtec_open_i2c_by_adapter(int adapter, int i2c_addr)
 	return switchtec_open_i2c(path, i2c_addr);
 }
 
+static struct switchtec_i2c *to_i2c_dev(struct switchtec_dev *dev)
+{
+	if (dev->ops != &i2c_ops) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+
+	return to_switchtec_i2c(dev);
+}
+
+/**
+ * @brief Set the bus scheduling class of an I2C device handle
+ * @param[in] dev	Switchtec device handle opened over I2C
+ * @param[in] prio	Class for subsequent transfers on this handle
+ * @return 0 on success, negative on failure
+ *
+ * Handles start out interactive. Mark a handle bulk before a long
+ * transfer, such as a firmware download, so health polls on the other
+ * switches sharing the adapter are not held up behind it.
+ */
+int switchtec_i2c_set_prio(struct switchtec_dev *dev,
+			   enum switchtec_i2c_prio prio)
+{
+	struct switchtec_i2c *idev = to_i2c_dev(dev);
+
+	if (!idev)
+		return -1;
+
+	if (prio < 0 || prio >= SWITCHTEC_I2C_PRIO_NUM) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	platform_lock(dev);
+	idev->prio = prio;
+	platform_unlock(dev);
+
+	return 0;
+}
+
+/**
+ * @brief Get utilization counters of the I2C adapter behind a handle
+ * @param[in]  dev	Switchtec device handle opened over I2C
+ * @param[out] stats	Counters for every handle sharing the adapter
+ * @return 0 on success, negative on failure
+ */
+int switchtec_i2c_bus_stats_get(struct switchtec_dev *dev,
+				struct switchtec_i2c_bus_stats *stats)
+{
+	struct switchtec_i2c *idev = to_i2c_dev(dev);
+	struct i2c_bus *bus;
+
+	if (!idev)
+		return -1;
+
+	bus = idev->bus;
+
+	pthread_mutex_lock(&i2c_buses_lock);
+	stats->handles = bus->refcnt;
+	pthread_mutex_unlock(&i2c_buses_lock);
+
+	stats->adapter = minor(bus->rdev);
+
+	pthread_mutex_lock(&bus->lock);
+	stats->elapsed_us = platform_time_us() - bus->stats_start_us;
+	stats->busy_us = bus->busy_us;
+	memcpy(stats->prio, bus->stats, sizeof(stats->prio));
+	pthread_mutex_unlock(&bus->lock);
+
+	return 0;
+}
+
+/**
+ * @brief Reset the utilization counters of the I2C adapter behind a handle
+ * @param[in] dev	Switchtec device handle opened over I2C
+ * @return 0 on success, negative on failure
+ */
+int switchtec_i2c_bus_stats_reset(struct switchtec_dev *dev)
+{
+	struct switchtec_i2c *idev = to_i2c_dev(dev);
+	struct i2c_bus *bus;
+
+	if (!idev)
+		return -1;
+
+	bus = idev->bus;
+
+	pthread_mutex_lock(&bus->lock);
+	bus->stats_start_us = platform_time_us();
+	bus->busy_us = 0;
+	memset(bus->stats, 0, sizeof(bus->stats));
+	pthread_mutex_unlock(&bus->lock);
+
+	return 0;
+}
+
 #endif
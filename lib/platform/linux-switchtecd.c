@@ -0,0 +1,641 @@
+/*
+ * Microsemi Switchtec(tm) PCIe Management Library
+ * Copyright (c) 2017, Microsemi Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifdef __linux__
+
+/*
+ * Client side of the switchtecd daemon. Every operation is forwarded
+ * over a unix socket to the daemon, which owns the device and keeps
+ * its probed state and caches warm between clients.
+ */
+
+#include "../switchtec_priv.h"
+#include "switchtec/switchtec.h"
+#include "gasops.h"
+#include "switchtecd.h"
+
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+/* Requests sent together in one window by the bulk operations */
+#define SD_MAX_BATCH 16
+
+struct sd_frame {
+	struct switchtecd_req hdr;
+	uint8_t data[SWITCHTECD_MAX_DATA];
+};
+
+struct switchtec_sd {
+	struct switchtec_dev dev;
+	int fd;
+
+	uint8_t tx_buf[SD_MAX_BATCH * sizeof(struct sd_frame)];
+	size_t tx_len;
+	int queued;
+};
+
+#define to_switchtec_sd(d)  \
+	((struct switchtec_sd *) \
+	((char *)d - offsetof(struct switchtec_sd, dev)))
+
+#ifdef __CHECKER__
+#define __force __attribute__((force))
+#else
+#define __force
+#endif
+
+static int sd_queue(struct switchtec_sd *sdev, uint32_t type, uint32_t arg,
+		    const void *data, size_t len, size_t resp_len)
+{
+	struct sd_frame *f = (void *)(sdev->tx_buf + sdev->tx_len);
+
+	if (len > sizeof(f->data) || resp_len > SWITCHTECD_MAX_DATA) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (sdev->queued == SD_MAX_BATCH) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	f->hdr.type = type;
+	f->hdr.arg = arg;
+	f->hdr.len = len;
+	f->hdr.resp_len = resp_len;
+	if (len)
+		memcpy(f->data, data, len);
+
+	sdev->tx_len += offsetof(struct sd_frame, data) + len;
+	sdev->queued++;
+
+	return 0;
+}
+
+static int sd_flush(struct switchtec_sd *sdev)
+{
+	size_t off = 0;
+	ssize_t ret;
+
+	while (off < sdev->tx_len) {
+		ret = send(sdev->fd, sdev->tx_buf + off, sdev->tx_len - off,
+			   MSG_NOSIGNAL);
+		if (ret < 0) {
+			sdev->tx_len = 0;
+			return -1;
+		}
+		off += ret;
+	}
+
+	sdev->tx_len = 0;
+	return 0;
+}
+
+static int sd_recv_all(int fd, void *buf, size_t len)
+{
+	ssize_t ret;
+
+	ret = recv(fd, buf, len, MSG_WAITALL);
+	if (ret < 0)
+		return -1;
+
+	if (ret != len) {
+		errno = ECONNRESET;
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Receive the response to the oldest queued request. Returns the
+ * daemon's result for the request, or -errno if it could not be
+ * received.
+ */
+static int sd_recv(struct switchtec_sd *sdev, void *out, size_t out_len)
+{
+	struct switchtecd_resp resp;
+	uint8_t discard[SWITCHTECD_MAX_DATA];
+
+	sdev->queued--;
+
+	if (sd_recv_all(sdev->fd, &resp, sizeof(resp)))
+		return -errno;
+
+	if (resp.len > SWITCHTECD_MAX_DATA) {
+		errno = ECONNRESET;
+		return -errno;
+	}
+
+	if (resp.len == out_len) {
+		if (out_len && sd_recv_all(sdev->fd, out, out_len))
+			return -errno;
+	} else if (resp.len) {
+		if (sd_recv_all(sdev->fd, discard, resp.len))
+			return -errno;
+	}
+
+	if (resp.ret < 0) {
+		errno = resp.err;
+		return -errno;
+	}
+
+	if (resp.ret == 0 && resp.len != out_len) {
+		errno = EIO;
+		return -errno;
+	}
+
+	if (resp.ret)
+		errno = resp.ret;
+
+	return resp.ret;
+}
+
+/* Drop responses still owed after a window was cut short */
+static void sd_drain(struct switchtec_sd *sdev)
+{
+	while (sdev->queued)
+		if (sd_recv(sdev, NULL, 0) == -ECONNRESET)
+			sdev->queued = 0;
+}
+
+static int sd_request(struct switchtec_sd *sdev, uint32_t type, uint32_t arg,
+		      const void *data, size_t len, void *out, size_t out_len)
+{
+	if (sd_queue(sdev, type, arg, data, len, out_len))
+		return -errno;
+
+	if (sd_flush(sdev)) {
+		sdev->queued = 0;
+		return -errno;
+	}
+
+	return sd_recv(sdev, out, out_len);
+}
+
+static int sd_cmd(struct switchtec_dev *dev, uint32_t cmd,
+		  const void *payload, size_t payload_len,
+		  void *resp, size_t resp_len)
+{
+	struct switchtec_sd *sdev = to_switchtec_sd(dev);
+
+	return sd_request(sdev, SWITCHTECD_REQ_CMD, cmd, payload,
+			  payload_len, resp, resp_len);
+}
+
+/*
+ * Send up to SD_MAX_BATCH commands at once. The daemon runs a window
+ * as a single batch on the device when no other client is waiting.
+ */
+static int sd_cmd_batch(struct switchtec_dev *dev,
+			struct switchtec_cmd_desc *cmds, int n)
+{
+	struct switchtec_sd *sdev = to_switchtec_sd(dev);
+	struct switchtec_cmd_desc *c;
+	int i, j, cnt;
+
+	for (i = 0; i < n; i += cnt) {
+		cnt = n - i < SD_MAX_BATCH ? n - i : SD_MAX_BATCH;
+
+		for (j = 0; j < cnt; j++) {
+			c = &cmds[i + j];
+			if (sd_queue(sdev, SWITCHTECD_REQ_CMD,
+				     platform_cmd_id(dev, c->cmd),
+				     c->payload, c->payload_len,
+				     c->resp_len)) {
+				cnt = j;
+				break;
+			}
+		}
+
+		if (!cnt)
+			return cmds[i].ret = -errno;
+
+		if (sd_flush(sdev)) {
+			sdev->queued = 0;
+			return cmds[i].ret = -errno;
+		}
+
+		for (j = 0; j < cnt; j++) {
+			c = &cmds[i + j];
+			c->ret = sd_recv(sdev, c->resp, c->resp_len);
+			if (c->ret == -ECONNRESET) {
+				sdev->queued = 0;
+				return c->ret;
+			}
+		}
+
+		for (j = 0; j < cnt; j++)
+			if (cmds[i + j].ret < 0)
+				return cmds[i + j].ret;
+	}
+
+	return 0;
+}
+
+static int sd_gas_read_exec(struct switchtec_sd *sdev, uint32_t offset,
+			    uint8_t *data, size_t n)
+{
+	size_t lens[SD_MAX_BATCH];
+	int i, cnt, ret = 0;
+	size_t len;
+
+	while (n) {
+		for (cnt = 0; cnt < SD_MAX_BATCH && n; cnt++) {
+			len = n > SWITCHTECD_MAX_DATA ? SWITCHTECD_MAX_DATA : n;
+			if (sd_queue(sdev, SWITCHTECD_REQ_GAS_READ, offset,
+				     NULL, 0, len))
+				break;
+
+			lens[cnt] = len;
+			offset += len;
+			n -= len;
+		}
+
+		if (!cnt || sd_flush(sdev)) {
+			sdev->queued = 0;
+			return -1;
+		}
+
+		for (i = 0; i < cnt; i++) {
+			if (sd_recv(sdev, data, lens[i]))
+				ret = -1;
+			data += lens[i];
+		}
+
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static int sd_gas_write_exec(struct switchtec_sd *sdev, uint32_t offset,
+			     const uint8_t *data, size_t n)
+{
+	int i, cnt, ret = 0;
+	size_t len;
+
+	while (n) {
+		for (cnt = 0; cnt < SD_MAX_BATCH && n; cnt++) {
+			len = n > SWITCHTECD_MAX_DATA ? SWITCHTECD_MAX_DATA : n;
+			if (sd_queue(sdev, SWITCHTECD_REQ_GAS_WRITE, offset,
+				     data, len, 0))
+				break;
+
+			offset += len;
+			data += len;
+			n -= len;
+		}
+
+		if (!cnt || sd_flush(sdev)) {
+			sdev->queued = 0;
+			return -1;
+		}
+
+		for (i = 0; i < cnt; i++)
+			if (sd_recv(sdev, NULL, 0))
+				ret = -1;
+
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+static void sd_gas_read(struct switchtec_dev *dev, void *dest,
+			const void __gas *src, size_t n)
+{
+	struct switchtec_sd *sdev = to_switchtec_sd(dev);
+	uint32_t gas_addr;
+
+	gas_addr = (uint32_t)(src - (void __gas *)dev->gas_map);
+	if (sd_gas_read_exec(sdev, gas_addr, dest, n)) {
+		sd_drain(sdev);
+		raise(SIGBUS);
+	}
+}
+
+static void sd_gas_write(struct switchtec_dev *dev, void __gas *dest,
+			 const void *src, size_t n)
+{
+	struct switchtec_sd *sdev = to_switchtec_sd(dev);
+	uint32_t gas_addr;
+
+	gas_addr = (uint32_t)(dest - (void __gas *)dev->gas_map);
+	if (sd_gas_write_exec(sdev, gas_addr, src, n)) {
+		sd_drain(sdev);
+		raise(SIGBUS);
+	}
+}
+
+static void sd_gas_write8(struct switchtec_dev *dev, uint8_t val,
+			  uint8_t __gas *addr)
+{
+	sd_gas_write(dev, addr, &val, sizeof(uint8_t));
+}
+
+static void sd_gas_write16(struct switchtec_dev *dev, uint16_t val,
+			   uint16_t __gas *addr)
+{
+	val = htole16(val);
+	sd_gas_write(dev, addr, &val, sizeof(uint16_t));
+}
+
+static void sd_gas_write32(struct switchtec_dev *dev, uint32_t val,
+			   uint32_t __gas *addr)
+{
+	val = htole32(val);
+	sd_gas_write(dev, addr, &val, sizeof(uint32_t));
+}
+
+static void sd_gas_write64(struct switchtec_dev *dev, uint64_t val,
+			   uint64_t __gas *addr)
+{
+	val = htole64(val);
+	sd_gas_write(dev, addr, &val, sizeof(uint64_t));
+}
+
+static void sd_memcpy_from_gas(struct switchtec_dev *dev, void *dest,
+			       const void __gas *src, size_t n)
+{
+	sd_gas_read(dev, dest, src, n);
+}
+
+static void sd_memcpy_to_gas(struct switchtec_dev *dev, void __gas *dest,
+			     const void *src, size_t n)
+{
+	sd_gas_write(dev, dest, src, n);
+}
+
+static ssize_t sd_write_from_gas(struct switchtec_dev *dev, int fd,
+				 const void __gas *src, size_t n)
+{
+	uint8_t buf[SWITCHTECD_MAX_DATA * SD_MAX_BATCH];
+	ssize_t ret = 0;
+	size_t cnt;
+
+	while (n) {
+		cnt = n > sizeof(buf) ? sizeof(buf) : n;
+		sd_memcpy_from_gas(dev, buf, src, cnt);
+		ret += write(fd, buf, cnt);
+
+		src += cnt;
+		n -= cnt;
+	}
+
+	return ret;
+}
+
+static uint8_t sd_gas_read8(struct switchtec_dev *dev, uint8_t __gas *addr)
+{
+	uint8_t val;
+
+	sd_gas_read(dev, &val, addr, sizeof(val));
+	return val;
+}
+
+static uint16_t sd_gas_read16(struct switchtec_dev *dev, uint16_t __gas *addr)
+{
+	uint16_t val;
+
+	sd_gas_read(dev, &val, addr, sizeof(val));
+	return le16toh(val);
+}
+
+static uint32_t sd_gas_read32(struct switchtec_dev *dev, uint32_t __gas *addr)
+{
+	uint32_t val;
+
+	sd_gas_read(dev, &val, addr, sizeof(val));
+	return le32toh(val);
+}
+
+static uint64_t sd_gas_read64(struct switchtec_dev *dev, uint64_t __gas *addr)
+{
+	uint64_t val;
+
+	sd_gas_read(dev, &val, addr, sizeof(val));
+	return le64toh(val);
+}
+
+/* The daemon keeps the PFF index, so lookups don't walk the GAS here */
+static int sd_pff_to_port(struct switchtec_dev *dev, int pff,
+			  int *partition, int *port)
+{
+	struct switchtec_sd *sdev = to_switchtec_sd(dev);
+	int32_t out[2];
+	int ret;
+
+	ret = sd_request(sdev, SWITCHTECD_REQ_PFF_TO_PORT, pff, NULL, 0,
+			 out, sizeof(out));
+	if (ret)
+		return ret;
+
+	if (partition)
+		*partition = out[0];
+	if (port)
+		*port = out[1];
+
+	return 0;
+}
+
+static int sd_port_to_pff(struct switchtec_dev *dev, int partition,
+			  int port, int *pff)
+{
+	struct switchtec_sd *sdev = to_switchtec_sd(dev);
+	int32_t out;
+	int ret;
+
+	ret = sd_request(sdev, SWITCHTECD_REQ_PORT_TO_PFF,
+			 (partition & 0xffff) << 16 | (port & 0xffff),
+			 NULL, 0, &out, sizeof(out));
+	if (ret)
+		return ret;
+
+	if (pff)
+		*pff = out;
+
+	return 0;
+}
+
+static void sd_close(struct switchtec_dev *dev)
+{
+	struct switchtec_sd *sdev = to_switchtec_sd(dev);
+
+	if (dev->gas_map)
+		munmap((void __force *)dev->gas_map, dev->gas_map_size);
+
+	close(sdev->fd);
+	platform_dev_fini(dev);
+	free(sdev);
+}
+
+static int map_gas(struct switchtec_dev *dev)
+{
+	void *addr;
+
+	/*
+	 * As with the other remote transports, reserve an inaccessible
+	 * range so a stray direct dereference faults instead of
+	 * touching random memory.
+	 */
+	addr = mmap(NULL, dev->gas_map_size, PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		return -1;
+
+	dev->gas_map = (gasptr_t __force)addr;
+
+	return 0;
+}
+
+static gasptr_t sd_gas_map(struct switchtec_dev *dev, int writeable,
+			   size_t *map_size)
+{
+	if (map_size)
+		*map_size = dev->gas_map_size;
+
+	return dev->gas_map;
+}
+
+static const struct switchtec_ops sd_ops = {
+	.flags = SWITCHTEC_OPS_FLAG_CMD_SHARED,
+	.close = sd_close,
+	.gas_map = sd_gas_map,
+	.cmd = sd_cmd,
+	.cmd_batch = sd_cmd_batch,
+	.get_device_id = gasop_get_device_id,
+	.get_fw_version = gasop_get_fw_version,
+	.pff_to_port = sd_pff_to_port,
+	.port_to_pff = sd_port_to_pff,
+	.flash_part = gasop_flash_part,
+	.event_summary = gasop_event_summary,
+	.event_summary_sparse = gasop_event_summary_sparse,
+	.event_ctl = gasop_event_ctl,
+	.event_block_ctl = gasop_event_block_ctl,
+
+	.gas_read8 = sd_gas_read8,
+	.gas_read16 = sd_gas_read16,
+	.gas_read32 = sd_gas_read32,
+	.gas_read64 = sd_gas_read64,
+	.gas_write8 = sd_gas_write8,
+	.gas_write16 = sd_gas_write16,
+	.gas_write32 = sd_gas_write32,
+	.gas_write32_no_retry = sd_gas_write32,
+	.gas_write64 = sd_gas_write64,
+	.memcpy_to_gas = sd_memcpy_to_gas,
+	.memcpy_from_gas = sd_memcpy_from_gas,
+	.write_from_gas = sd_write_from_gas,
+};
+
+static int sd_connect(const char *path)
+{
+	struct sockaddr_un addr = {
+		.sun_family = AF_UNIX,
+	};
+	int fd;
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+
+	fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+struct switchtec_dev *switchtec_open_daemon(const char *socket_path,
+					    const char *device)
+{
+	struct switchtecd_dev_info info;
+	struct switchtec_sd *sdev;
+	int ret;
+
+	if (!socket_path)
+		socket_path = getenv(SWITCHTECD_SOCKET_ENV);
+	if (!socket_path)
+		socket_path = SWITCHTECD_SOCKET_PATH;
+
+	sdev = calloc(1, sizeof(*sdev));
+	if (!sdev)
+		return NULL;
+
+	sdev->fd = sd_connect(socket_path);
+	if (sdev->fd < 0)
+		goto err_free;
+
+	ret = sd_request(sdev, SWITCHTECD_REQ_OPEN, SWITCHTECD_PROTO_VERSION,
+			 device, strlen(device) + 1, &info, sizeof(info));
+	if (ret) {
+		if (ret > 0)
+			errno = ENODEV;
+		goto err_close;
+	}
+
+	sdev->dev.gas_map_size = info.gas_map_size;
+	if (map_gas(&sdev->dev))
+		goto err_close;
+
+	platform_dev_init(&sdev->dev);
+	sdev->dev.ops = &sd_ops;
+
+	/* The daemon probed the device when it opened it */
+	sdev->dev.device_id = info.device_id;
+	sdev->dev.gen = info.gen;
+	sdev->dev.var = info.var;
+	sdev->dev.boot_phase = info.boot_phase;
+	sdev->dev.local_pax_id = info.local_pax_id;
+	sdev->dev.probed = true;
+
+	gasop_set_partition_info(&sdev->dev);
+
+	return &sdev->dev;
+
+err_close:
+	close(sdev->fd);
+err_free:
+	free(sdev);
+	return NULL;
+}
+
+#endif
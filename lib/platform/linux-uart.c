@@ -41,6 +41,8 @@
 #include <assert.h>
 #include <string.h>
 #include <stdarg.h>
+#include <ctype.h>
+#include <poll.h>
 
 #include <sys/file.h>
 #include <termios.h>
@@ -106,20 +108,36 @@
  * 	     0x00000000:0d93>
  */
 
+#define UART_MAX_WRITE_BYTES			100
+#define UART_MAX_READ_BYTES			1024
+#define UART_RX_BUF_LEN				8192
+#define UART_PIPELINE_DEPTH			4
+#define RETRY_NUM				3
+#define UART_DRAIN_IDLE_MS			100
+#define UART_DRAIN_MAX_MS			2000
+#define SWITCHTEC_UART_BAUDRATE			(B230400)
+
 struct switchtec_uart{
 	struct switchtec_dev dev;
 	int fd;
+
+	/*
+	 * Console output not yet consumed. With pipelining this may
+	 * hold the start of the replies to later commands.
+	 */
+	char rx_buf[UART_RX_BUF_LEN + 1];
+	size_t rx_len;
+	size_t rx_scan;
+	size_t resp_len;
+	char resp_next;
+
+	int pipeline_depth;
 };
 
 #define to_switchtec_uart(d) \
 	((struct switchtec_uart *) \
 	 ((char *)(d) - offsetof(struct switchtec_uart, dev)))
 
-#define UART_MAX_WRITE_BYTES			100
-#define UART_MAX_READ_BYTES			1024
-#define RETRY_NUM				3
-#define SWITCHTEC_UART_BAUDRATE			(B230400)
-
 static int send_cmd(int fd, const char *fmt, int write_bytes, ...)
 {
 	int ret;
@@ -163,41 +181,102 @@ static int send_cmd(int fd, const char *fmt, int write_bytes, ...)
 	return 0;
 }
 
-static int read_resp_line(int fd, char *str)
+/*
+ * Wait for the next reply, which ends with the prompt
+ * "0x12345678:1234>", and return it NUL terminated in *resp. The reply
+ * stays in the receive buffer until uart_resp_consume() is called.
+ */
+static int uart_resp_next(struct switchtec_uart *udev, char **resp)
 {
-	int ret;
-	int cnt = 0;
-
-	while(1) {
-		ret = read(fd, str + cnt, sizeof(str));
-		if (ret <= 0)
-			return ret;
+	char *buf = udev->rx_buf;
+	size_t i;
+	ssize_t ret;
 
-		cnt += ret;
-		str[cnt] = '\0';
+	while (1) {
+		for (i = udev->rx_scan; i < udev->rx_len; i++) {
+			if (buf[i] != '>' || i < 5 || buf[i - 5] != ':')
+				continue;
 
-		/* Prompt "0x12345678:1234>" */
-		if (strrchr(str, ':') + 5 == strrchr(str, '>'))
+			udev->resp_len = i + 1;
+			udev->resp_next = buf[i + 1];
+			buf[i + 1] = '\0';
+			*resp = buf;
 			return 0;
+		}
+		udev->rx_scan = udev->rx_len;
+
+		if (udev->rx_len == UART_RX_BUF_LEN) {
+			/* Not a reply we understand; drop it */
+			udev->rx_len = udev->rx_scan = 0;
+			errno = EPROTO;
+			return -1;
+		}
+
+		ret = read(udev->fd, buf + udev->rx_len,
+			   UART_RX_BUF_LEN - udev->rx_len);
+		if (ret < 0)
+			return ret;
+		if (ret == 0) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+
+		udev->rx_len += ret;
 	}
+}
 
-	return -1;
+static void uart_resp_consume(struct switchtec_uart *udev)
+{
+	char *buf = udev->rx_buf;
+
+	if (!udev->resp_len)
+		return;
+
+	buf[udev->resp_len] = udev->resp_next;
+	udev->rx_len -= udev->resp_len;
+	memmove(buf, buf + udev->resp_len, udev->rx_len);
+	udev->rx_scan = 0;
+	udev->resp_len = 0;
+}
+
+/*
+ * Throw away everything received so far, e.g. after a lost reply. With
+ * pipelining the console may still be answering commands sent before
+ * the failure, so keep discarding until the line has been idle for a
+ * while.
+ */
+static void uart_resp_flush(struct switchtec_uart *udev)
+{
+	struct pollfd pfd = { .fd = udev->fd, .events = POLLIN };
+	uint64_t end = platform_time_us() + UART_DRAIN_MAX_MS * 1000ULL;
+	char buf[256];
+
+	tcflush(udev->fd, TCIFLUSH);
+
+	while (platform_time_us() < end &&
+	       poll(&pfd, 1, UART_DRAIN_IDLE_MS) > 0)
+		if (read(udev->fd, buf, sizeof(buf)) <= 0)
+			break;
+
+	udev->rx_len = udev->rx_scan = udev->resp_len = 0;
 }
 
 static int cli_control(struct switchtec_dev *dev, const char *str)
 {
 	int ret;
-	char rtn[1024];
+	char *rtn;
 	struct switchtec_uart *udev = to_switchtec_uart(dev);
 
 	ret = send_cmd(udev->fd, str, 0);
 	if (ret)
 		return ret;
 
-	ret =  read_resp_line(udev->fd, rtn);
+	ret = uart_resp_next(udev, &rtn);
 	if (ret)
 		return ret;
 
+	uart_resp_consume(udev);
+
 	return 0;
 }
 
@@ -218,6 +297,7 @@ static void uart_close(struct switchtec_dev *dev)
 
 	flock(udev->fd, LOCK_UN);
 	close(udev->fd);
+	platform_dev_fini(dev);
 	free(udev);
 }
 
@@ -247,82 +327,238 @@ static gasptr_t uart_gas_map(struct switchtec_dev *dev, int writeable,
 	return dev->gas_map;
 }
 
-static void uart_gas_read(struct switchtec_dev *dev, void *dest,
-				const void __gas *src, size_t n)
+static int hex_digit(char c)
 {
-	int ret;
-	int raddr, rnum, rcrc;
-	int i, j;
-	char *pos;
-	struct switchtec_uart *udev = to_switchtec_uart(dev);
-	uint32_t addr = (uint32_t)(src - (void __gas *)dev->gas_map);
-	uint8_t *ptr = dest;
-	uint8_t cal;
-	char gas_rd_rtn[4096];
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
 
-	for (i = 0; i < RETRY_NUM; i++) {
-		ret =  send_cmd(udev->fd, "gasrd -c -s 0x%x %zu\r", 0, addr, n);
-		if (ret)
-			continue;
+static const char *parse_hex(const char *pos, uint32_t *val)
+{
+	int d;
 
-		ret = read_resp_line(udev->fd, gas_rd_rtn);
-		if (ret)
-			continue;
+	*val = 0;
+	if (hex_digit(*pos) < 0)
+		return NULL;
 
-		/* case 3 */
-		if (strstr(gas_rd_rtn, "No access beyond the Total GAS Section")){
-			memset(dest, 0xff, n);
-			break;
-		}
-		/* case 2 */
-		if (strchr(gas_rd_rtn, ',')) {
-			if (sscanf(gas_rd_rtn,
-				 "%*[^<]<0x%x> [%d Byte]%*[^,],%*[^:]: 0x"
-				 "%x%*[^:]:",
-				  &raddr, &rnum, &rcrc) != 3)
-			continue;
-		} else {
-			/* case 1 */
-			if (sscanf(gas_rd_rtn,
-				 "%*[^<]<0x%x> [%d Byte]%*[^:]: 0x%x%*[^:]:",
-				  &raddr, &rnum, &rcrc) != 3)
+	while ((d = hex_digit(*pos)) >= 0) {
+		*val = *val << 4 | d;
+		pos++;
+	}
+
+	return pos;
+}
+
+/*
+ * Decode the reply to "gasrd -c -s <addr> <n>" (see the examples at the
+ * top of this file) into dest.
+ * Returns 0 on success, 1 if the range is outside the GAS, 2 if it is
+ * the reply to a read of another range and -1 if it is malformed.
+ */
+static int parse_gas_rd(const char *resp, uint32_t addr, uint8_t *dest,
+			size_t n, uint8_t *crc)
+{
+	const char *pos, *line, *next, *end;
+	uint32_t raddr, rnum, rcrc;
+	int hi, lo;
+	size_t i;
+
+	if (strstr(resp, "No access beyond the Total GAS Section"))
+		return 1;
+
+	pos = strstr(resp, "<0x");
+	if (!pos)
+		return -1;
+
+	pos = parse_hex(pos + 3, &raddr);
+	if (!pos || *pos != '>')
+		return -1;
+
+	pos = strchr(pos, '[');
+	if (!pos)
+		return -1;
+
+	rnum = strtoul(pos + 1, (char **)&pos, 10);
+	if (raddr != addr || rnum != n)
+		return 2;
+
+	end = strstr(pos, "CRC: 0x");
+	if (!end || !parse_hex(end + 7, &rcrc))
+		return -1;
+	*crc = rcrc;
+
+	/*
+	 * The data follows the header, possibly on several lines and
+	 * after other informational lines such as "[PFF] cs addr: ...".
+	 */
+	i = 0;
+	for (pos = strchr(pos, '\n'); pos && pos < end; pos = next) {
+		next = strchr(++pos, '\n');
+		if (!next || next > end)
+			next = end;
+
+		for (line = pos; line < next; line++)
+			if (!isxdigit((unsigned char)*line) &&
+			    !isspace((unsigned char)*line))
+				break;
+		if (line != next)
 			continue;
+
+		for (line = pos; line < next && i < n; ) {
+			if (isspace((unsigned char)*line)) {
+				line++;
+				continue;
+			}
+
+			hi = hex_digit(line[0]);
+			lo = hex_digit(line[1]);
+			if (hi < 0 || lo < 0)
+				return -1;
+
+			dest[i++] = hi << 4 | lo;
+			line += 2;
 		}
+	}
 
-		if ((raddr != addr) || (rnum != n))
-			continue;
+	if (i != n)
+		return -1;
 
-		pos = strchr(gas_rd_rtn, ']');
-		if (strchr(gas_rd_rtn, ','))
-			pos = strchr(gas_rd_rtn, ',') + strlen("not hit");
-		else
-			pos += 2;
+	return 0;
+}
+
+static int send_gas_rd(struct switchtec_uart *udev, uint32_t addr, size_t n)
+{
+	return send_cmd(udev->fd, "gasrd -c -s 0x%x %zu\r", 0, addr, n);
+}
+
+/* Read and check the reply to a gasrd command already sent */
+static int recv_gas_rd(struct switchtec_uart *udev, void *dest,
+		       uint32_t addr, size_t n)
+{
+	uint32_t be_addr = htobe32(addr);
+	uint8_t cal, crc = 0;
+	char *resp;
+	int ret, stale = 0;
+
+	/*
+	 * Skip stale replies to reads from an earlier, abandoned window;
+	 * they may still arrive after a flush.
+	 */
+	do {
+		ret = uart_resp_next(udev, &resp);
+		if (ret)
+			return ret;
 
-		for (j = 0; j < n; j++)
-			*ptr++ = strtol(pos, &pos, 16);
+		ret = parse_gas_rd(resp, addr, dest, n, &crc);
+		uart_resp_consume(udev);
+	} while (ret == 2 && ++stale <= UART_PIPELINE_DEPTH);
 
-		addr = htobe32(addr);
-		cal = crc8((uint8_t *)&addr, sizeof(addr), 0, true);
-		cal = crc8(dest, n, cal, false);
-		if (cal == rcrc)
+	if (ret == 1) {
+		memset(dest, 0xff, n);
+		return 0;
+	} else if (ret) {
+		errno = EPROTO;
+		return -1;
+	}
+
+	cal = crc8((uint8_t *)&be_addr, sizeof(be_addr), 0, true);
+	cal = crc8(dest, n, cal, false);
+	if (cal != crc) {
+		errno = EIO;
+		return -1;
+	}
+
+	return 0;
+}
+
+static void uart_gas_read(struct switchtec_dev *dev, void *dest,
+			  const void __gas *src, size_t n)
+{
+	int i;
+	struct switchtec_uart *udev = to_switchtec_uart(dev);
+	uint32_t addr = (uint32_t)(src - (void __gas *)dev->gas_map);
+
+	for (i = 0; i < RETRY_NUM; i++) {
+		if (send_gas_rd(udev, addr, n))
+			continue;
+
+		if (!recv_gas_rd(udev, dest, addr, n))
 			break;
+
+		uart_resp_flush(udev);
 	}
 
 	if (i == RETRY_NUM)
 		raise(SIGBUS);
 }
 
+/*
+ * Keep up to pipeline_depth reads outstanding so the console turns
+ * around the next command while the previous reply is still being
+ * received. If anything goes wrong the window is flushed and re-read
+ * one chunk at a time, and pipelining is turned off for this handle
+ * in case the firmware drops input while it is busy.
+ */
 static void uart_memcpy_from_gas(struct switchtec_dev *dev, void *dest,
-				const void __gas *src, size_t n)
+				 const void __gas *src, size_t n)
 {
-	ssize_t cnt;
+	struct switchtec_uart *udev = to_switchtec_uart(dev);
+	uint32_t addr = (uint32_t)(src - (void __gas *)dev->gas_map);
+	size_t sent, recvd, cnt;
+	int failed = 0;
+
+	while (n) {
+		sent = 0;
+		while (sent < n && sent < udev->pipeline_depth *
+		       UART_MAX_READ_BYTES) {
+			cnt = n - sent;
+			if (cnt > UART_MAX_READ_BYTES)
+				cnt = UART_MAX_READ_BYTES;
+			if (send_gas_rd(udev, addr + sent, cnt)) {
+				failed = 1;
+				break;
+			}
+			sent += cnt;
+		}
 
-	while(n) {
-		cnt = n > UART_MAX_READ_BYTES? UART_MAX_READ_BYTES : n;
-		uart_gas_read(dev, dest, src, cnt);
-		dest += cnt;
-		src += cnt;
-		n -= cnt;
+		for (recvd = 0; !failed && recvd < sent; recvd += cnt) {
+			cnt = sent - recvd;
+			if (cnt > UART_MAX_READ_BYTES)
+				cnt = UART_MAX_READ_BYTES;
+			if (recv_gas_rd(udev, dest + recvd, addr + recvd, cnt))
+				failed = 1;
+		}
+
+		if (failed) {
+			uart_resp_flush(udev);
+			udev->pipeline_depth = 1;
+			failed = 0;
+
+			for (recvd = 0; recvd < sent; recvd += cnt) {
+				cnt = sent - recvd;
+				if (cnt > UART_MAX_READ_BYTES)
+					cnt = UART_MAX_READ_BYTES;
+				uart_gas_read(dev, dest + recvd,
+					      src + recvd, cnt);
+			}
+
+			if (!sent) {
+				cnt = n > UART_MAX_READ_BYTES ?
+					UART_MAX_READ_BYTES : n;
+				uart_gas_read(dev, dest, src, cnt);
+				sent = cnt;
+			}
+		}
+
+		dest += sent;
+		src += sent;
+		addr += sent;
+		n -= sent;
 	}
 }
 
@@ -344,7 +580,7 @@ static void uart_gas_write(struct switchtec_dev *dev, void __gas *dest,
 {
 	int ret;
 	int i;
-	char gas_wr_rtn[4096];
+	char *gas_wr_rtn;
 	uint32_t crc;
 	uint32_t cal, exp;
 	struct switchtec_uart *udev =  to_switchtec_uart(dev);
@@ -362,24 +598,31 @@ static void uart_gas_write(struct switchtec_dev *dev, void __gas *dest,
 		if (ret)
 			continue;
 
-		ret = read_resp_line(udev->fd, gas_wr_rtn);
-		if (ret)
+		ret = uart_resp_next(udev, &gas_wr_rtn);
+		if (ret) {
+			uart_resp_flush(udev);
 			continue;
+		}
 
 		/* case 4 */
-		if (strstr(gas_wr_rtn, "Error with gas_reg_write()"))
+		if (strstr(gas_wr_rtn, "Error with gas_reg_write()")) {
+			uart_resp_consume(udev);
 			break;
+		}
 		/* case 2 */
 		if (strchr(gas_wr_rtn, ',')) {
-			if (sscanf(gas_wr_rtn, "%*[^,],%*[^:]: [0x%x/0x%x]%*[^:]:",
-				   &cal, &exp) != 2)
-				continue;
+			ret = sscanf(gas_wr_rtn,
+				     "%*[^,],%*[^:]: [0x%x/0x%x]%*[^:]:",
+				     &cal, &exp);
 		} else {
 			/* case 1 and case 3 */
-			if (sscanf(gas_wr_rtn, "%*[^:]: [0x%x/0x%x]%*[^:]:",
-				   &cal, &exp) != 2)
-				continue;
+			ret = sscanf(gas_wr_rtn, "%*[^:]: [0x%x/0x%x]%*[^:]:",
+				     &cal, &exp);
 		}
+		uart_resp_consume(udev);
+
+		if (ret != 2)
+			continue;
 		if ((exp == cal) && (cal == crc))
 			break;
 	}
@@ -437,13 +680,18 @@ static const struct switchtec_ops uart_ops = {
 	.gas_map = uart_gas_map,
 
 	.cmd = gasop_cmd,
+	.cmd_submit = gasop_cmd_submit,
+	.cmd_poll = gasop_cmd_poll,
+	.cmd_complete = gasop_cmd_complete,
 	.get_device_id = gasop_get_device_id,
 	.get_fw_version = gasop_get_fw_version,
 	.pff_to_port = gasop_pff_to_port,
 	.port_to_pff = gasop_port_to_pff,
 	.flash_part = gasop_flash_part,
 	.event_summary = gasop_event_summary,
+	.event_summary_sparse = gasop_event_summary_sparse,
 	.event_ctl = gasop_event_ctl,
+	.event_block_ctl = gasop_event_block_ctl,
 	.event_wait_for = gasop_event_wait_for,
 
 	.gas_read8 = uart_gas_read8,
@@ -507,6 +755,13 @@ struct switchtec_dev *switchtec_open_uart(int fd)
 	if (udev->fd < 0)
 		goto err_free;
 
+	udev->rx_len = udev->rx_scan = udev->resp_len = 0;
+	udev->pipeline_depth = UART_PIPELINE_DEPTH;
+	if (getenv("SWITCHTEC_UART_PIPELINE"))
+		udev->pipeline_depth = atoi(getenv("SWITCHTEC_UART_PIPELINE"));
+	if (udev->pipeline_depth < 1)
+		udev->pipeline_depth = 1;
+
 	ret = flock(udev->fd, LOCK_EX | LOCK_NB);
 	if (ret)
 		goto err_close_free;
@@ -526,6 +781,7 @@ struct switchtec_dev *switchtec_open_uart(int fd)
 	if (map_gas(&udev->dev))
 		goto err_close_free;
 
+	platform_dev_init(&udev->dev);
 	udev->dev.ops = &uart_ops;
 	gasop_set_partition_info(&udev->dev);
 	return &udev->dev;
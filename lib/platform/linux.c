@@ -35,17 +35,21 @@
 
 #include <linux/switchtec_ioctl.h>
 
+#include <linux/netlink.h>
+
 #include <unistd.h>
 #include <fcntl.h>
 #include <endian.h>
 #include <dirent.h>
 #include <libgen.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/sysmacros.h>
 #include <glob.h>
 #include <poll.h>
+#include <pthread.h>
 
 #include <errno.h>
 #include <string.h>
@@ -112,6 +116,244 @@ static long long sysfs_read_int(const char *path, int base)
 	return strtoll(buf, NULL, base);
 }
 
+/*
+ * Per-process index of what switchtec_list() and linux_get_devices()
+ * find in sysfs. Building it takes directory scans, globs and realpath()
+ * calls for every port, so the results are kept until a kernel uevent
+ * for a PCI or switchtec device arrives on a NETLINK_KOBJECT_UEVENT
+ * socket. sysfs doesn't reliably update directory times when devices
+ * come and go, so if the socket can't be opened nothing is cached.
+ * Setting SWITCHTEC_SYSFS_CACHE=0 disables the index.
+ *
+ * Attributes that change without a uevent (the firmware version and
+ * the ACS control register) are always read directly.
+ */
+struct sysfs_port_ent {
+	int log_id;
+	bool upstream;
+	char *pci_bdf;
+	char *pci_bdf_path;
+	char *pci_dev;
+	char *class_devices;
+	int vendor_id;
+	int device_id;
+};
+
+struct sysfs_dev_ent {
+	char syspath[PATH_MAX];
+	char searchpath[PATH_MAX];
+	int nr_ports;
+	struct sysfs_port_ent *ports;
+};
+
+static struct {
+	pthread_mutex_t lock;
+	pid_t pid;
+	int sock;
+	bool unavailable;
+
+	bool list_valid;
+	int list_cnt;
+	struct switchtec_device_info *list;
+
+	int nr_devs;
+	struct sysfs_dev_ent *devs;
+} sysfs_idx = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.sock = -1,
+};
+
+static void sysfs_index_flush(void)
+{
+	int i, j;
+
+	for (i = 0; i < sysfs_idx.nr_devs; i++) {
+		for (j = 0; j < sysfs_idx.devs[i].nr_ports; j++) {
+			free(sysfs_idx.devs[i].ports[j].pci_bdf);
+			free(sysfs_idx.devs[i].ports[j].pci_bdf_path);
+			free(sysfs_idx.devs[i].ports[j].pci_dev);
+			free(sysfs_idx.devs[i].ports[j].class_devices);
+		}
+		free(sysfs_idx.devs[i].ports);
+	}
+
+	free(sysfs_idx.devs);
+	sysfs_idx.devs = NULL;
+	sysfs_idx.nr_devs = 0;
+
+	free(sysfs_idx.list);
+	sysfs_idx.list = NULL;
+	sysfs_idx.list_cnt = 0;
+	sysfs_idx.list_valid = false;
+}
+
+static int sysfs_index_open(void)
+{
+	struct sockaddr_nl addr = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = 1,
+	};
+	int sock;
+
+	sock = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+		      NETLINK_KOBJECT_UEVENT);
+	if (sock < 0)
+		return -1;
+
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr))) {
+		close(sock);
+		return -1;
+	}
+
+	return sock;
+}
+
+/* Returns true if the uevent message is for a device we index */
+static bool sysfs_uevent_relevant(const char *msg, size_t len)
+{
+	size_t off;
+
+	for (off = 0; off < len; off += strlen(msg + off) + 1) {
+		if (!strcmp(msg + off, "SUBSYSTEM=pci") ||
+		    !strcmp(msg + off, "SUBSYSTEM=switchtec"))
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Take the index lock and drop anything stale. Returns true if the
+ * index may be used; the lock is held either way.
+ */
+static bool sysfs_index_lock(void)
+{
+	char msg[4096];
+	const char *env;
+	ssize_t len;
+
+	pthread_mutex_lock(&sysfs_idx.lock);
+
+	env = getenv("SWITCHTEC_SYSFS_CACHE");
+	if (env && !strcmp(env, "0"))
+		return false;
+
+	/* A forked child shares the parent's socket, so start over */
+	if (sysfs_idx.pid != getpid()) {
+		if (sysfs_idx.sock >= 0)
+			close(sysfs_idx.sock);
+		sysfs_idx.sock = -1;
+		sysfs_idx.unavailable = false;
+		sysfs_idx.pid = getpid();
+		sysfs_index_flush();
+	}
+
+	if (sysfs_idx.unavailable)
+		return false;
+
+	if (sysfs_idx.sock < 0) {
+		sysfs_idx.sock = sysfs_index_open();
+		if (sysfs_idx.sock < 0) {
+			sysfs_idx.unavailable = true;
+			return false;
+		}
+	}
+
+	while (true) {
+		len = recv(sysfs_idx.sock, msg, sizeof(msg) - 1, MSG_DONTWAIT);
+		if (len < 0) {
+			/* Dropped events (ENOBUFS) may have been relevant */
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				sysfs_index_flush();
+			break;
+		}
+
+		msg[len] = 0;
+		if (sysfs_uevent_relevant(msg, len))
+			sysfs_index_flush();
+	}
+
+	errno = 0;
+	return true;
+}
+
+static void sysfs_index_unlock(void)
+{
+	pthread_mutex_unlock(&sysfs_idx.lock);
+}
+
+static struct sysfs_dev_ent *sysfs_index_dev(const char *syspath)
+{
+	struct sysfs_dev_ent *devs, *d;
+	int i;
+
+	for (i = 0; i < sysfs_idx.nr_devs; i++)
+		if (!strcmp(sysfs_idx.devs[i].syspath, syspath))
+			return &sysfs_idx.devs[i];
+
+	devs = realloc(sysfs_idx.devs,
+		       (sysfs_idx.nr_devs + 1) * sizeof(*devs));
+	if (!devs)
+		return NULL;
+
+	sysfs_idx.devs = devs;
+	d = &devs[sysfs_idx.nr_devs++];
+	memset(d, 0, sizeof(*d));
+	snprintf(d->syspath, sizeof(d->syspath), "%s", syspath);
+
+	return d;
+}
+
+static struct sysfs_port_ent *sysfs_dev_port(struct sysfs_dev_ent *d,
+					     int log_id, bool upstream)
+{
+	int i;
+
+	for (i = 0; i < d->nr_ports; i++)
+		if (d->ports[i].log_id == log_id &&
+		    d->ports[i].upstream == upstream)
+			return &d->ports[i];
+
+	return NULL;
+}
+
+static char *strdup_null(const char *s)
+{
+	return s ? strdup(s) : NULL;
+}
+
+static void sysfs_dev_add_port(struct sysfs_dev_ent *d,
+			       const struct switchtec_status *status)
+{
+	struct sysfs_port_ent *ports, *pe;
+
+	ports = realloc(d->ports, (d->nr_ports + 1) * sizeof(*ports));
+	if (!ports)
+		return;
+
+	d->ports = ports;
+	pe = &ports[d->nr_ports++];
+	pe->log_id = status->port.log_id;
+	pe->upstream = status->port.upstream;
+	pe->pci_bdf = strdup_null(status->pci_bdf);
+	pe->pci_bdf_path = strdup_null(status->pci_bdf_path);
+	pe->pci_dev = strdup_null(status->pci_dev);
+	pe->class_devices = strdup_null(status->class_devices);
+	pe->vendor_id = status->vendor_id;
+	pe->device_id = status->device_id;
+}
+
+static void sysfs_port_copy(struct switchtec_status *status,
+			    const struct sysfs_port_ent *pe)
+{
+	status->pci_bdf = strdup_null(pe->pci_bdf);
+	status->pci_bdf_path = strdup_null(pe->pci_bdf_path);
+	status->pci_dev = strdup_null(pe->pci_dev);
+	status->class_devices = strdup_null(pe->class_devices);
+	status->vendor_id = pe->vendor_id;
+	status->device_id = pe->device_id;
+}
+
 static int check_switchtec_device(struct switchtec_linux *ldev)
 {
 	int ret;
@@ -160,6 +402,7 @@ static void linux_close(struct switchtec_dev *dev)
 	struct switchtec_linux *ldev = to_switchtec_linux(dev);
 
 	close(ldev->fd);
+	platform_dev_fini(dev);
 	free(ldev);
 }
 
@@ -210,7 +453,51 @@ unknown_version:
 	snprintf(buf, buflen, "unknown");
 }
 
-int switchtec_list(struct switchtec_device_info **devlist)
+static int switchtec_list_cached(struct switchtec_device_info **devlist)
+{
+	struct switchtec_device_info *dl;
+	char link_path[PATH_MAX];
+	int i, n = sysfs_idx.list_cnt;
+
+	if (!n)
+		return 0;
+
+	dl = *devlist = calloc(n, sizeof(*dl));
+	if (!dl) {
+		errno = ENOMEM;
+		return -errno;
+	}
+
+	memcpy(dl, sysfs_idx.list, n * sizeof(*dl));
+
+	for (i = 0; i < n; i++) {
+		snprintf(link_path, sizeof(link_path), "%s/%s",
+			 sys_path, dl[i].name);
+		get_fw_version(link_path, dl[i].fw_version,
+			       sizeof(dl[i].fw_version));
+	}
+
+	return n;
+}
+
+static void switchtec_list_store(struct switchtec_device_info *dl, int n)
+{
+	free(sysfs_idx.list);
+	sysfs_idx.list = NULL;
+
+	if (n) {
+		sysfs_idx.list = malloc(n * sizeof(*dl));
+		if (!sysfs_idx.list)
+			return;
+
+		memcpy(sysfs_idx.list, dl, n * sizeof(*dl));
+	}
+
+	sysfs_idx.list_cnt = n;
+	sysfs_idx.list_valid = true;
+}
+
+static int __switchtec_list(struct switchtec_device_info **devlist)
 {
 	struct dirent **devices;
 	int i, n;
@@ -265,6 +552,24 @@ int switchtec_list(struct switchtec_device_info **devlist)
 	return n;
 }
 
+int switchtec_list(struct switchtec_device_info **devlist)
+{
+	bool cached;
+	int n;
+
+	cached = sysfs_index_lock();
+	if (cached && sysfs_idx.list_valid) {
+		n = switchtec_list_cached(devlist);
+	} else {
+		n = __switchtec_list(devlist);
+		if (cached && n >= 0)
+			switchtec_list_store(n ? *devlist : NULL, n);
+	}
+	sysfs_index_unlock();
+
+	return n;
+}
+
 static int linux_get_device_id(struct switchtec_dev *dev)
 {
 	int ret;
@@ -353,27 +658,101 @@ static int read_resp(struct switchtec_linux *ldev, void *resp,
 	return ret;
 }
 
-static int linux_cmd(struct switchtec_dev *dev,  uint32_t cmd,
-		     const void *payload, size_t payload_len, void *resp,
-		     size_t resp_len)
+static int linux_cmd_submit(struct switchtec_dev *dev, uint32_t cmd,
+			    const void *payload, size_t payload_len,
+			    size_t resp_len)
 {
 	int ret;
 	struct switchtec_linux *ldev = to_switchtec_linux(dev);
 
 retry:
 	ret = submit_cmd(ldev, cmd, payload, payload_len);
-	if (errno == EBADE) {
+	if (ret < 0 && errno == EBADE) {
 		read_resp(ldev, NULL, 0);
 		errno = 0;
 		goto retry;
 	}
 
+	return ret;
+}
+
+static int linux_cmd_poll(struct switchtec_dev *dev)
+{
+	struct switchtec_linux *ldev = to_switchtec_linux(dev);
+	struct pollfd fds = {
+		.fd = ldev->fd,
+		.events = POLLIN,
+	};
+	int ret;
+
+	ret = poll(&fds, 1, 0);
 	if (ret < 0)
-		return ret;
+		return -errno;
+
+	return !!(fds.revents & POLLIN);
+}
+
+static int linux_cmd_poll_fd(struct switchtec_dev *dev)
+{
+	struct switchtec_linux *ldev = to_switchtec_linux(dev);
+
+	return ldev->fd;
+}
+
+static int linux_cmd_complete(struct switchtec_dev *dev, void *resp,
+			      size_t resp_len)
+{
+	struct switchtec_linux *ldev = to_switchtec_linux(dev);
 
 	return read_resp(ldev, resp, resp_len);
 }
 
+/* Called directly by switchtec_cmd() in single transport builds */
+#ifndef SWITCHTEC_SINGLE_TRANSPORT_LINUX
+static
+#endif
+int linux_cmd(struct switchtec_dev *dev,  uint32_t cmd,
+	      const void *payload, size_t payload_len, void *resp,
+	      size_t resp_len)
+{
+	int ret;
+
+	ret = linux_cmd_submit(dev, cmd, payload, payload_len, resp_len);
+	if (ret < 0)
+		return ret;
+
+	return linux_cmd_complete(dev, resp, resp_len);
+}
+
+static int linux_cmd_batch(struct switchtec_dev *dev,
+			   struct switchtec_cmd_desc *cmds, int n)
+{
+	struct switchtec_cmd_desc *c;
+	int i, ret;
+
+	for (i = 0; i < n; i++) {
+		c = &cmds[i];
+
+		ret = linux_cmd_submit(dev, platform_cmd_id(dev, c->cmd),
+				       c->payload, c->payload_len,
+				       c->resp_len);
+		if (ret < 0) {
+			c->ret = -errno;
+			return c->ret;
+		}
+
+		ret = linux_cmd_complete(dev, c->resp, c->resp_len);
+		if (ret < 0) {
+			c->ret = -errno;
+			return c->ret;
+		}
+
+		c->ret = ret;
+	}
+
+	return 0;
+}
+
 static int get_class_devices(const char *searchpath,
 			     struct switchtec_status *status)
 {
@@ -565,19 +944,32 @@ static int linux_get_devices(struct switchtec_dev *dev,
 	char syspath[PATH_MAX];
 	char searchpath[PATH_MAX];
 	struct switchtec_linux *ldev = to_switchtec_linux(dev);
+	struct sysfs_dev_ent *d = NULL;
+	struct sysfs_port_ent *pe;
 
 	ret = dev_to_sysfs_path(ldev, "device", syspath,
 				sizeof(syspath));
 	if (ret)
 		return ret;
 
-	if (!realpath(syspath, searchpath)) {
-		errno = ENXIO;
-		return -errno;
-	}
+	if (sysfs_index_lock())
+		d = sysfs_index_dev(syspath);
 
-	//Replace eg "0000:03:00.1" into "0000:03:00.0"
-	searchpath[strlen(searchpath) - 1] = '0';
+	if (d && d->searchpath[0]) {
+		memcpy(searchpath, d->searchpath, sizeof(searchpath));
+	} else {
+		if (!realpath(syspath, searchpath)) {
+			sysfs_index_unlock();
+			errno = ENXIO;
+			return -errno;
+		}
+
+		//Replace eg "0000:03:00.1" into "0000:03:00.0"
+		searchpath[strlen(searchpath) - 1] = '0';
+
+		if (d)
+			memcpy(d->searchpath, searchpath, sizeof(searchpath));
+	}
 
 	local_part = switchtec_partition(dev);
 
@@ -585,18 +977,38 @@ static int linux_get_devices(struct switchtec_dev *dev,
 		if (status[i].port.partition != local_part)
 			continue;
 
+		pe = d ? sysfs_dev_port(d, status[i].port.log_id,
+					status[i].port.upstream) : NULL;
+
 		if (status[i].port.upstream) {
+			if (pe) {
+				sysfs_port_copy(&status[i], pe);
+				continue;
+			}
+
 			status[i].pci_bdf = strdup(basename(searchpath));
 			get_port_bdf_path(&status[i]);
+			if (d)
+				sysfs_dev_add_port(d, &status[i]);
 			continue;
 		}
 
-		get_port_bdf(searchpath, status[i].port.log_id - 1, &status[i]);
-		get_port_bdf_path(&status[i]);
-		get_port_info(&status[i]);
+		if (pe) {
+			sysfs_port_copy(&status[i], pe);
+		} else {
+			get_port_bdf(searchpath, status[i].port.log_id - 1,
+				     &status[i]);
+			get_port_bdf_path(&status[i]);
+			get_port_info(&status[i]);
+			if (d)
+				sysfs_dev_add_port(d, &status[i]);
+		}
+
 		get_config_info(&status[i]);
 	}
 
+	sysfs_index_unlock();
+
 	return 0;
 }
 
@@ -967,11 +1379,25 @@ static int linux_event_wait(struct switchtec_dev *dev, int timeout_ms)
 	return 0;
 }
 
+static int linux_event_wait_fd(struct switchtec_dev *dev, short *events)
+{
+	struct switchtec_linux *ldev = to_switchtec_linux(dev);
+
+	*events = POLLPRI;
+	return ldev->fd;
+}
+
 static const struct switchtec_ops linux_ops = {
+	.flags = SWITCHTEC_OPS_FLAG_CMD_SHARED,
 	.close = linux_close,
 	.get_device_id = linux_get_device_id,
 	.get_fw_version = linux_get_fw_version,
 	.cmd = linux_cmd,
+	.cmd_batch = linux_cmd_batch,
+	.cmd_submit = linux_cmd_submit,
+	.cmd_poll = linux_cmd_poll,
+	.cmd_poll_fd = linux_cmd_poll_fd,
+	.cmd_complete = linux_cmd_complete,
 	.get_devices = linux_get_devices,
 	.pff_to_port = linux_pff_to_port,
 	.port_to_pff = linux_port_to_pff,
@@ -981,6 +1407,7 @@ static const struct switchtec_ops linux_ops = {
 	.event_summary = linux_event_summary,
 	.event_ctl = linux_event_ctl,
 	.event_wait = linux_event_wait,
+	.event_wait_fd = linux_event_wait_fd,
 
 	.gas_read8 = mmap_gas_read8,
 	.gas_read16 = mmap_gas_read16,
@@ -1022,6 +1449,7 @@ struct switchtec_dev *switchtec_open_by_path(const char *path)
 	if (get_partition(ldev))
 		goto err_close_free;
 
+	platform_dev_init(&ldev->dev);
 	ldev->dev.ops = &linux_ops;
 
 	return &ldev->dev;
@@ -1092,4 +1520,70 @@ err_out:
 	return NULL;
 }
 
+#ifdef SWITCHTEC_SINGLE_TRANSPORT_LINUX
+
+/*
+ * The other transports are left out of single transport builds; their
+ * entry points remain so applications still link against the library.
+ */
+
+struct switchtec_dev *switchtec_open_i2c(const char *path, int i2c_addr)
+{
+	errno = ENOTSUP;
+	return NULL;
+}
+
+struct switchtec_dev *switchtec_open_i2c_by_adapter(int adapter, int i2c_addr)
+{
+	errno = ENOTSUP;
+	return NULL;
+}
+
+int switchtec_i2c_set_prio(struct switchtec_dev *dev,
+			   enum switchtec_i2c_prio prio)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
+int switchtec_i2c_bus_stats_get(struct switchtec_dev *dev,
+				struct switchtec_i2c_bus_stats *stats)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
+int switchtec_i2c_bus_stats_reset(struct switchtec_dev *dev)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
+struct switchtec_dev *switchtec_open_uart(int fd)
+{
+	errno = ENOTSUP;
+	return NULL;
+}
+
+struct switchtec_dev *switchtec_open_eth(const char *ip, const int inst)
+{
+	errno = ENOTSUP;
+	return NULL;
+}
+
+struct switchtec_dev *switchtec_open_daemon(const char *socket_path,
+					    const char *device)
+{
+	errno = ENOTSUP;
+	return NULL;
+}
+
+struct switchtec_dev *switchtec_open_sim(const char *options)
+{
+	errno = ENOTSUP;
+	return NULL;
+}
+
+#endif
+
 #endif
@@ -43,27 +43,168 @@
 
 #include "../switchtec_priv.h"
 
-static void mmap_memcpy_to_gas(struct switchtec_dev *dev, void __gas *dest,
-			       const void *src, size_t n)
+/*
+ * The GAS is uncached device memory. libc's memcpy() picks whatever
+ * access widths suit it: byte accesses at unaligned ends, SIMD loads
+ * wider than the device handles, or a register split over two reads.
+ * These copy with naturally aligned accesses of at most 64 bits
+ * (32 bits on 32-bit hosts), so every register no wider than that is
+ * accessed exactly once and in one piece.
+ *
+ * Streaming (non-temporal) SIMD loads only help on write-combining
+ * mappings; the GAS is mapped uncached, where they would just be
+ * split up again, so they aren't used.
+ */
+#if UINTPTR_MAX == UINT64_MAX
+#define MMIO_COPY_64
+#endif
+
+static inline void mmio_copy_from(void *dest, const volatile void *src,
+				  size_t n)
+{
+	const volatile uint8_t *s = src;
+	uint8_t *d = dest;
+	uint64_t v64;
+	uint32_t v32;
+	uint16_t v16;
+
+	if (n && ((uintptr_t)s & 1)) {
+		*d++ = *s++;
+		n--;
+	}
+
+	if (n >= 2 && ((uintptr_t)s & 2)) {
+		v16 = *(const volatile uint16_t *)s;
+		memcpy(d, &v16, 2);
+		s += 2; d += 2; n -= 2;
+	}
+
+#ifdef MMIO_COPY_64
+	if (n >= 4 && ((uintptr_t)s & 4)) {
+		v32 = *(const volatile uint32_t *)s;
+		memcpy(d, &v32, 4);
+		s += 4; d += 4; n -= 4;
+	}
+
+	for (; n >= 8; s += 8, d += 8, n -= 8) {
+		v64 = *(const volatile uint64_t *)s;
+		memcpy(d, &v64, 8);
+	}
+#else
+	(void)v64;
+#endif
+
+	for (; n >= 4; s += 4, d += 4, n -= 4) {
+		v32 = *(const volatile uint32_t *)s;
+		memcpy(d, &v32, 4);
+	}
+
+	if (n >= 2) {
+		v16 = *(const volatile uint16_t *)s;
+		memcpy(d, &v16, 2);
+		s += 2; d += 2; n -= 2;
+	}
+
+	if (n)
+		*d = *s;
+}
+
+static inline void mmio_copy_to(volatile void *dest, const void *src,
+				size_t n)
+{
+	volatile uint8_t *d = dest;
+	const uint8_t *s = src;
+	uint64_t v64;
+	uint32_t v32;
+	uint16_t v16;
+
+	if (n && ((uintptr_t)d & 1)) {
+		*d++ = *s++;
+		n--;
+	}
+
+	if (n >= 2 && ((uintptr_t)d & 2)) {
+		memcpy(&v16, s, 2);
+		*(volatile uint16_t *)d = v16;
+		s += 2; d += 2; n -= 2;
+	}
+
+#ifdef MMIO_COPY_64
+	if (n >= 4 && ((uintptr_t)d & 4)) {
+		memcpy(&v32, s, 4);
+		*(volatile uint32_t *)d = v32;
+		s += 4; d += 4; n -= 4;
+	}
+
+	for (; n >= 8; s += 8, d += 8, n -= 8) {
+		memcpy(&v64, s, 8);
+		*(volatile uint64_t *)d = v64;
+	}
+#else
+	(void)v64;
+#endif
+
+	for (; n >= 4; s += 4, d += 4, n -= 4) {
+		memcpy(&v32, s, 4);
+		*(volatile uint32_t *)d = v32;
+	}
+
+	if (n >= 2) {
+		memcpy(&v16, s, 2);
+		*(volatile uint16_t *)d = v16;
+		s += 2; d += 2; n -= 2;
+	}
+
+	if (n)
+		*d = *s;
+}
+
+static inline void mmap_memcpy_to_gas(struct switchtec_dev *dev,
+				      void __gas *dest, const void *src,
+				      size_t n)
 {
-	memcpy((void __force *)dest, src, n);
+	mmio_copy_to((void __force *)dest, src, n);
 }
 
-static void mmap_memcpy_from_gas(struct switchtec_dev *dev, void *dest,
-				 const void __gas *src, size_t n)
+static inline void mmap_memcpy_from_gas(struct switchtec_dev *dev, void *dest,
+					const void __gas *src, size_t n)
 {
-	memcpy(dest, (void __force *)src, n);
+	mmio_copy_from(dest, (const void __force *)src, n);
 }
 
-static ssize_t mmap_write_from_gas(struct switchtec_dev *dev, int fd,
-				   const void __gas *src, size_t n)
+/*
+ * Bounce through a buffer rather than handing the mapping to write():
+ * the kernel's copy from user memory has the same width problems as
+ * memcpy() and holds up the write on every uncached load.
+ */
+static inline ssize_t mmap_write_from_gas(struct switchtec_dev *dev, int fd,
+					  const void __gas *src, size_t n)
 {
-	return write(fd, (void __force *)src, n);
+	uint8_t buf[16384];
+	ssize_t ret, total = 0;
+	size_t cnt, off;
+
+	while (n) {
+		cnt = n > sizeof(buf) ? sizeof(buf) : n;
+		mmio_copy_from(buf, (const void __force *)src, cnt);
+
+		for (off = 0; off < cnt; off += ret) {
+			ret = write(fd, buf + off, cnt - off);
+			if (ret < 0)
+				return total ? total : ret;
+			total += ret;
+		}
+
+		src += cnt;
+		n -= cnt;
+	}
+
+	return total;
 }
 
 #define create_gas_read(type, suffix) \
-	static type mmap_gas_read ## suffix(struct switchtec_dev *dev, \
-					    type __gas *addr) \
+	static inline type mmap_gas_read ## suffix( \
+		struct switchtec_dev *dev, type __gas *addr) \
 	{ \
 		type *safe_addr = (type __force *)addr; \
 		asm volatile("": : :"memory"); \
@@ -71,8 +212,8 @@ static ssize_t mmap_write_from_gas(struct switchtec_dev *dev, int fd,
 	}
 
 #define create_gas_write(type, suffix) \
-	static void mmap_gas_write ## suffix(struct switchtec_dev *dev, \
-					     type val, type __gas *addr) \
+	static inline void mmap_gas_write ## suffix( \
+		struct switchtec_dev *dev, type val, type __gas *addr) \
 	{ \
 		type *safe_addr = (type __force *)addr; \
 		asm volatile("": : :"memory"); \
@@ -89,6 +230,17 @@ create_gas_write(uint16_t, 16);
 create_gas_write(uint32_t, 32);
 create_gas_write(uint64_t, 64);
 
+#undef create_gas_read
+#undef create_gas_write
+
+/* A store to the mapping can't fail, so there is nothing to retry */
+static inline void mmap_gas_write32_no_retry(struct switchtec_dev *dev,
+					     uint32_t val,
+					     uint32_t __gas *addr)
+{
+	mmap_gas_write32(dev, val, addr);
+}
+
 #undef __force
 
 #endif
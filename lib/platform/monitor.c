@@ -0,0 +1,653 @@
+/*
+ * Microsemi Switchtec(tm) PCIe Management Library
+ * Copyright (c) 2025, Microsemi Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * @file
+ * @brief Wait for events on many devices at once
+ *
+ * A monitor holds a set of device handles and blocks until any of them
+ * reports an event. Devices with a waitable object (the character
+ * device's POLLPRI on Linux, the event socket on Ethernet, an overlapped
+ * wait request on Windows) are waited on with a single epoll_wait() or
+ * GetQueuedCompletionStatus() call. On Windows a device whose handle
+ * can't be associated with the monitor's I/O completion port falls back
+ * to WaitForMultipleObjects(), which is limited to MAXIMUM_WAIT_OBJECTS
+ * handles. Transports without one (I2C, UART) are polled by reading the
+ * event summary at a fixed interval.
+ */
+
+#include "../switchtec_priv.h"
+#include "switchtec/switchtec.h"
+#include "switchtec/portable.h"
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/epoll.h>
+#endif
+
+#define MONITOR_DEFAULT_POLL_MS 50
+#define MONITOR_EPOLL_BATCH 16
+
+enum monitor_kind {
+	MONITOR_POLLED,
+	MONITOR_FD,
+	MONITOR_HANDLE,
+	MONITOR_PORT,
+};
+
+struct monitor_dev {
+	struct switchtec_dev *dev;
+	struct switchtec_event_summary mask;
+	bool all;
+	void *data;
+
+	enum monitor_kind kind;
+	bool ready;
+	int error;
+	uint64_t next_poll_us;
+};
+
+struct switchtec_monitor {
+	struct monitor_dev **devs;
+	int nr_devs;
+	int alloc_devs;
+	int nr_handles;
+	int next_dev;
+	int poll_interval_ms;
+#if defined(__linux__)
+	int epfd;
+#elif defined(__WINDOWS__)
+	HANDLE port;
+#endif
+};
+
+/**
+ * @brief Create an empty event monitor
+ * @ingroup Event
+ * @returns The new monitor or NULL on failure
+ *
+ * A monitor must only be used by one thread at a time.
+ */
+struct switchtec_monitor *switchtec_monitor_new(void)
+{
+	struct switchtec_monitor *mon;
+
+	mon = calloc(1, sizeof(*mon));
+	if (!mon)
+		return NULL;
+
+	mon->poll_interval_ms = MONITOR_DEFAULT_POLL_MS;
+
+#ifdef __linux__
+	mon->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (mon->epfd < 0) {
+		free(mon);
+		return NULL;
+	}
+#elif defined(__WINDOWS__)
+	/* Without a port every device uses an event handle */
+	mon->port = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 1);
+#endif
+
+	return mon;
+}
+
+/**
+ * @brief Free a monitor created with switchtec_monitor_new()
+ * @ingroup Event
+ * @param[in] mon	Monitor to free
+ *
+ * The registered devices are not closed.
+ */
+void switchtec_monitor_free(struct switchtec_monitor *mon)
+{
+	if (!mon)
+		return;
+
+	while (mon->nr_devs)
+		switchtec_monitor_remove(mon, mon->devs[0]->dev);
+
+#if defined(__linux__)
+	close(mon->epfd);
+#elif defined(__WINDOWS__)
+	if (mon->port)
+		CloseHandle(mon->port);
+#endif
+	free(mon->devs);
+	free(mon);
+}
+
+/**
+ * @brief Set how often devices without a waitable object are polled
+ * @ingroup Event
+ * @param[in] mon		Monitor
+ * @param[in] interval_ms	Milliseconds between event summary reads
+ */
+void switchtec_monitor_set_poll_interval(struct switchtec_monitor *mon,
+					 int interval_ms)
+{
+	if (interval_ms < 1)
+		interval_ms = 1;
+
+	mon->poll_interval_ms = interval_ms;
+}
+
+static struct monitor_dev **monitor_find(struct switchtec_monitor *mon,
+					 struct switchtec_dev *dev)
+{
+	int i;
+
+	for (i = 0; i < mon->nr_devs; i++)
+		if (mon->devs[i]->dev == dev)
+			return &mon->devs[i];
+
+	return NULL;
+}
+
+static int monitor_attach(struct switchtec_monitor *mon,
+			  struct monitor_dev *mdev)
+{
+	struct switchtec_dev *dev = mdev->dev;
+
+#if defined(__linux__)
+	struct epoll_event ev = {
+		.data.ptr = mdev,
+	};
+	short events = 0;
+	int fd;
+
+	if (!dev->ops->event_wait_fd)
+		return 0;
+
+	fd = dev->ops->event_wait_fd(dev, &events);
+	if (fd < 0)
+		return 0;
+
+	if (events & POLLPRI)
+		ev.events |= EPOLLPRI;
+	if (events & POLLIN)
+		ev.events |= EPOLLIN;
+
+	if (epoll_ctl(mon->epfd, EPOLL_CTL_ADD, fd, &ev))
+		return -errno;
+
+	mdev->kind = MONITOR_FD;
+#elif defined(__WINDOWS__)
+	if (!dev->ops->event_wait_arm)
+		return 0;
+
+	/*
+	 * The device itself is the completion key: packets for a device
+	 * that has since been removed are then simply not found.
+	 */
+	if (mon->port && dev->ops->event_wait_port &&
+	    !dev->ops->event_wait_port(dev, mon->port, (uintptr_t)dev)) {
+		mdev->kind = MONITOR_PORT;
+		return 0;
+	}
+
+	if (mon->nr_handles >= MAXIMUM_WAIT_OBJECTS) {
+		errno = E2BIG;
+		return -errno;
+	}
+
+	mon->nr_handles++;
+	mdev->kind = MONITOR_HANDLE;
+#endif
+
+	return 0;
+}
+
+static void monitor_detach(struct switchtec_monitor *mon,
+			   struct monitor_dev *mdev)
+{
+	struct switchtec_dev *dev = mdev->dev;
+
+#if defined(__linux__)
+	short events;
+
+	if (mdev->kind == MONITOR_FD)
+		epoll_ctl(mon->epfd, EPOLL_CTL_DEL,
+			  dev->ops->event_wait_fd(dev, &events), NULL);
+#elif defined(__WINDOWS__)
+	if (mdev->kind == MONITOR_HANDLE) {
+		if (dev->ops->event_wait_disarm)
+			dev->ops->event_wait_disarm(dev);
+		mon->nr_handles--;
+	} else if (mdev->kind == MONITOR_PORT) {
+		dev->ops->event_wait_port(dev, NULL, 0);
+	}
+#endif
+	mdev->kind = MONITOR_POLLED;
+}
+
+/**
+ * @brief Add a device to a monitor
+ * @ingroup Event
+ * @param[in] mon	Monitor
+ * @param[in] dev	Switchtec device handle
+ * @param[in] mask	Events to report for this device (NULL for all)
+ * @param[in] data	Opaque pointer returned with this device's events
+ * @returns 0 on success, negative on failure
+ *
+ * A device may only be registered with one monitor at a time.
+ */
+int switchtec_monitor_add(struct switchtec_monitor *mon,
+			  struct switchtec_dev *dev,
+			  const struct switchtec_event_summary *mask,
+			  void *data)
+{
+	struct monitor_dev *mdev, **devs;
+	int ret;
+
+	if (monitor_find(mon, dev)) {
+		errno = EEXIST;
+		return -errno;
+	}
+
+	if (mon->nr_devs == mon->alloc_devs) {
+		devs = realloc(mon->devs, (mon->alloc_devs * 2 + 8) *
+			       sizeof(*devs));
+		if (!devs)
+			return -errno;
+		mon->devs = devs;
+		mon->alloc_devs = mon->alloc_devs * 2 + 8;
+	}
+
+	mdev = calloc(1, sizeof(*mdev));
+	if (!mdev)
+		return -errno;
+
+	mdev->dev = dev;
+	mdev->data = data;
+	mdev->kind = MONITOR_POLLED;
+	if (mask)
+		mdev->mask = *mask;
+	else
+		mdev->all = true;
+
+	ret = monitor_attach(mon, mdev);
+	if (ret) {
+		free(mdev);
+		return ret;
+	}
+
+	mon->devs[mon->nr_devs++] = mdev;
+
+	return 0;
+}
+
+/**
+ * @brief Remove a device from a monitor
+ * @ingroup Event
+ * @param[in] mon	Monitor
+ * @param[in] dev	Switchtec device handle
+ * @returns 0 on success, negative if the device was not registered
+ */
+int switchtec_monitor_remove(struct switchtec_monitor *mon,
+			     struct switchtec_dev *dev)
+{
+	struct monitor_dev **slot;
+	int idx;
+
+	slot = monitor_find(mon, dev);
+	if (!slot) {
+		errno = ENOENT;
+		return -errno;
+	}
+
+	monitor_detach(mon, *slot);
+	free(*slot);
+
+	idx = slot - mon->devs;
+	memmove(slot, slot + 1, (mon->nr_devs - idx - 1) * sizeof(*slot));
+	mon->nr_devs--;
+	if (mon->next_dev >= mon->nr_devs)
+		mon->next_dev = 0;
+
+	return 0;
+}
+
+static int summary_mask(struct switchtec_event_summary *sum,
+			const struct switchtec_event_summary *mask)
+{
+	int i, any;
+
+	sum->global &= mask->global;
+	sum->part_bitmap &= mask->part_bitmap;
+	sum->local_part &= mask->local_part;
+	any = sum->global || sum->part_bitmap || sum->local_part;
+
+	for (i = 0; i < SWITCHTEC_MAX_PARTS; i++) {
+		sum->part[i] &= mask->part[i];
+		any |= !!sum->part[i];
+	}
+
+	for (i = 0; i < SWITCHTEC_MAX_PFF_CSR; i++) {
+		sum->pff[i] &= mask->pff[i];
+		any |= !!sum->pff[i];
+	}
+
+	return any;
+}
+
+static int summary_any(const struct switchtec_event_summary *sum)
+{
+	struct switchtec_event_summary tmp = *sum;
+
+	return summary_mask(&tmp, sum);
+}
+
+/*
+ * Read the summary of every device that signalled or is due for a poll
+ * and fill in \p evts for those with events in their mask. Devices left
+ * over when \p evts is full stay ready for the next call; the scan
+ * starts where the previous one stopped so no device is starved.
+ */
+static int monitor_collect(struct switchtec_monitor *mon,
+			   struct switchtec_monitor_event *evts, int max,
+			   uint64_t now)
+{
+	struct switchtec_event_summary sum;
+	struct monitor_dev *mdev;
+	int i, nr = 0, idx, ret;
+
+	for (i = 0; i < mon->nr_devs && nr < max; i++) {
+		idx = (mon->next_dev + i) % mon->nr_devs;
+		mdev = mon->devs[idx];
+
+		if (mdev->kind == MONITOR_POLLED && !mdev->error &&
+		    now >= mdev->next_poll_us) {
+			mdev->next_poll_us = now +
+				mon->poll_interval_ms * 1000ULL;
+			mdev->ready = true;
+		}
+
+		if (!mdev->ready)
+			continue;
+		mdev->ready = false;
+
+		if (mdev->error) {
+			ret = -1;
+			errno = mdev->error;
+		} else {
+			if (mdev->kind == MONITOR_FD)
+				mdev->dev->ops->event_wait(mdev->dev, 0);
+			ret = switchtec_event_summary(mdev->dev, &sum);
+		}
+
+		if (ret) {
+			evts[nr].dev = mdev->dev;
+			evts[nr].data = mdev->data;
+			evts[nr].error = errno;
+			memset(&evts[nr].sum, 0, sizeof(sum));
+			nr++;
+			continue;
+		}
+
+		if (mdev->all ? !summary_any(&sum) :
+		    !summary_mask(&sum, &mdev->mask))
+			continue;
+
+		evts[nr].dev = mdev->dev;
+		evts[nr].data = mdev->data;
+		evts[nr].error = 0;
+		evts[nr].sum = sum;
+		nr++;
+	}
+
+	if (mon->nr_devs)
+		mon->next_dev = (mon->next_dev + i) % mon->nr_devs;
+
+	return nr;
+}
+
+static int monitor_poll_wait_ms(struct switchtec_monitor *mon, uint64_t now,
+				int wait_ms)
+{
+	int64_t due;
+	int i;
+
+	for (i = 0; i < mon->nr_devs; i++) {
+		if (mon->devs[i]->kind != MONITOR_POLLED)
+			continue;
+
+		due = (int64_t)(mon->devs[i]->next_poll_us - now) / 1000;
+		if (due < 0)
+			due = 0;
+		if (wait_ms < 0 || due < wait_ms)
+			wait_ms = due;
+	}
+
+	return wait_ms;
+}
+
+#if defined(__linux__)
+
+static int monitor_block(struct switchtec_monitor *mon, int wait_ms)
+{
+	struct epoll_event evs[MONITOR_EPOLL_BATCH];
+	struct monitor_dev *mdev;
+	int i, n;
+
+	n = epoll_wait(mon->epfd, evs, MONITOR_EPOLL_BATCH, wait_ms);
+	if (n < 0)
+		return errno == EINTR ? 0 : -errno;
+
+	for (i = 0; i < n; i++) {
+		mdev = evs[i].data.ptr;
+		mdev->ready = true;
+
+		if (evs[i].events & (EPOLLERR | EPOLLHUP)) {
+			mdev->error = ENODEV;
+			monitor_detach(mon, mdev);
+		}
+	}
+
+	return 0;
+}
+
+#elif defined(__WINDOWS__)
+
+/*
+ * Dequeue every packet on the completion port, waiting up to \p wait_ms
+ * for the first one, and mark the devices they belong to as ready.
+ * Cancelled requests also queue a packet; reading the summary of such
+ * a device is harmless.
+ */
+static int monitor_port_wait(struct switchtec_monitor *mon, int wait_ms)
+{
+	struct monitor_dev **slot;
+	OVERLAPPED *overlap;
+	ULONG_PTR key;
+	DWORD transferred;
+	int n = 0;
+
+	while (1) {
+		if (!GetQueuedCompletionStatus(mon->port, &transferred, &key,
+					       &overlap, n ? 0 :
+					       (wait_ms < 0 ? INFINITE :
+						(DWORD)wait_ms)) &&
+		    !overlap) {
+			if (GetLastError() == WAIT_TIMEOUT)
+				return n;
+			errno = EIO;
+			return -errno;
+		}
+
+		slot = monitor_find(mon, (struct switchtec_dev *)key);
+		if (slot && (*slot)->kind == MONITOR_PORT)
+			(*slot)->ready = true;
+		n++;
+	}
+}
+
+static int monitor_block(struct switchtec_monitor *mon, int wait_ms)
+{
+	HANDLE handles[MAXIMUM_WAIT_OBJECTS];
+	struct monitor_dev *devs[MAXIMUM_WAIT_OBJECTS];
+	struct monitor_dev *mdev;
+	int i, n = 0, nr_port = 0, rc;
+	HANDLE event;
+	DWORD ret;
+
+	for (i = 0; i < mon->nr_devs; i++) {
+		mdev = mon->devs[i];
+		if (mdev->kind != MONITOR_HANDLE && mdev->kind != MONITOR_PORT)
+			continue;
+
+		/* Port devices are armed so their next event is queued */
+		event = mdev->dev->ops->event_wait_arm(mdev->dev);
+		if (!event) {
+			mdev->error = EIO;
+			mdev->ready = true;
+			monitor_detach(mon, mdev);
+			continue;
+		}
+
+		if (mdev->kind == MONITOR_PORT) {
+			nr_port++;
+			continue;
+		}
+
+		handles[n] = event;
+		devs[n++] = mdev;
+	}
+
+	if (!n && !nr_port) {
+		Sleep(wait_ms < 0 ? INFINITE : wait_ms);
+		return 0;
+	}
+
+	if (!n) {
+		rc = monitor_port_wait(mon, wait_ms);
+		return rc < 0 ? rc : 0;
+	}
+
+	/*
+	 * A completion port can't be waited on together with event
+	 * handles, so when both are in use the port is checked on either
+	 * side of a handle wait bounded by the poll interval.
+	 */
+	if (nr_port) {
+		rc = monitor_port_wait(mon, 0);
+		if (rc < 0)
+			return rc;
+		if (rc)
+			wait_ms = 0;
+		else if (wait_ms < 0 || wait_ms > mon->poll_interval_ms)
+			wait_ms = mon->poll_interval_ms;
+	}
+
+	ret = WaitForMultipleObjects(n, handles, FALSE,
+				     wait_ms < 0 ? INFINITE : wait_ms);
+	if (ret == WAIT_FAILED) {
+		errno = EIO;
+		return -errno;
+	}
+
+	if (nr_port) {
+		rc = monitor_port_wait(mon, 0);
+		if (rc < 0)
+			return rc;
+	}
+
+	/* Only the first signalled handle is reported, check the rest */
+	for (i = 0; i < n; i++)
+		if (WaitForSingleObject(handles[i], 0) == WAIT_OBJECT_0)
+			devs[i]->ready = true;
+
+	return 0;
+}
+
+#else
+
+static int monitor_block(struct switchtec_monitor *mon, int wait_ms)
+{
+	if (wait_ms < 0)
+		wait_ms = MONITOR_DEFAULT_POLL_MS;
+
+	usleep(wait_ms * 1000);
+	return 0;
+}
+
+#endif
+
+/**
+ * @brief Wait for events on any device registered with a monitor
+ * @ingroup Event
+ * @param[in]  mon		Monitor
+ * @param[out] evts		Devices that have pending events
+ * @param[in]  max		Number of entries in \p evts
+ * @param[in]  timeout_ms	Timeout in milliseconds (-1 to wait forever)
+ * @returns The number of entries filled in \p evts, 0 on timeout, or
+ *	negative on failure
+ *
+ * The summary in each entry only lists the events in the device's mask.
+ * A device whose handle fails is reported with \p error set; it should
+ * be removed from the monitor.
+ */
+int switchtec_monitor_wait(struct switchtec_monitor *mon,
+			   struct switchtec_monitor_event *evts, int max,
+			   int timeout_ms)
+{
+	uint64_t now, deadline = 0;
+	int nr, ret, wait_ms;
+
+	if (max < 1) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	now = platform_time_us();
+	if (timeout_ms >= 0)
+		deadline = now + timeout_ms * 1000ULL;
+
+	while (1) {
+		nr = monitor_collect(mon, evts, max, now);
+		if (nr)
+			return nr;
+
+		now = platform_time_us();
+		wait_ms = -1;
+		if (timeout_ms >= 0) {
+			if (now >= deadline)
+				return 0;
+			wait_ms = (deadline - now + 999) / 1000;
+		}
+
+		wait_ms = monitor_poll_wait_ms(mon, now, wait_ms);
+
+		ret = monitor_block(mon, wait_ms);
+		if (ret)
+			return ret;
+
+		now = platform_time_us();
+	}
+}
@@ -93,6 +93,52 @@ struct switchtec_dev *switchtec_open_uart(int fd);
  */
 struct switchtec_dev *switchtec_open_eth(const char *ip, const int inst);
 
+/**
+ * @brief Open a switchtec device through the switchtecd daemon
+ * @ingroup Device
+ * @param[in] socket_path	path to the daemon's socket, or NULL for the
+ *				SWITCHTECD_SOCKET environment variable or
+ *				the default /run/switchtecd.sock
+ * @param[in] device		device string the daemon should open, in
+ *				any form accepted by switchtec_open()
+ * @return Switchtec device handle, NULL on failure
+ *
+ * The daemon owns the device and serves every client from one handle,
+ * so its probed state and GAS cache stay warm between invocations and
+ * concurrent tools take turns instead of contending for the link.
+ * switchtec_open() uses this for device strings of the form
+ * "switchtecd:<device>".
+ */
+struct switchtec_dev *switchtec_open_daemon(const char *socket_path,
+					    const char *device);
+
+/**
+ * @brief Open a simulated switchtec device held in memory
+ * @ingroup Device
+ * @param[in] options	comma separated list of key=value options, or
+ *			NULL for the defaults
+ * @return Switchtec device handle, NULL on failure
+ *
+ * The simulated switch has a single partition whose first port is the
+ * upstream port. It answers the ECHO, I2C_TWI_PING, DIETEMP, LNKSTAT,
+ * PMON, FWLOGRD, RD_FLASH, GAS_READ, GAS_WRITE and GET_PAX_ID commands,
+ * and its event registers behave like the hardware's. Other commands fail with
+ * ERR_CMD_INVALID.
+ *
+ * The options are:
+ *   * id=<device id> - the device ID to report (default 0x4052)
+ *   * ports=<n> - the number of ports (default 8)
+ *   * latency=<us> - how long every command takes to execute
+ *   * <MRPC name>=<us> - how long one command takes (e.g. LNKSTAT=500)
+ *   * rtt=<us> - the round trip time added to every command, but only
+ *	once for a whole switchtec_cmd_batch()
+ *
+ * A leading word without a value is ignored, so that instances can be
+ * told apart by name. switchtec_open() uses this for device strings of
+ * the form "sim:<options>" (e.g. "sim:sw3,ports=16,latency=50").
+ */
+struct switchtec_dev *switchtec_open_sim(const char *options);
+
 /**
  * @brief Close a Switchtec device handle
  * @ingroup Device
@@ -103,6 +149,13 @@ void switchtec_close(struct switchtec_dev *dev)
 	if (!dev)
 		return;
 
+	free(dev->mrpc_stats);
+	free(dev->gas_cache);
+	free(dev->pff_map);
+	free(dev->event_last);
+	free(dev->topo);
+
+	/* The platform's close calls platform_dev_fini() before freeing */
 	dev->ops->close(dev);
 }
 
@@ -150,6 +203,28 @@ int switchtec_get_fw_version(struct switchtec_dev *dev, char *buf,
 	return 0;
 }
 
+/*
+ * Finish a command another caller started with switchtec_cmd_submit()
+ * so a synchronous command can use the mailbox. The result is kept for
+ * the submitter's switchtec_cmd_complete(). Called with the lock held.
+ */
+static void platform_async_reap(struct switchtec_dev *dev)
+{
+	struct switchtec_async_cmd *acmd = &dev->async_cmd;
+	int err = errno;
+
+	if (!acmd->pending || acmd->done)
+		return;
+
+	acmd->ret = dev->ops->cmd_complete(dev, acmd->resp, acmd->resp_len);
+	acmd->err = errno;
+	acmd->done = true;
+
+	gas_cache_cmd_done(dev, acmd->cmd);
+
+	errno = err;
+}
+
 /**
  * @brief Execute an MRPC command
  * @ingroup Device
@@ -165,20 +240,561 @@ int switchtec_cmd(struct switchtec_dev *dev,  uint32_t cmd,
 		  const void *payload, size_t payload_len, void *resp,
 		  size_t resp_len)
 {
+	uint64_t start = 0;
 	int ret;
 
-	cmd &= SWITCHTEC_CMD_MASK;
-	cmd |= dev->pax_id << SWITCHTEC_PAX_ID_SHIFT;
+	platform_lock(dev);
+
+	platform_async_reap(dev);
+
+	cmd = platform_cmd_id(dev, cmd);
+
+	if (dev->mrpc_stats || dev->trace_fn) {
+		dev->mrpc_wait_us = 0;
+		start = platform_time_us();
+	}
+
+	platform_probe(cmd_start, dev, cmd, payload_len);
+	ret = platform_cmd_op(dev)(dev, cmd, payload, payload_len,
+				   resp, resp_len);
+	platform_probe(cmd_done, dev, cmd, ret);
+
+	gas_cache_cmd_done(dev, cmd);
+
+	if (dev->mrpc_stats)
+		mrpc_stats_record(dev, cmd, payload_len, resp_len,
+				  platform_time_us() - start, ret);
+	if (dev->trace_fn)
+		platform_trace(dev, SWITCHTEC_TRACE_CMD, cmd,
+			       payload_len + resp_len, ret, start);
 
-	ret = dev->ops->cmd(dev, cmd, payload, payload_len, resp, resp_len);
 	if (ret > 0) {
 		mrpc_error_cmd = cmd & SWITCHTEC_CMD_MASK;
 		errno |= SWITCHTEC_ERRNO_MRPC_FLAG_BIT;
 	}
 
+	platform_unlock(dev);
+
+	return ret;
+}
+
+/**
+ * @brief Execute a sequence of MRPC commands
+ * @ingroup Device
+ * @param[in]     dev	Switchtec device handle
+ * @param[in,out] cmds	Commands to execute, in order. The ret field of
+ *			each one is filled in with its result.
+ * @param[in]     n	Number of commands
+ * @return 0 if every command succeeded, otherwise the result of the
+ *	first command that failed
+ *
+ * Commands that fail with an MRPC error (positive return) do not stop
+ * the batch. After a system error (negative return) the remaining
+ * commands are not executed and their ret is set to -ECANCELED.
+ *
+ * Some platforms (e.g. Ethernet) pipeline the commands so that the
+ * fixed per-command overhead is only paid once. When instrumentation
+ * is enabled, each command is recorded with an equal share of the
+ * batch's total time on these platforms.
+ */
+int switchtec_cmd_batch(struct switchtec_dev *dev,
+			struct switchtec_cmd_desc *cmds, int n)
+{
+	uint64_t start = 0, elapsed;
+	int i, ret = 0;
+
+	for (i = 0; i < n; i++) {
+		if (cmds[i].payload_len > MRPC_MAX_DATA_LEN ||
+		    cmds[i].resp_len > MRPC_MAX_DATA_LEN) {
+			errno = EINVAL;
+			return -EINVAL;
+		}
+		cmds[i].ret = -ECANCELED;
+	}
+
+	platform_lock(dev);
+
+	platform_async_reap(dev);
+
+	if (!dev->ops->cmd_batch) {
+		for (i = 0; i < n; i++) {
+			cmds[i].ret = switchtec_cmd(dev, cmds[i].cmd,
+						    cmds[i].payload,
+						    cmds[i].payload_len,
+						    cmds[i].resp,
+						    cmds[i].resp_len);
+			if (cmds[i].ret && !ret)
+				ret = cmds[i].ret;
+			if (cmds[i].ret < 0)
+				break;
+		}
+
+		platform_unlock(dev);
+		return ret;
+	}
+
+	if (dev->mrpc_stats || dev->trace_fn) {
+		dev->mrpc_wait_us = 0;
+		start = platform_time_us();
+	}
+
+	platform_probe(cmd_batch_start, dev, n, 0);
+	dev->ops->cmd_batch(dev, cmds, n);
+	platform_probe(cmd_batch_done, dev, n, 0);
+
+	for (i = 0; i < n; i++)
+		if (cmds[i].ret != -ECANCELED)
+			gas_cache_cmd_done(dev, cmds[i].cmd);
+
+	if (dev->mrpc_stats && n) {
+		elapsed = (platform_time_us() - start) / n;
+		for (i = 0; i < n && cmds[i].ret != -ECANCELED; i++)
+			mrpc_stats_record(dev, cmds[i].cmd,
+					  cmds[i].payload_len,
+					  cmds[i].resp_len, elapsed,
+					  cmds[i].ret);
+	}
+
+	/* Each command of the batch is reported as starting with it */
+	for (i = 0; dev->trace_fn && i < n && cmds[i].ret != -ECANCELED; i++)
+		platform_trace(dev, SWITCHTEC_TRACE_CMD,
+			       platform_cmd_id(dev, cmds[i].cmd),
+			       cmds[i].payload_len + cmds[i].resp_len,
+			       cmds[i].ret, start);
+
+	for (i = 0; i < n; i++) {
+		if (!cmds[i].ret)
+			continue;
+
+		ret = cmds[i].ret;
+		errno = ret < 0 ? -ret : ret;
+		if (ret > 0) {
+			mrpc_error_cmd = cmds[i].cmd & SWITCHTEC_CMD_MASK;
+			errno |= SWITCHTEC_ERRNO_MRPC_FLAG_BIT;
+		}
+		break;
+	}
+
+	platform_unlock(dev);
+
+	return ret;
+}
+
+/**
+ * @brief Start an MRPC command without waiting for it to complete
+ * @ingroup Device
+ * @param[in]  dev		Switchtec device handle
+ * @param[in]  cmd		Command ID
+ * @param[in]  payload		Input data
+ * @param[in]  payload_len	Input data length (in bytes)
+ * @param[out] resp		Output data, filled in by
+ *				switchtec_cmd_complete()
+ * @param[in]  resp_len		Output data length (in bytes)
+ * @return 0 on success, negative on failure
+ *
+ * Only one command may be outstanding on a handle at a time. The
+ * command must be finished with switchtec_cmd_complete() before another
+ * one is submitted. \p resp must remain valid until then. A synchronous
+ * command issued on the handle in the meantime, from any thread, first
+ * waits for this one to finish; its result is kept for
+ * switchtec_cmd_complete().
+ *
+ * Platforms without native support execute the command synchronously
+ * here; switchtec_cmd_poll() will then report it complete immediately.
+ */
+int switchtec_cmd_submit(struct switchtec_dev *dev, uint32_t cmd,
+			 const void *payload, size_t payload_len,
+			 void *resp, size_t resp_len)
+{
+	struct switchtec_async_cmd *acmd = &dev->async_cmd;
+	int ret = 0;
+
+	platform_lock(dev);
+
+	if (acmd->pending) {
+		platform_unlock(dev);
+		errno = EBUSY;
+		return -EBUSY;
+	}
+
+	cmd = platform_cmd_id(dev, cmd);
+
+	acmd->cmd = cmd;
+	acmd->resp = resp;
+	acmd->resp_len = resp_len;
+	acmd->payload_len = payload_len;
+	acmd->done = false;
+	dev->mrpc_wait_us = 0;
+	acmd->start_us = platform_time_us();
+
+	platform_probe(cmd_start, dev, cmd, payload_len);
+
+	if (!dev->ops->cmd_submit) {
+		acmd->ret = platform_cmd_op(dev)(dev, cmd, payload,
+						 payload_len, resp, resp_len);
+		acmd->err = errno;
+		acmd->done = true;
+		acmd->pending = true;
+		goto out;
+	}
+
+	ret = dev->ops->cmd_submit(dev, cmd, payload, payload_len, resp_len);
+	if (ret >= 0) {
+		acmd->pending = true;
+		ret = 0;
+	}
+
+out:
+	platform_unlock(dev);
+	return ret;
+}
+
+/**
+ * @brief Check whether the command started with switchtec_cmd_submit()
+ *	has completed
+ * @ingroup Device
+ * @param[in] dev	Switchtec device handle
+ * @return 1 if the command has completed, 0 if it is still in progress,
+ *	negative on failure
+ *
+ * This never blocks.
+ */
+int switchtec_cmd_poll(struct switchtec_dev *dev)
+{
+	struct switchtec_async_cmd *acmd = &dev->async_cmd;
+	int ret;
+
+	platform_lock(dev);
+
+	if (!acmd->pending) {
+		errno = EINVAL;
+		ret = -EINVAL;
+	} else if (acmd->done) {
+		ret = 1;
+	} else {
+		ret = dev->ops->cmd_poll(dev);
+	}
+
+	platform_unlock(dev);
+
+	return ret;
+}
+
+/**
+ * @brief Get a file descriptor to wait on for command completion
+ * @ingroup Device
+ * @param[in] dev	Switchtec device handle
+ * @return A file descriptor which becomes readable (POLLIN) once the
+ *	outstanding command completes, or a negative value if the
+ *	platform has no such descriptor
+ *
+ * The descriptor is owned by the handle and must not be closed. When no
+ * descriptor is available, switchtec_cmd_poll() must be called
+ * periodically instead.
+ */
+int switchtec_cmd_poll_fd(struct switchtec_dev *dev)
+{
+	if (!dev->ops->cmd_poll_fd || dev->async_cmd.done) {
+		errno = ENOTSUP;
+		return -ENOTSUP;
+	}
+
+	return dev->ops->cmd_poll_fd(dev);
+}
+
+/**
+ * @brief Get a Windows event handle to wait on for command completion
+ * @ingroup Device
+ * @param[in] dev	Switchtec device handle
+ * @return A manual-reset event HANDLE which is signalled once the
+ *	outstanding command completes, or NULL if the platform has none
+ *
+ * This is the Windows counterpart of switchtec_cmd_poll_fd(): handles
+ * from several devices may be passed to one WaitForMultipleObjects()
+ * call. The handle is owned by the device and must not be closed.
+ */
+void *switchtec_cmd_poll_handle(struct switchtec_dev *dev)
+{
+	if (!dev->ops->cmd_poll_handle || dev->async_cmd.done) {
+		errno = ENOTSUP;
+		return NULL;
+	}
+
+	return dev->ops->cmd_poll_handle(dev);
+}
+
+/**
+ * @brief Finish the command started with switchtec_cmd_submit()
+ * @ingroup Device
+ * @param[in] dev	Switchtec device handle
+ * @return 0 on success, negative on system error, positive on MRPC error
+ *
+ * This blocks if the command has not completed yet. The response is
+ * copied to the buffer passed to switchtec_cmd_submit().
+ */
+int switchtec_cmd_complete(struct switchtec_dev *dev)
+{
+	struct switchtec_async_cmd *acmd = &dev->async_cmd;
+	int ret;
+
+	platform_lock(dev);
+
+	if (!acmd->pending) {
+		platform_unlock(dev);
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	if (acmd->done) {
+		ret = acmd->ret;
+		errno = acmd->err;
+	} else
+		ret = dev->ops->cmd_complete(dev, acmd->resp, acmd->resp_len);
+
+	acmd->pending = false;
+	acmd->done = false;
+
+	platform_probe(cmd_done, dev, acmd->cmd, ret);
+
+	gas_cache_cmd_done(dev, acmd->cmd);
+
+	if (dev->mrpc_stats)
+		mrpc_stats_record(dev, acmd->cmd, acmd->payload_len,
+				  acmd->resp_len,
+				  platform_time_us() - acmd->start_us, ret);
+	if (dev->trace_fn)
+		platform_trace(dev, SWITCHTEC_TRACE_CMD, acmd->cmd,
+			       acmd->payload_len + acmd->resp_len, ret,
+			       acmd->start_us);
+
+	if (ret > 0) {
+		errno = ret;
+		mrpc_error_cmd = acmd->cmd & SWITCHTEC_CMD_MASK;
+		errno |= SWITCHTEC_ERRNO_MRPC_FLAG_BIT;
+	}
+
+	platform_unlock(dev);
+
 	return ret;
 }
 
+static const struct switchtec_mrpc_poll_policy default_mrpc_poll = {
+	.spin_count = 2,
+	.initial_delay_us = 50,
+	.backoff_factor = 2,
+	.max_delay_us = 5000,
+};
+
+void platform_trace(struct switchtec_dev *dev, enum switchtec_trace_op op,
+		    uint32_t id, size_t len, int ret, uint64_t start_us)
+{
+	struct switchtec_trace_rec rec = {
+		.op = op,
+		.id = id,
+		.len = len,
+		.ret = ret,
+		.start_us = start_us,
+		.elapsed_us = platform_time_us() - start_us,
+	};
+
+	dev->trace_fn(dev, &rec, dev->trace_arg);
+}
+
+static void trace_to_stderr(struct switchtec_dev *dev,
+			    const struct switchtec_trace_rec *rec, void *arg)
+{
+	static const char * const names[] = {
+		[SWITCHTEC_TRACE_CMD] = "cmd",
+		[SWITCHTEC_TRACE_GAS_READ] = "gas_read",
+		[SWITCHTEC_TRACE_GAS_WRITE] = "gas_write",
+		[SWITCHTEC_TRACE_EVENT_WAIT] = "event_wait",
+	};
+	const char *mrpc = NULL;
+
+	if (rec->op == SWITCHTEC_TRACE_CMD)
+		mrpc = switchtec_mrpc_name(rec->id & SWITCHTEC_CMD_MASK);
+
+	fprintf(stderr, "switchtec: %s %s 0x%x%s%s len %lu ret %d %lluus\n",
+		dev->name, names[rec->op], rec->id, mrpc ? " " : "",
+		mrpc ? mrpc : "", (unsigned long)rec->len, rec->ret,
+		(unsigned long long)rec->elapsed_us);
+}
+
+/**
+ * @brief Report every call through a device's transport to a callback
+ * @ingroup Device
+ * @param[in] dev	Switchtec device handle
+ * @param[in] fn	Callback, or NULL to stop tracing
+ * @param[in] arg	Passed to \p fn
+ *
+ * MRPC commands, uncached GAS accesses and event waits are reported
+ * with their timing once they complete. The same calls are also
+ * exposed as USDT probes (see switchtec_priv.h) which need no callback
+ * and cost a nop when no tracer is attached.
+ *
+ * Setting the SWITCHTEC_TRACE environment variable installs a callback
+ * on every handle that logs each call to stderr.
+ */
+void switchtec_set_trace(struct switchtec_dev *dev, switchtec_trace_fn fn,
+			 void *arg)
+{
+	platform_lock(dev);
+	dev->trace_fn = fn;
+	dev->trace_arg = arg;
+	platform_unlock(dev);
+}
+
+/**
+ * @brief Initialize the common fields of a newly allocated device handle
+ * @param[in] dev	Switchtec device handle
+ *
+ * Called by each platform's open function before the handle is returned.
+ */
+void platform_dev_init(struct switchtec_dev *dev)
+{
+	pthread_mutexattr_t attr;
+	int i;
+
+	/*
+	 * The lock is recursive: commands to remote PAX devices are
+	 * issued from within GAS accessors that already hold it.
+	 */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&dev->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	dev->mrpc_poll = default_mrpc_poll;
+	memset(&dev->async_cmd, 0, sizeof(dev->async_cmd));
+	dev->mrpc_stats = NULL;
+	dev->mrpc_wait_us = 0;
+	dev->trace_fn = NULL;
+	dev->trace_arg = NULL;
+	dev->gas_cache = NULL;
+	dev->pff_map = NULL;
+	dev->event_last = NULL;
+	dev->topo = NULL;
+	dev->topo_valid = false;
+	dev->pax_id = SWITCHTEC_PAX_ID_LOCAL;
+	dev->local_pax_id = -1;
+	dev->probed = false;
+	dev->probing = false;
+
+	if (getenv("SWITCHTEC_MRPC_STATS"))
+		switchtec_mrpc_stats_enable(dev, 1);
+	if (getenv("SWITCHTEC_GAS_CACHE"))
+		switchtec_gas_cache_enable(dev, 1);
+	if (getenv("SWITCHTEC_TRACE"))
+		switchtec_set_trace(dev, trace_to_stderr, NULL);
+	for (i = 0; i < MRPC_MAX_ID; i++)
+		dev->mrpc_poll_hint_us[i] = -1;
+}
+
+/**
+ * @brief Release the common fields of a device handle
+ * @param[in] dev	Switchtec device handle
+ *
+ * Called by each platform's close function, once it no longer needs the
+ * handle lock and just before the handle is freed.
+ */
+void platform_dev_fini(struct switchtec_dev *dev)
+{
+	pthread_mutex_destroy(&dev->lock);
+}
+
+/**
+ * @brief Get the delay to wait before first polling for a command's
+ *	completion
+ * @param[in] dev	Switchtec device handle
+ * @param[in] cmd	Command ID (may include the PAX ID bits)
+ * @return The delay in microseconds
+ */
+int platform_mrpc_poll_hint(struct switchtec_dev *dev, uint32_t cmd)
+{
+	cmd &= SWITCHTEC_CMD_MASK;
+	if (cmd >= MRPC_MAX_ID)
+		return 0;
+
+	if (dev->mrpc_poll_hint_us[cmd] >= 0)
+		return dev->mrpc_poll_hint_us[cmd];
+
+	return switchtec_mrpc_table[cmd].poll_delay_us;
+}
+
+/**
+ * @brief Set how MRPC completion is polled
+ * @ingroup Device
+ * @param[in] dev	Switchtec device handle
+ * @param[in] policy	New policy, or NULL to restore the default
+ * @return 0 on success, negative on failure
+ *
+ * This only affects transports that poll the MRPC status register
+ * (I2C and UART). Commands issued through a driver or over Ethernet
+ * are completed by the other side.
+ */
+int switchtec_set_mrpc_poll_policy(struct switchtec_dev *dev,
+			const struct switchtec_mrpc_poll_policy *policy)
+{
+	if (!policy) {
+		dev->mrpc_poll = default_mrpc_poll;
+		return 0;
+	}
+
+	if (policy->spin_count < 0 || policy->initial_delay_us < 1 ||
+	    policy->backoff_factor < 1 ||
+	    policy->max_delay_us < policy->initial_delay_us) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	dev->mrpc_poll = *policy;
+	return 0;
+}
+
+/**
+ * @brief Get the current MRPC completion polling policy
+ * @ingroup Device
+ * @param[in]  dev	Switchtec device handle
+ * @param[out] policy	Current policy
+ * @return 0 on success, negative on failure
+ */
+int switchtec_get_mrpc_poll_policy(struct switchtec_dev *dev,
+				   struct switchtec_mrpc_poll_policy *policy)
+{
+	if (!policy) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	*policy = dev->mrpc_poll;
+	return 0;
+}
+
+/**
+ * @brief Set the expected completion time of a specific MRPC command
+ * @ingroup Device
+ * @param[in] dev	Switchtec device handle
+ * @param[in] mrpc_id	MRPC command ID
+ * @param[in] delay_us	Time to wait before the first status poll, or
+ *			a negative value to use the library's default
+ * @return 0 on success, negative on failure
+ *
+ * Long running commands (e.g. flash reads or resets) waste transport
+ * bandwidth when polled aggressively. The defaults come from
+ * switchtec_mrpc_table.
+ */
+int switchtec_set_mrpc_poll_hint(struct switchtec_dev *dev, int mrpc_id,
+				 int delay_us)
+{
+	if (mrpc_id < 0 || mrpc_id >= MRPC_MAX_ID) {
+		errno = EINVAL;
+		return -EINVAL;
+	}
+
+	dev->mrpc_poll_hint_us[mrpc_id] = delay_us < 0 ? -1 : delay_us;
+	return 0;
+}
+
 /**
  * @brief Populate an already retrieved switchtec_status structure list
  * 	with information about the devices plugged into the switch
@@ -213,7 +829,13 @@ int switchtec_get_devices(struct switchtec_dev *dev,
 int switchtec_pff_to_port(struct switchtec_dev *dev, int pff,
 			  int *partition, int *port)
 {
-	return dev->ops->pff_to_port(dev, pff, partition, port);
+	int ret;
+
+	platform_lock(dev);
+	ret = dev->ops->pff_to_port(dev, pff, partition, port);
+	platform_unlock(dev);
+
+	return ret;
 }
 
 /**
@@ -228,7 +850,13 @@ int switchtec_pff_to_port(struct switchtec_dev *dev, int pff,
 int switchtec_port_to_pff(struct switchtec_dev *dev, int partition,
 			  int port, int *pff)
 {
-	return dev->ops->port_to_pff(dev, partition, port, pff);
+	int ret;
+
+	platform_lock(dev);
+	ret = dev->ops->port_to_pff(dev, partition, port, pff);
+	platform_unlock(dev);
+
+	return ret;
 }
 
 /**
@@ -284,7 +912,13 @@ int switchtec_flash_part(struct switchtec_dev *dev,
 			 struct switchtec_fw_image_info *info,
 			 enum switchtec_fw_image_part_id_gen3 part)
 {
-	return dev->ops->flash_part(dev, info, part);
+	int ret;
+
+	platform_lock(dev);
+	ret = dev->ops->flash_part(dev, info, part);
+	platform_unlock(dev);
+
+	return ret;
 }
 
 /**
@@ -297,7 +931,83 @@ int switchtec_flash_part(struct switchtec_dev *dev,
 int switchtec_event_summary(struct switchtec_dev *dev,
 			    struct switchtec_event_summary *sum)
 {
-	return dev->ops->event_summary(dev, sum);
+	int ret;
+
+	platform_lock(dev);
+	ret = dev->ops->event_summary(dev, sum);
+	platform_unlock(dev);
+
+	return ret;
+}
+
+/**
+ * @brief Retrieve the events that were set since the previous call
+ * @ingroup Event
+ * @param[in]  dev	Switchtec device handle
+ * @param[out] sum	Events that are set now but were not on the last call
+ * @returns 1 if any new event is set, 0 if none, negative on failure
+ *
+ * The previous summary is kept in the device handle, so the first call
+ * returns every event that is set. Use switchtec_event_summary_iter()
+ * to walk the result. An event that is cleared and set again between
+ * two calls is not reported. On the GAS based transports only the
+ * summary registers of partitions flagged in the partition event bitmap
+ * (and of their PFFs) are read.
+ */
+int switchtec_event_summary_since(struct switchtec_dev *dev,
+				  struct switchtec_event_summary *sum)
+{
+	struct switchtec_event_summary cur, *last;
+	int i, ret;
+	int any;
+
+	platform_lock(dev);
+
+	if (!dev->event_last) {
+		dev->event_last = calloc(1, sizeof(*dev->event_last));
+		if (!dev->event_last) {
+			platform_unlock(dev);
+			return -errno;
+		}
+	}
+	last = dev->event_last;
+
+	if (dev->ops->event_summary_sparse)
+		ret = dev->ops->event_summary_sparse(dev, &cur);
+	else
+		ret = dev->ops->event_summary(dev, &cur);
+	if (ret) {
+		platform_unlock(dev);
+		return ret;
+	}
+
+	sum->global = cur.global & ~last->global;
+	sum->part_bitmap = cur.part_bitmap & ~last->part_bitmap;
+	sum->local_part = cur.local_part & ~last->local_part;
+	any = sum->global || sum->local_part;
+
+	for (i = 0; i < SWITCHTEC_MAX_PARTS; i++) {
+		sum->part[i] = cur.part[i] & ~last->part[i];
+		any |= !!sum->part[i];
+	}
+
+	for (i = 0; i < SWITCHTEC_MAX_PFF_CSR; i++) {
+		sum->pff[i] = cur.pff[i] & ~last->pff[i];
+		any |= !!sum->pff[i];
+	}
+
+	/* Link changes and resets can change which lanes a port has */
+	if (switchtec_event_summary_test(sum, SWITCHTEC_GLOBAL_EVT_SYS_RESET, 0))
+		switchtec_topo_invalidate(dev);
+	for (i = 0; i < SWITCHTEC_MAX_PFF_CSR; i++)
+		if (switchtec_event_summary_test(sum,
+				SWITCHTEC_PFF_EVT_LINK_STATE, i))
+			switchtec_topo_invalidate(dev);
+
+	*last = cur;
+	platform_unlock(dev);
+
+	return any;
 }
 
 /**
@@ -315,7 +1025,78 @@ int switchtec_event_ctl(struct switchtec_dev *dev,
 			int index, int flags,
 			uint32_t data[5])
 {
-	return dev->ops->event_ctl(dev, e, index, flags, data);
+	int ret;
+
+	platform_lock(dev);
+	ret = dev->ops->event_ctl(dev, e, index, flags, data);
+	platform_unlock(dev);
+
+	return ret;
+}
+
+/**
+ * @brief Read every event of a global, partition or PFF block and clear
+ *	some of them
+ * @ingroup Event
+ * @param[in]  dev	Switchtec device handle
+ * @param[in]  type	Type of the events in the block
+ * @param[in]  index	Partition or PFF index (ignored for global events)
+ * @param[in]  clear	Bitmask (1 << event ID) of events to clear if they
+ *	occurred, or 0 to only read the block
+ * @param[out] blk	Headers, counts and data of the block's events
+ * @returns The number of events in the block that occurred, or negative
+ *	on failure
+ *
+ * Where the transport accesses the GAS directly, all the headers and
+ * data words of the block are read in one transfer and only the events
+ * selected by \p clear that occurred are written to. This is much
+ * cheaper than calling switchtec_event_ctl() for every event, especially
+ * over I2C. Other transports fall back to switchtec_event_ctl(), in
+ * which case only the count and occurred bit of each header are set.
+ */
+int switchtec_event_block_ctl(struct switchtec_dev *dev,
+			      enum switchtec_event_type type, int index,
+			      uint64_t clear,
+			      struct switchtec_event_block *blk)
+{
+	enum switchtec_event_id e;
+	int ret, nr = 0;
+
+	platform_lock(dev);
+
+	if (dev->ops->event_block_ctl) {
+		ret = dev->ops->event_block_ctl(dev, type, index, clear, blk);
+		platform_unlock(dev);
+		return ret;
+	}
+
+	memset(blk, 0, sizeof(*blk));
+
+	for (e = 0; e < SWITCHTEC_MAX_EVENTS; e++) {
+		if (switchtec_event_info(e, NULL, NULL) != type)
+			continue;
+
+		ret = dev->ops->event_ctl(dev, e, index,
+					  (clear & (1ULL << e)) ?
+					  SWITCHTEC_EVT_FLAG_CLEAR : 0,
+					  blk->data[e]);
+		if (ret < 0) {
+			platform_unlock(dev);
+			return ret;
+		}
+
+		blk->count[e] = ret;
+		blk->hdr[e] = ret << 5;
+		if (ret) {
+			blk->hdr[e] |= SWITCHTEC_EVENT_OCCURRED;
+			blk->occurred |= 1ULL << e;
+			nr++;
+		}
+	}
+
+	platform_unlock(dev);
+
+	return nr;
 }
 
 /**
@@ -328,12 +1109,33 @@ int switchtec_event_ctl(struct switchtec_dev *dev,
  */
 int switchtec_event_wait(struct switchtec_dev *dev, int timeout_ms)
 {
+	uint64_t start = platform_trace_start(dev);
+	int ret;
+
 	if (!dev->ops->event_wait) {
 		errno = ENOTSUP;
 		return -errno;
 	}
 
-	return dev->ops->event_wait(dev, timeout_ms);
+	platform_probe(event_wait_start, dev, timeout_ms, 0);
+	ret = dev->ops->event_wait(dev, timeout_ms);
+	platform_probe(event_wait_done, dev, timeout_ms, ret);
+
+	if (dev->trace_fn)
+		platform_trace(dev, SWITCHTEC_TRACE_EVENT_WAIT, timeout_ms, 0,
+			       ret, start);
+
+	return ret;
+}
+
+/*
+ * The local PAX ID is part of the lazily probed identity, so make sure
+ * it has been read before deciding how to route a GAS access.
+ */
+static int gas_is_remote(struct switchtec_dev *dev)
+{
+	switchtec_probe(dev);
+	return dev->pax_id != dev->local_pax_id;
 }
 
 /**
@@ -345,10 +1147,12 @@ int switchtec_event_wait(struct switchtec_dev *dev, int timeout_ms)
  */
 int gas_read8(struct switchtec_dev *dev, uint8_t __gas *addr, uint8_t *val)
 {
-	if (dev->pax_id != dev->local_pax_id)
+	if (gas_is_remote(dev))
 		return gas_mrpc_read8(dev, addr, val);
-	else
-		*val = __gas_read8(dev, addr);
+
+	platform_lock(dev);
+	*val = __gas_read8(dev, addr);
+	platform_unlock(dev);
 
 	return 0;
 }
@@ -362,10 +1166,12 @@ int gas_read8(struct switchtec_dev *dev, uint8_t __gas *addr, uint8_t *val)
  */
 int gas_read16(struct switchtec_dev *dev, uint16_t __gas *addr, uint16_t *val)
 {
-	if (dev->pax_id != dev->local_pax_id)
+	if (gas_is_remote(dev))
 		return gas_mrpc_read16(dev, addr, val);
-	else
-		*val = __gas_read16(dev, addr);
+
+	platform_lock(dev);
+	*val = __gas_read16(dev, addr);
+	platform_unlock(dev);
 
 	return 0;
 }
@@ -379,10 +1185,12 @@ int gas_read16(struct switchtec_dev *dev, uint16_t __gas *addr, uint16_t *val)
  */
 int gas_read32(struct switchtec_dev *dev, uint32_t __gas *addr, uint32_t *val)
 {
-	if (dev->pax_id != dev->local_pax_id)
+	if (gas_is_remote(dev))
 		return gas_mrpc_read32(dev, addr, val);
-	else
-		*val = __gas_read32(dev, addr);
+
+	platform_lock(dev);
+	*val = __gas_read32(dev, addr);
+	platform_unlock(dev);
 
 	return 0;
 }
@@ -396,10 +1204,12 @@ int gas_read32(struct switchtec_dev *dev, uint32_t __gas *addr, uint32_t *val)
  */
 int gas_read64(struct switchtec_dev *dev, uint64_t __gas *addr, uint64_t *val)
 {
-	if (dev->pax_id != dev->local_pax_id)
+	if (gas_is_remote(dev))
 		return gas_mrpc_read64(dev, addr, val);
-	else
-		*val = __gas_read64(dev, addr);
+
+	platform_lock(dev);
+	*val = __gas_read64(dev, addr);
+	platform_unlock(dev);
 
 	return 0;
 }
@@ -412,10 +1222,14 @@ int gas_read64(struct switchtec_dev *dev, uint64_t __gas *addr, uint64_t *val)
  */
 void gas_write8(struct switchtec_dev *dev, uint8_t val, uint8_t __gas *addr)
 {
-	if (dev->pax_id != dev->local_pax_id)
+	if (gas_is_remote(dev)) {
 		gas_mrpc_write8(dev, val, addr);
-	else
-		__gas_write8(dev, val, addr);
+		return;
+	}
+
+	platform_lock(dev);
+	__gas_write8(dev, val, addr);
+	platform_unlock(dev);
 }
 
 /**
@@ -426,10 +1240,14 @@ void gas_write8(struct switchtec_dev *dev, uint8_t val, uint8_t __gas *addr)
  */
 void gas_write16(struct switchtec_dev *dev, uint16_t val, uint16_t __gas *addr)
 {
-	if (dev->pax_id != dev->local_pax_id)
+	if (gas_is_remote(dev)) {
 		gas_mrpc_write16(dev, val, addr);
-	else
-		__gas_write16(dev, val, addr);
+		return;
+	}
+
+	platform_lock(dev);
+	__gas_write16(dev, val, addr);
+	platform_unlock(dev);
 }
 
 /**
@@ -440,10 +1258,14 @@ void gas_write16(struct switchtec_dev *dev, uint16_t val, uint16_t __gas *addr)
  */
 void gas_write32(struct switchtec_dev *dev, uint32_t val, uint32_t __gas *addr)
 {
-	if (dev->pax_id != dev->local_pax_id)
+	if (gas_is_remote(dev)) {
 		gas_mrpc_write32(dev, val, addr);
-	else
-		__gas_write32(dev, val, addr);
+		return;
+	}
+
+	platform_lock(dev);
+	__gas_write32(dev, val, addr);
+	platform_unlock(dev);
 }
 
 /**
@@ -454,10 +1276,14 @@ void gas_write32(struct switchtec_dev *dev, uint32_t val, uint32_t __gas *addr)
  */
 void gas_write64(struct switchtec_dev *dev, uint64_t val, uint64_t __gas *addr)
 {
-	if (dev->pax_id != dev->local_pax_id)
+	if (gas_is_remote(dev)) {
 		gas_mrpc_write64(dev, val, addr);
-	else
-		__gas_write64(dev, val, addr);
+		return;
+	}
+
+	platform_lock(dev);
+	__gas_write64(dev, val, addr);
+	platform_unlock(dev);
 }
 
 /**
@@ -470,10 +1296,14 @@ void gas_write64(struct switchtec_dev *dev, uint64_t val, uint64_t __gas *addr)
 void memcpy_to_gas(struct switchtec_dev *dev, void __gas *dest,
 		   const void *src, size_t n)
 {
-	if (dev->pax_id != dev->local_pax_id)
+	if (gas_is_remote(dev)) {
 		gas_mrpc_memcpy_to_gas(dev, dest, src, n);
-	else
-		__memcpy_to_gas(dev, dest, src, n);
+		return;
+	}
+
+	platform_lock(dev);
+	__memcpy_to_gas(dev, dest, src, n);
+	platform_unlock(dev);
 }
 
 /**
@@ -487,10 +1317,12 @@ void memcpy_to_gas(struct switchtec_dev *dev, void __gas *dest,
 int memcpy_from_gas(struct switchtec_dev *dev, void *dest,
 		    const void __gas *src, size_t n)
 {
-	if (dev->pax_id != dev->local_pax_id)
+	if (gas_is_remote(dev))
 		return gas_mrpc_memcpy_from_gas(dev, dest, src, n);
-	else
-		__memcpy_from_gas(dev, dest, src, n);
+
+	platform_lock(dev);
+	__memcpy_from_gas(dev, dest, src, n);
+	platform_unlock(dev);
 
 	return 0;
 }
@@ -505,8 +1337,14 @@ int memcpy_from_gas(struct switchtec_dev *dev, void *dest,
 ssize_t write_from_gas(struct switchtec_dev *dev, int fd,
 		       const void __gas *src, size_t n)
 {
-	if (dev->pax_id != dev->local_pax_id)
+	ssize_t ret;
+
+	if (gas_is_remote(dev))
 		return gas_mrpc_write_from_gas(dev, fd, src, n);
-	else
-		return __write_from_gas(dev, fd, src, n);
+
+	platform_lock(dev);
+	ret = __write_from_gas(dev, fd, src, n);
+	platform_unlock(dev);
+
+	return ret;
 }
@@ -0,0 +1,1405 @@
+/*
+ * Microsemi Switchtec(tm) PCIe Management Library
+ * Copyright (c) 2017, Microsemi Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/*
+ * A simulated switch held entirely in memory. The GAS is an ordinary
+ * allocation accessed like a mapped BAR, and MRPC commands are answered
+ * by a small firmware model with a configurable execution time, so
+ * tools and the library's batching and asynchronous paths can be
+ * exercised without hardware.
+ */
+
+#include "../switchtec_priv.h"
+#include "switchtec/switchtec.h"
+#include "switchtec/errors.h"
+#include "switchtec/endian.h"
+#include "switchtec/pmon.h"
+#include "switchtec/log.h"
+#include "switchtec/gas_mrpc.h"
+#include "switchtec/bind.h"
+#include "switchtec/diag.h"
+#include "switchtec/utils.h"
+#include "gasops.h"
+#include "mmap_gas.h"
+
+#include <sys/time.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#ifdef __CHECKER__
+#define __force __attribute__((force))
+#else
+#define __force
+#endif
+
+#define SIM_DEFAULT_DEVICE_ID	0x4052
+#define SIM_DEFAULT_PORTS	8
+
+#define SIM_FW_MINOR		0x70
+#define SIM_FW_BUILD		0x12
+
+#define SIM_FLASH_LEN		(16 << 20)
+#define SIM_MEMLOG_LEN		(16 << 10)
+
+/* The app log starts with this many entries and grows at this rate */
+#define SIM_LOG_INITIAL		256
+#define SIM_LOG_PER_SEC		10
+#define SIM_LOG_CAPACITY	16384
+
+#define SIM_DIE_TEMP		4500
+
+/* A bind or unbind stays in progress this long */
+#define SIM_BIND_US		20000
+
+#pragma pack(push, 1)
+
+struct sim_lnkstat {
+	uint8_t phys_port_id;
+	uint8_t par_id;
+	uint8_t log_port_id;
+	uint8_t stk_id;
+	uint8_t cfg_lnk_width;
+	uint8_t neg_lnk_width;
+	uint8_t usp_flag;
+	uint8_t linkup_linkrate;
+	uint16_t ltssm;
+	uint8_t lane_reversal;
+	uint8_t first_act_lane;
+};
+
+struct sim_rd_flash {
+	uint32_t addr;
+	uint32_t length;
+};
+
+struct sim_ping_reply {
+	uint32_t dev_info;
+	uint32_t ping_reply;
+};
+
+struct sim_log_c_reply {
+	uint8_t reason;
+	uint8_t rsvd[3];
+	uint32_t nvlog_version;
+	uint32_t thread_handle;
+	uint32_t fw_version;
+	uint32_t timestamp1;
+	uint32_t timestamp2;
+};
+
+#pragma pack(pop)
+
+struct sim_evcntr {
+	uint32_t mask;
+	uint8_t ieg;
+	uint32_t thresh;
+	uint64_t clear_us;
+};
+
+struct sim_bind {
+	bool bound;
+	uint8_t par_id;
+	uint8_t log_port_id;
+	uint64_t done_us;
+};
+
+struct switchtec_sim {
+	struct switchtec_dev dev;
+	struct switchtec_gas *gas;
+
+	enum switchtec_gen gen;
+	int nr_ports;
+	uint64_t start_us;
+
+	uint32_t rtt_us;
+	uint32_t exec_us[MRPC_MAX_ID];
+
+	pthread_mutex_t ev_lock;
+	pthread_cond_t ev_cond;
+	unsigned ev_seq;
+	unsigned ev_seen;
+
+	uint64_t bw_clear_us[SWITCHTEC_MAX_PORTS];
+	struct sim_evcntr evcntr[SWITCHTEC_MAX_STACKS]
+				[SWITCHTEC_MAX_EVENT_COUNTERS];
+	struct sim_bind bind[SWITCHTEC_MAX_PHY_PORTS];
+
+	struct {
+		uint64_t done_us;
+		int ret;
+		uint8_t resp[MRPC_MAX_DATA_LEN];
+	} async;
+};
+
+#define to_switchtec_sim(d)  \
+	((struct switchtec_sim *) \
+	 ((char *)d - offsetof(struct switchtec_sim, dev)))
+
+static enum switchtec_gen sim_id_to_gen(int device_id)
+{
+	switch (device_id >> 12) {
+	case 4:
+		return SWITCHTEC_GEN4;
+	case 5:
+		return SWITCHTEC_GEN5;
+	default:
+		return SWITCHTEC_GEN3;
+	}
+}
+
+static int sim_gen_max_ports(enum switchtec_gen gen)
+{
+	switch (gen) {
+	case SWITCHTEC_GEN5:
+		return SWITCHTEC_MAX_PORTS;
+	case SWITCHTEC_GEN4:
+		return 52;
+	default:
+		return 48;
+	}
+}
+
+static void sim_delay(uint64_t us)
+{
+	if (us)
+		usleep(us);
+}
+
+static uint32_t sim_exec_us(struct switchtec_sim *sdev, uint32_t cmd)
+{
+	cmd &= SWITCHTEC_CMD_MASK;
+
+	if (cmd >= MRPC_MAX_ID)
+		return 0;
+
+	return sdev->exec_us[cmd];
+}
+
+/*
+ * Events
+ *
+ * Event headers behave like the hardware's: writing the clear bit
+ * resets the occurred flag and count, the enable bits are stored and
+ * everything else is read only. The summary registers and the
+ * partition bitmap follow the headers.
+ */
+
+static uint32_t sim_summary_bit(enum switchtec_event_id e, int index,
+				uint32_t __gas **summary,
+				struct switchtec_sim *sdev)
+{
+	struct switchtec_dev *dev = &sdev->dev;
+	struct switchtec_event_summary sum = {0};
+
+	switchtec_event_summary_set(&sum, e, index);
+
+	switch (switchtec_event_info(e, NULL, NULL)) {
+	case SWITCHTEC_EVT_GLOBAL:
+		*summary = &dev->gas_map->sw_event.global_summary;
+		return sum.global;
+	case SWITCHTEC_EVT_PART:
+		*summary = &dev->gas_map->part_cfg[index].part_event_summary;
+		return sum.part[index];
+	case SWITCHTEC_EVT_PFF:
+		*summary = &dev->gas_map->pff_csr[index].pff_event_summary;
+		return sum.pff[index];
+	}
+
+	*summary = NULL;
+	return 0;
+}
+
+/* Every simulated port function belongs to the single partition */
+static void sim_update_part_bitmap(struct switchtec_sim *sdev)
+{
+	struct switchtec_gas *gas = sdev->gas;
+	uint64_t bitmap = 0;
+	int i;
+
+	if (gas->part_cfg[0].part_event_summary)
+		bitmap = 1;
+
+	for (i = 0; i < sdev->nr_ports && !bitmap; i++)
+		if (gas->pff_csr[i].pff_event_summary)
+			bitmap = 1;
+
+	gas->sw_event.part_event_bitmap = htole64(bitmap);
+}
+
+static void sim_event_set(struct switchtec_sim *sdev,
+			  enum switchtec_event_id e, int index,
+			  int occurred)
+{
+	struct switchtec_dev *dev = &sdev->dev;
+	uint32_t __gas *summary;
+	uint32_t bit, reg;
+
+	bit = sim_summary_bit(e, index, &summary, sdev);
+	if (!summary)
+		return;
+
+	reg = mmap_gas_read32(dev, summary);
+	if (occurred)
+		reg |= htole32(bit);
+	else
+		reg &= ~htole32(bit);
+	mmap_gas_write32(dev, reg, summary);
+
+	sim_update_part_bitmap(sdev);
+}
+
+static void sim_event_raise(struct switchtec_sim *sdev,
+			    enum switchtec_event_id e, int index)
+{
+	struct switchtec_dev *dev = &sdev->dev;
+	uint32_t __gas *reg;
+	uint32_t hdr, cnt;
+
+	reg = gasop_event_hdr_addr(dev, e, index);
+	if (!reg)
+		return;
+
+	pthread_mutex_lock(&sdev->ev_lock);
+
+	hdr = le32toh(mmap_gas_read32(dev, reg));
+	cnt = (hdr >> 5) & 0xFF;
+	if (cnt < 0xFF)
+		cnt++;
+	hdr = (hdr & ~(0xFF << 5)) | (cnt << 5) | SWITCHTEC_EVENT_OCCURRED;
+	mmap_gas_write32(dev, htole32(hdr), reg);
+
+	sim_event_set(sdev, e, index, 1);
+
+	sdev->ev_seq++;
+	pthread_cond_broadcast(&sdev->ev_cond);
+	pthread_mutex_unlock(&sdev->ev_lock);
+}
+
+static int sim_event_lookup(struct switchtec_sim *sdev, uint32_t __gas *addr,
+			    enum switchtec_event_id *event, int *index)
+{
+	struct switchtec_dev *dev = &sdev->dev;
+	size_t off = (char __force *)addr - (char *)sdev->gas;
+	enum switchtec_event_type type;
+	enum switchtec_event_id e;
+	int idx;
+
+	if (off >= offsetof(struct switchtec_gas, sw_event) &&
+	    off < offsetof(struct switchtec_gas, sys_info)) {
+		type = SWITCHTEC_EVT_GLOBAL;
+		idx = 0;
+	} else if (off >= offsetof(struct switchtec_gas, part_cfg) &&
+		   off < offsetof(struct switchtec_gas, part_cfg) +
+			 sizeof(sdev->gas->part_cfg)) {
+		type = SWITCHTEC_EVT_PART;
+		idx = (off - offsetof(struct switchtec_gas, part_cfg)) /
+			sizeof(struct part_cfg_regs);
+	} else if (off >= offsetof(struct switchtec_gas, pff_csr) &&
+		   off < sizeof(struct switchtec_gas)) {
+		type = SWITCHTEC_EVT_PFF;
+		idx = (off - offsetof(struct switchtec_gas, pff_csr)) /
+			sizeof(struct pff_csr_regs);
+	} else {
+		return 0;
+	}
+
+	for (e = 0; e < SWITCHTEC_MAX_EVENTS; e++) {
+		if (switchtec_event_info(e, NULL, NULL) != type)
+			continue;
+
+		if (gasop_event_hdr_addr(dev, e, idx) == addr) {
+			*event = e;
+			*index = idx;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int sim_event_wait(struct switchtec_dev *dev, int timeout_ms)
+{
+	struct switchtec_sim *sdev = to_switchtec_sim(dev);
+	struct timespec ts;
+	struct timeval tv;
+	uint64_t deadline;
+	int ret = 0;
+
+	gettimeofday(&tv, NULL);
+	deadline = tv.tv_sec * 1000000ULL + tv.tv_usec +
+		timeout_ms * 1000ULL;
+	ts.tv_sec = deadline / 1000000;
+	ts.tv_nsec = (deadline % 1000000) * 1000;
+
+	pthread_mutex_lock(&sdev->ev_lock);
+
+	while (sdev->ev_seq == sdev->ev_seen && !ret) {
+		if (timeout_ms < 0)
+			pthread_cond_wait(&sdev->ev_cond, &sdev->ev_lock);
+		else
+			ret = pthread_cond_timedwait(&sdev->ev_cond,
+						     &sdev->ev_lock, &ts);
+	}
+
+	ret = sdev->ev_seq != sdev->ev_seen;
+	sdev->ev_seen = sdev->ev_seq;
+
+	pthread_mutex_unlock(&sdev->ev_lock);
+
+	return ret;
+}
+
+/*
+ * GAS
+ */
+
+static gasptr_t sim_gas_map(struct switchtec_dev *dev, int writeable,
+			    size_t *map_size)
+{
+	if (map_size)
+		*map_size = dev->gas_map_size;
+
+	return dev->gas_map;
+}
+
+static void sim_gas_write32(struct switchtec_dev *dev, uint32_t val,
+			    uint32_t __gas *addr)
+{
+	struct switchtec_sim *sdev = to_switchtec_sim(dev);
+	const uint32_t ctl = SWITCHTEC_EVENT_EN_LOG | SWITCHTEC_EVENT_EN_CLI |
+		SWITCHTEC_EVENT_EN_IRQ | SWITCHTEC_EVENT_FATAL;
+	enum switchtec_event_id e;
+	uint32_t hdr;
+	int index;
+
+	if (!sim_event_lookup(sdev, addr, &e, &index)) {
+		mmap_gas_write32(dev, val, addr);
+		return;
+	}
+
+	val = le32toh(val);
+
+	pthread_mutex_lock(&sdev->ev_lock);
+
+	hdr = le32toh(mmap_gas_read32(dev, addr));
+	hdr = (hdr & ~ctl) | (val & ctl);
+	if (val & SWITCHTEC_EVENT_CLEAR) {
+		hdr &= ~(SWITCHTEC_EVENT_OCCURRED | (0xFF << 5));
+		sim_event_set(sdev, e, index, 0);
+	}
+	mmap_gas_write32(dev, htole32(hdr), addr);
+
+	pthread_mutex_unlock(&sdev->ev_lock);
+}
+
+static void sim_copy_id(char *dest, size_t len, const char *src)
+{
+	size_t n = strlen(src);
+
+	memset(dest, ' ', len);
+	memcpy(dest, src, n < len ? n : len);
+}
+
+static void sim_init_gas(struct switchtec_sim *sdev, int device_id)
+{
+	struct switchtec_gas *gas = sdev->gas;
+	struct part_cfg_regs *part = &gas->part_cfg[0];
+	struct flash_info_regs *fi = &gas->flash_info;
+	char product[32];
+	int i;
+
+	gas->sys_info.device_id = htole32(device_id);
+	gas->sys_info.firmware_version =
+		htole32((sdev->gen == SWITCHTEC_GEN5 ? 5 :
+			 sdev->gen == SWITCHTEC_GEN4 ? 4 : 3) << 24 |
+			SIM_FW_MINOR << 16 | SIM_FW_BUILD);
+	gas->sys_info.cfg_running = htole16(SWITCHTEC_CFG0_RUNNING);
+	gas->sys_info.img_running = htole16(SWITCHTEC_IMG0_RUNNING);
+
+	snprintf(product, sizeof(product), "SIM %04X", device_id);
+	sim_copy_id(gas->sys_info.vendor_id, sizeof(gas->sys_info.vendor_id),
+		    "MICROSEM");
+	sim_copy_id(gas->sys_info.product_id,
+		    sizeof(gas->sys_info.product_id), product);
+	sim_copy_id(gas->sys_info.product_revision,
+		    sizeof(gas->sys_info.product_revision), "0");
+	sim_copy_id(gas->sys_info.component_vendor,
+		    sizeof(gas->sys_info.component_vendor), "MICROSEM");
+
+	fi->flash_length = htole32(SIM_FLASH_LEN);
+	fi->img0.address = htole32(0x100000);
+	fi->img0.length = htole32(0x300000);
+	fi->img1.address = htole32(0x400000);
+	fi->img1.length = htole32(0x300000);
+	fi->cfg0.address = htole32(0x700000);
+	fi->cfg0.length = htole32(0x40000);
+	fi->cfg1.address = htole32(0x740000);
+	fi->cfg1.length = htole32(0x40000);
+	fi->active_img.address = fi->img0.address;
+	fi->active_cfg.address = fi->cfg0.address;
+	fi->inactive_img.address = fi->img1.address;
+	fi->inactive_cfg.address = fi->cfg1.address;
+
+	gas->top.partition_count = 1;
+	gas->top.partition_id = 0;
+	gas->top.pff_count = sdev->nr_ports;
+	for (i = 0; i < sdev->nr_ports; i++) {
+		gas->top.pff_port[i] = i;
+		gas->top.stack_valid[i / SWITCHTEC_PORTS_PER_STACK] = 1;
+	}
+
+	/* PFF 0 is the upstream port, the others are downstream ports */
+	part->port_cnt = htole32(sdev->nr_ports);
+	part->usp_pff_inst_id = htole32(0);
+	part->vep_pff_inst_id = htole32(SWITCHTEC_MAX_PFF_CSR);
+	for (i = 0; i < ARRAY_SIZE(part->dsp_pff_inst_id); i++)
+		part->dsp_pff_inst_id[i] = htole32(i + 1 < sdev->nr_ports ?
+						   i + 1 :
+						   SWITCHTEC_MAX_PFF_CSR);
+
+	for (i = 0; i < sdev->nr_ports; i++) {
+		gas->pff_csr[i].vendor_id = htole16(MICROSEMI_VENDOR_ID);
+		gas->pff_csr[i].device_id = htole16(device_id);
+	}
+}
+
+/*
+ * MRPC commands
+ *
+ * Each handler gets the payload zero padded to MRPC_MAX_DATA_LEN and a
+ * zeroed output buffer of the same size, of which the first out_len
+ * bytes are returned.
+ */
+
+static int sim_echo(struct switchtec_sim *sdev, const uint8_t *in,
+		    size_t in_len, uint8_t *out, size_t out_len)
+{
+	size_t i;
+
+	for (i = 0; i < MRPC_MAX_DATA_LEN; i++)
+		out[i] = ~in[i];
+
+	return 0;
+}
+
+static int sim_twi_ping(struct switchtec_sim *sdev, const uint8_t *in,
+			size_t in_len, uint8_t *out, size_t out_len)
+{
+	struct sim_ping_reply *reply = (void *)out;
+	uint32_t ping;
+
+	/* Gen3 firmware doesn't implement the ping */
+	if (sdev->gen == SWITCHTEC_GEN3)
+		return ERR_CMD_INVALID;
+
+	memcpy(&ping, in, sizeof(ping));
+	reply->dev_info = htole32(SWITCHTEC_BOOT_PHASE_FW |
+				  (sdev->gen == SWITCHTEC_GEN5) << 12);
+	reply->ping_reply = ~ping;
+
+	return 0;
+}
+
+static int sim_dietemp(struct switchtec_sim *sdev, const uint8_t *in,
+		       size_t in_len, uint8_t *out, size_t out_len)
+{
+	uint32_t *temps = (void *)out;
+	int i;
+
+	for (i = 0; i < 4; i++)
+		temps[i] = htole32(SIM_DIE_TEMP + i * 25);
+
+	return 0;
+}
+
+static int sim_lnkstat(struct switchtec_sim *sdev, const uint8_t *in,
+		       size_t in_len, uint8_t *out, size_t out_len)
+{
+	struct sim_lnkstat *st = (void *)out;
+	int rate = sdev->gen == SWITCHTEC_GEN5 ? 5 :
+		sdev->gen == SWITCHTEC_GEN4 ? 4 : 3;
+	uint64_t bitmap;
+	int i, n;
+
+	memcpy(&bitmap, in, sizeof(bitmap));
+	bitmap = le64toh(bitmap);
+
+	n = MRPC_MAX_DATA_LEN / sizeof(*st);
+	for (i = 0; i < n; i++, st++) {
+		if (i >= sdev->nr_ports ||
+		    (bitmap && !(bitmap & (1ULL << i)))) {
+			st->stk_id = 0xFF;
+			continue;
+		}
+
+		st->phys_port_id = i;
+		st->par_id = 0;
+		st->log_port_id = i;
+		st->stk_id = (i / SWITCHTEC_PORTS_PER_STACK) << 4 |
+			(i % SWITCHTEC_PORTS_PER_STACK);
+		st->cfg_lnk_width = i ? 4 : 16;
+		st->neg_lnk_width = st->cfg_lnk_width;
+		st->usp_flag = !i;
+		st->linkup_linkrate = 0x80 | rate;
+		st->ltssm = htole16(0x0103);
+	}
+
+	return 0;
+}
+
+static int sim_bind_find(struct switchtec_sim *sdev, int par_id,
+			 int log_port_id)
+{
+	int i;
+
+	for (i = 0; i < sdev->nr_ports && i < SWITCHTEC_MAX_PHY_PORTS; i++)
+		if (sdev->bind[i].bound && sdev->bind[i].par_id == par_id &&
+		    sdev->bind[i].log_port_id == log_port_id)
+			return i;
+
+	return -1;
+}
+
+/* Binds take SIM_BIND_US to complete; busy ports reject new requests */
+static int sim_portpartp2p(struct switchtec_sim *sdev, const uint8_t *in,
+			   size_t in_len, uint8_t *out, size_t out_len)
+{
+	const struct switchtec_bind_status_in *q = (const void *)in;
+	struct switchtec_bind_status_out *st = (void *)out;
+	const struct switchtec_bind_in *b = (const void *)in;
+	uint64_t now = platform_time_us();
+	struct sim_bind *p;
+	int i;
+
+	switch (in[0]) {
+	case MRPC_PORT_INFO:
+		for (i = 0; i < sdev->nr_ports &&
+		     i < SWITCHTEC_MAX_PHY_PORTS; i++) {
+			p = &sdev->bind[i];
+			if (q->phys_port_id != 0xff && q->phys_port_id != i)
+				continue;
+
+			st->port_info[st->inf_cnt].phys_port_id = i;
+			st->port_info[st->inf_cnt].par_id = p->par_id;
+			st->port_info[st->inf_cnt].log_port_id = p->log_port_id;
+			st->port_info[st->inf_cnt].bind_state = p->bound << 4 |
+				(now < p->done_us ? BIND_INFO_IN_PROGRESS :
+				 BIND_INFO_SUCCESS);
+			st->inf_cnt++;
+		}
+		return 0;
+	case MRPC_PORT_BIND:
+		if (b->phys_port_id >= sdev->nr_ports ||
+		    b->phys_port_id >= SWITCHTEC_MAX_PHY_PORTS)
+			return ERR_PARAM_INVALID;
+
+		p = &sdev->bind[b->phys_port_id];
+		if (p->bound || now < p->done_us ||
+		    sim_bind_find(sdev, b->par_id, b->log_port_id) >= 0)
+			return ERR_PARAM_INVALID;
+
+		p->bound = true;
+		p->par_id = b->par_id;
+		p->log_port_id = b->log_port_id;
+		p->done_us = now + SIM_BIND_US;
+		return 0;
+	case MRPC_PORT_UNBIND:
+		i = sim_bind_find(sdev, b->par_id, b->log_port_id);
+		if (i < 0 || now < sdev->bind[i].done_us)
+			return ERR_PARAM_INVALID;
+
+		sdev->bind[i].bound = false;
+		sdev->bind[i].done_us = now + SIM_BIND_US;
+		return 0;
+	default:
+		return ERR_SUBCMD_INVALID;
+	}
+}
+
+static int sim_port_width(struct switchtec_sim *sdev, int port)
+{
+	if (port >= sdev->nr_ports)
+		return 0;
+
+	return port ? 4 : 16;
+}
+
+/* Receiver objects of port p, lane l are derived from p and l */
+static int sim_rcvr_obj(struct switchtec_sim *sdev, const uint8_t *in,
+			size_t in_len, uint8_t *out, size_t out_len)
+{
+	const struct switchtec_diag_rcvr_obj_dump_in *q = (const void *)in;
+	struct switchtec_diag_rcvr_obj_dump_out *r = (void *)out;
+	int i;
+
+	if (q->lane_id >= sim_port_width(sdev, q->port_id))
+		return ERR_PARAM_INVALID;
+
+	r->port_id = q->port_id;
+	r->lane_id = q->lane_id;
+	r->ctle = 10 + q->port_id;
+	r->target_amplitude = 40 + q->lane_id;
+	r->speculative_dfe = q->port_id ^ q->lane_id;
+	for (i = 0; i < ARRAY_SIZE(r->dynamic_dfe); i++)
+		r->dynamic_dfe[i] = i - 3 + q->lane_id;
+
+	return 0;
+}
+
+static int sim_port_eq_status(struct switchtec_sim *sdev, const uint8_t *in,
+			      size_t in_len, uint8_t *out, size_t out_len)
+{
+	const struct switchtec_diag_port_eq_status_in *eq = (const void *)in;
+	const struct switchtec_diag_port_eq_status_in2 *eq2 = (const void *)in;
+	struct switchtec_diag_port_eq_status_out *coeff = (void *)out;
+	struct switchtec_diag_port_eq_table_out *table = (void *)out;
+	struct switchtec_diag_port_eq_tx_fslf_out *fslf = (void *)out;
+	int i, width;
+
+	switch (in[0]) {
+	case MRPC_PORT_EQ_LOCAL_TX_COEFF_DUMP:
+	case MRPC_PORT_EQ_FAR_END_TX_COEFF_DUMP:
+		width = sim_port_width(sdev, eq->port_id);
+		if (!width)
+			return ERR_PARAM_INVALID;
+
+		coeff->port_id = eq->port_id;
+		coeff->lane_id = width - 1;
+		for (i = 0; i < width; i++) {
+			coeff->cursors[i].pre = 4 + in[0] + i % 3;
+			coeff->cursors[i].post = 12 - i % 5;
+		}
+		return 0;
+	case MRPC_PORT_EQ_FAR_END_TX_EQ_TABLE_DUMP:
+		if (!sim_port_width(sdev, eq2->port_id))
+			return ERR_PARAM_INVALID;
+
+		table->port_id = eq2->port_id;
+		table->step_cnt = 8;
+		for (i = 0; i < table->step_cnt; i++) {
+			table->steps[i].pre_cursor = i;
+			table->steps[i].post_cursor = 2 * i;
+			table->steps[i].fom = 100 + eq2->port_id + i;
+			table->steps[i].active_status = i == 5;
+			table->steps[i].speed = 4;
+		}
+		return 0;
+	case MRPC_PORT_EQ_LOCAL_TX_FSLF_DUMP:
+	case MRPC_PORT_EQ_FAR_END_TX_FSLF_DUMP:
+		if (eq2->lane_id >= sim_port_width(sdev, eq2->port_id))
+			return ERR_PARAM_INVALID;
+
+		fslf->port_id = eq2->port_id;
+		fslf->lane_id = eq2->lane_id;
+		fslf->fs = 48 + in[0];
+		fslf->lf = 16;
+		return 0;
+	default:
+		return ERR_SUBCMD_INVALID;
+	}
+}
+
+/* Only the current link is modelled, so previous dumps are rejected */
+static int sim_ext_rcvr_obj(struct switchtec_sim *sdev, const uint8_t *in,
+			    size_t in_len, uint8_t *out, size_t out_len)
+{
+	const struct switchtec_diag_ext_recv_obj_dump_in *q = (const void *)in;
+	struct switchtec_diag_rcvr_ext_out *r = (void *)out;
+
+	if (q->sub_cmd != MRPC_EXT_RCVR_OBJ_DUMP_RCVR_EXT)
+		return ERR_SUBCMD_INVALID;
+
+	if (q->lane_id >= sim_port_width(sdev, q->port_id))
+		return ERR_PARAM_INVALID;
+
+	r->port_id = q->port_id;
+	r->lane_id = q->lane_id;
+	r->ctle2_rx_mode = htole16(0x100 + q->lane_id);
+	r->dtclk_5 = 5;
+	r->dtclk_8_6 = 6;
+	r->dtclk_9 = 9;
+
+	return 0;
+}
+
+/* Port n moves (n + 1) MB/s each way, split between the TLP types */
+static void sim_bw_dir(uint64_t us, int port,
+		       struct switchtec_bwcntr_dir *d)
+{
+	uint64_t bytes = us * (port + 1);
+
+	d->posted = htole64(bytes / 2);
+	d->comp = htole64(bytes / 4 + bytes / 8);
+	d->nonposted = htole64(bytes / 8);
+}
+
+static int sim_pmon_bw_get(struct switchtec_sim *sdev, const uint8_t *in,
+			   uint8_t *out, size_t out_len)
+{
+	const struct pmon_bw_get *cmd = (const void *)in;
+	struct switchtec_bwcntr_res *res = (void *)out;
+	uint64_t now = platform_time_us();
+	uint64_t us;
+	int i, port;
+
+	if (cmd->count * sizeof(*res) > MRPC_MAX_DATA_LEN)
+		return ERR_PARAM_INVALID;
+
+	for (i = 0; i < cmd->count; i++, res++) {
+		port = cmd->ports[i].id;
+		if (port >= sdev->nr_ports)
+			return ERR_PARAM_INVALID;
+
+		us = now - sdev->bw_clear_us[port];
+		res->time_us = htole64(us);
+		sim_bw_dir(us, port, &res->egress);
+		sim_bw_dir(us / 2, port, &res->ingress);
+
+		if (cmd->ports[i].clear)
+			sdev->bw_clear_us[port] = now;
+	}
+
+	return 0;
+}
+
+static int sim_pmon_evcntr(struct switchtec_sim *sdev, const uint8_t *in,
+			   uint8_t *out, size_t out_len)
+{
+	const struct pmon_event_counter_setup *setup = (const void *)in;
+	const struct pmon_event_counter_get *get = (const void *)in;
+	struct pmon_event_counter_get_setup_result *sres = (void *)out;
+	struct pmon_event_counter_result *res = (void *)out;
+	uint64_t now = platform_time_us();
+	struct sim_evcntr *c;
+	int i;
+
+	if (setup->stack_id >= SWITCHTEC_MAX_STACKS ||
+	    setup->counter_id + setup->num_counters >
+	    SWITCHTEC_MAX_EVENT_COUNTERS)
+		return ERR_PARAM_INVALID;
+
+	/* Only the setup command is limited by the size of its payload */
+	if (setup->sub_cmd_id == MRPC_PMON_SETUP_EV_COUNTER &&
+	    setup->num_counters > ARRAY_SIZE(setup->counters))
+		return ERR_PARAM_INVALID;
+
+	c = &sdev->evcntr[setup->stack_id][setup->counter_id];
+
+	switch (setup->sub_cmd_id) {
+	case MRPC_PMON_SETUP_EV_COUNTER:
+		for (i = 0; i < setup->num_counters; i++, c++) {
+			c->mask = le32toh(setup->counters[i].mask);
+			c->ieg = setup->counters[i].ieg;
+			c->thresh = le32toh(setup->counters[i].thresh);
+			c->clear_us = now;
+		}
+		break;
+	case MRPC_PMON_GET_EV_COUNTER_SETUP:
+		for (i = 0; i < get->num_counters; i++, c++, sres++) {
+			sres->mask = htole32(c->mask);
+			sres->ieg = c->ieg;
+			sres->thresh = htole32(c->thresh);
+		}
+		break;
+	case MRPC_PMON_GET_EV_COUNTER:
+		/* A configured counter counts one event per millisecond */
+		for (i = 0; i < get->num_counters; i++, c++, res++) {
+			if (c->mask)
+				res->value = htole32((now - c->clear_us) /
+						     1000);
+			res->threshold = htole32(c->thresh);
+
+			if (get->read_clear)
+				c->clear_us = now;
+		}
+		break;
+	}
+
+	return 0;
+}
+
+static int sim_pmon_lat_get(struct switchtec_sim *sdev, const uint8_t *in,
+			    uint8_t *out, size_t out_len)
+{
+	const struct pmon_lat_get *cmd = (const void *)in;
+	struct pmon_lat_data *res = (void *)out;
+	int i, port;
+
+	if (cmd->count > ARRAY_SIZE(cmd->port_ids))
+		return ERR_PARAM_INVALID;
+
+	for (i = 0; i < cmd->count; i++, res++) {
+		port = cmd->port_ids[i];
+		res->cur_ns = htole16(200 + 10 * port);
+		res->max_ns = htole16(400 + 10 * port);
+	}
+
+	return 0;
+}
+
+static int sim_pmon(struct switchtec_sim *sdev, const uint8_t *in,
+		    size_t in_len, uint8_t *out, size_t out_len)
+{
+	switch (in[0]) {
+	case MRPC_PMON_GET_BW_COUNTER:
+		return sim_pmon_bw_get(sdev, in, out, out_len);
+	case MRPC_PMON_SETUP_EV_COUNTER:
+	case MRPC_PMON_GET_EV_COUNTER:
+	case MRPC_PMON_GET_EV_COUNTER_SETUP:
+		return sim_pmon_evcntr(sdev, in, out, out_len);
+	case MRPC_PMON_GET_LAT_COUNTER:
+		return sim_pmon_lat_get(sdev, in, out, out_len);
+	case MRPC_PMON_SET_BW_COUNTER:
+	case MRPC_PMON_SETUP_LAT_COUNTER:
+		return 0;
+	default:
+		return ERR_SUBCMD_INVALID;
+	}
+}
+
+static void sim_log_entry(struct log_a_data *d, uint32_t e)
+{
+	uint64_t ts = (uint64_t)e * 100000;
+
+	d->data[0] = htole32(ts >> 32);
+	d->data[1] = htole32(ts);
+	d->data[2] = htole32((e % 5 + 1) << 28 | (e % 11) << 16 |
+			     (e & 0xFFFF));
+	d->data[3] = htole32(e);
+	d->data[4] = htole32(e + 1);
+}
+
+static int sim_log_a(struct switchtec_sim *sdev, const uint8_t *in,
+		     uint8_t *out, size_t out_len)
+{
+	const struct log_a_retr *cmd = (const void *)in;
+	struct log_a_retr_result *res = (void *)out;
+	uint64_t gen, first, start, n, max;
+	uint32_t i;
+
+	gen = SIM_LOG_INITIAL + (platform_time_us() - sdev->start_us) *
+		SIM_LOG_PER_SEC / 1000000;
+	first = gen > SIM_LOG_CAPACITY ? gen - SIM_LOG_CAPACITY : 0;
+
+	start = le32toh(cmd->start);
+	if (start == UINT32_MAX || start < first)
+		start = first;
+	if (start > gen)
+		start = gen;
+
+	max = ARRAY_SIZE(res->data);
+	if (cmd->count && le32toh(cmd->count) < max)
+		max = le32toh(cmd->count);
+
+	n = gen - start;
+	if (n > max)
+		n = max;
+
+	for (i = 0; i < n; i++)
+		sim_log_entry(&res->data[i], start + i);
+
+	res->hdr.sub_cmd_id = cmd->sub_cmd_id;
+	res->hdr.overflow = first != 0;
+	res->hdr.total = htole32(gen - first);
+	res->hdr.count = htole32(n);
+	res->hdr.remain = htole32(gen - start - n);
+	res->hdr.next_start = htole32(start + n);
+	res->hdr.fw_version = sdev->gas->sys_info.firmware_version;
+
+	return 0;
+}
+
+static int sim_log_b(struct switchtec_sim *sdev, const uint8_t *in,
+		     uint8_t *out, size_t out_len)
+{
+	const struct log_b_retr *cmd = (const void *)in;
+	struct log_b_retr_result *res = (void *)out;
+	uint32_t off = le32toh(cmd->offset);
+	uint32_t len = le32toh(cmd->length);
+	uint32_t i;
+
+	if (off > SIM_MEMLOG_LEN)
+		return ERR_PARAM_INVALID;
+
+	if (len > sizeof(res->data))
+		len = sizeof(res->data);
+	if (len > SIM_MEMLOG_LEN - off)
+		len = SIM_MEMLOG_LEN - off;
+
+	for (i = 0; i < len; i++)
+		res->data[i] = off + i;
+
+	res->hdr.sub_cmd_id = cmd->sub_cmd_id;
+	res->hdr.length = htole32(len);
+	res->hdr.remain = htole32(SIM_MEMLOG_LEN - off - len);
+
+	return 0;
+}
+
+static int sim_fwlogrd(struct switchtec_sim *sdev, const uint8_t *in,
+		       size_t in_len, uint8_t *out, size_t out_len)
+{
+	struct sim_log_c_reply *reply = (void *)out;
+
+	switch (in[0]) {
+	case MRPC_FWLOGRD_RAM:
+	case MRPC_FWLOGRD_FLASH:
+	case MRPC_FWLOGRD_RAM_GEN5:
+	case MRPC_FWLOGRD_FLASH_GEN5:
+	case MRPC_FWLOGRD_RAM_WITH_FLAG:
+	case MRPC_FWLOGRD_FLASH_WITH_FLAG:
+		return sim_log_a(sdev, in, out, out_len);
+	case MRPC_FWLOGRD_MEMLOG:
+	case MRPC_FWLOGRD_REGS:
+	case MRPC_FWLOGRD_SYS_STACK:
+	case MRPC_FWLOGRD_THRD_STACK:
+	case MRPC_FWLOGRD_THRD:
+		return sim_log_b(sdev, in, out, out_len);
+	case MRPC_FWLOGRD_NVHDR:
+		reply->fw_version = sdev->gas->sys_info.firmware_version;
+		return 0;
+	default:
+		return ERR_SUBCMD_INVALID;
+	}
+}
+
+static int sim_rd_flash(struct switchtec_sim *sdev, const uint8_t *in,
+			size_t in_len, uint8_t *out, size_t out_len)
+{
+	const struct sim_rd_flash *cmd = (const void *)in;
+	uint32_t addr = le32toh(cmd->addr);
+	uint32_t len = le32toh(cmd->length);
+	uint32_t i, a;
+
+	if (len > MRPC_MAX_DATA_LEN || addr > SIM_FLASH_LEN ||
+	    len > SIM_FLASH_LEN - addr)
+		return ERR_PARAM_INVALID;
+
+	for (i = 0; i < len; i++) {
+		a = addr + i;
+		out[i] = a ^ (a >> 8) ^ (a >> 16);
+	}
+
+	return 0;
+}
+
+static int sim_gas_read(struct switchtec_sim *sdev, const uint8_t *in,
+			size_t in_len, uint8_t *out, size_t out_len)
+{
+	const struct gas_mrpc_read *cmd = (const void *)in;
+	uint32_t off = le32toh(cmd->gas_offset);
+	uint32_t len = le32toh(cmd->len);
+
+	if (len > MRPC_MAX_DATA_LEN || off > sizeof(*sdev->gas) ||
+	    len > sizeof(*sdev->gas) - off)
+		return ERR_PARAM_INVALID;
+
+	memcpy(out, (uint8_t *)sdev->gas + off, len);
+
+	return 0;
+}
+
+/* Whole registers go through sim_gas_write32() to act on event headers */
+static int sim_gas_write(struct switchtec_sim *sdev, const uint8_t *in,
+			 size_t in_len, uint8_t *out, size_t out_len)
+{
+	const struct gas_mrpc_write *cmd = (const void *)in;
+	struct switchtec_dev *dev = &sdev->dev;
+	uint32_t off = le32toh(cmd->gas_offset);
+	uint32_t len = le32toh(cmd->len);
+	uint32_t i, val;
+
+	if (len > sizeof(cmd->data) || off > sizeof(*sdev->gas) ||
+	    len > sizeof(*sdev->gas) - off)
+		return ERR_PARAM_INVALID;
+
+	for (i = 0; i < len; off++, i++) {
+		if (off & 3 || len - i < 4) {
+			((uint8_t *)sdev->gas)[off] = cmd->data[i];
+			continue;
+		}
+
+		memcpy(&val, &cmd->data[i], sizeof(val));
+		sim_gas_write32(dev, val, (void __gas *)dev->gas_map + off);
+		off += 3;
+		i += 3;
+	}
+
+	return 0;
+}
+
+static int sim_get_pax_id(struct switchtec_sim *sdev, const uint8_t *in,
+			  size_t in_len, uint8_t *out, size_t out_len)
+{
+	out[0] = 0;
+	return 0;
+}
+
+typedef int (*sim_handler)(struct switchtec_sim *sdev, const uint8_t *in,
+			   size_t in_len, uint8_t *out, size_t out_len);
+
+static sim_handler sim_find_handler(uint32_t cmd)
+{
+	switch (cmd & SWITCHTEC_CMD_MASK) {
+	case MRPC_ECHO:		return sim_echo;
+	case MRPC_I2C_TWI_PING:	return sim_twi_ping;
+	case MRPC_DIETEMP:	return sim_dietemp;
+	case MRPC_LNKSTAT:	return sim_lnkstat;
+	case MRPC_PMON:		return sim_pmon;
+	case MRPC_FWLOGRD:	return sim_fwlogrd;
+	case MRPC_RD_FLASH:	return sim_rd_flash;
+	case MRPC_GAS_READ:	return sim_gas_read;
+	case MRPC_GAS_WRITE:	return sim_gas_write;
+	case MRPC_GET_PAX_ID:	return sim_get_pax_id;
+	case MRPC_PORTPARTP2P:	return sim_portpartp2p;
+	case MRPC_RCVR_OBJ_DUMP:	return sim_rcvr_obj;
+	case MRPC_PORT_EQ_STATUS:	return sim_port_eq_status;
+	case MRPC_EXT_RCVR_OBJ_DUMP:	return sim_ext_rcvr_obj;
+	default:		return NULL;
+	}
+}
+
+/*
+ * Run a command against the model. Returns 0, a positive MRPC error
+ * code, or a negative errno if the request couldn't be sent at all.
+ */
+static int sim_exec(struct switchtec_sim *sdev, uint32_t cmd,
+		    const void *payload, size_t payload_len, void *resp,
+		    size_t resp_len)
+{
+	uint8_t in[MRPC_MAX_DATA_LEN] = {0};
+	uint8_t out[MRPC_MAX_DATA_LEN] = {0};
+	sim_handler handler;
+	int ret;
+
+	if (payload_len > MRPC_MAX_DATA_LEN || resp_len > MRPC_MAX_DATA_LEN) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	if (payload)
+		memcpy(in, payload, payload_len);
+
+	handler = sim_find_handler(cmd);
+	if (!handler)
+		return ERR_CMD_INVALID;
+
+	ret = handler(sdev, in, payload_len, out, resp_len);
+	if (!ret && resp)
+		memcpy(resp, out, resp_len);
+
+	return ret;
+}
+
+static void sim_cmd_done(struct switchtec_sim *sdev, int ret)
+{
+	if (ret >= 0)
+		sim_event_raise(sdev, SWITCHTEC_PART_EVT_MRPC_COMP,
+				sdev->dev.partition);
+}
+
+static int sim_cmd(struct switchtec_dev *dev, uint32_t cmd,
+		   const void *payload, size_t payload_len, void *resp,
+		   size_t resp_len)
+{
+	struct switchtec_sim *sdev = to_switchtec_sim(dev);
+	int ret;
+
+	ret = sim_exec(sdev, cmd, payload, payload_len, resp, resp_len);
+	if (ret >= 0)
+		sim_delay(sdev->rtt_us + sim_exec_us(sdev, cmd));
+
+	sim_cmd_done(sdev, ret);
+	if (ret > 0)
+		errno = ret;
+
+	return ret;
+}
+
+/*
+ * A batch costs one round trip; the commands still execute one after
+ * the other.
+ */
+static int sim_cmd_batch(struct switchtec_dev *dev,
+			 struct switchtec_cmd_desc *cmds, int n)
+{
+	struct switchtec_sim *sdev = to_switchtec_sim(dev);
+	uint64_t us = sdev->rtt_us;
+	uint32_t cmd;
+	int i;
+
+	for (i = 0; i < n; i++) {
+		cmd = platform_cmd_id(dev, cmds[i].cmd);
+		cmds[i].ret = sim_exec(sdev, cmd, cmds[i].payload,
+				       cmds[i].payload_len, cmds[i].resp,
+				       cmds[i].resp_len);
+		us += sim_exec_us(sdev, cmd);
+	}
+
+	sim_delay(us);
+
+	for (i = 0; i < n; i++)
+		sim_cmd_done(sdev, cmds[i].ret);
+
+	return 0;
+}
+
+static int sim_cmd_submit(struct switchtec_dev *dev, uint32_t cmd,
+			  const void *payload, size_t payload_len,
+			  size_t resp_len)
+{
+	struct switchtec_sim *sdev = to_switchtec_sim(dev);
+	int ret;
+
+	ret = sim_exec(sdev, cmd, payload, payload_len, sdev->async.resp,
+		       resp_len);
+	if (ret < 0)
+		return ret;
+
+	sdev->async.ret = ret;
+	sdev->async.done_us = platform_time_us() + sdev->rtt_us +
+		sim_exec_us(sdev, cmd);
+
+	return 0;
+}
+
+static int sim_cmd_poll(struct switchtec_dev *dev)
+{
+	struct switchtec_sim *sdev = to_switchtec_sim(dev);
+
+	return platform_time_us() >= sdev->async.done_us;
+}
+
+static int sim_cmd_complete(struct switchtec_dev *dev, void *resp,
+			    size_t resp_len)
+{
+	struct switchtec_sim *sdev = to_switchtec_sim(dev);
+	uint64_t now = platform_time_us();
+	int ret = sdev->async.ret;
+
+	if (now < sdev->async.done_us)
+		sim_delay(sdev->async.done_us - now);
+
+	if (!ret && resp)
+		memcpy(resp, sdev->async.resp, resp_len);
+
+	sim_cmd_done(sdev, ret);
+	if (ret > 0)
+		errno = ret;
+
+	return ret;
+}
+
+static void sim_close(struct switchtec_dev *dev)
+{
+	struct switchtec_sim *sdev = to_switchtec_sim(dev);
+
+	pthread_cond_destroy(&sdev->ev_cond);
+	pthread_mutex_destroy(&sdev->ev_lock);
+	free(sdev->gas);
+	platform_dev_fini(dev);
+	free(sdev);
+}
+
+static const struct switchtec_ops sim_ops = {
+	.close = sim_close,
+	.gas_map = sim_gas_map,
+	.cmd = sim_cmd,
+	.cmd_batch = sim_cmd_batch,
+	.cmd_submit = sim_cmd_submit,
+	.cmd_poll = sim_cmd_poll,
+	.cmd_complete = sim_cmd_complete,
+	.get_device_id = gasop_get_device_id,
+	.get_fw_version = gasop_get_fw_version,
+	.pff_to_port = gasop_pff_to_port,
+	.port_to_pff = gasop_port_to_pff,
+	.flash_part = gasop_flash_part,
+	.event_summary = gasop_event_summary,
+	.event_summary_sparse = gasop_event_summary_sparse,
+	.event_ctl = gasop_event_ctl,
+	.event_block_ctl = gasop_event_block_ctl,
+	.event_wait = sim_event_wait,
+	.event_wait_for = gasop_event_wait_for,
+
+	.gas_read8 = mmap_gas_read8,
+	.gas_read16 = mmap_gas_read16,
+	.gas_read32 = mmap_gas_read32,
+	.gas_read64 = mmap_gas_read64,
+	.gas_write8 = mmap_gas_write8,
+	.gas_write16 = mmap_gas_write16,
+	.gas_write32 = sim_gas_write32,
+	.gas_write32_no_retry = sim_gas_write32,
+	.gas_write64 = mmap_gas_write64,
+	.memcpy_to_gas = mmap_memcpy_to_gas,
+	.memcpy_from_gas = mmap_memcpy_from_gas,
+	.write_from_gas = mmap_write_from_gas,
+};
+
+static int sim_parse_ulong(const char *val, unsigned long *out)
+{
+	char *end;
+
+	errno = 0;
+	*out = strtoul(val, &end, 0);
+	if (errno || end == val || *end)
+		return -1;
+
+	return 0;
+}
+
+static int sim_set_option(struct switchtec_sim *sdev, const char *key,
+			  const char *val, int *device_id)
+{
+	unsigned long v;
+	const char *name;
+	int id;
+
+	if (sim_parse_ulong(val, &v))
+		return -1;
+
+	if (!strcmp(key, "id")) {
+		*device_id = v;
+		return 0;
+	}
+
+	if (!strcmp(key, "ports")) {
+		sdev->nr_ports = v;
+		return 0;
+	}
+
+	if (!strcmp(key, "rtt")) {
+		sdev->rtt_us = v;
+		return 0;
+	}
+
+	if (!strcmp(key, "latency")) {
+		for (id = 0; id < MRPC_MAX_ID; id++)
+			sdev->exec_us[id] = v;
+		return 0;
+	}
+
+	for (id = 0; id < MRPC_MAX_ID; id++) {
+		name = switchtec_mrpc_name(id);
+		if (name && !strcasecmp(name, key)) {
+			sdev->exec_us[id] = v;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/*
+ * Options are applied left to right, so a later "latency" overrides
+ * earlier per-command times.
+ */
+static int sim_parse_options(struct switchtec_sim *sdev, const char *options,
+			     int *device_id)
+{
+	char buf[256];
+	char *opt, *next, *val;
+
+	if (!options)
+		return 0;
+
+	if (snprintf(buf, sizeof(buf), "%s", options) >= sizeof(buf))
+		return -1;
+
+	for (opt = buf; opt; opt = next) {
+		next = strchr(opt, ',');
+		if (next)
+			*next++ = 0;
+
+		val = strchr(opt, '=');
+		if (!val) {
+			/* A leading bare word just names the instance */
+			if (opt != buf)
+				return -1;
+			continue;
+		}
+
+		*val++ = 0;
+		if (sim_set_option(sdev, opt, val, device_id))
+			return -1;
+	}
+
+	return 0;
+}
+
+struct switchtec_dev *switchtec_open_sim(const char *options)
+{
+	struct switchtec_sim *sdev;
+	int device_id = SIM_DEFAULT_DEVICE_ID;
+	int i;
+
+	sdev = calloc(1, sizeof(*sdev));
+	if (!sdev)
+		return NULL;
+
+	sdev->nr_ports = SIM_DEFAULT_PORTS;
+
+	if (sim_parse_options(sdev, options, &device_id))
+		goto err_inval;
+
+	sdev->gen = sim_id_to_gen(device_id);
+	if (sdev->nr_ports < 1 ||
+	    sdev->nr_ports > sim_gen_max_ports(sdev->gen))
+		goto err_inval;
+
+	/* Pages of the image that are never touched are never committed */
+	sdev->gas = calloc(1, sizeof(*sdev->gas));
+	if (!sdev->gas)
+		goto err_free;
+
+	sdev->start_us = platform_time_us();
+	for (i = 0; i < ARRAY_SIZE(sdev->bw_clear_us); i++)
+		sdev->bw_clear_us[i] = sdev->start_us;
+
+	sim_init_gas(sdev, device_id);
+
+	pthread_mutex_init(&sdev->ev_lock, NULL);
+	pthread_cond_init(&sdev->ev_cond, NULL);
+
+	sdev->dev.gas_map = (gasptr_t __force)sdev->gas;
+	sdev->dev.gas_map_size = sizeof(*sdev->gas);
+
+	platform_dev_init(&sdev->dev);
+	sdev->dev.ops = &sim_ops;
+
+	gasop_set_partition_info(&sdev->dev);
+
+	return &sdev->dev;
+
+err_inval:
+	errno = EINVAL;
+err_free:
+	free(sdev);
+	return NULL;
+}
@@ -0,0 +1,87 @@
+/*
+ * Microsemi Switchtec(tm) PCIe Management Library
+ * Copyright (c) 2017, Microsemi Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+#ifndef LIBSWITCHTEC_SWITCHTECD_H
+#define LIBSWITCHTEC_SWITCHTECD_H
+
+/*
+ * Wire protocol between the switchtecd daemon and the client transport
+ * in linux-switchtecd.c. Both ends run on the same host so fields are
+ * in host byte order.
+ *
+ * A client connects to the daemon's unix socket and sends an OPEN
+ * request naming the device; the reply carries the state the daemon
+ * probed when it opened the device. After that every request is a
+ * header followed by len bytes of data and is answered, in order, by a
+ * response header followed by len bytes. Clients may send several
+ * requests before reading the responses.
+ */
+
+#include "switchtec/mrpc.h"
+
+#include <stdint.h>
+
+#define SWITCHTECD_SOCKET_PATH "/run/switchtecd.sock"
+#define SWITCHTECD_SOCKET_ENV "SWITCHTECD_SOCKET"
+#define SWITCHTECD_DEVICE_PREFIX "switchtecd:"
+
+#define SWITCHTECD_PROTO_VERSION 1
+
+/* Largest data section of any request or response */
+#define SWITCHTECD_MAX_DATA MRPC_MAX_DATA_LEN
+
+enum switchtecd_req_type {
+	SWITCHTECD_REQ_OPEN = 1,	//!< arg: version, data: device name
+	SWITCHTECD_REQ_CMD,		//!< arg: command ID, data: payload
+	SWITCHTECD_REQ_GAS_READ,	//!< arg: GAS offset
+	SWITCHTECD_REQ_GAS_WRITE,	//!< arg: GAS offset, data: bytes
+	SWITCHTECD_REQ_PFF_TO_PORT,	//!< arg: PFF, resp: partition, port
+	SWITCHTECD_REQ_PORT_TO_PFF,	//!< arg: partition << 16 | port
+};
+
+struct switchtecd_req {
+	uint32_t type;
+	uint32_t arg;
+	uint32_t len;
+	uint32_t resp_len;
+};
+
+struct switchtecd_resp {
+	int32_t ret;
+	int32_t err;
+	uint32_t len;
+	uint32_t rsvd;
+};
+
+/* Data of the response to SWITCHTECD_REQ_OPEN */
+struct switchtecd_dev_info {
+	int32_t device_id;
+	int32_t gen;
+	int32_t var;
+	int32_t boot_phase;
+	int32_t local_pax_id;
+	uint32_t gas_map_size;
+};
+
+#endif
@@ -41,12 +41,34 @@
 struct switchtec_windows {
 	struct switchtec_dev dev;
 	HANDLE hdl;
+
+	OVERLAPPED mrpc_overlap;
+	HANDLE mrpc_event;
+	struct switchtec_mrpc_cmd *mcmd;
+	struct switchtec_mrpc_result *mres;
+
+	OVERLAPPED evt_overlap;
+	HANDLE evt_event;
+	bool evt_armed;
+	bool port_bound;	//!< hdl is associated with a completion port
+	bool port_active;	//!< Event requests complete to that port
 };
 
 #define to_switchtec_windows(d)  \
 	((struct switchtec_windows *) \
 	 ((char *)d - offsetof(struct switchtec_windows, dev)))
 
+/*
+ * An OVERLAPPED whose event handle has the low-order bit set does not
+ * queue a packet to the completion port associated with the file
+ * handle. MRPC requests always use it so only event waits ever reach
+ * a monitor's port.
+ */
+static HANDLE no_port(HANDLE event)
+{
+	return (HANDLE)((ULONG_PTR)event | 1);
+}
+
 static int earlier_error = 0;
 
 const char *platform_strerror(void)
@@ -230,13 +252,39 @@ static void append_guid(const char *path, char *path_with_guid, size_t bufsize,
 #define __force
 #endif
 
+/*
+ * The device is opened with FILE_FLAG_OVERLAPPED so every request needs
+ * an OVERLAPPED, even the ones we wait for straight away.
+ */
+static BOOL windows_ioctl(struct switchtec_windows *wdev, DWORD code,
+			  void *in, DWORD in_len, void *out, DWORD out_len)
+{
+	OVERLAPPED overlap = {0};
+	DWORD transferred;
+	BOOL status;
+
+	overlap.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+	if (!overlap.hEvent)
+		return FALSE;
+	overlap.hEvent = no_port(overlap.hEvent);
+
+	status = DeviceIoControl(wdev->hdl, code, in, in_len, out, out_len,
+				 NULL, &overlap);
+	if (status || GetLastError() == ERROR_IO_PENDING)
+		status = GetOverlappedResult(wdev->hdl, &overlap,
+					     &transferred, TRUE);
+
+	CloseHandle((HANDLE)((ULONG_PTR)overlap.hEvent & ~(ULONG_PTR)1));
+	return status;
+}
+
 static BOOL map_gas(struct switchtec_windows *wdev)
 {
 	BOOL status;
 	struct switchtec_gas_map map;
 
-	status = DeviceIoControl(wdev->hdl, IOCTL_SWITCHTEC_GAS_MAP, NULL, 0,
-				 &map, sizeof(map), NULL, NULL);
+	status = windows_ioctl(wdev, IOCTL_SWITCHTEC_GAS_MAP, NULL, 0,
+			       &map, sizeof(map));
 	if (!status) {
 		earlier_error = GetLastError();
 		return status;
@@ -254,16 +302,46 @@ static void unmap_gas(struct switchtec_windows *wdev)
 		.length = wdev->dev.gas_map_size,
 	};
 
-	DeviceIoControl(wdev->hdl, IOCTL_SWITCHTEC_GAS_UNMAP, &map, sizeof(map),
-			NULL, 0, NULL, NULL);
+	windows_ioctl(wdev, IOCTL_SWITCHTEC_GAS_UNMAP, &map, sizeof(map),
+		      NULL, 0);
+}
+
+/*
+ * Cancel an overlapped request and wait for it to finish. The kernel
+ * may write to the request's buffers until it has completed, so they
+ * must not be freed or reused before this returns.
+ */
+static void windows_io_cancel(struct switchtec_windows *wdev,
+			      OVERLAPPED *overlap)
+{
+	DWORD transferred;
+
+	if (!HasOverlappedIoCompleted(overlap))
+		CancelIoEx(wdev->hdl, overlap);
+	GetOverlappedResult(wdev->hdl, overlap, &transferred, TRUE);
 }
 
+static void windows_event_wait_disarm(struct switchtec_dev *dev);
+
 static void windows_close(struct switchtec_dev *dev)
 {
 	struct switchtec_windows *wdev = to_switchtec_windows(dev);
 
+	windows_event_wait_disarm(dev);
+	if (wdev->evt_event)
+		CloseHandle(wdev->evt_event);
+
+	if (wdev->mcmd) {
+		windows_io_cancel(wdev, &wdev->mrpc_overlap);
+		free(wdev->mcmd);
+		free(wdev->mres);
+	}
+	if (wdev->mrpc_event)
+		CloseHandle(wdev->mrpc_event);
+
 	unmap_gas(wdev);
 	CloseHandle(wdev->hdl);
+	platform_dev_fini(dev);
 }
 
 int switchtec_list(struct switchtec_device_info **devlist)
@@ -323,91 +401,237 @@ int switchtec_list(struct switchtec_device_info **devlist)
 	return cnt;
 }
 
-static int windows_cmd(struct switchtec_dev *dev, uint32_t cmd,
-		       const void *payload, size_t payload_len, void *resp,
-		       size_t resp_len)
+static void windows_cmd_free(struct switchtec_windows *wdev)
+{
+	free(wdev->mcmd);
+	free(wdev->mres);
+	wdev->mcmd = NULL;
+	wdev->mres = NULL;
+}
+
+static int windows_cmd_submit(struct switchtec_dev *dev, uint32_t cmd,
+			      const void *payload, size_t payload_len,
+			      size_t resp_len)
 {
 	struct switchtec_windows *wdev = to_switchtec_windows(dev);
+	size_t mcmd_len, mres_len;
 	BOOL status;
-	int ret;
 
-	struct switchtec_mrpc_cmd *mcmd;
-	struct switchtec_mrpc_result *mres;
-	size_t mcmd_len, mres_len;
+	if (!wdev->mrpc_event) {
+		wdev->mrpc_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (!wdev->mrpc_event) {
+			errno = EIO;
+			return -EIO;
+		}
+	}
 
 	mcmd_len = offsetof(struct switchtec_mrpc_cmd, data) + payload_len;
 	mres_len = offsetof(struct switchtec_mrpc_result, data) + resp_len;
 
-	mcmd = calloc(1, mcmd_len);
-	if (!mcmd)
-		return -errno;
-
-	mres = calloc(1, mres_len);
-	if (!mres) {
-		free(mcmd);
+	wdev->mcmd = calloc(1, mcmd_len);
+	wdev->mres = calloc(1, mres_len);
+	if (!wdev->mcmd || !wdev->mres) {
+		windows_cmd_free(wdev);
 		return -errno;
 	}
 
-	mcmd->cmd = cmd;
-	memcpy(mcmd->data, payload, payload_len);
+	wdev->mcmd->cmd = cmd;
+	memcpy(wdev->mcmd->data, payload, payload_len);
+
+	memset(&wdev->mrpc_overlap, 0, sizeof(wdev->mrpc_overlap));
+	wdev->mrpc_overlap.hEvent = no_port(wdev->mrpc_event);
+	ResetEvent(wdev->mrpc_event);
 
 	status = DeviceIoControl(wdev->hdl, IOCTL_SWITCHTEC_MRPC,
-				 mcmd, (DWORD)mcmd_len,
-				 mres, (DWORD)mres_len,
-				 NULL, NULL);
-	if (!status) {
+				 wdev->mcmd, (DWORD)mcmd_len,
+				 wdev->mres, (DWORD)mres_len,
+				 NULL, &wdev->mrpc_overlap);
+	if (!status && GetLastError() != ERROR_IO_PENDING) {
+		windows_cmd_free(wdev);
+		errno = EIO;
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static int windows_cmd_poll(struct switchtec_dev *dev)
+{
+	struct switchtec_windows *wdev = to_switchtec_windows(dev);
+	DWORD transferred;
+
+	if (GetOverlappedResult(wdev->hdl, &wdev->mrpc_overlap,
+				&transferred, FALSE))
+		return 1;
+
+	if (GetLastError() == ERROR_IO_INCOMPLETE)
+		return 0;
+
+	/* Report the failure from windows_cmd_complete() */
+	return 1;
+}
+
+static int windows_cmd_complete(struct switchtec_dev *dev, void *resp,
+				size_t resp_len)
+{
+	struct switchtec_windows *wdev = to_switchtec_windows(dev);
+	DWORD transferred;
+	int ret;
+
+	if (!GetOverlappedResult(wdev->hdl, &wdev->mrpc_overlap,
+				 &transferred, TRUE)) {
 		ret = -EIO;
 		goto free_and_exit;
 	}
 
 	if (resp)
-		memcpy(resp, mres->data, resp_len);
+		memcpy(resp, wdev->mres->data, resp_len);
 
-	ret = mres->status;
+	ret = wdev->mres->status;
 	if (ret)
 		errno = ret;
 
 free_and_exit:
-	free(mres);
-	free(mcmd);
+	windows_cmd_free(wdev);
 	return ret;
 }
 
+static int windows_cmd(struct switchtec_dev *dev, uint32_t cmd,
+		       const void *payload, size_t payload_len, void *resp,
+		       size_t resp_len)
+{
+	int ret;
+
+	ret = windows_cmd_submit(dev, cmd, payload, payload_len, resp_len);
+	if (ret)
+		return ret;
+
+	return windows_cmd_complete(dev, resp, resp_len);
+}
+
+static void *windows_cmd_poll_handle(struct switchtec_dev *dev)
+{
+	struct switchtec_windows *wdev = to_switchtec_windows(dev);
+
+	if (!wdev->mcmd) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	return wdev->mrpc_event;
+}
+
+/*
+ * Leave an IOCTL_SWITCHTEC_WAIT_FOR_EVENT request pending on the device
+ * and return its event handle so several devices can be waited on with
+ * one WaitForMultipleObjects() call. A request that has completed is
+ * reissued.
+ */
+static void *windows_event_wait_arm(struct switchtec_dev *dev)
+{
+	struct switchtec_windows *wdev = to_switchtec_windows(dev);
+	BOOL status;
+
+	if (!wdev->evt_event) {
+		wdev->evt_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+		if (!wdev->evt_event)
+			return NULL;
+	}
+
+	if (wdev->evt_armed && !HasOverlappedIoCompleted(&wdev->evt_overlap))
+		return wdev->evt_event;
+
+	memset(&wdev->evt_overlap, 0, sizeof(wdev->evt_overlap));
+	wdev->evt_overlap.hEvent = wdev->port_active ? wdev->evt_event :
+		no_port(wdev->evt_event);
+	ResetEvent(wdev->evt_event);
+
+	status = DeviceIoControl(wdev->hdl, IOCTL_SWITCHTEC_WAIT_FOR_EVENT,
+				 NULL, 0, NULL, 0, NULL, &wdev->evt_overlap);
+	if (!status && GetLastError() != ERROR_IO_PENDING)
+		return NULL;
+
+	wdev->evt_armed = true;
+	return wdev->evt_event;
+}
+
+static void windows_event_wait_disarm(struct switchtec_dev *dev)
+{
+	struct switchtec_windows *wdev = to_switchtec_windows(dev);
+
+	if (!wdev->evt_armed)
+		return;
+
+	windows_io_cancel(wdev, &wdev->evt_overlap);
+	wdev->evt_armed = false;
+}
+
+/*
+ * The request left pending by a previous call that timed out is reused
+ * so an event that fires between calls is not missed.
+ */
 static int windows_event_wait(struct switchtec_dev *dev, int timeout_ms)
 {
 	struct switchtec_windows *wdev = to_switchtec_windows(dev);
-	OVERLAPPED overlap = {
-		.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL),
-	};
-	DWORD ret;
 	DWORD transferred;
-	BOOL error;
+	HANDLE event;
+	DWORD ret;
 
 	errno = 0;
 
-	if (!overlap.hEvent)
+	event = windows_event_wait_arm(dev);
+	if (!event)
 		return -1;
 
-	DeviceIoControl(wdev->hdl, IOCTL_SWITCHTEC_WAIT_FOR_EVENT, NULL, 0,
-			NULL, 0, NULL, &overlap);
-	if (GetLastError() != ERROR_IO_PENDING)
-		return -1;
-
-	ret = WaitForSingleObject(overlap.hEvent, timeout_ms);
-	if (ret == WAIT_TIMEOUT) {
-		CancelIoEx(wdev->hdl, &overlap);
+	ret = WaitForSingleObject(event, timeout_ms < 0 ? INFINITE :
+				  (DWORD)timeout_ms);
+	if (ret == WAIT_TIMEOUT)
 		return 0;
-	} else if (ret) {
+	else if (ret != WAIT_OBJECT_0)
 		return -1;
-	}
 
-	error = GetOverlappedResult(wdev->hdl, &overlap, &transferred, FALSE);
-	if (!error)
+	wdev->evt_armed = false;
+	if (!GetOverlappedResult(wdev->hdl, &wdev->evt_overlap,
+				 &transferred, FALSE))
 		return -1;
 
 	return 1;
 }
 
+/*
+ * Make completed event wait requests queue a packet with \p key to the
+ * I/O completion port \p port, or stop doing so when \p port is NULL.
+ * Windows only allows a file handle to be associated with one port for
+ * its lifetime, so a handle that has been used with one monitor falls
+ * back to plain event handles in any later one.
+ */
+static int windows_event_wait_port(struct switchtec_dev *dev, void *port,
+				   uintptr_t key)
+{
+	struct switchtec_windows *wdev = to_switchtec_windows(dev);
+
+	windows_event_wait_disarm(dev);
+
+	if (!port) {
+		wdev->port_active = false;
+		return 0;
+	}
+
+	if (wdev->port_bound) {
+		errno = EBUSY;
+		return -errno;
+	}
+
+	if (!CreateIoCompletionPort(wdev->hdl, port, key, 0)) {
+		errno = EIO;
+		return -errno;
+	}
+
+	wdev->port_bound = true;
+	wdev->port_active = true;
+	return 0;
+}
+
 static gasptr_t windows_gas_map(struct switchtec_dev *dev, int writeable,
 				size_t *map_size)
 {
@@ -425,10 +649,18 @@ static gasptr_t windows_gas_map(struct switchtec_dev *dev, int writeable,
 }
 
 static const struct switchtec_ops windows_ops = {
+	.flags = SWITCHTEC_OPS_FLAG_CMD_SHARED,
 	.close = windows_close,
 	.cmd = windows_cmd,
+	.cmd_submit = windows_cmd_submit,
+	.cmd_poll = windows_cmd_poll,
+	.cmd_complete = windows_cmd_complete,
+	.cmd_poll_handle = windows_cmd_poll_handle,
 	.gas_map = windows_gas_map,
 	.event_wait = windows_event_wait,
+	.event_wait_arm = windows_event_wait_arm,
+	.event_wait_disarm = windows_event_wait_disarm,
+	.event_wait_port = windows_event_wait_port,
 
 	.get_device_id = gasop_get_device_id,
 	.get_fw_version = gasop_get_fw_version,
@@ -436,7 +668,9 @@ static const struct switchtec_ops windows_ops = {
 	.port_to_pff = gasop_port_to_pff,
 	.flash_part = gasop_flash_part,
 	.event_summary = gasop_event_summary,
+	.event_summary_sparse = gasop_event_summary_sparse,
 	.event_ctl = gasop_event_ctl,
+	.event_block_ctl = gasop_event_block_ctl,
 
 	.gas_read8 = mmap_gas_read8,
 	.gas_read16 = mmap_gas_read16,
@@ -461,7 +695,7 @@ struct switchtec_dev *switchtec_open_by_path(const char *path)
 	if (sscanf(path, "/dev/switchtec%d", &idx) == 1)
 		return switchtec_open_by_index(idx);
 
-	wdev = malloc(sizeof(*wdev));
+	wdev = calloc(1, sizeof(*wdev));
 	if (!wdev)
 		return NULL;
 
@@ -478,6 +712,7 @@ struct switchtec_dev *switchtec_open_by_path(const char *path)
 	if (!map_gas(wdev))
 		goto err_close;
 
+	platform_dev_init(&wdev->dev);
 	wdev->dev.ops = &windows_ops;
 
 	gasop_set_partition_info(&wdev->dev);
@@ -583,6 +818,26 @@ struct switchtec_dev *switchtec_open_i2c_by_adapter(int adapter, int i2c_addr)
 	return NULL;
 }
 
+int switchtec_i2c_set_prio(struct switchtec_dev *dev,
+			   enum switchtec_i2c_prio prio)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
+int switchtec_i2c_bus_stats_get(struct switchtec_dev *dev,
+				struct switchtec_i2c_bus_stats *stats)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
+int switchtec_i2c_bus_stats_reset(struct switchtec_dev *dev)
+{
+	errno = ENOTSUP;
+	return -1;
+}
+
 struct switchtec_dev *switchtec_open_uart(int fd)
 {
 	errno = ENOTSUP;
@@ -595,4 +850,11 @@ struct switchtec_dev *switchtec_open_eth(const char *ip, const int inst)
 	return NULL;
 }
 
+struct switchtec_dev *switchtec_open_daemon(const char *socket_path,
+					    const char *device)
+{
+	errno = ENOTSUP;
+	return NULL;
+}
+
 #endif
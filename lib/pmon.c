@@ -35,7 +35,10 @@
 #include "switchtec/endian.h"
 
 #include <stddef.h>
+#include <stdlib.h>
 #include <errno.h>
+#include <string.h>
+#include <unistd.h>
 
 /**
  * @defgroup PMON Performance Monitor
@@ -329,6 +332,609 @@ int switchtec_evcntr_wait(struct switchtec_dev *dev, int timeout_ms)
 					NULL, timeout_ms);
 }
 
+/**
+ * @brief Find every configured event counter on every stack
+ * @param[in]  dev	Switchtec device handle
+ * @param[out] snap	Snapshot to fill in (counts are zeroed)
+ * @return The number of configured counters, or negative on failure
+ *
+ * The setup of all the stacks is read in one batch of commands. Stacks
+ * the device doesn't have are skipped. Call this again after changing
+ * the counter configuration.
+ */
+int switchtec_evcntr_snapshot_setup(struct switchtec_dev *dev,
+				    struct switchtec_evcntr_snapshot *snap)
+{
+	struct pmon_event_counter_get_setup_result
+		data[SWITCHTEC_MAX_STACKS][SWITCHTEC_MAX_EVENT_COUNTERS];
+	struct pmon_event_counter_get cmd[SWITCHTEC_MAX_STACKS];
+	struct switchtec_cmd_desc desc[SWITCHTEC_MAX_STACKS];
+	uint32_t mask;
+	int stack, i, ret;
+
+	for (stack = 0; stack < SWITCHTEC_MAX_STACKS; stack++) {
+		cmd[stack] = (struct pmon_event_counter_get) {
+			.sub_cmd_id = MRPC_PMON_GET_EV_COUNTER_SETUP,
+			.stack_id = stack,
+			.num_counters = SWITCHTEC_MAX_EVENT_COUNTERS,
+		};
+		desc[stack] = (struct switchtec_cmd_desc) {
+			.cmd = MRPC_PMON,
+			.payload = &cmd[stack],
+			.payload_len = sizeof(cmd[stack]),
+			.resp = data[stack],
+			.resp_len = sizeof(data[stack]),
+		};
+	}
+
+	ret = switchtec_cmd_batch(dev, desc, SWITCHTEC_MAX_STACKS);
+	if (ret < 0)
+		return ret;
+
+	memset(snap, 0, sizeof(*snap));
+
+	for (stack = 0; stack < SWITCHTEC_MAX_STACKS; stack++) {
+		if (desc[stack].ret)
+			continue;
+
+		for (i = 0; i < SWITCHTEC_MAX_EVENT_COUNTERS; i++) {
+			mask = le32toh(data[stack][i].mask);
+			if (!(mask & 0xFF) || !(mask >> 8))
+				continue;
+
+			snap->stack_id[snap->nr] = stack;
+			snap->cntr_id[snap->nr] = i;
+			snap->port_mask[snap->nr] = mask & 0xFF;
+			snap->type_mask[snap->nr] = mask >> 8;
+			snap->nr++;
+		}
+	}
+
+	return snap->nr;
+}
+
+/**
+ * @brief Read the counts of all the counters in a snapshot
+ * @param[in]     dev	Switchtec device handle
+ * @param[in,out] snap	Snapshot set up with switchtec_evcntr_snapshot_setup()
+ * @param[in]     clear	If non-zero, clear the counters after reading them
+ * @return The number of counters read, or negative on failure
+ *
+ * Each stack with configured counters is read with a single command
+ * covering its lowest to highest configured counter, and all of those
+ * commands are issued as one batch.
+ */
+int switchtec_evcntr_snapshot(struct switchtec_dev *dev,
+			      struct switchtec_evcntr_snapshot *snap,
+			      int clear)
+{
+	struct pmon_event_counter_result
+		data[SWITCHTEC_MAX_STACKS][SWITCHTEC_MAX_EVENT_COUNTERS];
+	struct pmon_event_counter_get cmd[SWITCHTEC_MAX_STACKS];
+	struct switchtec_cmd_desc desc[SWITCHTEC_MAX_STACKS];
+	int first[SWITCHTEC_MAX_STACKS];
+	int nr_cmds = 0;
+	unsigned i, stack;
+	int ret, n;
+
+	if (!snap->nr)
+		return 0;
+
+	for (i = 0; i < snap->nr; i++) {
+		stack = snap->stack_id[i];
+		if (!nr_cmds || cmd[nr_cmds - 1].stack_id != stack) {
+			first[nr_cmds] = snap->cntr_id[i];
+			cmd[nr_cmds] = (struct pmon_event_counter_get) {
+				.sub_cmd_id = MRPC_PMON_GET_EV_COUNTER,
+				.stack_id = stack,
+				.counter_id = snap->cntr_id[i],
+				.read_clear = clear,
+			};
+			nr_cmds++;
+		}
+
+		cmd[nr_cmds - 1].num_counters =
+			snap->cntr_id[i] - first[nr_cmds - 1] + 1;
+	}
+
+	for (n = 0; n < nr_cmds; n++) {
+		desc[n] = (struct switchtec_cmd_desc) {
+			.cmd = MRPC_PMON,
+			.payload = &cmd[n],
+			.payload_len = sizeof(cmd[n]),
+			.resp = data[n],
+			.resp_len = sizeof(data[n][0]) * cmd[n].num_counters,
+		};
+	}
+
+	ret = switchtec_cmd_batch(dev, desc, nr_cmds);
+	if (ret) {
+		if (ret > 0)
+			errno = ret;
+		return -1;
+	}
+
+	snap->time_us = platform_time_us();
+	snap->cleared = !!clear;
+
+	for (i = 0, n = -1; i < snap->nr; i++) {
+		if (n < 0 || cmd[n].stack_id != snap->stack_id[i])
+			n++;
+
+		snap->count[i] = le32toh(data[n][snap->cntr_id[i] -
+						 first[n]].value);
+	}
+
+	return snap->nr;
+}
+
+/**
+ * @brief Compute the change of every counter between two snapshots
+ * @param[in]  new	Later snapshot
+ * @param[in]  old	Earlier snapshot with the same setup
+ * @param[out] delta	Increase of each counter (at least \p new->nr entries)
+ * @return The number of counters, or negative if the snapshots don't
+ *	describe the same counters
+ *
+ * Counter wrap-around is handled. If \p old was read with clear set,
+ * the counters restarted from zero, so the new counts are used as the
+ * deltas as they are.
+ */
+int switchtec_evcntr_snapshot_delta(const struct switchtec_evcntr_snapshot *new,
+				    const struct switchtec_evcntr_snapshot *old,
+				    unsigned *delta)
+{
+	unsigned i;
+
+	if (new->nr != old->nr ||
+	    memcmp(new->stack_id, old->stack_id, new->nr) ||
+	    memcmp(new->cntr_id, old->cntr_id, new->nr)) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	for (i = 0; i < new->nr; i++)
+		delta[i] = new->count[i] - (old->cleared ? 0 : old->count[i]);
+
+	return new->nr;
+}
+
+struct alert_dev {
+	struct switchtec_dev *dev;
+	void *data;
+
+	/** @brief The counters set up for the rules, by stack and counter */
+	struct switchtec_evcntr_snapshot snap;
+	int rule[SWITCHTEC_MAX_EVCNTRS];
+	int egress[SWITCHTEC_MAX_EVCNTRS];
+	unsigned threshold[SWITCHTEC_MAX_EVCNTRS];
+	struct switchtec_port_id port[SWITCHTEC_MAX_EVCNTRS];
+};
+
+struct switchtec_evcntr_alerts {
+	struct switchtec_monitor *mon;
+	struct alert_dev **devs;
+	int nr_devs;
+
+	/** @brief Alerts decoded but not yet returned */
+	struct switchtec_evcntr_alert *pending;
+	int nr_pending;
+	int alloc_pending;
+};
+
+/**
+ * @brief Create an empty event counter alert engine
+ * @return The engine, or NULL on failure
+ *
+ * The engine waits on threshold events with a switchtec_monitor, so
+ * devices whose transport can signal events are not read at all until
+ * a counter crosses its threshold. Like a monitor, it must only be used
+ * by one thread at a time.
+ */
+struct switchtec_evcntr_alerts *switchtec_evcntr_alerts_new(void)
+{
+	struct switchtec_evcntr_alerts *al;
+
+	al = calloc(1, sizeof(*al));
+	if (!al)
+		return NULL;
+
+	al->mon = switchtec_monitor_new();
+	if (!al->mon) {
+		free(al);
+		return NULL;
+	}
+
+	return al;
+}
+
+static int alert_cntr_cmp(const void *a, const void *b)
+{
+	const uint16_t *x = a, *y = b;
+
+	return *x - *y;
+}
+
+/*
+ * Program (or, with remove set, clear) every counter of a device in one
+ * batch of commands.
+ */
+static int alert_program(struct alert_dev *adev, int remove)
+{
+	struct switchtec_evcntr_snapshot *snap = &adev->snap;
+	struct pmon_event_counter_setup *cmd;
+	struct switchtec_cmd_desc *desc;
+	size_t len = offsetof(struct pmon_event_counter_setup, counters) +
+		sizeof(cmd->counters[0]);
+	unsigned i;
+	int ret;
+
+	if (!snap->nr)
+		return 0;
+
+	cmd = calloc(snap->nr, sizeof(*cmd));
+	desc = calloc(snap->nr, sizeof(*desc));
+	if (!cmd || !desc) {
+		free(cmd);
+		free(desc);
+		return -1;
+	}
+
+	for (i = 0; i < snap->nr; i++) {
+		cmd[i].sub_cmd_id = MRPC_PMON_SETUP_EV_COUNTER;
+		cmd[i].stack_id = snap->stack_id[i];
+		cmd[i].counter_id = snap->cntr_id[i];
+		cmd[i].num_counters = 1;
+		if (!remove) {
+			cmd[i].counters[0].mask =
+				htole32(snap->type_mask[i] << 8 |
+					(snap->port_mask[i] & 0xFF));
+			cmd[i].counters[0].ieg = adev->egress[i];
+			cmd[i].counters[0].thresh =
+				htole32(adev->threshold[i]);
+		}
+
+		desc[i] = (struct switchtec_cmd_desc) {
+			.cmd = MRPC_PMON,
+			.payload = &cmd[i],
+			.payload_len = len,
+		};
+	}
+
+	ret = switchtec_cmd_batch(adev->dev, desc, snap->nr);
+
+	free(cmd);
+	free(desc);
+	return ret;
+}
+
+/**
+ * @brief Set up threshold counters on a device and watch them
+ * @param[in] al	Alert engine
+ * @param[in] dev	Switchtec device handle
+ * @param[in] rules	Rules to set up counters for
+ * @param[in] nr_rules	Number of entries in \p rules
+ * @param[in] data	Opaque pointer returned with this device's alerts
+ * @return 0 on success, negative on failure
+ *
+ * Each rule is expanded to one counter per selected port and event type
+ * on the port's stack. Only counters that are not already configured
+ * are used, and all of them are programmed in one batch of commands.
+ * errno is ENOSPC if a stack runs out of counters, in which case none
+ * are programmed. The counters are removed again by
+ * switchtec_evcntr_alerts_free().
+ */
+int switchtec_evcntr_alerts_add(struct switchtec_evcntr_alerts *al,
+				struct switchtec_dev *dev,
+				const struct switchtec_evcntr_rule *rules,
+				int nr_rules, void *data)
+{
+	struct switchtec_port_snapshot ports[SWITCHTEC_MAX_PORTS];
+	uint8_t used[SWITCHTEC_MAX_STACKS][SWITCHTEC_MAX_EVENT_COUNTERS] = {};
+	uint8_t next[SWITCHTEC_MAX_STACKS] = {};
+	struct switchtec_evcntr_snapshot *existing;
+	struct switchtec_event_summary mask = {};
+	struct alert_dev *adev, **devs;
+	struct {
+		uint16_t key;		//!< stack << 8 | counter, to sort by
+		uint16_t rule;
+		uint8_t port;
+		unsigned type;
+	} *alloc = NULL;
+	int nr_ports, nr = 0;
+	int r, p, stack, ret = -1;
+	unsigned i, type;
+
+	if (!rules || nr_rules < 1) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	nr_ports = switchtec_status_snapshot(dev, ports, ARRAY_SIZE(ports));
+	if (nr_ports < 0)
+		return nr_ports;
+	if (nr_ports > ARRAY_SIZE(ports))
+		nr_ports = ARRAY_SIZE(ports);
+
+	adev = calloc(1, sizeof(*adev));
+	existing = calloc(1, sizeof(*existing));
+	alloc = calloc(SWITCHTEC_MAX_EVCNTRS, sizeof(*alloc));
+	if (!adev || !existing || !alloc)
+		goto out_free;
+
+	adev->dev = dev;
+	adev->data = data;
+
+	ret = switchtec_evcntr_snapshot_setup(dev, existing);
+	if (ret < 0)
+		goto out_free;
+
+	for (i = 0; i < existing->nr; i++)
+		used[existing->stack_id[i]][existing->cntr_id[i]] = 1;
+
+	for (r = 0; r < nr_rules; r++) {
+		for (p = 0; p < nr_ports; p++) {
+			if (rules[r].port_mask &&
+			    !(rules[r].port_mask &
+			      (1ULL << ports[p].port.phys_id)))
+				continue;
+
+			stack = ports[p].port.stack;
+			for (type = 1; type <= rules[r].type_mask &&
+			     type <= ALL; type <<= 1) {
+				if (!(rules[r].type_mask & type))
+					continue;
+
+				while (next[stack] < SWITCHTEC_MAX_EVENT_COUNTERS &&
+				       used[stack][next[stack]])
+					next[stack]++;
+
+				if (next[stack] >= SWITCHTEC_MAX_EVENT_COUNTERS) {
+					errno = ENOSPC;
+					ret = -errno;
+					goto out_free;
+				}
+
+				alloc[nr].key = stack << 8 | next[stack]++;
+				alloc[nr].rule = r;
+				alloc[nr].port = p;
+				alloc[nr].type = type;
+				nr++;
+			}
+		}
+	}
+
+	/* switchtec_evcntr_snapshot() wants the counters in order */
+	qsort(alloc, nr, sizeof(*alloc), alert_cntr_cmp);
+
+	for (i = 0; i < nr; i++) {
+		p = alloc[i].port;
+		adev->snap.stack_id[i] = alloc[i].key >> 8;
+		adev->snap.cntr_id[i] = alloc[i].key & 0xFF;
+		adev->snap.port_mask[i] = 1 << ports[p].port.stk_id;
+		adev->snap.type_mask[i] = alloc[i].type;
+		adev->rule[i] = alloc[i].rule;
+		adev->egress[i] = rules[alloc[i].rule].egress;
+		adev->threshold[i] = rules[alloc[i].rule].threshold;
+		adev->port[i] = ports[p].port;
+	}
+	adev->snap.nr = nr;
+
+	devs = realloc(al->devs, (al->nr_devs + 1) * sizeof(*devs));
+	if (!devs) {
+		ret = -1;
+		goto out_free;
+	}
+	al->devs = devs;
+
+	ret = alert_program(adev, 0);
+	if (ret)
+		goto out_remove;
+
+	/* Start every counter from zero */
+	ret = switchtec_evcntr_snapshot(dev, &adev->snap, 1);
+	if (ret < 0)
+		goto out_remove;
+
+	ret = switchtec_event_ctl(dev, SWITCHTEC_PFF_EVT_THRESH,
+				  SWITCHTEC_EVT_IDX_ALL,
+				  SWITCHTEC_EVT_FLAG_CLEAR |
+				  SWITCHTEC_EVT_FLAG_EN_POLL, NULL);
+	if (ret < 0)
+		goto out_remove;
+
+	switchtec_event_summary_set(&mask, SWITCHTEC_PFF_EVT_THRESH,
+				    SWITCHTEC_EVT_IDX_ALL);
+	ret = switchtec_monitor_add(al->mon, dev, &mask, adev);
+	if (ret < 0)
+		goto out_remove;
+
+	al->devs[al->nr_devs++] = adev;
+	free(existing);
+	free(alloc);
+	return 0;
+
+out_remove:
+	alert_program(adev, 1);
+out_free:
+	free(adev);
+	free(existing);
+	free(alloc);
+	return ret;
+}
+
+static int alert_push(struct switchtec_evcntr_alerts *al,
+		      const struct switchtec_evcntr_alert *alert)
+{
+	struct switchtec_evcntr_alert *pending;
+	int alloc;
+
+	if (al->nr_pending == al->alloc_pending) {
+		alloc = al->alloc_pending ? al->alloc_pending * 2 : 16;
+		pending = realloc(al->pending, alloc * sizeof(*pending));
+		if (!pending)
+			return -1;
+
+		al->pending = pending;
+		al->alloc_pending = alloc;
+	}
+
+	al->pending[al->nr_pending++] = *alert;
+	return 0;
+}
+
+/*
+ * Re-arm the threshold events that fired and then find the counters
+ * that crossed their thresholds. Those are cleared so they count
+ * towards the next alert from zero.
+ */
+static int alert_decode(struct switchtec_evcntr_alerts *al,
+			struct alert_dev *adev,
+			struct switchtec_event_summary *sum)
+{
+	struct switchtec_evcntr_alert alert;
+	enum switchtec_event_id e;
+	unsigned i, count;
+	int idx, ret;
+
+	while (switchtec_event_summary_iter(sum, &e, &idx)) {
+		ret = switchtec_event_ctl(adev->dev, e, idx,
+					  SWITCHTEC_EVT_FLAG_CLEAR |
+					  SWITCHTEC_EVT_FLAG_EN_POLL, NULL);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = switchtec_evcntr_snapshot(adev->dev, &adev->snap, 0);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < adev->snap.nr; i++) {
+		if (adev->snap.count[i] < adev->threshold[i])
+			continue;
+
+		alert = (struct switchtec_evcntr_alert) {
+			.dev = adev->dev,
+			.data = adev->data,
+			.rule = adev->rule[i],
+			.stack_id = adev->snap.stack_id[i],
+			.cntr_id = adev->snap.cntr_id[i],
+			.port = adev->port[i],
+			.type_mask = adev->snap.type_mask[i],
+			.count = adev->snap.count[i],
+			.threshold = adev->threshold[i],
+			.time_us = platform_wall_time_us(),
+		};
+
+		ret = switchtec_evcntr_get(adev->dev, adev->snap.stack_id[i],
+					   adev->snap.cntr_id[i], 1, &count, 1);
+		if (ret < 0)
+			return ret;
+
+		if (alert_push(al, &alert))
+			return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Wait for counters on any device to reach their thresholds
+ * @param[in]  al		Alert engine
+ * @param[out] alerts		Alerts that were raised
+ * @param[in]  max		Number of entries in \p alerts
+ * @param[in]  timeout_ms	Timeout in milliseconds (-1 to wait forever)
+ * @return The number of entries filled in \p alerts, 0 on timeout, or
+ *	negative on failure
+ *
+ * The counters are only read after a device reports a threshold event.
+ * A device whose handle fails is reported once with \p error set and
+ * no counter; it should be dropped by freeing the engine.
+ */
+int switchtec_evcntr_alerts_wait(struct switchtec_evcntr_alerts *al,
+				 struct switchtec_evcntr_alert *alerts,
+				 int max, int timeout_ms)
+{
+	struct switchtec_monitor_event evts[16];
+	struct switchtec_evcntr_alert err;
+	uint64_t now, deadline = 0;
+	int n, i, ret, wait_ms = timeout_ms;
+
+	if (max < 1) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	if (timeout_ms >= 0)
+		deadline = platform_time_us() + timeout_ms * 1000ULL;
+
+	while (!al->nr_pending) {
+		if (timeout_ms >= 0) {
+			now = platform_time_us();
+			if (now >= deadline)
+				return 0;
+			wait_ms = (deadline - now + 999) / 1000;
+		}
+
+		n = switchtec_monitor_wait(al->mon, evts, ARRAY_SIZE(evts),
+					   wait_ms);
+		if (n <= 0)
+			return n;
+
+		for (i = 0; i < n; i++) {
+			if (!evts[i].error) {
+				ret = alert_decode(al, evts[i].data,
+						   &evts[i].sum);
+				if (!ret)
+					continue;
+				evts[i].error = errno;
+			}
+
+			err = (struct switchtec_evcntr_alert) {
+				.dev = evts[i].dev,
+				.data = ((struct alert_dev *)evts[i].data)->data,
+				.error = evts[i].error,
+				.rule = -1,
+				.time_us = platform_wall_time_us(),
+			};
+
+			switchtec_monitor_remove(al->mon, evts[i].dev);
+			if (alert_push(al, &err))
+				return -1;
+		}
+	}
+
+	n = al->nr_pending < max ? al->nr_pending : max;
+	memcpy(alerts, al->pending, n * sizeof(*alerts));
+	al->nr_pending -= n;
+	memmove(al->pending, al->pending + n,
+		al->nr_pending * sizeof(*al->pending));
+
+	return n;
+}
+
+/**
+ * @brief Remove the counters an alert engine set up and free it
+ * @param[in] al	Alert engine
+ *
+ * The device handles are not closed.
+ */
+void switchtec_evcntr_alerts_free(struct switchtec_evcntr_alerts *al)
+{
+	int i;
+
+	for (i = 0; i < al->nr_devs; i++) {
+		switchtec_monitor_remove(al->mon, al->devs[i]->dev);
+		alert_program(al->devs[i], 1);
+		free(al->devs[i]);
+	}
+
+	switchtec_monitor_free(al->mon);
+	free(al->devs);
+	free(al->pending);
+	free(al);
+}
+
 /**
  * @brief Subtract all the values between two bwcntr result structures
  * @param[in,out] new_cntr
@@ -515,6 +1121,426 @@ uint64_t switchtec_bwcntr_tot(struct switchtec_bwcntr_dir *d)
 	return d->posted + d->nonposted + d->comp;
 }
 
+#define BW_SAMPLER_DEFAULT_ALPHA 0.2
+
+struct bw_port_stats {
+	struct switchtec_bw_rate latest;
+	struct switchtec_bw_rate ewma;
+	struct switchtec_bw_rate peak;
+	struct switchtec_bwcntr_res total;
+};
+
+/*
+ * The sampler thread is the only writer. It fills the frame after the
+ * newest one and then publishes it by incrementing head. Readers copy a
+ * frame and then re-check head: if the writer may have started on the
+ * same slot in the meantime the copy is discarded and retried, so
+ * readers never block the sampler and never see a torn frame.
+ */
+struct switchtec_bw_sampler {
+	struct switchtec_dev *dev;
+	int nr_ports;
+	int *ids;
+	int interval_ms;
+	double alpha;
+
+	struct switchtec_bwcntr_res *res;
+	struct bw_port_stats *stats;
+
+	unsigned depth;
+	struct bw_port_stats *frames;
+	uint64_t head;
+
+	int stop;
+	int reset;
+	int error;
+	pthread_t thread;
+};
+
+static struct bw_port_stats *bw_frame(struct switchtec_bw_sampler *s,
+				      uint64_t n)
+{
+	return &s->frames[(n % s->depth) * s->nr_ports];
+}
+
+static void bw_rate_dir(struct switchtec_bw_rate_dir *r,
+			struct switchtec_bwcntr_dir *d, double secs)
+{
+	r->posted = d->posted / secs;
+	r->comp = d->comp / secs;
+	r->nonposted = d->nonposted / secs;
+}
+
+static void bw_ewma_dir(struct switchtec_bw_rate_dir *e,
+			struct switchtec_bw_rate_dir *r, double alpha)
+{
+	e->posted += alpha * (r->posted - e->posted);
+	e->comp += alpha * (r->comp - e->comp);
+	e->nonposted += alpha * (r->nonposted - e->nonposted);
+}
+
+static void bw_peak_dir(struct switchtec_bw_rate_dir *p,
+			struct switchtec_bw_rate_dir *r)
+{
+	if (r->posted > p->posted)
+		p->posted = r->posted;
+	if (r->comp > p->comp)
+		p->comp = r->comp;
+	if (r->nonposted > p->nonposted)
+		p->nonposted = r->nonposted;
+}
+
+static void bw_total_dir(struct switchtec_bwcntr_dir *t,
+			 struct switchtec_bwcntr_dir *d)
+{
+	t->posted += d->posted;
+	t->comp += d->comp;
+	t->nonposted += d->nonposted;
+}
+
+static void bw_sampler_update(struct switchtec_bw_sampler *s, uint64_t now,
+			      uint64_t elapsed_us, int first, int reset)
+{
+	struct bw_port_stats *st;
+	struct switchtec_bwcntr_res *res;
+	double secs;
+	int i;
+
+	for (i = 0; i < s->nr_ports; i++) {
+		st = &s->stats[i];
+		res = &s->res[i];
+
+		/*
+		 * The counters are cleared on every read so the device
+		 * time is the length of this sample's window.
+		 */
+		secs = (res->time_us ? res->time_us : elapsed_us) / 1e6;
+
+		if (reset)
+			memset(&st->total, 0, sizeof(st->total));
+		st->total.time_us += secs * 1e6;
+		bw_total_dir(&st->total.egress, &res->egress);
+		bw_total_dir(&st->total.ingress, &res->ingress);
+
+		if (secs <= 0)
+			continue;
+
+		st->latest.time_us = now;
+		bw_rate_dir(&st->latest.egress, &res->egress, secs);
+		bw_rate_dir(&st->latest.ingress, &res->ingress, secs);
+
+		if (first || reset) {
+			st->ewma = st->latest;
+			st->peak = st->latest;
+			continue;
+		}
+
+		st->ewma.time_us = now;
+		bw_ewma_dir(&st->ewma.egress, &st->latest.egress, s->alpha);
+		bw_ewma_dir(&st->ewma.ingress, &st->latest.ingress, s->alpha);
+
+		st->peak.time_us = now;
+		bw_peak_dir(&st->peak.egress, &st->latest.egress);
+		bw_peak_dir(&st->peak.ingress, &st->latest.ingress);
+	}
+}
+
+static void *bw_sampler_thread(void *arg)
+{
+	struct switchtec_bw_sampler *s = arg;
+	uint64_t now, last, next;
+	uint64_t head;
+	int first = 1;
+	int reset;
+	int ret, i;
+
+	/*
+	 * Start every port's window from zero. The totals include what
+	 * the counters held before the sampler started.
+	 */
+	ret = switchtec_bwcntr_many(s->dev, s->nr_ports, s->ids, 1, s->res);
+	if (ret < 0)
+		__atomic_store_n(&s->error, errno, __ATOMIC_RELAXED);
+	else
+		for (i = 0; i < s->nr_ports; i++)
+			s->stats[i].total = s->res[i];
+
+	last = platform_time_us();
+	next = last;
+
+	while (!__atomic_load_n(&s->stop, __ATOMIC_ACQUIRE)) {
+		next += s->interval_ms * 1000ULL;
+		now = platform_time_us();
+		if (next > now)
+			usleep(next - now);
+		else
+			next = now;
+
+		ret = switchtec_bwcntr_many(s->dev, s->nr_ports, s->ids, 1,
+					    s->res);
+		now = platform_time_us();
+		if (ret < 0) {
+			__atomic_store_n(&s->error, errno, __ATOMIC_RELAXED);
+			last = now;
+			continue;
+		}
+
+		reset = __atomic_exchange_n(&s->reset, 0, __ATOMIC_ACQ_REL);
+		bw_sampler_update(s, now, now - last, first, reset);
+		last = now;
+		first = 0;
+
+		head = s->head;
+		memcpy(bw_frame(s, head), s->stats,
+		       s->nr_ports * sizeof(*s->stats));
+		__atomic_store_n(&s->head, head + 1, __ATOMIC_RELEASE);
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Start sampling the bandwidth counters in the background
+ * @ingroup PMON
+ * @param[in] dev		Switchtec device handle
+ * @param[in] nr_ports		Number of ports to sample
+ * @param[in] phys_port_ids	The physical ids of the ports to sample
+ * @param[in] interval_ms	Time between samples in milliseconds
+ * @param[in] depth		Number of samples kept for
+ *	switchtec_bw_sampler_history() (at least 2)
+ * @param[in] ewma_alpha	Weight of the newest sample in the moving
+ *	average (0 selects the default of 0.2)
+ * @return The sampler or NULL on failure
+ *
+ * A thread reads the counters of all the ports with
+ * switchtec_bwcntr_many() every \p interval_ms, clearing them each time,
+ * and converts them to rates. The counters should not be read or
+ * cleared by anything else while the sampler runs.
+ */
+struct switchtec_bw_sampler *
+switchtec_bw_sampler_start(struct switchtec_dev *dev, int nr_ports,
+			   int *phys_port_ids, int interval_ms, int depth,
+			   double ewma_alpha)
+{
+	struct switchtec_bw_sampler *s;
+	int ret;
+
+	if (nr_ports < 1 || interval_ms < 1 || depth < 2 ||
+	    ewma_alpha < 0 || ewma_alpha > 1) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return NULL;
+
+	s->dev = dev;
+	s->nr_ports = nr_ports;
+	s->interval_ms = interval_ms;
+	s->alpha = ewma_alpha ? ewma_alpha : BW_SAMPLER_DEFAULT_ALPHA;
+	s->depth = depth;
+
+	s->ids = calloc(nr_ports, sizeof(*s->ids));
+	s->res = calloc(nr_ports, sizeof(*s->res));
+	s->stats = calloc(nr_ports, sizeof(*s->stats));
+	s->frames = calloc((size_t)nr_ports * depth, sizeof(*s->frames));
+	if (!s->ids || !s->res || !s->stats || !s->frames)
+		goto err_free;
+
+	memcpy(s->ids, phys_port_ids, nr_ports * sizeof(*s->ids));
+
+	ret = pthread_create(&s->thread, NULL, bw_sampler_thread, s);
+	if (ret) {
+		errno = ret;
+		goto err_free;
+	}
+
+	return s;
+
+err_free:
+	free(s->ids);
+	free(s->res);
+	free(s->stats);
+	free(s->frames);
+	free(s);
+	return NULL;
+}
+
+/**
+ * @brief Stop a bandwidth sampler and free it
+ * @ingroup PMON
+ * @param[in] s		Sampler returned by switchtec_bw_sampler_start()
+ */
+void switchtec_bw_sampler_stop(struct switchtec_bw_sampler *s)
+{
+	if (!s)
+		return;
+
+	__atomic_store_n(&s->stop, 1, __ATOMIC_RELEASE);
+	pthread_join(s->thread, NULL);
+
+	free(s->ids);
+	free(s->res);
+	free(s->stats);
+	free(s->frames);
+	free(s);
+}
+
+/*
+ * Copy port \p port of frame \p n. Returns 0 if the frame was still
+ * intact after the copy.
+ */
+static int bw_sampler_copy(struct switchtec_bw_sampler *s, uint64_t n,
+			   int port, struct bw_port_stats *st)
+{
+	*st = bw_frame(s, n)[port];
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	return __atomic_load_n(&s->head, __ATOMIC_ACQUIRE) - n >= s->depth;
+}
+
+/* Copy port \p port of the newest frame */
+static int bw_sampler_newest(struct switchtec_bw_sampler *s, int port,
+			     struct bw_port_stats *st)
+{
+	uint64_t head;
+
+	if (port < 0 || port >= s->nr_ports) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	do {
+		head = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+		if (!head) {
+			errno = EAGAIN;
+			return -errno;
+		}
+	} while (bw_sampler_copy(s, head - 1, port, st));
+
+	return 0;
+}
+
+/**
+ * @brief Get the newest rates for a port from a bandwidth sampler
+ * @ingroup PMON
+ * @param[in]  s	Bandwidth sampler
+ * @param[in]  port	Index of the port in the list given at start
+ * @param[out] latest	Rates over the last interval (may be NULL)
+ * @param[out] ewma	Exponentially weighted moving average (may be NULL)
+ * @param[out] peak	Highest rates seen so far (may be NULL)
+ * @return 0 on success, negative if no sample is available yet
+ *
+ * This never blocks and may be called from any thread.
+ */
+int switchtec_bw_sampler_latest(struct switchtec_bw_sampler *s, int port,
+				struct switchtec_bw_rate *latest,
+				struct switchtec_bw_rate *ewma,
+				struct switchtec_bw_rate *peak)
+{
+	struct bw_port_stats st;
+	int ret;
+
+	ret = bw_sampler_newest(s, port, &st);
+	if (ret)
+		return ret;
+
+	if (latest)
+		*latest = st.latest;
+	if (ewma)
+		*ewma = st.ewma;
+	if (peak)
+		*peak = st.peak;
+
+	return 0;
+}
+
+/**
+ * @brief Get the bytes counted on a port by a bandwidth sampler
+ * @ingroup PMON
+ * @param[in]  s	Bandwidth sampler
+ * @param[in]  port	Index of the port in the list given at start
+ * @param[out] total	Bytes and device time since the counters were last
+ *	cleared, or since switchtec_bw_sampler_reset()
+ * @return 0 on success, negative if no sample is available yet
+ */
+int switchtec_bw_sampler_total(struct switchtec_bw_sampler *s, int port,
+			       struct switchtec_bwcntr_res *total)
+{
+	struct bw_port_stats st;
+	int ret;
+
+	ret = bw_sampler_newest(s, port, &st);
+	if (ret)
+		return ret;
+
+	*total = st.total;
+	return 0;
+}
+
+/**
+ * @brief Restart the totals and peaks of a bandwidth sampler
+ * @ingroup PMON
+ * @param[in] s		Bandwidth sampler
+ *
+ * Takes effect at the next sample. This never blocks and may be called
+ * from any thread.
+ */
+void switchtec_bw_sampler_reset(struct switchtec_bw_sampler *s)
+{
+	__atomic_store_n(&s->reset, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Get the recent rates for a port from a bandwidth sampler
+ * @ingroup PMON
+ * @param[in]  s	Bandwidth sampler
+ * @param[in]  port	Index of the port in the list given at start
+ * @param[out] rates	Rates for each interval, newest first
+ * @param[in]  max	Number of entries in \p rates
+ * @return The number of entries filled in, or negative on error
+ */
+int switchtec_bw_sampler_history(struct switchtec_bw_sampler *s, int port,
+				 struct switchtec_bw_rate *rates, int max)
+{
+	struct bw_port_stats st;
+	uint64_t head, n;
+	int i;
+
+	if (port < 0 || port >= s->nr_ports || max < 0) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	head = __atomic_load_n(&s->head, __ATOMIC_ACQUIRE);
+	if (max > s->depth - 1)
+		max = s->depth - 1;
+	if (max > head)
+		max = head;
+
+	for (i = 0; i < max; i++) {
+		n = head - 1 - i;
+		if (bw_sampler_copy(s, n, port, &st))
+			break;
+		rates[i] = st.latest;
+	}
+
+	return i;
+}
+
+/**
+ * @brief Get the last error seen by a bandwidth sampler
+ * @ingroup PMON
+ * @param[in] s		Bandwidth sampler
+ * @return The errno of the most recent failed read and resets it,
+ *	or 0 if none failed
+ */
+int switchtec_bw_sampler_error(struct switchtec_bw_sampler *s)
+{
+	return __atomic_exchange_n(&s->error, 0, __ATOMIC_RELAXED);
+}
+
 /**
  * @brief Setup a number of latency counters
  * @param[in]  dev		Switchtec device handle
@@ -638,4 +1664,280 @@ int switchtec_lat_get(struct switchtec_dev *dev, int clear,
 				      cur_ns, max_ns);
 }
 
+#define LAT_HIST_SUB_COUNT (1 << SWITCHTEC_LAT_HIST_SUB_BITS)
+#define LAT_HIST_MAX_NS 0xFFFF
+
+static int lat_hist_index(unsigned v)
+{
+	int shift;
+
+	if (v < 2 * LAT_HIST_SUB_COUNT)
+		return v;
+
+	shift = (31 - __builtin_clz(v)) - SWITCHTEC_LAT_HIST_SUB_BITS;
+	return (shift + 1) * LAT_HIST_SUB_COUNT +
+		((v >> shift) & (LAT_HIST_SUB_COUNT - 1));
+}
+
+/* The largest value that falls in bucket \p idx */
+static int lat_hist_value(int idx)
+{
+	int shift, sub;
+
+	if (idx < 2 * LAT_HIST_SUB_COUNT)
+		return idx;
+
+	shift = idx / LAT_HIST_SUB_COUNT - 1;
+	sub = idx % LAT_HIST_SUB_COUNT;
+
+	return ((LAT_HIST_SUB_COUNT + sub) << shift) + (1 << shift) - 1;
+}
+
+/**
+ * @brief Add a latency value to a histogram
+ * @param[in] h		Histogram (zero initialized before first use)
+ * @param[in] ns	Latency in nanoseconds
+ */
+void switchtec_lat_hist_record(struct switchtec_lat_hist *h, int ns)
+{
+	if (ns < 0)
+		ns = 0;
+	if (ns > LAT_HIST_MAX_NS)
+		ns = LAT_HIST_MAX_NS;
+
+	if (!h->count || ns < h->min_ns)
+		h->min_ns = ns;
+	if (!h->count || ns > h->max_ns)
+		h->max_ns = ns;
+
+	h->buckets[lat_hist_index(ns)]++;
+	h->count++;
+}
+
+/**
+ * @brief Get a percentile from a latency histogram
+ * @param[in] h		Histogram
+ * @param[in] pct	Percentile (eg. 99.9)
+ * @return The latency in nanoseconds at or below which \p pct percent
+ *	of the recorded values fall, or -1 if the histogram is empty
+ */
+int switchtec_lat_hist_percentile(const struct switchtec_lat_hist *h,
+				  double pct)
+{
+	uint64_t target, seen = 0;
+	int i, val;
+
+	if (!h->count)
+		return -1;
+
+	if (pct <= 0)
+		return h->min_ns;
+
+	target = (pct * h->count + 99) / 100;
+	if (target > h->count)
+		target = h->count;
+
+	for (i = 0; i < SWITCHTEC_LAT_HIST_BUCKETS; i++) {
+		seen += h->buckets[i];
+		if (seen >= target)
+			break;
+	}
+
+	val = lat_hist_value(i);
+	return val > h->max_ns ? h->max_ns : val;
+}
+
+struct lat_pair {
+	int egress;
+	int ingress;
+	struct switchtec_lat_hist cur;
+	struct switchtec_lat_hist max;
+};
+
+/*
+ * A latency counter belongs to an egress port, so pairs that share an
+ * egress port can't be measured at the same time. They are split into
+ * rounds where each egress port appears at most once, and the collector
+ * moves to the next round after each sample.
+ */
+struct switchtec_lat_collector {
+	struct switchtec_dev *dev;
+	int nr_pairs;
+	struct lat_pair *pairs;
+
+	int nr_rounds;
+	int round;
+	int *round_of;
+
+	int nr_active;
+	int active[SWITCHTEC_MAX_PORTS];
+	int egress[SWITCHTEC_MAX_PORTS];
+	int ingress[SWITCHTEC_MAX_PORTS];
+};
+
+static int lat_collector_arm(struct switchtec_lat_collector *c)
+{
+	int i, ret;
+
+	c->nr_active = 0;
+	for (i = 0; i < c->nr_pairs; i++) {
+		if (c->round_of[i] != c->round)
+			continue;
+
+		c->active[c->nr_active] = i;
+		c->egress[c->nr_active] = c->pairs[i].egress;
+		c->ingress[c->nr_active] = c->pairs[i].ingress;
+		c->nr_active++;
+	}
+
+	ret = switchtec_lat_setup_many(c->dev, c->nr_active, c->egress,
+				       c->ingress);
+	if (ret)
+		return ret;
+
+	ret = switchtec_lat_get_many(c->dev, c->nr_active, 1, c->egress,
+				     NULL, NULL);
+	return ret < 0 ? ret : 0;
+}
+
+/**
+ * @brief Create a latency collector and program its first set of pairs
+ * @param[in] dev		Switchtec device handle
+ * @param[in] nr_pairs		Number of egress/ingress pairs
+ * @param[in] egress_port_ids	Physical egress port of each pair
+ * @param[in] ingress_port_ids	Physical ingress port of each pair
+ *	(may be SWITCHTEC_LAT_ALL_INGRESS)
+ * @return The collector or NULL on failure
+ *
+ * Call switchtec_lat_collector_sample() at the desired interval; each
+ * call adds the values measured since the previous one to the pair's
+ * histograms. Pairs sharing an egress port are measured in turn.
+ */
+struct switchtec_lat_collector *
+switchtec_lat_collector_new(struct switchtec_dev *dev, int nr_pairs,
+			    int *egress_port_ids, int *ingress_port_ids)
+{
+	struct switchtec_lat_collector *c;
+	int uses[SWITCHTEC_MAX_PORTS] = {};
+	int i, e;
+
+	if (nr_pairs < 1) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	for (i = 0; i < nr_pairs; i++) {
+		if (egress_port_ids[i] < 0 ||
+		    egress_port_ids[i] >= SWITCHTEC_MAX_PORTS) {
+			errno = EINVAL;
+			return NULL;
+		}
+	}
+
+	c = calloc(1, sizeof(*c));
+	if (!c)
+		return NULL;
+
+	c->dev = dev;
+	c->nr_pairs = nr_pairs;
+	c->pairs = calloc(nr_pairs, sizeof(*c->pairs));
+	c->round_of = calloc(nr_pairs, sizeof(*c->round_of));
+	if (!c->pairs || !c->round_of)
+		goto err_free;
+
+	for (i = 0; i < nr_pairs; i++) {
+		e = egress_port_ids[i];
+		c->pairs[i].egress = e;
+		c->pairs[i].ingress = ingress_port_ids[i];
+		c->round_of[i] = uses[e]++;
+		if (uses[e] > c->nr_rounds)
+			c->nr_rounds = uses[e];
+	}
+
+	if (lat_collector_arm(c))
+		goto err_free;
+
+	return c;
+
+err_free:
+	free(c->pairs);
+	free(c->round_of);
+	free(c);
+	return NULL;
+}
+
+/**
+ * @brief Free a latency collector
+ * @param[in] c		Collector to free
+ */
+void switchtec_lat_collector_free(struct switchtec_lat_collector *c)
+{
+	if (!c)
+		return;
+
+	free(c->pairs);
+	free(c->round_of);
+	free(c);
+}
+
+/**
+ * @brief Read and clear the active latency counters into the histograms
+ * @param[in] c		Latency collector
+ * @return 0 on success, negative on failure
+ *
+ * Windows that saw no TLPs read as zero and are not recorded.
+ */
+int switchtec_lat_collector_sample(struct switchtec_lat_collector *c)
+{
+	int cur_ns[SWITCHTEC_MAX_PORTS], max_ns[SWITCHTEC_MAX_PORTS];
+	struct lat_pair *p;
+	int i, ret;
+
+	ret = switchtec_lat_get_many(c->dev, c->nr_active, 1, c->egress,
+				     cur_ns, max_ns);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < c->nr_active; i++) {
+		p = &c->pairs[c->active[i]];
+		if (max_ns[i] <= 0)
+			continue;
+
+		switchtec_lat_hist_record(&p->cur, cur_ns[i]);
+		switchtec_lat_hist_record(&p->max, max_ns[i]);
+	}
+
+	if (c->nr_rounds == 1)
+		return 0;
+
+	c->round = (c->round + 1) % c->nr_rounds;
+	return lat_collector_arm(c);
+}
+
+/**
+ * @brief Get the histograms collected for a pair
+ * @param[in]  c	Latency collector
+ * @param[in]  pair	Index of the pair given to switchtec_lat_collector_new()
+ * @param[out] cur	Current (Gen3) or minimum (Gen4 and later) latency
+ *	of each sample window (may be NULL)
+ * @param[out] max	Maximum latency of each sample window (may be NULL)
+ * @return 0 on success, negative on failure
+ */
+int switchtec_lat_collector_hist(struct switchtec_lat_collector *c, int pair,
+				 const struct switchtec_lat_hist **cur,
+				 const struct switchtec_lat_hist **max)
+{
+	if (pair < 0 || pair >= c->nr_pairs) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	if (cur)
+		*cur = &c->pairs[pair].cur;
+	if (max)
+		*max = &c->pairs[pair].max;
+
+	return 0;
+}
+
 /**@}*/
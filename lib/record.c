@@ -0,0 +1,336 @@
+/*
+ * Microsemi Switchtec(tm) PCIe Management Library
+ * Copyright (c) 2025, Microsemi Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR
+ * OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+ * ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ *
+ */
+
+/**
+ * @file
+ * @brief Binary telemetry recording and replay
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#define SWITCHTEC_LIB_CORE
+
+#include "switchtec_priv.h"
+#include "switchtec/record.h"
+#include "switchtec/portable.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __WINDOWS__
+#define rec_seek(f, off, whence)	_fseeki64(f, off, whence)
+#define rec_tell(f)			_ftelli64(f)
+#else
+#define rec_seek(f, off, whence)	fseeko(f, off, whence)
+#define rec_tell(f)			ftello(f)
+#endif
+
+#define REC_HEADER_ALIGN 4096
+
+struct switchtec_rec {
+	FILE *f;
+	int writing;
+	size_t data_size;
+	struct switchtec_rec_header hdr;
+};
+
+/**
+ * @brief Size of one channel's value in a recording of the given type
+ * @param[in] type	Recording type
+ * @return The size in bytes, or 0 for an unknown type
+ */
+size_t switchtec_rec_channel_size(enum switchtec_rec_type type)
+{
+	switch (type) {
+	case SWITCHTEC_REC_BW:
+		return sizeof(struct switchtec_bwcntr_res);
+	case SWITCHTEC_REC_LAT:
+		return sizeof(struct switchtec_rec_lat);
+	case SWITCHTEC_REC_EVCNTR:
+		return sizeof(uint32_t);
+	case SWITCHTEC_REC_TEMP:
+		return sizeof(float);
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Create a new recording
+ * @param[in] path		File to create (truncated if it exists)
+ * @param[in] type		What the samples hold
+ * @param[in] period_us		Intended sampling period
+ * @param[in] dev		Device being recorded (may be NULL)
+ * @param[in] nr_channels	Number of channels in each sample
+ * @param[in] channels		Description of each channel
+ * @return The recording, or NULL on failure
+ */
+struct switchtec_rec *
+switchtec_rec_create(const char *path, enum switchtec_rec_type type,
+		     unsigned period_us, struct switchtec_dev *dev,
+		     int nr_channels,
+		     const struct switchtec_rec_channel *channels)
+{
+	struct switchtec_rec *rec;
+	size_t chan_size = switchtec_rec_channel_size(type);
+
+	if (!chan_size || nr_channels < 1 ||
+	    nr_channels > SWITCHTEC_REC_MAX_CHANNELS) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	rec = calloc(1, sizeof(*rec));
+	if (!rec)
+		return NULL;
+
+	memcpy(rec->hdr.magic, SWITCHTEC_REC_MAGIC, sizeof(SWITCHTEC_REC_MAGIC));
+	rec->hdr.version = SWITCHTEC_REC_VERSION;
+	rec->hdr.header_size = (sizeof(rec->hdr) + REC_HEADER_ALIGN - 1) &
+		~(REC_HEADER_ALIGN - 1);
+	rec->data_size = chan_size * nr_channels;
+	rec->hdr.sample_size = (sizeof(uint64_t) + rec->data_size + 7) & ~7;
+	rec->hdr.type = type;
+	rec->hdr.period_us = period_us;
+	rec->hdr.start_us = platform_wall_time_us();
+	rec->hdr.nr_channels = nr_channels;
+	memcpy(rec->hdr.channels, channels, nr_channels * sizeof(*channels));
+
+	if (dev) {
+		rec->hdr.device_id = switchtec_device_id(dev);
+		snprintf(rec->hdr.dev_name, sizeof(rec->hdr.dev_name), "%s",
+			 switchtec_name(dev));
+	}
+
+	rec->f = fopen(path, "wb");
+	if (!rec->f)
+		goto err_free;
+
+	rec->writing = 1;
+	if (fwrite(&rec->hdr, sizeof(rec->hdr), 1, rec->f) != 1 ||
+	    rec_seek(rec->f, rec->hdr.header_size, SEEK_SET))
+		goto err_close;
+
+	return rec;
+
+err_close:
+	fclose(rec->f);
+err_free:
+	free(rec);
+	return NULL;
+}
+
+/**
+ * @brief Append a sample to a recording
+ * @param[in] rec	Recording created with switchtec_rec_create()
+ * @param[in] time_us	Host time of the sample
+ * @param[in] data	One value per channel, of the recording's type
+ * @return 0 on success, negative on failure
+ */
+int switchtec_rec_append(struct switchtec_rec *rec, uint64_t time_us,
+			 const void *data)
+{
+	static const uint8_t pad[8];
+	size_t pad_len;
+
+	if (!rec->writing) {
+		errno = EBADF;
+		return -errno;
+	}
+
+	pad_len = rec->hdr.sample_size - sizeof(time_us) - rec->data_size;
+
+	if (fwrite(&time_us, sizeof(time_us), 1, rec->f) != 1 ||
+	    fwrite(data, rec->data_size, 1, rec->f) != 1 ||
+	    (pad_len && fwrite(pad, pad_len, 1, rec->f) != 1))
+		return -errno;
+
+	return 0;
+}
+
+/**
+ * @brief Open an existing recording for reading
+ * @param[in] path	File to open
+ * @return The recording, or NULL on failure
+ *
+ * A file that is still being written may be opened; switchtec_rec_count()
+ * picks up samples appended since.
+ */
+struct switchtec_rec *switchtec_rec_open(const char *path)
+{
+	struct switchtec_rec *rec;
+	size_t chan_size;
+
+	rec = calloc(1, sizeof(*rec));
+	if (!rec)
+		return NULL;
+
+	rec->f = fopen(path, "rb");
+	if (!rec->f)
+		goto err_free;
+
+	if (fread(&rec->hdr, sizeof(rec->hdr), 1, rec->f) != 1)
+		goto err_inval;
+
+	chan_size = switchtec_rec_channel_size(rec->hdr.type);
+	if (memcmp(rec->hdr.magic, SWITCHTEC_REC_MAGIC,
+		   sizeof(SWITCHTEC_REC_MAGIC)) ||
+	    rec->hdr.version != SWITCHTEC_REC_VERSION || !chan_size ||
+	    !rec->hdr.nr_channels ||
+	    rec->hdr.nr_channels > SWITCHTEC_REC_MAX_CHANNELS ||
+	    rec->hdr.header_size < sizeof(rec->hdr))
+		goto err_inval;
+
+	rec->data_size = chan_size * rec->hdr.nr_channels;
+	if (rec->hdr.sample_size < sizeof(uint64_t) + rec->data_size)
+		goto err_inval;
+
+	return rec;
+
+err_inval:
+	errno = EINVAL;
+	fclose(rec->f);
+err_free:
+	free(rec);
+	return NULL;
+}
+
+/**
+ * @brief Get the header of a recording
+ * @param[in] rec	Recording
+ * @return The header
+ */
+const struct switchtec_rec_header *
+switchtec_rec_header(struct switchtec_rec *rec)
+{
+	return &rec->hdr;
+}
+
+/**
+ * @brief Get the number of complete samples in a recording
+ * @param[in] rec	Recording
+ * @return The number of samples, or negative on failure
+ */
+long switchtec_rec_count(struct switchtec_rec *rec)
+{
+	int64_t size;
+
+	if (rec->writing)
+		fflush(rec->f);
+
+	if (rec_seek(rec->f, 0, SEEK_END))
+		return -errno;
+
+	size = rec_tell(rec->f);
+	if (size < 0)
+		return -errno;
+	if (size < rec->hdr.header_size)
+		return 0;
+
+	return (size - rec->hdr.header_size) / rec->hdr.sample_size;
+}
+
+/**
+ * @brief Read one sample of a recording
+ * @param[in]  rec	Recording opened with switchtec_rec_open()
+ * @param[in]  idx	Sample index
+ * @param[out] time_us	Host time of the sample (may be NULL)
+ * @param[out] data	One value per channel (may be NULL)
+ * @return 0 on success, negative on failure
+ */
+int switchtec_rec_read(struct switchtec_rec *rec, long idx,
+		       uint64_t *time_us, void *data)
+{
+	uint64_t t;
+
+	if (rec->writing || idx < 0) {
+		errno = EINVAL;
+		return -errno;
+	}
+
+	if (rec_seek(rec->f, rec->hdr.header_size +
+		     (int64_t)idx * rec->hdr.sample_size, SEEK_SET))
+		return -errno;
+
+	if (fread(&t, sizeof(t), 1, rec->f) != 1)
+		goto err_short;
+	if (data && fread(data, rec->data_size, 1, rec->f) != 1)
+		goto err_short;
+
+	if (time_us)
+		*time_us = t;
+
+	return 0;
+
+err_short:
+	errno = ERANGE;
+	return -errno;
+}
+
+/**
+ * @brief Find the first sample taken at or after a time
+ * @param[in] rec	Recording opened with switchtec_rec_open()
+ * @param[in] time_us	Host time to look for
+ * @return The sample index (the sample count if every sample is older),
+ *	or negative on failure
+ */
+long switchtec_rec_find(struct switchtec_rec *rec, uint64_t time_us)
+{
+	long lo = 0, hi, mid;
+	uint64_t t;
+	int ret;
+
+	hi = switchtec_rec_count(rec);
+	if (hi < 0)
+		return hi;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		ret = switchtec_rec_read(rec, mid, &t, NULL);
+		if (ret)
+			return ret;
+
+		if (t < time_us)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/**
+ * @brief Close a recording, flushing any buffered samples
+ * @param[in] rec	Recording to close
+ */
+void switchtec_rec_close(struct switchtec_rec *rec)
+{
+	if (!rec)
+		return;
+
+	fclose(rec->f);
+	free(rec);
+}
@@ -30,6 +30,7 @@
 #define SWITCHTEC_LIB_CORE
 
 #include "switchtec_priv.h"
+#include "platform/switchtecd.h"
 
 #include "switchtec/switchtec.h"
 #include "switchtec/mrpc.h"
@@ -37,11 +38,20 @@
 #include "switchtec/log.h"
 #include "switchtec/endian.h"
 #include "switchtec/utils.h"
+#include "crc.h"
 
 #include <string.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <errno.h>
 #include <time.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#ifndef _WIN32
+#include <sys/mman.h>
+#endif
 
 /**
  * @defgroup Device Switchtec Management
@@ -72,6 +82,9 @@ struct module_log_defs {
 struct log_defs {
 	struct module_log_defs *module_defs;	//!< per-module log definitions
 	int num_alloc;				//!< number of modules allocated
+	char **entry_ptrs;			//!< entries of a mapped cache
+	void *map;				//!< mapped compiled cache, if any
+	size_t map_len;				//!< length of the mapping
 };
 
 /**
@@ -234,6 +247,37 @@ static int set_local_pax_id(struct switchtec_dev *dev)
 	return 0;
 }
 
+/**
+ * @brief Read the identity of a device if it has not been read yet
+ * @param[in] dev Switchtec device handle
+ * @return 0 on success, negative on failure
+ *
+ * Handles opened with ::SWITCHTEC_OPEN_LAZY_PROBE skip the device id,
+ * generation, variant, boot phase and local PAX ID queries until one of
+ * them is first needed. The accessors call this implicitly; a failed
+ * probe is retried on the next use.
+ */
+int switchtec_probe(struct switchtec_dev *dev)
+{
+	int ret = 0;
+
+	platform_lock(dev);
+
+	/* The probe itself uses the accessors, so guard against recursion */
+	if (!dev->probed && !dev->probing) {
+		dev->probing = true;
+		ret = set_gen_variant(dev);
+		if (!ret)
+			ret = set_local_pax_id(dev);
+		dev->probing = false;
+		dev->probed = !ret;
+	}
+
+	platform_unlock(dev);
+
+	return ret;
+}
+
 /**
  * @brief Free a list of device info structures allocated by switchtec_list()
  * @param[in] devlist switchtec_device_info structure list as returned by switchtec_list()
@@ -259,8 +303,40 @@ void switchtec_list_free(struct switchtec_device_info *devlist)
  *   * An I2C device delimited with a colon (/dev/i2c-1:0x20)
  *     (must start with a / so that it is distinguishable from a BDF)
  *   * A UART device (/dev/ttyUSB0)
+ *   * Any of the above served by the switchtecd daemon, with a
+ *     'switchtecd:' prefix (switchtecd:/dev/i2c-1@0x20)
+ *   * A simulated device, with a 'sim:' prefix followed by the options
+ *     described in switchtec_open_sim() (sim:ports=16,latency=50)
+ *
+ * The handle may be shared by multiple threads. Commands and register
+ * accesses issued through it are serialized internally.
  */
 struct switchtec_dev *switchtec_open(const char *device)
+{
+	const char *env = getenv("SWITCHTEC_LAZY_PROBE");
+	int flags = 0;
+
+	if (env && atoi(env))
+		flags |= SWITCHTEC_OPEN_LAZY_PROBE;
+
+	return switchtec_open_flags(device, flags);
+}
+
+/**
+ * @brief Open a Switchtec device by string with options
+ * @param[in] device A string representing the device to open, as
+ *	accepted by switchtec_open()
+ * @param[in] flags  Bitmask of ::switchtec_open_flags
+ * @return A switchtec_dev structure for use in other library functions
+ *	or NULL if an error occurred.
+ *
+ * With ::SWITCHTEC_OPEN_LAZY_PROBE the identity MRPCs normally issued at
+ * open time are deferred until the first accessor that needs them (see
+ * switchtec_probe()). This saves several round trips on slow transports
+ * such as I2C and UART; switchtec_open() selects it when the
+ * SWITCHTEC_LAZY_PROBE environment variable is set to a non-zero value.
+ */
+struct switchtec_dev *switchtec_open_flags(const char *device, int flags)
 {
 	int idx;
 	int domain = 0;
@@ -270,6 +346,18 @@ struct switchtec_dev *switchtec_open(const char *device)
 	char *endptr;
 	struct switchtec_dev *ret;
 
+	if (!strncmp(device, SWITCHTECD_DEVICE_PREFIX,
+		     strlen(SWITCHTECD_DEVICE_PREFIX))) {
+		ret = switchtec_open_daemon(NULL, device +
+					    strlen(SWITCHTECD_DEVICE_PREFIX));
+		goto found;
+	}
+
+	if (!strncmp(device, "sim:", 4)) {
+		ret = switchtec_open_sim(device + 4);
+		goto found;
+	}
+
 	if (sscanf(device, "%i@%i", &bus, &dev) == 2) {
 		ret = switchtec_open_i2c_by_adapter(bus, dev);
 		goto found;
@@ -329,24 +417,121 @@ found:
 
 	snprintf(ret->name, sizeof(ret->name), "%s", device);
 
-	if (set_gen_variant(ret))
-		return NULL;
+	if (flags & SWITCHTEC_OPEN_LAZY_PROBE)
+		return ret;
 
-	if (set_local_pax_id(ret))
+	if (switchtec_probe(ret)) {
+		switchtec_close(ret);
 		return NULL;
+	}
 
 	return ret;
 }
 
+#define OPEN_MANY_MAX_THREADS 16
+
+struct open_many_ctx {
+	const char * const *devices;
+	struct switchtec_dev **devs;
+	int count;
+	int flags;
+	int next;
+	pthread_mutex_t lock;
+};
+
+static void *open_many_worker(void *arg)
+{
+	struct open_many_ctx *ctx = arg;
+	int i;
+
+	while (1) {
+		pthread_mutex_lock(&ctx->lock);
+		i = ctx->next++;
+		pthread_mutex_unlock(&ctx->lock);
+
+		if (i >= ctx->count)
+			break;
+
+		ctx->devs[i] = switchtec_open_flags(ctx->devices[i],
+						    ctx->flags);
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief Open several Switchtec devices concurrently
+ * @param[in]  devices Array of device strings, as accepted by
+ *	switchtec_open()
+ * @param[in]  count   Number of entries in \p devices
+ * @param[out] devs    Array of \p count handles; entries for devices
+ *	that could not be opened are set to NULL
+ * @param[in]  flags   Bitmask of ::switchtec_open_flags
+ * @return The number of devices opened, or negative on failure
+ *
+ * Each device is opened and probed on its own thread so the per-device
+ * MRPC latency overlaps rather than adding up. Handles are closed
+ * individually with switchtec_close().
+ */
+int switchtec_open_many(const char * const *devices, int count,
+			struct switchtec_dev **devs, int flags)
+{
+	pthread_t threads[OPEN_MANY_MAX_THREADS];
+	struct open_many_ctx ctx = {
+		.devices = devices,
+		.devs = devs,
+		.count = count,
+		.flags = flags,
+	};
+	int nthreads, started = 0;
+	int i, opened = 0;
+
+	if (count < 0 || (count && (!devices || !devs))) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	for (i = 0; i < count; i++)
+		devs[i] = NULL;
+
+	pthread_mutex_init(&ctx.lock, NULL);
+
+	/* The calling thread works through the list as well */
+	nthreads = count - 1;
+	if (nthreads > OPEN_MANY_MAX_THREADS)
+		nthreads = OPEN_MANY_MAX_THREADS;
+
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i], NULL, open_many_worker, &ctx))
+			break;
+		started++;
+	}
+
+	open_many_worker(&ctx);
+
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&ctx.lock);
+
+	for (i = 0; i < count; i++)
+		if (devs[i])
+			opened++;
+
+	return opened;
+}
+
 /**
  * @brief Get the device id of the device
  * @param[in] dev Switchtec device handle
  * @return The device id of the device
  *
  * This is only valid if the device was opend with switchtec_open().
+ * If the handle was opened lazily the device is probed on first use.
  */
-_PURE int switchtec_device_id(struct switchtec_dev *dev)
+int switchtec_device_id(struct switchtec_dev *dev)
 {
+	switchtec_probe(dev);
 	return dev->device_id;
 }
 
@@ -356,9 +541,11 @@ _PURE int switchtec_device_id(struct switchtec_dev *dev)
  * @return The generation of the device
  *
  * This is only valid if the device was opend with switchtec_open().
+ * If the handle was opened lazily the device is probed on first use.
  */
-_PURE enum switchtec_gen switchtec_gen(struct switchtec_dev *dev)
+enum switchtec_gen switchtec_gen(struct switchtec_dev *dev)
 {
+	switchtec_probe(dev);
 	return dev->gen;
 }
 
@@ -368,9 +555,11 @@ _PURE enum switchtec_gen switchtec_gen(struct switchtec_dev *dev)
  * @return The variant type of the device
  *
  * This is only valid if the device was opend with switchtec_open().
+ * If the handle was opened lazily the device is probed on first use.
  */
-_PURE enum switchtec_variant switchtec_variant(struct switchtec_dev *dev)
+enum switchtec_variant switchtec_variant(struct switchtec_dev *dev)
 {
+	switchtec_probe(dev);
 	return dev->var;
 }
 
@@ -380,9 +569,11 @@ _PURE enum switchtec_variant switchtec_variant(struct switchtec_dev *dev)
  * @return The boot phase of the device
  *
  * This is only valid if the device was opend with switchtec_open().
+ * If the handle was opened lazily the device is probed on first use.
  */
-_PURE enum switchtec_boot_phase switchtec_boot_phase(struct switchtec_dev *dev)
+enum switchtec_boot_phase switchtec_boot_phase(struct switchtec_dev *dev)
 {
+	switchtec_probe(dev);
 	return dev->boot_phase;
 }
 
@@ -410,13 +601,19 @@ _PURE int switchtec_partition(struct switchtec_dev *dev)
 
 int switchtec_set_pax_id(struct switchtec_dev *dev, int pax_id)
 {
+	if (switchtec_probe(dev))
+		return -1;
+
 	if (!switchtec_is_pax_all(dev) && (pax_id != SWITCHTEC_PAX_ID_LOCAL))
 		return -1;
 
 	if (pax_id == SWITCHTEC_PAX_ID_LOCAL)
-		dev->pax_id = dev->local_pax_id;
-	else
-		dev->pax_id = pax_id;
+		pax_id = dev->local_pax_id;
+
+	if (dev->pax_id != pax_id)
+		switchtec_topo_invalidate(dev);
+
+	dev->pax_id = pax_id;
 
 	return 0;
 }
@@ -432,13 +629,6 @@ static int compare_port_id(const void *aa, const void *bb)
 	return a->log_id - b->log_id;
 }
 
-static int compare_status(const void *aa, const void *bb)
-{
-	const struct switchtec_status *a = aa, *b = bb;
-
-	return compare_port_id(&a->port, &b->port);
-}
-
 static const char *lane_reversal_str(int link_up,
 				     int lane_reversal)
 {
@@ -482,33 +672,43 @@ static void generate_lane_str(struct switchtec_status *s)
 	}
 }
 
+static int compare_port_snapshot(const void *aa, const void *bb)
+{
+	const struct switchtec_port_snapshot *a = aa, *b = bb;
+
+	return compare_port_id(&a->port, &b->port);
+}
+
 /**
- * @brief Get the status of all the ports on a switchtec device
- * @param[in]  dev    Switchtec device handle
- * @param[out] status A pointer to an allocated list of port statuses
- * @return The number of ports in the status list or a negative value
- *	on failure
+ * @brief Get the numeric status of all the ports on a switchtec device
+ * @param[in]  dev	 Switchtec device handle
+ * @param[out] ports	 Caller provided array to fill
+ * @param[in]  max_ports Number of entries in \p ports
+ * @return The number of ports on the device or a negative value on
+ *	failure. At most \p max_ports entries are filled, so a return value
+ *	larger than \p max_ports means the array was too small.
  *
- * This function a allocates memory for the number of ports in the
- * system. The returned \p status structure should be freed with the
- * switchtec_status_free() function.
+ * This returns the same ports, in the same order, as switchtec_status()
+ * but does no allocation and builds no strings, so it is suited to
+ * polling loops. An array of SWITCHTEC_MAX_PORTS entries is always
+ * large enough.
  */
-int switchtec_status(struct switchtec_dev *dev,
-		     struct switchtec_status **status)
+int switchtec_status_snapshot(struct switchtec_dev *dev,
+			      struct switchtec_port_snapshot *ports,
+			      int max_ports)
 {
+	struct switchtec_port_snapshot all[SWITCHTEC_MAX_PORTS];
 	uint64_t port_bitmap = 0;
 	int ret;
 	int i, p;
-	int nr_ports = 0;
-	struct switchtec_status *s;
-	int max_ports;
+	int dev_ports;
 
-	if (!status) {
+	if (!ports || max_ports < 0) {
 		errno = EINVAL;
 		return -errno;
 	}
 
-	max_ports = switchtec_max_supported_ports(dev);
+	dev_ports = switchtec_max_supported_ports(dev);
 
 	struct {
 		uint8_t phys_port_id;
@@ -522,53 +722,89 @@ int switchtec_status(struct switchtec_dev *dev,
 		uint16_t LTSSM;
 		uint8_t lane_reversal;
 		uint8_t first_act_lane;
-	} ports[max_ports];
+	} raw[dev_ports];
 
 	ret = switchtec_cmd(dev, MRPC_LNKSTAT, &port_bitmap, sizeof(port_bitmap),
-			    ports, sizeof(ports));
+			    raw, sizeof(raw));
 	if (ret)
 		return -1;
 
-
-	for (i = 0; i < max_ports; i++) {
-		if ((ports[i].stk_id >> 4) > SWITCHTEC_MAX_STACKS)
+	for (i = 0, p = 0; i < dev_ports && p < SWITCHTEC_MAX_PORTS; i++) {
+		if ((raw[i].stk_id >> 4) > SWITCHTEC_MAX_STACKS)
 			continue;
-		nr_ports++;
+
+		all[p].port.partition = raw[i].par_id;
+		all[p].port.stack = raw[i].stk_id >> 4;
+		all[p].port.upstream = raw[i].usp_flag;
+		all[p].port.stk_id = raw[i].stk_id & 0xF;
+		all[p].port.phys_id = raw[i].phys_port_id;
+		all[p].port.log_id = raw[i].log_port_id;
+
+		all[p].cfg_lnk_width = raw[i].cfg_lnk_width;
+		all[p].neg_lnk_width = raw[i].neg_lnk_width;
+		all[p].link_up = raw[i].linkup_linkrate >> 7;
+		all[p].link_rate = raw[i].linkup_linkrate & 0x7F;
+		all[p].ltssm = le16toh(raw[i].LTSSM);
+		all[p].lane_reversal = raw[i].lane_reversal;
+		all[p].first_act_lane = raw[i].first_act_lane & 0xF;
+
+		p++;
+	}
+
+	qsort(all, p, sizeof(*all), compare_port_snapshot);
+	memcpy(ports, all, sizeof(*all) * (p < max_ports ? p : max_ports));
+
+	return p;
+}
+
+/**
+ * @brief Get the status of all the ports on a switchtec device
+ * @param[in]  dev    Switchtec device handle
+ * @param[out] status A pointer to an allocated list of port statuses
+ * @return The number of ports in the status list or a negative value
+ *	on failure
+ *
+ * This function a allocates memory for the number of ports in the
+ * system. The returned \p status structure should be freed with the
+ * switchtec_status_free() function.
+ */
+int switchtec_status(struct switchtec_dev *dev,
+		     struct switchtec_status **status)
+{
+	struct switchtec_port_snapshot ports[SWITCHTEC_MAX_PORTS];
+	struct switchtec_status *s;
+	int nr_ports;
+	int p;
+
+	if (!status) {
+		errno = EINVAL;
+		return -errno;
 	}
 
+	nr_ports = switchtec_status_snapshot(dev, ports, ARRAY_SIZE(ports));
+	if (nr_ports < 0)
+		return nr_ports;
+
 	s = *status = calloc(nr_ports, sizeof(*s));
 	if (!s)
 		return -ENOMEM;
 
-	for (i = 0, p = 0; i < max_ports && p < nr_ports; i++) {
-		if ((ports[i].stk_id >> 4) > SWITCHTEC_MAX_STACKS)
-			continue;
-
-		s[p].port.partition = ports[i].par_id;
-		s[p].port.stack = ports[i].stk_id >> 4;
-		s[p].port.upstream = ports[i].usp_flag;
-		s[p].port.stk_id = ports[i].stk_id & 0xF;
-		s[p].port.phys_id = ports[i].phys_port_id;
-		s[p].port.log_id = ports[i].log_port_id;
-
-		s[p].cfg_lnk_width = ports[i].cfg_lnk_width;
-		s[p].neg_lnk_width = ports[i].neg_lnk_width;
-		s[p].link_up = ports[i].linkup_linkrate >> 7;
-		s[p].link_rate = ports[i].linkup_linkrate & 0x7F;
-		s[p].ltssm = le16toh(ports[i].LTSSM);
+	for (p = 0; p < nr_ports; p++) {
+		s[p].port = ports[p].port;
+		s[p].cfg_lnk_width = ports[p].cfg_lnk_width;
+		s[p].neg_lnk_width = ports[p].neg_lnk_width;
+		s[p].link_up = ports[p].link_up;
+		s[p].link_rate = ports[p].link_rate;
+		s[p].ltssm = ports[p].ltssm;
 		s[p].ltssm_str = switchtec_ltssm_str(s[p].ltssm, 1);
-		s[p].lane_reversal = ports[i].lane_reversal;
+		s[p].lane_reversal = ports[p].lane_reversal;
 		s[p].lane_reversal_str = lane_reversal_str(s[p].link_up,
 							   s[p].lane_reversal);
-		s[p].first_act_lane = ports[i].first_act_lane & 0xF;
+		s[p].first_act_lane = ports[p].first_act_lane;
 		s[p].acs_ctrl = -1;
 		generate_lane_str(&s[p]);
-
-		p++;
 	}
 
-	qsort(s, nr_ports, sizeof(*s), compare_status);
-
 	return nr_ports;
 }
 
@@ -806,6 +1042,19 @@ static void free_log_defs(struct log_defs *defs)
 	if (!defs->module_defs)
 		return;
 
+#ifndef _WIN32
+	if (defs->map) {
+		/* all the strings live in the mapping */
+		free(defs->module_defs);
+		free(defs->entry_ptrs);
+		munmap(defs->map, defs->map_len);
+		defs->module_defs = NULL;
+		defs->entry_ptrs = NULL;
+		defs->map = NULL;
+		return;
+	}
+#endif
+
 	for (i = 0; i < defs->num_alloc; i++) {
 		free(defs->module_defs[i].mod_name);
 
@@ -1038,177 +1287,644 @@ err_free_log_defs:
 	return -1;
 }
 
+#ifndef _WIN32
+
+/*
+ * Compiled log definitions are cached on disk so later dumps and parses
+ * with the same definition file can mmap() them instead of parsing the
+ * text again. A cache file is named after the log type, the FW and SDK
+ * versions from the definition file's header, and a CRC32 of the whole
+ * definition file, and it holds:
+ *
+ *   struct log_def_cache_hdr
+ *   struct log_def_cache_mod[num_modules]
+ *   uint32_t entry_offsets[num_entries]	(offsets into the arena)
+ *   char arena[arena_len]			(NUL-terminated strings)
+ *
+ * The cache is only meant for the machine that made it, so everything
+ * is kept in host byte order.
+ */
+#define LOG_DEF_CACHE_MAGIC "SWLDEFC1"
+#define LOG_DEF_CACHE_NO_NAME 0xFFFFFFFF
+
+struct log_def_cache_hdr {
+	char magic[8];
+	uint32_t type;
+	uint32_t fw_version;
+	uint32_t sdk_version;
+	uint32_t crc;
+	uint32_t num_modules;
+	uint32_t num_entries;
+	uint32_t arena_len;
+	uint32_t rsvd;
+};
+
+struct log_def_cache_mod {
+	uint32_t name_off;
+	uint32_t first_entry;
+	uint32_t num_entries;
+};
+
 /**
- * @brief Parse an app log or mailbox log and write the results to a file
- * @param[in] log_data	     - logging data
- * @param[in] count	     - number of entries
- * @param[in] init_entry_idx - index of the initial entry
- * @param[in] defs           - log definitions
- * @param[in] log_type       - log type
- * @param[in] log_file	     - log output file
- * @param[in] ts_factor	     - timestamp conversion factor
- * @return 0 on success, negative value on failure
+ * @brief Get the directory the compiled log definitions are cached in
+ * @param[out] dir - directory path
+ * @param[in] len  - size of dir
+ * @return 0 on success, -1 if caching is disabled
+ *
+ * The directory is $SWITCHTEC_LOG_DEF_CACHE if set (an empty value
+ * disables the cache), otherwise $XDG_CACHE_HOME/switchtec or
+ * ~/.cache/switchtec. It is created if it doesn't exist.
  */
-static int write_parsed_log(struct log_a_data log_data[],
-			    size_t count, int init_entry_idx,
-			    struct log_defs *defs,
-			    enum switchtec_log_parse_type log_type,
-			    FILE *log_file, int ts_factor)
+static int log_def_cache_dir(char *dir, size_t len)
 {
-	int i;
-	int ret;
-	int entry_idx = init_entry_idx;
-	unsigned long long time;
-	unsigned int nanos, micros, millis, secs, mins, hours, days;
-	unsigned int entry_num;
-	unsigned int mod_id;
-	unsigned int log_sev = 0;
-	const char *log_sev_strs[] = {"DISABLED", "HIGHEST", "HIGH", "MEDIUM",
-				      "LOW", "LOWEST"};
-	bool is_bl1;
-	struct module_log_defs *mod_defs;
+	const char *env;
+	char *slash;
 
-	if (entry_idx == 0) {
-		if (log_type == SWITCHTEC_LOG_PARSE_TYPE_APP)
-			fputs("   #|Timestamp                |Module       |Severity |Event ID |Event\n",
-		      	      log_file);
-		else
-			fputs("   #|Timestamp                |Source |Event ID |Event\n",
-		      	      log_file);
+	env = getenv("SWITCHTEC_LOG_DEF_CACHE");
+	if (env) {
+		if (!*env)
+			return -1;
+		snprintf(dir, len, "%s", env);
+	} else if ((env = getenv("XDG_CACHE_HOME")) && *env) {
+		snprintf(dir, len, "%s/switchtec", env);
+	} else if ((env = getenv("HOME")) && *env) {
+		snprintf(dir, len, "%s/.cache/switchtec", env);
+	} else {
+		return -1;
 	}
 
-	for (i = 0; i < count; i ++) {
-		/* timestamp is in the first 2 DWords */
-		time = (((unsigned long long)log_data[i].data[0] << 32) |
-			log_data[i].data[1]) * ts_factor/100;
-		nanos = time % 1000;
-		time /= 1000;
-		micros = time % 1000;
-		time /= 1000;
-		millis = time % 1000;
-		time /= 1000;
-		secs = time % 60;
-		time /= 60;
-		mins = time % 60;
-		time /= 60;
-		hours = time % 24;
-		days = time / 24;
-
-		if (log_type == SWITCHTEC_LOG_PARSE_TYPE_APP) {
-			/*
-			 * app log: module ID and log severity are in the 3rd
-			 * DWord
-			 */
-			mod_id = (log_data[i].data[2] >> 16) & 0xFFF;
-			log_sev = (log_data[i].data[2] >> 28) & 0xF;
-
-			if ((mod_id > defs->num_alloc) ||
-			    (defs->module_defs[mod_id].mod_name == NULL) ||
-			    (strlen(defs->module_defs[mod_id].mod_name) == 0)) {
-				if (fprintf(log_file, "(Invalid module ID: 0x%x)\n",
-					mod_id) < 0)
-					goto ret_print_error;
-				continue;
-			}
+	if (!mkdir(dir, 0755) || errno == EEXIST)
+		return 0;
+	if (errno != ENOENT)
+		return -1;
 
-			if (log_sev >= ARRAY_SIZE(log_sev_strs)) {
-				if (fprintf(log_file, "(Invalid log severity: %d)\n",
-					log_sev) < 0)
-					goto ret_print_error;
-				continue;
-			}
-		} else {
-			/*
-			 * mailbox log: BL1/BL2 indication is in the 3rd
-			 * DWord
-			 */
-			is_bl1 = (((log_data[i].data[2] >> 27) & 1) == 0);
+	/* create the parent (eg. ~/.cache) and try again */
+	slash = strrchr(dir, '/');
+	if (!slash || slash == dir)
+		return -1;
 
-			/* mailbox log definitions are all in the first entry */
-			mod_id = 0;
-		}
+	*slash = 0;
+	if (mkdir(dir, 0755) && errno != EEXIST)
+		return -1;
+	*slash = '/';
 
-		mod_defs = &defs->module_defs[mod_id];
+	if (mkdir(dir, 0755) && errno != EEXIST)
+		return -1;
 
-		/* entry number is in the 3rd DWord */
-		entry_num = log_data[i].data[2] & 0x0000FFFF;
+	return 0;
+}
 
-		if (entry_num >= mod_defs->num_entries) {
-			if (fprintf(log_file,
-				    "(Invalid log entry number: %d (module 0x%x))\n",
-				    entry_num, mod_id) < 0)
-				goto ret_print_error;
-			continue;
-		}
+static int log_def_file_crc(FILE *log_def_file, uint32_t *crc)
+{
+	uint8_t buf[16384];
+	size_t len, total = 0;
+	uint32_t sum = 0;
 
-		/* print the entry index and timestamp */
-		if (ts_factor == 0)
-			ret = fprintf(log_file,
-				      "%04d|xxxd xx:xx:xx.xxx,xxx,xxx|",
-				      entry_idx);
-		else
-			ret = fprintf(log_file,
-				      "%04d|%03dd %02d:%02d:%02d.%03d,%03d,%03d|",
-				      entry_idx, days, hours, mins, secs,
-				      millis, micros, nanos);
+	rewind(log_def_file);
+	while ((len = fread(buf, 1, sizeof(buf), log_def_file))) {
+		sum = crc32(buf, len, sum, !total, 0);
+		total += len;
+	}
 
-		if (ret < 0)
-			goto ret_print_error;
+	if (ferror(log_def_file)) {
+		rewind(log_def_file);
+		return -1;
+	}
 
-		if (log_type == SWITCHTEC_LOG_PARSE_TYPE_APP) {
-			/* print the module name and log severity */
-			if (fprintf(log_file, "%-12s |%-8s |0x%04x   |",
-			    mod_defs->mod_name, log_sev_strs[log_sev],
-			    entry_num) < 0)
-				goto ret_print_error;
-		} else {
-			/* print the log source (BL1/BL2) */
-			if (fprintf(log_file, "%-6s |0x%04x   |",
-			    (is_bl1 ? "BL1" : "BL2"), entry_num) < 0)
-				goto ret_print_error;
-		}
+	rewind(log_def_file);
+	*crc = sum;
+	return 0;
+}
 
-		/* print the log entry */
-	  	if (fprintf(log_file, mod_defs->entries[entry_num],
-	  		    log_data[i].data[3], log_data[i].data[4],
-			    log_data[i].data[5], log_data[i].data[6],
-			    log_data[i].data[7]) < 0)
-			goto ret_print_error;
+static int log_def_cache_load(const char *path,
+			      const struct log_def_cache_hdr *key,
+			      struct log_defs *defs)
+{
+	const struct log_def_cache_hdr *hdr;
+	const struct log_def_cache_mod *mods;
+	const uint32_t *offs;
+	struct module_log_defs *mod_defs;
+	const char *arena;
+	size_t len, i, j, n;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
 
-		entry_idx++;
+	if (fstat(fd, &st) || st.st_size < sizeof(*hdr)) {
+		close(fd);
+		return -1;
 	}
 
-	if (fflush(log_file) != 0)
+	len = st.st_size;
+	map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
 		return -1;
 
+	hdr = map;
+	if (memcmp(hdr->magic, key->magic, sizeof(hdr->magic)) ||
+	    hdr->type != key->type || hdr->crc != key->crc ||
+	    hdr->fw_version != key->fw_version ||
+	    hdr->sdk_version != key->sdk_version ||
+	    !hdr->num_modules || !hdr->arena_len ||
+	    len != sizeof(*hdr) + hdr->num_modules * sizeof(*mods) +
+		   (size_t)hdr->num_entries * sizeof(*offs) + hdr->arena_len)
+		goto err_unmap;
+
+	mods = (const void *)(hdr + 1);
+	offs = (const void *)(mods + hdr->num_modules);
+	arena = (const void *)(offs + hdr->num_entries);
+
+	/* every offset below arena_len then points at a terminated string */
+	if (arena[hdr->arena_len - 1])
+		goto err_unmap;
+
+	defs->module_defs = calloc(hdr->num_modules, sizeof(*defs->module_defs));
+	defs->entry_ptrs = malloc((hdr->num_entries ? hdr->num_entries : 1) *
+				  sizeof(*defs->entry_ptrs));
+	if (!defs->module_defs || !defs->entry_ptrs)
+		goto err_free;
+
+	for (i = 0; i < hdr->num_entries; i++) {
+		if (offs[i] >= hdr->arena_len)
+			goto err_free;
+		defs->entry_ptrs[i] = (char *)arena + offs[i];
+	}
+
+	for (i = 0; i < hdr->num_modules; i++) {
+		mod_defs = &defs->module_defs[i];
+		n = mods[i].num_entries;
+		j = mods[i].first_entry;
+
+		if (j > hdr->num_entries || n > hdr->num_entries - j)
+			goto err_free;
+
+		if (mods[i].name_off != LOG_DEF_CACHE_NO_NAME) {
+			if (mods[i].name_off >= hdr->arena_len)
+				goto err_free;
+			mod_defs->mod_name = (char *)arena + mods[i].name_off;
+		}
+
+		mod_defs->entries = defs->entry_ptrs + j;
+		mod_defs->num_entries = n;
+	}
+
+	defs->num_alloc = hdr->num_modules;
+	defs->map = map;
+	defs->map_len = len;
 	return 0;
 
-ret_print_error:
-	errno = SWITCHTEC_ERR_PARSED_LOG_WRITE_ERROR;
+err_free:
+	free(defs->module_defs);
+	free(defs->entry_ptrs);
+	defs->module_defs = NULL;
+	defs->entry_ptrs = NULL;
+err_unmap:
+	munmap(map, len);
 	return -1;
 }
 
-static int parse_def_header(FILE *log_def_file, uint32_t *fw_version,
-			    uint32_t *sdk_version)
+static int log_def_cache_store(const char *path,
+			       const struct log_def_cache_hdr *key,
+			       struct log_defs *defs)
 {
-	char line[512];
-	int i;
+	struct log_def_cache_hdr hdr = *key;
+	struct log_def_cache_mod *mods;
+	uint32_t *offs;
+	char *buf, *arena, tmp[PATH_MAX];
+	struct module_log_defs *mod_defs;
+	size_t total, arena_len = 0, len;
+	uint32_t num_entries = 0;
+	int i, j, fd, ret = -1;
 
-	*fw_version = 0;
-	*sdk_version = 0;
-	while (fgets(line, sizeof(line), log_def_file)) {
-		if (line[0] != '#')
-			continue;
+	for (i = 0; i < defs->num_alloc; i++) {
+		mod_defs = &defs->module_defs[i];
+		if (mod_defs->mod_name)
+			arena_len += strlen(mod_defs->mod_name) + 1;
+		for (j = 0; j < mod_defs->num_entries; j++)
+			arena_len += strlen(mod_defs->entries[j]) + 1;
+		num_entries += mod_defs->num_entries;
+	}
 
-		i = 0;
-		while (line[i] == ' ' || line[i] == '#') i++;
+	if (!defs->num_alloc || !arena_len || arena_len >= UINT32_MAX)
+		return -1;
 
-		if (strncasecmp(line + i, "SDK Version:", 12) == 0) {
-			i += 12;
-			while (line[i] == ' ') i++;
-			sscanf(line + i, "%i", (int*)sdk_version);
-		}
-		else if (strncasecmp(line + i, "FW Version:", 11) == 0) {
+	hdr.num_modules = defs->num_alloc;
+	hdr.num_entries = num_entries;
+	hdr.arena_len = arena_len;
+
+	total = sizeof(hdr) + hdr.num_modules * sizeof(*mods) +
+		num_entries * sizeof(*offs) + arena_len;
+	buf = malloc(total);
+	if (!buf)
+		return -1;
+
+	memcpy(buf, &hdr, sizeof(hdr));
+	mods = (void *)(buf + sizeof(hdr));
+	offs = (void *)(mods + hdr.num_modules);
+	arena = (void *)(offs + num_entries);
+
+	arena_len = 0;
+	num_entries = 0;
+	for (i = 0; i < defs->num_alloc; i++) {
+		mod_defs = &defs->module_defs[i];
+
+		mods[i].name_off = LOG_DEF_CACHE_NO_NAME;
+		if (mod_defs->mod_name) {
+			len = strlen(mod_defs->mod_name) + 1;
+			memcpy(arena + arena_len, mod_defs->mod_name, len);
+			mods[i].name_off = arena_len;
+			arena_len += len;
+		}
+
+		mods[i].first_entry = num_entries;
+		mods[i].num_entries = mod_defs->num_entries;
+		for (j = 0; j < mod_defs->num_entries; j++) {
+			len = strlen(mod_defs->entries[j]) + 1;
+			memcpy(arena + arena_len, mod_defs->entries[j], len);
+			offs[num_entries++] = arena_len;
+			arena_len += len;
+		}
+	}
+
+	/* write to a temporary file first so readers never see a partial one */
+	if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= sizeof(tmp))
+		goto out_free;
+
+	fd = mkstemp(tmp);
+	if (fd < 0)
+		goto out_free;
+
+	len = 0;
+	while (len < total) {
+		ssize_t wrote = write(fd, buf + len, total - len);
+		if (wrote <= 0)
+			break;
+		len += wrote;
+	}
+
+	if (close(fd) || len != total || rename(tmp, path))
+		unlink(tmp);
+	else
+		ret = 0;
+
+out_free:
+	free(buf);
+	return ret;
+}
+
+#endif /* _WIN32 */
+
+/**
+ * @brief Get the log definitions from a log definition file
+ * @param[in] log_def_file - log definition file
+ * @param[in] log_type     - log type the definitions are for
+ * @param[in] fw_version   - FW version from the definition file's header
+ * @param[in] sdk_version  - SDK version from the definition file's header
+ * @param[out] defs 	   - log definitions
+ * @return 0 on success, negative value on failure
+ *
+ * The definitions are taken from the compiled cache when it has an
+ * up to date copy. Otherwise the file is parsed and the result is added
+ * to the cache.
+ */
+static int load_log_defs(FILE *log_def_file,
+			 enum switchtec_log_parse_type log_type,
+			 uint32_t fw_version, uint32_t sdk_version,
+			 struct log_defs *defs)
+{
+	int ret;
+#ifndef _WIN32
+	struct log_def_cache_hdr key = {
+		.magic = LOG_DEF_CACHE_MAGIC,
+		.type = log_type,
+		.fw_version = fw_version,
+		.sdk_version = sdk_version,
+	};
+	char dir[PATH_MAX - 64], path[PATH_MAX];
+	int cached = 0;
+
+	if (!log_def_cache_dir(dir, sizeof(dir)) &&
+	    !log_def_file_crc(log_def_file, &key.crc)) {
+		snprintf(path, sizeof(path), "%s/logdef-%s-%08x-%08x-%08x.bin",
+			 dir, log_type == SWITCHTEC_LOG_PARSE_TYPE_APP ?
+			 "app" : "mailbox", fw_version, sdk_version, key.crc);
+
+		if (!log_def_cache_load(path, &key, defs))
+			return 0;
+		cached = 1;
+	}
+#endif
+
+	if (log_type == SWITCHTEC_LOG_PARSE_TYPE_APP)
+		ret = read_app_log_defs(log_def_file, defs);
+	else
+		ret = read_mailbox_log_defs(log_def_file, defs);
+
+#ifndef _WIN32
+	/* failing to update the cache doesn't matter */
+	if (!ret && cached)
+		log_def_cache_store(path, &key, defs);
+#endif
+
+	return ret;
+}
+
+/*
+ * Fields decoded from one app log or mailbox log entry. Entries are
+ * decoded a batch at a time before any formatting is done so the
+ * formatting loop only has to deal with the output.
+ */
+struct log_entry {
+	unsigned int days, hours, mins, secs, millis, micros, nanos;
+	unsigned int mod_id;
+	unsigned int log_sev;
+	unsigned int entry_num;
+	bool is_bl1;
+	const uint32_t *args;
+};
+
+#define LOG_DECODE_BATCH 64
+
+static const char * const log_sev_strs[] = {
+	"DISABLED", "HIGHEST", "HIGH", "MEDIUM", "LOW", "LOWEST"
+};
+
+static void decode_log_entries(const struct log_a_data *log_data,
+			       size_t count,
+			       enum switchtec_log_parse_type log_type,
+			       int ts_factor, struct log_entry *ent)
+{
+	unsigned long long time;
+	size_t i;
+
+	for (i = 0; i < count; i++, ent++) {
+		/* timestamp is in the first 2 DWords */
+		time = (((unsigned long long)log_data[i].data[0] << 32) |
+			log_data[i].data[1]) * ts_factor/100;
+		ent->nanos = time % 1000;
+		time /= 1000;
+		ent->micros = time % 1000;
+		time /= 1000;
+		ent->millis = time % 1000;
+		time /= 1000;
+		ent->secs = time % 60;
+		time /= 60;
+		ent->mins = time % 60;
+		time /= 60;
+		ent->hours = time % 24;
+		ent->days = time / 24;
+
+		if (log_type == SWITCHTEC_LOG_PARSE_TYPE_APP) {
+			/*
+			 * app log: module ID and log severity are in the 3rd
+			 * DWord
+			 */
+			ent->mod_id = (log_data[i].data[2] >> 16) & 0xFFF;
+			ent->log_sev = (log_data[i].data[2] >> 28) & 0xF;
+			ent->is_bl1 = false;
+		} else {
+			/*
+			 * mailbox log: BL1/BL2 indication is in the 3rd
+			 * DWord
+			 */
+			ent->is_bl1 = (((log_data[i].data[2] >> 27) & 1) == 0);
+
+			/* mailbox log definitions are all in the first entry */
+			ent->mod_id = 0;
+			ent->log_sev = 0;
+		}
+
+		/* entry number is in the 3rd DWord */
+		ent->entry_num = log_data[i].data[2] & 0x0000FFFF;
+		ent->args = &log_data[i].data[3];
+	}
+}
+
+/*
+ * Growable in-memory text buffer that parsed log output is formatted
+ * into, so a block (or a whole range of a binary log file) can be
+ * formatted without touching a FILE and then written out in one go.
+ */
+struct log_buf {
+	char *buf;
+	size_t len;
+	size_t alloc;
+};
+
+static int log_buf_reserve(struct log_buf *lb, size_t len)
+{
+	size_t alloc = lb->alloc ? lb->alloc : 4096;
+	char *buf;
+
+	if (lb->len + len < lb->alloc)
+		return 0;
+
+	while (lb->len + len >= alloc)
+		alloc *= 2;
+
+	buf = realloc(lb->buf, alloc);
+	if (!buf)
+		return -1;
+
+	lb->buf = buf;
+	lb->alloc = alloc;
+	return 0;
+}
+
+static int log_buf_printf(struct log_buf *lb, const char *fmt, ...)
+{
+	va_list ap;
+	int ret;
+
+	if (log_buf_reserve(lb, 256))
+		return -1;
+
+	va_start(ap, fmt);
+	ret = vsnprintf(lb->buf + lb->len, lb->alloc - lb->len, fmt, ap);
+	va_end(ap);
+	if (ret < 0)
+		return ret;
+
+	if (lb->len + ret >= lb->alloc) {
+		if (log_buf_reserve(lb, ret + 1))
+			return -1;
+
+		va_start(ap, fmt);
+		ret = vsnprintf(lb->buf + lb->len, lb->alloc - lb->len,
+				fmt, ap);
+		va_end(ap);
+		if (ret < 0)
+			return ret;
+	}
+
+	lb->len += ret;
+	return ret;
+}
+
+static void log_buf_free(struct log_buf *lb)
+{
+	free(lb->buf);
+	lb->buf = NULL;
+	lb->len = lb->alloc = 0;
+}
+
+static int write_parsed_log_header(enum switchtec_log_parse_type log_type,
+				   struct log_buf *out)
+{
+	int ret;
+
+	if (log_type == SWITCHTEC_LOG_PARSE_TYPE_APP)
+		ret = log_buf_printf(out, "   #|Timestamp                |Module       |Severity |Event ID |Event\n");
+	else
+		ret = log_buf_printf(out, "   #|Timestamp                |Source |Event ID |Event\n");
+
+	if (ret < 0) {
+		errno = SWITCHTEC_ERR_PARSED_LOG_WRITE_ERROR;
+		return -1;
+	}
+
+	return 0;
+}
+
+/**
+ * @brief Parse an app log or mailbox log into a text buffer
+ * @param[in] log_data	     - logging data
+ * @param[in] count	     - number of entries
+ * @param[in] init_entry_idx - index of the initial entry
+ * @param[in] defs           - log definitions
+ * @param[in] log_type       - log type
+ * @param[out] out	     - buffer the parsed text is appended to
+ * @param[in] ts_factor	     - timestamp conversion factor
+ * @return 0 on success, negative value on failure
+ *
+ * Every entry, including invalid ones, uses up one index so the index
+ * printed for an entry is always its position in the log.
+ */
+static int write_parsed_log(const struct log_a_data log_data[],
+			    size_t count, int init_entry_idx,
+			    struct log_defs *defs,
+			    enum switchtec_log_parse_type log_type,
+			    struct log_buf *out, int ts_factor)
+{
+	struct log_entry batch[LOG_DECODE_BATCH];
+	struct log_entry *ent;
+	struct module_log_defs *mod_defs;
+	int entry_idx = init_entry_idx;
+	size_t done, n, i;
+	int ret;
+
+	for (done = 0; done < count; done += n) {
+		n = count - done;
+		if (n > LOG_DECODE_BATCH)
+			n = LOG_DECODE_BATCH;
+
+		decode_log_entries(&log_data[done], n, log_type, ts_factor,
+				   batch);
+
+		for (i = 0; i < n; i++, entry_idx++) {
+			ent = &batch[i];
+
+			if (log_type == SWITCHTEC_LOG_PARSE_TYPE_APP) {
+				if ((ent->mod_id > defs->num_alloc) ||
+				    (defs->module_defs[ent->mod_id].mod_name == NULL) ||
+				    (strlen(defs->module_defs[ent->mod_id].mod_name) == 0)) {
+					if (log_buf_printf(out, "(Invalid module ID: 0x%x)\n",
+							   ent->mod_id) < 0)
+						goto ret_print_error;
+					continue;
+				}
+
+				if (ent->log_sev >= ARRAY_SIZE(log_sev_strs)) {
+					if (log_buf_printf(out, "(Invalid log severity: %d)\n",
+							   ent->log_sev) < 0)
+						goto ret_print_error;
+					continue;
+				}
+			}
+
+			mod_defs = &defs->module_defs[ent->mod_id];
+
+			if (ent->entry_num >= mod_defs->num_entries) {
+				if (log_buf_printf(out,
+						   "(Invalid log entry number: %d (module 0x%x))\n",
+						   ent->entry_num, ent->mod_id) < 0)
+					goto ret_print_error;
+				continue;
+			}
+
+			/* print the entry index and timestamp */
+			if (ts_factor == 0)
+				ret = log_buf_printf(out,
+						     "%04d|xxxd xx:xx:xx.xxx,xxx,xxx|",
+						     entry_idx);
+			else
+				ret = log_buf_printf(out,
+						     "%04d|%03dd %02d:%02d:%02d.%03d,%03d,%03d|",
+						     entry_idx, ent->days,
+						     ent->hours, ent->mins,
+						     ent->secs, ent->millis,
+						     ent->micros, ent->nanos);
+
+			if (ret < 0)
+				goto ret_print_error;
+
+			if (log_type == SWITCHTEC_LOG_PARSE_TYPE_APP) {
+				/* print the module name and log severity */
+				if (log_buf_printf(out, "%-12s |%-8s |0x%04x   |",
+						   mod_defs->mod_name,
+						   log_sev_strs[ent->log_sev],
+						   ent->entry_num) < 0)
+					goto ret_print_error;
+			} else {
+				/* print the log source (BL1/BL2) */
+				if (log_buf_printf(out, "%-6s |0x%04x   |",
+						   (ent->is_bl1 ? "BL1" : "BL2"),
+						   ent->entry_num) < 0)
+					goto ret_print_error;
+			}
+
+			/* print the log entry */
+			if (log_buf_printf(out, mod_defs->entries[ent->entry_num],
+					   ent->args[0], ent->args[1],
+					   ent->args[2], ent->args[3],
+					   ent->args[4]) < 0)
+				goto ret_print_error;
+		}
+	}
+
+	return 0;
+
+ret_print_error:
+	errno = SWITCHTEC_ERR_PARSED_LOG_WRITE_ERROR;
+	return -1;
+}
+
+static int parse_def_header(FILE *log_def_file, uint32_t *fw_version,
+			    uint32_t *sdk_version)
+{
+	char line[512];
+	int i;
+
+	*fw_version = 0;
+	*sdk_version = 0;
+	while (fgets(line, sizeof(line), log_def_file)) {
+		if (line[0] != '#')
+			continue;
+
+		i = 0;
+		while (line[i] == ' ' || line[i] == '#') i++;
+
+		if (strncasecmp(line + i, "SDK Version:", 12) == 0) {
+			i += 12;
+			while (line[i] == ' ') i++;
+			sscanf(line + i, "%i", (int*)sdk_version);
+		}
+		else if (strncasecmp(line + i, "FW Version:", 11) == 0) {
 			i += 11;
 			while (line[i] == ' ') i++;
 			sscanf(line + i, "%i", (int*)fw_version);
@@ -1261,24 +1977,96 @@ static int get_ts_factor(enum switchtec_gen gen)
 		return 833;
 }
 
+#define LOG_SINK_BUF_LEN (256 * 1024)
+
+/*
+ * Two response buffers shared between a fetch thread, which issues the
+ * MRPC_FWLOGRD commands, and the caller, which writes out (and possibly
+ * parses) each block. The next block is fetched from the switch while
+ * the current one is being formatted.
+ */
+struct log_a_fetch {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct switchtec_dev *dev;
+	struct log_a_retr cmd;
+	struct log_a_retr_result res[2];
+	int full[2];
+	int done;
+	int stop;
+	int error;
+	int error_no;
+};
+
+static void *log_a_fetcher(void *arg)
+{
+	struct log_a_fetch *lf = arg;
+	int i = 0, ret, last;
+
+	while (1) {
+		pthread_mutex_lock(&lf->lock);
+		while (lf->full[i] && !lf->stop)
+			pthread_cond_wait(&lf->cond, &lf->lock);
+		if (lf->stop) {
+			pthread_mutex_unlock(&lf->lock);
+			break;
+		}
+		pthread_mutex_unlock(&lf->lock);
+
+		ret = switchtec_cmd(lf->dev, MRPC_FWLOGRD, &lf->cmd,
+				    sizeof(lf->cmd), &lf->res[i],
+				    sizeof(lf->res[i]));
+		last = ret || !lf->res[i].hdr.remain;
+		if (!ret)
+			lf->cmd.start = lf->res[i].hdr.next_start;
+
+		pthread_mutex_lock(&lf->lock);
+		if (ret) {
+			lf->error = ret;
+			lf->error_no = errno;
+		} else {
+			lf->full[i] = 1;
+		}
+		if (last)
+			lf->done = 1;
+		pthread_cond_signal(&lf->cond);
+		pthread_mutex_unlock(&lf->lock);
+
+		if (last)
+			break;
+		i = !i;
+	}
+
+	return NULL;
+}
+
+/*
+ * Dump an app log (RAM or flash) to fd. With a cursor, reading starts
+ * where the previous call left off, the file header is only written
+ * once, and the cursor is moved past the entries read.
+ */
 static int log_a_to_file(struct switchtec_dev *dev, int sub_cmd_id,
 			 int fd, FILE *log_def_file,
-			 struct switchtec_log_file_info *info)
+			 struct switchtec_log_file_info *info,
+			 struct switchtec_log_cursor *cursor)
 {
 	int ret = -1;
 	int read = 0;
-	struct log_a_retr_result res;
-	struct log_a_retr cmd = {
-		.sub_cmd_id = sub_cmd_id,
-		.start = -1,
-	};
+	struct log_a_fetch *lf;
+	struct log_a_retr_result *res;
 	struct log_defs defs = {
 		.module_defs = NULL,
 		.num_alloc = 0};
-	FILE *log_file;
+	FILE *log_file = NULL;
+	struct log_buf text = {};
+	pthread_t fetcher;
 	int entry_idx = 0;
 	uint32_t fw_version = 0;
 	uint32_t sdk_version = 0;
+	int i = 0, sink_fd;
+	bool write_header = true;
+	uint32_t next_start = 0;
+	int blocks = 0;
 
 	if (log_def_file != NULL) {
 		ret = parse_def_header(log_def_file, &fw_version,
@@ -1286,73 +2074,169 @@ static int log_a_to_file(struct switchtec_dev *dev, int sub_cmd_id,
 		if (ret)
 			return ret;
 		/* read the log definition file into defs */
-		ret = read_app_log_defs(log_def_file, &defs);
+		ret = load_log_defs(log_def_file, SWITCHTEC_LOG_PARSE_TYPE_APP,
+				    fw_version, sdk_version, &defs);
 		if (ret < 0)
 			return ret;
-	}
 
-	res.hdr.remain = 1;
+		/*
+		 * The parsed output of every block goes through the same
+		 * buffered stream. It is opened on a duplicate of fd so it
+		 * can be closed without closing the caller's descriptor.
+		 */
+		ret = -1;
+		sink_fd = dup(fd);
+		if (sink_fd < 0)
+			goto ret_free_log_defs;
 
-	while (res.hdr.remain) {
-		ret = switchtec_cmd(dev, MRPC_FWLOGRD, &cmd, sizeof(cmd),
-				    &res, sizeof(res));
-		if (ret)
+		log_file = fdopen(sink_fd, "w");
+		if (!log_file) {
+			close(sink_fd);
 			goto ret_free_log_defs;
-		if (res.hdr.overflow && info)
+		}
+
+		setvbuf(log_file, NULL, _IOFBF, LOG_SINK_BUF_LEN);
+	}
+
+	lf = calloc(1, sizeof(*lf));
+	if (!lf) {
+		ret = -1;
+		goto ret_close_log_file;
+	}
+
+	pthread_mutex_init(&lf->lock, NULL);
+	pthread_cond_init(&lf->cond, NULL);
+	lf->dev = dev;
+	lf->cmd.sub_cmd_id = sub_cmd_id;
+	lf->cmd.start = -1;
+
+	if (cursor) {
+		if (cursor->valid)
+			lf->cmd.start = cursor->next_start;
+		entry_idx = cursor->entries;
+		write_header = !cursor->header_written;
+	}
+
+	ret = pthread_create(&fetcher, NULL, log_a_fetcher, lf);
+	if (ret) {
+		errno = ret;
+		ret = -1;
+		goto ret_free_fetch;
+	}
+
+	while (1) {
+		pthread_mutex_lock(&lf->lock);
+		while (!lf->full[i] && !lf->done)
+			pthread_cond_wait(&lf->cond, &lf->lock);
+		if (!lf->full[i]) {
+			ret = lf->error;
+			if (ret)
+				errno = lf->error_no;
+			pthread_mutex_unlock(&lf->lock);
+			break;
+		}
+		pthread_mutex_unlock(&lf->lock);
+
+		res = &lf->res[i];
+
+		if (res->hdr.overflow && info)
 			info->overflow = 1;
 		if (read == 0) {
-			if (dev->gen < SWITCHTEC_GEN5) {
-				res.hdr.sdk_version = 0;
-				res.hdr.fw_version = 0;
+			if (switchtec_gen(dev) < SWITCHTEC_GEN5) {
+				res->hdr.sdk_version = 0;
+				res->hdr.fw_version = 0;
 			}
 
 			if (info) {
 				info->def_fw_version = fw_version;
 				info->def_sdk_version = sdk_version;
-				info->log_fw_version = res.hdr.fw_version;
-				info->log_sdk_version = res.hdr.sdk_version;
+				info->log_fw_version = res->hdr.fw_version;
+				info->log_sdk_version = res->hdr.sdk_version;
 			}
 
-			if (res.hdr.sdk_version != sdk_version ||
-			     res.hdr.fw_version != fw_version) {
+			if (res->hdr.sdk_version != sdk_version ||
+			     res->hdr.fw_version != fw_version) {
 				if (info && log_def_file)
 					info->version_mismatch = true;
 
 			}
 
-			append_log_header(fd, res.hdr.sdk_version,
-					  res.hdr.fw_version,
-					  log_def_file == NULL? 1 : 0);
+			if (write_header) {
+				append_log_header(fd, res->hdr.sdk_version,
+						  res->hdr.fw_version,
+						  log_def_file == NULL? 1 : 0);
+				if (log_def_file)
+					write_parsed_log_header(SWITCHTEC_LOG_PARSE_TYPE_APP,
+								&text);
+			}
 		}
 
 		if (log_def_file == NULL) {
 			/* write the binary log data to a file */
-			ret = write(fd, res.data,
-				    sizeof(*res.data) * res.hdr.count);
+			ret = write(fd, res->data,
+				    sizeof(*res->data) * res->hdr.count);
 			if (ret < 0)
-				return ret;
+				break;
 		} else {
-			log_file = fdopen(fd, "w");
-			if (!log_file)
-				goto ret_free_log_defs;
-
 			/* parse the log data and write it to a file */
-			ret = write_parsed_log(res.data, res.hdr.count,
+			ret = write_parsed_log(res->data, res->hdr.count,
 					       entry_idx, &defs,
 					       SWITCHTEC_LOG_PARSE_TYPE_APP,
-					       log_file,
-					       get_ts_factor(dev->gen));
+					       &text,
+					       get_ts_factor(switchtec_gen(dev)));
 			if (ret < 0)
-				goto ret_free_log_defs;
+				break;
+
+			if (fwrite(text.buf, 1, text.len, log_file) !=
+			    text.len) {
+				errno = SWITCHTEC_ERR_PARSED_LOG_WRITE_ERROR;
+				ret = -1;
+				break;
+			}
+			text.len = 0;
 
-			entry_idx += res.hdr.count;
+			entry_idx += res->hdr.count;
 		}
 
-		read += le32toh(res.hdr.count);
-		cmd.start = res.hdr.next_start;
+		read += le32toh(res->hdr.count);
+		next_start = res->hdr.next_start;
+		blocks++;
+
+		pthread_mutex_lock(&lf->lock);
+		lf->full[i] = 0;
+		pthread_cond_signal(&lf->cond);
+		pthread_mutex_unlock(&lf->lock);
+		i = !i;
 	}
 
-	ret = 0;
+	pthread_mutex_lock(&lf->lock);
+	lf->stop = 1;
+	pthread_cond_signal(&lf->cond);
+	pthread_mutex_unlock(&lf->lock);
+	pthread_join(fetcher, NULL);
+
+	/*
+	 * Move the cursor past every block that made it to the file, even
+	 * if a later one failed, so the next call doesn't repeat them.
+	 */
+	if (cursor && blocks) {
+		cursor->next_start = next_start;
+		cursor->valid = true;
+		cursor->entries += read;
+		cursor->header_written = true;
+	}
+
+ret_free_fetch:
+	pthread_cond_destroy(&lf->cond);
+	pthread_mutex_destroy(&lf->lock);
+	free(lf);
+
+ret_close_log_file:
+	if (log_file && fclose(log_file) && !ret) {
+		errno = SWITCHTEC_ERR_PARSED_LOG_WRITE_ERROR;
+		ret = -1;
+	}
+	log_buf_free(&text);
 
 ret_free_log_defs:
 	free_log_defs(&defs);
@@ -1424,16 +2308,17 @@ static int log_c_to_file(struct switchtec_dev *dev, int sub_cmd_id, int fd)
 static int log_ram_flash_to_file(struct switchtec_dev *dev,
 				 int gen5_cmd, int gen4_cmd, int gen4_cmd_lgcy,
 				 int fd, FILE *log_def_file,
-				 struct switchtec_log_file_info *info)
+				 struct switchtec_log_file_info *info,
+				 struct switchtec_log_cursor *cursor)
 {
 	int ret;
 
 	if (switchtec_is_gen5(dev)) {
 		return log_a_to_file(dev, gen5_cmd, fd, log_def_file,
-				     info);
+				     info, cursor);
 	} else {
 		ret = log_a_to_file(dev, gen4_cmd, fd, log_def_file,
-				    info);
+				    info, cursor);
 
 		/* somehow hardware returns ERR_LOGC_PORT_ARDY_BIND
 		 * instead of ERR_SUBCMD_INVALID if this subcommand
@@ -1444,7 +2329,7 @@ static int log_ram_flash_to_file(struct switchtec_dev *dev,
 		    (ERRNO_MRPC(errno) == ERR_LOGC_PORT_ARDY_BIND ||
 		     ERRNO_MRPC(errno) == ERR_SUBCMD_INVALID))
 			ret = log_a_to_file(dev, gen4_cmd_lgcy, fd,
-					    log_def_file, info);
+					    log_def_file, info, cursor);
 
 		return ret;
 	}
@@ -1472,13 +2357,13 @@ int switchtec_log_to_file(struct switchtec_dev *dev,
 					     MRPC_FWLOGRD_RAM_GEN5,
 					     MRPC_FWLOGRD_RAM_WITH_FLAG,
 					     MRPC_FWLOGRD_RAM,
-					     fd, log_def_file, info);
+					     fd, log_def_file, info, NULL);
 	case SWITCHTEC_LOG_FLASH:
 		return log_ram_flash_to_file(dev,
 					     MRPC_FWLOGRD_FLASH_GEN5,
 					     MRPC_FWLOGRD_FLASH_WITH_FLAG,
 					     MRPC_FWLOGRD_FLASH,
-					     fd, log_def_file, info);
+					     fd, log_def_file, info, NULL);
 	case SWITCHTEC_LOG_MEMLOG:
 		return log_b_to_file(dev, MRPC_FWLOGRD_MEMLOG, fd);
 	case SWITCHTEC_LOG_REGS:
@@ -1497,6 +2382,55 @@ int switchtec_log_to_file(struct switchtec_dev *dev,
 	return -errno;
 }
 
+/**
+ * @brief Append the log entries added since the last call to a file
+ * @param[in]  dev          - Switchtec device handle
+ * @param[in]  type         - Type of log data (SWITCHTEC_LOG_RAM or
+ *	SWITCHTEC_LOG_FLASH)
+ * @param[in]  fd           - File descriptor to dump the data to
+ * @param[in]  log_def_file - Log definition file, or NULL for binary
+ *	output
+ * @param[in,out] cursor    - Position in the log. Zero it before the
+ *	first call (or restore a saved one) to start at the oldest entry.
+ * @param[out] info         - Log file information
+ * @return 0 on success, error code on failure
+ *
+ * The first call writes the log file header and all the entries in the
+ * log; every later call only writes the entries that have been added
+ * since, and adds their number to cursor->entries. The cursor is plain data and can be saved to resume tailing the
+ * log from another process. info->overflow is set if the log wrapped,
+ * in which case some entries were lost.
+ */
+int switchtec_log_tail(struct switchtec_dev *dev,
+		       enum switchtec_log_type type, int fd,
+		       FILE *log_def_file,
+		       struct switchtec_log_cursor *cursor,
+		       struct switchtec_log_file_info *info)
+{
+	if (info)
+		memset(info, 0, sizeof(*info));
+
+	switch (type) {
+	case SWITCHTEC_LOG_RAM:
+		return log_ram_flash_to_file(dev,
+					     MRPC_FWLOGRD_RAM_GEN5,
+					     MRPC_FWLOGRD_RAM_WITH_FLAG,
+					     MRPC_FWLOGRD_RAM,
+					     fd, log_def_file, info, cursor);
+	case SWITCHTEC_LOG_FLASH:
+		return log_ram_flash_to_file(dev,
+					     MRPC_FWLOGRD_FLASH_GEN5,
+					     MRPC_FWLOGRD_FLASH_WITH_FLAG,
+					     MRPC_FWLOGRD_FLASH,
+					     fd, log_def_file, info, cursor);
+	default:
+		break;
+	}
+
+	errno = EINVAL;
+	return -errno;
+}
+
 static int parse_log_header(FILE *bin_log_file, uint32_t *fw_version,
 			    uint32_t *sdk_version)
 {
@@ -1530,33 +2464,296 @@ static int parse_log_header(FILE *bin_log_file, uint32_t *fw_version,
 	return 0;
 }
 
+/* Number of log entries formatted by each job of a parallel parse */
+#define LOG_PARSE_CHUNK_ENTRIES (32 * 1024)
+
+struct log_parse_chunk {
+	size_t start;
+	size_t count;
+	struct log_buf out;
+	int done;
+	int ret;
+};
+
+/*
+ * State shared by the workers of a parallel parse. Workers take the
+ * next chunk in order, and never run more than 'window' chunks ahead of
+ * the one the caller is writing out, which bounds the memory used by
+ * the formatted output.
+ */
+struct log_parse_job {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	const struct log_a_data *data;
+	struct log_defs *defs;
+	enum switchtec_log_parse_type log_type;
+	int ts_factor;
+	struct log_parse_chunk *chunks;
+	size_t nr_chunks;
+	size_t next;
+	size_t written;
+	size_t window;
+	int stop;
+};
+
+static int log_parse_chunk(struct log_parse_job *job,
+			   struct log_parse_chunk *c)
+{
+	if (c->start == 0 && c->count &&
+	    write_parsed_log_header(job->log_type, &c->out))
+		return -1;
+
+	return write_parsed_log(&job->data[c->start], c->count, c->start,
+				job->defs, job->log_type, &c->out,
+				job->ts_factor);
+}
+
+static void *log_parse_worker(void *arg)
+{
+	struct log_parse_job *job = arg;
+	struct log_parse_chunk *c;
+	int ret;
+
+	while (1) {
+		pthread_mutex_lock(&job->lock);
+		while (!job->stop && job->next < job->nr_chunks &&
+		       job->next >= job->written + job->window)
+			pthread_cond_wait(&job->cond, &job->lock);
+		if (job->stop || job->next >= job->nr_chunks) {
+			pthread_mutex_unlock(&job->lock);
+			break;
+		}
+		c = &job->chunks[job->next++];
+		pthread_mutex_unlock(&job->lock);
+
+		ret = log_parse_chunk(job, c);
+
+		pthread_mutex_lock(&job->lock);
+		c->ret = ret ? errno : 0;
+		c->done = 1;
+		pthread_cond_broadcast(&job->cond);
+		pthread_mutex_unlock(&job->lock);
+	}
+
+	return NULL;
+}
+
+/*
+ * Get the log entries following the header in a binary log file. The
+ * file is mapped when possible; otherwise (pipes, Windows) the rest of
+ * it is read into memory. *map_len is set to the length to munmap(), or
+ * zero if the buffer must be freed instead.
+ */
+static void *map_bin_log(FILE *bin_log_file, size_t *entries_len,
+			 size_t *offset, size_t *map_len)
+{
+	size_t alloc = 0, len = 0;
+	long pos;
+	char *buf = NULL, *tmp;
+	size_t ret;
+
+	*map_len = 0;
+	*offset = 0;
+
+	pos = ftell(bin_log_file);
+	if (pos < 0)
+		pos = 0;
+
+#ifndef _WIN32
+	{
+		struct stat st;
+		void *map;
+
+		if (!fstat(fileno(bin_log_file), &st) &&
+		    S_ISREG(st.st_mode) && st.st_size > pos) {
+			map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE,
+				   fileno(bin_log_file), 0);
+			if (map != MAP_FAILED) {
+				*map_len = st.st_size;
+				*offset = pos;
+				*entries_len = st.st_size - pos;
+				return map;
+			}
+		}
+	}
+#endif
+
+	do {
+		if (len == alloc) {
+			alloc = alloc ? alloc * 2 : 1 << 20;
+			tmp = realloc(buf, alloc);
+			if (!tmp) {
+				free(buf);
+				return NULL;
+			}
+			buf = tmp;
+		}
+
+		ret = fread(buf + len, 1, alloc - len, bin_log_file);
+		len += ret;
+	} while (ret);
+
+	if (ferror(bin_log_file)) {
+		free(buf);
+		errno = SWITCHTEC_ERR_BIN_LOG_READ_ERROR;
+		return NULL;
+	}
+
+	*entries_len = len;
+	return buf;
+}
+
+static void unmap_bin_log(void *buf, size_t map_len)
+{
+#ifndef _WIN32
+	if (map_len) {
+		munmap(buf, map_len);
+		return;
+	}
+#endif
+	free(buf);
+}
+
+static int parse_log_entries(const struct log_a_data *data, size_t count,
+			     struct log_defs *defs,
+			     enum switchtec_log_parse_type log_type,
+			     int ts_factor, int jobs, FILE *parsed_log_file)
+{
+	struct log_parse_job job = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.data = data,
+		.defs = defs,
+		.log_type = log_type,
+		.ts_factor = ts_factor,
+	};
+	struct log_parse_chunk *c;
+	pthread_t *workers = NULL;
+	int nr_workers = 0;
+	int ret = 0, err = 0;
+	size_t i;
+
+	job.nr_chunks = (count + LOG_PARSE_CHUNK_ENTRIES - 1) /
+		LOG_PARSE_CHUNK_ENTRIES;
+	if (!job.nr_chunks)
+		job.nr_chunks = 1;
+
+	job.chunks = calloc(job.nr_chunks, sizeof(*job.chunks));
+	if (!job.chunks)
+		return -1;
+
+	for (i = 0; i < job.nr_chunks; i++) {
+		job.chunks[i].start = i * LOG_PARSE_CHUNK_ENTRIES;
+		job.chunks[i].count = count - job.chunks[i].start;
+		if (job.chunks[i].count > LOG_PARSE_CHUNK_ENTRIES)
+			job.chunks[i].count = LOG_PARSE_CHUNK_ENTRIES;
+	}
+
+	if (jobs > 1 && job.nr_chunks > 1) {
+		if (jobs > job.nr_chunks)
+			jobs = job.nr_chunks;
+		job.window = jobs * 2;
+
+		workers = calloc(jobs, sizeof(*workers));
+		if (!workers) {
+			ret = -1;
+			goto out_free;
+		}
+
+		for (nr_workers = 0; nr_workers < jobs; nr_workers++) {
+			if (pthread_create(&workers[nr_workers], NULL,
+					   log_parse_worker, &job))
+				break;
+		}
+	}
+
+	for (i = 0; i < job.nr_chunks; i++) {
+		c = &job.chunks[i];
+
+		if (nr_workers) {
+			pthread_mutex_lock(&job.lock);
+			while (!c->done)
+				pthread_cond_wait(&job.cond, &job.lock);
+			pthread_mutex_unlock(&job.lock);
+		} else {
+			c->ret = log_parse_chunk(&job, c) ? errno : 0;
+		}
+
+		if (c->ret) {
+			err = c->ret;
+			break;
+		}
+
+		if (fwrite(c->out.buf, 1, c->out.len, parsed_log_file) !=
+		    c->out.len) {
+			err = SWITCHTEC_ERR_PARSED_LOG_WRITE_ERROR;
+			break;
+		}
+
+		log_buf_free(&c->out);
+
+		pthread_mutex_lock(&job.lock);
+		job.written++;
+		pthread_cond_broadcast(&job.cond);
+		pthread_mutex_unlock(&job.lock);
+	}
+
+	pthread_mutex_lock(&job.lock);
+	job.stop = 1;
+	pthread_cond_broadcast(&job.cond);
+	pthread_mutex_unlock(&job.lock);
+
+	while (nr_workers--)
+		pthread_join(workers[nr_workers], NULL);
+
+	if (err) {
+		errno = err;
+		ret = -1;
+	}
+
+out_free:
+	for (i = 0; i < job.nr_chunks; i++)
+		log_buf_free(&job.chunks[i].out);
+	free(job.chunks);
+	free(workers);
+	return ret;
+}
+
 /**
- * @brief Parse a binary app log or mailbox log to a text file
+ * @brief Parse a binary app log or mailbox log to a text file, using
+ *	several threads
  * @param[in] bin_log_file    - Binary log input file
  * @param[in] log_def_file    - Log definition file
  * @param[in] parsed_log_file - Parsed output file
  * @param[in] log_type        - log type
  * @param[in] gen             - device generation
+ * @param[in] jobs            - number of threads to format the log with
  * @param[out] info           - log file information
  * @return 0 on success, error code on failure
+ *
+ * The binary log is memory-mapped (or read into memory when it can't
+ * be) and split into fixed-size ranges of entries. Each range is
+ * formatted into its own buffer by one of the threads and the buffers
+ * are written to parsed_log_file in order, so the output is the same as
+ * that of switchtec_parse_log().
  */
-int switchtec_parse_log(FILE *bin_log_file, FILE *log_def_file,
-			FILE *parsed_log_file,
-			enum switchtec_log_parse_type log_type,
-			enum switchtec_gen gen,
-			struct switchtec_log_file_info *info)
+int switchtec_parse_log_mt(FILE *bin_log_file, FILE *log_def_file,
+			   FILE *parsed_log_file,
+			   enum switchtec_log_parse_type log_type,
+			   enum switchtec_gen gen, int jobs,
+			   struct switchtec_log_file_info *info)
 {
 	int ret;
-	struct log_a_data log_data;
 	struct log_defs defs = {
 		.module_defs = NULL,
 		.num_alloc = 0};
-	int entry_idx = 0;
 	uint32_t fw_version_log;
 	uint32_t sdk_version_log;
 	uint32_t fw_version_def;
 	uint32_t sdk_version_def;
 	enum switchtec_gen gen_file;
+	size_t entries_len, offset, map_len, count;
+	char *map;
 
 	if (info)
 		memset(info, 0, sizeof(*info));
@@ -1589,10 +2786,8 @@ int switchtec_parse_log(FILE *bin_log_file, FILE *log_def_file,
 		info->log_sdk_version = sdk_version_log;
 	}
 	/* read the log definition file into defs */
-	if (log_type == SWITCHTEC_LOG_PARSE_TYPE_APP)
-		ret = read_app_log_defs(log_def_file, &defs);
-	else
-		ret = read_mailbox_log_defs(log_def_file, &defs);
+	ret = load_log_defs(log_def_file, log_type, fw_version_def,
+			    sdk_version_def, &defs);
 
 	if (ret < 0)
 		return ret;
@@ -1600,40 +2795,46 @@ int switchtec_parse_log(FILE *bin_log_file, FILE *log_def_file,
 	ret = append_log_header(fileno(parsed_log_file), sdk_version_log,
 				fw_version_log, 0);
 	if (ret < 0)
-		return ret;
+		goto ret_free_log_defs;
 
-	/* parse each log entry */
-	while (fread(&log_data, sizeof(struct log_a_data), 1,
-		     bin_log_file) == 1) {
-		if(fw_version_log)
-			gen_file = switchtec_fw_version_to_gen(fw_version_log);
-		else
-			gen_file = switchtec_fw_version_to_gen(fw_version_def);
-
-		if (gen_file != SWITCHTEC_GEN_UNKNOWN &&
-		    gen != SWITCHTEC_GEN_UNKNOWN) {
-			if (info)
-				info->gen_ignored = true;
-		} else if (gen_file == SWITCHTEC_GEN_UNKNOWN &&
-			   gen == SWITCHTEC_GEN_UNKNOWN) {
-			if (info)
-				info->gen_unknown = true;
-		} else if (gen != SWITCHTEC_GEN_UNKNOWN) {
-			gen_file = gen;
-		}
+	map = map_bin_log(bin_log_file, &entries_len, &offset, &map_len);
+	if (!map) {
+		ret = -1;
+		goto ret_free_log_defs;
+	}
 
-		ret = write_parsed_log(&log_data, 1, entry_idx, &defs,
-				       log_type, parsed_log_file,
-				       get_ts_factor(gen_file));
-		if (ret < 0)
-			goto ret_free_log_defs;
+	count = entries_len / sizeof(struct log_a_data);
 
-		entry_idx++;
+	if(fw_version_log)
+		gen_file = switchtec_fw_version_to_gen(fw_version_log);
+	else
+		gen_file = switchtec_fw_version_to_gen(fw_version_def);
+
+	if (count && gen_file != SWITCHTEC_GEN_UNKNOWN &&
+	    gen != SWITCHTEC_GEN_UNKNOWN) {
+		if (info)
+			info->gen_ignored = true;
+	} else if (count && gen_file == SWITCHTEC_GEN_UNKNOWN &&
+		   gen == SWITCHTEC_GEN_UNKNOWN) {
+		if (info)
+			info->gen_unknown = true;
+	} else if (gen != SWITCHTEC_GEN_UNKNOWN) {
+		gen_file = gen;
 	}
 
-	if (ferror(bin_log_file)) {
-		errno = SWITCHTEC_ERR_BIN_LOG_READ_ERROR;
+	/* parse all the log entries */
+	ret = parse_log_entries((const struct log_a_data *)(map + offset),
+				count, &defs, log_type,
+				get_ts_factor(gen_file), jobs,
+				parsed_log_file);
+	unmap_bin_log(map, map_len);
+	if (ret < 0)
+		goto ret_free_log_defs;
+
+	if (fflush(parsed_log_file)) {
+		errno = SWITCHTEC_ERR_PARSED_LOG_WRITE_ERROR;
 		ret = -1;
+		goto ret_free_log_defs;
 	}
 
 	if (fw_version_def != fw_version_log ||
@@ -1648,6 +2849,27 @@ ret_free_log_defs:
 	return ret;
 }
 
+/**
+ * @brief Parse a binary app log or mailbox log to a text file
+ * @param[in] bin_log_file    - Binary log input file
+ * @param[in] log_def_file    - Log definition file
+ * @param[in] parsed_log_file - Parsed output file
+ * @param[in] log_type        - log type
+ * @param[in] gen             - device generation
+ * @param[out] info           - log file information
+ * @return 0 on success, error code on failure
+ */
+int switchtec_parse_log(FILE *bin_log_file, FILE *log_def_file,
+			FILE *parsed_log_file,
+			enum switchtec_log_parse_type log_type,
+			enum switchtec_gen gen,
+			struct switchtec_log_file_info *info)
+{
+	return switchtec_parse_log_mt(bin_log_file, log_def_file,
+				      parsed_log_file, log_type, gen, 1,
+				      info);
+}
+
 /**
  * @brief Dump the Switchtec log definition data to a file
  * @param[in]  dev          - Switchtec device handle
@@ -1926,6 +3148,330 @@ int switchtec_unbind(struct switchtec_dev *dev, int par_id, int log_port)
 			    sizeof(sub_cmd_id), &output, sizeof(output));
 }
 
+#define BIND_POLL_US 10000
+
+struct bind_wait {
+	int entry;
+	int phys_port_id;
+	int bound;		//!< State to wait for
+	int par_id;
+	int log_port_id;
+	int done;
+};
+
+static int bind_status_find(const struct switchtec_bind_status_out *st,
+			    int phys_port_id)
+{
+	int i;
+
+	for (i = 0; i < st->inf_cnt && i < SWITCHTEC_MAX_PHY_PORTS; i++)
+		if (st->port_info[i].phys_port_id == phys_port_id)
+			return i;
+
+	return -1;
+}
+
+static void bind_fail(struct switchtec_bind_map_entry *e, int ret)
+{
+	if (!e->ret)
+		e->ret = ret;
+}
+
+/*
+ * Poll the binding state of all ports at once until every port in the
+ * wait list reached its state, failed, or the deadline passed.
+ */
+static int bind_wait_all(struct switchtec_dev *dev, struct bind_wait *w,
+			 int nr, struct switchtec_bind_map_entry *map,
+			 uint64_t deadline)
+{
+	struct switchtec_bind_status_out st;
+	int i, idx, pending, result, state;
+	int ret;
+
+	do {
+		ret = switchtec_bind_info(dev, &st, 0xff);
+		if (ret)
+			return -1;
+
+		pending = 0;
+		for (i = 0; i < nr; i++) {
+			if (w[i].done)
+				continue;
+
+			idx = bind_status_find(&st, w[i].phys_port_id);
+			if (idx < 0) {
+				bind_fail(&map[w[i].entry], -ENODEV);
+				w[i].done = 1;
+				continue;
+			}
+
+			result = st.port_info[idx].bind_state & 0x0F;
+			state = st.port_info[idx].bind_state >> 4;
+
+			if (result == BIND_INFO_FAIL) {
+				bind_fail(&map[w[i].entry], -EIO);
+				w[i].done = 1;
+			} else if (result == BIND_INFO_SUCCESS &&
+				   !!state == w[i].bound &&
+				   (!state ||
+				    (st.port_info[idx].par_id == w[i].par_id &&
+				     st.port_info[idx].log_port_id ==
+					w[i].log_port_id))) {
+				w[i].done = 1;
+			} else {
+				pending++;
+			}
+		}
+
+		if (!pending)
+			return 0;
+
+		usleep(BIND_POLL_US);
+	} while (platform_time_us() < deadline);
+
+	for (i = 0; i < nr; i++)
+		if (!w[i].done)
+			bind_fail(&map[w[i].entry], -ETIMEDOUT);
+
+	return 0;
+}
+
+/*
+ * Issue the commands of one phase in a batch, then wait for the ports
+ * they touched. Entries whose command was rejected are marked failed.
+ */
+static int bind_run_phase(struct switchtec_dev *dev,
+			  struct switchtec_cmd_desc *desc, struct bind_wait *w,
+			  int nr, struct switchtec_bind_map_entry *map,
+			  uint64_t deadline)
+{
+	int i, ret;
+
+	if (!nr)
+		return 0;
+
+	ret = switchtec_cmd_batch(dev, desc, nr);
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < nr; i++) {
+		if (desc[i].ret) {
+			bind_fail(&map[w[i].entry], desc[i].ret);
+			w[i].done = 1;
+		}
+	}
+
+	return bind_wait_all(dev, w, nr, map, deadline);
+}
+
+/**
+ * @brief Move the port bindings of a switch to a desired map
+ * @param[in]     dev		Switchtec device handle
+ * @param[in,out] map		Desired binding of each physical port
+ * @param[in]     nr		Number of entries in \p map
+ * @param[in]     timeout_ms	Time to wait for the whole set of changes
+ * @return The number of entries that failed, or -1 on error (with
+ *	errno set); the reason of each failure is in its ret field
+ *
+ * The current binding of every port is read in one command and
+ * compared with \p map to find the smallest set of changes: ports that
+ * already have their binding are left alone, ports moving elsewhere
+ * are unbound first, and so is any port not in the map that holds a
+ * logical port the map gives to another physical port. Ports not in
+ * the map are otherwise untouched.
+ *
+ * The firmware binds one port per command, so all the unbinds are
+ * issued as one command batch and waited for together, then the same
+ * is done for the binds. Waiting reads the state of all ports in a
+ * single command per poll.
+ *
+ * The ret field of an entry is 0 on success, the MRPC error of a
+ * rejected command, -EIO if the firmware reported the change failed,
+ * -ETIMEDOUT if it did not finish in time, or -EINVAL/-ENODEV for a
+ * bad entry. An entry is not bound if its unbind failed.
+ */
+int switchtec_bind_apply(struct switchtec_dev *dev,
+			 struct switchtec_bind_map_entry *map, int nr,
+			 unsigned int timeout_ms)
+{
+	struct switchtec_bind_status_out st;
+	struct switchtec_cmd_desc *desc = NULL;
+	struct switchtec_unbind_in *unb = NULL;
+	struct switchtec_bind_in *bnd = NULL;
+	struct bind_wait *w = NULL;
+	uint32_t *out = NULL;
+	int i, j, k, idx, bound, n = 0;
+	uint64_t deadline;
+	int ret;
+
+	if (!map || nr < 1) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	ret = switchtec_bind_info(dev, &st, 0xff);
+	if (ret)
+		return -1;
+
+	/* Every entry needs at most its own unbind, one of a holder and a bind */
+	desc = calloc(3 * nr, sizeof(*desc));
+	unb = calloc(2 * nr, sizeof(*unb));
+	bnd = calloc(nr, sizeof(*bnd));
+	w = calloc(3 * nr, sizeof(*w));
+	out = calloc(3 * nr, sizeof(*out));
+	if (!desc || !unb || !bnd || !w || !out) {
+		ret = -1;
+		goto out;
+	}
+
+	for (i = 0; i < nr; i++) {
+		map[i].op = SWITCHTEC_BIND_OP_NONE;
+		map[i].ret = 0;
+	}
+
+	for (i = 0; i < nr; i++) {
+		for (j = 0; j < i; j++) {
+			if (map[j].phys_port_id == map[i].phys_port_id ||
+			    (map[i].par_id >= 0 &&
+			     map[j].par_id == map[i].par_id &&
+			     map[j].log_port_id == map[i].log_port_id)) {
+				bind_fail(&map[i], -EINVAL);
+				bind_fail(&map[j], -EINVAL);
+			}
+		}
+
+		idx = bind_status_find(&st, map[i].phys_port_id);
+		if (idx < 0)
+			bind_fail(&map[i], -ENODEV);
+		else if ((st.port_info[idx].bind_state & 0x0F) ==
+			 BIND_INFO_IN_PROGRESS)
+			bind_fail(&map[i], -EBUSY);
+	}
+
+	/* Unbinds: ports moving and ports holding a wanted logical port */
+	for (i = 0; i < nr; i++) {
+		if (map[i].ret)
+			continue;
+
+		idx = bind_status_find(&st, map[i].phys_port_id);
+		bound = st.port_info[idx].bind_state >> 4;
+
+		if (bound && map[i].par_id == st.port_info[idx].par_id &&
+		    map[i].log_port_id == st.port_info[idx].log_port_id)
+			continue;
+
+		if (bound) {
+			map[i].op = map[i].par_id < 0 ?
+				SWITCHTEC_BIND_OP_UNBIND :
+				SWITCHTEC_BIND_OP_REBIND;
+			unb[n] = (struct switchtec_unbind_in) {
+				.sub_cmd = MRPC_PORT_UNBIND,
+				.par_id = st.port_info[idx].par_id,
+				.log_port_id = st.port_info[idx].log_port_id,
+				.opt = 2,
+			};
+			w[n] = (struct bind_wait) {
+				.entry = i,
+				.phys_port_id = map[i].phys_port_id,
+			};
+			n++;
+		} else if (map[i].par_id >= 0) {
+			map[i].op = SWITCHTEC_BIND_OP_BIND;
+		}
+
+		if (map[i].par_id < 0)
+			continue;
+
+		for (k = 0; k < st.inf_cnt && k < SWITCHTEC_MAX_PHY_PORTS; k++) {
+			if (!(st.port_info[k].bind_state >> 4) ||
+			    st.port_info[k].phys_port_id == map[i].phys_port_id ||
+			    st.port_info[k].par_id != map[i].par_id ||
+			    st.port_info[k].log_port_id != map[i].log_port_id)
+				continue;
+
+			for (j = 0; j < nr; j++)
+				if (map[j].phys_port_id ==
+				    st.port_info[k].phys_port_id)
+					break;
+			if (j < nr)
+				continue;
+
+			unb[n] = (struct switchtec_unbind_in) {
+				.sub_cmd = MRPC_PORT_UNBIND,
+				.par_id = map[i].par_id,
+				.log_port_id = map[i].log_port_id,
+				.opt = 2,
+			};
+			w[n] = (struct bind_wait) {
+				.entry = i,
+				.phys_port_id = st.port_info[k].phys_port_id,
+			};
+			n++;
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		desc[i] = (struct switchtec_cmd_desc) {
+			.cmd = MRPC_PORTPARTP2P,
+			.payload = &unb[i],
+			.payload_len = sizeof(unb[i]),
+			.resp = &out[i],
+			.resp_len = sizeof(out[i]),
+		};
+
+	deadline = platform_time_us() + timeout_ms * 1000ULL;
+
+	ret = bind_run_phase(dev, desc, w, n, map, deadline);
+	if (ret)
+		goto out;
+
+	n = 0;
+	for (i = 0; i < nr; i++) {
+		if (map[i].ret || map[i].par_id < 0 ||
+		    map[i].op == SWITCHTEC_BIND_OP_NONE)
+			continue;
+
+		bnd[n] = (struct switchtec_bind_in) {
+			.sub_cmd = MRPC_PORT_BIND,
+			.par_id = map[i].par_id,
+			.log_port_id = map[i].log_port_id,
+			.phys_port_id = map[i].phys_port_id,
+		};
+		desc[n] = (struct switchtec_cmd_desc) {
+			.cmd = MRPC_PORTPARTP2P,
+			.payload = &bnd[n],
+			.payload_len = sizeof(bnd[n]),
+			.resp = &out[n],
+			.resp_len = sizeof(out[n]),
+		};
+		w[n] = (struct bind_wait) {
+			.entry = i,
+			.phys_port_id = map[i].phys_port_id,
+			.bound = 1,
+			.par_id = map[i].par_id,
+			.log_port_id = map[i].log_port_id,
+		};
+		n++;
+	}
+
+	ret = bind_run_phase(dev, desc, w, n, map, deadline);
+	if (ret)
+		goto out;
+
+	for (i = 0; i < nr; i++)
+		if (map[i].ret)
+			ret++;
+
+out:
+	free(desc);
+	free(unb);
+	free(bnd);
+	free(w);
+	free(out);
+	return ret;
+}
+
 static int __switchtec_calc_lane_id(struct switchtec_status *port, int lane_id)
 {
 	int lane;
@@ -2017,7 +3563,7 @@ int switchtec_calc_port_lane(struct switchtec_dev *dev, int lane_id,
 		return ports;
 
 	if (lane_id >= 96) {
-		if (dev->gen < SWITCHTEC_GEN5)
+		if (switchtec_gen(dev) < SWITCHTEC_GEN5)
 			p = lane_id - 96 + 48;
 		else
 			p = lane_id - 96 + 56;
@@ -2046,7 +3592,7 @@ int switchtec_calc_port_lane(struct switchtec_dev *dev, int lane_id,
 		*phys_port_id = status[i].port.phys_id;
 
 	lane = lane_id - status[i].port.phys_id * 2;
-	if (port->lane_reversal)
+	if (status[i].lane_reversal)
 		lane = status[i].cfg_lnk_width - 1 - lane;
 
 	if (port_lane_id)
@@ -2108,6 +3654,257 @@ out:
 	return rc;
 }
 
+/*
+ * Lanes 96 and up belong to the x1 ports that __switchtec_calc_lane_id()
+ * maps specially.
+ */
+static int topo_first_lane(int phys_id)
+{
+	if (phys_id >= 48 && phys_id <= 51)
+		return 96 + phys_id - 48;
+	if (phys_id >= 56 && phys_id <= 59)
+		return 96 + phys_id - 56;
+
+	return phys_id * 2;
+}
+
+static int topo_build(struct switchtec_dev *dev, struct switchtec_topo *topo)
+{
+	struct switchtec_port_snapshot status[SWITCHTEC_MAX_PORTS];
+	struct switchtec_topo_port *p;
+	int ports, i, l, first, last;
+
+	ports = switchtec_status_snapshot(dev, status, ARRAY_SIZE(status));
+	if (ports < 0)
+		return ports;
+
+	memset(topo, 0, sizeof(*topo));
+	memset(topo->phys_port, -1, sizeof(topo->phys_port));
+	memset(topo->lane_port, -1, sizeof(topo->lane_port));
+	memset(topo->stack_port, -1, sizeof(topo->stack_port));
+
+	for (i = 0; i < ports && i < SWITCHTEC_MAX_PORTS; i++) {
+		p = &topo->ports[i];
+		p->port = status[i].port;
+		p->cfg_lnk_width = status[i].cfg_lnk_width;
+		p->neg_lnk_width = status[i].neg_lnk_width;
+		p->link_up = status[i].link_up;
+		p->link_rate = status[i].link_rate;
+		p->lane_reversal = status[i].lane_reversal;
+		p->first_lane = topo_first_lane(p->port.phys_id);
+
+		if (p->port.phys_id < SWITCHTEC_MAX_PORTS)
+			topo->phys_port[p->port.phys_id] = i;
+
+		if (p->port.stack < SWITCHTEC_MAX_STACKS &&
+		    p->port.stk_id < SWITCHTEC_PORTS_PER_STACK)
+			topo->stack_port[p->port.stack][p->port.stk_id] = i;
+
+		first = p->first_lane;
+		if (first >= 96)
+			last = first + 1;
+		else
+			last = first + p->cfg_lnk_width;
+		if (last > SWITCHTEC_MAX_LANES)
+			last = SWITCHTEC_MAX_LANES;
+
+		for (l = first; l < last; l++)
+			if (topo->lane_port[l] < 0)
+				topo->lane_port[l] = i;
+	}
+
+	topo->num_ports = i;
+
+	return 0;
+}
+
+/**
+ * @brief Get the cached port/lane topology of a device
+ * @param[in] dev	Switchtec device handle
+ * @return The topology, or NULL on error (with errno set appropriately)
+ *
+ * The topology is read once (with a single LNKSTAT command) and
+ * kept in the handle so lanes can be resolved without any further
+ * device traffic. It is invalidated when the stack bifurcation is set,
+ * when the PAX ID of the handle changes and when
+ * switchtec_event_summary_since() reports a link state change or a
+ * reset; the next call rebuilds it. The returned pointer stays valid
+ * until the handle is closed, but its contents change when the
+ * topology is rebuilt.
+ */
+const struct switchtec_topo *switchtec_topo(struct switchtec_dev *dev)
+{
+	const struct switchtec_topo *topo = NULL;
+
+	platform_lock(dev);
+
+	if (dev->topo_valid || !switchtec_topo_refresh(dev))
+		topo = dev->topo;
+
+	platform_unlock(dev);
+
+	return topo;
+}
+
+/**
+ * @brief Re-read the port/lane topology of a device
+ * @param[in] dev	Switchtec device handle
+ * @return 0 on success, or a negative value on failure
+ */
+int switchtec_topo_refresh(struct switchtec_dev *dev)
+{
+	int ret;
+
+	platform_lock(dev);
+
+	if (!dev->topo) {
+		dev->topo = calloc(1, sizeof(*dev->topo));
+		if (!dev->topo) {
+			platform_unlock(dev);
+			return -1;
+		}
+	}
+
+	ret = topo_build(dev, dev->topo);
+	dev->topo_valid = !ret;
+
+	platform_unlock(dev);
+
+	return ret;
+}
+
+/**
+ * @brief Mark the cached port/lane topology as stale
+ * @param[in] dev	Switchtec device handle
+ *
+ * The next call to switchtec_topo() rebuilds it.
+ */
+void switchtec_topo_invalidate(struct switchtec_dev *dev)
+{
+	platform_lock(dev);
+	dev->topo_valid = false;
+	platform_unlock(dev);
+}
+
+/**
+ * @brief Find a port in a topology
+ * @param[in] topo		Topology from switchtec_topo()
+ * @param[in] phys_port_id	Physical port id
+ * @return The port, or NULL if there is no such port (with errno set)
+ */
+const struct switchtec_topo_port *
+switchtec_topo_find_port(const struct switchtec_topo *topo, int phys_port_id)
+{
+	if (phys_port_id < 0 || phys_port_id >= SWITCHTEC_MAX_PORTS ||
+	    topo->phys_port[phys_port_id] < 0) {
+		errno = SWITCHTEC_ERR_INVALID_PORT;
+		return NULL;
+	}
+
+	return &topo->ports[(int)topo->phys_port[phys_port_id]];
+}
+
+/**
+ * @brief Calculate the global lane ID for a lane within a physical port
+ * @param[in] topo		Topology from switchtec_topo()
+ * @param[in] phys_port_id	Physical port id
+ * @param[in] lane_id		Lane number within the port
+ * @return The lane id or -1 on error (with errno set appropriately)
+ *
+ * This is switchtec_calc_lane_id() without any device access.
+ */
+int switchtec_topo_lane_id(const struct switchtec_topo *topo,
+			   int phys_port_id, int lane_id)
+{
+	const struct switchtec_topo_port *p;
+
+	p = switchtec_topo_find_port(topo, phys_port_id);
+	if (!p)
+		return -1;
+
+	if (lane_id < 0 || lane_id >= p->neg_lnk_width) {
+		errno = SWITCHTEC_ERR_INVALID_LANE;
+		return -1;
+	}
+
+	if (p->first_lane >= 96)
+		return p->first_lane;
+
+	if (p->lane_reversal)
+		return p->first_lane + p->cfg_lnk_width - 1 - lane_id;
+
+	return p->first_lane + lane_id;
+}
+
+/**
+ * @brief Calculate the port and lane within the port from a global lane ID
+ * @param[in]  topo		Topology from switchtec_topo()
+ * @param[in]  lane_id		Global Lane Number
+ * @param[out] phys_port_id	Physical port id (may be NULL)
+ * @param[out] port_lane_id	Lane number within the port (may be NULL)
+ * @return 0 on success or -1 on error (with errno set appropriately)
+ *
+ * This is switchtec_calc_port_lane() without any device access.
+ */
+int switchtec_topo_port_lane(const struct switchtec_topo *topo, int lane_id,
+			     int *phys_port_id, int *port_lane_id)
+{
+	const struct switchtec_topo_port *p;
+	int lane;
+
+	if (lane_id < 0 || lane_id >= SWITCHTEC_MAX_LANES ||
+	    topo->lane_port[lane_id] < 0) {
+		errno = SWITCHTEC_ERR_INVALID_PORT;
+		return -1;
+	}
+
+	p = &topo->ports[(int)topo->lane_port[lane_id]];
+
+	if (p->first_lane >= 96) {
+		lane = 0;
+	} else {
+		lane = lane_id - p->first_lane;
+		if (p->lane_reversal)
+			lane = p->cfg_lnk_width - 1 - lane;
+	}
+
+	if (phys_port_id)
+		*phys_port_id = p->port.phys_id;
+	if (port_lane_id)
+		*port_lane_id = lane;
+
+	return 0;
+}
+
+/**
+ * @brief Calculate the lane mask for lanes within a physical port
+ * @param[in]  topo		Topology from switchtec_topo()
+ * @param[in]  phys_port_id	Physical port id
+ * @param[in]  lane_id		Lane number within the port
+ * @param[in]  num_lanes	Number of consecutive lanes to set
+ * @param[out] lane_mask	Pointer to array of 4 integers to set the
+ *				bits of the lanes to
+ * @return 0 or -1 on error (with errno set appropriately)
+ *
+ * This is switchtec_calc_lane_mask() without any device access.
+ */
+int switchtec_topo_lane_mask(const struct switchtec_topo *topo,
+			     int phys_port_id, int lane_id, int num_lanes,
+			     int *lane_mask)
+{
+	int l, lane;
+
+	for (l = lane_id; l < lane_id + num_lanes; l++) {
+		lane = switchtec_topo_lane_id(topo, phys_port_id, l);
+		if (lane < 0)
+			return -1;
+
+		lane_mask[lane >> 5] |= 1 << (lane & 0x1F);
+	}
+
+	return 0;
+}
+
 /**
  * @brief Return true if a port within a stack is valid
  * @param[in] dev	Switchtec device handle
@@ -2118,7 +3915,7 @@ out:
 bool switchtec_stack_bif_port_valid(struct switchtec_dev *dev, int stack_id,
 				    int port_id)
 {
-	if (dev->gen == SWITCHTEC_GEN4)
+	if (switchtec_gen(dev) == SWITCHTEC_GEN4)
 		return stack_id * 8 + port_id < 52;
 
 	return true;
@@ -2143,7 +3940,7 @@ int switchtec_stack_bif_width(struct switchtec_dev *dev, int stack_id,
 		return -1;
 	}
 
-	if (dev->gen == SWITCHTEC_GEN4 && stack_id == 6)
+	if (switchtec_gen(dev) == SWITCHTEC_GEN4 && stack_id == 6)
 		return port_bif;
 	else
 		return  (port_bif + 1) / 2;
@@ -2207,7 +4004,7 @@ int switchtec_set_stack_bif(struct switchtec_dev *dev, int stack_id,
 		.sub_cmd = MRPC_STACKBIF_SET,
 		.stack_id = stack_id,
 	};
-	int i;
+	int i, ret;
 
 	for (i = 0; i < SWITCHTEC_PORTS_PER_STACK; i++) {
 		switch (port_bif[i]) {
@@ -2223,8 +4020,12 @@ int switchtec_set_stack_bif(struct switchtec_dev *dev, int stack_id,
 		}
 	}
 
-	return switchtec_cmd(dev, MRPC_STACKBIF, &in, sizeof(in), &out,
+	ret = switchtec_cmd(dev, MRPC_STACKBIF, &in, sizeof(in), &out,
 			    sizeof(out));
+	if (!ret)
+		switchtec_topo_invalidate(dev);
+
+	return ret;
 }
 
 
@@ -31,6 +31,9 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <limits.h>
+#include <sys/time.h>
+#include <time.h>
+#include <pthread.h>
 
 struct switchtec_dev;
 
@@ -84,6 +87,12 @@ enum switchtec_fw_image_part_id_gen5 {
 
 enum switchtec_ops_flags {
 	SWITCHTEC_OPS_FLAG_NO_MFG = (1 << 0),
+	/*
+	 * MRPCs from separate handles on the same device are serialized
+	 * by the other side (a kernel driver or switchtecd), so several
+	 * handles may issue commands concurrently.
+	 */
+	SWITCHTEC_OPS_FLAG_CMD_SHARED = (1 << 1),
 };
 
 struct switchtec_ops {
@@ -96,6 +105,16 @@ struct switchtec_ops {
 	int (*cmd)(struct switchtec_dev *dev,  uint32_t cmd,
 		   const void *payload, size_t payload_len, void *resp,
 		   size_t resp_len);
+	int (*cmd_batch)(struct switchtec_dev *dev,
+			 struct switchtec_cmd_desc *cmds, int n);
+	int (*cmd_submit)(struct switchtec_dev *dev, uint32_t cmd,
+			  const void *payload, size_t payload_len,
+			  size_t resp_len);
+	int (*cmd_poll)(struct switchtec_dev *dev);
+	int (*cmd_poll_fd)(struct switchtec_dev *dev);
+	void *(*cmd_poll_handle)(struct switchtec_dev *dev);
+	int (*cmd_complete)(struct switchtec_dev *dev, void *resp,
+			    size_t resp_len);
 	int (*get_devices)(struct switchtec_dev *dev,
 			   struct switchtec_status *status,
 			   int ports);
@@ -111,11 +130,22 @@ struct switchtec_ops {
 			  enum switchtec_fw_image_part_id_gen3 part);
 	int (*event_summary)(struct switchtec_dev *dev,
 			     struct switchtec_event_summary *sum);
+	int (*event_summary_sparse)(struct switchtec_dev *dev,
+				    struct switchtec_event_summary *sum);
 	int (*event_ctl)(struct switchtec_dev *dev,
 			 enum switchtec_event_id e,
 			 int index, int flags,
 			 uint32_t data[5]);
+	int (*event_block_ctl)(struct switchtec_dev *dev,
+			       enum switchtec_event_type type, int index,
+			       uint64_t clear,
+			       struct switchtec_event_block *blk);
 	int (*event_wait)(struct switchtec_dev *dev, int timeout_ms);
+	int (*event_wait_fd)(struct switchtec_dev *dev, short *events);
+	void *(*event_wait_arm)(struct switchtec_dev *dev);
+	void (*event_wait_disarm)(struct switchtec_dev *dev);
+	int (*event_wait_port)(struct switchtec_dev *dev, void *port,
+			       uintptr_t key);
 	int (*event_wait_for)(struct switchtec_dev *dev,
 			      enum switchtec_event_id e, int index,
 			      struct switchtec_event_summary *res,
@@ -149,6 +179,21 @@ int switchtec_flash_part(struct switchtec_dev *dev,
 			 struct switchtec_fw_image_info *info,
 			 enum switchtec_fw_image_part_id_gen3 part);
 
+/**
+ * @brief State of the command started with switchtec_cmd_submit()
+ */
+struct switchtec_async_cmd {
+	bool pending;
+	bool done;	//!< Already executed synchronously, \p ret is valid
+	uint32_t cmd;
+	void *resp;
+	size_t resp_len;
+	size_t payload_len;
+	uint64_t start_us;
+	int ret;
+	int err;	//!< errno to go with \p ret when \p done
+};
+
 struct switchtec_dev {
 	int device_id;
 	enum switchtec_gen gen;
@@ -159,12 +204,145 @@ struct switchtec_dev {
 	enum switchtec_boot_phase boot_phase;
 	char name[PATH_MAX];
 
+	/** @brief Identity fields above have been read from the device */
+	bool probed;
+	bool probing;
+
 	gasptr_t gas_map;
 	size_t gas_map_size;
 
+	struct switchtec_mrpc_poll_policy mrpc_poll;
+	int mrpc_poll_hint_us[MRPC_MAX_ID];
+	struct switchtec_async_cmd async_cmd;
+
+	struct switchtec_mrpc_stats *mrpc_stats;
+	uint64_t mrpc_wait_us;
+
+	switchtec_trace_fn trace_fn;
+	void *trace_arg;
+
+	struct gas_cache *gas_cache;
+	struct gasop_pff_map *pff_map;
+	struct switchtec_event_summary *event_last;
+	struct switchtec_topo *topo;
+	bool topo_valid;
+
+	/** @brief Serializes all access to the device through this handle */
+	pthread_mutex_t lock;
+
 	const struct switchtec_ops *ops;
 };
 
+void platform_dev_init(struct switchtec_dev *dev);
+void platform_dev_fini(struct switchtec_dev *dev);
+
+static inline uint32_t platform_cmd_id(struct switchtec_dev *dev,
+				       uint32_t cmd)
+{
+	cmd &= SWITCHTEC_CMD_MASK;
+	return cmd | dev->pax_id << SWITCHTEC_PAX_ID_SHIFT;
+}
+
+static inline void platform_lock(struct switchtec_dev *dev)
+{
+	pthread_mutex_lock(&dev->lock);
+}
+
+static inline void platform_unlock(struct switchtec_dev *dev)
+{
+	pthread_mutex_unlock(&dev->lock);
+}
+int platform_mrpc_poll_hint(struct switchtec_dev *dev, uint32_t cmd);
+
+void mrpc_stats_record(struct switchtec_dev *dev, uint32_t cmd,
+		       size_t payload_len, size_t resp_len,
+		       uint64_t elapsed_us, int ret);
+
+int gas_cache_read(struct switchtec_dev *dev, const void __gas *addr,
+		   size_t size, uint64_t *val);
+void gas_cache_write(struct switchtec_dev *dev, void __gas *addr,
+		     size_t size, uint64_t val);
+int gas_cache_memcpy_from(struct switchtec_dev *dev, void *dest,
+			  const void __gas *src, size_t n);
+void gas_cache_memcpy_to(struct switchtec_dev *dev, void __gas *dest,
+			 const void *src, size_t n);
+void gas_cache_cmd_done(struct switchtec_dev *dev, uint32_t cmd);
+
+/*
+ * Monotonic time, for intervals and deadlines: it doesn't jump when the
+ * system clock is stepped.
+ */
+static inline uint64_t platform_time_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+/* Wall clock time, for timestamps that are stored or shown to the user */
+static inline uint64_t platform_wall_time_us(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000000ULL + tv.tv_usec;
+}
+
+/*
+ * USDT probes, usable as usdt:libswitchtec:<name> from bpftrace or
+ * SystemTap. Every traced call fires <op>_start(dev, id, len) before
+ * and <op>_done(dev, id, ret) after the transport runs, where id is the
+ * command ID or GAS offset. Without a tracer attached a probe is a
+ * single nop. Build with -DSWITCHTEC_NO_SDT to leave them out.
+ */
+#if defined(__has_include) && !defined(SWITCHTEC_NO_SDT)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define SWITCHTEC_HAVE_SDT
+#endif
+#endif
+
+#ifdef SWITCHTEC_HAVE_SDT
+#define platform_probe(name, dev, id, val) \
+	STAP_PROBE3(libswitchtec, name, dev, id, val)
+#else
+#define platform_probe(name, dev, id, val) do { } while (0)
+#endif
+
+void platform_trace(struct switchtec_dev *dev, enum switchtec_trace_op op,
+		    uint32_t id, size_t len, int ret, uint64_t start_us);
+
+static inline uint64_t platform_trace_start(struct switchtec_dev *dev)
+{
+	return dev->trace_fn ? platform_time_us() : 0;
+}
+
+static inline uint32_t platform_gas_offset(struct switchtec_dev *dev,
+					   const void __gas *addr)
+{
+	return (uint32_t)(addr - (const void __gas *)dev->gas_map);
+}
+
+/* Run a GAS access through the transport with its probes and callback */
+#define platform_trace_gas(dev, op, probe, addr, len, call) do {	\
+	uint32_t __off = platform_gas_offset(dev, addr);		\
+	uint64_t __start = platform_trace_start(dev);			\
+									\
+	platform_probe(probe##_start, dev, __off, len);			\
+	call;								\
+	platform_probe(probe##_done, dev, __off, 0);			\
+	if (dev->trace_fn)						\
+		platform_trace(dev, op, __off, len, 0, __start);	\
+} while (0)
+
+#define platform_trace_gas_read(dev, addr, len, call) \
+	platform_trace_gas(dev, SWITCHTEC_TRACE_GAS_READ, gas_read, \
+			   addr, len, call)
+#define platform_trace_gas_write(dev, addr, len, call) \
+	platform_trace_gas(dev, SWITCHTEC_TRACE_GAS_WRITE, gas_write, \
+			   addr, len, call)
+
 extern const struct switchtec_mrpc switchtec_mrpc_table[MRPC_MAX_ID];
 
 static inline void version_to_string(uint32_t version, char *buf, size_t buflen)
@@ -178,77 +356,151 @@ static inline void version_to_string(uint32_t version, char *buf, size_t buflen)
 
 const char *platform_strerror();
 
+/*
+ * Library builds configured with --enable-single-transport=linux only
+ * contain the Linux kernel driver backend. GAS accesses then compile
+ * down to the MMIO loads and stores of mmap_gas.h, and commands go
+ * straight to the driver, instead of calling through dev->ops.
+ */
+#ifdef SWITCHTEC_SINGLE_TRANSPORT_LINUX
+#include "platform/mmap_gas.h"
+
+int linux_cmd(struct switchtec_dev *dev, uint32_t cmd,
+	      const void *payload, size_t payload_len, void *resp,
+	      size_t resp_len);
+
+#define platform_gas_op(dev, op) mmap_##op
+#define platform_cmd_op(dev) linux_cmd
+#else
+#define platform_gas_op(dev, op) ((dev)->ops->op)
+#define platform_cmd_op(dev) ((dev)->ops->cmd)
+#endif
+
 static inline uint8_t __gas_read8(struct switchtec_dev *dev,
 				  uint8_t __gas *addr)
 {
-	return dev->ops->gas_read8(dev, addr);
+	uint64_t val;
+
+	if (dev->gas_cache && !gas_cache_read(dev, addr, sizeof(*addr), &val))
+		return val;
+
+	platform_trace_gas_read(dev, addr, sizeof(*addr),
+		val = platform_gas_op(dev, gas_read8)(dev, addr));
+	return val;
 }
 
 static inline uint16_t __gas_read16(struct switchtec_dev *dev,
 				    uint16_t __gas *addr)
 {
-	return dev->ops->gas_read16(dev, addr);
+	uint64_t val;
+
+	if (dev->gas_cache && !gas_cache_read(dev, addr, sizeof(*addr), &val))
+		return val;
+
+	platform_trace_gas_read(dev, addr, sizeof(*addr),
+		val = platform_gas_op(dev, gas_read16)(dev, addr));
+	return val;
 }
 
 static inline uint32_t __gas_read32(struct switchtec_dev *dev,
 				    uint32_t __gas *addr)
 {
-	return dev->ops->gas_read32(dev, addr);
+	uint64_t val;
+
+	if (dev->gas_cache && !gas_cache_read(dev, addr, sizeof(*addr), &val))
+		return val;
+
+	platform_trace_gas_read(dev, addr, sizeof(*addr),
+		val = platform_gas_op(dev, gas_read32)(dev, addr));
+	return val;
 }
 
 static inline uint64_t __gas_read64(struct switchtec_dev *dev,
 				    uint64_t __gas *addr)
 {
-	return dev->ops->gas_read64(dev, addr);
+	uint64_t val;
+
+	if (dev->gas_cache && !gas_cache_read(dev, addr, sizeof(*addr), &val))
+		return val;
+
+	platform_trace_gas_read(dev, addr, sizeof(*addr),
+		val = platform_gas_op(dev, gas_read64)(dev, addr));
+	return val;
 }
 
 static inline void __gas_write8(struct switchtec_dev *dev, uint8_t val,
 				uint8_t __gas *addr)
 {
-	dev->ops->gas_write8(dev, val, addr);
+	platform_trace_gas_write(dev, addr, sizeof(*addr),
+		platform_gas_op(dev, gas_write8)(dev, val, addr));
+	if (dev->gas_cache)
+		gas_cache_write(dev, addr, sizeof(*addr), val);
 }
 
 static inline void __gas_write16(struct switchtec_dev *dev, uint16_t val,
 				 uint16_t __gas *addr)
 {
-	dev->ops->gas_write16(dev, val, addr);
+	platform_trace_gas_write(dev, addr, sizeof(*addr),
+		platform_gas_op(dev, gas_write16)(dev, val, addr));
+	if (dev->gas_cache)
+		gas_cache_write(dev, addr, sizeof(*addr), val);
 }
 
 static inline void __gas_write32(struct switchtec_dev *dev, uint32_t val,
 				 uint32_t __gas *addr)
 {
-	dev->ops->gas_write32(dev, val, addr);
+	platform_trace_gas_write(dev, addr, sizeof(*addr),
+		platform_gas_op(dev, gas_write32)(dev, val, addr));
+	if (dev->gas_cache)
+		gas_cache_write(dev, addr, sizeof(*addr), val);
 }
 
 static inline void __gas_write32_no_retry(struct switchtec_dev *dev,
 					  uint32_t val,
 					  uint32_t __gas *addr)
 {
-	dev->ops->gas_write32_no_retry(dev, val, addr);
+	platform_trace_gas_write(dev, addr, sizeof(*addr),
+		platform_gas_op(dev, gas_write32_no_retry)(dev, val, addr));
+	if (dev->gas_cache)
+		gas_cache_write(dev, addr, sizeof(*addr), val);
 }
 
 static inline void __gas_write64(struct switchtec_dev *dev, uint64_t val,
 				 uint64_t __gas *addr)
 {
-	dev->ops->gas_write64(dev, val, addr);
+	platform_trace_gas_write(dev, addr, sizeof(*addr),
+		platform_gas_op(dev, gas_write64)(dev, val, addr));
+	if (dev->gas_cache)
+		gas_cache_write(dev, addr, sizeof(*addr), val);
 }
 
 static inline void __memcpy_to_gas(struct switchtec_dev *dev, void __gas *dest,
 		   const void *src, size_t n)
 {
-	dev->ops->memcpy_to_gas(dev, dest, src, n);
+	platform_trace_gas_write(dev, dest, n,
+		platform_gas_op(dev, memcpy_to_gas)(dev, dest, src, n));
+	if (dev->gas_cache)
+		gas_cache_memcpy_to(dev, dest, src, n);
 }
 
 static inline void __memcpy_from_gas(struct switchtec_dev *dev, void *dest,
 		     const void __gas *src, size_t n)
 {
-	dev->ops->memcpy_from_gas(dev, dest, src, n);
+	if (dev->gas_cache && !gas_cache_memcpy_from(dev, dest, src, n))
+		return;
+
+	platform_trace_gas_read(dev, src, n,
+		platform_gas_op(dev, memcpy_from_gas)(dev, dest, src, n));
 }
 
 static inline ssize_t __write_from_gas(struct switchtec_dev *dev, int fd,
 		       const void __gas *src, size_t n)
 {
-	return dev->ops->write_from_gas(dev, fd, src, n);
+	ssize_t ret;
+
+	platform_trace_gas_read(dev, src, n,
+		ret = platform_gas_op(dev, write_from_gas)(dev, fd, src, n));
+	return ret;
 }
 
 #endif